@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-02-01 09:34:01
- * @LastEditTime: 2024-04-25 20:31:03
+ * @LastEditTime: 2024-06-02 09:40:15
  * @Description: base class of the abstract layer interface
  */
 
@@ -134,6 +134,75 @@ struct _ALViBaseContext {
   ALBaseContext stAlBaseContext;
 };
 
+#define AL_PLUGIN_CAPS_VERSION 1
+
+/***
+ * bit of a MppFrameBufferType in ALPluginCaps.nMemoryModes
+ */
+#define AL_PLUGIN_MEMORY_MODE(type) (1U << (type))
+
+/***
+ * @description: what a codec plugin can do, returned by the exported
+ * al_plugin_get_caps() of the library, so the module registry can pick a
+ * backend per codec without opening a channel. The arrays are static data
+ * of the plugin, valid while the library is loaded.
+ */
+typedef struct _ALPluginCaps {
+  /***
+   * AL_PLUGIN_CAPS_VERSION, a registry ignores versions it does not know
+   */
+  U32 nVersion;
+  MppModuleType eModuleType;
+  const MppCodingType *pDecoderCodingTypes;
+  S32 nDecoderCodingTypeNum;
+  const MppCodingType *pEncoderCodingTypes;
+  S32 nEncoderCodingTypeNum;
+
+  /***
+   * output formats of the decoder and input formats of the encoder, an
+   * empty list does not limit the format
+   */
+  const MppPixelFormat *pPixelFormats;
+  S32 nPixelFormatNum;
+
+  /***
+   * 0 if the backend does not tell (the device decides at init)
+   */
+  S32 nMaxWidth;
+  S32 nMaxHeight;
+
+  /***
+   * AL_PLUGIN_MEMORY_MODE() bits of the supported MppFrameBufferType
+   */
+  U32 nMemoryModes;
+
+  /***
+   * channels that can run at the same time, 0 if not limited
+   */
+  S32 nMaxInstances;
+
+  /***
+   * relative cost of a channel, the lowest one that can do the job is
+   * picked: hardware about 10, software about 100, debug plugins 1000
+   */
+  S32 nCost;
+} ALPluginCaps;
+
+/***
+ * @description: exported by a codec plugin that describes itself
+ * @return {*}: the static descriptor of the library
+ */
+const ALPluginCaps *al_plugin_get_caps();
+
+/***
+ * @description: exported by a codec plugin that runs on a device, the caps
+ * say what the plugin can map and this says whether the device for it is
+ * there now, the registry does not pick a plugin that says no. A plugin
+ * without it is taken as always able.
+ * @return {*}: MPP_TRUE if a channel of the coding type can be opened
+ */
+BOOL al_plugin_probe(MppCodingType coding_type, BOOL encoder);
+
 #ifdef __cplusplus
 };
 #endif
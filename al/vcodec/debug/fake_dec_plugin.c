@@ -5,8 +5,10 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-17 09:38:36
- * @LastEditTime: 2023-12-13 20:13:57
- * @Description: video decode plugin for fake test
+ * @LastEditTime: 2024-06-02 10:05:33
+ * @Description: video decode plugin for fake test, with
+ *               MPP_FAKEDEC_DELAY_US > 0 a frame is done that long after
+ *               its packet by a thread of the plugin, like a device.
  */
 
 #define ENABLE_DEBUG 1
@@ -25,7 +27,9 @@
 #include <unistd.h>
 
 #include "al_interface_dec.h"
+#include "env.h"
 #include "log.h"
+#include "notify.h"
 
 #define MODULE_TAG "fake_dec"
 
@@ -45,6 +49,20 @@ struct _ALFakeDecContext {
   U32 gPacketNum;
   U32 rFrameNum;
   S32 DecRetEos;
+
+  /***
+   * MPP_FAKEDEC_DELAY_US, 0 if the frame is done in al_dec_decode. Else
+   * stDeviceThread marks the frames done (nDoneNum) and makes nDeviceFd
+   * readable, as the capture queue of a V4L2 device, nOutputEventFd is not
+   * signalled for them. Guarded by stMutex.
+   */
+  U32 nDelayUs;
+  U32 nDoneNum;
+  S32 nDeviceFd;
+  BOOL bExit;
+  pthread_t stDeviceThread;
+  pthread_mutex_t stMutex;
+  pthread_cond_t stCond;
 };
 
 ALBaseContext *al_dec_create() {
@@ -52,9 +70,33 @@ ALBaseContext *al_dec_create() {
       (ALFakeDecContext *)malloc(sizeof(ALFakeDecContext));
   if (!context) return NULL;
 
+  memset(context, 0, sizeof(ALFakeDecContext));
+  context->nDeviceFd = -1;
+
   return &(context->stAlDecBaseContext.stAlBaseContext);
 }
 
+static void *run_device(void *private_data) {
+  ALFakeDecContext *context = (ALFakeDecContext *)private_data;
+
+  pthread_mutex_lock(&context->stMutex);
+  while (!context->bExit) {
+    if (context->nDoneNum >= context->gPacketNum) {
+      pthread_cond_wait(&context->stCond, &context->stMutex);
+      continue;
+    }
+
+    pthread_mutex_unlock(&context->stMutex);
+    usleep(context->nDelayUs);
+    pthread_mutex_lock(&context->stMutex);
+    context->nDoneNum++;
+    mpp_notify_signal(context->nDeviceFd);
+  }
+  pthread_mutex_unlock(&context->stMutex);
+
+  return NULL;
+}
+
 RETURN al_dec_init(ALBaseContext *ctx, MppVdecPara *para) {
   if (!ctx || !para) return MPP_NULL_POINTER;
 
@@ -77,7 +119,24 @@ RETURN al_dec_init(ALBaseContext *ctx, MppVdecPara *para) {
 
   context->nMagicColor = 255;
 
-  debug("init finish");
+  mpp_env_get_u32("MPP_FAKEDEC_DELAY_US", &context->nDelayUs, 0);
+  context->nDoneNum = 0;
+  context->bExit = MPP_FALSE;
+  pthread_mutex_init(&context->stMutex, NULL);
+  pthread_cond_init(&context->stCond, NULL);
+  if (context->nDelayUs) {
+    context->nDeviceFd = mpp_notify_create();
+    if (context->nDeviceFd < 0 ||
+        pthread_create(&context->stDeviceThread, NULL, run_device, context)) {
+      error("can not start the fake device, please check!");
+      mpp_notify_destory(context->nDeviceFd);
+      context->nDeviceFd = -1;
+      return MPP_INIT_FAILED;
+    }
+    para->nOutputPollFd = context->nDeviceFd;
+  }
+
+  debug("init finish, delay %u us", context->nDelayUs);
 
   return MPP_OK;
 }
@@ -93,11 +152,19 @@ S32 al_dec_decode(ALBaseContext *ctx, MppData *sink_data) {
   context = (ALFakeDecContext *)ctx;
   packet = PACKET_GetPacket(sink_data);
 
+  pthread_mutex_lock(&context->stMutex);
   if (PACKET_GetEos(packet)) {
     context->DecRetEos = MPP_TRUE;
   } else {
     context->gPacketNum++;
   }
+  if (!context->nDelayUs) context->nDoneNum = context->gPacketNum;
+  pthread_cond_signal(&context->stCond);
+  pthread_mutex_unlock(&context->stMutex);
+
+  // the frame of the packet is done later, the device fd tells it
+  if (!context->nDelayUs)
+    mpp_notify_signal(context->pVdecPara->nOutputEventFd);
 
   return 0;
 }
@@ -106,17 +173,25 @@ S32 al_dec_request_output_frame(ALBaseContext *ctx, MppData *src_data) {
   ALFakeDecContext *context;
   MppDataQueueNode *node;
   static U32 count = 0;
+  BOOL eos;
+  U32 done;
 
   if (!ctx) return MPP_NULL_POINTER;
 
   context = (ALFakeDecContext *)ctx;
 
-  if (!context->DecRetEos && context->rFrameNum >= context->gPacketNum) {
-    usleep(500);
+  // dequeue, the fd is readable again when the next frame is done
+  mpp_notify_clear(context->nDeviceFd);
+  pthread_mutex_lock(&context->stMutex);
+  done = context->nDoneNum;
+  eos = context->DecRetEos && done >= context->gPacketNum;
+  pthread_mutex_unlock(&context->stMutex);
+
+  if (!eos && context->rFrameNum >= done) {
     return MPP_CODER_NO_DATA;
   }
 
-  if (context->DecRetEos && context->rFrameNum >= context->gPacketNum) {
+  if (eos && context->rFrameNum >= done) {
     return MPP_CODER_EOS;
   }
 
@@ -163,13 +238,54 @@ S32 al_dec_return_output_frame(ALBaseContext *ctx, MppData *src_data) {
 
   context->bIsFrameUsed[FRAME_GetID(frame)] = MPP_FALSE;
   error("------------------------------------return id %d", FRAME_GetID(frame));
+  mpp_notify_signal(context->pVdecPara->nOutputEventFd);
 
   return 0;
 }
 
 void al_dec_destory(ALBaseContext *ctx) {
   ALFakeDecContext *context = (ALFakeDecContext *)ctx;
+
+  if (context->nDeviceFd >= 0) {
+    pthread_mutex_lock(&context->stMutex);
+    context->bExit = MPP_TRUE;
+    pthread_cond_signal(&context->stCond);
+    pthread_mutex_unlock(&context->stMutex);
+    pthread_join(context->stDeviceThread, NULL);
+    mpp_notify_destory(context->nDeviceFd);
+    context->nDeviceFd = -1;
+  }
   for (S32 i = 0; i < NUM_OF_FRAMES; i++) {
     free(context->pOutputFrame[i]);
   }
 }
+
+/**
+ * the fake codecs do not parse the data, they say what the tests use, the
+ * library has fake_enc_plugin.c too
+ */
+static const MppCodingType stFakeDecCodingTypes[] = {
+    CODING_H264, CODING_H265, CODING_MJPEG, CODING_VP8, CODING_VP9,
+};
+
+static const MppCodingType stFakeEncCodingTypes[] = {
+    CODING_H264,
+    CODING_H265,
+};
+
+static const ALPluginCaps stFakeCaps = {
+    .nVersion = AL_PLUGIN_CAPS_VERSION,
+    .eModuleType = CODEC_FAKEDEC,
+    .pDecoderCodingTypes = stFakeDecCodingTypes,
+    .nDecoderCodingTypeNum = NUM_OF(stFakeDecCodingTypes),
+    .pEncoderCodingTypes = stFakeEncCodingTypes,
+    .nEncoderCodingTypeNum = NUM_OF(stFakeEncCodingTypes),
+    .nMaxWidth = 8192,
+    .nMaxHeight = 8192,
+    .nMemoryModes =
+        AL_PLUGIN_MEMORY_MODE(MPP_FRAME_BUFFERTYPE_NORMAL_INTERNAL),
+    .nMaxInstances = 0,
+    .nCost = 1000,
+};
+
+const ALPluginCaps *al_plugin_get_caps() { return &stFakeCaps; }
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-20 14:22:17
+ * @LastEditTime: 2024-05-20 16:40:02
+ * @Description: video encode plugin for fake test, every input frame produces
+ *               a small packet holding the head of the frame's first plane.
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "al_interface_enc.h"
+#include "log.h"
+#include "notify.h"
+
+#define MODULE_TAG "fake_enc"
+
+#define NUM_OF_PACKETS 5
+#define FAKE_PACKET_SIZE 64
+
+typedef struct _ALFakeEncContext ALFakeEncContext;
+
+struct _ALFakeEncContext {
+  ALEncBaseContext stAlEncBaseContext;
+  MppVencPara *pVencPara;
+  U8 pStream[NUM_OF_PACKETS][FAKE_PACKET_SIZE];
+  S64 nPts[NUM_OF_PACKETS];
+
+  /***
+   * packets are produced at nWriteNum and consumed at nReadNum.
+   */
+  U32 nWriteNum;
+  U32 nReadNum;
+  pthread_mutex_t sMutex;
+};
+
+ALBaseContext *al_enc_create() {
+  ALFakeEncContext *context =
+      (ALFakeEncContext *)malloc(sizeof(ALFakeEncContext));
+  if (!context) return NULL;
+
+  memset(context, 0, sizeof(ALFakeEncContext));
+  pthread_mutex_init(&context->sMutex, NULL);
+
+  return &(context->stAlEncBaseContext.stAlBaseContext);
+}
+
+RETURN al_enc_init(ALBaseContext *ctx, MppVencPara *para) {
+  if (!ctx || !para) return MPP_NULL_POINTER;
+
+  ALFakeEncContext *context = (ALFakeEncContext *)ctx;
+
+  context->pVencPara = para;
+  context->nWriteNum = 0;
+  context->nReadNum = 0;
+
+  debug("init finish");
+
+  return MPP_OK;
+}
+
+S32 al_enc_set_para(ALBaseContext *ctx, MppVencPara *para) {
+  if (!ctx || !para) return MPP_NULL_POINTER;
+
+  return MPP_OK;
+}
+
+S32 al_enc_encode(ALBaseContext *ctx, MppData *sink_data) {
+  ALFakeEncContext *context;
+  MppFrame *frame = NULL;
+  U8 *data = NULL;
+  S32 index = 0;
+
+  if (!ctx || !sink_data) return MPP_NULL_POINTER;
+
+  context = (ALFakeEncContext *)ctx;
+  frame = FRAME_GetFrame(sink_data);
+
+  pthread_mutex_lock(&context->sMutex);
+  if (context->nWriteNum - context->nReadNum >= NUM_OF_PACKETS) {
+    pthread_mutex_unlock(&context->sMutex);
+    return MPP_DATAQUEUE_FULL;
+  }
+
+  index = context->nWriteNum % NUM_OF_PACKETS;
+  data = (U8 *)FRAME_GetDataPointer(frame, 0);
+  if (data)
+    memcpy(context->pStream[index], data, FAKE_PACKET_SIZE);
+  else
+    memset(context->pStream[index], 0, FAKE_PACKET_SIZE);
+  context->nPts[index] = FRAME_GetPts(frame);
+  context->nWriteNum++;
+  pthread_mutex_unlock(&context->sMutex);
+
+  mpp_notify_signal(context->pVencPara->nOutputEventFd);
+
+  return MPP_OK;
+}
+
+S32 al_enc_request_output_stream(ALBaseContext *ctx, MppData *src_data) {
+  ALFakeEncContext *context;
+  MppPacket *packet = NULL;
+  S32 index = 0;
+
+  if (!ctx || !src_data) return MPP_NULL_POINTER;
+
+  context = (ALFakeEncContext *)ctx;
+  packet = PACKET_GetPacket(src_data);
+
+  pthread_mutex_lock(&context->sMutex);
+  if (context->nWriteNum == context->nReadNum) {
+    pthread_mutex_unlock(&context->sMutex);
+    return MPP_CODER_NO_DATA;
+  }
+
+  index = context->nReadNum % NUM_OF_PACKETS;
+  PACKET_SetDataPointer(packet, context->pStream[index]);
+  PACKET_SetLength(packet, FAKE_PACKET_SIZE);
+  PACKET_SetPts(packet, context->nPts[index]);
+  context->nReadNum++;
+  pthread_mutex_unlock(&context->sMutex);
+
+  return MPP_OK;
+}
+
+S32 al_enc_get_output_stream(ALBaseContext *ctx, MppData *src_data) {
+  return al_enc_request_output_stream(ctx, src_data);
+}
+
+S32 al_enc_return_output_stream(ALBaseContext *ctx, MppData *src_data) {
+  if (!ctx || !src_data) return MPP_NULL_POINTER;
+
+  return MPP_OK;
+}
+
+S32 al_enc_flush(ALBaseContext *ctx) {
+  if (!ctx) return MPP_NULL_POINTER;
+
+  ALFakeEncContext *context = (ALFakeEncContext *)ctx;
+
+  pthread_mutex_lock(&context->sMutex);
+  context->nReadNum = context->nWriteNum;
+  pthread_mutex_unlock(&context->sMutex);
+
+  return MPP_OK;
+}
+
+void al_enc_destory(ALBaseContext *ctx) {
+  ALFakeEncContext *context = (ALFakeEncContext *)ctx;
+
+  if (!context) return;
+
+  pthread_mutex_destroy(&context->sMutex);
+  free(context);
+}
@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-17 09:38:36
- * @LastEditTime: 2023-11-09 15:38:06
+ * @LastEditTime: 2024-06-02 11:14:37
  * @Description: video decode plugin for ffmpeg
  */
 
@@ -20,6 +20,7 @@
 #include "libavcodec/avcodec.h"
 #include "libavutil/pixfmt.h"
 #include "log.h"
+#include "notify.h"
 
 #define MODULE_TAG "ffmpegdec"
 
@@ -28,7 +29,14 @@
 PIXEL_FORMAT_MAPPING_DEFINE(FFMpegDec, enum AVPixelFormat)
 static const ALFFMpegDecPixelFormatMapping stALFFMpegDecPixelFormatMapping[] = {
     {PIXEL_FORMAT_I420, AV_PIX_FMT_YUV420P},
+    {PIXEL_FORMAT_I420, AV_PIX_FMT_YUVJ420P},
     {PIXEL_FORMAT_NV12, AV_PIX_FMT_NV12},
+    {PIXEL_FORMAT_NV21, AV_PIX_FMT_NV21},
+    {PIXEL_FORMAT_NV12_P010, AV_PIX_FMT_P010LE},
+    {PIXEL_FORMAT_YUV422P, AV_PIX_FMT_YUV422P},
+    {PIXEL_FORMAT_YUV422P, AV_PIX_FMT_YUVJ422P},
+    {PIXEL_FORMAT_YUV444P, AV_PIX_FMT_YUV444P},
+    {PIXEL_FORMAT_YUV444P, AV_PIX_FMT_YUVJ444P},
     {PIXEL_FORMAT_YVYU, AV_PIX_FMT_YVYU422},
     {PIXEL_FORMAT_UYVY, AV_PIX_FMT_UYVY422},
     {PIXEL_FORMAT_YUYV, AV_PIX_FMT_YUYV422},
@@ -57,6 +65,23 @@ CODING_TYPE_MAPPING_CONVERT(FFMpegDec, ffmpegdec, enum AVCodecID)
 
 typedef struct _ALFFMpegDecContext ALFFMpegDecContext;
 
+/***
+ * one decoded AVFrame lent to the caller through its MppFrame, the caller's
+ * own planes are kept here and put back when the frame is released.
+ */
+typedef struct _ALFFMpegDecLend {
+  AVFrame *pAvFrame;
+  S32 nLentPlanes;
+  U8 *pOwnedData[MPP_MAX_PLANES];
+  S32 nOwnedDataUsedNum;
+  MppFrameBufferType eOwnedBufferType;
+  // what the caller's planes were made for, checked before a copy into them
+  MppPixelFormat eOwnedFormat;
+  S32 nOwnedWidth;
+  S32 nOwnedHeight;
+  S32 nOwnedLineStride;
+} ALFFMpegDecLend;
+
 struct _ALFFMpegDecContext {
   ALDecBaseContext stAlDecBaseContext;
   const AVCodec *pCodec;
@@ -64,6 +89,12 @@ struct _ALFFMpegDecContext {
   AVFrame *pFrame;
   AVPacket *pPacket;
   U8 pInputBuf[INBUF_SIZE + AV_INPUT_BUFFER_PADDING_SIZE];
+
+  /***
+   * nOutputEventFd of MppVdecPara, signaled when a packet is taken, a frame
+   * can be received then.
+   */
+  S32 nOutputEventFd;
 };
 
 ALBaseContext *al_dec_create() {
@@ -83,11 +114,44 @@ ALBaseContext *al_dec_create() {
   return &(context->stAlDecBaseContext.stAlBaseContext);
 }
 
+/**
+ * @description: apply the threading asked in para before avcodec_open2,
+ * libavcodec falls back to what the codec supports by itself.
+ */
+static void set_threading(AVCodecContext *codec_context, const AVCodec *codec,
+                          MppVdecPara *para) {
+  // 0 is "auto" for libavcodec, in MPP it keeps the old single thread
+  if (para->nThreadCount == MPP_THREAD_COUNT_AUTO)
+    codec_context->thread_count = 0;
+  else if (para->nThreadCount > 0)
+    codec_context->thread_count = para->nThreadCount;
+  else
+    codec_context->thread_count = 1;
+
+  switch (para->eThreadType) {
+    case CODEC_THREAD_FRAME:
+      codec_context->thread_type = FF_THREAD_FRAME;
+      break;
+    case CODEC_THREAD_SLICE:
+      codec_context->thread_type = FF_THREAD_SLICE;
+      break;
+    case CODEC_THREAD_AUTO:
+    default:
+      codec_context->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+      break;
+  }
+
+  if ((codec_context->thread_type & FF_THREAD_FRAME) &&
+      !(codec->capabilities & AV_CODEC_CAP_FRAME_THREADS))
+    info("%s has no frame threads, at most slice threads", codec->name);
+}
+
 RETURN al_dec_init(ALBaseContext *ctx, MppVdecPara *para) {
   if (!ctx) return MPP_NULL_POINTER;
 
   ALFFMpegDecContext *context = (ALFFMpegDecContext *)ctx;
 
+  context->nOutputEventFd = para->nOutputEventFd;
   context->pCodec =
       avcodec_find_decoder(get_ffmpegdec_codec_coding_type(para->eCodingType));
   if (!context->pCodec) {
@@ -113,12 +177,25 @@ RETURN al_dec_init(ALBaseContext *ctx, MppVdecPara *para) {
     return MPP_NULL_POINTER;
   }
 
+  set_threading(context->pCodecContext, context->pCodec, para);
+
   if (avcodec_open2(context->pCodecContext, context->pCodec, NULL) < 0) {
     error("Could not open codec, please check");
     return MPP_NULL_POINTER;
   }
 
-  debug("init finish");
+  // report what libavcodec really uses, auto count is resolved by open
+  para->nThreadCount = context->pCodecContext->thread_count;
+  if (context->pCodecContext->active_thread_type & FF_THREAD_FRAME)
+    para->eThreadType = CODEC_THREAD_FRAME;
+  else if (context->pCodecContext->active_thread_type & FF_THREAD_SLICE)
+    para->eThreadType = CODEC_THREAD_SLICE;
+  else
+    para->eThreadType = CODEC_THREAD_AUTO;
+
+  info("init finish, %s, %d threads, active thread type %d",
+       context->pCodec->name, para->nThreadCount,
+       context->pCodecContext->active_thread_type);
 
   return MPP_OK;
 }
@@ -132,92 +209,309 @@ S32 al_dec_decode(ALBaseContext *ctx, MppData *sink_data) {
 
   context->pPacket->data = PACKET_GetDataPointer(sink_packet);
   context->pPacket->size = PACKET_GetLength(sink_packet);
-  debug("head:%x %x %x %x", context->pPacket->data[0],
-        context->pPacket->data[1], context->pPacket->data[2],
-        context->pPacket->data[3]);
 
-  do {
+  // with frame threads the decoder holds several packets, it only takes
+  // more after frames are received, so give it back instead of spinning
+  if (context->pPacket->size > 0) {
+    debug("head:%x %x %x %x", context->pPacket->data[0],
+          context->pPacket->data[1], context->pPacket->data[2],
+          context->pPacket->data[3]);
     ret = avcodec_send_packet(context->pCodecContext, context->pPacket);
-  } while (AVERROR(EAGAIN) == ret);
+    if (AVERROR(EAGAIN) == ret) return MPP_DATAQUEUE_FULL;
 
-  if (ret < 0) {
-    error("Error sending a packet for decoding %d", ret);
-    return 1;
+    if (ret < 0) {
+      error("Error sending a packet for decoding %d", ret);
+      return 1;
+    }
+    av_packet_unref(context->pPacket);
   }
 
-  av_packet_unref(context->pPacket);
+  // drain: receive_frame gives the frames held and then AVERROR_EOF
+  if (PACKET_GetEos(sink_packet)) {
+    ret = avcodec_send_packet(context->pCodecContext, NULL);
+    if (ret < 0 && AVERROR_EOF != ret)
+      error("Error sending the end of stream %d", ret);
+  }
+  mpp_notify_signal(context->nOutputEventFd);
 
   return 0;
 }
 
+/**
+ * @description: number of planes and the vertical chroma subsampling of the
+ * formats that can be lent without copy.
+ * @return {*}: planes, 0 if the format can not be lent
+ */
+static S32 get_plane_layout(MppPixelFormat format, S32 *chroma_shift_h,
+                            S32 *chroma_shift_v) {
+  *chroma_shift_h = 1;
+  *chroma_shift_v = 1;
+  switch (format) {
+    case PIXEL_FORMAT_I420:
+      return 3;
+    case PIXEL_FORMAT_YUV422P:
+      *chroma_shift_v = 0;
+      return 3;
+    case PIXEL_FORMAT_YUV444P:
+      *chroma_shift_h = 0;
+      *chroma_shift_v = 0;
+      return 3;
+    case PIXEL_FORMAT_NV12:
+    case PIXEL_FORMAT_NV21:
+    case PIXEL_FORMAT_NV12_P010:
+      *chroma_shift_h = 0;
+      return 2;
+    default:
+      return 0;
+  }
+}
+
+/**
+ * @description: MppFrame keeps one line stride, the planes of the AVFrame
+ * must follow it (true for the frames of libavcodec's default allocator).
+ */
+static BOOL is_stride_compatible(AVFrame *av_frame, S32 planes,
+                                 S32 chroma_shift_h) {
+  S32 i;
+
+  for (i = 1; i < planes; i++) {
+    if (av_frame->linesize[i] != av_frame->linesize[0] >> chroma_shift_h)
+      return MPP_FALSE;
+  }
+
+  return MPP_TRUE;
+}
+
+/**
+ * @description: keep the caller's planes of the frame in the lend
+ */
+static void save_owned_planes(ALFFMpegDecLend *lend, MppFrame *frame) {
+  S32 i;
+
+  lend->eOwnedBufferType = FRAME_GetBufferType(frame);
+  lend->nOwnedDataUsedNum = FRAME_GetDataUsedNum(frame);
+  lend->eOwnedFormat = FRAME_GetPixelFormat(frame);
+  lend->nOwnedWidth = FRAME_GetWidth(frame);
+  lend->nOwnedHeight = FRAME_GetHeight(frame);
+  lend->nOwnedLineStride = FRAME_GetLineStride(frame);
+  for (i = 0; i < lend->nOwnedDataUsedNum && i < MPP_MAX_PLANES; i++)
+    lend->pOwnedData[i] = FRAME_GetDataPointer(frame, i);
+}
+
+/**
+ * @description: put back (or clear) every plane that was overwritten, then
+ * the count and what the planes were made for, the AVFrame stays in the lend.
+ */
+static void restore_owned_planes(ALFFMpegDecLend *lend, MppFrame *frame) {
+  S32 i;
+
+  FRAME_SetBufferType(frame, lend->eOwnedBufferType);
+  for (i = 0; i < lend->nLentPlanes; i++)
+    FRAME_SetDataPointer(frame, i, lend->pOwnedData[i]);
+  FRAME_SetDataUsedNum(frame, lend->nOwnedDataUsedNum);
+  FRAME_SetPixelFormat(frame, lend->eOwnedFormat);
+  FRAME_SetWidth(frame, lend->nOwnedWidth);
+  FRAME_SetHeight(frame, lend->nOwnedHeight);
+  FRAME_SetLineStride(frame, lend->nOwnedLineStride);
+}
+
+/**
+ * @description: called when the last reference of the lent frame is
+ * dropped, give the AVFrame back to libavcodec and restore the caller's
+ * planes.
+ */
+static void release_lent_frame(MppFrame *frame, void *opaque) {
+  ALFFMpegDecLend *lend = (ALFFMpegDecLend *)opaque;
+
+  restore_owned_planes(lend, frame);
+  av_frame_free(&(lend->pAvFrame));
+  free(lend);
+}
+
+static S32 lend_frame(ALFFMpegDecContext *context, MppFrame *frame,
+                      MppPixelFormat format, S32 planes) {
+  ALFFMpegDecLend *lend = (ALFFMpegDecLend *)malloc(sizeof(ALFFMpegDecLend));
+  S32 i;
+
+  if (!lend) {
+    error("can not malloc ALFFMpegDecLend, please check!");
+    return MPP_MALLOC_FAILED;
+  }
+  memset(lend, 0, sizeof(ALFFMpegDecLend));
+
+  lend->pAvFrame = av_frame_alloc();
+  if (!lend->pAvFrame) {
+    error("can not alloc AVFrame, please check!");
+    free(lend);
+    return MPP_MALLOC_FAILED;
+  }
+  // take over the buffer references, context->pFrame is reset for the next
+  av_frame_move_ref(lend->pAvFrame, context->pFrame);
+
+  lend->nLentPlanes = planes;
+  save_owned_planes(lend, frame);
+
+  FRAME_SetBufferType(frame, MPP_FRAME_BUFFERTYPE_NORMAL_EXTERNAL);
+  FRAME_SetDataUsedNum(frame, planes);
+  for (i = 0; i < planes; i++)
+    FRAME_SetDataPointer(frame, i, lend->pAvFrame->data[i]);
+  FRAME_SetWidth(frame, lend->pAvFrame->width);
+  FRAME_SetHeight(frame, lend->pAvFrame->height);
+  FRAME_SetPixelFormat(frame, format);
+  FRAME_SetLineStride(frame, lend->pAvFrame->linesize[0]);
+  FRAME_SetReleaseCallback(frame, release_lent_frame, lend);
+  // the caller's reference, dropped in al_dec_return_output_frame
+  if (!FRAME_GetRef(frame)) FRAME_Ref(frame);
+
+  return MPP_OK;
+}
+
+/**
+ * @description: the planes of the frame can take the decoded picture only if
+ * they were made for its format and at least its size.
+ */
+static BOOL is_frame_fit(MppFrame *frame, MppPixelFormat format, S32 width,
+                         S32 height) {
+  return FRAME_GetPixelFormat(frame) == format &&
+         FRAME_GetWidth(frame) >= width && FRAME_GetHeight(frame) >= height;
+}
+
+/**
+ * @description: fallback when the AVFrame can not be lent, copy it row by
+ * row into the caller's (packed) planes. The planes the caller gave must fit
+ * the picture, the ones MPP allocated are allocated again when not.
+ */
+static S32 copy_frame(ALFFMpegDecContext *context, MppFrame *frame,
+                      MppPixelFormat format, S32 planes, S32 chroma_shift_h,
+                      S32 chroma_shift_v) {
+  AVFrame *av_frame = context->pFrame;
+  S32 bytes = PIXEL_FORMAT_NV12_P010 == format ? 2 : 1;
+  S32 width, height, i, j;
+  U8 *dst, *src;
+  S32 ret;
+
+  if (FRAME_GetDataPointer(frame, 0) &&
+      !is_frame_fit(frame, format, av_frame->width, av_frame->height)) {
+    // FRAME_Free keeps the planes of a pooled frame
+    if (MPP_FRAME_BUFFERTYPE_NORMAL_INTERNAL != FRAME_GetBufferType(frame) ||
+        FRAME_Free(frame) || FRAME_GetDataPointer(frame, 0)) {
+      error("the frame (%s %dx%d) can not take a %s %dx%d picture, "
+            "please check!",
+            mpp_pixelformat2str(FRAME_GetPixelFormat(frame)),
+            FRAME_GetWidth(frame), FRAME_GetHeight(frame),
+            mpp_pixelformat2str(format), av_frame->width, av_frame->height);
+      av_frame_unref(av_frame);
+      return MPP_CHECK_FAILED;
+    }
+  }
+
+  if (!FRAME_GetDataPointer(frame, 0)) {
+    ret = FRAME_Alloc(frame, format, av_frame->width, av_frame->height);
+    if (ret) {
+      av_frame_unref(av_frame);
+      return ret;
+    }
+  }
+
+  FRAME_SetWidth(frame, av_frame->width);
+  FRAME_SetHeight(frame, av_frame->height);
+  FRAME_SetPixelFormat(frame, format);
+  // bytes, as the lent frames
+  FRAME_SetLineStride(frame, av_frame->width * bytes);
+
+  for (i = 0; i < planes; i++) {
+    width = (i ? av_frame->width >> chroma_shift_h : av_frame->width) * bytes;
+    height = i ? av_frame->height >> chroma_shift_v : av_frame->height;
+    // the interleaved uv plane carries both chroma samples in one row
+    if (planes == 2 && i) width = av_frame->width * bytes;
+
+    dst = (U8 *)FRAME_GetDataPointer(frame, i);
+    src = av_frame->data[i];
+    if (!dst) {
+      av_frame_unref(av_frame);
+      return MPP_NULL_POINTER;
+    }
+    for (j = 0; j < height; j++) {
+      memcpy(dst, src, width);
+      dst += width;
+      src += av_frame->linesize[i];
+    }
+  }
+
+  av_frame_unref(av_frame);
+
+  return MPP_OK;
+}
+
 S32 al_dec_request_output_frame(ALBaseContext *ctx, MppData *src_data) {
   if (!ctx) return MPP_NULL_POINTER;
 
   ALFFMpegDecContext *context = (ALFFMpegDecContext *)ctx;
   MppFrame *frame = FRAME_GetFrame(src_data);
-  U8 *tmp_pdata0;
-  U8 *tmp_pdata1;
-  U8 *tmp_pdata2;
+  ALFFMpegDecLend *lend = NULL;
+  MppPixelFormat format;
+  S32 planes, chroma_shift_h, chroma_shift_v;
   S32 ret = 0;
 
-  do {
-    ret = avcodec_receive_frame(context->pCodecContext, context->pFrame);
-  } while (AVERROR(EAGAIN) == ret);
-
-  if (AVERROR_EOF == ret) {
-    error("Get EOF");
-    return 1;
+  // a frame thread or the reorder delay may still hold it, ask again when
+  // more input is sent
+  ret = avcodec_receive_frame(context->pCodecContext, context->pFrame);
+  if (AVERROR(EAGAIN) == ret) {
+    return MPP_CODER_NO_DATA;
+  } else if (AVERROR_EOF == ret) {
+    debug("Get EOF");
+    return MPP_CODER_EOS;
   } else if (ret < 0) {
     error("Error during decoding");
     return 1;
   }
 
-  FRAME_SetWidth(frame, context->pFrame->width);
-  FRAME_SetHeight(frame, context->pFrame->height);
-  FRAME_SetLineStride(frame, context->pFrame->width);
-  FRAME_SetPixelFormat(frame,
-                       get_ffmpegdec_mpp_pixel_format(
-                           (enum AVPixelFormat)(context->pFrame->format)));
-  FRAME_SetPts(frame, context->pFrame->pts);
-
-  MppFrame *src_frame = FRAME_GetFrame(src_data);
-  if (!FRAME_GetDataPointer(src_frame, 0)) {
-    FRAME_Alloc(src_frame, FRAME_GetPixelFormat(frame),
-                context->pFrame->linesize[0], context->pFrame->height);
+  format = get_ffmpegdec_mpp_pixel_format(
+      (enum AVPixelFormat)(context->pFrame->format));
+  planes = get_plane_layout(format, &chroma_shift_h, &chroma_shift_v);
+  if (!planes) {
+    error("unsupported output format %d, please check!",
+          context->pFrame->format);
+    av_frame_unref(context->pFrame);
+    return MPP_NOT_SUPPORTED_FORMAT;
   }
 
-  tmp_pdata0 = (U8 *)FRAME_GetDataPointer(src_frame, 0);
-  tmp_pdata1 = (U8 *)FRAME_GetDataPointer(src_frame, 1);
-  tmp_pdata2 = (U8 *)FRAME_GetDataPointer(src_frame, 2);
+  FRAME_SetPts(frame, context->pFrame->pts);
 
   debug("---%d %d %d %d %d", context->pFrame->width, context->pFrame->height,
         context->pFrame->linesize[0], context->pFrame->linesize[1],
         context->pFrame->linesize[2]);
 
-  for (S32 i = 0; i < context->pFrame->height; i++) {
-    memcpy(tmp_pdata0, context->pFrame->data[0], context->pFrame->width);
-    tmp_pdata0 += context->pFrame->width;
-    context->pFrame->data[0] += context->pFrame->linesize[0];
-  }
-
-  for (S32 i = 0; i < context->pFrame->height / 2; i++) {
-    memcpy(tmp_pdata1, context->pFrame->data[1], context->pFrame->width / 2);
-    memcpy(tmp_pdata2, context->pFrame->data[2], context->pFrame->width / 2);
-    tmp_pdata1 += context->pFrame->width / 2;
-    tmp_pdata2 += context->pFrame->width / 2;
-    context->pFrame->data[1] += context->pFrame->linesize[0] / 2;
-    context->pFrame->data[2] += context->pFrame->linesize[0] / 2;
-  }
-
-  av_frame_unref(context->pFrame);
-
-  return 0;
+  // zero copy: the caller reads libavcodec's buffer until it returns it,
+  // a frame somebody else still holds (or still lent) is not lent again
+  lend = (ALFFMpegDecLend *)FRAME_GetReleaseOpaque(frame);
+  if (!lend && FRAME_GetRef(frame) <= 1 &&
+      is_stride_compatible(context->pFrame, planes, chroma_shift_h) &&
+      !lend_frame(context, frame, format, planes))
+    return 0;
+
+  // never copy into the lent AVFrame, it can be a reference picture: use
+  // the caller's planes, the release keeps them then
+  if (lend) restore_owned_planes(lend, frame);
+  ret = copy_frame(context, frame, format, planes, chroma_shift_h,
+                   chroma_shift_v);
+  if (lend) save_owned_planes(lend, frame);
+
+  return ret;
 }
 
 S32 al_dec_return_output_frame(ALBaseContext *ctx, MppData *src_data) {
   if (!ctx) return MPP_NULL_POINTER;
 
-  ALFFMpegDecContext *context = (ALFFMpegDecContext *)ctx;
+  MppFrame *frame = FRAME_GetFrame(src_data);
+
+  // not lent (copied), nothing to give back
+  if (!FRAME_GetReleaseOpaque(frame)) return 0;
+
+  // the release callback runs (and is cleared with its opaque) when the
+  // last reference is dropped, the caller's own reference is taken again so
+  // it can request the next one
+  if (FRAME_UnRef(frame) == 0) FRAME_Ref(frame);
 
   return 0;
 }
@@ -234,3 +528,40 @@ void al_dec_destory(ALBaseContext *ctx) {
   free(context);
   context = NULL;
 }
+
+/**
+ * descriptor of the whole ffmpegcodec library, ffmpegenc.c is in it too
+ */
+static const MppCodingType stFfmpegDecCodingTypes[] = {
+    CODING_H264, CODING_H265, CODING_MJPEG, CODING_VP8,
+    CODING_VP9,  CODING_AV1,  CODING_AVS,   CODING_AVS2,
+    CODING_MPEG1, CODING_MPEG2, CODING_MPEG4,
+};
+
+static const MppCodingType stFfmpegEncCodingTypes[] = {
+    CODING_H264, CODING_H265, CODING_VP8, CODING_VP9, CODING_MJPEG,
+};
+
+static const MppPixelFormat stFfmpegPixelFormats[] = {
+    PIXEL_FORMAT_I420,      PIXEL_FORMAT_NV12,    PIXEL_FORMAT_NV21,
+    PIXEL_FORMAT_NV12_P010, PIXEL_FORMAT_YUV422P, PIXEL_FORMAT_YUV444P,
+};
+
+static const ALPluginCaps stFfmpegCaps = {
+    .nVersion = AL_PLUGIN_CAPS_VERSION,
+    .eModuleType = CODEC_FFMPEG,
+    .pDecoderCodingTypes = stFfmpegDecCodingTypes,
+    .nDecoderCodingTypeNum = NUM_OF(stFfmpegDecCodingTypes),
+    .pEncoderCodingTypes = stFfmpegEncCodingTypes,
+    .nEncoderCodingTypeNum = NUM_OF(stFfmpegEncCodingTypes),
+    .pPixelFormats = stFfmpegPixelFormats,
+    .nPixelFormatNum = NUM_OF(stFfmpegPixelFormats),
+    .nMaxWidth = 8192,
+    .nMaxHeight = 8192,
+    .nMemoryModes =
+        AL_PLUGIN_MEMORY_MODE(MPP_FRAME_BUFFERTYPE_NORMAL_INTERNAL),
+    .nMaxInstances = 0,
+    .nCost = 100,
+};
+
+const ALPluginCaps *al_plugin_get_caps() { return &stFfmpegCaps; }
@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-17 09:38:36
- * @LastEditTime: 2023-10-19 16:51:35
+ * @LastEditTime: 2024-06-01 19:05:33
  * @Description: video encode plugin for ffmpeg
  */
 
@@ -21,19 +21,275 @@
 #include "al_interface_enc.h"
 #include "libavcodec/avcodec.h"
 #include "log.h"
+#include "notify.h"
 
 #define MODULE_TAG "ffmpegenc"
 
+/***
+ * caller pts of the frames inside the encoder, indexed by the frame number
+ * used as the libavcodec pts, larger than any encoder delay.
+ */
+#define FFMPEGENC_PTS_RING_SIZE 256
+
+/***
+ * ids of the frames copied by the encoder and not returned yet.
+ */
+#define FFMPEGENC_ID_RING_SIZE 64
+
+#define FFMPEGENC_DEFAULT_FRAMERATE 25
+
+PIXEL_FORMAT_MAPPING_DEFINE(FFMpegEnc, enum AVPixelFormat)
+static const ALFFMpegEncPixelFormatMapping stALFFMpegEncPixelFormatMapping[] = {
+    {PIXEL_FORMAT_I420, AV_PIX_FMT_YUV420P},
+    {PIXEL_FORMAT_I420, AV_PIX_FMT_YUVJ420P},
+    {PIXEL_FORMAT_NV12, AV_PIX_FMT_NV12},
+    {PIXEL_FORMAT_NV21, AV_PIX_FMT_NV21},
+    {PIXEL_FORMAT_NV12_P010, AV_PIX_FMT_P010LE},
+    {PIXEL_FORMAT_YUV422P, AV_PIX_FMT_YUV422P},
+    {PIXEL_FORMAT_YUV422P, AV_PIX_FMT_YUVJ422P},
+    {PIXEL_FORMAT_YUV444P, AV_PIX_FMT_YUV444P},
+    {PIXEL_FORMAT_YUV444P, AV_PIX_FMT_YUVJ444P},
+    {PIXEL_FORMAT_YVYU, AV_PIX_FMT_YVYU422},
+    {PIXEL_FORMAT_UYVY, AV_PIX_FMT_UYVY422},
+    {PIXEL_FORMAT_YUYV, AV_PIX_FMT_YUYV422},
+    {PIXEL_FORMAT_RGBA, AV_PIX_FMT_RGBA},
+    {PIXEL_FORMAT_BGRA, AV_PIX_FMT_BGRA},
+    {PIXEL_FORMAT_ARGB, AV_PIX_FMT_ARGB},
+    {PIXEL_FORMAT_ABGR, AV_PIX_FMT_ABGR},
+};
+
+CODING_TYPE_MAPPING_DEFINE(FFMpegEnc, enum AVCodecID)
+static const ALFFMpegEncCodingTypeMapping stALFFMpegEncCodingTypeMapping[] = {
+    {CODING_H264, AV_CODEC_ID_H264}, {CODING_H265, AV_CODEC_ID_HEVC},
+    {CODING_VP8, AV_CODEC_ID_VP8},   {CODING_VP9, AV_CODEC_ID_VP9},
+    {CODING_MJPEG, AV_CODEC_ID_MJPEG},
+};
+CODING_TYPE_MAPPING_CONVERT(FFMpegEnc, ffmpegenc, enum AVCodecID)
+
 typedef struct _ALFFMpegEncContext ALFFMpegEncContext;
 
 struct _ALFFMpegEncContext {
   ALEncBaseContext stAlEncBaseContext;
+  MppVencPara *pVencPara;
   const AVCodec *pCodec;
   AVCodecContext *pCodecContext;
   AVFrame *pFrame;
   AVPacket *pPacket;
+
+  // layout of the input frames
+  MppPixelFormat eInputFormat;
+  S32 nPlanes;
+  S32 nChromaShiftH;
+  S32 nChromaShiftV;
+  S32 nPixelBytes;
+
+  S64 nInputNum;
+  S64 pInputPts[FFMPEGENC_PTS_RING_SIZE];
+  S64 nPtsStep;
+  BOOL bEosSent;
+
+  /***
+   * when the ring is full the id is not kept (the frame is still encoded),
+   * nReturnLost counts those, the caller does not return its frames.
+   */
+  S32 pReturnId[FFMPEGENC_ID_RING_SIZE];
+  S32 nReturnWrite;
+  S32 nReturnRead;
+  S32 nReturnLost;
+
+  // pPacket is lent to the caller's MppPacket until it is returned
+  BOOL bPacketLent;
+  U8 *pLentPacketData;
+  U8 *pOwnedPacketData;
 };
 
+/**
+ * @description: the encoder libavcodec should use for the coding type, the
+ * well known software ones first, then whatever is registered for the id.
+ */
+static const AVCodec *find_encoder(MppCodingType coding_type) {
+  const AVCodec *codec = NULL;
+  const char *name = NULL;
+
+  switch (coding_type) {
+    case CODING_H264:
+      name = "libx264";
+      break;
+    case CODING_H265:
+      name = "libx265";
+      break;
+    case CODING_VP8:
+      name = "libvpx";
+      break;
+    case CODING_VP9:
+      name = "libvpx-vp9";
+      break;
+    default:
+      break;
+  }
+
+  if (name) codec = avcodec_find_encoder_by_name(name);
+  if (!codec)
+    codec = avcodec_find_encoder(get_ffmpegenc_codec_coding_type(coding_type));
+
+  return codec;
+}
+
+/**
+ * @description: the AVPixelFormat of the MPP format that the encoder accepts,
+ * e.g. mjpeg only takes the yuvj formats.
+ */
+static enum AVPixelFormat find_pixel_format(const AVCodec *codec,
+                                            MppPixelFormat format) {
+  const enum AVPixelFormat *p = NULL;
+  S32 i;
+
+  for (i = 0; i < NUM_OF(stALFFMpegEncPixelFormatMapping); i++) {
+    if (stALFFMpegEncPixelFormatMapping[i].eMppPixelFormat != format) continue;
+    if (!codec->pix_fmts)
+      return stALFFMpegEncPixelFormatMapping[i].eFFMpegEncPixelFormat;
+    for (p = codec->pix_fmts; *p != AV_PIX_FMT_NONE; p++) {
+      if (*p == stALFFMpegEncPixelFormatMapping[i].eFFMpegEncPixelFormat)
+        return *p;
+    }
+  }
+
+  return AV_PIX_FMT_NONE;
+}
+
+/**
+ * @description: planes of the input format, chroma subsampling as shift of
+ * the first plane's line stride and rows, and bytes per pixel of the first
+ * plane. NV12 keeps the full luma stride for its interleaved UV plane.
+ * @return {*}: planes, 0 if the format is not supported
+ */
+static S32 get_plane_layout(MppPixelFormat format, S32 *chroma_shift_h,
+                            S32 *chroma_shift_v, S32 *pixel_bytes) {
+  *chroma_shift_h = 1;
+  *chroma_shift_v = 1;
+  *pixel_bytes = 1;
+  switch (format) {
+    case PIXEL_FORMAT_I420:
+      return 3;
+    case PIXEL_FORMAT_YUV422P:
+      *chroma_shift_v = 0;
+      return 3;
+    case PIXEL_FORMAT_YUV444P:
+      *chroma_shift_h = 0;
+      *chroma_shift_v = 0;
+      return 3;
+    case PIXEL_FORMAT_NV12_P010:
+      *pixel_bytes = 2;
+      // fall through
+    case PIXEL_FORMAT_NV12:
+    case PIXEL_FORMAT_NV21:
+      *chroma_shift_h = 0;
+      return 2;
+    case PIXEL_FORMAT_YVYU:
+    case PIXEL_FORMAT_UYVY:
+    case PIXEL_FORMAT_YUYV:
+      *pixel_bytes = 2;
+      return 1;
+    case PIXEL_FORMAT_RGBA:
+    case PIXEL_FORMAT_BGRA:
+    case PIXEL_FORMAT_ARGB:
+    case PIXEL_FORMAT_ABGR:
+      *pixel_bytes = 4;
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static void set_threading(AVCodecContext *codec_context, MppVencPara *para) {
+  // 0 is "auto" for libavcodec, in MPP it keeps the old single thread
+  if (para->nThreadCount == MPP_THREAD_COUNT_AUTO)
+    codec_context->thread_count = 0;
+  else if (para->nThreadCount > 0)
+    codec_context->thread_count = para->nThreadCount;
+  else
+    codec_context->thread_count = 1;
+
+  switch (para->eThreadType) {
+    case CODEC_THREAD_FRAME:
+      codec_context->thread_type = FF_THREAD_FRAME;
+      break;
+    case CODEC_THREAD_SLICE:
+      codec_context->thread_type = FF_THREAD_SLICE;
+      break;
+    case CODEC_THREAD_AUTO:
+    default:
+      codec_context->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+      break;
+  }
+}
+
+/**
+ * @description: bitrate and quantizer, the generic fields work for all
+ * libavcodec encoders, the private options are set where the wrapper has
+ * them and silently ignored by the others.
+ */
+static void set_rate_control(AVCodecContext *codec_context,
+                             const AVCodec *codec, MppVencPara *para) {
+  void *priv = codec_context->priv_data;
+  char value[16];
+
+  switch (para->eRcMode) {
+    case MPP_RC_MODE_CBR:
+      codec_context->bit_rate = para->nBitrate;
+      codec_context->rc_min_rate = para->nBitrate;
+      codec_context->rc_max_rate = para->nBitrate;
+      codec_context->rc_buffer_size = para->nBitrate;
+      av_opt_set(priv, "nal-hrd", "cbr", 0);
+      break;
+    case MPP_RC_MODE_CQP:
+      if (para->nQp <= 0) break;
+      codec_context->qmin = para->nQp;
+      codec_context->qmax = para->nQp;
+      codec_context->flags |= AV_CODEC_FLAG_QSCALE;
+      codec_context->global_quality = para->nQp * FF_QP2LAMBDA;
+      av_opt_set_int(priv, "qp", para->nQp, 0);
+      snprintf(value, sizeof(value), "qp=%d", para->nQp);
+      av_opt_set(priv, "x265-params", value, 0);
+      break;
+    case MPP_RC_MODE_CRF:
+      if (para->nQp <= 0) break;
+      // libvpx is constant quality only without a bitrate target
+      codec_context->bit_rate = 0;
+      av_opt_set_int(priv, "crf", para->nQp, 0);
+      break;
+    case MPP_RC_MODE_VBR:
+    default:
+      codec_context->bit_rate = para->nBitrate;
+      break;
+  }
+
+  debug("%s rc mode %d, bitrate %d, qp %d", codec->name, para->eRcMode,
+        para->nBitrate, para->nQp);
+}
+
+static void set_preset(AVCodecContext *codec_context, MppVencPara *para) {
+  static const char *x26x_presets[] = {NULL, "ultrafast", "veryfast", "medium",
+                                       "slow"};
+  static const char *vpx_deadlines[] = {NULL, "realtime", "realtime", "good",
+                                        "good"};
+  static const S32 vpx_cpu_used[] = {0, 8, 5, 2, 0};
+  void *priv = codec_context->priv_data;
+  S32 preset = para->ePreset;
+
+  // x264 lookahead and B frames add latency, keep the old realtime tuning
+  // unless the caller asks for B frames or frame threads
+  if (para->nMaxBFrames <= 0 && para->eThreadType != CODEC_THREAD_FRAME)
+    av_opt_set(priv, "tune", "zerolatency", 0);
+
+  if (preset <= MPP_VENC_PRESET_DEFAULT || preset > MPP_VENC_PRESET_SLOW)
+    return;
+
+  av_opt_set(priv, "preset", x26x_presets[preset], 0);
+  av_opt_set(priv, "deadline", vpx_deadlines[preset], 0);
+  av_opt_set_int(priv, "cpu-used", vpx_cpu_used[preset], 0);
+}
+
 ALBaseContext *al_enc_create() {
   ALFFMpegEncContext *context =
       (ALFFMpegEncContext *)malloc(sizeof(ALFFMpegEncContext));
@@ -49,17 +305,37 @@ ALBaseContext *al_enc_create() {
 }
 
 RETURN al_enc_init(ALBaseContext *ctx, MppVencPara *para) {
-  if (!ctx) return MPP_NULL_POINTER;
-  S32 ret = 0;
+  if (!ctx || !para) return MPP_NULL_POINTER;
 
   ALFFMpegEncContext *context = (ALFFMpegEncContext *)ctx;
+  AVCodecContext *codec_context = NULL;
+  enum AVPixelFormat pix_fmt = AV_PIX_FMT_NONE;
+  S32 frame_rate = 0;
+
+  if (para->nWidth <= 0 || para->nHeight <= 0) {
+    error("invalid size %dx%d, please check!", para->nWidth, para->nHeight);
+    return MPP_CHECK_FAILED;
+  }
 
-  context->pCodec = avcodec_find_encoder(AV_CODEC_ID_H264);
+  context->pVencPara = para;
+  context->pCodec = find_encoder(para->eCodingType);
   if (!context->pCodec) {
-    error("can not find encoder, please check!");
+    error("can not find encoder of %s, please check!",
+          mpp_codingtype2str(para->eCodingType));
     return MPP_NULL_POINTER;
   }
 
+  context->eInputFormat = para->PixelFormat;
+  context->nPlanes = get_plane_layout(
+      context->eInputFormat, &(context->nChromaShiftH),
+      &(context->nChromaShiftV), &(context->nPixelBytes));
+  pix_fmt = find_pixel_format(context->pCodec, context->eInputFormat);
+  if (!context->nPlanes || pix_fmt == AV_PIX_FMT_NONE) {
+    error("%s does not take %s, please check!", context->pCodec->name,
+          mpp_pixelformat2str(context->eInputFormat));
+    return MPP_NOT_SUPPORTED_FORMAT;
+  }
+
   context->pPacket = av_packet_alloc();
   if (!context->pPacket) {
     error("can not alloc packet, please check!");
@@ -77,86 +353,280 @@ RETURN al_enc_init(ALBaseContext *ctx, MppVencPara *para) {
     error("can not alloc context, please check!");
     return MPP_NULL_POINTER;
   }
+  codec_context = context->pCodecContext;
+
+  frame_rate =
+      para->nFrameRate > 0 ? para->nFrameRate : FFMPEGENC_DEFAULT_FRAMERATE;
+  codec_context->width = para->nWidth;
+  codec_context->height = para->nHeight;
+  codec_context->pix_fmt = pix_fmt;
+  // pts given to libavcodec are frame numbers, see al_enc_encode
+  codec_context->time_base = (AVRational){1, frame_rate};
+  codec_context->framerate = (AVRational){frame_rate, 1};
+  if (para->nGop > 0) codec_context->gop_size = para->nGop;
+  codec_context->max_b_frames = para->nMaxBFrames > 0 ? para->nMaxBFrames : 0;
+
+  set_threading(codec_context, para);
+  set_rate_control(codec_context, context->pCodec, para);
+  set_preset(codec_context, para);
+
+  if (avcodec_open2(codec_context, context->pCodec, NULL) < 0) {
+    error("Could not open codec %s", context->pCodec->name);
+    return MPP_INIT_FAILED;
+  }
 
-  context->pCodecContext->bit_rate = 400000;  // put sample parameters
-  context->pCodecContext->width = 1280;
-  context->pCodecContext->height = 720;
-  context->pCodecContext->time_base = (AVRational){1, 25};
-  context->pCodecContext->framerate = (AVRational){25, 1};
+  para->nThreadCount = codec_context->thread_count;
+  if (codec_context->active_thread_type & FF_THREAD_FRAME)
+    para->eThreadType = CODEC_THREAD_FRAME;
+  else if (codec_context->active_thread_type & FF_THREAD_SLICE)
+    para->eThreadType = CODEC_THREAD_SLICE;
+  else
+    para->eThreadType = CODEC_THREAD_AUTO;
+
+  context->pFrame->format = codec_context->pix_fmt;
+  context->pFrame->width = codec_context->width;
+  context->pFrame->height = codec_context->height;
+  context->nPtsStep = 1;
+
+  info("init finish, %s %dx%d %s, %d fps, gop %d, b frames %d, %d threads",
+       context->pCodec->name, para->nWidth, para->nHeight,
+       mpp_pixelformat2str(context->eInputFormat), frame_rate,
+       codec_context->gop_size, codec_context->max_b_frames,
+       para->nThreadCount);
 
-  context->pCodecContext->pix_fmt = AV_PIX_FMT_YUV420P;
+  return MPP_OK;
+}
 
-  av_opt_set(context->pCodecContext->priv_data, "tune", "zerolatency", 0);
+/**
+ * @description: only the bitrate can change on the fly, x264 and libvpx pick
+ * it up on the next frame, others keep the one they were opened with.
+ */
+S32 al_enc_set_para(ALBaseContext *ctx, MppVencPara *para) {
+  if (!ctx || !para) return MPP_NULL_POINTER;
 
-  if (avcodec_open2(context->pCodecContext, context->pCodec, NULL) < 0) {
-    error("Could not open codec");
-    return MPP_NULL_POINTER;
-  }
+  ALFFMpegEncContext *context = (ALFFMpegEncContext *)ctx;
 
-  context->pFrame->format = context->pCodecContext->pix_fmt;
-  context->pFrame->width = context->pCodecContext->width;
-  context->pFrame->height = context->pCodecContext->height;
+  if (!context->pCodecContext || para->nBitrate <= 0) return MPP_OK;
 
-  ret = av_frame_get_buffer(context->pFrame, 0);
+  if (para->eRcMode == MPP_RC_MODE_CBR) {
+    context->pCodecContext->bit_rate = para->nBitrate;
+    context->pCodecContext->rc_min_rate = para->nBitrate;
+    context->pCodecContext->rc_max_rate = para->nBitrate;
+    context->pCodecContext->rc_buffer_size = para->nBitrate;
+  } else if (para->eRcMode == MPP_RC_MODE_VBR) {
+    context->pCodecContext->bit_rate = para->nBitrate;
+  }
 
-  if (ret != 0) return MPP_NULL_POINTER;
+  return MPP_OK;
+}
+
+/**
+ * @description: point the AVFrame to the planes of the MppFrame, planes the
+ * frame does not carry follow the previous one in the same buffer.
+ */
+static RETURN fill_av_frame(ALFFMpegEncContext *context, MppFrame *frame) {
+  AVFrame *av_frame = context->pFrame;
+  S32 height = context->pCodecContext->height;
+  S32 chroma_rows = (height + (1 << context->nChromaShiftV) - 1) >>
+                    context->nChromaShiftV;
+  S32 stride = FRAME_GetLineStride(frame);
+  U8 *data = NULL;
+  S32 i;
+
+  if (stride <= 0) stride = context->pVencPara->nStride * context->nPixelBytes;
+  if (stride <= 0) stride = context->pCodecContext->width * context->nPixelBytes;
+
+  for (i = 0; i < context->nPlanes; i++) {
+    data = i < FRAME_GetDataUsedNum(frame)
+               ? (U8 *)FRAME_GetDataPointer(frame, i)
+               : NULL;
+    if (!data && i > 0) {
+      data = av_frame->data[i - 1] +
+             (S64)av_frame->linesize[i - 1] * (i == 1 ? height : chroma_rows);
+    }
+    if (!data) {
+      error("frame %d has no data, please check!", FRAME_GetID(frame));
+      return MPP_NULL_POINTER;
+    }
+
+    av_frame->data[i] = data;
+    av_frame->linesize[i] = i ? stride >> context->nChromaShiftH : stride;
+  }
+  for (; i < AV_NUM_DATA_POINTERS; i++) {
+    av_frame->data[i] = NULL;
+    av_frame->linesize[i] = 0;
+  }
 
-  debug("init finish");
+  av_frame->pts = context->nInputNum;
+  av_frame->pict_type = AV_PICTURE_TYPE_NONE;
+  if (context->pCodecContext->flags & AV_CODEC_FLAG_QSCALE)
+    av_frame->quality = context->pCodecContext->global_quality;
 
   return MPP_OK;
 }
 
-S32 al_enc_set_para(ALBaseContext *ctx, MppVencPara *para) { return 0; }
-
 S32 al_enc_encode(ALBaseContext *ctx, MppData *sink_data) {
-  ALFFMpegEncContext *enc_context = (ALFFMpegEncContext *)ctx;
-  S32 ret = 0;
+  if (!ctx || !sink_data) return MPP_NULL_POINTER;
+
+  ALFFMpegEncContext *context = (ALFFMpegEncContext *)ctx;
   MppFrame *sink_frame = FRAME_GetFrame(sink_data);
+  MppFrameEos eos = FRAME_GetEos(sink_frame);
+  S64 index = context->nInputNum % FFMPEGENC_PTS_RING_SIZE;
+  S32 ret = 0;
 
-  ret = av_frame_make_writable(enc_context->pFrame);
-  if (ret < 0) return MPP_ERROR_UNKNOWN;
+  if (context->bEosSent) {
+    error("encoder is already at eos, please check!");
+    return MPP_CHECK_FAILED;
+  }
 
-  enc_context->pFrame->data[0] = (U8 *)FRAME_GetDataPointer(sink_frame, 0);
-  enc_context->pFrame->data[1] = (U8 *)FRAME_GetDataPointer(sink_frame, 1);
-  enc_context->pFrame->data[2] = (U8 *)FRAME_GetDataPointer(sink_frame, 2);
-  enc_context->pFrame->pts = 1;
-  // encode a frame
-  ret = avcodec_send_frame(enc_context->pCodecContext, enc_context->pFrame);
-  if (ret < 0) {
-    error("Error sending a frame for encoding");
+  if (eos != FRAME_EOS_WITHOUT_DATA) {
+    ret = fill_av_frame(context, sink_frame);
+    if (ret) return ret;
+
+    // the frame is not refcounted, libavcodec copies it, so the caller can
+    // reuse its buffer as soon as we return
+    ret = avcodec_send_frame(context->pCodecContext, context->pFrame);
+    if (AVERROR(EAGAIN) == ret) return MPP_DATAQUEUE_FULL;
+    if (ret < 0) {
+      error("Error sending a frame for encoding %d", ret);
+      return MPP_ENCODER_ERROR;
+    }
+
+    context->pInputPts[index] = FRAME_GetPts(sink_frame);
+    if (context->nInputNum == 1)
+      context->nPtsStep = context->pInputPts[1] - context->pInputPts[0];
+    context->nInputNum++;
+
+    // never overwrite an id that is not returned yet
+    if (context->nReturnWrite - context->nReturnRead < FFMPEGENC_ID_RING_SIZE) {
+      context->pReturnId[context->nReturnWrite++ % FFMPEGENC_ID_RING_SIZE] =
+          FRAME_GetID(sink_frame);
+    } else if (!context->nReturnLost++) {
+      error("%d frames are not returned, id %d is dropped, please check!",
+            FFMPEGENC_ID_RING_SIZE, FRAME_GetID(sink_frame));
+    }
   }
-  debug("encode ret = %d", ret);
 
-  return ret;
+  if (eos != FRAME_NO_EOS) {
+    avcodec_send_frame(context->pCodecContext, NULL);
+    context->bEosSent = MPP_TRUE;
+  }
+
+  mpp_notify_signal(context->pVencPara->nOutputEventFd);
+  debug("encode frame %lld, eos %d", (long long)context->nInputNum, eos);
+
+  return MPP_OK;
+}
+
+S32 al_enc_send_input_frame(ALBaseContext *ctx, MppData *sink_data) {
+  return al_enc_encode(ctx, sink_data);
+}
+
+/**
+ * @description: frames are copied when sent, so they come back right away
+ * @return {*}: id of the frame, -1 if there is none
+ */
+S32 al_enc_return_input_frame(ALBaseContext *ctx, MppData *sink_data) {
+  if (!ctx) return -1;
+
+  ALFFMpegEncContext *context = (ALFFMpegEncContext *)ctx;
+
+  if (context->nReturnRead == context->nReturnWrite) return -1;
+
+  return context->pReturnId[context->nReturnRead++ % FFMPEGENC_ID_RING_SIZE];
+}
+
+/**
+ * @description: libavcodec pts/dts are frame numbers, give back the caller's
+ * pts of that frame, dts before the first frame (B frame delay) are
+ * extrapolated with the distance of the first two pts.
+ */
+static S64 get_caller_pts(ALFFMpegEncContext *context, S64 number) {
+  if (number == AV_NOPTS_VALUE) return 0;
+  if (number < 0) return context->pInputPts[0] + number * context->nPtsStep;
+
+  return context->pInputPts[number % FFMPEGENC_PTS_RING_SIZE];
+}
+
+static void restore_packet(ALFFMpegEncContext *context, MppPacket *packet) {
+  if (context->pLentPacketData && packet &&
+      PACKET_GetDataPointer(packet) == context->pLentPacketData) {
+    PACKET_SetDataPointer(packet, context->pOwnedPacketData);
+  }
+  context->pLentPacketData = NULL;
+  context->pOwnedPacketData = NULL;
+
+  if (context->bPacketLent) {
+    av_packet_unref(context->pPacket);
+    context->bPacketLent = MPP_FALSE;
+  }
 }
 
 S32 al_enc_request_output_stream(ALBaseContext *ctx, MppData *src_data) {
-  ALFFMpegEncContext *enc_context = (ALFFMpegEncContext *)ctx;
+  if (!ctx || !src_data) return MPP_NULL_POINTER;
+
+  ALFFMpegEncContext *context = (ALFFMpegEncContext *)ctx;
+  MppPacket *packet = PACKET_GetPacket(src_data);
+  AVPacket *av_packet = context->pPacket;
   S32 ret = 0;
 
-  ret =
-      avcodec_receive_packet(enc_context->pCodecContext, enc_context->pPacket);
-  debug("receive ret = %d, enc_context->pPacket->size = %d", ret,
-        enc_context->pPacket->size);
-  if (AVERROR(EAGAIN) == ret || AVERROR_EOF == ret)
-    return 5;
-  else if (ret < 0) {
-    error("Error during encoding");
-    return 6;
+  restore_packet(context, packet);
+
+  ret = avcodec_receive_packet(context->pCodecContext, av_packet);
+  debug("receive ret = %d, size = %d", ret, av_packet->size);
+  if (AVERROR(EAGAIN) == ret) return MPP_CODER_NO_DATA;
+  if (AVERROR_EOF == ret) {
+    PACKET_SetEos(packet, MPP_TRUE);
+    PACKET_SetLength(packet, 0);
+    return MPP_CODER_EOS;
+  }
+  if (ret < 0) {
+    error("Error during encoding %d", ret);
+    return MPP_ENCODER_ERROR;
   }
 
-  PACKET_Alloc(PACKET_GetPacket(src_data), enc_context->pPacket->size);
-  // PACKET_GetPacket(src_data)->pData = (
-  // U8*)malloc(enc_context->pPacket->size);
-  // PACKET_GetPacket(src_data)->nLength = enc_context->pPacket->size;
-  // PACKET_SetLength(PACKET_GetPacket(src_data), enc_context->pPacket->size);
+  // lend the encoded data until the packet is returned or the next request
+  context->bPacketLent = MPP_TRUE;
+  context->pOwnedPacketData = PACKET_GetDataPointer(packet);
+  context->pLentPacketData = av_packet->data;
+  PACKET_SetDataPointer(packet, av_packet->data);
+  PACKET_SetLength(packet, av_packet->size);
+  PACKET_SetPts(packet, get_caller_pts(context, av_packet->pts));
+  PACKET_SetDts(packet, get_caller_pts(context, av_packet->dts));
+  PACKET_SetKeyFrame(packet, !!(av_packet->flags & AV_PKT_FLAG_KEY));
+  PACKET_SetEos(packet, MPP_FALSE);
+
+  return MPP_OK;
+}
+
+S32 al_enc_get_output_stream(ALBaseContext *ctx, MppData *src_data) {
+  return al_enc_request_output_stream(ctx, src_data);
+}
+
+S32 al_enc_return_output_stream(ALBaseContext *ctx, MppData *src_data) {
+  if (!ctx) return MPP_NULL_POINTER;
 
-  memcpy(PACKET_GetDataPointer(PACKET_GetPacket(src_data)),
-         enc_context->pPacket->data, enc_context->pPacket->size);
+  ALFFMpegEncContext *context = (ALFFMpegEncContext *)ctx;
 
-  av_packet_unref(enc_context->pPacket);
+  restore_packet(context, src_data ? PACKET_GetPacket(src_data) : NULL);
 
-  return 1;
+  return MPP_OK;
+}
+
+S32 al_enc_flush(ALBaseContext *ctx) {
+  if (!ctx) return MPP_NULL_POINTER;
+
+  ALFFMpegEncContext *context = (ALFFMpegEncContext *)ctx;
+
+  restore_packet(context, NULL);
+#ifdef AV_CODEC_CAP_ENCODER_FLUSH
+  if (context->pCodec->capabilities & AV_CODEC_CAP_ENCODER_FLUSH) {
+    avcodec_flush_buffers(context->pCodecContext);
+    context->bEosSent = MPP_FALSE;
+  }
+#endif
+
+  return MPP_OK;
 }
 
 void al_enc_destory(ALBaseContext *ctx) {
@@ -164,6 +634,10 @@ void al_enc_destory(ALBaseContext *ctx) {
 
   ALFFMpegEncContext *context = (ALFFMpegEncContext *)ctx;
 
+  if (context->nReturnLost)
+    error("ids of %d frames were dropped, return the input frames!",
+          context->nReturnLost);
+
   if (context->pCodecContext) avcodec_free_context(&(context->pCodecContext));
   if (context->pFrame) av_frame_free(&(context->pFrame));
   if (context->pPacket) av_packet_free(&(context->pPacket));
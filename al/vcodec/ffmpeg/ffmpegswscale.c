@@ -5,8 +5,9 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-31 15:46:44
- * @LastEditTime: 2023-11-14 11:20:13
- * @Description: video scale plugin for ffmpeg
+ * @LastEditTime: 2024-06-01 20:10:12
+ * @Description: video scale plugin for ffmpeg, G2D convert/scale/crop/rotate
+ *               on the CPU by libswscale
  */
 
 #define ENABLE_DEBUG 0
@@ -16,6 +17,7 @@
 #include <libavutil/frame.h>
 #include <libavutil/imgutils.h>
 #include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
 #include <libswscale/swscale.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -26,31 +28,597 @@
 
 #define MODULE_TAG "ffmpegswscale"
 
-typedef struct _ALFFMpegSwscaleContext ALFFMpegSwscaleContext;
+/***
+ * SwsContext built for different (format, size) pairs of one channel, a
+ * channel usually cycles through one or two of them.
+ */
+#define SWSCALE_CACHE_SIZE 8
 
-struct _ALFFMpegSwscaleContext {
-  ALG2dBaseContext stAlG2dBaseContext;
+#define SWSCALE_FLAGS SWS_BILINEAR
+
+typedef struct _ALFFMpegSwscaleFormat {
+  MppPixelFormat eMppPixelFormat;
+  enum AVPixelFormat eAvPixelFormat;
+  // YV12/YV16 are YUV420P/YUV422P with U and V planes swapped
+  BOOL bSwapUV;
+} ALFFMpegSwscaleFormat;
+
+static const ALFFMpegSwscaleFormat stALFFMpegSwscaleFormat[] = {
+    {PIXEL_FORMAT_I420, AV_PIX_FMT_YUV420P, MPP_FALSE},
+    {PIXEL_FORMAT_YV12, AV_PIX_FMT_YUV420P, MPP_TRUE},
+    {PIXEL_FORMAT_NV12, AV_PIX_FMT_NV12, MPP_FALSE},
+    {PIXEL_FORMAT_NV21, AV_PIX_FMT_NV21, MPP_FALSE},
+    {PIXEL_FORMAT_NV12_P010, AV_PIX_FMT_P010LE, MPP_FALSE},
+    {PIXEL_FORMAT_YUV422P, AV_PIX_FMT_YUV422P, MPP_FALSE},
+    {PIXEL_FORMAT_YV16, AV_PIX_FMT_YUV422P, MPP_TRUE},
+    {PIXEL_FORMAT_YUV422SP, AV_PIX_FMT_NV16, MPP_FALSE},
+    {PIXEL_FORMAT_YUV444P, AV_PIX_FMT_YUV444P, MPP_FALSE},
+    {PIXEL_FORMAT_YUYV, AV_PIX_FMT_YUYV422, MPP_FALSE},
+    {PIXEL_FORMAT_YVYU, AV_PIX_FMT_YVYU422, MPP_FALSE},
+    {PIXEL_FORMAT_UYVY, AV_PIX_FMT_UYVY422, MPP_FALSE},
+    {PIXEL_FORMAT_RGBA, AV_PIX_FMT_RGBA, MPP_FALSE},
+    {PIXEL_FORMAT_BGRA, AV_PIX_FMT_BGRA, MPP_FALSE},
+    {PIXEL_FORMAT_ARGB, AV_PIX_FMT_ARGB, MPP_FALSE},
+    {PIXEL_FORMAT_ABGR, AV_PIX_FMT_ABGR, MPP_FALSE},
+    {PIXEL_FORMAT_RGB_888, AV_PIX_FMT_RGB24, MPP_FALSE},
+    {PIXEL_FORMAT_BGR_888, AV_PIX_FMT_BGR24, MPP_FALSE},
+    {PIXEL_FORMAT_RGB_565, AV_PIX_FMT_RGB565LE, MPP_FALSE},
+    {PIXEL_FORMAT_BGR_565, AV_PIX_FMT_BGR565LE, MPP_FALSE},
+};
+
+/***
+ * one picture as libswscale wants it.
+ */
+typedef struct _ALSwsImage {
+  enum AVPixelFormat eFormat;
+  S32 nWidth;
+  S32 nHeight;
+  U8 *pData[4];
+  S32 nLinesize[4];
+} ALSwsImage;
+
+typedef struct _ALSwsCacheEntry {
   struct SwsContext *pSwsContext;
-  U8 *pSrcData[4];
-  U8 *pDstData[4];
-  S32 nSrcLinesize[4];
-  S32 nDstLinesize[4];
+  enum AVPixelFormat eSrcFormat;
+  enum AVPixelFormat eDstFormat;
   S32 nSrcWidth;
   S32 nSrcHeight;
   S32 nDstWidth;
   S32 nDstHeight;
-  enum AVPixelFormat eSrcPixFmt;
-  enum AVPixelFormat eDstPixFmt;
+  S32 nFlags;
+  S64 nLastUsed;
+} ALSwsCacheEntry;
+
+typedef struct _ALFFMpegSwscaleContext ALFFMpegSwscaleContext;
+
+struct _ALFFMpegSwscaleContext {
+  ALG2dBaseContext stAlG2dBaseContext;
+  MppG2dPara stG2dPara;
+
+  ALSwsCacheEntry stCache[SWSCALE_CACHE_SIZE];
+  S64 nCacheClock;
+  S64 nCacheMiss;
+
+  // scaled picture before rotation
+  ALSwsImage stScratch;
+
+  // output of al_g2d_convert, handed out by al_g2d_request_output_frame
+  MppFrame *pOutputFrame;
+  BOOL bOutputReady;
 };
 
+static const ALFFMpegSwscaleFormat *get_format(MppPixelFormat format) {
+  S32 i;
+
+  for (i = 0; i < NUM_OF(stALFFMpegSwscaleFormat); i++) {
+    if (stALFFMpegSwscaleFormat[i].eMppPixelFormat == format)
+      return &stALFFMpegSwscaleFormat[i];
+  }
+
+  error("swscale does not support %s, please check!",
+        mpp_pixelformat2str(format));
+  return NULL;
+}
+
+/**
+ * @description: bytes between two pixels and horizontal/vertical chroma
+ * subsampling of one plane, from the libavutil pixel descriptor.
+ */
+static void get_plane_info(const AVPixFmtDescriptor *desc, S32 plane,
+                           S32 *step, S32 *shift_w, S32 *shift_h) {
+  S32 c;
+
+  *step = 0;
+  *shift_w = 0;
+  *shift_h = 0;
+  for (c = 0; c < desc->nb_components; c++) {
+    if (desc->comp[c].plane != plane) continue;
+    if (desc->comp[c].step > *step) *step = desc->comp[c].step;
+    if ((c == 1 || c == 2) && !(desc->flags & AV_PIX_FMT_FLAG_RGB)) {
+      *shift_w = desc->log2_chroma_w;
+      *shift_h = desc->log2_chroma_h;
+    }
+  }
+}
+
+/**
+ * @description: describe the planes of a MppFrame, planes the frame does not
+ * carry follow the previous one in the same buffer.
+ */
+static RETURN fill_image(ALSwsImage *image, MppFrame *frame,
+                         const ALFFMpegSwscaleFormat *format, S32 width,
+                         S32 height) {
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(format->eAvPixelFormat);
+  S32 min_linesize[4] = {0};
+  S32 planes = av_pix_fmt_count_planes(format->eAvPixelFormat);
+  S32 stride = FRAME_GetLineStride(frame);
+  S32 step, shift_w, shift_h;
+  U8 *data = NULL;
+  S32 tmp;
+  S32 i;
+
+  memset(image, 0, sizeof(ALSwsImage));
+  image->eFormat = format->eAvPixelFormat;
+  image->nWidth = width;
+  image->nHeight = height;
+
+  if (av_image_fill_linesizes(min_linesize, format->eAvPixelFormat, width) <
+      0)
+    return MPP_CHECK_FAILED;
+  if (stride < min_linesize[0]) stride = min_linesize[0];
+
+  for (i = 0; i < planes; i++) {
+    data = i < FRAME_GetDataUsedNum(frame)
+               ? (U8 *)FRAME_GetDataPointer(frame, i)
+               : NULL;
+    if (!data && i > 0) {
+      get_plane_info(desc, i - 1, &step, &shift_w, &shift_h);
+      data = image->pData[i - 1] +
+             (S64)image->nLinesize[i - 1] * AV_CEIL_RSHIFT(height, shift_h);
+    }
+    if (!data) {
+      error("frame %d has no data, please check!", FRAME_GetID(frame));
+      return MPP_NULL_POINTER;
+    }
+
+    image->pData[i] = data;
+    image->nLinesize[i] = min_linesize[i] * stride / min_linesize[0];
+  }
+
+  if (format->bSwapUV) {
+    data = image->pData[1];
+    image->pData[1] = image->pData[2];
+    image->pData[2] = data;
+    tmp = image->nLinesize[1];
+    image->nLinesize[1] = image->nLinesize[2];
+    image->nLinesize[2] = tmp;
+  }
+
+  return MPP_OK;
+}
+
+/**
+ * @description: a rect of the image, empty rect means the whole image.
+ */
+static RETURN crop_image(ALSwsImage *dst, const ALSwsImage *src,
+                         const MppRect *rect) {
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(src->eFormat);
+  S32 step, shift_w, shift_h;
+  S32 i;
+
+  *dst = *src;
+  if (!rect || rect->nXmax <= rect->nXmin || rect->nYmax <= rect->nYmin)
+    return MPP_OK;
+
+  if (rect->nXmax > (U32)src->nWidth || rect->nYmax > (U32)src->nHeight) {
+    error("rect (%u,%u)-(%u,%u) is out of %dx%d, please check!", rect->nXmin,
+          rect->nYmin, rect->nXmax, rect->nYmax, src->nWidth, src->nHeight);
+    return MPP_CHECK_FAILED;
+  }
+
+  dst->nWidth = rect->nXmax - rect->nXmin;
+  dst->nHeight = rect->nYmax - rect->nYmin;
+  for (i = 0; i < 4 && src->pData[i]; i++) {
+    get_plane_info(desc, i, &step, &shift_w, &shift_h);
+    dst->pData[i] = src->pData[i] +
+                    (S64)(rect->nYmin >> shift_h) * src->nLinesize[i] +
+                    (rect->nXmin >> shift_w) * step;
+  }
+
+  return MPP_OK;
+}
+
+/**
+ * @description: the cached SwsContext of the conversion, the least recently
+ * used one is rebuilt on a miss.
+ */
+static struct SwsContext *get_sws_context(ALFFMpegSwscaleContext *context,
+                                          const ALSwsImage *src,
+                                          const ALSwsImage *dst) {
+  ALSwsCacheEntry *entry = NULL;
+  ALSwsCacheEntry *victim = &(context->stCache[0]);
+  struct SwsContext *sws = NULL;
+  S32 threads = context->stG2dPara.nThreadCount;
+  S32 i;
+
+  context->nCacheClock++;
+  for (i = 0; i < SWSCALE_CACHE_SIZE; i++) {
+    entry = &(context->stCache[i]);
+    if (entry->pSwsContext && entry->eSrcFormat == src->eFormat &&
+        entry->eDstFormat == dst->eFormat && entry->nSrcWidth == src->nWidth &&
+        entry->nSrcHeight == src->nHeight && entry->nDstWidth == dst->nWidth &&
+        entry->nDstHeight == dst->nHeight && entry->nFlags == SWSCALE_FLAGS) {
+      entry->nLastUsed = context->nCacheClock;
+      return entry->pSwsContext;
+    }
+    if (entry->nLastUsed < victim->nLastUsed) victim = entry;
+  }
+
+  sws = sws_alloc_context();
+  if (!sws) return NULL;
+
+  av_opt_set_int(sws, "srcw", src->nWidth, 0);
+  av_opt_set_int(sws, "srch", src->nHeight, 0);
+  av_opt_set_int(sws, "src_format", src->eFormat, 0);
+  av_opt_set_int(sws, "dstw", dst->nWidth, 0);
+  av_opt_set_int(sws, "dsth", dst->nHeight, 0);
+  av_opt_set_int(sws, "dst_format", dst->eFormat, 0);
+  av_opt_set_int(sws, "sws_flags", SWSCALE_FLAGS, 0);
+  // slice threads, libswscale older than 6 has no such option
+  av_opt_set_int(sws, "threads",
+                 threads == MPP_THREAD_COUNT_AUTO ? 0
+                 : threads > 0                    ? threads
+                                                  : 1,
+                 0);
+  if (sws_init_context(sws, NULL, NULL) < 0) {
+    error("can not init SwsContext %s %dx%d -> %s %dx%d, please check!",
+          av_get_pix_fmt_name(src->eFormat), src->nWidth, src->nHeight,
+          av_get_pix_fmt_name(dst->eFormat), dst->nWidth, dst->nHeight);
+    sws_freeContext(sws);
+    return NULL;
+  }
+
+  if (victim->pSwsContext) sws_freeContext(victim->pSwsContext);
+  victim->pSwsContext = sws;
+  victim->eSrcFormat = src->eFormat;
+  victim->eDstFormat = dst->eFormat;
+  victim->nSrcWidth = src->nWidth;
+  victim->nSrcHeight = src->nHeight;
+  victim->nDstWidth = dst->nWidth;
+  victim->nDstHeight = dst->nHeight;
+  victim->nFlags = SWSCALE_FLAGS;
+  victim->nLastUsed = context->nCacheClock;
+  context->nCacheMiss++;
+  debug("build SwsContext, %lld misses in %lld", (long long)context->nCacheMiss,
+        (long long)context->nCacheClock);
+
+  return sws;
+}
+
+#if LIBSWSCALE_VERSION_MAJOR >= 6
+static void unref_nothing(void *opaque, uint8_t *data) {}
+
+/**
+ * @description: wrap the planes in AVFrame without taking the ownership,
+ * sws_scale_frame only runs the slice threads on refcounted frames.
+ */
+static RETURN wrap_image(AVFrame *frame, const ALSwsImage *image) {
+  S32 i;
+
+  frame->format = image->eFormat;
+  frame->width = image->nWidth;
+  frame->height = image->nHeight;
+  for (i = 0; i < 4 && image->pData[i]; i++) {
+    frame->data[i] = image->pData[i];
+    frame->linesize[i] = image->nLinesize[i];
+    frame->buf[i] = av_buffer_create(image->pData[i], image->nLinesize[i],
+                                     unref_nothing, NULL, 0);
+    if (!frame->buf[i]) return MPP_MALLOC_FAILED;
+  }
+
+  return MPP_OK;
+}
+#endif
+
+static RETURN scale_image(ALFFMpegSwscaleContext *context,
+                          const ALSwsImage *src, const ALSwsImage *dst) {
+  struct SwsContext *sws = get_sws_context(context, src, dst);
+  S32 ret = 0;
+
+  if (!sws) return MPP_CONVERTER_ERROR;
+
+#if LIBSWSCALE_VERSION_MAJOR >= 6
+  if (context->stG2dPara.nThreadCount != 0 &&
+      context->stG2dPara.nThreadCount != 1) {
+    AVFrame *src_frame = av_frame_alloc();
+    AVFrame *dst_frame = av_frame_alloc();
+
+    ret = (!src_frame || !dst_frame) ? MPP_MALLOC_FAILED
+                                     : wrap_image(src_frame, src);
+    if (!ret) ret = wrap_image(dst_frame, dst);
+    if (!ret) ret = sws_scale_frame(sws, dst_frame, src_frame);
+
+    av_frame_free(&src_frame);
+    av_frame_free(&dst_frame);
+    return ret < 0 ? MPP_CONVERTER_ERROR : MPP_OK;
+  }
+#endif
+
+  ret = sws_scale(sws, (const uint8_t *const *)src->pData, src->nLinesize, 0,
+                  src->nHeight, dst->pData, dst->nLinesize);
+
+  return ret > 0 ? MPP_OK : MPP_CONVERTER_ERROR;
+}
+
+/**
+ * @description: the destination of pixel (x, y) of the source is
+ * base + y * row_step + x * col_step, both steps in bytes.
+ */
+#define ROTATE_PLANE(type)                                          \
+  do {                                                              \
+    for (y = 0; y < height; y++) {                                  \
+      const type *s = (const type *)(src + (S64)y * src_linesize);  \
+      U8 *d = base + (S64)y * row_step;                             \
+      for (x = 0; x < width; x++, d += col_step) *(type *)d = s[x]; \
+    }                                                               \
+  } while (0)
+
+/**
+ * @description: rotate or flip one plane of width x height elements of
+ * 1, 2 (NV12 UV, 16 bit), 3 (RGB24) or 4 (RGBA) bytes.
+ */
+static RETURN rotate_plane(const U8 *src, S32 src_linesize, U8 *dst,
+                           S32 dst_linesize, S32 width, S32 height, S32 step,
+                           MppRotate rotate) {
+  S64 row_step, col_step;
+  U8 *base;
+  S32 x, y;
+
+  switch (rotate) {
+    case MPP_ROTATE_90:
+      base = dst + (S64)(height - 1) * step;
+      row_step = -step;
+      col_step = dst_linesize;
+      break;
+    case MPP_ROTATE_180:
+      base = dst + (S64)(height - 1) * dst_linesize + (S64)(width - 1) * step;
+      row_step = -dst_linesize;
+      col_step = -step;
+      break;
+    case MPP_ROTATE_270:
+      base = dst + (S64)(width - 1) * dst_linesize;
+      row_step = step;
+      col_step = -dst_linesize;
+      break;
+    case MPP_MIRROR:
+      base = dst + (S64)(width - 1) * step;
+      row_step = dst_linesize;
+      col_step = -step;
+      break;
+    case MPP_VFLIP:
+    default:
+      base = dst + (S64)(height - 1) * dst_linesize;
+      row_step = -dst_linesize;
+      col_step = step;
+      break;
+  }
+
+  switch (step) {
+    case 1:
+      ROTATE_PLANE(U8);
+      break;
+    case 2:
+      ROTATE_PLANE(U16);
+      break;
+    case 3:
+      for (y = 0; y < height; y++) {
+        const U8 *s = src + (S64)y * src_linesize;
+        U8 *d = base + (S64)y * row_step;
+        for (x = 0; x < width; x++, s += 3, d += col_step) {
+          d[0] = s[0];
+          d[1] = s[1];
+          d[2] = s[2];
+        }
+      }
+      break;
+    case 4:
+      ROTATE_PLANE(U32);
+      break;
+    default:
+      error("can not rotate %d byte pixels, please check!", step);
+      return MPP_NOT_SUPPORTED_FORMAT;
+  }
+
+  return MPP_OK;
+}
+
+static RETURN rotate_image(const ALSwsImage *src, const ALSwsImage *dst,
+                           MppRotate rotate) {
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(src->eFormat);
+  BOOL transpose = rotate == MPP_ROTATE_90 || rotate == MPP_ROTATE_270;
+  S32 step, shift_w, shift_h;
+  S32 ret = 0;
+  S32 i;
+
+  // packed YUV shares chroma between 2 pixels of a row, and 4:2:2 chroma
+  // would not be 4:2:2 any more once transposed
+  if ((desc->log2_chroma_w && av_pix_fmt_count_planes(src->eFormat) == 1) ||
+      (transpose && desc->log2_chroma_w != desc->log2_chroma_h)) {
+    error("can not rotate %s, please check!",
+          av_get_pix_fmt_name(src->eFormat));
+    return MPP_NOT_SUPPORTED_FORMAT;
+  }
+
+  for (i = 0; i < 4 && src->pData[i]; i++) {
+    get_plane_info(desc, i, &step, &shift_w, &shift_h);
+    ret = rotate_plane(src->pData[i], src->nLinesize[i], dst->pData[i],
+                       dst->nLinesize[i], AV_CEIL_RSHIFT(src->nWidth, shift_w),
+                       AV_CEIL_RSHIFT(src->nHeight, shift_h), step, rotate);
+    if (ret) return ret;
+  }
+
+  return MPP_OK;
+}
+
+static RETURN prepare_scratch(ALFFMpegSwscaleContext *context,
+                              enum AVPixelFormat format, S32 width,
+                              S32 height) {
+  ALSwsImage *scratch = &(context->stScratch);
+
+  if (scratch->pData[0] && scratch->eFormat == format &&
+      scratch->nWidth == width && scratch->nHeight == height)
+    return MPP_OK;
+
+  if (scratch->pData[0]) av_freep(&(scratch->pData[0]));
+  memset(scratch, 0, sizeof(ALSwsImage));
+  if (av_image_alloc(scratch->pData, scratch->nLinesize, width, height, format,
+                     64) < 0) {
+    error("can not alloc %dx%d scratch, please check!", width, height);
+    return MPP_MALLOC_FAILED;
+  }
+  scratch->eFormat = format;
+  scratch->nWidth = width;
+  scratch->nHeight = height;
+
+  return MPP_OK;
+}
+
+/**
+ * @description: output size of MPP_SCALE_* when the caller gives none
+ */
+static void get_scaled_size(MppScale scale, S32 width, S32 height,
+                            S32 *out_width, S32 *out_height) {
+  switch (scale) {
+    case MPP_SCALE_2:
+      *out_width = width * 2;
+      *out_height = height * 2;
+      break;
+    case MPP_SCALE_4:
+      *out_width = width * 4;
+      *out_height = height * 4;
+      break;
+    case MPP_SCALE_1_2:
+      *out_width = width / 2;
+      *out_height = height / 2;
+      break;
+    case MPP_SCALE_1_4:
+      *out_width = width / 4;
+      *out_height = height / 4;
+      break;
+    case MPP_SCALE_CUSTOM:
+    default:
+      *out_width = width;
+      *out_height = height;
+      break;
+  }
+}
+
+/**
+ * @description: run the command of para from sink_frame to src_frame
+ */
+static RETURN do_g2d(ALFFMpegSwscaleContext *context, MppFrame *sink_frame,
+                     MppFrame *src_frame) {
+  MppG2dPara *para = &(context->stG2dPara);
+  const ALFFMpegSwscaleFormat *in_format = NULL;
+  const ALFFMpegSwscaleFormat *out_format = NULL;
+  const MppRect *src_rect = NULL;
+  const MppRect *dst_rect = NULL;
+  MppRotate rotate = MPP_ROTATE_0;
+  ALSwsImage in, out, in_rect, out_rect;
+  S32 in_width = para->nInputWidth;
+  S32 in_height = para->nInputHeight;
+  S32 out_width = para->nOutputWidth;
+  S32 out_height = para->nOutputHeight;
+  S32 ret = 0;
+
+  switch (para->eG2dCmd) {
+    case MPP_G2D_CMD_SCALE:
+      src_rect = &(para->sScalePara.sSrcPosition);
+      dst_rect = &(para->sScalePara.sDstPosition);
+      if (out_width <= 0 || out_height <= 0)
+        get_scaled_size(para->sScalePara.eScale, in_width, in_height,
+                        &out_width, &out_height);
+      break;
+    case MPP_G2D_CMD_COPY:
+      src_rect = &(para->sCopyPara.sSrcPosition);
+      dst_rect = &(para->sCopyPara.sDstPosition);
+      break;
+    case MPP_G2D_CMD_ROTATE:
+      src_rect = &(para->sRotatePara.sSrcPosition);
+      dst_rect = &(para->sRotatePara.sDstPosition);
+      rotate = para->sRotatePara.eRotate;
+      if (out_width <= 0 || out_height <= 0) {
+        BOOL transpose = rotate == MPP_ROTATE_90 || rotate == MPP_ROTATE_270;
+        out_width = transpose ? in_height : in_width;
+        out_height = transpose ? in_width : in_height;
+      }
+      break;
+    case MPP_G2D_CMD_DRAW:
+      // zero (DRAW) is what a memset para holds, take it as plain convert
+      break;
+    default:
+      error("swscale does not support g2d cmd %d, please check!",
+            para->eG2dCmd);
+      return MPP_CHECK_FAILED;
+  }
+
+  if (out_width <= 0 || out_height <= 0) {
+    out_width = in_width;
+    out_height = in_height;
+  }
+
+  in_format = get_format(para->eInputPixelFormat);
+  out_format = get_format(para->eOutputPixelFormat);
+  if (!in_format || !out_format) return MPP_NOT_SUPPORTED_FORMAT;
+
+  if (!FRAME_GetDataPointer(src_frame, 0)) {
+    ret = FRAME_Alloc(src_frame, para->eOutputPixelFormat, out_width,
+                      out_height);
+    if (ret) return ret;
+  }
+
+  ret = fill_image(&in, sink_frame, in_format, in_width, in_height);
+  if (!ret)
+    ret = fill_image(&out, src_frame, out_format, out_width, out_height);
+  if (!ret) ret = crop_image(&in_rect, &in, src_rect);
+  if (!ret) ret = crop_image(&out_rect, &out, dst_rect);
+  if (ret) return ret;
+
+  // copy does not scale, take the smaller of the two rects
+  if (para->eG2dCmd == MPP_G2D_CMD_COPY) {
+    if (out_rect.nWidth > in_rect.nWidth) out_rect.nWidth = in_rect.nWidth;
+    if (out_rect.nHeight > in_rect.nHeight) out_rect.nHeight = in_rect.nHeight;
+    in_rect.nWidth = out_rect.nWidth;
+    in_rect.nHeight = out_rect.nHeight;
+  }
+
+  if (rotate == MPP_ROTATE_0) {
+    ret = scale_image(context, &in_rect, &out_rect);
+  } else {
+    // scale to the output rect before rotation, then rotate into it
+    BOOL transpose = rotate == MPP_ROTATE_90 || rotate == MPP_ROTATE_270;
+    ret = prepare_scratch(context, out_rect.eFormat,
+                          transpose ? out_rect.nHeight : out_rect.nWidth,
+                          transpose ? out_rect.nWidth : out_rect.nHeight);
+    if (!ret) ret = scale_image(context, &in_rect, &(context->stScratch));
+    if (!ret) ret = rotate_image(&(context->stScratch), &out_rect, rotate);
+  }
+  if (ret) return ret;
+
+  FRAME_SetWidth(src_frame, out_width);
+  FRAME_SetHeight(src_frame, out_height);
+  FRAME_SetPixelFormat(src_frame, para->eOutputPixelFormat);
+  FRAME_SetPts(src_frame, FRAME_GetPts(sink_frame));
+
+  return MPP_OK;
+}
+
 ALBaseContext *al_g2d_create() {
   ALFFMpegSwscaleContext *context =
       (ALFFMpegSwscaleContext *)malloc(sizeof(ALFFMpegSwscaleContext));
   if (!context) return NULL;
   memset(context, 0, sizeof(ALFFMpegSwscaleContext));
 
-  context->pSwsContext = NULL;
-
   return &(context->stAlG2dBaseContext.stAlBaseContext);
 }
 
@@ -65,69 +633,121 @@ RETURN al_g2d_init(ALBaseContext *ctx, MppG2dPara *para) {
     return MPP_NULL_POINTER;
   }
 
-  S32 ret = 0;
-
   ALFFMpegSwscaleContext *context = (ALFFMpegSwscaleContext *)ctx;
 
-  context->nSrcWidth = 1280;
-  context->nSrcHeight = 720;
-  context->eSrcPixFmt = AV_PIX_FMT_YUV420P;
-  context->nDstWidth = 640;
-  context->nDstHeight = 360;
-  context->eDstPixFmt = AV_PIX_FMT_YUV420P;
-
-  context->pSwsContext = sws_getContext(
-      context->nSrcWidth, context->nSrcHeight, context->eSrcPixFmt,
-      context->nDstWidth, context->nDstHeight, context->eDstPixFmt,
-      SWS_BILINEAR, NULL, NULL, NULL);
-  if (!context->pSwsContext) return MPP_NULL_POINTER;
-
-  if ((av_image_alloc(context->pSrcData, context->nSrcLinesize,
-                      context->nSrcWidth, context->nSrcHeight,
-                      context->eSrcPixFmt, 16)) < 0) {
-    error("Could not allocate source image");
-    return MPP_MALLOC_FAILED;
-  }
+  context->stG2dPara = *para;
+  para->eInputFrameBufferType = MPP_FRAME_BUFFERTYPE_NORMAL_EXTERNAL;
+  para->eOutputFrameBufferType = MPP_FRAME_BUFFERTYPE_NORMAL_EXTERNAL;
 
-  if ((av_image_alloc(context->pDstData, context->nDstLinesize,
-                      context->nDstWidth, context->nDstHeight,
-                      context->eDstPixFmt, 1)) < 0) {
-    error("Could not allocate destination image");
-    return MPP_MALLOC_FAILED;
-  }
+  debug("init finish, cmd %d, %s %dx%d -> %s %dx%d", para->eG2dCmd,
+        mpp_pixelformat2str(para->eInputPixelFormat), para->nInputWidth,
+        para->nInputHeight, mpp_pixelformat2str(para->eOutputPixelFormat),
+        para->nOutputWidth, para->nOutputHeight);
 
-  debug("init finish %d %d", context->nSrcLinesize[0],
-        context->nDstLinesize[0]);
+  return MPP_OK;
+}
+
+/**
+ * @description: the next frames use the new para, SwsContext of the sizes
+ * and formats seen before are still in the cache.
+ */
+S32 al_g2d_set_para(ALBaseContext *ctx, MppG2dPara *para) {
+  if (!ctx || !para) return MPP_NULL_POINTER;
+
+  ALFFMpegSwscaleContext *context = (ALFFMpegSwscaleContext *)ctx;
+
+  context->stG2dPara = *para;
 
   return MPP_OK;
 }
 
-S32 al_g2d_set_para(ALBaseContext *ctx, MppG2dPara *para) { return 0; }
+S32 al_g2d_process(ALBaseContext *ctx, MppData *sink_data, MppData *src_data) {
+  if (!ctx || !sink_data || !src_data) {
+    error("input para is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  ALFFMpegSwscaleContext *context = (ALFFMpegSwscaleContext *)ctx;
+
+  return do_g2d(context, FRAME_GetFrame(sink_data), FRAME_GetFrame(src_data));
+}
 
 S32 al_g2d_convert(ALBaseContext *ctx, MppData *sink_data) {
+  if (!ctx || !sink_data) return MPP_NULL_POINTER;
+
   ALFFMpegSwscaleContext *context = (ALFFMpegSwscaleContext *)ctx;
   S32 ret = 0;
-  MppFrame *sink_frame = FRAME_GetFrame(sink_data);
 
-  context->pSrcData[0] = (U8 *)FRAME_GetDataPointer(sink_frame, 0);
-  context->pSrcData[1] = (U8 *)FRAME_GetDataPointer(sink_frame, 1);
-  context->pSrcData[2] = (U8 *)FRAME_GetDataPointer(sink_frame, 2);
+  if (context->bOutputReady) return MPP_DATAQUEUE_FULL;
+
+  if (!context->pOutputFrame) {
+    context->pOutputFrame = FRAME_Create();
+    if (!context->pOutputFrame) return MPP_MALLOC_FAILED;
+  }
 
-  // scale a frame
-  sws_scale(context->pSwsContext, (const uint8_t *const *)context->pSrcData,
-            context->nSrcLinesize, 0, context->nSrcHeight, context->pDstData,
-            context->nDstLinesize);
+  ret = do_g2d(context, FRAME_GetFrame(sink_data), context->pOutputFrame);
+  if (ret) return ret;
+  context->bOutputReady = MPP_TRUE;
 
-  return ret;
+  return MPP_OK;
+}
+
+/**
+ * @description: the input is converted at once, the caller can take it back
+ * right after al_g2d_send_input_frame.
+ */
+S32 al_g2d_send_input_frame(ALBaseContext *ctx, MppData *sink_data) {
+  return al_g2d_convert(ctx, sink_data);
+}
+
+S32 al_g2d_return_input_frame(ALBaseContext *ctx, MppData *sink_data) {
+  return MPP_OK;
 }
 
 S32 al_g2d_request_output_frame(ALBaseContext *ctx, MppData *src_data) {
+  if (!ctx || !src_data) return MPP_NULL_POINTER;
+
+  ALFFMpegSwscaleContext *context = (ALFFMpegSwscaleContext *)ctx;
+
+  if (!context->bOutputReady) return MPP_CODER_NO_DATA;
+
+  memcpy(src_data, FRAME_GetBaseData(context->pOutputFrame),
+         FRAME_GetStructSize());
+
+  return MPP_OK;
+}
+
+S32 al_g2d_get_output_frame(ALBaseContext *ctx, MppData *src_data) {
+  return al_g2d_request_output_frame(ctx, src_data);
+}
+
+S32 al_g2d_return_output_frame(ALBaseContext *ctx, MppData *src_data) {
+  if (!ctx) return MPP_NULL_POINTER;
+
   ALFFMpegSwscaleContext *context = (ALFFMpegSwscaleContext *)ctx;
-  S32 ret = 0;
 
-  // av_packet_unref(enc_context->pPacket);
+  context->bOutputReady = MPP_FALSE;
 
-  return 0;
+  return MPP_OK;
 }
 
-void al_g2d_destory(ALBaseContext *ctx) {}
+void al_g2d_destory(ALBaseContext *ctx) {
+  if (!ctx) return;
+
+  ALFFMpegSwscaleContext *context = (ALFFMpegSwscaleContext *)ctx;
+  S32 i;
+
+  for (i = 0; i < SWSCALE_CACHE_SIZE; i++) {
+    if (context->stCache[i].pSwsContext)
+      sws_freeContext(context->stCache[i].pSwsContext);
+  }
+
+  if (context->stScratch.pData[0]) av_freep(&(context->stScratch.pData[0]));
+
+  if (context->pOutputFrame) {
+    FRAME_Free(context->pOutputFrame);
+    FRAME_Destory(context->pOutputFrame);
+  }
+
+  free(context);
+}
@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-17 09:38:40
- * @LastEditTime: 2023-02-02 10:06:32
+ * @LastEditTime: 2024-06-01 20:42:05
  * @Description: video decode plugin for openh264, only can decode H.264 stream
  */
 
@@ -18,6 +18,7 @@
 
 #include "al_interface_dec.h"
 #include "log.h"
+#include "notify.h"
 #include "wels/codec_api.h"
 #include "wels/codec_app_def.h"
 #include "wels/codec_def.h"
@@ -25,12 +26,21 @@
 
 #define MODULE_TAG "openh264dec"
 
-// for test gstreamer single thread handle openh264(no memory copy)
-//#define SINGLE_THREAD_TEST
-
 // for test gstreamer dmabuf handle
 //#define MULTI_THREAD_DMABUF
 
+/***
+ * output frames of one decoder, allocated once and reused. The ring grows up
+ * to OPENH264_DEC_RING_MAX_NUM, then frames are allocated one by one.
+ */
+#define OPENH264_DEC_RING_INIT_NUM 4
+#define OPENH264_DEC_RING_MAX_NUM 16
+
+/***
+ * frames lent to the caller at once, the ring and the decoder's own picture
+ */
+#define OPENH264_DEC_LEND_NUM (OPENH264_DEC_RING_MAX_NUM + 1)
+
 PIXEL_FORMAT_MAPPING_DEFINE(SoftOpenh264Dec, EVideoFormatType)
 static const ALSoftOpenh264DecPixelFormatMapping
     stALSoftOpenh264DecPixelFormatMapping[] = {
@@ -49,121 +59,278 @@ PIXEL_FORMAT_MAPPING_CONVERT(SoftOpenh264Dec, softopenh264dec, EVideoFormatType)
 
 typedef struct _ALSoftOpenh264DecContext ALSoftOpenh264DecContext;
 
+/***
+ * where the picture of the decoder (bOutputByReference) is
+ */
+typedef enum _ALSoftOpenh264DecRefState {
+  REF_IDLE = 0,
+  // decoded, not requested yet
+  REF_QUEUED,
+  // requested, decode returns MPP_DATAQUEUE_FULL until it is returned
+  REF_LENT,
+} ALSoftOpenh264DecRefState;
+
+/***
+ * one output frame lent to the caller through its MppFrame, the caller's
+ * own planes are kept here and put back when the frame is released.
+ */
+typedef struct _ALSoftOpenh264DecLend {
+  BOOL bInUse;
+  ALSoftOpenh264DecContext *pContext;
+  MppFrame *pOutputFrame;
+  U8 *pOwnedData[3];
+  S32 nOwnedDataUsedNum;
+  MppFrameBufferType eOwnedBufferType;
+} ALSoftOpenh264DecLend;
+
 struct _ALSoftOpenh264DecContext {
   ALDecBaseContext stAlDecBaseContext;
   ISVCDecoder *pSvcDecoder;  // decoder declaration
-  U8 *pData[3];              // output: [0~2] for Y,U,V buffer
   SBufferInfo stDstBufInfo;
   SDecodingParam stDecParam;
   S32 DecRetEos;
   S32 RequestApi;
   MppDataQueue *pOutputQueue;
+  S32 nFrameID;
+
+  /***
+   * nOutputEventFd of MppVdecPara, signaled when a picture is pushed into
+   * pOutputQueue or the stream ends
+   */
+  S32 nOutputEventFd;
+
+  /***
+   * gstreamer handles the first frame before its buffer pool is active,
+   * hold the output until a few frames are decoded.
+   */
+  BOOL bOutputStarted;
+
+  /***
+   * reusable output frames, created on the first picture and again when
+   * the size changes.
+   */
+  MppFramePool *pRing;
+  S32 nRingWidth;
+  S32 nRingHeight;
+
+  /***
+   * bOutputByReference: pRefFrame points at the decoder's picture
+   */
+  BOOL bOutputByReference;
+  MppFrame *pRefFrame;
+  ALSoftOpenh264DecRefState eRefState;
+
+  pthread_mutex_t stMutex;
+  ALSoftOpenh264DecLend stLend[OPENH264_DEC_LEND_NUM];
 };
 
-#ifdef SINGLE_THREAD_TEST
-enum _gFlag {
-  NO_FRAME,
-  END_OF_DEC,
-  REQ_FRAME,
-};
+/**
+ * @description: take a frame of the ring, the ring is created again when
+ * the picture size changes (frames still out are freed when put back).
+ */
+static MppFrame *get_ring_frame(ALSoftOpenh264DecContext *context, S32 width,
+                                S32 height) {
+  MppFrameBufferType buffer_type = MPP_FRAME_BUFFERTYPE_NORMAL_INTERNAL;
+  MppFrame *frame = NULL;
 
-pthread_mutex_t gMutex;
-pthread_cond_t gCond;
-S32 gFlag = NO_FRAME;
-S32 iStride[3];
+#ifdef MULTI_THREAD_DMABUF
+  buffer_type = MPP_FRAME_BUFFERTYPE_DMABUF_INTERNAL;
+#endif
 
-static S32 singlethread_decode(ALBaseContext *ctx, MppData *sink_data) {
-  ALSoftOpenh264DecContext *context = (ALSoftOpenh264DecContext *)ctx;
-  S32 ret;
-  MppPacket *sink_packet = PACKET_GetPacket(sink_data);
+  if (context->pRing &&
+      (context->nRingWidth != width || context->nRingHeight != height)) {
+    debug("picture size changed (%dx%d -> %dx%d), create the ring again",
+          context->nRingWidth, context->nRingHeight, width, height);
+    FRAMEPOOL_Destory(context->pRing);
+    context->pRing = NULL;
+  }
 
-  if (gFlag != NO_FRAME) {
-    pthread_cond_wait(&gCond, &gMutex);
-    pthread_mutex_unlock(&gMutex);
+  if (!context->pRing) {
+    context->pRing = FRAMEPOOL_Create(
+        buffer_type, PIXEL_FORMAT_I420, width, height,
+        OPENH264_DEC_RING_INIT_NUM, OPENH264_DEC_RING_MAX_NUM);
+    if (!context->pRing) {
+      error("can not create the output ring, please check!");
+      return NULL;
+    }
+    context->nRingWidth = width;
+    context->nRingHeight = height;
   }
-  debug("start dec a frame .....");
-  memset(&(context->stDstBufInfo), 0, sizeof(SBufferInfo));
 
-  ret = context->pSvcDecoder->DecodeFrameNoDelay(
-      (const U8 *)PACKET_GetDataPointer(sink_packet),
-      PACKET_GetLength(sink_packet), context->pData, &(context->stDstBufInfo));
-  if (ret != 0) {
-    // error handling (RequestIDR or something like that)
-    error("decode ret = %d", ret);
-  } else {
-    debug("------- get a decode frame (%p, %p, %p)", context->pData[0],
-          context->pData[1], context->pData[2]);
+  frame = FRAMEPOOL_GetFrame(context->pRing);
+  if (frame) return frame;
+
+  // all frames of the ring are out, the caller holds too many of them
+  debug("output ring is empty, alloc a frame");
+  frame = FRAME_Create();
+  if (!frame) return NULL;
+  FRAME_SetBufferType(frame, buffer_type);
+  if (FRAME_Alloc(frame, PIXEL_FORMAT_I420, width, height)) {
+    FRAME_Destory(frame);
+    return NULL;
   }
-  if (sink_data->bEos) {
-    context->DecRetEos = MPP_TRUE;
+
+  return frame;
+}
+
+/**
+ * @description: give an output frame back, to the ring if it belongs to it.
+ */
+static void put_output_frame(ALSoftOpenh264DecContext *context,
+                             MppFrame *frame) {
+  if (frame == context->pRefFrame) {
+    pthread_mutex_lock(&context->stMutex);
+    context->eRefState = REF_IDLE;
+    pthread_mutex_unlock(&context->stMutex);
+    return;
   }
-  iStride[0] = context->stDstBufInfo.UsrData.sSystemBuffer.iStride[0];
-  iStride[1] = context->stDstBufInfo.UsrData.sSystemBuffer.iStride[1];
-  debug("info : %d %d %d %d %d %d",
-        context->stDstBufInfo.UsrData.sSystemBuffer.iWidth,
-        context->stDstBufInfo.UsrData.sSystemBuffer.iHeight,
-        context->stDstBufInfo.UsrData.sSystemBuffer.iFormat,
-        context->stDstBufInfo.UsrData.sSystemBuffer.iStride[0],
-        context->stDstBufInfo.UsrData.sSystemBuffer.iStride[1],
-        context->stDstBufInfo.UsrData.sSystemBuffer.iStride[2]);
 
-  gFlag = END_OF_DEC;
+  // no-op on a frame of the ring, FRAME_Destory puts it back
+  FRAME_Free(frame);
+  FRAME_Destory(frame);
+}
 
-  return ret;
+/**
+ * @description: Y, U, V of a packed I420 output frame
+ */
+static void get_planes(MppFrame *frame, S32 width, S32 height, U8 **data) {
+  data[0] = (U8 *)FRAME_GetDataPointer(frame, 0);
+  if (FRAME_GetDataUsedNum(frame) < 3) {
+    // one (dmabuf) buffer, the planes follow each other
+    data[1] = data[0] + width * height;
+    data[2] = data[1] + (width / 2) * (height / 2);
+  } else {
+    data[1] = (U8 *)FRAME_GetDataPointer(frame, 1);
+    data[2] = (U8 *)FRAME_GetDataPointer(frame, 2);
+  }
 }
-static S32 singlethread_request(ALBaseContext *ctx, MppData *src_data) {
-  ALSoftOpenh264DecContext *context = (ALSoftOpenh264DecContext *)ctx;
-  MppFrame *src_frame = FRAME_GetFrame(src_data);
-  S32 ret = MPP_OK;
 
-  if (context->DecRetEos == MPP_TRUE) return MPP_CODER_EOS;
+/**
+ * @description: copy the picture into a packed I420 frame
+ */
+static void copy_picture(MppFrame *frame, U8 *const *src, const S32 *stride,
+                         S32 width, S32 height) {
+  U8 *dst[3];
+  S32 i;
 
-  if (gFlag == NO_FRAME || gFlag == REQ_FRAME) return MPP_CODER_NO_DATA;
+  get_planes(frame, width, height, dst);
 
-  FRAME_SetMetaData(src_frame, iStride);
-  FRAME_SetDataUsedNum(src_frame, 3);
-  FRAME_SetDataPointer(src_frame, 0, (U8 *)context->pData[0]);
-  FRAME_SetDataPointer(src_frame, 1, (U8 *)context->pData[1]);
-  FRAME_SetDataPointer(src_frame, 2, (U8 *)context->pData[2]);
+  for (i = 0; i < height; i++)
+    memcpy(dst[0] + i * width, src[0] + i * stride[0], width);
 
-  debug("request a frame .....(%p, %p, %p)", context->pData[0],
-        context->pData[1], context->pData[2]);
+  for (i = 0; i < height / 2; i++) {
+    memcpy(dst[1] + i * (width / 2), src[1] + i * stride[1], width / 2);
+    memcpy(dst[2] + i * (width / 2), src[2] + i * stride[1], width / 2);
+  }
 
-  gFlag = REQ_FRAME;
+  FRAME_SetWidth(frame, width);
+  FRAME_SetHeight(frame, height);
+  FRAME_SetLineStride(frame, width);
+  FRAME_SetPixelFormat(frame, PIXEL_FORMAT_I420);
+}
 
-  return ret;
+/**
+ * @description: copy the decoder's picture into the ring and queue it, the
+ * decoder is going to overwrite it.
+ * @return {*}: MPP_OK or the error of the ring/queue
+ */
+static S32 queue_ref_copy(ALSoftOpenh264DecContext *context) {
+  MppFrame *ref = context->pRefFrame;
+  MppFrame *frame = NULL;
+  U8 *src[3];
+  S32 stride[2];
+
+  frame = get_ring_frame(context, FRAME_GetWidth(ref), FRAME_GetHeight(ref));
+  if (!frame) return MPP_MALLOC_FAILED;
+
+  src[0] = (U8 *)FRAME_GetDataPointer(ref, 0);
+  src[1] = (U8 *)FRAME_GetDataPointer(ref, 1);
+  src[2] = (U8 *)FRAME_GetDataPointer(ref, 2);
+  stride[0] = FRAME_GetLineStride(ref);
+  stride[1] = stride[0] / 2;
+  copy_picture(frame, src, stride, FRAME_GetWidth(ref), FRAME_GetHeight(ref));
+  FRAME_SetPts(frame, FRAME_GetPts(ref));
+  FRAME_SetID(frame, FRAME_GetID(ref));
+
+  return DATAQUEUE_PushData(context->pOutputQueue, FRAME_GetBaseData(frame));
 }
 
-static S32 singlethread_return(ALBaseContext *ctx, MppData *src_data) {
-  ALSoftOpenh264DecContext *context = (ALSoftOpenh264DecContext *)ctx;
+/**
+ * @description: the decoder reuses the buffer of its last picture, take it
+ * back first. A picture nobody asked for yet is copied into the ring, a
+ * lent one has to be returned by the caller.
+ * @return {*}: MPP_OK, MPP_DATAQUEUE_FULL while the picture is still lent
+ * (send the packet again later) or the error of the ring/queue
+ */
+static S32 reclaim_ref_frame(ALSoftOpenh264DecContext *context) {
   S32 ret = MPP_OK;
 
-  gFlag = NO_FRAME;
+  pthread_mutex_lock(&context->stMutex);
+  if (context->eRefState == REF_QUEUED) {
+    ret = queue_ref_copy(context);
+    context->eRefState = REF_IDLE;
+  } else if (context->eRefState == REF_LENT) {
+    debug("the last picture is still lent, decode later");
+    ret = MPP_DATAQUEUE_FULL;
+  }
+  pthread_mutex_unlock(&context->stMutex);
 
-  context->pData[0] = NULL;
-  context->pData[1] = NULL;
-  context->pData[2] = NULL;
-  pthread_cond_signal(&gCond);
+  return ret;
+}
 
-  debug("return a frame .....");
+static S32 output_by_reference(ALSoftOpenh264DecContext *context, U8 **data,
+                               S64 pts) {
+  SSysMEMBuffer *buffer = &(context->stDstBufInfo.UsrData.sSystemBuffer);
+  MppFrame *frame = context->pRefFrame;
+
+  FRAME_SetDataUsedNum(frame, 3);
+  FRAME_SetDataPointer(frame, 0, data[0]);
+  FRAME_SetDataPointer(frame, 1, data[1]);
+  FRAME_SetDataPointer(frame, 2, data[2]);
+  FRAME_SetWidth(frame, buffer->iWidth);
+  FRAME_SetHeight(frame, buffer->iHeight);
+  FRAME_SetLineStride(frame, buffer->iStride[0]);
+  FRAME_SetPixelFormat(frame, PIXEL_FORMAT_I420);
+  FRAME_SetPts(frame, pts);
+  FRAME_SetID(frame, context->nFrameID++);
+
+  pthread_mutex_lock(&context->stMutex);
+  context->eRefState = REF_QUEUED;
+  pthread_mutex_unlock(&context->stMutex);
 
-  return ret;
+  return MPP_OK;
 }
 
-#else
+static S32 output_by_copy(ALSoftOpenh264DecContext *context, U8 **data,
+                          S64 pts) {
+  SSysMEMBuffer *buffer = &(context->stDstBufInfo.UsrData.sSystemBuffer);
+  MppFrame *frame = NULL;
 
-static S32 multithread_decode(ALBaseContext *ctx, MppData *sink_data) {
-  ALSoftOpenh264DecContext *context = (ALSoftOpenh264DecContext *)ctx;
-  static U32 num = 1;
-  static U32 id = 0;
-  MppFrame *pFrame = NULL;
-  MppPacket *sink_packet = PACKET_GetPacket(sink_data);
-  U8 *pData[3];
-  U8 *tmp_pdata0;
-  U8 *tmp_pdata1;
-  U8 *tmp_pdata2;
+  frame = get_ring_frame(context, buffer->iWidth, buffer->iHeight);
+  if (!frame) {
+    error("can not get an output frame, drop the picture!");
+    return MPP_MALLOC_FAILED;
+  }
+
+  copy_picture(frame, data, buffer->iStride, buffer->iWidth, buffer->iHeight);
+  FRAME_SetPts(frame, pts);
+  FRAME_SetID(frame, context->nFrameID++);
+
+  return DATAQUEUE_PushData(context->pOutputQueue, FRAME_GetBaseData(frame));
+}
+
+static S32 decode_packet(ALSoftOpenh264DecContext *context,
+                         MppPacket *sink_packet) {
+  SSysMEMBuffer *buffer = &(context->stDstBufInfo.UsrData.sSystemBuffer);
+  U8 *pData[3] = {NULL, NULL, NULL};
   S32 ret;
 
+  if (context->bOutputByReference) {
+    ret = reclaim_ref_frame(context);
+    if (ret == MPP_DATAQUEUE_FULL) return ret;
+    if (ret) error("can not keep the last picture, ret = %d", ret);
+  }
+
   memset(&(context->stDstBufInfo), 0, sizeof(SBufferInfo));
 
   ret = context->pSvcDecoder->DecodeFrameNoDelay(
@@ -172,8 +339,6 @@ static S32 multithread_decode(ALBaseContext *ctx, MppData *sink_data) {
   if (ret != 0) {
     // error handling (RequestIDR or something like that)
     error("decode ret = %d", ret);
-  } else {
-    // debug("------- get a decode frame");
   }
 
   if (1 != context->stDstBufInfo.iBufferStatus) {
@@ -186,75 +351,26 @@ static S32 multithread_decode(ALBaseContext *ctx, MppData *sink_data) {
     return ret;
   }
 
-  PACKET_SetWidth(sink_packet,
-                  context->stDstBufInfo.UsrData.sSystemBuffer.iWidth);
-  PACKET_SetHeight(sink_packet,
-                   context->stDstBufInfo.UsrData.sSystemBuffer.iHeight);
-  PACKET_SetLineStride(sink_packet,
-                       context->stDstBufInfo.UsrData.sSystemBuffer.iStride[0]);
-  PACKET_SetPixelFormat(sink_packet,
-                        get_softopenh264dec_mpp_pixel_format(
-                            (EVideoFormatType)(context->stDstBufInfo.UsrData
-                                                   .sSystemBuffer.iFormat)));
+  PACKET_SetWidth(sink_packet, buffer->iWidth);
+  PACKET_SetHeight(sink_packet, buffer->iHeight);
+  PACKET_SetLineStride(sink_packet, buffer->iStride[0]);
+  PACKET_SetPixelFormat(sink_packet, get_softopenh264dec_mpp_pixel_format(
+                                         (EVideoFormatType)(buffer->iFormat)));
   PACKET_SetPts(sink_packet, context->stDstBufInfo.uiOutYuvTimeStamp);
 
-  pFrame = FRAME_Create();
+  // MppFrame keeps one line stride, the chroma planes must follow it
+  if (context->bOutputByReference &&
+      buffer->iStride[1] * 2 == buffer->iStride[0])
+    ret = output_by_reference(context, pData,
+                              context->stDstBufInfo.uiOutYuvTimeStamp);
+  else
+    ret = output_by_copy(context, pData,
+                         context->stDstBufInfo.uiOutYuvTimeStamp);
 
-#ifdef MULTI_THREAD_DMABUF
-  FRAME_SetBufferType(pFrame, MPP_FRAME_BUFFERTYPE_DMABUF_INTERNAL);
-
-  FRAME_Alloc(pFrame, PACKET_GetPixelFormat(sink_packet),
-              PACKET_GetWidth(sink_packet), PACKET_GetHeight(sink_packet));
-  FRAME_SetID(pFrame, id++);
-
-  tmp_pdata0 = (U8 *)FRAME_GetDataPointer(pFrame, 0);
-  tmp_pdata1 =
-      tmp_pdata0 + PACKET_GetWidth(sink_packet) * PACKET_GetHeight(sink_packet);
-  tmp_pdata2 = tmp_pdata1 +
-               PACKET_GetWidth(sink_packet) * PACKET_GetHeight(sink_packet) / 4;
-
-#else
-  FRAME_Alloc(pFrame, (MppPixelFormat)PACKET_GetPixelFormat(sink_packet),
-              PACKET_GetWidth(sink_packet), PACKET_GetHeight(sink_packet));
-  FRAME_SetID(pFrame, id++);
-
-  tmp_pdata0 = (U8 *)FRAME_GetDataPointer(pFrame, 0);
-  tmp_pdata1 = (U8 *)FRAME_GetDataPointer(pFrame, 1);
-  tmp_pdata2 = (U8 *)FRAME_GetDataPointer(pFrame, 2);
-#endif
+  debug("finish decode a frame, info : %d %d %d %d %d", buffer->iWidth,
+        buffer->iHeight, buffer->iFormat, buffer->iStride[0],
+        buffer->iStride[1]);
 
-  for (S32 i = 0; i < context->stDstBufInfo.UsrData.sSystemBuffer.iHeight;
-       i++) {
-    memcpy(tmp_pdata0, pData[0],
-           context->stDstBufInfo.UsrData.sSystemBuffer.iWidth);
-    tmp_pdata0 += context->stDstBufInfo.UsrData.sSystemBuffer.iWidth;
-    pData[0] += context->stDstBufInfo.UsrData.sSystemBuffer.iStride[0];
-  }
-
-  for (S32 i = 0; i < context->stDstBufInfo.UsrData.sSystemBuffer.iHeight / 2;
-       i++) {
-    memcpy(tmp_pdata1, pData[1],
-           context->stDstBufInfo.UsrData.sSystemBuffer.iWidth / 2);
-    memcpy(tmp_pdata2, pData[2],
-           context->stDstBufInfo.UsrData.sSystemBuffer.iWidth / 2);
-    tmp_pdata1 += context->stDstBufInfo.UsrData.sSystemBuffer.iWidth / 2;
-    tmp_pdata2 += context->stDstBufInfo.UsrData.sSystemBuffer.iWidth / 2;
-    pData[1] += context->stDstBufInfo.UsrData.sSystemBuffer.iStride[1];
-    pData[2] += context->stDstBufInfo.UsrData.sSystemBuffer.iStride[1];
-  }
-
-  debug("finish decode a frame, info : %d %d %d %d %d(%d)",
-        context->stDstBufInfo.UsrData.sSystemBuffer.iWidth,
-        context->stDstBufInfo.UsrData.sSystemBuffer.iHeight,
-        context->stDstBufInfo.UsrData.sSystemBuffer.iFormat,
-        context->stDstBufInfo.UsrData.sSystemBuffer.iStride[0],
-        context->stDstBufInfo.UsrData.sSystemBuffer.iStride[1],
-        FRAME_GetDataUsedNum(pFrame));
-
-  MppDataQueueNode *node = DATAQUEUE_Node_Create();
-  DATAQUEUE_SetData(node, FRAME_GetBaseData(pFrame));
-
-  ret = DATAQUEUE_Push(context->pOutputQueue, node);
   if (PACKET_GetEos(sink_packet)) {
     context->DecRetEos = MPP_TRUE;
   }
@@ -262,29 +378,160 @@ static S32 multithread_decode(ALBaseContext *ctx, MppData *sink_data) {
   return ret;
 }
 
-static S32 multithread_return(ALBaseContext *ctx, MppData *src_data) {
-  ALSoftOpenh264DecContext *context = (ALSoftOpenh264DecContext *)ctx;
-  struct DNode *del_node;
-  struct DNode *pre_node;
-  S32 ret = MPP_OK;
+/**
+ * @description: take the oldest output frame, the frames copied into the
+ * ring go before the decoder's picture.
+ * @return {*}: MPP_OK, MPP_CODER_NO_DATA or MPP_CODER_EOS
+ */
+static S32 take_output_frame(ALSoftOpenh264DecContext *context,
+                             MppFrame **frame) {
+  MppData *data = NULL;
+
+  if (!context->bOutputByReference && !context->bOutputStarted) {
+    if (!context->DecRetEos &&
+        DATAQUEUE_GetCurrentSize(context->pOutputQueue) <= 3)
+      return MPP_CODER_NO_DATA;
+    context->bOutputStarted = MPP_TRUE;
+  }
 
-  if (!src_data) return -1;
+  data = DATAQUEUE_PopData(context->pOutputQueue);
+  if (data) {
+    *frame = FRAME_GetFrame(data);
+    return MPP_OK;
+  }
 
-  MppFrame *src_frame = FRAME_GetFrame(src_data);
+  pthread_mutex_lock(&context->stMutex);
+  if (context->eRefState == REF_QUEUED) {
+    context->eRefState = REF_LENT;
+    *frame = context->pRefFrame;
+  }
+  pthread_mutex_unlock(&context->stMutex);
+  if (*frame) return MPP_OK;
 
-  debug("-------------- return a frame, %d", FRAME_GetDataUsedNum(src_frame));
+  return context->DecRetEos ? MPP_CODER_EOS : MPP_CODER_NO_DATA;
+}
 
-  if (context->RequestApi == 2) {
-    FRAME_Free(src_frame);
-    FRAME_Destory(src_frame);
-  } else {
-    FRAME_Free(src_frame);
+/**
+ * @description: keep the caller's planes of the frame in the lend
+ */
+static void save_owned_planes(ALSoftOpenh264DecLend *lend, MppFrame *frame) {
+  S32 i;
+
+  lend->eOwnedBufferType = FRAME_GetBufferType(frame);
+  lend->nOwnedDataUsedNum = FRAME_GetDataUsedNum(frame);
+  for (i = 0; i < 3; i++) {
+    lend->pOwnedData[i] =
+        i < lend->nOwnedDataUsedNum ? (U8 *)FRAME_GetDataPointer(frame, i)
+                                    : NULL;
   }
+}
 
-  return ret;
+/**
+ * @description: put back (or clear) every plane that was overwritten, then
+ * the count.
+ */
+static void restore_owned_planes(ALSoftOpenh264DecLend *lend,
+                                 MppFrame *frame) {
+  S32 i;
+
+  FRAME_SetBufferType(frame, lend->eOwnedBufferType);
+  for (i = 0; i < 3; i++) FRAME_SetDataPointer(frame, i, lend->pOwnedData[i]);
+  FRAME_SetDataUsedNum(frame, lend->nOwnedDataUsedNum);
 }
 
-#endif
+/**
+ * @description: called when the last reference of the lent frame is
+ * dropped, restore the caller's planes and recycle the output frame.
+ */
+static void release_lent_frame(MppFrame *frame, void *opaque) {
+  ALSoftOpenh264DecLend *lend = (ALSoftOpenh264DecLend *)opaque;
+  ALSoftOpenh264DecContext *context = lend->pContext;
+
+  restore_owned_planes(lend, frame);
+  put_output_frame(context, lend->pOutputFrame);
+
+  pthread_mutex_lock(&context->stMutex);
+  lend->pOutputFrame = NULL;
+  lend->bInUse = MPP_FALSE;
+  pthread_mutex_unlock(&context->stMutex);
+}
+
+/**
+ * @description: point the caller's frame at the output frame until it is
+ * returned.
+ */
+static S32 lend_frame(ALSoftOpenh264DecContext *context, MppFrame *frame,
+                      MppFrame *output) {
+  ALSoftOpenh264DecLend *lend = NULL;
+  U8 *data[3];
+  S32 i;
+
+  pthread_mutex_lock(&context->stMutex);
+  for (i = 0; i < OPENH264_DEC_LEND_NUM; i++) {
+    if (!context->stLend[i].bInUse) {
+      lend = &(context->stLend[i]);
+      lend->bInUse = MPP_TRUE;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&context->stMutex);
+
+  if (!lend) {
+    error("too many frames are lent, return some of them first!");
+    put_output_frame(context, output);
+    return MPP_CHECK_FAILED;
+  }
+
+  lend->pContext = context;
+  lend->pOutputFrame = output;
+  save_owned_planes(lend, frame);
+
+  get_planes(output, FRAME_GetWidth(output), FRAME_GetHeight(output), data);
+  FRAME_SetBufferType(frame, MPP_FRAME_BUFFERTYPE_NORMAL_EXTERNAL);
+  FRAME_SetDataUsedNum(frame, 3);
+  for (i = 0; i < 3; i++) FRAME_SetDataPointer(frame, i, data[i]);
+  FRAME_SetWidth(frame, FRAME_GetWidth(output));
+  FRAME_SetHeight(frame, FRAME_GetHeight(output));
+  FRAME_SetLineStride(frame, FRAME_GetLineStride(output));
+  FRAME_SetPixelFormat(frame, FRAME_GetPixelFormat(output));
+  FRAME_SetPts(frame, FRAME_GetPts(output));
+  FRAME_SetID(frame, FRAME_GetID(output));
+  FRAME_SetReleaseCallback(frame, release_lent_frame, lend);
+  // the caller's reference, dropped in al_dec_return_output_frame
+  if (!FRAME_GetRef(frame)) FRAME_Ref(frame);
+
+  return MPP_OK;
+}
+
+/**
+ * @description: copy the output frame into the caller's planes (allocated
+ * if it has none) and recycle the output frame.
+ */
+static S32 copy_output_frame(ALSoftOpenh264DecContext *context,
+                             MppFrame *frame, MppFrame *output) {
+  S32 width = FRAME_GetWidth(output);
+  S32 height = FRAME_GetHeight(output);
+  U8 *src[3];
+  S32 stride[2];
+
+  if (!FRAME_GetDataPointer(frame, 0) &&
+      FRAME_Alloc(frame, PIXEL_FORMAT_I420, width, height)) {
+    error("can not alloc the output frame, drop the picture!");
+    put_output_frame(context, output);
+    return MPP_MALLOC_FAILED;
+  }
+
+  get_planes(output, width, height, src);
+  stride[0] = FRAME_GetLineStride(output);
+  stride[1] = stride[0] / 2;
+  copy_picture(frame, src, stride, width, height);
+  FRAME_SetPts(frame, FRAME_GetPts(output));
+  FRAME_SetID(frame, FRAME_GetID(output));
+
+  put_output_frame(context, output);
+
+  return MPP_OK;
+}
 
 ALBaseContext *al_dec_create() {
   ALSoftOpenh264DecContext *context =
@@ -301,6 +548,8 @@ ALBaseContext *al_dec_create() {
   memset(&(context->stDstBufInfo), 0, sizeof(SBufferInfo));
   memset(&(context->stDecParam), 0, sizeof(SDecodingParam));
 
+  pthread_mutex_init(&context->stMutex, NULL);
+
   return &(context->stAlDecBaseContext.stAlBaseContext);
 }
 
@@ -318,6 +567,7 @@ RETURN al_dec_init(ALBaseContext *ctx, MppVdecPara *para) {
     context->pSvcDecoder = NULL;
   }
   para->eDataTransmissinMode = MPP_INPUT_SYNC_OUTPUT_ASYNC;
+  context->nOutputEventFd = para->nOutputEventFd;
 
   WelsCreateDecoder(&(context->pSvcDecoder));
 
@@ -330,19 +580,25 @@ RETURN al_dec_init(ALBaseContext *ctx, MppVdecPara *para) {
   context->stDecParam.sVideoProperty.eVideoBsType = VIDEO_BITSTREAM_AVC;
   context->pSvcDecoder->Initialize(&(context->stDecParam));
 
-#ifdef SINGLE_THREAD_TEST
-  context->pData[0] = NULL;
-  context->pData[1] = NULL;
-  context->pData[2] = NULL;
-  pthread_mutex_init(&gMutex, NULL);
-  pthread_cond_init(&gCond, NULL);
+  // pop never blocks, an empty queue is MPP_CODER_NO_DATA
+  if (!context->pOutputQueue)
+    context->pOutputQueue = DATAQUEUE_Init(MPP_TRUE, MPP_FALSE);
+  if (!context->pOutputQueue) {
+    error("can not create the output queue, please check!");
+    return MPP_INIT_FAILED;
+  }
 
-#else
-  context->pOutputQueue = DATAQUEUE_Init(MPP_TRUE, MPP_TRUE);
+  context->bOutputByReference = para->bOutputByReference;
+  if (context->bOutputByReference && !context->pRefFrame) {
+    context->pRefFrame = FRAME_Create();
+    if (!context->pRefFrame) return MPP_MALLOC_FAILED;
+    FRAME_SetBufferType(context->pRefFrame,
+                        MPP_FRAME_BUFFERTYPE_NORMAL_EXTERNAL);
+  }
 
-#endif
-  debug("finish ----------------- init (%d, %d, %d)", para->eOutputPixelFormat,
-        para->nWidth, para->nHeight);
+  debug("finish ----------------- init (%d, %d, %d), by reference %d",
+        para->eOutputPixelFormat, para->nWidth, para->nHeight,
+        context->bOutputByReference);
 
   return MPP_OK;
 }
@@ -375,44 +631,28 @@ S32 al_dec_decode(ALBaseContext *ctx, MppData *sink_data) {
     return ret;
   }
 
-#ifdef SINGLE_THREAD_TEST
-  ret = singlethread_decode(ctx, sink_data);
-
-#else
-  ret = multithread_decode(ctx, sink_data);
+  ret = decode_packet(context, sink_packet);
+  if (!DATAQUEUE_IsEmpty(context->pOutputQueue) ||
+      REF_QUEUED == context->eRefState || context->DecRetEos)
+    mpp_notify_signal(context->nOutputEventFd);
 
-#endif
   return ret;
 }
+
 S32 al_dec_request_output_frame_2(ALBaseContext *ctx, MppData **src_data) {
   ALSoftOpenh264DecContext *context = (ALSoftOpenh264DecContext *)ctx;
+  MppFrame *frame = NULL;
   S32 ret = MPP_OK;
-  static int flag = 0;
-  MppDataQueueNode *node;
-  MppFrame *src_frame = FRAME_GetFrame(*src_data);
-
-  if (context->DecRetEos && DATAQUEUE_IsEmpty(context->pOutputQueue) == 1) {
-    debug("ret dec eos");
-
-    return MPP_CODER_EOS;
-  }
-
-  if (flag == 0) {
-    // gstreamer first handle frame, but buffer pool still not active, wait some
-    // time
-    if (DATAQUEUE_GetCurrentSize(context->pOutputQueue) > 3) flag = 1;
-    return MPP_CODER_NO_DATA;
-  }
 
-  node = DATAQUEUE_Pop(context->pOutputQueue);
-  if (!node) {
-    return context->DecRetEos ? MPP_CODER_EOS : MPP_CODER_NO_DATA;
+  ret = take_output_frame(context, &frame);
+  if (ret) {
+    if (ret == MPP_CODER_EOS) debug("ret dec eos");
+    return ret;
   }
-  *src_data = DATAQUEUE_GetData(node);
 
-  DATAQUEUE_Node_Destory(node);
+  *src_data = FRAME_GetBaseData(frame);
 
-  debug("----- frame %d request, left: %d ", FRAME_GetDataUsedNum(src_frame),
+  debug("----- frame %d request, left: %d ", FRAME_GetID(frame),
         DATAQUEUE_GetCurrentSize(context->pOutputQueue));
 
   context->RequestApi = 2;
@@ -421,41 +661,32 @@ S32 al_dec_request_output_frame_2(ALBaseContext *ctx, MppData **src_data) {
 
 S32 al_dec_request_output_frame(ALBaseContext *ctx, MppData *src_data) {
   ALSoftOpenh264DecContext *context = (ALSoftOpenh264DecContext *)ctx;
-  MppDataQueueNode *node;
-  S32 ret = MPP_OK;
-  static int flag = 0;
   MppFrame *src_frame = FRAME_GetFrame(src_data);
+  ALSoftOpenh264DecLend *lend = NULL;
+  MppFrame *frame = NULL;
+  S32 ret = MPP_OK;
 
-#ifdef SINGLE_THREAD_TEST
-  ret = singlethread_request(ctx, src_data);
-
-#else
-  if (context->DecRetEos && DATAQUEUE_IsEmpty(context->pOutputQueue) == 1) {
-    debug("ret dec eos");
-
-    return MPP_CODER_EOS;
-  }
-
-  if (flag == 0) {
-    if (DATAQUEUE_GetCurrentSize(context->pOutputQueue) > 3) flag = 1;
-    return MPP_CODER_NO_DATA;
+  ret = take_output_frame(context, &frame);
+  if (ret) {
+    if (ret == MPP_CODER_EOS) debug("ret dec eos");
+    return ret;
   }
 
-  node = DATAQUEUE_Pop(context->pOutputQueue);
-  if (!node) {
-    return context->DecRetEos ? MPP_CODER_EOS : MPP_CODER_NO_DATA;
+  // zero copy: the caller reads the ring (or the decoder's picture), a
+  // frame somebody else still holds (or still lent) is not lent again
+  lend = (ALSoftOpenh264DecLend *)FRAME_GetReleaseOpaque(src_frame);
+  if (!lend && FRAME_GetRef(src_frame) <= 1) {
+    ret = lend_frame(context, src_frame, frame);
+  } else {
+    // copy into the caller's planes, the release keeps them then
+    if (lend) restore_owned_planes(lend, src_frame);
+    ret = copy_output_frame(context, src_frame, frame);
+    if (lend) save_owned_planes(lend, src_frame);
   }
 
-  memcpy(src_data, DATAQUEUE_GetData(node), FRAME_GetStructSize());
-  FRAME_Destory(FRAME_GetFrame(DATAQUEUE_GetData(node)));
-
-  DATAQUEUE_Node_Destory(node);
-
-  debug("----- frame %d request, left: %d ", FRAME_GetDataUsedNum(src_frame),
+  debug("----- frame %d request, left: %d ", FRAME_GetID(src_frame),
         DATAQUEUE_GetCurrentSize(context->pOutputQueue));
 
-#endif
-
   context->RequestApi = 0;
 
   return ret;
@@ -463,16 +694,28 @@ S32 al_dec_request_output_frame(ALBaseContext *ctx, MppData *src_data) {
 
 S32 al_dec_return_output_frame(ALBaseContext *ctx, MppData *src_data) {
   ALSoftOpenh264DecContext *context = (ALSoftOpenh264DecContext *)ctx;
-  S32 ret = MPP_OK;
 
-#ifdef SINGLE_THREAD_TEST
-  ret = singlethread_return(ctx, src_data);
+  if (!src_data) return -1;
 
-#else
-  ret = multithread_return(ctx, src_data);
-#endif
+  MppFrame *frame = FRAME_GetFrame(src_data);
 
-  return ret;
+  debug("-------------- return a frame, %d", FRAME_GetID(frame));
+
+  // the output frame itself was handed out
+  if (context->RequestApi == 2) {
+    put_output_frame(context, frame);
+    return MPP_OK;
+  }
+
+  // not lent, nothing to give back
+  if (!FRAME_GetReleaseOpaque(frame)) return MPP_OK;
+
+  // the release callback runs (and is cleared with its opaque) when the
+  // last reference is dropped, the caller's own reference is taken again so
+  // it can request the next one
+  if (FRAME_UnRef(frame) == 0) FRAME_Ref(frame);
+
+  return MPP_OK;
 }
 
 void al_dec_destory(ALBaseContext *ctx) {
@@ -482,6 +725,7 @@ void al_dec_destory(ALBaseContext *ctx) {
   }
 
   ALSoftOpenh264DecContext *context = (ALSoftOpenh264DecContext *)ctx;
+  MppData *data = NULL;
 
   if (context->pSvcDecoder) {
     context->pSvcDecoder->Uninitialize();
@@ -489,6 +733,57 @@ void al_dec_destory(ALBaseContext *ctx) {
     context->pSvcDecoder = NULL;
   }
 
+  if (context->pOutputQueue) {
+    while ((data = DATAQUEUE_PopData(context->pOutputQueue)))
+      put_output_frame(context, FRAME_GetFrame(data));
+    DATAQUEUE_Destory(context->pOutputQueue);
+    context->pOutputQueue = NULL;
+  }
+
+  // frames of the ring still lent are freed when they are put back
+  if (context->pRing) {
+    FRAMEPOOL_Destory(context->pRing);
+    context->pRing = NULL;
+  }
+
+  if (context->pRefFrame) {
+    FRAME_Destory(context->pRefFrame);
+    context->pRefFrame = NULL;
+  }
+
+  pthread_mutex_destroy(&context->stMutex);
+
   free(context);
   context = NULL;
 }
+
+/**
+ * descriptor of the whole soft_openh264 library, openh264enc.cpp is in it
+ * too, H.264 only, up to level 5.2
+ */
+static const MppCodingType stOpenh264CodingTypes[] = {CODING_H264};
+
+static const MppPixelFormat stOpenh264PixelFormats[] = {
+    PIXEL_FORMAT_I420,
+    PIXEL_FORMAT_NV12,
+    PIXEL_FORMAT_NV21,
+    PIXEL_FORMAT_YV12,
+};
+
+static const ALPluginCaps stOpenh264Caps = {
+    AL_PLUGIN_CAPS_VERSION,
+    CODEC_OPENH264,
+    stOpenh264CodingTypes,
+    NUM_OF(stOpenh264CodingTypes),
+    stOpenh264CodingTypes,
+    NUM_OF(stOpenh264CodingTypes),
+    stOpenh264PixelFormats,
+    NUM_OF(stOpenh264PixelFormats),
+    4096,
+    2304,
+    AL_PLUGIN_MEMORY_MODE(MPP_FRAME_BUFFERTYPE_NORMAL_INTERNAL),
+    0,
+    120,
+};
+
+const ALPluginCaps *al_plugin_get_caps() { return &stOpenh264Caps; }
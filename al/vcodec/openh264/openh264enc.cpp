@@ -5,19 +5,22 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-17 09:38:40
- * @LastEditTime: 2023-02-01 19:13:45
+ * @LastEditTime: 2024-06-01 18:10:24
  * @Description: video encode plugin for openh264, only can encode H.264 stream
  */
 
 //#define ENABLE_DEBUG 1
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "al_interface_enc.h"
+#include "g2d_cpu_kernels.h"
 #include "log.h"
+#include "notify.h"
 #include "wels/codec_api.h"
 #include "wels/codec_app_def.h"
 #include "wels/codec_def.h"
@@ -25,33 +28,62 @@
 
 #define MODULE_TAG "openh264enc"
 
+/***
+ * encoded frames waiting for the caller, al_enc_encode returns
+ * MPP_DATAQUEUE_FULL when all of them are taken.
+ */
+#define OPENH264_ENC_SLOT_NUM 8
+
 typedef struct _ALSoftOpenh264EncContext ALSoftOpenh264EncContext;
 
+/***
+ * one encoded frame, the buffer is kept and only grows
+ */
+typedef struct _ALSoftOpenh264EncSlot {
+  MppPacket *pPacket;
+  S32 nSize;
+} ALSoftOpenh264EncSlot;
+
 struct _ALSoftOpenh264EncContext {
   ALEncBaseContext stAlEncBaseContext;
   ISVCEncoder *pSvcEncoder;
-  SEncParamBase stParam;
+  SEncParamExt stParam;
   SFrameBSInfo stInfo;
   SSourcePicture stPic;
   S32 bResult;
   S32 EncRetEos;
-};
-/*node*/
-struct DNode {
-  struct DNode *next;
 
-  MppPacket *pPacket;
-  S32 num;
+  /***
+   * nOutputEventFd of MppVencPara, signaled when a frame is put into the
+   * ring or the stream ends
+   */
+  S32 nOutputEventFd;
+
+  /***
+   * input format of the caller, semi-planar input is split into the
+   * planar chroma of pChroma (the luma is used where it is) before encoding.
+   */
+  MppPixelFormat eInputFormat;
+  S32 nInputStride;
+  U8 *pChroma;
+  G2dCpuJob stSplitJob;
+
+  /***
+   * ring of encoded frames, written by al_enc_encode, read and given back
+   * in order by al_enc_request/return_output_stream.
+   */
+  ALSoftOpenh264EncSlot stSlot[OPENH264_ENC_SLOT_NUM];
+  S64 nSlotWrite;
+  S64 nSlotRead;
+  pthread_mutex_t stSlotMutex;
+
+  /***
+   * the caller's own buffer, put back when the packet is returned
+   */
+  U8 *pOwnedPacketData;
+  U8 *pLentPacketData;
 };
 
-struct DList {
-  struct DNode *fnode;
-  S32 count;
-  pthread_mutex_t mutex;
-};
-
-static struct DList *srcDataList = NULL;
-
 ALBaseContext *al_enc_create() {
   ALSoftOpenh264EncContext *enc_context =
       (ALSoftOpenh264EncContext *)malloc(sizeof(ALSoftOpenh264EncContext));
@@ -63,11 +95,12 @@ ALBaseContext *al_enc_create() {
 
   enc_context->pSvcEncoder = NULL;
 
-  memset(&(enc_context->stParam), 0, sizeof(SEncParamBase));
+  memset(&(enc_context->stParam), 0, sizeof(SEncParamExt));
   memset(&(enc_context->stInfo), 0, sizeof(SFrameBSInfo));
   memset(&(enc_context->stPic), 0, sizeof(SSourcePicture));
 
   enc_context->bResult = 1;
+  pthread_mutex_init(&enc_context->stSlotMutex, NULL);
 
   return &(enc_context->stAlEncBaseContext.stAlBaseContext);
 }
@@ -76,6 +109,7 @@ RETURN al_enc_init(ALBaseContext *ctx, MppVencPara *para) {
   ALSoftOpenh264EncContext *enc_context = (ALSoftOpenh264EncContext *)ctx;
   S32 ret = 0;
 
+  enc_context->nOutputEventFd = para->nOutputEventFd;
   if (enc_context->pSvcEncoder != NULL) {
     enc_context->pSvcEncoder->Uninitialize();
     WelsDestroySVCEncoder(enc_context->pSvcEncoder);
@@ -85,35 +119,222 @@ RETURN al_enc_init(ALBaseContext *ctx, MppVencPara *para) {
   ret = WelsCreateSVCEncoder(&enc_context->pSvcEncoder);
   if (ret || !enc_context->pSvcEncoder) {
     error("Create Openh264 encoder failed, Please check it !");
+    return MPP_INIT_FAILED;
   }
 
-  // create & init node list
-  srcDataList = (struct DList *)malloc(sizeof(struct DList));
-  if (!srcDataList) {
-    error("srcDataList is NULL, please check it !");
-    return MPP_NULL_POINTER;
+  return MPP_OK;
+}
+
+static void set_threading(SEncParamExt *param, MppVencPara *para) {
+  // 0 is "one per core" for openh264, in MPP it keeps the old single thread
+  if (para->nThreadCount == MPP_THREAD_COUNT_AUTO)
+    param->iMultipleThreadIdc = 0;
+  else if (para->nThreadCount > 0)
+    param->iMultipleThreadIdc = para->nThreadCount;
+  else
+    param->iMultipleThreadIdc = 1;
+
+  if (para->eThreadType == CODEC_THREAD_FRAME)
+    info("openh264 has slice threads only, frame threads are not used");
+}
+
+/**
+ * @description: openh264 gives every thread its own slices, a single slice
+ * frame is encoded by one thread whatever iMultipleThreadIdc is.
+ */
+static void set_slices(SEncParamExt *param, MppVencPara *para) {
+  SSliceArgument *slice = &(param->sSpatialLayers[0].sSliceArgument);
+
+  switch (para->eSliceMode) {
+    case MPP_VENC_SLICE_SINGLE:
+      slice->uiSliceMode = SM_SINGLE_SLICE;
+      break;
+    case MPP_VENC_SLICE_FIXED_NUM:
+      slice->uiSliceMode = SM_FIXEDSLCNUM_SLICE;
+      slice->uiSliceNum = para->nSliceNum > 0 ? para->nSliceNum : 0;
+      break;
+    case MPP_VENC_SLICE_SIZE_LIMITED:
+      if (para->nSliceSize <= 0) {
+        error("slice size %d is not valid, use one slice", para->nSliceSize);
+        slice->uiSliceMode = SM_SINGLE_SLICE;
+        break;
+      }
+      slice->uiSliceMode = SM_SIZELIMITED_SLICE;
+      slice->uiSliceSizeConstraint = para->nSliceSize;
+      param->uiMaxNalSize = para->nSliceSize;
+      break;
+    case MPP_VENC_SLICE_AUTO:
+    default:
+      // uiSliceNum 0 is one slice per thread
+      slice->uiSliceMode = param->iMultipleThreadIdc == 1
+                               ? SM_SINGLE_SLICE
+                               : SM_FIXEDSLCNUM_SLICE;
+      slice->uiSliceNum = 0;
+      break;
+  }
+}
+
+/**
+ * @description: openh264 has no constant quality mode, CRF is encoded as
+ * CQP with the same quantizer.
+ */
+static void set_rate_control(SEncParamExt *param, MppVencPara *para) {
+  switch (para->eRcMode) {
+    case MPP_RC_MODE_CBR:
+      param->iRCMode = RC_BITRATE_MODE;
+      param->bEnableFrameSkip = true;
+      param->iMaxBitrate = para->nBitrate;
+      param->sSpatialLayers[0].iMaxSpatialBitrate = para->nBitrate;
+      break;
+    case MPP_RC_MODE_CRF:
+      info("openh264 has no crf, use cqp %d", para->nQp);
+      // fall through
+    case MPP_RC_MODE_CQP:
+      param->iRCMode = RC_OFF_MODE;
+      if (para->nQp <= 0) break;
+      param->sSpatialLayers[0].iDLayerQp = para->nQp;
+      param->iMinQp = para->nQp;
+      param->iMaxQp = para->nQp;
+      break;
+    case MPP_RC_MODE_VBR:
+    default:
+      param->iRCMode = RC_QUALITY_MODE;
+      break;
+  }
+
+  debug("rc mode %d, bitrate %d, qp %d", para->eRcMode, para->nBitrate,
+        para->nQp);
+}
+
+static void set_complexity(SEncParamExt *param, MppVencPara *para) {
+  switch (para->ePreset) {
+    case MPP_VENC_PRESET_FASTEST:
+    case MPP_VENC_PRESET_FAST:
+      param->iComplexityMode = LOW_COMPLEXITY;
+      break;
+    case MPP_VENC_PRESET_MEDIUM:
+      param->iComplexityMode = MEDIUM_COMPLEXITY;
+      break;
+    case MPP_VENC_PRESET_SLOW:
+      param->iComplexityMode = HIGH_COMPLEXITY;
+      break;
+    case MPP_VENC_PRESET_DEFAULT:
+    default:
+      break;
   }
-  srcDataList->count = 0;
-  srcDataList->fnode = NULL;
+}
 
-  pthread_mutex_init(&srcDataList->mutex, NULL);
+/**
+ * @description: the planar formats are given to openh264 as they are, the
+ * semi-planar ones get a chroma buffer for the split.
+ */
+static RETURN set_input_format(ALSoftOpenh264EncContext *enc_context,
+                               MppVencPara *para) {
+  G2dCpuJob *job = &(enc_context->stSplitJob);
+  S32 chroma_width = para->nWidth / 2;
+  S32 chroma_height = para->nHeight / 2;
+  S32 chroma_size = chroma_width * chroma_height;
+  S32 i;
+
+  enc_context->eInputFormat = para->PixelFormat;
+  enc_context->nInputStride = para->nStride ? para->nStride : para->nWidth;
+  enc_context->stPic.iStride[0] = enc_context->nInputStride;
+  enc_context->stPic.iStride[1] = enc_context->stPic.iStride[2] =
+      enc_context->nInputStride >> 1;
+
+  switch (para->PixelFormat) {
+    case PIXEL_FORMAT_UNKNOWN:  // callers from before were all I420
+    case PIXEL_FORMAT_I420:
+    case PIXEL_FORMAT_YV12:
+      return MPP_OK;
+    case PIXEL_FORMAT_NV12:
+    case PIXEL_FORMAT_NV21:
+      break;
+    default:
+      error("openh264 can not encode %s, please check!",
+            mpp_pixelformat2str(para->PixelFormat));
+      return MPP_NOT_SUPPORTED_FORMAT;
+  }
+
+  if (enc_context->pChroma) free(enc_context->pChroma);
+  enc_context->pChroma = (U8 *)malloc(chroma_size * 2);
+  if (!enc_context->pChroma) {
+    error("can not malloc the chroma buffer, please check!");
+    return MPP_MALLOC_FAILED;
+  }
+  enc_context->stPic.iStride[1] = enc_context->stPic.iStride[2] =
+      chroma_width;
+
+  // the data pointers are filled for every frame
+  memset(job, 0, sizeof(G2dCpuJob));
+  job->eKernel = G2D_CPU_KERNEL_SP_TO_P;
+  job->stSrc.nPlanes = 2;
+  job->stDst.nPlanes = 3;
+  for (i = 0; i < 3; i++) {
+    G2dCpuPlane *plane = &(job->stDst.stPlane[i]);
+    plane->nWidth = i ? chroma_width : para->nWidth;
+    plane->nHeight = i ? chroma_height : para->nHeight;
+    plane->nStride = i ? chroma_width : enc_context->nInputStride;
+    plane->nBytes = 1;
+    if (i < 2) job->stSrc.stPlane[i] = *plane;
+  }
+  job->stSrc.stPlane[1].nBytes = 2;
+  job->stSrc.stPlane[1].nStride = enc_context->nInputStride;
+
+  // NV21 has V first, the even bytes go to the V plane
+  job->stDst.stPlane[1].pData = enc_context->pChroma;
+  job->stDst.stPlane[2].pData = enc_context->pChroma + chroma_size;
+  if (para->PixelFormat == PIXEL_FORMAT_NV21) {
+    job->stDst.stPlane[1].pData = enc_context->pChroma + chroma_size;
+    job->stDst.stPlane[2].pData = enc_context->pChroma;
+  }
+  enc_context->stPic.pData[1] = enc_context->pChroma;
+  enc_context->stPic.pData[2] = enc_context->pChroma + chroma_size;
 
   return MPP_OK;
 }
 
 S32 al_enc_set_para(ALBaseContext *ctx, MppVencPara *para) {
   ALSoftOpenh264EncContext *enc_context = (ALSoftOpenh264EncContext *)ctx;
+  SEncParamExt *param = &(enc_context->stParam);
+  SSpatialLayerConfig *layer = &(param->sSpatialLayers[0]);
   S32 ret = 0;
   S32 video_format = -1;
 
-  enc_context->stParam.iUsageType =
-      CAMERA_VIDEO_REAL_TIME;  // from EUsageType enum
-  enc_context->stParam.fMaxFrameRate = para->nFrameRate;
-  enc_context->stParam.iPicWidth = para->nWidth;
-  enc_context->stParam.iPicHeight = para->nHeight;
-  enc_context->stParam.iTargetBitrate = para->nBitrate;
-  ret = enc_context->pSvcEncoder->Initialize(&enc_context->stParam);
-  if (ret != cmResultSuccess) error("Initialize encoder is fail");
+  ret = set_input_format(enc_context, para);
+  if (ret) return ret;
+
+  enc_context->pSvcEncoder->GetDefaultParams(param);
+  param->iUsageType = CAMERA_VIDEO_REAL_TIME;  // from EUsageType enum
+  param->fMaxFrameRate = para->nFrameRate;
+  param->iPicWidth = para->nWidth;
+  param->iPicHeight = para->nHeight;
+  param->iTargetBitrate = para->nBitrate;
+  if (para->nGop > 0) param->uiIntraPeriod = para->nGop;
+
+  param->iSpatialLayerNum = 1;
+  layer->iVideoWidth = para->nWidth;
+  layer->iVideoHeight = para->nHeight;
+  layer->fFrameRate = para->nFrameRate;
+  layer->iSpatialBitrate = para->nBitrate;
+
+  set_threading(param, para);
+  set_slices(param, para);
+  set_rate_control(param, para);
+  set_complexity(param, para);
+
+  ret = enc_context->pSvcEncoder->InitializeExt(param);
+  if (ret != cmResultSuccess) {
+    error("Initialize encoder is fail, ret = %d", ret);
+    return MPP_INIT_FAILED;
+  }
+
+  // openh264 clamps the threads to the cores and to the slices
+  enc_context->pSvcEncoder->GetOption(ENCODER_OPTION_SVC_ENCODE_PARAM_EXT,
+                                      param);
+  para->nThreadCount = param->iMultipleThreadIdc;
+  para->eThreadType =
+      param->iMultipleThreadIdc > 1 ? CODEC_THREAD_SLICE : CODEC_THREAD_AUTO;
 
   // enc_context->pSvcEncoder->SetOption (ENCODER_OPTION_TRACE_LEVEL,
   // &g_LevelSetting);
@@ -123,9 +344,90 @@ S32 al_enc_set_para(ALBaseContext *ctx, MppVencPara *para) {
   enc_context->stPic.iPicWidth = para->nWidth;
   enc_context->stPic.iPicHeight = para->nHeight;
   enc_context->stPic.iColorFormat = videoFormatI420;
-  enc_context->stPic.iStride[0] = para->nStride;
-  enc_context->stPic.iStride[1] = enc_context->stPic.iStride[2] =
-      para->nStride >> 1;
+
+  info("init finish, %dx%d %s, %d threads, slice mode %d, rc mode %d",
+       para->nWidth, para->nHeight, mpp_pixelformat2str(para->PixelFormat),
+       para->nThreadCount, layer->sSliceArgument.uiSliceMode, param->iRCMode);
+
+  return MPP_OK;
+}
+
+/**
+ * @description: point stPic at the planes of the frame, semi-planar chroma
+ * is split into pChroma first.
+ */
+static RETURN set_input_picture(ALSoftOpenh264EncContext *enc_context,
+                                MppFrame *frame) {
+  SSourcePicture *pic = &(enc_context->stPic);
+  G2dCpuJob *job = &(enc_context->stSplitJob);
+  U8 *luma = (U8 *)FRAME_GetDataPointer(frame, 0);
+  S32 luma_size = enc_context->nInputStride * pic->iPicHeight;
+  S32 planes = FRAME_GetDataUsedNum(frame);
+
+  pic->pData[0] = luma;
+
+  switch (enc_context->eInputFormat) {
+    case PIXEL_FORMAT_NV12:
+    case PIXEL_FORMAT_NV21:
+      job->stSrc.stPlane[0].pData = luma;
+      job->stSrc.stPlane[1].pData =
+          planes > 1 ? (U8 *)FRAME_GetDataPointer(frame, 1) : luma + luma_size;
+      job->stDst.stPlane[0].pData = luma;
+      return g2d_cpu_run(job, 0, pic->iPicHeight, MPP_TRUE);
+    case PIXEL_FORMAT_YV12:
+      pic->pData[2] = planes > 1 ? (U8 *)FRAME_GetDataPointer(frame, 1)
+                                 : luma + luma_size;
+      pic->pData[1] = planes > 2 ? (U8 *)FRAME_GetDataPointer(frame, 2)
+                                 : luma + luma_size * 5 / 4;
+      return MPP_OK;
+    case PIXEL_FORMAT_I420:
+    default:
+      pic->pData[1] = planes > 1 ? (U8 *)FRAME_GetDataPointer(frame, 1)
+                                 : luma + luma_size;
+      pic->pData[2] = planes > 2 ? (U8 *)FRAME_GetDataPointer(frame, 2)
+                                 : luma + luma_size * 5 / 4;
+      return MPP_OK;
+  }
+}
+
+/**
+ * @description: copy the layers of the encoded frame into the slot, its
+ * buffer is allocated again only when the frame is bigger.
+ */
+static S32 fill_slot(ALSoftOpenh264EncSlot *slot, const SFrameBSInfo *info) {
+  S32 length = 0;
+  S32 i, j;
+
+  for (i = 0; i < info->iLayerNum; ++i) {
+    const SLayerBSInfo &layerInfo = info->sLayerInfo[i];
+    for (j = 0; j < layerInfo.iNalCount; ++j)
+      length += layerInfo.pNalLengthInByte[j];
+  }
+  debug("buf_length = %d", length);
+
+  if (!slot->pPacket) {
+    slot->pPacket = PACKET_Create();
+    if (!slot->pPacket) return MPP_MALLOC_FAILED;
+  }
+
+  if (length > slot->nSize) {
+    if (slot->nSize) PACKET_Free(slot->pPacket);
+    slot->nSize = 0;
+    if (PACKET_Alloc(slot->pPacket, length)) return MPP_MALLOC_FAILED;
+    slot->nSize = length;
+  }
+
+  length = 0;
+  for (i = 0; i < info->iLayerNum; ++i) {
+    const SLayerBSInfo &layerInfo = info->sLayerInfo[i];
+    S32 layer_size = 0;
+    for (j = 0; j < layerInfo.iNalCount; ++j)
+      layer_size += layerInfo.pNalLengthInByte[j];
+    memcpy((U8 *)PACKET_GetDataPointer(slot->pPacket) + length,
+           layerInfo.pBsBuf, layer_size);
+    length += layer_size;
+  }
+  PACKET_SetLength(slot->pPacket, length);
 
   return MPP_OK;
 }
@@ -133,8 +435,8 @@ S32 al_enc_set_para(ALBaseContext *ctx, MppVencPara *para) {
 S32 al_enc_encode(ALBaseContext *ctx, MppData *sink_data) {
   ALSoftOpenh264EncContext *enc_context = (ALSoftOpenh264EncContext *)ctx;
   MppFrame *frame = FRAME_GetFrame(sink_data);
-  struct DNode *ins_node = NULL;
-  static U32 num = 1;
+  ALSoftOpenh264EncSlot *slot = NULL;
+  BOOL full;
   S32 ret = 0;
 
   if (!ctx) {
@@ -152,13 +454,26 @@ S32 al_enc_encode(ALBaseContext *ctx, MppData *sink_data) {
     return MPP_CHECK_FAILED;
   }
 
+  // refuse before encoding, the caller sends the same frame again
+  pthread_mutex_lock(&enc_context->stSlotMutex);
+  full = enc_context->nSlotWrite - enc_context->nSlotRead >=
+         OPENH264_ENC_SLOT_NUM;
+  pthread_mutex_unlock(&enc_context->stSlotMutex);
+  if (full) return MPP_DATAQUEUE_FULL;
+
   if (FRAME_GetEos(frame)) {
     enc_context->EncRetEos = MPP_TRUE;
+    if (FRAME_GetEos(frame) == FRAME_EOS_WITHOUT_DATA) {
+      mpp_notify_signal(enc_context->nOutputEventFd);
+      return MPP_OK;
+    }
   }
 
-  enc_context->stPic.pData[0] = (U8 *)FRAME_GetDataPointer(frame, 0);
-  enc_context->stPic.pData[1] = (U8 *)FRAME_GetDataPointer(frame, 1);
-  enc_context->stPic.pData[2] = (U8 *)FRAME_GetDataPointer(frame, 2);
+  ret = set_input_picture(enc_context, frame);
+  if (ret) {
+    error("can not prepare the input frame, ret = %d", ret);
+    return ret;
+  }
 
   // encode a frame
   ret = enc_context->pSvcEncoder->EncodeFrame(&enc_context->stPic,
@@ -171,163 +486,86 @@ S32 al_enc_encode(ALBaseContext *ctx, MppData *sink_data) {
 
   if (!enc_context->bResult &&
       enc_context->stInfo.eFrameType != videoFrameTypeSkip) {
-    // output bitstream handling
-    S32 buf_length = 0;
-
-    for (S32 i = 0; i < enc_context->stInfo.iLayerNum; ++i) {
-      const SLayerBSInfo &layerInfo = enc_context->stInfo.sLayerInfo[i];
-      S32 layer_size = 0;
-      for (S32 j = 0; j < layerInfo.iNalCount; ++j) {
-        layer_size += layerInfo.pNalLengthInByte[j];
-      }
-      buf_length += layer_size;
-      debug("buf_length = %d", buf_length);
-    }
-
-    // insert node malloc
-    ins_node = (struct DNode *)malloc(sizeof(struct DNode));
-    ins_node->pPacket = PACKET_Create();
-    PACKET_Alloc(ins_node->pPacket, buf_length);
-    PACKET_SetLength(ins_node->pPacket, buf_length);
-
-    buf_length = 0;
-    for (S32 i = 0; i < enc_context->stInfo.iLayerNum; ++i) {
-      const SLayerBSInfo &layerInfo = enc_context->stInfo.sLayerInfo[i];
-      S32 layer_size = 0;
-      for (S32 j = 0; j < layerInfo.iNalCount; ++j) {
-        layer_size += layerInfo.pNalLengthInByte[j];
-      }
-      memcpy((U8 *)PACKET_GetDataPointer(ins_node->pPacket) + buf_length,
-             layerInfo.pBsBuf, layer_size);
-      buf_length += layer_size;
-    }
+    // only this thread writes, the slot is not visible until nSlotWrite++
+    slot = &(enc_context->stSlot[enc_context->nSlotWrite %
+                                 OPENH264_ENC_SLOT_NUM]);
     enc_context->bResult = 1;
-
-    // insert node to list
-    pthread_mutex_lock(&srcDataList->mutex);
-    if (srcDataList->fnode == NULL) {
-      srcDataList->fnode = ins_node;
-      ins_node->next = NULL;
-    } else {
-      ins_node->next = srcDataList->fnode;
-      srcDataList->fnode = ins_node;
+    ret = fill_slot(slot, &(enc_context->stInfo));
+    if (ret) {
+      error("can not fill the output slot, drop the frame!");
+      return ret;
     }
+    PACKET_SetPts(slot->pPacket, FRAME_GetPts(frame));
 
-    ins_node->num = num;
-    num++;
-    srcDataList->count++;
-    pthread_mutex_unlock(&srcDataList->mutex);
+    pthread_mutex_lock(&enc_context->stSlotMutex);
+    enc_context->nSlotWrite++;
+    pthread_mutex_unlock(&enc_context->stSlotMutex);
+    mpp_notify_signal(enc_context->nOutputEventFd);
 
     return 0;
   } else {
     debug("encode a frame, but skip");
   }
 
+  // EOS with data and a skipped last frame, only the end is left to see
+  if (enc_context->EncRetEos) mpp_notify_signal(enc_context->nOutputEventFd);
+
   return ret;
 }
 
 S32 al_enc_request_output_stream(ALBaseContext *ctx, MppData *src_data) {
   ALSoftOpenh264EncContext *enc_context = (ALSoftOpenh264EncContext *)ctx;
-  struct DNode *req_node;
-  struct DNode *pre_node;
+  MppPacket *src_packet = PACKET_GetPacket(src_data);
+  ALSoftOpenh264EncSlot *slot = NULL;
   S32 ret = MPP_OK;
 
-  pthread_mutex_lock(&srcDataList->mutex);
-
-  req_node = srcDataList->fnode;
-  pre_node = req_node;
-
-  if (req_node == NULL) {
-    ret = MPP_CODER_NO_DATA;
-
-    if (enc_context->EncRetEos) {
-      ret = MPP_CODER_EOS;
-    }
-
-    pthread_mutex_unlock(&srcDataList->mutex);
+  pthread_mutex_lock(&enc_context->stSlotMutex);
+  if (enc_context->nSlotRead == enc_context->nSlotWrite) {
+    ret = enc_context->EncRetEos ? MPP_CODER_EOS : MPP_CODER_NO_DATA;
+    pthread_mutex_unlock(&enc_context->stSlotMutex);
     return ret;
   }
-#if 0
-    struct DNode *tmp_node = req_node;
-    debug ("be req");
-
-    while (tmp_node != NULL) {
-        debug ("%d ", tmp_node->num);
-        tmp_node = tmp_node->next;
-    }
-    debug ("af req");
-#endif
-
-  while (req_node->next != NULL) req_node = req_node->next;
-
-  // TODO: if src_frame pData had memory, need copy again
-  MppPacket *src_packet = PACKET_GetPacket(src_data);
-
-  PACKET_SetDataPointer(src_packet,
-                        (U8 *)PACKET_GetDataPointer(req_node->pPacket));
-  PACKET_SetLength(src_packet, PACKET_GetLength(req_node->pPacket));
-
-  pthread_mutex_unlock(&srcDataList->mutex);
+  slot =
+      &(enc_context->stSlot[enc_context->nSlotRead % OPENH264_ENC_SLOT_NUM]);
+  pthread_mutex_unlock(&enc_context->stSlotMutex);
+
+  // lend the slot until the packet is returned
+  if (!enc_context->pLentPacketData)
+    enc_context->pOwnedPacketData = (U8 *)PACKET_GetDataPointer(src_packet);
+  enc_context->pLentPacketData = (U8 *)PACKET_GetDataPointer(slot->pPacket);
+  PACKET_SetDataPointer(src_packet, enc_context->pLentPacketData);
+  PACKET_SetLength(src_packet, PACKET_GetLength(slot->pPacket));
+  PACKET_SetPts(src_packet, PACKET_GetPts(slot->pPacket));
 
   return ret;
 }
-S32 al_enc_return_output_stream(ALBaseContext *ctx, MppData *src_data) {
-  S32 ret = MPP_OK;
-  struct DNode *del_node;
-  struct DNode *pre_node;
 
-  pthread_mutex_lock(&srcDataList->mutex);
-
-  del_node = srcDataList->fnode;
-  pre_node = del_node;
+S32 al_enc_return_output_stream(ALBaseContext *ctx, MppData *src_data) {
+  ALSoftOpenh264EncContext *enc_context = (ALSoftOpenh264EncContext *)ctx;
+  MppPacket *src_packet = PACKET_GetPacket(src_data);
 
-  if (del_node == NULL) {
-    pthread_mutex_unlock(&srcDataList->mutex);
+  pthread_mutex_lock(&enc_context->stSlotMutex);
+  if (enc_context->nSlotRead == enc_context->nSlotWrite) {
+    pthread_mutex_unlock(&enc_context->stSlotMutex);
     return 1;
   }
-#if 0
-    struct DNode *tmp_node = del_node;
-    debug ("be out");
-
-    while (tmp_node != NULL) {
-        debug ("%d ", tmp_node->num);
-        tmp_node = tmp_node->next;
-    }
-    debug ("af out");
-#endif
-
-  // find the last node in list, del it
-  if (del_node->next == NULL) {
-    srcDataList->fnode = NULL;
-  } else {
-    while (1) {
-      if (del_node->next == NULL) {
-        pre_node->next = del_node->next;
-        break;
-      }
-      pre_node = del_node;
-      del_node = del_node->next;
-    }
-  }
-
-  srcDataList->count--;
-
-  pthread_mutex_unlock(&srcDataList->mutex);
-
-  PACKET_Free(del_node->pPacket);
-  PACKET_Destory(del_node->pPacket);
-  free(del_node);
-
-  MppPacket *src_packet = PACKET_GetPacket(src_data);
+  enc_context->nSlotRead++;
+  pthread_mutex_unlock(&enc_context->stSlotMutex);
+
+  if (enc_context->pLentPacketData &&
+      PACKET_GetDataPointer(src_packet) == enc_context->pLentPacketData)
+    PACKET_SetDataPointer(src_packet, enc_context->pOwnedPacketData);
+  enc_context->pLentPacketData = NULL;
+  enc_context->pOwnedPacketData = NULL;
   PACKET_SetLength(src_packet, 0);
-  // src_packet->nLength = 0;
-  // src_packet->pData = NULL;
 
-  return ret;
+  return MPP_OK;
 }
 
 void al_enc_destory(ALBaseContext *ctx) {
   ALSoftOpenh264EncContext *enc_context = (ALSoftOpenh264EncContext *)ctx;
+  S32 i;
+
   if (!ctx) {
     error("No need to destory, return !");
     return;
@@ -338,10 +576,16 @@ void al_enc_destory(ALBaseContext *ctx) {
     WelsDestroySVCEncoder(enc_context->pSvcEncoder);
     enc_context->pSvcEncoder = NULL;
   }
-  if (srcDataList) {
-    pthread_mutex_destroy(&srcDataList->mutex);
-    free(srcDataList);
+
+  for (i = 0; i < OPENH264_ENC_SLOT_NUM; i++) {
+    ALSoftOpenh264EncSlot *slot = &(enc_context->stSlot[i]);
+    if (!slot->pPacket) continue;
+    if (slot->nSize) PACKET_Free(slot->pPacket);
+    PACKET_Destory(slot->pPacket);
   }
+  pthread_mutex_destroy(&enc_context->stSlotMutex);
+  if (enc_context->pChroma) free(enc_context->pChroma);
+
   free(enc_context);
   enc_context = NULL;
 }
@@ -0,0 +1,151 @@
+/***
+ * @Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * @Use of this source code is governed by a BSD-style license
+ * @that can be found in the LICENSE file.
+ * @
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-06-01 15:20:36
+ * @LastEditTime: 2024-06-01 15:20:36
+ * @Description: port buffers of the sfomxil plugins, allocated from the dma
+ *               heap by the plugin and registered with OMX_UseBuffer, so the
+ *               plugin can write into them (or lend them to the APP) and
+ *               knows who holds each of them.
+ */
+
+#ifndef _SFOMXIL_BUFFER_H_
+#define _SFOMXIL_BUFFER_H_
+
+#include <OMX_Component.h>
+#include <OMX_Core.h>
+#include <pthread.h>
+
+#include "dmabufwrapper.h"
+#include "type.h"
+
+#define SFOMXIL_MAX_BUFFER_NUM 64
+
+/***
+ *                   sfomxil_buffer_take
+ *      +--------+ ----------------------> +-----------+
+ *      |        |                         |           |
+ *      | PLUGIN | <---------------------- | COMPONENT |
+ *      |        |   EmptyBufferDone/      |           |
+ *      +--------+   FillBufferDone        +-----------+
+ *        |    ^                                 ^
+ *   lend |    | give back                       | sent
+ *        v    |                                 |
+ *      +--------+                               |
+ *      |  APP   | ------------------------------+
+ *      +--------+
+ */
+typedef enum _SfOmxilBufferOwner {
+  /***
+   * idle, the plugin can fill it or lend it
+   */
+  SFOMXIL_BUFFER_OWNED_BY_PLUGIN = 0,
+
+  /***
+   * lent to the APP, who writes the data in place
+   */
+  SFOMXIL_BUFFER_OWNED_BY_APP,
+
+  /***
+   * given by OMX_EmptyThisBuffer/OMX_FillThisBuffer, until the done callback
+   */
+  SFOMXIL_BUFFER_OWNED_BY_COMPONENT,
+} SfOmxilBufferOwner;
+
+typedef struct _SfOmxilBuffer {
+  OMX_BUFFERHEADERTYPE *pHeader;
+
+  /***
+   * NULL if there is no dma heap, the memory is from malloc then
+   */
+  DmaBufWrapper *pDmaBufWrapper;
+  U8 *pData;
+  S32 nFd;
+  S32 nSize;
+  SfOmxilBufferOwner eOwner;
+} SfOmxilBuffer;
+
+typedef struct _SfOmxilBufferSet {
+  SfOmxilBuffer stBuffer[SFOMXIL_MAX_BUFFER_NUM];
+  S32 nBufferNum;
+  OMX_U32 nPortIndex;
+
+  /***
+   * the owners are changed by the APP thread and the work thread
+   */
+  pthread_mutex_t stMutex;
+} SfOmxilBufferSet;
+
+/***
+ * @description: alloc num buffers of size bytes and register them to the
+ * port by OMX_UseBuffer, all owned by the plugin. The component must be in
+ * the Loaded to Idle transition (or the port being enabled).
+ * @param {SfOmxilBufferSet} *set
+ * @param {OMX_HANDLETYPE} component
+ * @param {OMX_U32} port
+ * @param {S32} num
+ * @param {S32} size
+ * @return {*}: MPP_OK, MPP_MALLOC_FAILED
+ */
+RETURN sfomxil_buffer_alloc(SfOmxilBufferSet *set, OMX_HANDLETYPE component,
+                            OMX_U32 port, S32 num, S32 size);
+
+/***
+ * @description: OMX_FreeBuffer all buffers of the set and release their
+ * memory, whoever holds them.
+ * @param {SfOmxilBufferSet} *set
+ * @param {OMX_HANDLETYPE} component
+ * @return {*}
+ */
+void sfomxil_buffer_free(SfOmxilBufferSet *set, OMX_HANDLETYPE component);
+
+/***
+ * @description: the buffer of a header, NULL if it is not in the set
+ * @param {SfOmxilBufferSet} *set
+ * @param {OMX_BUFFERHEADERTYPE} *header
+ * @return {*}
+ */
+SfOmxilBuffer *sfomxil_buffer_find_header(SfOmxilBufferSet *set,
+                                          OMX_BUFFERHEADERTYPE *header);
+
+/***
+ * @description: the buffer whose memory starts at data, NULL if none
+ * @param {SfOmxilBufferSet} *set
+ * @param {U8} *data
+ * @return {*}
+ */
+SfOmxilBuffer *sfomxil_buffer_find_data(SfOmxilBufferSet *set, U8 *data);
+
+/***
+ * @description: take an idle buffer and give it to owner at once
+ * @param {SfOmxilBufferSet} *set
+ * @param {SfOmxilBufferOwner} owner
+ * @return {*}: NULL if all buffers are held by the APP or the component
+ */
+SfOmxilBuffer *sfomxil_buffer_take(SfOmxilBufferSet *set,
+                                   SfOmxilBufferOwner owner);
+
+/***
+ * @description: hand the buffer over from one owner to the other
+ * @param {SfOmxilBufferSet} *set
+ * @param {SfOmxilBuffer} *buffer
+ * @param {SfOmxilBufferOwner} from
+ * @param {SfOmxilBufferOwner} to
+ * @return {*}: MPP_OK, MPP_CHECK_FAILED if from does not hold it, nothing is
+ * changed then
+ */
+RETURN sfomxil_buffer_move(SfOmxilBufferSet *set, SfOmxilBuffer *buffer,
+                           SfOmxilBufferOwner from, SfOmxilBufferOwner to);
+
+/***
+ * @description: number of buffers held by owner
+ * @param {SfOmxilBufferSet} *set
+ * @param {SfOmxilBufferOwner} owner
+ * @return {*}
+ */
+S32 sfomxil_buffer_count(SfOmxilBufferSet *set, SfOmxilBufferOwner owner);
+
+#endif /*_SFOMXIL_BUFFER_H_*/
@@ -0,0 +1,202 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-06-01 15:20:36
+ * @LastEditTime: 2024-06-01 15:20:36
+ * @Description: port buffers of the sfomxil plugins, see sfomxil_buffer.h
+ */
+
+#define ENABLE_DEBUG 1
+
+#include "sfomxil_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+#define MODULE_TAG "sfomxil_buffer"
+
+static void free_memory(SfOmxilBuffer *buffer) {
+  if (buffer->pDmaBufWrapper) {
+    freeDmaBuf(buffer->pDmaBufWrapper);
+    destoryDmaBufWrapper(buffer->pDmaBufWrapper);
+  } else {
+    free(buffer->pData);
+  }
+
+  buffer->pDmaBufWrapper = NULL;
+  buffer->pData = NULL;
+  buffer->nFd = -1;
+}
+
+/**
+ * @description: dma heap memory for one buffer, malloc memory if dma is
+ * MPP_FALSE (no dma heap on this system)
+ */
+static RETURN alloc_memory(SfOmxilBuffer *buffer, S32 size, BOOL dma) {
+  buffer->nFd = -1;
+  buffer->nSize = size;
+
+  if (dma) {
+    buffer->pDmaBufWrapper = createDmaBufWrapper(DMA_HEAP_CMA);
+    if (!buffer->pDmaBufWrapper) return MPP_MALLOC_FAILED;
+
+    buffer->nFd = allocDmaBuf(buffer->pDmaBufWrapper, size);
+    if (buffer->nFd >= 0)
+      buffer->pData = (U8 *)mmapDmaBuf(buffer->pDmaBufWrapper);
+  } else {
+    buffer->pData = (U8 *)malloc(size);
+  }
+
+  if (buffer->pData) return MPP_OK;
+
+  free_memory(buffer);
+  return MPP_MALLOC_FAILED;
+}
+
+RETURN sfomxil_buffer_alloc(SfOmxilBufferSet *set, OMX_HANDLETYPE component,
+                            OMX_U32 port, S32 num, S32 size) {
+  if (!set || !component) {
+    error("input para is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  if (num <= 0 || num > SFOMXIL_MAX_BUFFER_NUM || size <= 0) {
+    error("can not alloc %d buffers of %d bytes, please check!", num, size);
+    return MPP_CHECK_FAILED;
+  }
+
+  DmaBufWrapper *probe = createDmaBufWrapper(DMA_HEAP_CMA);
+  BOOL dma = probe ? MPP_TRUE : MPP_FALSE;
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+
+  // one check for all buffers, the heap fd is shared by the wrappers
+  destoryDmaBufWrapper(probe);
+  if (!dma) info("no dma heap, port %u buffers are from malloc", port);
+
+  memset(set, 0, sizeof(SfOmxilBufferSet));
+  set->nPortIndex = port;
+  pthread_mutex_init(&set->stMutex, NULL);
+
+  for (S32 i = 0; i < num; i++) {
+    SfOmxilBuffer *buffer = &(set->stBuffer[i]);
+
+    // the heap can run out (cma), malloc memory still works for the copy
+    if (alloc_memory(buffer, size, dma) &&
+        (!dma || alloc_memory(buffer, size, MPP_FALSE))) {
+      error("can not alloc buffer %d of port %u, please check!", i, port);
+      goto fail;
+    }
+
+    err = OMX_UseBuffer(component, &buffer->pHeader, port, buffer, size,
+                        buffer->pData);
+    if (OMX_ErrorNone != err || !buffer->pHeader) {
+      error("OMX_UseBuffer failed, please check! error = %x", err);
+      buffer->pHeader = NULL;
+      free_memory(buffer);
+      goto fail;
+    }
+
+    buffer->eOwner = SFOMXIL_BUFFER_OWNED_BY_PLUGIN;
+    set->nBufferNum++;
+  }
+
+  debug("port %u: %d buffers of %d bytes (%s)", port, num, size,
+        dma ? "dma heap" : "malloc");
+
+  return MPP_OK;
+
+fail:
+  sfomxil_buffer_free(set, component);
+  return MPP_MALLOC_FAILED;
+}
+
+void sfomxil_buffer_free(SfOmxilBufferSet *set, OMX_HANDLETYPE component) {
+  if (!set) return;
+
+  for (S32 i = 0; i < set->nBufferNum; i++) {
+    SfOmxilBuffer *buffer = &(set->stBuffer[i]);
+
+    if (SFOMXIL_BUFFER_OWNED_BY_APP == buffer->eOwner)
+      error("buffer %d of port %u is still lent, please check!", i,
+            set->nPortIndex);
+    if (buffer->pHeader)
+      OMX_FreeBuffer(component, set->nPortIndex, buffer->pHeader);
+    free_memory(buffer);
+  }
+
+  pthread_mutex_destroy(&set->stMutex);
+  memset(set, 0, sizeof(SfOmxilBufferSet));
+}
+
+SfOmxilBuffer *sfomxil_buffer_find_header(SfOmxilBufferSet *set,
+                                          OMX_BUFFERHEADERTYPE *header) {
+  for (S32 i = 0; i < set->nBufferNum; i++) {
+    if (set->stBuffer[i].pHeader == header) return &(set->stBuffer[i]);
+  }
+
+  return NULL;
+}
+
+SfOmxilBuffer *sfomxil_buffer_find_data(SfOmxilBufferSet *set, U8 *data) {
+  if (!data) return NULL;
+
+  for (S32 i = 0; i < set->nBufferNum; i++) {
+    if (set->stBuffer[i].pData == data) return &(set->stBuffer[i]);
+  }
+
+  return NULL;
+}
+
+SfOmxilBuffer *sfomxil_buffer_take(SfOmxilBufferSet *set,
+                                   SfOmxilBufferOwner owner) {
+  SfOmxilBuffer *buffer = NULL;
+
+  pthread_mutex_lock(&set->stMutex);
+  for (S32 i = 0; i < set->nBufferNum; i++) {
+    if (SFOMXIL_BUFFER_OWNED_BY_PLUGIN == set->stBuffer[i].eOwner) {
+      buffer = &(set->stBuffer[i]);
+      buffer->eOwner = owner;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&set->stMutex);
+
+  return buffer;
+}
+
+RETURN sfomxil_buffer_move(SfOmxilBufferSet *set, SfOmxilBuffer *buffer,
+                           SfOmxilBufferOwner from, SfOmxilBufferOwner to) {
+  RETURN ret = MPP_OK;
+
+  if (!buffer) return MPP_NULL_POINTER;
+
+  pthread_mutex_lock(&set->stMutex);
+  if (buffer->eOwner == from)
+    buffer->eOwner = to;
+  else
+    ret = MPP_CHECK_FAILED;
+  pthread_mutex_unlock(&set->stMutex);
+
+  if (ret)
+    error("buffer %p of port %u is held by %d, not %d, please check!",
+          buffer->pData, set->nPortIndex, buffer->eOwner, from);
+
+  return ret;
+}
+
+S32 sfomxil_buffer_count(SfOmxilBufferSet *set, SfOmxilBufferOwner owner) {
+  S32 num = 0;
+
+  pthread_mutex_lock(&set->stMutex);
+  for (S32 i = 0; i < set->nBufferNum; i++) {
+    if (set->stBuffer[i].eOwner == owner) num++;
+  }
+  pthread_mutex_unlock(&set->stMutex);
+
+  return num;
+}
@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-17 09:38:36
- * @LastEditTime: 2023-12-13 16:20:10
+ * @LastEditTime: 2024-06-01 18:10:24
  * @Description: video decode plugin for starfive omxIL layer
  */
 
@@ -31,8 +31,11 @@
 #include <unistd.h>
 
 #include "al_interface_dec.h"
+#include "env.h"
 #include "log.h"
+#include "notify.h"
 #include "resolution_utils.h"
+#include "sfomxil_buffer.h"
 #include "sfomxil_find_dec_library.h"
 
 #define MODULE_TAG "sfomxil_dec"
@@ -56,13 +59,6 @@ U8 *pOutputFileName = "/tmp/output.yuv";
 U8 *pInputFileName = "/tmp/input.264";
 #endif
 
-OMX_ERRORTYPE (*omx_init)(void);
-OMX_ERRORTYPE (*omx_deinit)(void);
-OMX_ERRORTYPE(*omx_gethandle)
-(OMX_HANDLETYPE *pHandle, OMX_STRING cComponentName, OMX_PTR pAppData,
- OMX_CALLBACKTYPE *pCallBacks);
-OMX_ERRORTYPE (*omx_freehandle)(OMX_HANDLETYPE hComponent);
-
 typedef struct _Message {
   LONG msg_type;
   OMX_S32 msg_flag;
@@ -73,6 +69,7 @@ typedef enum _MessageFlag {
   EMPTY_BUFFER_DONE = 0,
   FILL_BUFFER_DONE,
   EOS,
+  INPUT_READY,
 } MessageFlag;
 
 typedef enum _MessageType {
@@ -105,8 +102,22 @@ struct _ALSfOmxilDecContext {
   OMX_CALLBACKTYPE callbacks;
   OMX_PARAM_PORTDEFINITIONTYPE pInputPortDefinition;
   OMX_PARAM_PORTDEFINITIONTYPE pOutputPortDefinition;
-  OMX_BUFFERHEADERTYPE *pInputBufferArray[64];
   OMX_BUFFERHEADERTYPE *pOutputBufferArray[64];
+
+  /**
+   * input port buffers from the dma heap, a packet is copied into an idle
+   * one, or written into one lent by al_dec_request_input_stream and sent
+   * as it is. pOwnedPacketData is the memory of the caller's packet while
+   * it points to a lent buffer.
+   */
+  SfOmxilBufferSet stInput;
+  U8 *pOwnedPacketData;
+
+  /**
+   * a packet popped while no input buffer was idle, it is sent first,
+   * guarded by mutex
+   */
+  MppDataQueueNode *pPendingNode;
   MppFrame *pFrame[64];
   S32 nInputBufferCount;
   S32 nOutputBufferCount;
@@ -117,6 +128,12 @@ struct _ALSfOmxilDecContext {
    */
   U8 so_path[256];
   void *load_so;
+  OMX_ERRORTYPE (*omx_init)(void);
+  OMX_ERRORTYPE (*omx_deinit)(void);
+  OMX_ERRORTYPE (*omx_gethandle)(OMX_HANDLETYPE *pHandle,
+                                 OMX_STRING cComponentName, OMX_PTR pAppData,
+                                 OMX_CALLBACKTYPE *pCallBacks);
+  OMX_ERRORTYPE (*omx_freehandle)(OMX_HANDLETYPE hComponent);
 
   /**
    * other
@@ -126,7 +143,7 @@ struct _ALSfOmxilDecContext {
   pthread_t workthread;
   BOOL bNormalMode;
   BOOL bDisableEvent;
-  BOOL bJustQuit;
+  volatile BOOL bJustQuit;
   volatile S32 port0Flushed;
   volatile S32 port1Flushed;
   S32 decFlushed;
@@ -141,6 +158,13 @@ struct _ALSfOmxilDecContext {
   U32 decOutNum;
   BOOL bIsFrameReady;
 
+  /**
+   * the biggest frame id given to the output frames, a frame which is still
+   * held by APP on port settings changed gets a new id above it.
+   */
+  S32 nMaxFrameID;
+  U32 nRequestNum;
+
   MppRingBuffer *rb;
 };
 
@@ -182,7 +206,6 @@ static OMX_ERRORTYPE event_handler(OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
 
       for (S32 i = 0; i < context->nOutputBufferCount; i++) {
         OMX_BUFFERHEADERTYPE *pBuffer = NULL;
-        static S32 maxID = 0;
 
 #ifdef OLD_MODE
         OMX_AllocateBuffer(hComponent, &pBuffer, 1, NULL, nOutputBufferSize);
@@ -190,17 +213,20 @@ static OMX_ERRORTYPE event_handler(OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
 #else
         if (context->needAllocDma) {
           mppframe_create_and_config(context, i, i);
-          maxID = (maxID < i) ? i : maxID;
+          context->nMaxFrameID =
+              (context->nMaxFrameID < i) ? i : context->nMaxFrameID;
         } else {
           if (FRAME_GetRef(context->pFrame[i]) == 2) {
             S32 nID = FRAME_GetID(context->pFrame[i]);
-            maxID = (maxID < nID) ? nID + 1 : maxID + 1;
+            context->nMaxFrameID = (context->nMaxFrameID < nID)
+                                       ? nID + 1
+                                       : context->nMaxFrameID + 1;
             FRAME_UnRef(context->pFrame[i]);
             FRAME_UnRef(context->pFrame[i]);
 
             debug("id%d frame need to be cover, new frame id is %d", nID,
-                  maxID);
-            mppframe_create_and_config(context, i, maxID);
+                  context->nMaxFrameID);
+            mppframe_create_and_config(context, i, context->nMaxFrameID);
           } else if (FRAME_GetRef(context->pFrame[i]) != 1) {
             error("id%d frame had something wrong in refcount",
                   FRAME_GetID(context->pFrame[i]));
@@ -358,8 +384,10 @@ static OMX_S32 FillInputBuffer(ALSfOmxilDecContext *context, MppData *sink_data,
 #ifdef USE_CIRCULAR_BUFFER
   RingBufferPop(context->rb, pInputBuffer->nFilledLen, pInputBuffer->pBuffer);
 #else
-  memcpy(pInputBuffer->pBuffer, PACKET_GetDataPointer(sink_packet),
-         pInputBuffer->nFilledLen);
+  // a packet written into a lent input buffer is in place already
+  if (pInputBuffer->pBuffer != PACKET_GetDataPointer(sink_packet))
+    memcpy(pInputBuffer->pBuffer, PACKET_GetDataPointer(sink_packet),
+           pInputBuffer->nFilledLen);
 #endif
   pInputBuffer->nTimeStamp = PACKET_GetPts(sink_packet);
   // debug("input pts: %lld", (S64)pInputBuffer->nTimeStamp);
@@ -367,6 +395,122 @@ static OMX_S32 FillInputBuffer(ALSfOmxilDecContext *context, MppData *sink_data,
   return pInputBuffer->nFilledLen;
 }
 
+/**
+ * @description: wake the work thread up, a full message queue wakes it
+ * anyway, so do not wait for room
+ */
+static void send_message(ALSfOmxilDecContext *context, MessageFlag flag) {
+  Message data;
+  data.msg_type = MSG_CONTROL;
+  data.msg_flag = flag;
+  data.pBuffer = NULL;
+  if (-1 == msgsnd(context->nMsgid, (void *)&data,
+                   sizeof(data) - sizeof(data.msg_type), IPC_NOWAIT) &&
+      EAGAIN != errno) {
+    error("msgsnd failed (%s)", strerror(errno));
+  }
+}
+
+/**
+ * @description: release a queued packet, the memory of a lent input buffer
+ * is kept, the buffer is idle again if the packet was not sent
+ */
+static void release_packet(ALSfOmxilDecContext *context, MppPacket *packet,
+                           BOOL sent) {
+  SfOmxilBuffer *buffer = sfomxil_buffer_find_data(
+      &context->stInput, (U8 *)PACKET_GetDataPointer(packet));
+
+  if (buffer) {
+    PACKET_SetDataPointer(packet, NULL);
+    if (!sent)
+      sfomxil_buffer_move(&context->stInput, buffer,
+                          SFOMXIL_BUFFER_OWNED_BY_APP,
+                          SFOMXIL_BUFFER_OWNED_BY_PLUGIN);
+  }
+#ifdef USE_CIRCULAR_BUFFER
+  PACKET_SetDataPointer(packet, NULL);
+#endif
+  PACKET_Free(packet);
+  PACKET_Destory(packet);
+}
+
+/**
+ * @description: send a queued packet in the input buffer lent for it, or
+ * in a copy, called with mutex held
+ * @return {*}: MPP_OK, MPP_CODER_NO_DATA if no input buffer is idle
+ */
+static RETURN send_packet(ALSfOmxilDecContext *context,
+                          MppDataQueueNode *node) {
+  MppData *sink_data = DATAQUEUE_GetData(node);
+  MppPacket *sink_packet = PACKET_GetPacket(sink_data);
+  SfOmxilBuffer *buffer = sfomxil_buffer_find_data(
+      &context->stInput, (U8 *)PACKET_GetDataPointer(sink_packet));
+
+  if (buffer) {
+    sfomxil_buffer_move(&context->stInput, buffer, SFOMXIL_BUFFER_OWNED_BY_APP,
+                        SFOMXIL_BUFFER_OWNED_BY_COMPONENT);
+  } else {
+    buffer = sfomxil_buffer_take(&context->stInput,
+                                 SFOMXIL_BUFFER_OWNED_BY_COMPONENT);
+    if (!buffer) return MPP_CODER_NO_DATA;
+  }
+
+  FillInputBuffer(context, sink_data, buffer->pHeader);
+  context->decInNum++;
+  OMX_EmptyThisBuffer(context->hComponentDecoder, buffer->pHeader);
+
+  release_packet(context, sink_packet, MPP_TRUE);
+  DATAQUEUE_Node_Destory(node);
+
+  return MPP_OK;
+}
+
+/**
+ * @description: send the queued packets while there are input buffers for
+ * them, one is kept in pPendingNode if not
+ * @return {*}: number of packets sent
+ */
+static S32 feed_input(ALSfOmxilDecContext *context) {
+  MppDataQueueNode *node = NULL;
+  S32 num = 0;
+
+  pthread_mutex_lock(&context->mutex);
+  while (MPP_TRUE) {
+    node = context->pPendingNode ? context->pPendingNode
+                                 : DATAQUEUE_Pop(context->pInputQueue);
+    context->pPendingNode = NULL;
+    if (!node) break;
+
+    if (send_packet(context, node)) {
+      context->pPendingNode = node;
+      break;
+    }
+    num++;
+  }
+  context->pVdecPara->nInputQueueLeftNum =
+      DATAQUEUE_GetMaxSize(context->pInputQueue) -
+      DATAQUEUE_GetCurrentSize(context->pInputQueue);
+  pthread_mutex_unlock(&context->mutex);
+
+  return num;
+}
+
+/**
+ * @description: drop the packet waiting for an input buffer
+ */
+static void drop_pending(ALSfOmxilDecContext *context) {
+  pthread_mutex_lock(&context->mutex);
+  if (context->pPendingNode) {
+    release_packet(
+        context,
+        PACKET_GetPacket(DATAQUEUE_GetData(context->pPendingNode)),
+        MPP_FALSE);
+    DATAQUEUE_Node_Destory(context->pPendingNode);
+    context->pPendingNode = NULL;
+  }
+  pthread_mutex_unlock(&context->mutex);
+}
+
 ALBaseContext *al_dec_create() {
   ALSfOmxilDecContext *context =
       (ALSfOmxilDecContext *)malloc(sizeof(ALSfOmxilDecContext));
@@ -409,42 +553,8 @@ void *do_decode(void *private_data) {
     }
 
     if (i < limit_count) {
-      MppDataQueueNode *node = DATAQUEUE_Pop(context->pInputQueue);
-      context->pVdecPara->nInputQueueLeftNum =
-          DATAQUEUE_GetMaxSize(context->pInputQueue) -
-          DATAQUEUE_GetCurrentSize(context->pInputQueue);
-      if (node) {
-        MppData *sink_data = DATAQUEUE_GetData(node);
-        MppPacket *sink_packet = PACKET_GetPacket(sink_data);
-#ifndef USE_CIRCULAR_BUFFER
-        debug("input check:%x %x %x %x %x %x %x %x %x",
-              *(S32 *)PACKET_GetDataPointer(sink_packet),
-              *(S32 *)(PACKET_GetDataPointer(sink_packet) + 4),
-              *(S32 *)(PACKET_GetDataPointer(sink_packet) + 8),
-              *(S32 *)(PACKET_GetDataPointer(sink_packet) + 12),
-              *(S32 *)(PACKET_GetDataPointer(sink_packet) + 16),
-              *(S32 *)(PACKET_GetDataPointer(sink_packet) + 20),
-              *(S32 *)(PACKET_GetDataPointer(sink_packet) + 24),
-              *(S32 *)(PACKET_GetDataPointer(sink_packet) + 28),
-              *(S32 *)(PACKET_GetDataPointer(sink_packet) + 32));
-#endif
-        FillInputBuffer(context, sink_data, context->pInputBufferArray[i]);
-
-        OMX_EmptyThisBuffer(context->hComponentDecoder,
-                            context->pInputBufferArray[i]);
-        i++;
-        context->decInNum++;
-
-        // free packet && free packet node
-#ifdef USE_CIRCULAR_BUFFER
-        PACKET_SetDataPointer(sink_packet, NULL);
-#endif
-        PACKET_Free(sink_packet);
-        PACKET_Destory(sink_packet);
-        DATAQUEUE_Node_Destory(node);
-      } else {
-        // debug("pop node is NULL!");
-      }
+      // every input buffer is sent before the component starts
+      i += feed_input(context);
       continue;
     } else if (limit_count == i && !start_dec) {
       debug("start decode process");
@@ -463,38 +573,16 @@ void *do_decode(void *private_data) {
 
     switch (data.msg_flag) {
       case EMPTY_BUFFER_DONE: {
-        OMX_BUFFERHEADERTYPE *pBuffer = data.pBuffer;
-        MppDataQueueNode *node = NULL;
-
-        node = DATAQUEUE_Pop(context->pInputQueue);
-
-        context->pVdecPara->nInputQueueLeftNum =
-            DATAQUEUE_GetMaxSize(context->pInputQueue) -
-            DATAQUEUE_GetCurrentSize(context->pInputQueue);
-        if (node) {
-          MppData *sink_data = DATAQUEUE_GetData(node);
-          MppPacket *sink_packet = PACKET_GetPacket(sink_data);
-
-          FillInputBuffer(context, sink_data, pBuffer);
-          context->decInNum++;
-
-          OMX_EmptyThisBuffer(context->hComponentDecoder, pBuffer);
-#ifdef USE_CIRCULAR_BUFFER
-          PACKET_SetDataPointer(sink_packet, NULL);
-#endif
-          PACKET_Free(sink_packet);
-          PACKET_Destory(sink_packet);
-          DATAQUEUE_Node_Destory(node);
-        } else {
-          Message data;
-          data.msg_type = MSG_CONTROL;
-          data.msg_flag = EMPTY_BUFFER_DONE;
-          data.pBuffer = pBuffer;
-          if (-1 == msgsnd(context->nMsgid, (void *)&data,
-                           sizeof(data) - sizeof(data.msg_type), 0)) {
-            error("msgsnd failed .....");
-          }
-        }
+        // an idle input buffer stays with the plugin until a packet comes,
+        // al_dec_decode wakes the thread up by INPUT_READY then
+        sfomxil_buffer_move(
+            &context->stInput,
+            sfomxil_buffer_find_header(&context->stInput, data.pBuffer),
+            SFOMXIL_BUFFER_OWNED_BY_COMPONENT, SFOMXIL_BUFFER_OWNED_BY_PLUGIN);
+        feed_input(context);
+      } break;
+      case INPUT_READY: {
+        feed_input(context);
       } break;
       case FILL_BUFFER_DONE: {
         OMX_BUFFERHEADERTYPE *pBuffer = data.pBuffer;
@@ -528,6 +616,7 @@ void *do_decode(void *private_data) {
         // debug("output pts: %lld", (S64)pBuffer->nTimeStamp);
 
         ret = DATAQUEUE_Push(context->pOutputQueue, node);
+        if (!ret) mpp_notify_signal(context->pVdecPara->nOutputEventFd);
 
         if ((pBuffer->nFlags) & OMX_BUFFERFLAG_EOS) {
           error("decoder commit EOS 111!");
@@ -563,6 +652,7 @@ finish:
 
   DATAQUEUE_Cond_BroadCast(context->pOutputQueue);
   DATAQUEUE_SetWaitExit(context->pOutputQueue, MPP_TRUE);
+  mpp_notify_signal(context->pVdecPara->nOutputEventFd);
 
   debug("finish decode!");
   pthread_exit(NULL);
@@ -584,13 +674,13 @@ static S32 omx_get_handle(ALBaseContext *ctx) {
 
   if (CODING_H264 == context->pVdecPara->eCodingType) {
     if (context->bNormalMode) {
-      ret =
-          omx_gethandle(&context->hComponentDecoder, "OMX.sf.video_decoder.avc",
-                        context, &context->callbacks);
+      ret = context->omx_gethandle(&context->hComponentDecoder,
+                                   "OMX.sf.video_decoder.avc", context,
+                                   &context->callbacks);
     } else {
-      ret = omx_gethandle(&context->hComponentDecoder,
-                          "OMX.sf.video_decoder.avc.internal", context,
-                          &context->callbacks);
+      ret = context->omx_gethandle(&context->hComponentDecoder,
+                                   "OMX.sf.video_decoder.avc.internal",
+                                   context, &context->callbacks);
     }
 
     if (OMX_ErrorNone != ret) {
@@ -599,13 +689,13 @@ static S32 omx_get_handle(ALBaseContext *ctx) {
     }
   } else if (CODING_H265 == context->pVdecPara->eCodingType) {
     if (context->bNormalMode) {
-      ret = omx_gethandle(&context->hComponentDecoder,
-                          "OMX.sf.video_decoder.hevc", context,
-                          &context->callbacks);
+      ret = context->omx_gethandle(&context->hComponentDecoder,
+                                   "OMX.sf.video_decoder.hevc", context,
+                                   &context->callbacks);
     } else {
-      ret = omx_gethandle(&context->hComponentDecoder,
-                          "OMX.sf.video_decoder.hevc.internal", context,
-                          &context->callbacks);
+      ret = context->omx_gethandle(&context->hComponentDecoder,
+                                   "OMX.sf.video_decoder.hevc.internal",
+                                   context, &context->callbacks);
     }
 
     if (OMX_ErrorNone != ret) {
@@ -690,15 +780,12 @@ static S32 alloc_input_buffer(ALBaseContext *ctx) {
   OMX_SetParameter(context->hComponentDecoder, OMX_IndexParamPortDefinition,
                    &context->pInputPortDefinition);
 
-  for (S32 i = 0; i < context->nInputBufferCount; i++) {
-    OMX_BUFFERHEADERTYPE *pBuffer = NULL;
-    ret = OMX_AllocateBuffer(context->hComponentDecoder, &pBuffer, 0, NULL,
-                             nInputBufferSize);
-    if (OMX_ErrorNone != ret) {
-      error("OMX_AllocateBuffer failed, please check! error = %x", ret);
-      return MPP_MALLOC_FAILED;
-    }
-    context->pInputBufferArray[i] = pBuffer;
+  if (MPP_OK != sfomxil_buffer_alloc(&context->stInput,
+                                     context->hComponentDecoder, INPUT_PORT,
+                                     context->nInputBufferCount,
+                                     nInputBufferSize)) {
+    error("sfomxil_buffer_alloc failed, please check!");
+    return MPP_MALLOC_FAILED;
   }
   debug("input alloc size = %d, count = %d", nInputBufferSize,
         context->nInputBufferCount);
@@ -719,6 +806,7 @@ RETURN al_dec_init(ALBaseContext *ctx, MppVdecPara *para) {
 
   ALSfOmxilDecContext *context = (ALSfOmxilDecContext *)ctx;
   S32 ret = OMX_ErrorNone;
+  U8 *omx_path = NULL;
 
   context->pVdecPara = para;
   context->callbacks.EventHandler = event_handler;
@@ -741,23 +829,30 @@ RETURN al_dec_init(ALBaseContext *ctx, MppVdecPara *para) {
     goto exit;
   }
 
-  find_dec_sfomx(context->so_path);
+  // MPP_SFOMX_LIBRARY replaces the omx il core, tests load a mock core by it
+  mpp_env_get_str("MPP_SFOMX_LIBRARY", &omx_path, NULL);
+  if (omx_path)
+    snprintf(context->so_path, sizeof(context->so_path), "%s", omx_path);
+  else
+    find_dec_sfomx(context->so_path);
   context->load_so = dlopen(context->so_path, RTLD_LAZY | RTLD_LOCAL);
   if (!context->load_so) {
-    error("can not dlopen load_so, please check! (%s)", strerror(errno));
+    error("can not dlopen load_so, please check! (%s)", dlerror());
     goto exit;
   }
-  omx_init = (OMX_ERRORTYPE(*)(void))dlsym(context->load_so, "OMX_Init");
-  omx_deinit = (OMX_ERRORTYPE(*)(void))dlsym(context->load_so, "OMX_Deinit");
-  omx_gethandle =
+  context->omx_init =
+      (OMX_ERRORTYPE(*)(void))dlsym(context->load_so, "OMX_Init");
+  context->omx_deinit =
+      (OMX_ERRORTYPE(*)(void))dlsym(context->load_so, "OMX_Deinit");
+  context->omx_gethandle =
       (OMX_ERRORTYPE(*)(OMX_HANDLETYPE * pHandle, OMX_STRING cComponentName,
                         OMX_PTR pAppData, OMX_CALLBACKTYPE * pCallBacks))
           dlsym(context->load_so, "OMX_GetHandle");
-  omx_freehandle = (OMX_ERRORTYPE(*)(OMX_HANDLETYPE hComponent))dlsym(
+  context->omx_freehandle = (OMX_ERRORTYPE(*)(OMX_HANDLETYPE hComponent))dlsym(
       context->load_so, "OMX_FreeHandle");
 
   debug("init omx");
-  ret = omx_init();
+  ret = context->omx_init();
   if (ret != OMX_ErrorNone) {
     error("run OMX_Init failed. ret is %d, please check!", ret);
     goto exit;
@@ -766,13 +861,18 @@ RETURN al_dec_init(ALBaseContext *ctx, MppVdecPara *para) {
   ret = omx_get_handle(ctx);
   if (OMX_ErrorNone != ret || !context->hComponentDecoder) {
     error("could not get omx handle, please check!");
-    omx_deinit();
+    context->omx_deinit();
     goto exit;
   }
 
-  context->pInputQueue = DATAQUEUE_Init(para->bInputBlockModeEnable, MPP_FALSE);
-  context->pOutputQueue =
-      DATAQUEUE_Init(MPP_TRUE, para->bOutputBlockModeEnable);
+  // both queues are also drained by flush from the application thread,
+  // which races with the omx callback thread
+  context->pInputQueue = DATAQUEUE_InitWithCapacity(
+      para->bInputBlockModeEnable, MPP_FALSE, DATAQUEUE_DEFAULT_CAPACITY,
+      DATAQUEUE_MODE_MPMC);
+  context->pOutputQueue = DATAQUEUE_InitWithCapacity(
+      MPP_TRUE, para->bOutputBlockModeEnable, DATAQUEUE_DEFAULT_CAPACITY,
+      DATAQUEUE_MODE_MPMC);
   context->DecRetEos = MPP_FALSE;
   context->port0Flushed = MPP_FALSE;
   context->port1Flushed = MPP_FALSE;
@@ -793,7 +893,7 @@ RETURN al_dec_init(ALBaseContext *ctx, MppVdecPara *para) {
           context->pVdecPara->nHeight);
     if (MPP_OK != output_port_init(ctx)) {
       error("could not init output port, please check!");
-      omx_deinit();
+      context->omx_deinit();
       goto exit;
     }
 
@@ -802,14 +902,14 @@ RETURN al_dec_init(ALBaseContext *ctx, MppVdecPara *para) {
 
     if (MPP_OK != input_port_init(ctx)) {
       error("could not init input port, please check!");
-      omx_deinit();
+      context->omx_deinit();
       goto exit;
     }
 
     // Alloc input buffer
     if (MPP_OK != alloc_input_buffer(ctx)) {
       error("could not alloc input buffer, please check!");
-      omx_deinit();
+      context->omx_deinit();
       goto exit;
     }
 
@@ -821,7 +921,7 @@ RETURN al_dec_init(ALBaseContext *ctx, MppVdecPara *para) {
 
     if (context->bJustQuit) {
       error("wait for Component idle, but get a error");
-      omx_deinit();
+      context->omx_deinit();
       goto exit;
     }
     debug("Component in idle");
@@ -856,9 +956,62 @@ RETURN al_dec_getparam(ALBaseContext *ctx, MppVdecPara **para) {
   return MPP_OK;
 }
 
+/**
+ * @description: lend an idle input buffer to the caller, who writes the
+ * packet into it, al_dec_decode sends it without a copy then. There are
+ * input buffers once the size of the stream is known.
+ * @return {*}: MPP_OK, MPP_CODER_NO_DATA if none is idle
+ */
+S32 al_dec_request_input_stream(ALBaseContext *ctx, MppData *sink_data) {
+  if (!ctx || !sink_data) {
+    error("input para is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  ALSfOmxilDecContext *context = (ALSfOmxilDecContext *)ctx;
+  MppPacket *packet = PACKET_GetPacket(sink_data);
+  SfOmxilBuffer *buffer =
+      sfomxil_buffer_take(&context->stInput, SFOMXIL_BUFFER_OWNED_BY_APP);
+
+  if (!buffer) return MPP_CODER_NO_DATA;
+
+  if (!context->pOwnedPacketData)
+    context->pOwnedPacketData = (U8 *)PACKET_GetDataPointer(packet);
+  PACKET_SetDataPointer(packet, buffer->pData);
+  PACKET_SetLength(packet, 0);
+
+  return MPP_OK;
+}
+
+/**
+ * @description: give back an input buffer lent and not decoded
+ */
+S32 al_dec_return_input_stream(ALBaseContext *ctx, MppData *sink_data) {
+  if (!ctx || !sink_data) {
+    error("input para is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  ALSfOmxilDecContext *context = (ALSfOmxilDecContext *)ctx;
+  MppPacket *packet = PACKET_GetPacket(sink_data);
+  SfOmxilBuffer *buffer = sfomxil_buffer_find_data(
+      &context->stInput, (U8 *)PACKET_GetDataPointer(packet));
+
+  if (!buffer ||
+      sfomxil_buffer_move(&context->stInput, buffer,
+                          SFOMXIL_BUFFER_OWNED_BY_APP,
+                          SFOMXIL_BUFFER_OWNED_BY_PLUGIN))
+    return MPP_CHECK_FAILED;
+
+  PACKET_SetDataPointer(packet, context->pOwnedPacketData);
+  context->pOwnedPacketData = NULL;
+  // a packet may wait for an input buffer
+  send_message(context, INPUT_READY);
+
+  return MPP_OK;
+}
+
 S32 al_dec_decode(ALBaseContext *ctx, MppData *sink_data) {
-  static U32 count = 0;
-  static U64 length = 0;
   S32 ret = 0;
 
   if (!ctx) {
@@ -868,6 +1021,14 @@ S32 al_dec_decode(ALBaseContext *ctx, MppData *sink_data) {
 
   ALSfOmxilDecContext *context = (ALSfOmxilDecContext *)ctx;
   MppPacket *sink_packet = PACKET_GetPacket(sink_data);
+  SfOmxilBuffer *lent = sfomxil_buffer_find_data(
+      &context->stInput, (U8 *)PACKET_GetDataPointer(sink_packet));
+
+  // nothing written into the lent buffer, it is idle again
+  if (lent && (PACKET_GetEos(sink_packet) || !PACKET_GetLength(sink_packet)))
+    al_dec_return_input_stream(ctx, sink_data);
+  if (lent && !PACKET_GetEos(sink_packet) && !PACKET_GetLength(sink_packet))
+    return MPP_OK;
 
   MppDataQueueNode *node = DATAQUEUE_Node_Create();
 
@@ -884,6 +1045,7 @@ S32 al_dec_decode(ALBaseContext *ctx, MppData *sink_data) {
         DATAQUEUE_GetMaxSize(context->pInputQueue) -
         DATAQUEUE_GetCurrentSize(context->pInputQueue);
     debug("------ eos push ret = %d", ret);
+    send_message(context, INPUT_READY);
 
     return ret;
   }
@@ -945,6 +1107,11 @@ S32 al_dec_decode(ALBaseContext *ctx, MppData *sink_data) {
       context->pVdecPara->bInputBlockModeEnable) {
     packet = PACKET_Create();
 
+    if (lent) {
+      // the packet is in the input buffer already, no copy
+      PACKET_SetDataPointer(packet, lent->pData);
+      PACKET_SetLength(packet, PACKET_GetLength(sink_packet));
+    } else {
 #ifdef USE_CIRCULAR_BUFFER
     void *tmp = RingBufferGetTailAddr(context->rb);
 
@@ -960,6 +1127,7 @@ S32 al_dec_decode(ALBaseContext *ctx, MppData *sink_data) {
     memcpy(PACKET_GetDataPointer(packet), PACKET_GetDataPointer(sink_packet),
            PACKET_GetLength(sink_packet));
 #endif
+    }
     PACKET_SetPts(packet, PACKET_GetPts(sink_packet));
     PACKET_SetID(packet, PACKET_GetID(sink_packet));
 
@@ -968,6 +1136,7 @@ S32 al_dec_decode(ALBaseContext *ctx, MppData *sink_data) {
     context->pVdecPara->nInputQueueLeftNum =
         DATAQUEUE_GetMaxSize(context->pInputQueue) -
         DATAQUEUE_GetCurrentSize(context->pInputQueue);
+    DATAQUEUE_Node_Destory(node);
     return MPP_DATAQUEUE_FULL;
   }
 
@@ -976,14 +1145,24 @@ S32 al_dec_decode(ALBaseContext *ctx, MppData *sink_data) {
       DATAQUEUE_GetMaxSize(context->pInputQueue) -
       DATAQUEUE_GetCurrentSize(context->pInputQueue);
 
-  //  debug("push packet to dec, %d %d, (%d)", ret,
-  //       ++count,  PACKET_GetLength(PACKET_GetPacket(sink_data)));
+  //  debug("push packet to dec, %d, (%d)", ret,
+  //        PACKET_GetLength(PACKET_GetPacket(sink_data)));
 
   if (ret) {
+    // a lent buffer stays lent, the caller can send it again
+    if (lent) PACKET_SetDataPointer(packet, NULL);
     PACKET_Free(packet);
     PACKET_Destory(packet);
     DATAQUEUE_Node_Destory(node);
+    return ret;
+  }
+
+  if (lent) {
+    // the packet is queued in the input buffer, hand back the caller's memory
+    PACKET_SetDataPointer(sink_packet, context->pOwnedPacketData);
+    context->pOwnedPacketData = NULL;
   }
+  send_message(context, INPUT_READY);
 
   return ret;
 }
@@ -992,7 +1171,6 @@ S32 al_dec_request_output_frame(ALBaseContext *ctx, MppData *src_data) {
   if (!ctx) return MPP_NULL_POINTER;
   ALSfOmxilDecContext *context = (ALSfOmxilDecContext *)ctx;
   MppDataQueueNode *node;
-  static U32 count = 0;
 
   if (context->DecRetEos && DATAQUEUE_IsEmpty(context->pOutputQueue) == 1) {
     debug("ret dec eos");
@@ -1008,7 +1186,8 @@ S32 al_dec_request_output_frame(ALBaseContext *ctx, MppData *src_data) {
   memcpy(src_data, DATAQUEUE_GetData(node), FRAME_GetStructSize());
 
   debug("----- num %d, request: %d left: %d (%d)",
-        FRAME_GetDataUsedNum(FRAME_GetFrame(DATAQUEUE_GetData(node))), ++count,
+        FRAME_GetDataUsedNum(FRAME_GetFrame(DATAQUEUE_GetData(node))),
+        ++context->nRequestNum,
         DATAQUEUE_GetCurrentSize(context->pOutputQueue),
         DATAQUEUE_GetCurrentSize(context->pInputQueue));
 
@@ -1025,7 +1204,6 @@ S32 al_dec_request_output_frame(ALBaseContext *ctx, MppData *src_data) {
 S32 al_dec_request_output_frame_2(ALBaseContext *ctx, MppData **src_data) {
   ALSfOmxilDecContext *context;
   MppDataQueueNode *node;
-  static U32 count = 0;
   MppFrame *nframe;
   MppFrame *src_frame;
 
@@ -1058,7 +1236,8 @@ S32 al_dec_request_output_frame_2(ALBaseContext *ctx, MppData **src_data) {
   // debug("----- num %d %d, request: %d left: %d (%d)",
   //       FRAME_GetDataUsedNum(src_frame),
   //       FRAME_GetDataUsedNum(nframe),
-  //       ++count, DATAQUEUE_GetCurrentSize(context->pOutputQueue),
+  //       ++context->nRequestNum,
+  //       DATAQUEUE_GetCurrentSize(context->pOutputQueue),
   //       DATAQUEUE_GetCurrentSize(context->pInputQueue));
 
   // FRAME_Destory(nframe);
@@ -1158,16 +1337,14 @@ S32 omx_dec_reinit(ALBaseContext *ctx) {
     OMX_FreeBuffer(context->hComponentDecoder, 1,
                    context->pOutputBufferArray[i]);
   }
-  for (S32 i = 0; i < context->nInputBufferCount; i++) {
-    OMX_FreeBuffer(context->hComponentDecoder, 0,
-                   context->pInputBufferArray[i]);
-  }
+  drop_pending(context);
+  sfomxil_buffer_free(&context->stInput, context->hComponentDecoder);
 
   while (context->comState != OMX_StateLoaded)
     ;
 
-  omx_freehandle(context->hComponentDecoder);
-  omx_deinit();
+  context->omx_freehandle(context->hComponentDecoder);
+  context->omx_deinit();
 
   DATAQUEUE_Cond_BroadCast(context->pInputQueue);
   DATAQUEUE_Cond_BroadCast(context->pOutputQueue);
@@ -1185,7 +1362,7 @@ S32 omx_dec_reinit(ALBaseContext *ctx) {
   }
 
   debug("init omx");
-  ret = omx_init();
+  ret = context->omx_init();
   if (ret != OMX_ErrorNone) {
     error("run OMX_Init failed. ret is %d", ret);
     return -MPP_FALSE;
@@ -1194,12 +1371,12 @@ S32 omx_dec_reinit(ALBaseContext *ctx) {
   omx_get_handle(ctx);
   if (!context->hComponentDecoder) {
     error("could not get handle");
-    omx_deinit();
+    context->omx_deinit();
     return MPP_INIT_FAILED;
   }
   if (MPP_OK != output_port_init(ctx)) {
     error("could not init output port");
-    omx_deinit();
+    context->omx_deinit();
     return MPP_INIT_FAILED;
   }
 
@@ -1208,13 +1385,13 @@ S32 omx_dec_reinit(ALBaseContext *ctx) {
 
   if (MPP_OK != input_port_init(ctx)) {
     error("could not init input port");
-    omx_deinit();
+    context->omx_deinit();
     return MPP_INIT_FAILED;
   }
 
   if (MPP_OK != alloc_input_buffer(ctx)) {
     error("could not alloc input buffer");
-    omx_deinit();
+    context->omx_deinit();
     return MPP_INIT_FAILED;
   }
 
@@ -1261,6 +1438,8 @@ S32 al_dec_flush(ALBaseContext *ctx) {
 
   debug("start to seek flush.(%d, %d)", context->decInNum, context->decOutNum);
 
+  drop_pending(context);
+
   if (DATAQUEUE_IsEmpty(context->pInputQueue)) {
     debug("pInputQueue is empty");
   } else {
@@ -1270,8 +1449,7 @@ S32 al_dec_flush(ALBaseContext *ctx) {
         MppData *sink_data = DATAQUEUE_GetData(node);
         MppPacket *sink_packet = PACKET_GetPacket(sink_data);
 
-        PACKET_Free(sink_packet);
-        PACKET_Destory(sink_packet);
+        release_packet(context, sink_packet, MPP_FALSE);
         DATAQUEUE_Node_Destory(node);
         release_num++;
 
@@ -1387,15 +1565,13 @@ void al_dec_destory(ALBaseContext *ctx) {
 #endif
   }
   error("destory 4");
-  for (S32 i = 0; i < context->nInputBufferCount; i++) {
-    OMX_FreeBuffer(context->hComponentDecoder, 0,
-                   context->pInputBufferArray[i]);
-  }
+  drop_pending(context);
+  sfomxil_buffer_free(&context->stInput, context->hComponentDecoder);
   error("destory 5");
   while (context->comState != OMX_StateLoaded)
     ;
-  omx_freehandle(context->hComponentDecoder);
-  omx_deinit();
+  context->omx_freehandle(context->hComponentDecoder);
+  context->omx_deinit();
   error("destory 6");
   dlclose(context->load_so);
   error("destory 7");
@@ -1418,3 +1594,37 @@ void al_dec_destory(ALBaseContext *ctx) {
 
   free(context);
 }
+
+/**
+ * descriptor of the whole sfomxil_plugin library, sfomxil_enc_plugin.c is
+ * in it too. The wave511 decoder and the wave420l encoder of the JH7110.
+ */
+static const MppCodingType stSfOmxilCodingTypes[] = {
+    CODING_H264,
+    CODING_H265,
+};
+
+static const MppPixelFormat stSfOmxilPixelFormats[] = {
+    PIXEL_FORMAT_I420,
+    PIXEL_FORMAT_NV12,
+    PIXEL_FORMAT_NV21,
+};
+
+static const ALPluginCaps stSfOmxilCaps = {
+    .nVersion = AL_PLUGIN_CAPS_VERSION,
+    .eModuleType = CODEC_SFOMX,
+    .pDecoderCodingTypes = stSfOmxilCodingTypes,
+    .nDecoderCodingTypeNum = NUM_OF(stSfOmxilCodingTypes),
+    .pEncoderCodingTypes = stSfOmxilCodingTypes,
+    .nEncoderCodingTypeNum = NUM_OF(stSfOmxilCodingTypes),
+    .pPixelFormats = stSfOmxilPixelFormats,
+    .nPixelFormatNum = NUM_OF(stSfOmxilPixelFormats),
+    .nMaxWidth = 4096,
+    .nMaxHeight = 2304,
+    .nMemoryModes =
+        AL_PLUGIN_MEMORY_MODE(MPP_FRAME_BUFFERTYPE_DMABUF_INTERNAL),
+    .nMaxInstances = 0,
+    .nCost = 20,
+};
+
+const ALPluginCaps *al_plugin_get_caps() { return &stSfOmxilCaps; }
@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-17 09:38:36
- * @LastEditTime: 2023-11-13 15:55:59
+ * @LastEditTime: 2024-06-01 18:10:24
  * @Description: video encode plugin for starfive omxIL layer
  */
 
@@ -29,7 +29,10 @@
 #include <unistd.h>
 
 #include "al_interface_enc.h"
+#include "env.h"
 #include "log.h"
+#include "notify.h"
+#include "sfomxil_buffer.h"
 #include "sfomxil_find_enc_library.h"
 
 #define MODULE_TAG "sfomxil_enc"
@@ -43,13 +46,6 @@
   (a).nVersion.s.nRevision = 1;     \
   (a).nVersion.s.nStep = 1
 
-OMX_ERRORTYPE (*omx_enc_init)(void);
-OMX_ERRORTYPE (*omx_enc_deinit)(void);
-OMX_ERRORTYPE(*omx_enc_gethandle)
-(OMX_HANDLETYPE *pHandle, OMX_STRING cComponentName, OMX_PTR pAppData,
- OMX_CALLBACKTYPE *pCallBacks);
-OMX_ERRORTYPE (*omx_enc_freehandle)(OMX_HANDLETYPE hComponent);
-
 typedef struct Message {
   long msg_type;
   OMX_S32 msg_flag;
@@ -73,16 +69,50 @@ struct _ALSfOmxilEncContext {
   volatile OMX_STATETYPE comState;
   OMX_PARAM_PORTDEFINITIONTYPE pInputPortDefinition;
   OMX_PARAM_PORTDEFINITIONTYPE pOutputPortDefinition;
-  OMX_BUFFERHEADERTYPE *pInputBufferArray[64];
   OMX_BUFFERHEADERTYPE *pOutputBufferArray[64];
+
+  /***
+   * input port buffers from the dma heap, a frame is copied into an idle one
+   * at once, it waits in pInputQueue (copied into a frame of our own) only
+   * if all of them are in the component. The mutex keeps the APP thread and
+   * the work thread from sending the frames out of order.
+   */
+  SfOmxilBufferSet stInput;
+  pthread_mutex_t stInputMutex;
   MppDataQueue *pInputQueue;
+  BOOL bStarted;
+
+  /***
+   * ids of the frames sent by al_enc_send_input_frame, for
+   * al_enc_return_input_frame
+   */
+  S32 nDoneId[SFOMXIL_MAX_BUFFER_NUM];
+  S32 nDoneHead;
+  S32 nDoneNum;
   MppDataQueue *pOutputQueue;
+
+  /***
+   * nOutputEventFd of MppVencPara, signaled when a stream is pushed into
+   * pOutputQueue or the encoder ends
+   */
+  S32 nOutputEventFd;
   S32 msgid;
   S32 EncRetEos;
   pthread_t workthread;
+  volatile BOOL bDisableEvent;
+  volatile BOOL bJustQuit;
+  U32 nStreamNum;
+  S64 nStreamBytes;
   // load openmax il so
   U8 so_path[256];
   void *load_so;
+  OMX_ERRORTYPE (*omx_enc_init)(void);
+  OMX_ERRORTYPE (*omx_enc_deinit)(void);
+  OMX_ERRORTYPE (*omx_enc_gethandle)(OMX_HANDLETYPE *pHandle,
+                                     OMX_STRING cComponentName,
+                                     OMX_PTR pAppData,
+                                     OMX_CALLBACKTYPE *pCallBacks);
+  OMX_ERRORTYPE (*omx_enc_freehandle)(OMX_HANDLETYPE hComponent);
 };
 
 PIXEL_FORMAT_MAPPING_DEFINE(SoftSfomxEnc, OMX_COLOR_FORMATTYPE)
@@ -94,13 +124,6 @@ static const ALSoftSfomxEncPixelFormatMapping
 };
 PIXEL_FORMAT_MAPPING_CONVERT(SoftSfomxEnc, softsfomxenc, OMX_COLOR_FORMATTYPE)
 
-static OMX_BOOL inputEndFlag = OMX_FALSE;
-// static OMX_S32 FillInputBuffer(ALSfOmxilEncContext *encodeTestContext,
-// OMX_BUFFERHEADERTYPE *pInputBuffer);
-static OMX_BOOL disableEVnt;
-static OMX_BOOL justQuit = OMX_FALSE;
-static S32 enc_eos = MPP_FALSE;
-
 static OMX_ERRORTYPE event_handler(OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
                                    OMX_EVENTTYPE eEvent, OMX_U32 nData1,
                                    OMX_U32 nData2, OMX_PTR pEventData) {
@@ -143,7 +166,7 @@ static OMX_ERRORTYPE event_handler(OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
           pEncodeTestContext->comState = (OMX_STATETYPE)(nData2);
         }
         case OMX_CommandPortDisable: {
-          if (1 == nData2) disableEVnt = OMX_TRUE;
+          if (1 == nData2) pEncodeTestContext->bDisableEvent = OMX_TRUE;
         } break;
         default:
           break;
@@ -151,7 +174,7 @@ static OMX_ERRORTYPE event_handler(OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
     } break;
     case OMX_EventError: {
       error("receive err event %d %d", nData1, nData2);
-      justQuit = OMX_TRUE;
+      pEncodeTestContext->bJustQuit = OMX_TRUE;
     } break;
     default:
       break;
@@ -195,23 +218,14 @@ static OMX_ERRORTYPE empty_buffer_done_handler(OMX_HANDLETYPE hComponent,
   return OMX_ErrorNone;
 }
 
-static OMX_S32 FillInputBuffer(ALSfOmxilEncContext *encodeTestContext,
-                               MppData *sink_data,
+static OMX_S32 FillInputBuffer(ALSfOmxilEncContext *context, MppFrame *frame,
                                OMX_BUFFERHEADERTYPE *pInputBuffer) {
-  ALSfOmxilEncContext *context = (ALSfOmxilEncContext *)encodeTestContext;
   S32 pnum = 0;
   S32 width, height, i, size[3], offset, length;
-  MppFrame *frame = FRAME_GetFrame(sink_data);
-
-  // OMX_S32 error;
-  if (!sink_data) {
-    pInputBuffer->nFlags = 0x10;
-    pInputBuffer->nFilledLen = 0;
-    return pInputBuffer->nFilledLen;
-  }
+  MppFrameEos eos = FRAME_GetEos(frame);
 
-  if (FRAME_GetEos(frame)) {
-    pInputBuffer->nFlags = 0x01;
+  if (FRAME_EOS_WITHOUT_DATA == eos) {
+    pInputBuffer->nFlags = OMX_BUFFERFLAG_EOS;
     pInputBuffer->nFilledLen = 0;
     return pInputBuffer->nFilledLen;
   }
@@ -236,16 +250,67 @@ static OMX_S32 FillInputBuffer(ALSfOmxilEncContext *encodeTestContext,
     length += size[i];
     offset += size[i];
   }
-  pInputBuffer->nFlags = 0x10;
+  pInputBuffer->nFlags = OMX_BUFFERFLAG_ENDOFFRAME;
+  if (FRAME_EOS_WITH_DATA == eos) pInputBuffer->nFlags |= OMX_BUFFERFLAG_EOS;
   pInputBuffer->nFilledLen = length;
-  FRAME_Free(frame);
-  FRAME_Destory(frame);
-
-  // input node free
 
   return pInputBuffer->nFilledLen;
 }
 
+/**
+ * @description: copy the frame into the input buffer taken for it and send
+ * it, the component is started once every input buffer is sent or EOS is.
+ * Called with stInputMutex held.
+ */
+static RETURN empty_input(ALSfOmxilEncContext *context, MppFrame *frame,
+                          SfOmxilBuffer *buffer) {
+  OMX_ERRORTYPE err = OMX_ErrorNone;
+
+  FillInputBuffer(context, frame, buffer->pHeader);
+  err = OMX_EmptyThisBuffer(context->hComponentEncoder, buffer->pHeader);
+  if (OMX_ErrorNone != err) {
+    error("OMX_EmptyThisBuffer failed, please check! error = %x", err);
+    sfomxil_buffer_move(&context->stInput, buffer,
+                        SFOMXIL_BUFFER_OWNED_BY_COMPONENT,
+                        SFOMXIL_BUFFER_OWNED_BY_PLUGIN);
+    return MPP_ENCODER_ERROR;
+  }
+
+  if (!context->bStarted &&
+      (FRAME_GetEos(frame) ||
+       !sfomxil_buffer_count(&context->stInput,
+                             SFOMXIL_BUFFER_OWNED_BY_PLUGIN))) {
+    debug("start process");
+    OMX_SendCommand(context->hComponentEncoder, OMX_CommandStateSet,
+                    OMX_StateExecuting, NULL);
+    context->bStarted = MPP_TRUE;
+  }
+
+  return MPP_OK;
+}
+
+/**
+ * @description: send the waiting frames while there are idle input buffers,
+ * called with stInputMutex held
+ */
+static void feed_input(ALSfOmxilEncContext *context) {
+  SfOmxilBuffer *buffer = NULL;
+  MppDataQueueNode *node = NULL;
+
+  while (!DATAQUEUE_IsEmpty(context->pInputQueue)) {
+    buffer = sfomxil_buffer_take(&context->stInput,
+                                 SFOMXIL_BUFFER_OWNED_BY_COMPONENT);
+    if (!buffer) break;
+
+    node = DATAQUEUE_Pop(context->pInputQueue);
+    MppFrame *frame = FRAME_GetFrame(DATAQUEUE_GetData(node));
+    empty_input(context, frame, buffer);
+    if (FRAME_EOS_WITHOUT_DATA != FRAME_GetEos(frame)) FRAME_Free(frame);
+    FRAME_Destory(frame);
+    DATAQUEUE_Node_Destory(node);
+  }
+}
+
 ALBaseContext *al_enc_create() {
   ALSfOmxilEncContext *context =
       (ALSfOmxilEncContext *)malloc(sizeof(ALSfOmxilEncContext));
@@ -264,29 +329,6 @@ void *do_encode(void *private_data) {
   Message data;
 
   while (OMX_TRUE) {
-    static S32 i = 0;
-
-    if (i < 5) {
-      MppDataQueueNode *node = DATAQUEUE_Pop(context->pInputQueue);
-      if (node) {
-        MppData *sink_data = DATAQUEUE_GetData(node);
-        FillInputBuffer(context, sink_data, context->pInputBufferArray[i]);
-        OMX_EmptyThisBuffer(context->hComponentEncoder,
-                            context->pInputBufferArray[i]);
-        i++;
-      } else {
-      }
-      continue;
-    } else if (5 == i) {
-      debug("start process");
-      OMX_SendCommand(context->hComponentEncoder, OMX_CommandStateSet,
-                      OMX_StateExecuting, NULL);
-      i++;
-      debug("start process finish");
-      // usleep(100000);
-      continue;
-    }
-
     if (-1 == msgrcv(context->msgid, (void *)&data, BUFSIZ, 0, 0)) {
       error("msgrcv failed with errno: %d .................", errno);
       continue;
@@ -294,31 +336,15 @@ void *do_encode(void *private_data) {
 
     switch (data.msg_flag) {
       case 0: {
-        OMX_BUFFERHEADERTYPE *pBuffer = data.pBuffer;
-        // debug("......input");
-        MppDataQueueNode *node = NULL;
-        // while(!node)
-        //{
-        node = DATAQUEUE_Pop(context->pInputQueue);
-        //   usleep(10000);
-        // }
-
-        if (node) {
-          MppData *sink_data = DATAQUEUE_GetData(node);
-          FillInputBuffer(context, sink_data, pBuffer);
-          OMX_EmptyThisBuffer(context->hComponentEncoder, pBuffer);
-          // debug("......input finish, need_d: %d", sink_data->bEos);
-        } else {
-          Message data;
-          data.msg_type = 1;
-          data.msg_flag = 0;
-          data.pBuffer = pBuffer;
-          if (-1 == msgsnd(context->msgid, (void *)&data,
-                           sizeof(data) - sizeof(data.msg_type), 0)) {
-            error("msgsnd failed .....");
-          }
-        }
-
+        // an idle input buffer stays with the plugin, al_enc_encode fills
+        // it at once when a frame comes
+        pthread_mutex_lock(&context->stInputMutex);
+        sfomxil_buffer_move(
+            &context->stInput,
+            sfomxil_buffer_find_header(&context->stInput, data.pBuffer),
+            SFOMXIL_BUFFER_OWNED_BY_COMPONENT, SFOMXIL_BUFFER_OWNED_BY_PLUGIN);
+        feed_input(context);
+        pthread_mutex_unlock(&context->stInputMutex);
       } break;
       case 1: {
         OMX_BUFFERHEADERTYPE *pBuffer = data.pBuffer;
@@ -333,6 +359,7 @@ void *do_encode(void *private_data) {
         DATAQUEUE_SetData(node, PACKET_GetBaseData(packet));
 
         ret = DATAQUEUE_Push(context->pOutputQueue, node);
+        if (!ret) mpp_notify_signal(context->nOutputEventFd);
 
         if ((pBuffer->nFlags) & (OMX_BUFFERFLAG_EOS == OMX_BUFFERFLAG_EOS)) {
           error("decoder commit EOS 111!");
@@ -365,8 +392,10 @@ void *do_encode(void *private_data) {
 
 finish:
   context->EncRetEos = MPP_TRUE;
+  mpp_notify_signal(context->nOutputEventFd);
 
   debug("finish encode!");
+  return NULL;
 }
 
 RETURN al_enc_init(ALBaseContext *ctx, MppVencPara *para) {
@@ -381,6 +410,9 @@ RETURN al_enc_init(ALBaseContext *ctx, MppVencPara *para) {
   }
 
   ALSfOmxilEncContext *context = (ALSfOmxilEncContext *)ctx;
+  U8 *omx_path = NULL;
+
+  context->nOutputEventFd = para->nOutputEventFd;
 
   OMX_S32 msgid = -1;
   msgid = msgget(IPC_PRIVATE, 0666 | IPC_CREAT);
@@ -390,23 +422,33 @@ RETURN al_enc_init(ALBaseContext *ctx, MppVencPara *para) {
   }
   context->msgid = msgid;
 
-  find_enc_sfomx(context->so_path);
+  // MPP_SFOMX_LIBRARY replaces the omx il core, tests load a mock core by it
+  mpp_env_get_str("MPP_SFOMX_LIBRARY", &omx_path, NULL);
+  if (omx_path)
+    snprintf(context->so_path, sizeof(context->so_path), "%s", omx_path);
+  else
+    find_enc_sfomx(context->so_path);
   context->load_so = dlopen(context->so_path, RTLD_LAZY | RTLD_LOCAL);
-  omx_enc_init = (OMX_ERRORTYPE(*)(void))dlsym(context->load_so, "OMX_Init");
-  omx_enc_deinit =
+  if (!context->load_so) {
+    error("can not dlopen load_so, please check! (%s)", dlerror());
+    return -1;
+  }
+  context->omx_enc_init =
+      (OMX_ERRORTYPE(*)(void))dlsym(context->load_so, "OMX_Init");
+  context->omx_enc_deinit =
       (OMX_ERRORTYPE(*)(void))dlsym(context->load_so, "OMX_Deinit");
-  omx_enc_gethandle =
+  context->omx_enc_gethandle =
       (OMX_ERRORTYPE(*)(OMX_HANDLETYPE * pHandle, OMX_STRING cComponentName,
                         OMX_PTR pAppData, OMX_CALLBACKTYPE * pCallBacks))
           dlsym(context->load_so, "OMX_GetHandle");
-  omx_enc_freehandle = (OMX_ERRORTYPE(*)(OMX_HANDLETYPE hComponent))dlsym(
-      context->load_so, "OMX_FreeHandle");
+  context->omx_enc_freehandle = (OMX_ERRORTYPE(*)(
+      OMX_HANDLETYPE hComponent))dlsym(context->load_so, "OMX_FreeHandle");
 
   /*omx init*/
   S32 ret = OMX_ErrorNone;
   // signal(SIGINT, signal_handle);
   debug("init omx");
-  ret = omx_enc_init();
+  ret = context->omx_enc_init();
   if (ret != OMX_ErrorNone) {
     error("run OMX_Init failed. ret is %d ", ret);
     return -1;
@@ -416,11 +458,12 @@ RETURN al_enc_init(ALBaseContext *ctx, MppVencPara *para) {
   context->callbacks.FillBufferDone = fill_output_buffer_done_handler;
   context->callbacks.EmptyBufferDone = empty_buffer_done_handler;
 
-  omx_enc_gethandle(&context->hComponentEncoder, "OMX.sf.video_encoder.hevc",
-                    context, &context->callbacks);
+  context->omx_enc_gethandle(&context->hComponentEncoder,
+                             "OMX.sf.video_encoder.hevc", context,
+                             &context->callbacks);
   if (!context->hComponentEncoder) {
     error("could not get handle");
-    omx_enc_deinit();
+    context->omx_enc_deinit();
     return -1;
   }
   OMX_INIT_STRUCTURE(context->pInputPortDefinition);
@@ -498,28 +541,28 @@ RETURN al_enc_init(ALBaseContext *ctx, MppVencPara *para) {
   OMX_U32 nInputBufferSize = context->pInputPortDefinition.nBufferSize;
   OMX_U32 nInputBufferCount = context->pInputPortDefinition.nBufferCountActual;
 
-  disableEVnt = OMX_FALSE;
+  context->bDisableEvent = OMX_FALSE;
   OMX_SendCommand(context->hComponentEncoder, OMX_CommandPortDisable, 1, NULL);
   debug("wait for output port disable");
-  // while (!disableEVnt && !justQuit);
-  // if (justQuit)
+  // while (!context->bDisableEvent && !context->bJustQuit);
+  // if (context->bJustQuit)
   // goto end;
   debug("output port disabled");
 
   OMX_SendCommand(context->hComponentEncoder, OMX_CommandStateSet,
                   OMX_StateIdle, NULL);
 
-  for (S32 i = 0; i < nInputBufferCount; i++) {
-    OMX_BUFFERHEADERTYPE *pBuffer = NULL;
-    OMX_AllocateBuffer(context->hComponentEncoder, &pBuffer, 0, NULL,
-                       nInputBufferSize);
-    context->pInputBufferArray[i] = pBuffer;
+  if (MPP_OK != sfomxil_buffer_alloc(&context->stInput,
+                                     context->hComponentEncoder, 0,
+                                     nInputBufferCount, nInputBufferSize)) {
+    error("could not alloc input buffer, please check!");
+    return MPP_INIT_FAILED;
   }
 
   debug("wait for Component idle");
-  while (context->comState != OMX_StateIdle && !justQuit)
+  while (context->comState != OMX_StateIdle && !context->bJustQuit)
     ;
-  if (justQuit) return -1;
+  if (context->bJustQuit) return -1;
   debug("Component in idle");
   /*
       for (S32 i = 0; i < nInputBufferCount; i++)
@@ -535,6 +578,7 @@ RETURN al_enc_init(ALBaseContext *ctx, MppVencPara *para) {
       OMX_SendCommand(context->hComponentEncoder, OMX_CommandStateSet,
      OMX_StateExecuting, NULL);
   */
+  pthread_mutex_init(&context->stInputMutex, NULL);
   context->pInputQueue = DATAQUEUE_Init(MPP_TRUE, MPP_FALSE);
 
   context->pOutputQueue = DATAQUEUE_Init(MPP_TRUE, MPP_FALSE);
@@ -553,27 +597,20 @@ exit:
 
 S32 al_enc_set_para(ALBaseContext *ctx, MppVencPara *para) { return 0; }
 
-S32 al_enc_encode(ALBaseContext *ctx, MppData *sink_data) {
-  if (!ctx) return MPP_NULL_POINTER;
-
-  ALSfOmxilEncContext *context = (ALSfOmxilEncContext *)ctx;
-  S32 ret = 0;
+/**
+ * @description: a copy of the frame in memory of our own, for a frame which
+ * has to wait for an input buffer
+ */
+static MppFrame *copy_frame(ALSfOmxilEncContext *context,
+                            MppFrame *sink_frame) {
   S32 width, height, i, size[3];
   MppPixelFormat ePixelFormat;
-
-  MppDataQueueNode *node =
-      (MppDataQueueNode *)malloc(DATAQUEUE_GetNodeStructSize());
-  MppFrame *sink_frame = FRAME_GetFrame(sink_data);
   MppFrame *frame = FRAME_Create();
 
-  if (FRAME_GetEos(sink_frame)) {
-    FRAME_SetEos(frame, 1);
-    DATAQUEUE_SetData(node, FRAME_GetBaseData(frame));
+  if (!frame) return NULL;
 
-    ret = DATAQUEUE_Push(context->pInputQueue, node);
-
-    return ret;
-  }
+  FRAME_SetEos(frame, FRAME_GetEos(sink_frame));
+  if (FRAME_EOS_WITHOUT_DATA == FRAME_GetEos(sink_frame)) return frame;
 
   width = context->pInputPortDefinition.format.video.nFrameWidth;
   height = context->pInputPortDefinition.format.video.nFrameHeight;
@@ -591,42 +628,133 @@ S32 al_enc_encode(ALBaseContext *ctx, MppData *sink_data) {
       (OMX_COLOR_FORMATTYPE)(context->pInputPortDefinition.format.video
                                  .eColorFormat));
 
-  // debug("enc %d, %d %d, %d, %x", ePixelFormat,
-  // width, height, size[1],
-  // (OMX_COLOR_FORMATTYPE)(context->pInputPortDefinition.format.video.eColorFormat));
-  ret = FRAME_Alloc(frame, ePixelFormat, width, height);
+  if (FRAME_Alloc(frame, ePixelFormat, width, height)) {
+    FRAME_Destory(frame);
+    return NULL;
+  }
 
   for (i = 0; i < FRAME_GetDataUsedNum(frame); i++) {
     memcpy(FRAME_GetDataPointer(frame, i), FRAME_GetDataPointer(sink_frame, i),
            size[i]);
-#if 0
-        //SF_OMX_BUF_INFO *pBufInfo = pOMXBuffer->pOutputPortPrivate;
-        //LOG(SF_LOG_INFO, "%p %d %p", pOMXBuffer->pBuffer, pOMXBuffer->nFilledLen, pBufInfo->remap_vaddr);
-        FILE *fbbb;
+  }
+
+  return frame;
+}
+
+/**
+ * @description: the frame is copied into an idle input buffer at once, or
+ * into memory of our own to wait for one, it can be released on return.
+ */
+S32 al_enc_encode(ALBaseContext *ctx, MppData *sink_data) {
+  if (!ctx || !sink_data) return MPP_NULL_POINTER;
 
-        fbbb = fopen("/tmp/out.yuv", "ab+");
-        fwrite(FRAME_GetDataPointer(sink_frame, i), 1, size[i], fbbb);
-        fclose(fbbb);
-#endif
+  ALSfOmxilEncContext *context = (ALSfOmxilEncContext *)ctx;
+  MppFrame *sink_frame = FRAME_GetFrame(sink_data);
+  SfOmxilBuffer *buffer = NULL;
+  MppDataQueueNode *node = NULL;
+  MppFrame *frame = NULL;
+  S32 ret = 0;
+
+  pthread_mutex_lock(&context->stInputMutex);
+  if (DATAQUEUE_IsEmpty(context->pInputQueue)) {
+    buffer = sfomxil_buffer_take(&context->stInput,
+                                 SFOMXIL_BUFFER_OWNED_BY_COMPONENT);
   }
 
-  DATAQUEUE_SetData(node, FRAME_GetBaseData(frame));
-  //    debug("ret = %d, sink_data bEos:%d, %d, %d, %d", ret,
-  //    sink_data->bEos, FRAME_GetDataUsedNum(frame), width, height);
+  if (buffer) ret = empty_input(context, sink_frame, buffer);
+  pthread_mutex_unlock(&context->stInputMutex);
+  if (buffer) return ret;
+
+  node = DATAQUEUE_Node_Create();
+  frame = copy_frame(context, sink_frame);
+  if (!node || !frame) {
+    error("can not copy the frame, please check!");
+    if (node) DATAQUEUE_Node_Destory(node);
+    if (frame) FRAME_Destory(frame);
+    return MPP_MALLOC_FAILED;
+  }
 
+  // the push can wait for room, which the work thread makes with the lock,
+  // an input buffer may be idle again meanwhile, so feed it afterwards
+  DATAQUEUE_SetData(node, FRAME_GetBaseData(frame));
   ret = DATAQUEUE_Push(context->pInputQueue, node);
+  pthread_mutex_lock(&context->stInputMutex);
+  feed_input(context);
+  pthread_mutex_unlock(&context->stInputMutex);
 
   return ret;
 }
 
-S32 al_enc_request_output_stream(ALBaseContext *ctx, MppData *src_data) {
-  static U32 count = 0;
+/**
+ * @description: copy the frame into an idle input buffer, the caller gets
+ * its id back by al_enc_return_input_frame.
+ * @return {*}: MPP_OK, MPP_POLL_FAILED if all input buffers are in the
+ * component (get streams and return frames, then send it again)
+ */
+S32 al_enc_send_input_frame(ALBaseContext *ctx, MppData *sink_data) {
+  if (!ctx || !sink_data) {
+    error("input para is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  ALSfOmxilEncContext *context = (ALSfOmxilEncContext *)ctx;
+  MppFrame *frame = FRAME_GetFrame(sink_data);
+  SfOmxilBuffer *buffer = NULL;
+  S32 ret = MPP_POLL_FAILED;
+
+  pthread_mutex_lock(&context->stInputMutex);
+  // frames copied by al_enc_encode go first
+  if (DATAQUEUE_IsEmpty(context->pInputQueue) &&
+      context->nDoneNum < SFOMXIL_MAX_BUFFER_NUM) {
+    buffer = sfomxil_buffer_take(&context->stInput,
+                                 SFOMXIL_BUFFER_OWNED_BY_COMPONENT);
+  }
+
+  if (buffer) {
+    ret = empty_input(context, frame, buffer);
+    if (MPP_OK == ret && FRAME_EOS_WITHOUT_DATA != FRAME_GetEos(frame)) {
+      context->nDoneId[(context->nDoneHead + context->nDoneNum) %
+                       SFOMXIL_MAX_BUFFER_NUM] = FRAME_GetID(frame);
+      context->nDoneNum++;
+    }
+  }
+  pthread_mutex_unlock(&context->stInputMutex);
+
+  return ret;
+}
+
+/**
+ * @description: a frame sent by al_enc_send_input_frame, which is copied
+ * and can be reused
+ * @return {*}: the id of the frame, -1 if there is none now
+ */
+S32 al_enc_return_input_frame(ALBaseContext *ctx, MppData *sink_data) {
+  if (!ctx) {
+    error("input para ALBaseContext is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  ALSfOmxilEncContext *context = (ALSfOmxilEncContext *)ctx;
+  S32 id = -1;
+
+  pthread_mutex_lock(&context->stInputMutex);
+  if (context->nDoneNum) {
+    id = context->nDoneId[context->nDoneHead];
+    context->nDoneHead = (context->nDoneHead + 1) % SFOMXIL_MAX_BUFFER_NUM;
+    context->nDoneNum--;
+  }
+  pthread_mutex_unlock(&context->stInputMutex);
+
+  if (id >= 0 && sink_data) FRAME_SetID(FRAME_GetFrame(sink_data), id);
+
+  return id;
+}
 
+S32 al_enc_request_output_stream(ALBaseContext *ctx, MppData *src_data) {
   if (!ctx) return MPP_NULL_POINTER;
 
   ALSfOmxilEncContext *context = (ALSfOmxilEncContext *)ctx;
   S32 ret = 0;
-  static S32 length = 0;
 
   if (context->EncRetEos && DATAQUEUE_IsEmpty(context->pOutputQueue) == 1) {
     return MPP_CODER_EOS;
@@ -638,9 +766,10 @@ S32 al_enc_request_output_stream(ALBaseContext *ctx, MppData *src_data) {
 
   // src_data = node->data;
   memcpy(src_data, DATAQUEUE_GetData(node), PACKET_GetStructSize());
-  length += PACKET_GetLength(PACKET_GetPacket(src_data));
-  debug("request output, %d, %d, %d",
-        PACKET_GetLength(PACKET_GetPacket(src_data)), length, ++count);
+  context->nStreamBytes += PACKET_GetLength(PACKET_GetPacket(src_data));
+  debug("request output, %d, %lld, %u",
+        PACKET_GetLength(PACKET_GetPacket(src_data)), context->nStreamBytes,
+        ++context->nStreamNum);
 
   return MPP_OK;
 }
@@ -675,6 +804,19 @@ void al_enc_destory(ALBaseContext *ctx) {
       ;
     debug("Component in idle");
   }
-  omx_enc_freehandle(context->hComponentEncoder);
-  omx_enc_deinit();
+  sfomxil_buffer_free(&context->stInput, context->hComponentEncoder);
+  context->omx_enc_freehandle(context->hComponentEncoder);
+  context->omx_enc_deinit();
+
+  // the work thread is still blocked in msgrcv if the encoder did not reach
+  // EOS, only release the per channel resources when it has exited.
+  if (!context->EncRetEos) return;
+
+  pthread_join(context->workthread, NULL);
+  pthread_mutex_destroy(&context->stInputMutex);
+  msgctl(context->msgid, IPC_RMID, NULL);
+  DATAQUEUE_Destory(context->pInputQueue);
+  DATAQUEUE_Destory(context->pOutputQueue);
+  dlclose(context->load_so);
+  free(context);
 }
@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2024-03-25 09:26:08
- * @LastEditTime: 2024-04-09 16:38:37
+ * @LastEditTime: 2024-06-01 11:20:47
  * @FilePath: \mpp\al\vcodec\v4l2\linlonv5v7\include\linlonv5v7_buffer.h
  * @Description:
  */
@@ -214,5 +214,7 @@ S32 getExtraId(Buffer *buf);
 S32 getExtraFd(Buffer *buf);
 BOOL getIsQueued(Buffer *buf);
 S32 setIsQueued(Buffer *buf, BOOL queued);
+BOOL getIsLent(Buffer *buf);
+void setIsLent(Buffer *buf, BOOL lent);
 
 #endif /*_LINLONV5V7_BUFFER_H_*/
@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2024-03-07 14:18:00
- * @LastEditTime: 2024-04-09 16:06:27
+ * @LastEditTime: 2024-06-02 10:52:46
  * @FilePath: \mpp\al\vcodec\v4l2\linlonv5v7\include\linlonv5v7_constant.h
  * @Description:
  */
@@ -25,6 +25,12 @@
 #define ENCODER_OUTPUT_BUF_NUM (6)
 
 #define POLL_TIMEOUT (0)
+// ms and times, wait for the device before retrying a busy VIDIOC_STREAMON
+#define STREAMON_WAIT_TIME (5)
+#define STREAMON_RETRY_NUM (10)
+
+// the driver VIDIOC_QUERYCAP of the linlon device tells
+#define LINLONV5V7_DRIVER_NAME "mvx"
 
 #define SIZE_IMAGE (1024 * 1024)
 
@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2024-03-20 19:29:29
- * @LastEditTime: 2024-03-26 09:46:18
+ * @LastEditTime: 2024-06-01 11:20:47
  * @FilePath: \mpp\al\vcodec\v4l2\linlonv5v7\include\linlonv5v7_port.h
  * @Description:
  */
@@ -154,7 +154,7 @@ void freeBuffers(Port *port);
 U32 getBufferCount(Port *port);
 
 /**
- * @description: queue all buffers to driver
+ * @description: queue all buffers to driver, except the lent ones
  * @param {Port} *port: context of the port
  * @param {BOOL} eof: end of file
  * @return {*}
@@ -197,7 +197,7 @@ S32 handleOutputBuffer(Port *port, BOOL eof, MppData *data);
  */
 void handleResolutionChange(Port *port, BOOL eof);
 
-void streamon(Port *port);
+S32 streamon(Port *port);
 void streamoff(Port *port);
 
 void sendEncStopCommand(Port *port);
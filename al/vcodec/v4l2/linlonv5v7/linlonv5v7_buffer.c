@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-10-07 14:08:38
- * @LastEditTime: 2024-04-09 16:51:49
+ * @LastEditTime: 2024-06-01 11:20:47
  * @Description:
  */
 
@@ -38,6 +38,12 @@ struct _Buffer {
   S32 nExtraFd;
   BOOL bIsQueued;
 
+  /***
+   * the data of the buffer is lent to APP (encoder stream by
+   * al_enc_request_output_stream), do not queue it until it is returned.
+   */
+  BOOL bIsLent;
+
   /***
    * only for frame, not used for packet
    */
@@ -587,3 +593,7 @@ S32 getExtraFd(Buffer *buf) { return buf->nExtraFd; }
 BOOL getIsQueued(Buffer *buf) { return buf->bIsQueued; }
 
 S32 setIsQueued(Buffer *buf, BOOL queued) { buf->bIsQueued = queued; }
+
+BOOL getIsLent(Buffer *buf) { return buf->bIsLent; }
+
+void setIsLent(Buffer *buf, BOOL lent) { buf->bIsLent = lent; }
@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-09-26 19:28:42
- * @LastEditTime: 2024-04-09 17:57:06
+ * @LastEditTime: 2024-06-01 10:12:35
  * @Description:
  */
 
@@ -463,10 +463,15 @@ void handleFlush(Codec *codec, BOOL eof) {
   streamoff(codec->stInputPort);
   streamoff(codec->stOutputPort);
   streamon(codec->stInputPort);
-  // this sleep is used to fix a bug, ffplay on linux sometimes get a streamon
-  // failed(Operation now in progress) error
-  usleep(5000);
-  streamon(codec->stOutputPort);
+  // ffplay on linux sometimes gets a streamon failed (Operation now in
+  // progress) error right after the input port is streamed on, wait for the
+  // device to signal instead of sleeping a fixed time, and retry.
+  for (S32 i = 0; i < STREAMON_RETRY_NUM; i++) {
+    if (!streamon(codec->stOutputPort)) break;
+    if (errno != EINPROGRESS && errno != EBUSY) break;
+    struct pollfd p = {.fd = codec->nVideoFd, .events = POLLPRI};
+    poll(&p, 1, STREAMON_WAIT_TIME);
+  }
   queueBuffers(codec->stOutputPort, MPP_FALSE);
   // port->nFramesProcessed = 0;
 }
@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-02-01 10:31:08
- * @LastEditTime: 2024-04-25 11:36:16
+ * @LastEditTime: 2024-06-02 10:52:46
  * @Description: video decode plugin for V4L2 codec interface
  */
 
@@ -17,6 +17,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
@@ -25,6 +27,7 @@
 #include "linlonv5v7_codec.h"
 #include "log.h"
 #include "mvx-v4l2-controls.h"
+#include "notify.h"
 #include "v4l2_utils.h"
 
 #define MODULE_TAG "linlonv5v7_dec"
@@ -139,6 +142,21 @@ struct _ALLinlonv5v7DecContext {
   BOOL bInputEos;
 
   pthread_t pollthread;
+  BOOL bIsPollThreadRunning;
+
+  /***
+   * eventfd polled by runpoll together with nVideoFd, writing to it wakes the
+   * poll thread up at once, it is used for shutdown.
+   */
+  S32 nEventFd;
+
+  /***
+   * epoll instance runpoll blocks in, on nEventFd and on nVideoFd edge
+   * triggered: a POLLERR the driver keeps returning (no buffer queued yet)
+   * is seen once instead of spun on. rearm_poll() modifies nVideoFd in it
+   * when a buffer is queued or returned, its state is looked at again then.
+   */
+  S32 nEpollFd;
 
   /***
    * default MPP_FLASE
@@ -284,43 +302,69 @@ static S32 checkInputParameters(MppCodingType type, S32 profile,
 }
 
 /***
- * pthread for poll event, need usleep, or CPU usage will soar, biubiu.
+ * events of nVideoFd runpoll waits for, a capture buffer done (POLLIN), a
+ * stream buffer back (POLLOUT) or a driver event (POLLPRI)
  */
-void *runpoll(void *private_data) {
-  ALLinlonv5v7DecContext *context = (ALLinlonv5v7DecContext *)private_data;
-  S32 ret = 0;
+#define LINLONV5V7_DEC_POLL_EVENTS (EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLET)
 
-  while (1) {
-    static S32 tmp = 0;
-    if (context->bIsDestoryed) pthread_exit(NULL);
+/**
+ * @description: a buffer is queued or returned, the queue state may have
+ * changed without a wake-up of the driver: look at nVideoFd again, epoll
+ * reports it at once if it is ready.
+ */
+static void rearm_poll(ALLinlonv5v7DecContext *context) {
+  struct epoll_event event = {.events = LINLONV5V7_DEC_POLL_EVENTS,
+                              .data.fd = context->nVideoFd};
+
+  if (context->nEpollFd < 0) return;
+  if (epoll_ctl(context->nEpollFd, EPOLL_CTL_MOD, context->nVideoFd, &event))
+    error("can not rearm the poll of the video fd (%s)", strerror(errno));
+}
 
-    struct pollfd p = {.fd = context->nVideoFd, .events = POLLPRI};
-    S32 ret = poll(&p, 1, POLL_TIMEOUT);
+/***
+ * pthread for poll event, it sleeps in epoll_wait() until the driver has an
+ * event or a buffer done on nVideoFd, a buffer is queued or returned
+ * (rearm_poll), or someone writes nEventFd, there is no timed wait.
+ */
+void *runpoll(void *private_data) {
+  ALLinlonv5v7DecContext *context = (ALLinlonv5v7DecContext *)private_data;
+  BOOL bErrorReported = MPP_FALSE;
+  struct epoll_event events[2];
+  U64 value;
 
+  while (!context->bIsDestoryed) {
+    U32 video_events = 0;
+    S32 ret = epoll_wait(context->nEpollFd, events, NUM_OF(events), -1);
     if (ret < 0) {
-      error("Poll returned error code.");
+      if (errno == EINTR) continue;
+      error("Poll returned error code. (%s)", strerror(errno));
+      break;
     }
 
-    if (p.revents & POLLERR) {
-      error("Poll returned error event.");
+    for (S32 i = 0; i < ret; i++) {
+      if (events[i].data.fd == context->nVideoFd) {
+        video_events |= events[i].events;
+      } else if (read(context->nEventFd, &value, sizeof(value)) < 0) {
+        debug("read eventfd failed (%s)", strerror(errno));
+      }
     }
 
-    if (0 == ret) {
-      // this log is boring, disable
-      // error("Event poll timed out.");
-    }
+    // dequeue the events first, POLLERR can come in the same round
+    if (video_events & EPOLLPRI) handleEvent(context->stCodec);
 
-    if (p.revents & POLLPRI) {
-      handleEvent(context->stCodec);
-    }
+    // a frame, a source change or EOS is waiting in the output queue
+    if (video_events & (EPOLLIN | EPOLLOUT | EPOLLPRI))
+      mpp_notify_signal(context->pVdecPara->nOutputEventFd);
 
-    usleep(10000);
-    tmp++;
-    if (200 == tmp) {
-      tmp = 0;
-      info("Now k1 hardware decoding ...");
+    if (video_events & EPOLLERR) {
+      if (!bErrorReported) error("Poll returned error event.");
+      bErrorReported = MPP_TRUE;
+    } else if (video_events) {
+      bErrorReported = MPP_FALSE;
     }
   }
+
+  return NULL;
 }
 
 ALBaseContext *al_dec_create() {
@@ -333,6 +377,8 @@ ALBaseContext *al_dec_create() {
   }
 
   memset(context, 0, sizeof(ALLinlonv5v7DecContext));
+  context->nEventFd = -1;
+  context->nEpollFd = -1;
 
   debug("init create");
 
@@ -350,6 +396,7 @@ RETURN al_dec_init(ALBaseContext *ctx, MppVdecPara *para) {
     return MPP_NULL_POINTER;
   }
 
+  struct epoll_event event;
   S32 ret = 0;
 
   ret = checkInputParameters(para->eCodingType, para->nProfile,
@@ -419,6 +466,8 @@ RETURN al_dec_init(ALBaseContext *ctx, MppVdecPara *para) {
 
   debug("video fd = %d, device path = '%s'", context->nVideoFd,
         context->sDevicePath);
+  // a frame done between two events of the poll thread wakes the sys flow
+  para->nOutputPollFd = context->nVideoFd;
 
   context->stCodec = createCodec(
       context->nVideoFd, context->nWidth, context->nHeight,
@@ -439,8 +488,35 @@ RETURN al_dec_init(ALBaseContext *ctx, MppVdecPara *para) {
   // setformat, allocate buffer, stream on
   stream(context->stCodec);
 
+  context->nEventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (context->nEventFd < 0) {
+    error("can not create eventfd, please check! (%s)", strerror(errno));
+    return MPP_INIT_FAILED;
+  }
+
+  context->nEpollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (context->nEpollFd < 0) {
+    error("can not create epoll, please check! (%s)", strerror(errno));
+    return MPP_INIT_FAILED;
+  }
+  event.events = EPOLLIN;
+  event.data.fd = context->nEventFd;
+  ret = epoll_ctl(context->nEpollFd, EPOLL_CTL_ADD, context->nEventFd, &event);
+  event.events = LINLONV5V7_DEC_POLL_EVENTS;
+  event.data.fd = context->nVideoFd;
+  if (ret ||
+      epoll_ctl(context->nEpollFd, EPOLL_CTL_ADD, context->nVideoFd, &event)) {
+    error("can not poll the video fd, please check! (%s)", strerror(errno));
+    return MPP_INIT_FAILED;
+  }
+
   // pthread for handle event or something
   ret = pthread_create(&context->pollthread, NULL, runpoll, (void *)context);
+  if (ret) {
+    error("can not create poll thread, please check! (%s)", strerror(ret));
+    return MPP_INIT_FAILED;
+  }
+  context->bIsPollThreadRunning = MPP_TRUE;
 
   context->pVdecPara->nInputQueueLeftNum =
       getBufNum(getInputPort(context->stCodec));
@@ -543,6 +619,7 @@ S32 al_dec_decode(ALBaseContext *ctx, MppData *sink_data) {
     }
     context->nInputQueuedNum++;
     context->pVdecPara->nInputQueueLeftNum--;
+    rearm_poll(context);
   } else {
     ret = runPoll(context->stCodec, &p);
     if (MPP_OK == ret && p.revents & POLLOUT) {
@@ -553,12 +630,17 @@ S32 al_dec_decode(ALBaseContext *ctx, MppData *sink_data) {
         return ret;
       }
       context->pVdecPara->nInputQueueLeftNum--;
+      rearm_poll(context);
     } else {
       // error("can not get input buffer");
       // usleep(1000);
       return MPP_POLL_FAILED;
     }
   }
+
+  // the driver decodes in the background, look for the frame now
+  mpp_notify_signal(context->pVdecPara->nOutputEventFd);
+
   return MPP_OK;
 }
 
@@ -653,6 +735,7 @@ RETURN al_dec_return_output_frame(ALBaseContext *ctx, MppData *src_data) {
     // debug("release output ret = %d", ret);
 
     context->pVdecPara->bIsBufferInDecoder[buf_idx] = MPP_TRUE;
+    rearm_poll(context);
   }
 
   return MPP_OK;
@@ -697,8 +780,15 @@ void al_dec_destory(ALBaseContext *ctx) {
   ALLinlonv5v7DecContext *context = (ALLinlonv5v7DecContext *)ctx;
   context->bIsDestoryed = MPP_TRUE;
   debug("destory start");
-  pthread_join(context->pollthread, NULL);
-  debug("pthread join finish");
+  if (context->bIsPollThreadRunning) {
+    U64 value = 1;
+    if (write(context->nEventFd, &value, sizeof(value)) < 0)
+      error("write eventfd failed (%s)", strerror(errno));
+    pthread_join(context->pollthread, NULL);
+    debug("pthread join finish");
+  }
+  if (context->nEpollFd >= 0) close(context->nEpollFd);
+  if (context->nEventFd >= 0) close(context->nEventFd);
 
   if (context->nVideoFd && context->stCodec) {
     enum v4l2_buf_type input_type =
@@ -716,3 +806,57 @@ void al_dec_destory(ALBaseContext *ctx) {
   free(context);
   context = NULL;
 }
+
+/**
+ * descriptor of the whole v4l2_linlonv5v7_codec library, the encoder is in
+ * it too, the codecs checkInputParameters lets through
+ */
+static const MppCodingType stLinlonv5v7DecCodingTypes[] = {
+    CODING_H264, CODING_H265,  CODING_MJPEG, CODING_VP8,
+    CODING_VP9,  CODING_MPEG2, CODING_MPEG4,
+};
+
+static const MppCodingType stLinlonv5v7EncCodingTypes[] = {
+    CODING_H264,
+    CODING_H265,
+    CODING_VP8,
+    CODING_MJPEG,
+};
+
+static const MppPixelFormat stLinlonv5v7PixelFormats[] = {
+    PIXEL_FORMAT_I420,
+    PIXEL_FORMAT_NV12,
+    PIXEL_FORMAT_NV21,
+};
+
+static const ALPluginCaps stLinlonv5v7Caps = {
+    .nVersion = AL_PLUGIN_CAPS_VERSION,
+    .eModuleType = CODEC_V4L2_LINLONV5V7,
+    .pDecoderCodingTypes = stLinlonv5v7DecCodingTypes,
+    .nDecoderCodingTypeNum = NUM_OF(stLinlonv5v7DecCodingTypes),
+    .pEncoderCodingTypes = stLinlonv5v7EncCodingTypes,
+    .nEncoderCodingTypeNum = NUM_OF(stLinlonv5v7EncCodingTypes),
+    .pPixelFormats = stLinlonv5v7PixelFormats,
+    .nPixelFormatNum = NUM_OF(stLinlonv5v7PixelFormats),
+    .nMaxWidth = 4096,
+    .nMaxHeight = 4096,
+    .nMemoryModes =
+        AL_PLUGIN_MEMORY_MODE(MPP_FRAME_BUFFERTYPE_DMABUF_INTERNAL),
+    .nMaxInstances = 0,
+    // below v4l2_standard_codec, which can open the same device, so the
+    // vendor plugin is picked where the device is a linlon one
+    .nCost = 9,
+};
+
+const ALPluginCaps *al_plugin_get_caps() { return &stLinlonv5v7Caps; }
+
+/**
+ * @description: only a linlon device, the generic devices are left to
+ * v4l2_standard_codec. The stream formats of the encoder map the same.
+ */
+BOOL al_plugin_probe(MppCodingType coding_type, BOOL encoder) {
+  S32 fourcc = get_linlonv5v7dec_codec_coding_type(coding_type);
+
+  return encoder ? has_v4l2_encoder(LINLONV5V7_DRIVER_NAME, fourcc)
+                 : has_v4l2_decoder(LINLONV5V7_DRIVER_NAME, fourcc);
+}
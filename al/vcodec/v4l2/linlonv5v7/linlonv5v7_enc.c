@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-02-01 10:43:49
- * @LastEditTime: 2024-04-17 13:59:22
+ * @LastEditTime: 2024-06-02 11:24:51
  * @Description: video encode plugin for V4L2 codec standard interface
  */
 
@@ -25,6 +25,7 @@
 #include "linlonv5v7_codec.h"
 #include "log.h"
 #include "mvx-v4l2-controls.h"
+#include "notify.h"
 #include "v4l2_utils.h"
 
 #define MODULE_TAG "linlonv5v7_enc"
@@ -144,6 +145,13 @@ struct _ALLinlonv5v7EncContext {
    */
   U32 nInputQueuedNum;
   BOOL bBufferNeedReturned[MAX_INPUT_BUF_NUM];
+
+  /***
+   * data pointer of the packet before al_enc_request_output_stream points it
+   * into a capture buffer, indexed by the capture buffer, it is put back by
+   * al_enc_return_output_stream so that PACKET_Free frees the right memory.
+   */
+  U8 *pOwnedPacketData[MAX_OUTPUT_BUF_NUM];
 };
 
 static void changeSWEO(ALLinlonv5v7EncContext *context, U32 csweo) {
@@ -584,6 +592,8 @@ RETURN al_enc_init(ALBaseContext *ctx, MppVencPara *para) {
 
   debug("video fd = %d, device path = '%s'", context->nVideoFd,
         context->sDevicePath);
+  // a stream done while nobody is in the plugin wakes the sys flow up
+  para->nOutputPollFd = context->nVideoFd;
 
   context->stCodec = createCodec(
       context->nVideoFd, context->nWidth, context->nHeight,
@@ -644,6 +654,7 @@ S32 al_enc_send_input_frame(ALBaseContext *ctx, MppData *sink_data) {
 
     // gstreamer last sink_data only had eos flag, no memory
     sendEncStopCommand(getInputPort(context->stCodec));
+    mpp_notify_signal(context->pVencPara->nOutputEventFd);
     return MPP_OK;
   }
 
@@ -733,6 +744,9 @@ S32 al_enc_send_input_frame(ALBaseContext *ctx, MppData *sink_data) {
     }
   }
 
+  // the driver encodes in the background, look for the stream now
+  mpp_notify_signal(context->pVencPara->nOutputEventFd);
+
   return MPP_OK;
 }
 
@@ -760,6 +774,39 @@ S32 al_enc_return_input_frame(ALBaseContext *ctx, MppData *sink_data) {
   return -1;
 }
 
+/**
+ * @description: dequeue a filled capture buffer
+ * @return {*}: MPP_OK, or MPP_CODER_EOS with the last buffer,
+ * MPP_CODER_NO_DATA if there is no buffer (*buffer is NULL)
+ */
+static S32 get_stream(ALLinlonv5v7EncContext *context, Buffer **buffer) {
+  struct pollfd p = {.fd = context->nVideoFd, .events = POLLIN};
+  S32 ret = runPoll(context->stCodec, &p);
+
+  *buffer = NULL;
+  if (MPP_OK != ret || !(p.revents & POLLIN)) return MPP_CODER_NO_DATA;
+
+  *buffer = dequeueBuffer(getOutputPort(context->stCodec));
+  if (!*buffer) return MPP_CODER_NO_DATA;
+
+  struct v4l2_buffer *b = getV4l2Buffer(*buffer);
+  if (!V4L2_TYPE_IS_OUTPUT(b->type) && b->flags & V4L2_BUF_FLAG_LAST) {
+    debug("Capture EOS.");
+    context->bOutputEos = MPP_TRUE;
+    return MPP_CODER_EOS;
+  }
+
+  return MPP_OK;
+}
+
+static U8 *get_stream_data(ALLinlonv5v7EncContext *context, Buffer *buffer) {
+  if (context->eCodingType == CODING_H265 ||
+      context->eCodingType == CODING_VP9)
+    return getUserPtrForHevcAndVp9Encode(buffer, 0);
+
+  return getUserPtr(buffer, 0);
+}
+
 S32 al_enc_get_output_stream(ALBaseContext *ctx, MppData *src_data) {
   if (!ctx) {
     error("input para ALBaseContext is NULL, please check!");
@@ -772,35 +819,107 @@ S32 al_enc_get_output_stream(ALBaseContext *ctx, MppData *src_data) {
   }
 
   ALLinlonv5v7EncContext *context = (ALLinlonv5v7EncContext *)ctx;
-  S32 ret = 0;
-  struct pollfd p = {.fd = context->nVideoFd, .events = POLLIN};
+  Buffer *buffer = NULL;
+  S32 ret = get_stream(context, &buffer);
 
-  ret = runPoll(context->stCodec, &p);
-  if (MPP_OK == ret && p.revents & POLLIN) {
-    Buffer *buffer = dequeueBuffer(getOutputPort(context->stCodec));
-    struct v4l2_buffer *b = getV4l2Buffer(buffer);
-    if (!V4L2_TYPE_IS_OUTPUT(b->type) && b->flags & V4L2_BUF_FLAG_LAST) {
-      debug("Capture EOS.");
-      context->bOutputEos = MPP_TRUE;
-    }
-    // if (buffer == NULL) return MPP_CODER_NO_DATA;
-    if (context->eCodingType == CODING_H265 ||
-        context->eCodingType == CODING_VP9) {
-      memcpy(PACKET_GetDataPointer(PACKET_GetPacket(src_data)),
-             getUserPtrForHevcAndVp9Encode(buffer, 0), b->bytesused);
-    } else {
-      memcpy(PACKET_GetDataPointer(PACKET_GetPacket(src_data)),
-             getUserPtr(buffer, 0), b->bytesused);
-    }
-    PACKET_SetLength(PACKET_GetPacket(src_data), b->bytesused);
-    resetVendorFlags(buffer);
-    queueBuffer(getOutputPort(context->stCodec), buffer);
+  if (!buffer) return ret;
 
-    if (context->bOutputEos) return MPP_CODER_EOS;
-  } else {
-    // usleep(2000);
-    return MPP_CODER_NO_DATA;
+  struct v4l2_buffer *b = getV4l2Buffer(buffer);
+  memcpy(PACKET_GetDataPointer(PACKET_GetPacket(src_data)),
+         get_stream_data(context, buffer), b->bytesused);
+  PACKET_SetLength(PACKET_GetPacket(src_data), b->bytesused);
+  resetVendorFlags(buffer);
+  queueBuffer(getOutputPort(context->stCodec), buffer);
+
+  return ret;
+}
+
+/**
+ * @description: lend the next stream without copy, the data pointer of the
+ * packet points into the mmapped capture buffer, and the buffer is not queued
+ * again until al_enc_return_output_stream. Packets must be returned before
+ * al_enc_destory.
+ */
+S32 al_enc_request_output_stream(ALBaseContext *ctx, MppData *src_data) {
+  if (!ctx) {
+    error("input para ALBaseContext is NULL, please check!");
+    return MPP_NULL_POINTER;
   }
+
+  if (!src_data) {
+    error("input para MppData is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  ALLinlonv5v7EncContext *context = (ALLinlonv5v7EncContext *)ctx;
+  MppPacket *packet = PACKET_GetPacket(src_data);
+  Buffer *buffer = NULL;
+  S32 ret = get_stream(context, &buffer);
+
+  if (!buffer) return ret;
+
+  struct v4l2_buffer *b = getV4l2Buffer(buffer);
+  setIsLent(buffer, MPP_TRUE);
+  context->pOwnedPacketData[b->index] = (U8 *)PACKET_GetDataPointer(packet);
+  PACKET_SetDataPointer(packet, get_stream_data(context, buffer));
+  PACKET_SetLength(packet, b->bytesused);
+
+  return ret;
+}
+
+/**
+ * @description: the lent capture buffer the packet points into, the id of
+ * the packet is the caller's and is not used for it.
+ */
+static Buffer *find_lent_stream(ALLinlonv5v7EncContext *context,
+                                MppPacket *packet) {
+  Port *port = getOutputPort(context->stCodec);
+  U8 *data = (U8 *)PACKET_GetDataPointer(packet);
+  Buffer *buffer = NULL;
+  S32 i;
+
+  for (i = 0; i < getBufNum(port); i++) {
+    buffer = getBuffer(port, i);
+    if (getIsLent(buffer) && get_stream_data(context, buffer) == data)
+      return buffer;
+  }
+
+  return NULL;
+}
+
+S32 al_enc_return_output_stream(ALBaseContext *ctx, MppData *src_data) {
+  if (!ctx) {
+    error("input para ALBaseContext is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  if (!src_data) {
+    error("input para MppData is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  ALLinlonv5v7EncContext *context = (ALLinlonv5v7EncContext *)ctx;
+  Port *port = getOutputPort(context->stCodec);
+  MppPacket *packet = PACKET_GetPacket(src_data);
+  Buffer *buffer = find_lent_stream(context, packet);
+
+  if (!buffer) {
+    error("stream %p is not lent by the encoder, please check!",
+          PACKET_GetDataPointer(packet));
+    return MPP_CHECK_FAILED;
+  }
+
+  S32 index = getV4l2Buffer(buffer)->index;
+  PACKET_SetDataPointer(packet, context->pOwnedPacketData[index]);
+  context->pOwnedPacketData[index] = NULL;
+  setIsLent(buffer, MPP_FALSE);
+
+  resetVendorFlags(buffer);
+  if (queueBuffer(port, buffer)) {
+    error("queue returned stream %d failed, please check!", index);
+    return MPP_IOCTL_FAILED;
+  }
+
   return MPP_OK;
 }
 
@@ -832,6 +951,12 @@ void al_enc_destory(ALBaseContext *ctx) {
     mpp_v4l2_stream_off(context->nVideoFd, &output_type);
     debug("stream off finish");
 
+    Port *port = getOutputPort(context->stCodec);
+    for (S32 i = 0; i < getBufNum(port); i++) {
+      if (getIsLent(getBuffer(port, i)))
+        error("stream %d is still lent, it becomes invalid now!", i);
+    }
+
     destoryCodec(context->stCodec);
     debug("destory codec finish");
 
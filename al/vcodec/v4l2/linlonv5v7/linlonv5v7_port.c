@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-10-07 17:37:14
- * @LastEditTime: 2024-04-09 19:37:11
+ * @LastEditTime: 2024-06-01 11:20:47
  * @Description:
  */
 
@@ -363,6 +363,9 @@ void queueBuffers(Port *port, BOOL eof) {
   S32 ret = 0;
 
   for (S32 i = 0; i < port->nBufNum; i++) {
+    // still used by APP, it is queued when APP returns it
+    if (getIsLent(port->stBuf[i])) continue;
+
     if (!eof) {
       /* Remove vendor custom flags. */
       resetVendorFlags(port->stBuf[i]);
@@ -521,16 +524,22 @@ void printBuffer(Port *port, struct v4l2_buffer buf, const U8 *prefix) {
   }
 }
 
-void streamon(Port *port) {
+S32 streamon(Port *port) {
   struct timeval time;
   gettimeofday(&time, NULL);
   debug("Stream on %ld", time.tv_sec * 1000 + time.tv_usec / 1000);
 
   S32 ret = ioctl(port->nVideoFd, VIDIOC_STREAMON, &(port->eBufType));
   if (ret) {
+    S32 err = errno;
     error("Failed to stream on.  nVideoFd = %d, (%s)", port->nVideoFd,
-          strerror(errno));
+          strerror(err));
+    // keep errno for the caller, it may retry on EINPROGRESS
+    errno = err;
+    return MPP_IOCTL_FAILED;
   }
+
+  return MPP_OK;
 }
 
 void streamoff(Port *port) {
@@ -5,14 +5,19 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-02-01 10:31:08
- * @LastEditTime: 2023-11-09 15:49:42
- * @Description: video decode plugin for V4L2 codec interface
+ * @LastEditTime: 2024-06-02 10:05:33
+ * @Description: video decode plugin for the stateful V4L2 M2M decoder
+ *               interface (vicodec, and the decoders of most SoCs), the
+ *               formats come from MppVdecPara, the frame size from
+ *               V4L2_EVENT_SOURCE_CHANGE.
  */
 
-#define ENABLE_DEBUG 1
+#define ENABLE_DEBUG 0
 
 #include <errno.h>
+#include <fcntl.h>
 #include <linux/videodev2.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,14 +26,30 @@
 #include <unistd.h>
 
 #include "al_interface_dec.h"
+#include "dmabufwrapper.h"
 #include "log.h"
+#include "notify.h"
 #include "v4l2_utils.h"
 
 #define MODULE_TAG "v4l2dec"
 
-#define INPUT_BUF_NUM (2)
-#define OUTPUT_BUF_NUM (3)
-//#define BS_BUF_SIZE (1 << 20)
+/***
+ * buffer counts used when MppVdecPara has 0, the output count is raised to
+ * what the driver asks for by V4L2_CID_MIN_BUFFERS_FOR_CAPTURE.
+ */
+#define V4L2_DEC_INPUT_BUF_NUM (4)
+#define V4L2_DEC_OUTPUT_BUF_NUM (6)
+#define V4L2_DEC_MAX_BUF_NUM (32)
+
+/***
+ * stream buffer size when the frame size is not known yet
+ */
+#define V4L2_DEC_INPUT_BUF_SIZE (1 << 20)
+
+/***
+ * ms to wait for a free stream buffer when bInputBlockModeEnable is set
+ */
+#define V4L2_DEC_POLL_TIMEOUT (100)
 
 CODING_TYPE_MAPPING_DEFINE(V4l2Dec, S32)
 static const ALV4l2DecCodingTypeMapping stALV4l2DecCodingTypeMapping[] = {
@@ -47,35 +68,604 @@ static const ALV4l2DecCodingTypeMapping stALV4l2DecCodingTypeMapping[] = {
 };
 CODING_TYPE_MAPPING_CONVERT(V4l2Dec, v4l2dec, S32)
 
+/***
+ * pixel formats of single-planar and multi-planar capture queues
+ */
+typedef struct _ALV4l2DecPixelFormat {
+  MppPixelFormat ePixelFormat;
+  U32 nFourcc;
+  U32 nFourccM;
+} ALV4l2DecPixelFormat;
+
+static const ALV4l2DecPixelFormat stALV4l2DecPixelFormat[] = {
+    {PIXEL_FORMAT_I420, V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_YUV420M},
+    {PIXEL_FORMAT_YV12, V4L2_PIX_FMT_YVU420, V4L2_PIX_FMT_YVU420M},
+    {PIXEL_FORMAT_NV12, V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_NV12M},
+    {PIXEL_FORMAT_NV21, V4L2_PIX_FMT_NV21, V4L2_PIX_FMT_NV21M},
+};
+
+typedef struct _ALV4l2DecBuffer {
+  struct v4l2_buffer stBuf;
+  struct v4l2_plane stPlanes[VIDEO_MAX_PLANES];
+
+  /***
+   * mapping and size of every plane, nFd is the dmabuf of the plane, our
+   * own one for V4L2_MEMORY_DMABUF, exported by the driver for
+   * V4L2_MEMORY_MMAP, -1 if there is none.
+   */
+  U8 *pUserPtr[VIDEO_MAX_PLANES];
+  S32 nLength[VIDEO_MAX_PLANES];
+  S32 nFd[VIDEO_MAX_PLANES];
+  DmaBufWrapper *pDmaBuf[VIDEO_MAX_PLANES];
+
+  /***
+   * in the driver, or lent to the caller (a frame not returned yet, or a
+   * stream buffer given by al_dec_request_input_stream)
+   */
+  BOOL bQueued;
+  BOOL bLent;
+} ALV4l2DecBuffer;
+
+typedef struct _ALV4l2DecQueue {
+  enum v4l2_buf_type eType;
+  enum v4l2_memory eMemType;
+  struct v4l2_format stFormat;
+  S32 nPlanes;
+  S32 nBufferNum;
+  BOOL bStreaming;
+  ALV4l2DecBuffer stBuffer[V4L2_DEC_MAX_BUF_NUM];
+} ALV4l2DecQueue;
+
 typedef struct _ALV4l2DecContext ALV4l2DecContext;
 
 struct _ALV4l2DecContext {
   ALDecBaseContext stAlDecBaseContext;
+  MppVdecPara *pVdecPara;
   U8 sDevicePath[20];
   S32 nVideoFd;
 
-  // common
-  S32 nMemType;
+  /***
+   * the heap of V4L2_MEMORY_DMABUF buffers, the queues are V4L2_MEMORY_MMAP
+   * when there is no dma heap.
+   */
+  BOOL bDmaBuf;
+  DMAHEAP eHeap;
+
+  // in: stream, V4L2 OUTPUT queue
+  ALV4l2DecQueue stInput;
+
+  // out: frame, V4L2 CAPTURE queue, set up by the first source change
+  ALV4l2DecQueue stOutput;
+  BOOL bOutputReady;
+  S32 nOutputHeldNum;
+
+  /***
+   * visible size of the frames
+   */
   S32 nWidth;
   S32 nHeight;
 
-  // in
-  S32 nInputFormatFourcc;
-  enum v4l2_buf_type eInputBufType;
-  struct v4l2_format stInputFormat;
-  struct v4l2_buffer stInputBufArr[INPUT_BUF_NUM];
-  struct v4l2_plane stInputBufPlanes[INPUT_BUF_NUM][VIDEO_MAX_PLANES];
-  U8 *pInputUserPtr[INPUT_BUF_NUM][8];
-
-  // out
-  S32 nOutputFormatFourcc;
-  enum v4l2_buf_type eOutputBufType;
-  struct v4l2_format stOutputFormat;
-  struct v4l2_buffer stOutputBufArr[OUTPUT_BUF_NUM];
-  struct v4l2_plane stOutputBufPlanes[OUTPUT_BUF_NUM][VIDEO_MAX_PLANES];
-  U8 *pOutputUserPtr[OUTPUT_BUF_NUM][8];
+  /***
+   * bSourceChange: the resolution changes after the frames in the driver,
+   * bOutputLast: a frame with V4L2_BUF_FLAG_LAST came, the next ones come
+   * after a source change, or there are no more.
+   */
+  BOOL bSourceChange;
+  BOOL bOutputLast;
+  BOOL bInputEos;
+
+  /***
+   * the caller's own packet buffer while a stream buffer is lent
+   */
+  U8 *pOwnedPacketData;
 };
 
+static S32 v4l2_ioctl(S32 fd, unsigned long req, void *arg) {
+  S32 ret;
+
+  do {
+    ret = ioctl(fd, req, arg);
+  } while (ret < 0 && errno == EINTR);
+
+  return ret;
+}
+
+static U32 get_frame_fourcc(MppPixelFormat format, BOOL mplane) {
+  for (S32 i = 0; i < NUM_OF(stALV4l2DecPixelFormat); i++) {
+    if (stALV4l2DecPixelFormat[i].ePixelFormat == format)
+      return mplane ? stALV4l2DecPixelFormat[i].nFourccM
+                    : stALV4l2DecPixelFormat[i].nFourcc;
+  }
+
+  return 0;
+}
+
+static MppPixelFormat get_frame_format(U32 fourcc) {
+  for (S32 i = 0; i < NUM_OF(stALV4l2DecPixelFormat); i++) {
+    if (stALV4l2DecPixelFormat[i].nFourcc == fourcc ||
+        stALV4l2DecPixelFormat[i].nFourccM == fourcc)
+      return stALV4l2DecPixelFormat[i].ePixelFormat;
+  }
+
+  return PIXEL_FORMAT_UNKNOWN;
+}
+
+/**
+ * @description: size of plane i of the queue format
+ */
+static S32 get_plane_size(const ALV4l2DecQueue *queue, S32 i) {
+  if (V4L2_TYPE_IS_MULTIPLANAR(queue->eType))
+    return queue->stFormat.fmt.pix_mp.plane_fmt[i].sizeimage;
+
+  return queue->stFormat.fmt.pix.sizeimage;
+}
+
+static void release_buffers(ALV4l2DecContext *context, ALV4l2DecQueue *queue) {
+  struct v4l2_requestbuffers reqbuf;
+
+  for (S32 i = 0; i < queue->nBufferNum; i++) {
+    ALV4l2DecBuffer *buffer = &(queue->stBuffer[i]);
+    for (S32 j = 0; j < queue->nPlanes; j++) {
+      if (buffer->pDmaBuf[j]) {
+        freeDmaBuf(buffer->pDmaBuf[j]);
+        destoryDmaBufWrapper(buffer->pDmaBuf[j]);
+      } else {
+        if (buffer->pUserPtr[j]) munmap(buffer->pUserPtr[j], buffer->nLength[j]);
+        if (buffer->nFd[j] >= 0) close(buffer->nFd[j]);
+      }
+    }
+  }
+  memset(queue->stBuffer, 0, sizeof(queue->stBuffer));
+  queue->nBufferNum = 0;
+
+  memset(&reqbuf, 0, sizeof(reqbuf));
+  reqbuf.type = queue->eType;
+  reqbuf.memory = queue->eMemType;
+  reqbuf.count = 0;
+  v4l2_ioctl(context->nVideoFd, VIDIOC_REQBUFS, &reqbuf);
+}
+
+/**
+ * @description: map (V4L2_MEMORY_MMAP) or allocate from the dma heap
+ * (V4L2_MEMORY_DMABUF) plane j of buffer, frames of MMAP queues get a dmabuf
+ * by VIDIOC_EXPBUF when the caller wants them.
+ */
+static RETURN setup_plane(ALV4l2DecContext *context, ALV4l2DecQueue *queue,
+                          ALV4l2DecBuffer *buffer, S32 j, BOOL export_fd) {
+  BOOL mplane = V4L2_TYPE_IS_MULTIPLANAR(queue->eType);
+  S32 size = 0;
+  U32 offset = 0;
+
+  buffer->nFd[j] = -1;
+
+  if (V4L2_MEMORY_DMABUF == queue->eMemType) {
+    size = get_plane_size(queue, j);
+    buffer->pDmaBuf[j] = createPooledDmaBufWrapper(context->eHeap);
+    if (!buffer->pDmaBuf[j]) return MPP_MALLOC_FAILED;
+    buffer->nFd[j] = allocDmaBuf(buffer->pDmaBuf[j], size);
+    if (buffer->nFd[j] < 0) return MPP_MALLOC_FAILED;
+    buffer->pUserPtr[j] = (U8 *)mmapDmaBuf(buffer->pDmaBuf[j]);
+    if (!buffer->pUserPtr[j]) return MPP_MMAP_FAILED;
+    buffer->nLength[j] = size;
+
+    if (mplane) {
+      buffer->stPlanes[j].m.fd = buffer->nFd[j];
+      buffer->stPlanes[j].length = size;
+    } else {
+      buffer->stBuf.m.fd = buffer->nFd[j];
+      buffer->stBuf.length = size;
+    }
+    return MPP_OK;
+  }
+
+  size = mplane ? buffer->stPlanes[j].length : buffer->stBuf.length;
+  offset = mplane ? buffer->stPlanes[j].m.mem_offset : buffer->stBuf.m.offset;
+  buffer->pUserPtr[j] = (U8 *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED, context->nVideoFd, offset);
+  if (MAP_FAILED == buffer->pUserPtr[j]) {
+    buffer->pUserPtr[j] = NULL;
+    error("mmap buffer failed, please check! (%s)", strerror(errno));
+    return MPP_MMAP_FAILED;
+  }
+  buffer->nLength[j] = size;
+
+  if (export_fd) {
+    struct v4l2_exportbuffer expbuf;
+    memset(&expbuf, 0, sizeof(expbuf));
+    expbuf.type = queue->eType;
+    expbuf.index = buffer->stBuf.index;
+    expbuf.plane = j;
+    expbuf.flags = O_RDWR | O_CLOEXEC;
+    if (!v4l2_ioctl(context->nVideoFd, VIDIOC_EXPBUF, &expbuf))
+      buffer->nFd[j] = expbuf.fd;
+    else
+      error("export buffer %d failed, no fd for it (%s)",
+            buffer->stBuf.index, strerror(errno));
+  }
+
+  return MPP_OK;
+}
+
+/**
+ * @description: request, map and query num buffers of the queue, the queue
+ * format has to be set already.
+ * @return {*}: MPP_OK, or the error code, no buffers are left then
+ */
+static RETURN setup_buffers(ALV4l2DecContext *context, ALV4l2DecQueue *queue,
+                            S32 num, BOOL export_fd) {
+  struct v4l2_requestbuffers reqbuf;
+  RETURN ret = MPP_OK;
+
+  if (num > V4L2_DEC_MAX_BUF_NUM) num = V4L2_DEC_MAX_BUF_NUM;
+
+  memset(&reqbuf, 0, sizeof(reqbuf));
+  reqbuf.type = queue->eType;
+  reqbuf.memory = queue->eMemType;
+  reqbuf.count = num;
+  if (mpp_v4l2_req_buffers(context->nVideoFd, &reqbuf)) {
+    error("request %d buffers failed, please check!", num);
+    return MPP_IOCTL_FAILED;
+  }
+  queue->nBufferNum = reqbuf.count > V4L2_DEC_MAX_BUF_NUM
+                          ? V4L2_DEC_MAX_BUF_NUM
+                          : reqbuf.count;
+  queue->nPlanes = V4L2_TYPE_IS_MULTIPLANAR(queue->eType)
+                       ? queue->stFormat.fmt.pix_mp.num_planes
+                       : 1;
+
+  for (S32 i = 0; i < queue->nBufferNum && !ret; i++) {
+    ALV4l2DecBuffer *buffer = &(queue->stBuffer[i]);
+    buffer->stBuf.type = queue->eType;
+    buffer->stBuf.memory = queue->eMemType;
+    buffer->stBuf.index = i;
+    if (V4L2_TYPE_IS_MULTIPLANAR(queue->eType)) {
+      buffer->stBuf.m.planes = buffer->stPlanes;
+      buffer->stBuf.length = queue->nPlanes;
+    }
+
+    if (mpp_v4l2_query_buffer(context->nVideoFd, &(buffer->stBuf))) {
+      ret = MPP_IOCTL_FAILED;
+      break;
+    }
+
+    for (S32 j = 0; j < queue->nPlanes && !ret; j++)
+      ret = setup_plane(context, queue, buffer, j, export_fd);
+  }
+
+  if (ret) {
+    error("can not set up %d buffers of queue %d, please check!",
+          queue->nBufferNum, queue->eType);
+    release_buffers(context, queue);
+  }
+  debug("queue %d: %d buffers, %d planes, memory %d", queue->eType,
+        queue->nBufferNum, queue->nPlanes, queue->eMemType);
+
+  return ret;
+}
+
+static RETURN queue_buffer(ALV4l2DecContext *context, ALV4l2DecQueue *queue,
+                           S32 index) {
+  ALV4l2DecBuffer *buffer = &(queue->stBuffer[index]);
+
+  if (V4L2_TYPE_IS_MULTIPLANAR(queue->eType)) {
+    buffer->stBuf.m.planes = buffer->stPlanes;
+    buffer->stBuf.length = queue->nPlanes;
+  }
+
+  if (mpp_v4l2_queue_buffer(context->nVideoFd, &(buffer->stBuf))) {
+    error("queue buffer %d of queue %d failed, please check!", index,
+          queue->eType);
+    return MPP_IOCTL_FAILED;
+  }
+  buffer->bQueued = MPP_TRUE;
+
+  return MPP_OK;
+}
+
+/**
+ * @description: take a done buffer out of the driver, without waiting
+ * @return {*}: MPP_OK, MPP_CODER_NO_DATA if there is none, MPP_CODER_EOS
+ * after the last buffer (EPIPE), MPP_IOCTL_FAILED
+ */
+static RETURN dequeue_buffer(ALV4l2DecContext *context, ALV4l2DecQueue *queue,
+                             ALV4l2DecBuffer **out) {
+  struct v4l2_plane planes[VIDEO_MAX_PLANES];
+  struct v4l2_buffer buf;
+  ALV4l2DecBuffer *buffer = NULL;
+
+  memset(&buf, 0, sizeof(buf));
+  memset(planes, 0, sizeof(planes));
+  buf.type = queue->eType;
+  buf.memory = queue->eMemType;
+  if (V4L2_TYPE_IS_MULTIPLANAR(queue->eType)) {
+    buf.m.planes = planes;
+    buf.length = VIDEO_MAX_PLANES;
+  }
+
+  if (v4l2_ioctl(context->nVideoFd, VIDIOC_DQBUF, &buf)) {
+    if (EAGAIN == errno) return MPP_CODER_NO_DATA;
+    if (EPIPE == errno) return MPP_CODER_EOS;
+    error("dequeue buffer of queue %d failed, please check! (%s)",
+          queue->eType, strerror(errno));
+    return MPP_IOCTL_FAILED;
+  }
+
+  if (buf.index >= queue->nBufferNum) {
+    error("dequeue buffer %d out of %d, please check!", buf.index,
+          queue->nBufferNum);
+    return MPP_CHECK_FAILED;
+  }
+
+  buffer = &(queue->stBuffer[buf.index]);
+  buffer->stBuf.bytesused = buf.bytesused;
+  buffer->stBuf.flags = buf.flags;
+  buffer->stBuf.timestamp = buf.timestamp;
+  buffer->stBuf.sequence = buf.sequence;
+  if (V4L2_TYPE_IS_MULTIPLANAR(queue->eType)) {
+    for (S32 j = 0; j < queue->nPlanes; j++) {
+      buffer->stPlanes[j].bytesused = planes[j].bytesused;
+      buffer->stPlanes[j].data_offset = planes[j].data_offset;
+    }
+  }
+  buffer->bQueued = MPP_FALSE;
+  *out = buffer;
+
+  return MPP_OK;
+}
+
+static RETURN stream_on(ALV4l2DecContext *context, ALV4l2DecQueue *queue) {
+  if (mpp_v4l2_stream_on(context->nVideoFd, &(queue->eType))) {
+    error("stream on queue %d failed, please check!", queue->eType);
+    return MPP_IOCTL_FAILED;
+  }
+  queue->bStreaming = MPP_TRUE;
+
+  return MPP_OK;
+}
+
+/**
+ * @description: stream off, all buffers come back from the driver, the ones
+ * lent to the caller stay lent.
+ */
+static void stream_off(ALV4l2DecContext *context, ALV4l2DecQueue *queue) {
+  if (!queue->bStreaming) return;
+
+  mpp_v4l2_stream_off(context->nVideoFd, &(queue->eType));
+  for (S32 i = 0; i < queue->nBufferNum; i++)
+    queue->stBuffer[i].bQueued = MPP_FALSE;
+  queue->bStreaming = MPP_FALSE;
+}
+
+/**
+ * @description: stream buffers the driver has finished with are free again
+ */
+static void reclaim_input(ALV4l2DecContext *context) {
+  ALV4l2DecBuffer *buffer = NULL;
+  S32 free_num = 0;
+
+  while (context->stInput.bStreaming &&
+         !dequeue_buffer(context, &(context->stInput), &buffer))
+    ;
+
+  for (S32 i = 0; i < context->stInput.nBufferNum; i++) {
+    if (!context->stInput.stBuffer[i].bQueued &&
+        !context->stInput.stBuffer[i].bLent)
+      free_num++;
+  }
+  context->pVdecPara->nInputQueueLeftNum = free_num;
+}
+
+static ALV4l2DecBuffer *get_free_input(ALV4l2DecContext *context) {
+  struct pollfd p = {.fd = context->nVideoFd, .events = POLLOUT};
+
+  while (1) {
+    reclaim_input(context);
+    for (S32 i = 0; i < context->stInput.nBufferNum; i++) {
+      ALV4l2DecBuffer *buffer = &(context->stInput.stBuffer[i]);
+      if (!buffer->bQueued && !buffer->bLent) return buffer;
+    }
+
+    if (!context->pVdecPara->bInputBlockModeEnable) return NULL;
+    if (poll(&p, 1, V4L2_DEC_POLL_TIMEOUT) <= 0) return NULL;
+  }
+}
+
+/**
+ * @description: the frame format the driver gives after the source change,
+ * the caller's eOutputPixelFormat if the driver can, its own otherwise.
+ */
+static RETURN set_output_format(ALV4l2DecContext *context) {
+  ALV4l2DecQueue *queue = &(context->stOutput);
+  MppVdecPara *para = context->pVdecPara;
+  BOOL mplane = V4L2_TYPE_IS_MULTIPLANAR(queue->eType);
+  struct v4l2_selection selection;
+  U32 fourcc = 0;
+
+  if (mpp_v4l2_get_format(context->nVideoFd, &(queue->stFormat),
+                          queue->eType)) {
+    error("get frame format failed, please check!");
+    return MPP_IOCTL_FAILED;
+  }
+
+  fourcc = get_frame_fourcc(para->eOutputPixelFormat, mplane);
+  if (fourcc) {
+    struct v4l2_format format = queue->stFormat;
+    if (mplane)
+      format.fmt.pix_mp.pixelformat = fourcc;
+    else
+      format.fmt.pix.pixelformat = fourcc;
+    if (!v4l2_ioctl(context->nVideoFd, VIDIOC_S_FMT, &format))
+      queue->stFormat = format;
+  }
+
+  fourcc = mplane ? queue->stFormat.fmt.pix_mp.pixelformat
+                  : queue->stFormat.fmt.pix.pixelformat;
+  if (PIXEL_FORMAT_UNKNOWN == get_frame_format(fourcc)) {
+    error("the driver gives frames of fourcc 0x%08x, not supported!", fourcc);
+    return MPP_NOT_SUPPORTED_FORMAT;
+  }
+  if (para->eOutputPixelFormat != get_frame_format(fourcc))
+    info("the driver can not give %s, use %s",
+         mpp_pixelformat2str(para->eOutputPixelFormat),
+         mpp_pixelformat2str(get_frame_format(fourcc)));
+  para->eOutputPixelFormat = get_frame_format(fourcc);
+
+  if (mplane) {
+    context->nWidth = queue->stFormat.fmt.pix_mp.width;
+    context->nHeight = queue->stFormat.fmt.pix_mp.height;
+    para->nStride = queue->stFormat.fmt.pix_mp.plane_fmt[0].bytesperline;
+  } else {
+    context->nWidth = queue->stFormat.fmt.pix.width;
+    context->nHeight = queue->stFormat.fmt.pix.height;
+    para->nStride = queue->stFormat.fmt.pix.bytesperline;
+  }
+
+  // the coded size can be aligned, the visible one is the compose rect
+  memset(&selection, 0, sizeof(selection));
+  selection.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  selection.target = V4L2_SEL_TGT_COMPOSE;
+  if (!v4l2_ioctl(context->nVideoFd, VIDIOC_G_SELECTION, &selection) &&
+      selection.r.width && selection.r.height) {
+    context->nWidth = selection.r.width;
+    context->nHeight = selection.r.height;
+  }
+
+  para->nOldWidth = para->nWidth;
+  para->nOldHeight = para->nHeight;
+  para->nWidth = context->nWidth;
+  para->nHeight = context->nHeight;
+
+  return MPP_OK;
+}
+
+/**
+ * @description: set up the frame queue after a source change, the frame
+ * buffers of the old size are released first.
+ */
+static RETURN setup_output(ALV4l2DecContext *context) {
+  ALV4l2DecQueue *queue = &(context->stOutput);
+  MppVdecPara *para = context->pVdecPara;
+  struct v4l2_control ctrl;
+  S32 num = para->nOutputBufferNum;
+  RETURN ret = MPP_OK;
+
+  stream_off(context, queue);
+  if (queue->nBufferNum) release_buffers(context, queue);
+  context->bOutputReady = MPP_FALSE;
+  context->bOutputLast = MPP_FALSE;
+  context->bSourceChange = MPP_FALSE;
+  context->nOutputHeldNum = 0;
+
+  ret = set_output_format(context);
+  if (ret) return ret;
+
+  // keep the frames the caller holds on top of what the decoder needs
+  memset(&ctrl, 0, sizeof(ctrl));
+  ctrl.id = V4L2_CID_MIN_BUFFERS_FOR_CAPTURE;
+  if (!v4l2_ioctl(context->nVideoFd, VIDIOC_G_CTRL, &ctrl) &&
+      ctrl.value + 2 > num)
+    num = ctrl.value + 2;
+
+  ret = setup_buffers(
+      context, queue, num,
+      para->eFrameBufferType == MPP_FRAME_BUFFERTYPE_DMABUF_INTERNAL);
+  if (ret) return ret;
+
+  para->nOutputBufferNum = queue->nBufferNum;
+  for (S32 i = 0; i < queue->nBufferNum; i++) {
+    para->nOutputBufferFd[i] = queue->stBuffer[i].nFd[0];
+    para->bIsBufferInDecoder[i] = MPP_TRUE;
+    ret = queue_buffer(context, queue, i);
+    if (ret) return ret;
+  }
+
+  ret = stream_on(context, queue);
+  if (ret) return ret;
+  context->bOutputReady = MPP_TRUE;
+
+  info("frame queue ready, %dx%d %s, stride %d, %d buffers, memory %d",
+       context->nWidth, context->nHeight,
+       mpp_pixelformat2str(para->eOutputPixelFormat), para->nStride,
+       queue->nBufferNum, queue->eMemType);
+
+  return MPP_OK;
+}
+
+/**
+ * @description: take the pending events, the frame queue is set up at the
+ * first source change, later ones wait for the frames of the old size.
+ */
+static RETURN handle_events(ALV4l2DecContext *context) {
+  struct v4l2_event event;
+  RETURN ret = MPP_OK;
+
+  while (1) {
+    memset(&event, 0, sizeof(event));
+    if (v4l2_ioctl(context->nVideoFd, VIDIOC_DQEVENT, &event)) break;
+
+    debug("event %d, pending %d", event.type, event.pending);
+    if (V4L2_EVENT_SOURCE_CHANGE == event.type &&
+        (event.u.src_change.changes & V4L2_EVENT_SRC_CH_RESOLUTION)) {
+      if (!context->bOutputReady)
+        ret = setup_output(context);
+      else
+        context->bSourceChange = MPP_TRUE;
+    }
+  }
+
+  return ret;
+}
+
+/**
+ * @description: point the frame at the planes of the buffer, single-planar
+ * formats have all planes in plane 0 of the buffer.
+ */
+static void fill_frame(ALV4l2DecContext *context, ALV4l2DecBuffer *buffer,
+                       MppFrame *frame) {
+  ALV4l2DecQueue *queue = &(context->stOutput);
+  MppPixelFormat format = context->pVdecPara->eOutputPixelFormat;
+  S32 stride = context->pVdecPara->nStride;
+  S32 height = V4L2_TYPE_IS_MULTIPLANAR(queue->eType)
+                   ? queue->stFormat.fmt.pix_mp.height
+                   : queue->stFormat.fmt.pix.height;
+  S32 planes = (PIXEL_FORMAT_NV12 == format || PIXEL_FORMAT_NV21 == format)
+                   ? 2
+                   : 3;
+  U8 *data = buffer->pUserPtr[0];
+
+  FRAME_SetDataUsedNum(frame, planes);
+  if (queue->nPlanes >= planes) {
+    for (S32 i = 0; i < planes; i++) {
+      FRAME_SetDataPointer(frame, i, buffer->pUserPtr[i]);
+      if (buffer->nFd[i] >= 0) FRAME_SetFD(frame, buffer->nFd[i], i);
+    }
+  } else {
+    FRAME_SetDataPointer(frame, 0, data);
+    FRAME_SetDataPointer(frame, 1, data + stride * height);
+    if (planes > 2)
+      FRAME_SetDataPointer(frame, 2, data + stride * height * 5 / 4);
+    if (buffer->nFd[0] >= 0) FRAME_SetFD(frame, buffer->nFd[0], 0);
+  }
+
+  FRAME_SetWidth(frame, context->nWidth);
+  FRAME_SetHeight(frame, context->nHeight);
+  FRAME_SetLineStride(frame, stride);
+  FRAME_SetPixelFormat(frame, format);
+  FRAME_SetID(frame, buffer->stBuf.index);
+  FRAME_SetPts(frame, (S64)buffer->stBuf.timestamp.tv_sec * 1000000 +
+                          buffer->stBuf.timestamp.tv_usec);
+}
+
+static void send_stop(ALV4l2DecContext *context) {
+  struct v4l2_decoder_cmd cmd;
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.cmd = V4L2_DEC_CMD_STOP;
+  if (v4l2_ioctl(context->nVideoFd, VIDIOC_DECODER_CMD, &cmd))
+    error("decoder stop failed, the last frames may not come (%s)",
+          strerror(errno));
+}
+
 ALBaseContext *al_dec_create() {
   ALV4l2DecContext *context =
       (ALV4l2DecContext *)malloc(sizeof(ALV4l2DecContext));
@@ -84,10 +674,40 @@ ALBaseContext *al_dec_create() {
           strerror(errno));
     return NULL;
   }
+  memset(context, 0, sizeof(ALV4l2DecContext));
+  context->nVideoFd = -1;
 
   return &(context->stAlDecBaseContext.stAlBaseContext);
 }
 
+/**
+ * @description: pick the memory of the queues, DMABUF ones are allocated
+ * from the dma heap, and are MMAP ones when there is no heap.
+ */
+static void select_memory(ALV4l2DecContext *context, MppVdecPara *para) {
+  DmaBufWrapper *probe = NULL;
+
+  context->bDmaBuf = MPP_FALSE;
+  if (para->eFrameBufferType == MPP_FRAME_BUFFERTYPE_DMABUF_INTERNAL) {
+    context->eHeap = DMA_HEAP_CMA;
+    probe = createDmaBufWrapper(DMA_HEAP_CMA);
+    if (!probe) {
+      context->eHeap = DMA_HEAP_SYSTEM;
+      probe = createDmaBufWrapper(DMA_HEAP_SYSTEM);
+    }
+    if (probe) {
+      context->bDmaBuf = MPP_TRUE;
+      destoryDmaBufWrapper(probe);
+    } else {
+      info("no dma heap, frames are exported from MMAP buffers");
+    }
+  }
+
+  context->stInput.eMemType =
+      context->bDmaBuf ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
+  context->stOutput.eMemType = context->stInput.eMemType;
+}
+
 RETURN al_dec_init(ALBaseContext *ctx, MppVdecPara *para) {
   if (!ctx) {
     error("input para ALBaseContext is NULL, please check!");
@@ -99,216 +719,194 @@ RETURN al_dec_init(ALBaseContext *ctx, MppVdecPara *para) {
     return MPP_NULL_POINTER;
   }
 
+  ALV4l2DecContext *context = (ALV4l2DecContext *)ctx;
+  ALV4l2DecQueue *input = &(context->stInput);
+  struct v4l2_event_subscription sub;
+  struct v4l2_capability vcap;
+  U32 fourcc = get_v4l2dec_codec_coding_type(para->eCodingType);
+  S32 size = V4L2_DEC_INPUT_BUF_SIZE;
+  BOOL mplane = MPP_FALSE;
   S32 ret = 0;
 
-  ALV4l2DecContext *context = (ALV4l2DecContext *)ctx;
+  context->pVdecPara = para;
+  if (!fourcc) {
+    error("%s can not be decoded by V4L2, please check!",
+          mpp_codingtype2str(para->eCodingType));
+    return MPP_NOT_SUPPORTED_FORMAT;
+  }
 
-  context->nVideoFd = find_v4l2_decoder(
-      context->sDevicePath, get_v4l2dec_codec_coding_type(para->eCodingType));
+  context->nVideoFd = find_v4l2_decoder(context->sDevicePath, fourcc);
   if (-1 == context->nVideoFd) {
     error("can not find and open the v4l2 codec device, please check!");
     return MPP_OPEN_FAILED;
   }
+  fcntl(context->nVideoFd, F_SETFL,
+        fcntl(context->nVideoFd, F_GETFL) | O_NONBLOCK);
+  // a frame done while nobody is in the plugin wakes the sys flow up
+  para->nOutputPollFd = context->nVideoFd;
+
+  memset(&vcap, 0, sizeof(vcap));
+  if (!v4l2_ioctl(context->nVideoFd, VIDIOC_QUERYCAP, &vcap)) {
+    U32 caps = (vcap.capabilities & V4L2_CAP_DEVICE_CAPS) ? vcap.device_caps
+                                                          : vcap.capabilities;
+    mplane = !!(caps & (V4L2_CAP_VIDEO_M2M_MPLANE |
+                        V4L2_CAP_VIDEO_OUTPUT_MPLANE));
+  }
+  debug("video fd = %d, device path = '%s', driver '%s', mplane %d",
+        context->nVideoFd, context->sDevicePath, vcap.driver, mplane);
+
+  input->eType =
+      mplane ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE : V4L2_BUF_TYPE_VIDEO_OUTPUT;
+  context->stOutput.eType =
+      mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  select_memory(context, para);
+
+  if (!para->nInputBufferNum) para->nInputBufferNum = V4L2_DEC_INPUT_BUF_NUM;
+  if (!para->nOutputBufferNum)
+    para->nOutputBufferNum = V4L2_DEC_OUTPUT_BUF_NUM;
+  if (para->nWidth > 0 && para->nHeight > 0 &&
+      para->nWidth * para->nHeight * 3 / 2 > size)
+    size = para->nWidth * para->nHeight * 3 / 2;
+
+  // stream format, the size is a hint, the stream header has the real one
+  if (mpp_v4l2_get_format(context->nVideoFd, &(input->stFormat),
+                          input->eType)) {
+    error("get stream format failed, please check!");
+    return MPP_IOCTL_FAILED;
+  }
+  if (mplane) {
+    struct v4l2_pix_format_mplane *pix = &(input->stFormat.fmt.pix_mp);
+    pix->pixelformat = fourcc;
+    pix->width = para->nWidth;
+    pix->height = para->nHeight;
+    pix->num_planes = 1;
+    pix->plane_fmt[0].sizeimage = size;
+    pix->plane_fmt[0].bytesperline = 0;
+    pix->field = V4L2_FIELD_NONE;
+  } else {
+    struct v4l2_pix_format *pix = &(input->stFormat.fmt.pix);
+    pix->pixelformat = fourcc;
+    pix->width = para->nWidth;
+    pix->height = para->nHeight;
+    pix->sizeimage = size;
+    pix->bytesperline = 0;
+    pix->field = V4L2_FIELD_NONE;
+  }
+  if (mpp_v4l2_set_format(context->nVideoFd, &(input->stFormat))) {
+    error("set stream format failed, please check!");
+    return MPP_IOCTL_FAILED;
+  }
 
-  debug("video fd = %d, device path = '%s'", context->nVideoFd,
-        context->sDevicePath);
-
-  context->nMemType = V4L2_MEMORY_MMAP;
-  context->nInputFormatFourcc = V4L2_PIX_FMT_FWHT;
-  context->eInputBufType = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-  // context->nOutputFormatFourcc = V4L2_PIX_FMT_YUV420M;
-  // context->eOutputBufType = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-  context->nOutputFormatFourcc = V4L2_PIX_FMT_YUV420;
-  context->eOutputBufType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  context->nWidth = 1280;
-  context->nHeight = 720;
-
-  // set naul format
-  // mpp_v4l2_set_ctrl(context->nVideoFd, V4L2_CID_MVE_VIDEO_NALU_FORMAT,
-  // V4L2_OPT_NALU_FORMAT_START_CODES);
-
-  // set format
-  {
-    debug("=========== stream format ============");
-    ret = mpp_v4l2_get_format(context->nVideoFd, &(context->stInputFormat),
-                              context->eInputBufType);
-    if (ret) {
-      error("get format failed, please check!");
-      return MPP_IOCTL_FAILED;
-    }
+  memset(&sub, 0, sizeof(sub));
+  sub.type = V4L2_EVENT_SOURCE_CHANGE;
+  if (mpp_v4l2_subscribe_event(context->nVideoFd, &sub)) {
+    error("subscribe source change failed, please check!");
+    return MPP_IOCTL_FAILED;
+  }
 
-    struct v4l2_pix_format *pix_format_tmp = &(context->stInputFormat.fmt.pix);
-    pix_format_tmp->pixelformat = context->nInputFormatFourcc;
-    pix_format_tmp->width = context->nWidth;
-    pix_format_tmp->height = context->nHeight;
-    pix_format_tmp->bytesperline = 0;
-    pix_format_tmp->sizeimage = (1 << 20);
-    pix_format_tmp->field = V4L2_FIELD_NONE;
-    ret = mpp_v4l2_try_format(context->nVideoFd, &(context->stInputFormat));
-    if (ret) {
-      error("try format failed, please check!");
-      return MPP_IOCTL_FAILED;
-    }
+  ret = setup_buffers(context, input, para->nInputBufferNum, MPP_FALSE);
+  if (ret) return ret;
+  para->nInputBufferNum = input->nBufferNum;
+  para->nInputQueueLeftNum = input->nBufferNum;
 
-    context->nWidth = pix_format_tmp->width;
-    context->nHeight = pix_format_tmp->height;
-    debug("After try_format of stream, w = %d, h = %d", context->nWidth,
-          context->nHeight);
-    ret = mpp_v4l2_set_format(context->nVideoFd, &(context->stInputFormat));
-    if (ret) {
-      error("set format failed, please check!");
-      return MPP_IOCTL_FAILED;
-    }
-  }
+  ret = stream_on(context, input);
+  if (ret) return ret;
 
-  {
-    debug("============ frame format ==========");
-    ret = mpp_v4l2_get_format(context->nVideoFd, &(context->stOutputFormat),
-                              context->eOutputBufType);
-    if (ret) {
-      error("get format failed, please check!");
-      return MPP_IOCTL_FAILED;
-    }
+  para->eDataTransmissinMode = MPP_INPUT_SYNC_OUTPUT_ASYNC;
+  for (S32 i = 0; i < V4L2_DEC_MAX_BUF_NUM; i++)
+    para->bIsBufferInDecoder[i] = MPP_TRUE;
 
-    // struct v4l2_pix_format_mplane *pix_format_tmp =
-    // &(context->stOutputFormat.fmt.pix_mp);
-    struct v4l2_pix_format *pix_format_tmp = &(context->stOutputFormat.fmt.pix);
-    pix_format_tmp->pixelformat = context->nOutputFormatFourcc;
-    pix_format_tmp->width = context->nWidth;
-    pix_format_tmp->height = context->nHeight;
-    // tmp->num_planes = 3;
-    pix_format_tmp->field = V4L2_FIELD_NONE;
-    ret = mpp_v4l2_try_format(context->nVideoFd, &(context->stOutputFormat));
-    if (ret) {
-      error("try format failed, please check!");
-      return MPP_IOCTL_FAILED;
-    }
+  info("init finish, %s on '%s' (%s), %d stream buffers of %d bytes, "
+       "memory %d",
+       mpp_codingtype2str(para->eCodingType), context->sDevicePath,
+       vcap.driver, input->nBufferNum, get_plane_size(input, 0),
+       input->eMemType);
 
-    context->nWidth = pix_format_tmp->width;
-    context->nHeight = pix_format_tmp->height;
-    debug("after try_format of frame, w = %d, h = %d", context->nWidth,
-          context->nHeight);
-    ret = mpp_v4l2_set_format(context->nVideoFd, &(context->stOutputFormat));
-    if (ret) {
-      error("set format failed, please check!");
-      return MPP_IOCTL_FAILED;
-    }
+  return MPP_OK;
+}
+
+RETURN al_dec_getparam(ALBaseContext *ctx, MppVdecPara **para) {
+  if (!ctx) {
+    error("input para ALBaseContext is NULL, please check!");
+    return MPP_NULL_POINTER;
   }
 
-  // alloc input buffers
-  struct v4l2_requestbuffers reqbuf_in_tmp;
-  reqbuf_in_tmp.count = INPUT_BUF_NUM;
-  reqbuf_in_tmp.type = context->eInputBufType;
-  reqbuf_in_tmp.memory = context->nMemType;
+  ALV4l2DecContext *context = (ALV4l2DecContext *)ctx;
 
-  ret = mpp_v4l2_req_buffers(context->nVideoFd, &reqbuf_in_tmp);
-  if (ret) {
-    error("request buffers failed, please check!");
-    return MPP_IOCTL_FAILED;
-  }
-  debug("=======> bitstream buffer count : %d", reqbuf_in_tmp.count);
-  for (S32 i = 0; i < reqbuf_in_tmp.count; i++) {
-    context->stInputBufArr[i].type = context->eInputBufType;
-    context->stInputBufArr[i].memory = context->nMemType;
-    // context->stInputBufArr[i].m.planes = context->stInputBufPlanes[i];
-    context->stInputBufArr[i].index = i;
-    // context->stInputBufArr[i].length   = 1024*1024;
-
-    ret =
-        mpp_v4l2_query_buffer(context->nVideoFd, &(context->stInputBufArr[i]));
-    if (ret) {
-      error("query buffer failed, please check!");
-      return MPP_IOCTL_FAILED;
-    }
+  reclaim_input(context);
+  *para = context->pVdecPara;
 
-    if (V4L2_MEMORY_MMAP == context->nMemType) {
-      debug("mmap input buffer! length = %d, offset = %d",
-            context->stInputBufArr[i].length,
-            context->stInputBufArr[i].m.offset);
-      ret = mpp_v4l2_map_memory(context->nVideoFd, &(context->stInputBufArr[i]),
-                                context->pInputUserPtr[i]);
-      if (ret) {
-        error("mmap buffer failed, please check!");
-        return MPP_MMAP_FAILED;
-      }
-    }
+  return MPP_OK;
+}
+
+/**
+ * @description: lend a free stream buffer to the caller, who writes the
+ * packet into it, al_dec_decode queues it without a copy then.
+ * @return {*}: MPP_OK, MPP_CODER_NO_DATA if all are in the driver
+ */
+S32 al_dec_request_input_stream(ALBaseContext *ctx, MppData *sink_data) {
+  if (!ctx || !sink_data) {
+    error("input para is NULL, please check!");
+    return MPP_NULL_POINTER;
   }
 
-  // alloc output buffers
-  struct v4l2_requestbuffers reqbuf_out_tmp;
-  reqbuf_out_tmp.count = OUTPUT_BUF_NUM;
-  reqbuf_out_tmp.type = context->eOutputBufType;
-  reqbuf_out_tmp.memory = context->nMemType;
+  ALV4l2DecContext *context = (ALV4l2DecContext *)ctx;
+  MppPacket *packet = PACKET_GetPacket(sink_data);
+  ALV4l2DecBuffer *buffer = get_free_input(context);
+
+  if (!buffer) return MPP_CODER_NO_DATA;
 
-  ret = mpp_v4l2_req_buffers(context->nVideoFd, &reqbuf_out_tmp);
-  if (ret) {
-    error("request buffers failed, please check!");
-    return MPP_IOCTL_FAILED;
+  if (!context->pOwnedPacketData)
+    context->pOwnedPacketData = (U8 *)PACKET_GetDataPointer(packet);
+  buffer->bLent = MPP_TRUE;
+  PACKET_SetDataPointer(packet, buffer->pUserPtr[0]);
+  PACKET_SetLength(packet, 0);
+  context->pVdecPara->nInputQueueLeftNum--;
+
+  return MPP_OK;
+}
+
+/**
+ * @description: give back a stream buffer lent and not decoded
+ */
+S32 al_dec_return_input_stream(ALBaseContext *ctx, MppData *sink_data) {
+  if (!ctx || !sink_data) {
+    error("input para is NULL, please check!");
+    return MPP_NULL_POINTER;
   }
-  debug("=======> output yuv buffer count : %d", reqbuf_out_tmp.count);
-  for (S32 i = 0; i < reqbuf_out_tmp.count; i++) {
-    context->stOutputBufArr[i].type = context->eOutputBufType;
-    context->stOutputBufArr[i].memory = context->nMemType;
-    // context->stOutputBufArr[i].m.planes = context->stOutputBufPlanes[i];
-    context->stOutputBufArr[i].index = i;
-    // context->stOutputBufArr[i].length   = 1280*720*3;
-
-    ret =
-        mpp_v4l2_query_buffer(context->nVideoFd, &(context->stOutputBufArr[i]));
-    if (ret) {
-      error("query buffer failed, please check!");
-      return MPP_IOCTL_FAILED;
-    }
 
-    if (V4L2_MEMORY_MMAP == context->nMemType) {
-      debug("mmap output buffer! length = %d, offset = %d",
-            context->stInputBufArr[i].length,
-            context->stInputBufArr[i].m.offset);
-      ret =
-          mpp_v4l2_map_memory(context->nVideoFd, &(context->stOutputBufArr[i]),
-                              context->pOutputUserPtr[i]);
-      if (ret) {
-        error("mmap buffer failed, please check!");
-        return MPP_MMAP_FAILED;
-      }
+  ALV4l2DecContext *context = (ALV4l2DecContext *)ctx;
+  MppPacket *packet = PACKET_GetPacket(sink_data);
+  U8 *data = (U8 *)PACKET_GetDataPointer(packet);
+
+  for (S32 i = 0; i < context->stInput.nBufferNum; i++) {
+    ALV4l2DecBuffer *buffer = &(context->stInput.stBuffer[i]);
+    if (buffer->bLent && buffer->pUserPtr[0] == data) {
+      buffer->bLent = MPP_FALSE;
+      PACKET_SetDataPointer(packet, context->pOwnedPacketData);
+      context->pOwnedPacketData = NULL;
+      context->pVdecPara->nInputQueueLeftNum++;
+      return MPP_OK;
     }
   }
 
-  // queue output buffer
-  for (S32 i = 0; i < OUTPUT_BUF_NUM; i++) {
-    // remove vendor custom flags.
-    // context->stOutputBufArr[i].flags &= ~V4L2_BUF_FLAG_MVX_MASK;
+  return MPP_CHECK_FAILED;
+}
 
-    // mask buffer offset
-    if (!V4L2_TYPE_IS_MULTIPLANAR(context->stOutputBufArr[i].type) &&
-        V4L2_MEMORY_MMAP == context->stOutputBufArr[i].memory) {
-      context->stOutputBufArr[i].m.offset &= ~((1 << 12) - 1);
-    }
-    debug("queue all output buffer!");
-    ret =
-        mpp_v4l2_queue_buffer(context->nVideoFd, &(context->stOutputBufArr[i]));
-    if (ret) {
-      error("queue buffer failed, please check!");
-      return MPP_IOCTL_FAILED;
-    }
-  }
+/**
+ * @description: the lent stream buffer holding the packet, NULL if the
+ * packet is in the caller's own memory.
+ */
+static ALV4l2DecBuffer *find_lent_input(ALV4l2DecContext *context,
+                                        MppPacket *packet) {
+  U8 *data = (U8 *)PACKET_GetDataPointer(packet);
 
-  // stream on
-  debug("stream on!");
-  ret = mpp_v4l2_stream_on(context->nVideoFd, &context->eInputBufType);
-  if (ret) {
-    error("stream on input buffer failed, please check!");
-    return MPP_IOCTL_FAILED;
+  for (S32 i = 0; i < context->stInput.nBufferNum; i++) {
+    ALV4l2DecBuffer *buffer = &(context->stInput.stBuffer[i]);
+    if (buffer->bLent && buffer->pUserPtr[0] == data) return buffer;
   }
-  ret = mpp_v4l2_stream_on(context->nVideoFd, &context->eOutputBufType);
-  if (ret) {
-    error("stream on output buffer failed, please check!");
-    return MPP_IOCTL_FAILED;
-  }
-
-  debug("init finish");
 
-  return MPP_OK;
+  return NULL;
 }
 
 S32 al_dec_decode(ALBaseContext *ctx, MppData *sink_data) {
@@ -323,32 +921,71 @@ S32 al_dec_decode(ALBaseContext *ctx, MppData *sink_data) {
   }
 
   ALV4l2DecContext *context = (ALV4l2DecContext *)ctx;
-  MppPacket *sink_packet = PACKET_GetPacket(sink_data);
-  S32 ret = 0;
-  static S32 i = 0;
-
-  if (unlikely(i < INPUT_BUF_NUM)) {
-    memcpy(context->pInputUserPtr[i][0], PACKET_GetDataPointer(sink_packet),
-           PACKET_GetLength(sink_packet));
-    context->stInputBufArr[i].bytesused = PACKET_GetLength(sink_packet);
-    context->stInputBufArr[i].flags |= V4L2_BUF_FLAG_LAST;
-    ret = mpp_v4l2_queue_buffer(context->nVideoFd, &context->stInputBufArr[i]);
-    i++;
+  ALV4l2DecQueue *input = &(context->stInput);
+  MppPacket *packet = PACKET_GetPacket(sink_data);
+  ALV4l2DecBuffer *buffer = NULL;
+  S32 length = PACKET_GetLength(packet);
+  S64 pts = PACKET_GetPts(packet);
+  BOOL eos = PACKET_GetEos(packet);
+  RETURN ret = MPP_OK;
+
+  if (context->bInputEos) {
+    debug("stream already ended, drop the packet");
+    return MPP_OK;
+  }
+
+  ret = handle_events(context);
+  if (ret) return ret;
+
+  buffer = find_lent_input(context, packet);
+  if (buffer && !length) {
+    // nothing written into the lent buffer, it is free again
+    buffer->bLent = MPP_FALSE;
+    PACKET_SetDataPointer(packet, context->pOwnedPacketData);
+    context->pOwnedPacketData = NULL;
+    context->pVdecPara->nInputQueueLeftNum++;
+  } else if (length) {
+    if (!buffer) {
+      buffer = get_free_input(context);
+      if (!buffer) return MPP_POLL_FAILED;
+      if (length > buffer->nLength[0]) {
+        error("packet of %d bytes, the stream buffer has %d, please check!",
+              length, buffer->nLength[0]);
+        return MPP_CHECK_FAILED;
+      }
+      memcpy(buffer->pUserPtr[0], PACKET_GetDataPointer(packet), length);
+    } else {
+      // the packet is in the stream buffer, hand back the caller's memory
+      buffer->bLent = MPP_FALSE;
+      PACKET_SetDataPointer(packet, context->pOwnedPacketData);
+      context->pOwnedPacketData = NULL;
+    }
+
+    if (V4L2_TYPE_IS_MULTIPLANAR(input->eType))
+      buffer->stPlanes[0].bytesused = length;
+    else
+      buffer->stBuf.bytesused = length;
+    buffer->stBuf.flags = 0;
+    buffer->stBuf.timestamp.tv_sec = pts / 1000000;
+    buffer->stBuf.timestamp.tv_usec = pts % 1000000;
+    ret = queue_buffer(context, input, buffer->stBuf.index);
+    if (ret) return ret;
+    context->pVdecPara->nInputQueueLeftNum--;
   } else {
-    struct v4l2_buffer buf_tmp;
-    buf_tmp.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    buf_tmp.memory = V4L2_MEMORY_MMAP;
-    ret = mpp_v4l2_dequeue_buffer(context->nVideoFd, &buf_tmp);
-    memcpy(context->pInputUserPtr[buf_tmp.index][0],
-           PACKET_GetDataPointer(sink_packet), PACKET_GetLength(sink_packet));
-    context->stInputBufArr[buf_tmp.index].bytesused =
-        PACKET_GetLength(sink_packet);
-    context->stInputBufArr[buf_tmp.index].flags |= V4L2_BUF_FLAG_LAST;
-    ret = mpp_v4l2_queue_buffer(context->nVideoFd,
-                                &context->stInputBufArr[buf_tmp.index]);
+    // an empty packet is not the end of the stream, nothing to queue
+    debug("empty packet, pts(%lld)", (long long)pts);
   }
 
-  return 0;
+  if (eos) {
+    debug("EOS is coming, pts(%lld)", (long long)pts);
+    context->bInputEos = MPP_TRUE;
+    send_stop(context);
+  }
+
+  // the driver decodes in the background, look for the frame (or EOS) now
+  mpp_notify_signal(context->pVdecPara->nOutputEventFd);
+
+  return MPP_OK;
 }
 
 RETURN al_dec_request_output_frame(ALBaseContext *ctx, MppData *src_data) {
@@ -363,50 +1000,58 @@ RETURN al_dec_request_output_frame(ALBaseContext *ctx, MppData *src_data) {
   }
 
   ALV4l2DecContext *context = (ALV4l2DecContext *)ctx;
-  S32 ret = 0;
-
-  debug("@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@request output");
-
-  struct v4l2_buffer buf_tmp;
-  // struct v4l2_plane  planes[8];
-  // buf_tmp.m.planes = planes;
-  buf_tmp.type = context->eOutputBufType;
-  buf_tmp.memory = context->nMemType;
-  // buf_tmp.length   = 3;
+  ALV4l2DecBuffer *buffer = NULL;
+  RETURN ret = MPP_OK;
+
+  ret = handle_events(context);
+  if (ret) return ret;
+
+  if (!context->bOutputReady)
+    return context->bInputEos ? MPP_CODER_EOS : MPP_CODER_NO_DATA;
+
+  if (!context->bOutputLast) {
+    ret = dequeue_buffer(context, &(context->stOutput), &buffer);
+    if (MPP_CODER_EOS == ret) {
+      context->bOutputLast = MPP_TRUE;
+    } else if (ret) {
+      return ret;
+    } else {
+      if (buffer->stBuf.flags & V4L2_BUF_FLAG_LAST) {
+        debug("last frame before %s",
+              context->bSourceChange ? "the source change" : "EOS");
+        context->bOutputLast = MPP_TRUE;
+      }
 
-  ret = mpp_v4l2_dequeue_buffer(context->nVideoFd, &buf_tmp);
-  if (ret) {
-    error("dequeue output buffer failed, please check!");
-    return MPP_IOCTL_FAILED;
-  }
+      // the last one can be empty, it only carries the flag
+      if ((V4L2_TYPE_IS_MULTIPLANAR(buffer->stBuf.type)
+               ? buffer->stPlanes[0].bytesused
+               : buffer->stBuf.bytesused) &&
+          !(buffer->stBuf.flags & V4L2_BUF_FLAG_ERROR)) {
+        fill_frame(context, buffer, FRAME_GetFrame(src_data));
+        buffer->bLent = MPP_TRUE;
+        context->nOutputHeldNum++;
+        context->pVdecPara->bIsBufferInDecoder[buffer->stBuf.index] =
+            MPP_FALSE;
+        return MPP_OK;
+      }
 
-  context->stOutputBufArr[buf_tmp.index] = buf_tmp;
-  if (V4L2_TYPE_IS_MULTIPLANAR(buf_tmp.type)) {
-    context->stOutputBufArr[buf_tmp.index].m.planes =
-        context->stOutputBufPlanes[buf_tmp.index];
-    for (size_t i = 0; i < context->stOutputBufArr[buf_tmp.index].length; ++i) {
-      context->stOutputBufArr[buf_tmp.index].m.planes[i] = buf_tmp.m.planes[i];
+      if (!context->bOutputLast)
+        return queue_buffer(context, &(context->stOutput),
+                            buffer->stBuf.index)
+                   ? MPP_IOCTL_FAILED
+                   : MPP_ERROR_FRAME;
     }
   }
 
-  // handle output picture
-  struct v4l2_buffer *p_tmp = &context->stOutputBufArr[buf_tmp.index];
-  // U8 *user_ptr = context->pOutputUserPtr[buf_idx];
-  show_buffer_info(p_tmp);
-  for (S32 i = 0; i < p_tmp->length; ++i) {
-    // struct v4l2_plane *plane = &(p->m.planes);
-
-    // u8 *pl     = user_ptr[i] + plane->data_offset;
-    // S32   len    = plane->bytesused - plane->data_offset;
-    // S32   wr_len = fwrite(pl, 1, len, out_pic);
+  // the event can come after the last frame of the old size
+  handle_events(context);
+  if (context->bSourceChange) {
+    if (context->nOutputHeldNum) return MPP_CODER_NO_DATA;
+    ret = setup_output(context);
+    return ret ? ret : MPP_RESOLUTION_CHANGED;
   }
 
-  FRAME_SetID(FRAME_GetFrame(src_data), buf_tmp.index);
-
-  debug("@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@ request output idx = %d",
-        buf_tmp.index);
-
-  return 0;
+  return context->bInputEos ? MPP_CODER_EOS : MPP_CODER_NO_DATA;
 }
 
 RETURN al_dec_return_output_frame(ALBaseContext *ctx, MppData *src_data) {
@@ -421,31 +1066,123 @@ RETURN al_dec_return_output_frame(ALBaseContext *ctx, MppData *src_data) {
   }
 
   ALV4l2DecContext *context = (ALV4l2DecContext *)ctx;
-  S32 ret = 0;
+  ALV4l2DecQueue *queue = &(context->stOutput);
+  S32 index = FRAME_GetID(FRAME_GetFrame(src_data));
 
-  S32 buf_idx = FRAME_GetID(FRAME_GetFrame(src_data));
-  debug("@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@release output idx = %d", buf_idx);
+  if (index < 0 || index >= queue->nBufferNum ||
+      !queue->stBuffer[index].bLent) {
+    error("frame %d is not lent by the decoder, please check!", index);
+    return MPP_CHECK_FAILED;
+  }
 
-  ret = mpp_v4l2_queue_buffer(context->nVideoFd,
-                              &context->stOutputBufArr[buf_idx]);
-  if (ret) {
-    error("queue output buffer failed, please check!");
-    return MPP_IOCTL_FAILED;
+  queue->stBuffer[index].bLent = MPP_FALSE;
+  context->nOutputHeldNum--;
+  context->pVdecPara->bIsBufferInDecoder[index] = MPP_TRUE;
+
+  // after the last frame the buffers wait for the new size or the end
+  if (context->bOutputLast || !queue->bStreaming) return MPP_OK;
+
+  return queue_buffer(context, queue, index);
+}
+
+/**
+ * @description: drop the queued stream and the decoded frames, the decoder
+ * takes a new stream from a key frame then.
+ */
+S32 al_dec_flush(ALBaseContext *ctx) {
+  if (!ctx) return MPP_NULL_POINTER;
+
+  ALV4l2DecContext *context = (ALV4l2DecContext *)ctx;
+  ALV4l2DecQueue *queue = &(context->stOutput);
+  RETURN ret = MPP_OK;
+
+  debug("flush start");
+
+  stream_off(context, &(context->stInput));
+  ret = stream_on(context, &(context->stInput));
+  if (ret) return ret;
+  context->bInputEos = MPP_FALSE;
+  reclaim_input(context);
+
+  if (context->bOutputReady) {
+    stream_off(context, queue);
+    for (S32 i = 0; i < queue->nBufferNum && !ret; i++) {
+      if (!queue->stBuffer[i].bLent) ret = queue_buffer(context, queue, i);
+    }
+    if (ret) return ret;
+    ret = stream_on(context, queue);
+    context->bOutputLast = MPP_FALSE;
   }
-  debug("@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@release output ret = %d", ret);
 
-  return MPP_OK;
+  debug("flush finish, ret = %d", ret);
+
+  return ret;
 }
 
+S32 al_dec_reset(ALBaseContext *ctx) { return al_dec_flush(ctx); }
+
 void al_dec_destory(ALBaseContext *ctx) {
   if (!ctx) return;
 
   ALV4l2DecContext *context = (ALV4l2DecContext *)ctx;
 
-  mpp_v4l2_stream_off(context->nVideoFd, &context->eInputBufType);
-  mpp_v4l2_stream_off(context->nVideoFd, &context->eOutputBufType);
+  if (context->nVideoFd >= 0) {
+    stream_off(context, &(context->stInput));
+    stream_off(context, &(context->stOutput));
+    release_buffers(context, &(context->stInput));
+    release_buffers(context, &(context->stOutput));
+    close(context->nVideoFd);
+  }
 
-  close(context->nVideoFd);
   free(context);
   context = NULL;
 }
+
+/**
+ * descriptor of the whole v4l2_standard_codec library, v4l2enc.c is in it
+ * too. It is what the plugin can map, the device found at init may do less
+ * and it tells the size.
+ */
+static const MppCodingType stV4l2CodingTypes[] = {
+    CODING_H264,  CODING_H265,  CODING_MJPEG, CODING_VP8,   CODING_VP9,
+    CODING_MPEG1, CODING_MPEG2, CODING_MPEG4, CODING_FWHT,
+};
+
+static const MppPixelFormat stV4l2PixelFormats[] = {
+    PIXEL_FORMAT_I420,
+    PIXEL_FORMAT_YV12,
+    PIXEL_FORMAT_NV12,
+    PIXEL_FORMAT_NV21,
+};
+
+static const ALPluginCaps stV4l2Caps = {
+    .nVersion = AL_PLUGIN_CAPS_VERSION,
+    .eModuleType = CODEC_V4L2,
+    .pDecoderCodingTypes = stV4l2CodingTypes,
+    .nDecoderCodingTypeNum = NUM_OF(stV4l2CodingTypes),
+    .pEncoderCodingTypes = stV4l2CodingTypes,
+    .nEncoderCodingTypeNum = NUM_OF(stV4l2CodingTypes),
+    .pPixelFormats = stV4l2PixelFormats,
+    .nPixelFormatNum = NUM_OF(stV4l2PixelFormats),
+    .nMaxWidth = 0,
+    .nMaxHeight = 0,
+    .nMemoryModes =
+        AL_PLUGIN_MEMORY_MODE(MPP_FRAME_BUFFERTYPE_NORMAL_INTERNAL) |
+        AL_PLUGIN_MEMORY_MODE(MPP_FRAME_BUFFERTYPE_DMABUF_INTERNAL) |
+        AL_PLUGIN_MEMORY_MODE(MPP_FRAME_BUFFERTYPE_DMABUF_EXTERNAL),
+    .nMaxInstances = 0,
+    .nCost = 10,
+};
+
+const ALPluginCaps *al_plugin_get_caps() { return &stV4l2Caps; }
+
+/**
+ * @description: a device of any driver, v4l2enc.c maps the stream formats
+ * the same.
+ */
+BOOL al_plugin_probe(MppCodingType coding_type, BOOL encoder) {
+  S32 fourcc = get_v4l2dec_codec_coding_type(coding_type);
+
+  return encoder ? has_v4l2_encoder(NULL, fourcc)
+                 : has_v4l2_decoder(NULL, fourcc);
+}
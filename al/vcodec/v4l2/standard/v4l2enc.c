@@ -5,13 +5,17 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-02-01 10:43:49
- * @LastEditTime: 2023-11-09 15:53:56
- * @Description: video encode plugin for V4L2 codec standard interface
+ * @LastEditTime: 2024-06-02 11:36:12
+ * @Description: video encode plugin for the stateful V4L2 M2M encoder
+ *               interface (vicodec, and the encoders of most SoCs), frames
+ *               with dmabuf fds are imported by V4L2_MEMORY_DMABUF, others
+ *               are copied into MMAP buffers.
  */
 
-#define ENABLE_DEBUG 1
+#define ENABLE_DEBUG 0
 
 #include <errno.h>
+#include <fcntl.h>
 #include <linux/videodev2.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,13 +26,22 @@
 
 #include "al_interface_enc.h"
 #include "log.h"
+#include "notify.h"
 #include "v4l2_utils.h"
 
 #define MODULE_TAG "v4l2enc"
 
-#define INPUT_BUF_NUM (3)
-#define OUTPUT_BUF_NUM (3)
-#define BS_BUF_SIZE (1 << 20)
+/***
+ * queue depths used when MppVencPara has 0
+ */
+#define V4L2_ENC_INPUT_BUF_NUM (4)
+#define V4L2_ENC_OUTPUT_BUF_NUM (4)
+#define V4L2_ENC_MAX_BUF_NUM (32)
+
+/***
+ * min size of a stream buffer, drivers can make it larger
+ */
+#define V4L2_ENC_OUTPUT_BUF_SIZE (1 << 20)
 
 CODING_TYPE_MAPPING_DEFINE(V4l2Enc, S32)
 static const ALV4l2EncCodingTypeMapping stALV4l2EncCodingTypeMapping[] = {
@@ -47,276 +60,814 @@ static const ALV4l2EncCodingTypeMapping stALV4l2EncCodingTypeMapping[] = {
 };
 CODING_TYPE_MAPPING_CONVERT(V4l2Enc, v4l2enc, S32)
 
+/***
+ * pixel formats of single-planar and multi-planar frame queues
+ */
+typedef struct _ALV4l2EncPixelFormat {
+  MppPixelFormat ePixelFormat;
+  U32 nFourcc;
+  U32 nFourccM;
+} ALV4l2EncPixelFormat;
+
+static const ALV4l2EncPixelFormat stALV4l2EncPixelFormat[] = {
+    {PIXEL_FORMAT_I420, V4L2_PIX_FMT_YUV420, V4L2_PIX_FMT_YUV420M},
+    {PIXEL_FORMAT_YV12, V4L2_PIX_FMT_YVU420, V4L2_PIX_FMT_YVU420M},
+    {PIXEL_FORMAT_NV12, V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_NV12M},
+    {PIXEL_FORMAT_NV21, V4L2_PIX_FMT_NV21, V4L2_PIX_FMT_NV21M},
+};
+
+typedef struct _ALV4l2EncBuffer {
+  struct v4l2_buffer stBuf;
+  struct v4l2_plane stPlanes[VIDEO_MAX_PLANES];
+
+  /***
+   * mapping of every plane of MMAP buffers
+   */
+  U8 *pUserPtr[VIDEO_MAX_PLANES];
+  S32 nLength[VIDEO_MAX_PLANES];
+
+  /***
+   * frame buffers: the frame in it and the fd imported last, the driver
+   * keeps the import of an index, so the same fd goes to the same index.
+   * stream buffers: the caller's own packet data and where the packet
+   * points into the buffer while it is lent.
+   */
+  S32 nFrameId;
+  S32 nImportedFd;
+  U8 *pOwnedPacketData;
+  U8 *pLentData;
+
+  BOOL bQueued;
+  BOOL bLent;
+} ALV4l2EncBuffer;
+
+typedef struct _ALV4l2EncQueue {
+  enum v4l2_buf_type eType;
+  enum v4l2_memory eMemType;
+  struct v4l2_format stFormat;
+  S32 nPlanes;
+  S32 nBufferNum;
+  BOOL bStreaming;
+  ALV4l2EncBuffer stBuffer[V4L2_ENC_MAX_BUF_NUM];
+} ALV4l2EncQueue;
+
 typedef struct _ALV4l2EncContext ALV4l2EncContext;
 
 struct _ALV4l2EncContext {
   ALEncBaseContext stAlEncBaseContext;
+  MppVencPara *pVencPara;
   U8 sDevicePath[20];
   S32 nVideoFd;
 
-  // common
-  S32 nMemType;
+  MppPixelFormat ePixelFormat;
   S32 nWidth;
   S32 nHeight;
 
-  // in
-  S32 nInputFormatFourcc;
-  enum v4l2_buf_type eInputBufType;
-  struct v4l2_format stInputFormat;
-  struct v4l2_buffer stInputBufArr[INPUT_BUF_NUM];
-  struct v4l2_plane stInputBufPlanes[INPUT_BUF_NUM][VIDEO_MAX_PLANES];
-  U8 *pInputUserPtr[INPUT_BUF_NUM][8];
-
-  // out
-  S32 nOutputFormatFourcc;
-  enum v4l2_buf_type eOutputBufType;
-  struct v4l2_format stOutputFormat;
-  struct v4l2_buffer stOutputBufArr[OUTPUT_BUF_NUM];
-  struct v4l2_plane stOutputBufPlanes[OUTPUT_BUF_NUM][VIDEO_MAX_PLANES];
-  U8 *pOutputUserPtr[OUTPUT_BUF_NUM][8];
+  // in: frame, V4L2 OUTPUT queue
+  ALV4l2EncQueue stInput;
+
+  /***
+   * ids of the frames the driver is done with, in order, taken by
+   * al_enc_return_input_frame
+   */
+  S32 nDoneId[V4L2_ENC_MAX_BUF_NUM];
+  S32 nDoneHead;
+  S32 nDoneNum;
+
+  // out: stream, V4L2 CAPTURE queue
+  ALV4l2EncQueue stOutput;
+
+  BOOL bInputEos;
+  BOOL bOutputEos;
 };
 
-ALBaseContext *al_enc_create() {
-  ALV4l2EncContext *context =
-      (ALV4l2EncContext *)malloc(sizeof(ALV4l2EncContext));
-  if (!context) {
-    error("can not malloc ALV4l2EncContext, please check! (%s)",
-          strerror(errno));
-    return NULL;
-  }
+static S32 v4l2_ioctl(S32 fd, unsigned long req, void *arg) {
+  S32 ret;
 
-  return &(context->stAlEncBaseContext.stAlBaseContext);
+  do {
+    ret = ioctl(fd, req, arg);
+  } while (ret < 0 && errno == EINTR);
+
+  return ret;
 }
 
-RETURN al_enc_init(ALBaseContext *ctx, MppVencPara *para) {
-  if (!ctx) {
-    error("input para ALBaseContext is NULL, please check!");
-    return MPP_NULL_POINTER;
+static U32 get_frame_fourcc(MppPixelFormat format, BOOL mplane) {
+  for (S32 i = 0; i < NUM_OF(stALV4l2EncPixelFormat); i++) {
+    if (stALV4l2EncPixelFormat[i].ePixelFormat == format)
+      return mplane ? stALV4l2EncPixelFormat[i].nFourccM
+                    : stALV4l2EncPixelFormat[i].nFourcc;
   }
 
-  if (!para) {
-    error("input para MppVencData is NULL, please check!");
-    return MPP_NULL_POINTER;
-  }
+  return 0;
+}
 
-  S32 ret = 0;
+static BOOL is_semi_planar(MppPixelFormat format) {
+  return PIXEL_FORMAT_NV12 == format || PIXEL_FORMAT_NV21 == format;
+}
 
-  ALV4l2EncContext *context = (ALV4l2EncContext *)ctx;
+/**
+ * @description: components of the frame format, Y U V or Y UV
+ */
+static S32 get_component_num(MppPixelFormat format) {
+  return is_semi_planar(format) ? 2 : 3;
+}
 
-  context->nVideoFd = find_v4l2_encoder(
-      context->sDevicePath,
-      V4L2_PIX_FMT_FWHT /*get_v4l2enc_coding_type(para->eCodingType)*/);
+/**
+ * @description: line stride and lines of component i, from the luma stride
+ */
+static void get_component_size(MppPixelFormat format, S32 i, S32 stride,
+                               S32 height, S32 *line, S32 *lines) {
+  *line = (!i || is_semi_planar(format)) ? stride : stride / 2;
+  *lines = i ? height / 2 : height;
+}
 
-  if (-1 == context->nVideoFd) {
-    error("can not find the v4l2 codec device, please check!");
-    return MPP_OPEN_FAILED;
-  }
+static S32 get_bytesperline(const ALV4l2EncQueue *queue, S32 i) {
+  if (V4L2_TYPE_IS_MULTIPLANAR(queue->eType))
+    return queue->stFormat.fmt.pix_mp.plane_fmt[i].bytesperline;
 
-  debug("video fd = %d, device path = '%s'", context->nVideoFd,
-        context->sDevicePath);
+  return queue->stFormat.fmt.pix.bytesperline;
+}
 
-  context->nMemType = V4L2_MEMORY_MMAP;
+static S32 get_sizeimage(const ALV4l2EncQueue *queue, S32 i) {
+  if (V4L2_TYPE_IS_MULTIPLANAR(queue->eType))
+    return queue->stFormat.fmt.pix_mp.plane_fmt[i].sizeimage;
 
-  context->nInputFormatFourcc = V4L2_PIX_FMT_YUV420;
-  context->eInputBufType = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-  // context->nOutputFormatFourcc = V4L2_PIX_FMT_YUV420M;
-  // context->eOutputBufType = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-  context->nOutputFormatFourcc = V4L2_PIX_FMT_FWHT;
-  context->eOutputBufType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  context->nWidth = 1280;
-  context->nHeight = 720;
+  return queue->stFormat.fmt.pix.sizeimage;
+}
 
-  // set naul format
-  // mpp_v4l2_set_ctrl(context->nVideoFd, V4L2_CID_MVE_VIDEO_NALU_FORMAT,
-  // V4L2_OPT_NALU_FORMAT_START_CODES);
+/**
+ * @description: set a codec control, not every driver has every one, so a
+ * failure is not an error.
+ */
+static void set_ctrl(ALV4l2EncContext *context, U32 id, S32 value,
+                     const char *name) {
+  struct v4l2_control ctrl;
+
+  memset(&ctrl, 0, sizeof(ctrl));
+  ctrl.id = id;
+  ctrl.value = value;
+  if (v4l2_ioctl(context->nVideoFd, VIDIOC_S_CTRL, &ctrl))
+    debug("%s = %d not supported by the driver (%s)", name, value,
+          strerror(errno));
+  else
+    debug("%s = %d", name, value);
+}
 
-  // set format
-  {
-    debug("=========== frame format ============");
-    ret = mpp_v4l2_get_format(context->nVideoFd, &(context->stInputFormat),
-                              context->eInputBufType);
-    if (ret) {
-      error("get format failed, please check!");
-      return MPP_IOCTL_FAILED;
+/**
+ * @description: rate control, GOP and frame rate from MppVencPara, 0 keeps
+ * the driver default.
+ */
+static void set_controls(ALV4l2EncContext *context, MppVencPara *para) {
+  struct v4l2_streamparm parm;
+
+  if (para->nGop > 0)
+    set_ctrl(context, V4L2_CID_MPEG_VIDEO_GOP_SIZE, para->nGop, "gop");
+  if (para->nMaxBFrames > 0)
+    set_ctrl(context, V4L2_CID_MPEG_VIDEO_B_FRAMES, para->nMaxBFrames,
+             "b frames");
+
+  switch (para->eRcMode) {
+    case MPP_RC_MODE_CBR:
+      set_ctrl(context, V4L2_CID_MPEG_VIDEO_BITRATE_MODE,
+               V4L2_MPEG_VIDEO_BITRATE_MODE_CBR, "bitrate mode");
+      break;
+    case MPP_RC_MODE_CQP:
+    case MPP_RC_MODE_CRF:
+      set_ctrl(context, V4L2_CID_MPEG_VIDEO_FRAME_RC_ENABLE, 0, "frame rc");
+      break;
+    case MPP_RC_MODE_VBR:
+    default:
+      if (para->nBitrate > 0)
+        set_ctrl(context, V4L2_CID_MPEG_VIDEO_BITRATE_MODE,
+                 V4L2_MPEG_VIDEO_BITRATE_MODE_VBR, "bitrate mode");
+      break;
+  }
+  if (para->nBitrate > 0)
+    set_ctrl(context, V4L2_CID_MPEG_VIDEO_BITRATE, para->nBitrate, "bitrate");
+
+  if (para->nQp > 0) {
+    switch (para->eCodingType) {
+      case CODING_H264:
+        set_ctrl(context, V4L2_CID_MPEG_VIDEO_H264_I_FRAME_QP, para->nQp,
+                 "i qp");
+        set_ctrl(context, V4L2_CID_MPEG_VIDEO_H264_P_FRAME_QP, para->nQp,
+                 "p qp");
+        break;
+      case CODING_H265:
+        set_ctrl(context, V4L2_CID_MPEG_VIDEO_HEVC_I_FRAME_QP, para->nQp,
+                 "i qp");
+        set_ctrl(context, V4L2_CID_MPEG_VIDEO_HEVC_P_FRAME_QP, para->nQp,
+                 "p qp");
+        break;
+      case CODING_FWHT:
+        set_ctrl(context, V4L2_CID_FWHT_I_FRAME_QP, para->nQp, "i qp");
+        set_ctrl(context, V4L2_CID_FWHT_P_FRAME_QP, para->nQp, "p qp");
+        break;
+      default:
+        break;
     }
+  }
 
-    struct v4l2_pix_format *pix_format_tmp = &(context->stInputFormat.fmt.pix);
-    pix_format_tmp->pixelformat = context->nInputFormatFourcc;
-    pix_format_tmp->width = context->nWidth;
-    pix_format_tmp->height = context->nHeight;
-    pix_format_tmp->bytesperline = 0;
-    pix_format_tmp->sizeimage = (1 << 20);
-    pix_format_tmp->field = V4L2_FIELD_NONE;
-    ret = mpp_v4l2_try_format(context->nVideoFd, &(context->stInputFormat));
-    if (ret) {
-      error("try format failed, please check!");
-      return MPP_IOCTL_FAILED;
-    }
+  if (para->nFrameRate > 0) {
+    memset(&parm, 0, sizeof(parm));
+    parm.type = context->stInput.eType;
+    parm.parm.output.timeperframe.numerator = 1;
+    parm.parm.output.timeperframe.denominator = para->nFrameRate;
+    if (v4l2_ioctl(context->nVideoFd, VIDIOC_S_PARM, &parm))
+      debug("frame rate %d not supported by the driver", para->nFrameRate);
+  }
+}
 
-    context->nWidth = pix_format_tmp->width;
-    context->nHeight = pix_format_tmp->height;
-    debug("after try_format of frame, w = %d, h = %d", context->nWidth,
-          context->nHeight);
-    ret = mpp_v4l2_set_format(context->nVideoFd, &(context->stInputFormat));
-    if (ret) {
-      error("set format failed, please check!");
-      return MPP_IOCTL_FAILED;
+static void release_buffers(ALV4l2EncContext *context, ALV4l2EncQueue *queue) {
+  struct v4l2_requestbuffers reqbuf;
+
+  for (S32 i = 0; i < queue->nBufferNum; i++) {
+    for (S32 j = 0; j < queue->nPlanes; j++) {
+      if (queue->stBuffer[i].pUserPtr[j])
+        munmap(queue->stBuffer[i].pUserPtr[j], queue->stBuffer[i].nLength[j]);
     }
   }
+  memset(queue->stBuffer, 0, sizeof(queue->stBuffer));
+  queue->nBufferNum = 0;
+
+  memset(&reqbuf, 0, sizeof(reqbuf));
+  reqbuf.type = queue->eType;
+  reqbuf.memory = queue->eMemType;
+  reqbuf.count = 0;
+  v4l2_ioctl(context->nVideoFd, VIDIOC_REQBUFS, &reqbuf);
+}
 
-  {
-    debug("============ stream format ==========");
-    ret = mpp_v4l2_get_format(context->nVideoFd, &(context->stOutputFormat),
-                              context->eOutputBufType);
-    if (ret) {
-      error("get format failed, please check!");
-      return MPP_IOCTL_FAILED;
+/**
+ * @description: request num buffers of the queue and map the MMAP ones, the
+ * queue format has to be set already.
+ * @return {*}: MPP_OK, or the error code, no buffers are left then
+ */
+static RETURN setup_buffers(ALV4l2EncContext *context, ALV4l2EncQueue *queue,
+                            S32 num) {
+  BOOL mplane = V4L2_TYPE_IS_MULTIPLANAR(queue->eType);
+  struct v4l2_requestbuffers reqbuf;
+
+  if (num > V4L2_ENC_MAX_BUF_NUM) num = V4L2_ENC_MAX_BUF_NUM;
+
+  memset(&reqbuf, 0, sizeof(reqbuf));
+  reqbuf.type = queue->eType;
+  reqbuf.memory = queue->eMemType;
+  reqbuf.count = num;
+  if (mpp_v4l2_req_buffers(context->nVideoFd, &reqbuf)) {
+    error("request %d buffers failed, please check!", num);
+    return MPP_IOCTL_FAILED;
+  }
+  queue->nBufferNum = reqbuf.count > V4L2_ENC_MAX_BUF_NUM
+                          ? V4L2_ENC_MAX_BUF_NUM
+                          : reqbuf.count;
+  queue->nPlanes = mplane ? queue->stFormat.fmt.pix_mp.num_planes : 1;
+
+  for (S32 i = 0; i < queue->nBufferNum; i++) {
+    ALV4l2EncBuffer *buffer = &(queue->stBuffer[i]);
+    buffer->stBuf.type = queue->eType;
+    buffer->stBuf.memory = queue->eMemType;
+    buffer->stBuf.index = i;
+    buffer->nImportedFd = -1;
+    if (mplane) {
+      buffer->stBuf.m.planes = buffer->stPlanes;
+      buffer->stBuf.length = queue->nPlanes;
     }
 
-    // struct v4l2_pix_format_mplane *pix_format_tmp =
-    // &(context->stOutputFormat.fmt.pix_mp);
-    struct v4l2_pix_format *pix_format_tmp = &(context->stOutputFormat.fmt.pix);
-    pix_format_tmp->pixelformat = context->nOutputFormatFourcc;
-    pix_format_tmp->width = context->nWidth;
-    pix_format_tmp->height = context->nHeight;
-
-    // pix_format_tmp->num_planes  = 3;
-    pix_format_tmp->field = V4L2_FIELD_NONE;
-    ret = mpp_v4l2_try_format(context->nVideoFd, &(context->stOutputFormat));
-    if (ret) {
-      error("try format failed, please check!");
+    if (mpp_v4l2_query_buffer(context->nVideoFd, &(buffer->stBuf))) {
+      release_buffers(context, queue);
       return MPP_IOCTL_FAILED;
     }
-
-    context->nWidth = pix_format_tmp->width;
-    context->nHeight = pix_format_tmp->height;
-    debug("after try_format of stream, w = %d, h = %d", context->nWidth,
-          context->nHeight);
-    ret = mpp_v4l2_set_format(context->nVideoFd, &(context->stOutputFormat));
-    if (ret) {
-      error("set format failed, please check!");
-      return MPP_IOCTL_FAILED;
+    if (V4L2_MEMORY_MMAP != queue->eMemType) continue;
+
+    for (S32 j = 0; j < queue->nPlanes; j++) {
+      S32 size = mplane ? buffer->stPlanes[j].length : buffer->stBuf.length;
+      U32 offset =
+          mplane ? buffer->stPlanes[j].m.mem_offset : buffer->stBuf.m.offset;
+      buffer->pUserPtr[j] = (U8 *)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                       MAP_SHARED, context->nVideoFd, offset);
+      if (MAP_FAILED == buffer->pUserPtr[j]) {
+        buffer->pUserPtr[j] = NULL;
+        error("mmap buffer failed, please check! (%s)", strerror(errno));
+        release_buffers(context, queue);
+        return MPP_MMAP_FAILED;
+      }
+      buffer->nLength[j] = size;
     }
   }
+  debug("queue %d: %d buffers, %d planes, memory %d", queue->eType,
+        queue->nBufferNum, queue->nPlanes, queue->eMemType);
+
+  return MPP_OK;
+}
+
+static RETURN queue_buffer(ALV4l2EncContext *context, ALV4l2EncQueue *queue,
+                           S32 index) {
+  ALV4l2EncBuffer *buffer = &(queue->stBuffer[index]);
+
+  if (V4L2_TYPE_IS_MULTIPLANAR(queue->eType)) {
+    buffer->stBuf.m.planes = buffer->stPlanes;
+    buffer->stBuf.length = queue->nPlanes;
+  }
 
-  // alloc input buffers
-  struct v4l2_requestbuffers reqbuf_in_tmp;
-  reqbuf_in_tmp.count = INPUT_BUF_NUM;
-  reqbuf_in_tmp.type = context->eInputBufType;
-  reqbuf_in_tmp.memory = context->nMemType;
+  if (mpp_v4l2_queue_buffer(context->nVideoFd, &(buffer->stBuf))) {
+    error("queue buffer %d of queue %d failed, please check!", index,
+          queue->eType);
+    return MPP_IOCTL_FAILED;
+  }
+  buffer->bQueued = MPP_TRUE;
+
+  return MPP_OK;
+}
+
+/**
+ * @description: take a done buffer out of the driver, without waiting
+ * @return {*}: MPP_OK, MPP_CODER_NO_DATA if there is none, MPP_CODER_EOS
+ * after the last buffer (EPIPE), MPP_IOCTL_FAILED
+ */
+static RETURN dequeue_buffer(ALV4l2EncContext *context, ALV4l2EncQueue *queue,
+                             ALV4l2EncBuffer **out) {
+  struct v4l2_plane planes[VIDEO_MAX_PLANES];
+  struct v4l2_buffer buf;
+  ALV4l2EncBuffer *buffer = NULL;
+
+  memset(&buf, 0, sizeof(buf));
+  memset(planes, 0, sizeof(planes));
+  buf.type = queue->eType;
+  buf.memory = queue->eMemType;
+  if (V4L2_TYPE_IS_MULTIPLANAR(queue->eType)) {
+    buf.m.planes = planes;
+    buf.length = VIDEO_MAX_PLANES;
+  }
 
-  ret = mpp_v4l2_req_buffers(context->nVideoFd, &reqbuf_in_tmp);
-  if (ret) {
-    error("request buffers failed, please check!");
+  if (v4l2_ioctl(context->nVideoFd, VIDIOC_DQBUF, &buf)) {
+    if (EAGAIN == errno) return MPP_CODER_NO_DATA;
+    if (EPIPE == errno) return MPP_CODER_EOS;
+    error("dequeue buffer of queue %d failed, please check! (%s)",
+          queue->eType, strerror(errno));
     return MPP_IOCTL_FAILED;
   }
-  debug("=======> bitstream buffer count : %d", reqbuf_in_tmp.count);
-  for (S32 i = 0; i < reqbuf_in_tmp.count; i++) {
-    context->stInputBufArr[i].type = context->eInputBufType;
-    context->stInputBufArr[i].memory = context->nMemType;
-    // context->stInputBufArr[i].m.planes = context->stInputBufPlanes[i];
-    context->stInputBufArr[i].index = i;
-    // context->stInputBufArr[i].length   = 1024*1024;
-
-    ret =
-        mpp_v4l2_query_buffer(context->nVideoFd, &(context->stInputBufArr[i]));
-    if (ret) {
-      error("query buffer failed, please check!");
-      return MPP_IOCTL_FAILED;
-    }
 
-    if (V4L2_MEMORY_MMAP == context->nMemType) {
-      debug("mmap input buffer! length = %d, offset = %d",
-            context->stInputBufArr[i].length,
-            context->stInputBufArr[i].m.offset);
-      ret = mpp_v4l2_map_memory(context->nVideoFd, &(context->stInputBufArr[i]),
-                                context->pInputUserPtr[i]);
-      if (ret) {
-        error("mmap buffer failed, please check!");
-        return MPP_MMAP_FAILED;
-      }
+  if (buf.index >= queue->nBufferNum) {
+    error("dequeue buffer %d out of %d, please check!", buf.index,
+          queue->nBufferNum);
+    return MPP_CHECK_FAILED;
+  }
+
+  buffer = &(queue->stBuffer[buf.index]);
+  buffer->stBuf.bytesused = buf.bytesused;
+  buffer->stBuf.flags = buf.flags;
+  buffer->stBuf.timestamp = buf.timestamp;
+  if (V4L2_TYPE_IS_MULTIPLANAR(queue->eType)) {
+    for (S32 j = 0; j < queue->nPlanes; j++) {
+      buffer->stPlanes[j].bytesused = planes[j].bytesused;
+      buffer->stPlanes[j].data_offset = planes[j].data_offset;
     }
   }
+  buffer->bQueued = MPP_FALSE;
+  *out = buffer;
 
-  struct v4l2_requestbuffers reqbuf_out_tmp;
-  reqbuf_out_tmp.count = OUTPUT_BUF_NUM;
-  reqbuf_out_tmp.type = context->eOutputBufType;
-  reqbuf_out_tmp.memory = context->nMemType;
+  return MPP_OK;
+}
 
-  ret = mpp_v4l2_req_buffers(context->nVideoFd, &reqbuf_out_tmp);
-  if (ret) {
-    error("request buffers failed, please check!");
+static RETURN stream_on(ALV4l2EncContext *context, ALV4l2EncQueue *queue) {
+  if (mpp_v4l2_stream_on(context->nVideoFd, &(queue->eType))) {
+    error("stream on queue %d failed, please check!", queue->eType);
     return MPP_IOCTL_FAILED;
   }
-  debug("=======> output yuv buffer count : %d", reqbuf_out_tmp.count);
-  for (S32 i = 0; i < reqbuf_out_tmp.count; i++) {
-    context->stOutputBufArr[i].type = context->eOutputBufType;
-    context->stOutputBufArr[i].memory = context->nMemType;
-    // context->stOutputBufArr[i].m.planes = context->stOutputBufPlanes[i];
-    context->stOutputBufArr[i].index = i;
-    // context->stOutputBufArr[i].length   = 1280*720*3;
-
-    ret =
-        mpp_v4l2_query_buffer(context->nVideoFd, &(context->stOutputBufArr[i]));
-    if (ret) {
-      error("query buffer failed, please check!");
-      return MPP_IOCTL_FAILED;
+  queue->bStreaming = MPP_TRUE;
+
+  return MPP_OK;
+}
+
+static void push_done_id(ALV4l2EncContext *context, S32 id) {
+  if (context->nDoneNum >= V4L2_ENC_MAX_BUF_NUM) return;
+
+  context->nDoneId[(context->nDoneHead + context->nDoneNum) %
+                   V4L2_ENC_MAX_BUF_NUM] = id;
+  context->nDoneNum++;
+}
+
+/**
+ * @description: stream off the frame queue, the frames in it are done.
+ */
+static void stop_input(ALV4l2EncContext *context) {
+  ALV4l2EncQueue *queue = &(context->stInput);
+
+  if (!queue->bStreaming) return;
+
+  mpp_v4l2_stream_off(context->nVideoFd, &(queue->eType));
+  for (S32 i = 0; i < queue->nBufferNum; i++) {
+    if (queue->stBuffer[i].bQueued) {
+      push_done_id(context, queue->stBuffer[i].nFrameId);
+      queue->stBuffer[i].bQueued = MPP_FALSE;
     }
+  }
+  queue->bStreaming = MPP_FALSE;
+}
 
-    if (V4L2_MEMORY_MMAP == context->nMemType) {
-      debug("mmap output buffer! length = %d, offset = %d",
-            context->stInputBufArr[i].length,
-            context->stInputBufArr[i].m.offset);
-      ret =
-          mpp_v4l2_map_memory(context->nVideoFd, &(context->stOutputBufArr[i]),
-                              context->pOutputUserPtr[i]);
-      if (ret) {
-        error("mmap buffer failed, please check!");
-        return MPP_MMAP_FAILED;
-      }
+/**
+ * @description: frame buffers the driver is done with are free again, their
+ * frames go back to the caller by al_enc_return_input_frame.
+ */
+static void reclaim_input(ALV4l2EncContext *context) {
+  ALV4l2EncBuffer *buffer = NULL;
+
+  while (context->stInput.bStreaming &&
+         !dequeue_buffer(context, &(context->stInput), &buffer))
+    push_done_id(context, buffer->nFrameId);
+}
+
+/**
+ * @description: a free frame buffer, the one that imported fd last if any
+ */
+static ALV4l2EncBuffer *get_free_input(ALV4l2EncContext *context, S32 fd) {
+  ALV4l2EncBuffer *found = NULL;
+
+  reclaim_input(context);
+  for (S32 i = 0; i < context->stInput.nBufferNum; i++) {
+    ALV4l2EncBuffer *buffer = &(context->stInput.stBuffer[i]);
+    if (buffer->bQueued) continue;
+    if (fd >= 0 && buffer->nImportedFd == fd) return buffer;
+    if (!found) found = buffer;
+  }
+
+  return found;
+}
+
+/**
+ * @description: start of component i of a frame, frames with fewer data
+ * pointers (dmabuf ones) have the components one after another.
+ */
+static U8 *get_component(ALV4l2EncContext *context, MppFrame *frame, S32 i,
+                         S32 stride) {
+  U8 *data = NULL;
+  S32 line, lines;
+
+  if (FRAME_GetDataUsedNum(frame) > i) return FRAME_GetDataPointer(frame, i);
+
+  data = FRAME_GetDataPointer(frame, 0);
+  for (S32 j = 0; j < i && data; j++) {
+    get_component_size(context->ePixelFormat, j, stride, context->nHeight,
+                       &line, &lines);
+    data += line * lines;
+  }
+
+  return data;
+}
+
+/**
+ * @description: copy the frame into the MMAP buffer, line by line as the
+ * driver can pad lines.
+ */
+static RETURN copy_frame(ALV4l2EncContext *context, ALV4l2EncBuffer *buffer,
+                         MppFrame *frame) {
+  ALV4l2EncQueue *queue = &(context->stInput);
+  MppPixelFormat format = context->ePixelFormat;
+  S32 num = get_component_num(format);
+  S32 src_stride = FRAME_GetLineStride(frame) > 0 ? FRAME_GetLineStride(frame)
+                                                  : context->nWidth;
+  S32 offset = 0;
+
+  for (S32 i = 0; i < num; i++) {
+    S32 width = (!i || is_semi_planar(format)) ? context->nWidth
+                                               : context->nWidth / 2;
+    S32 src_line, dst_line, lines;
+    U8 *src = get_component(context, frame, i, src_stride);
+    U8 *dst = NULL;
+
+    if (!src) {
+      error("frame has no data %d, please check!", i);
+      return MPP_NULL_POINTER;
+    }
+    get_component_size(format, i, src_stride, context->nHeight, &src_line,
+                       &lines);
+
+    if (queue->nPlanes >= num) {
+      // a buffer plane per component
+      dst = buffer->pUserPtr[i];
+      dst_line = get_bytesperline(queue, i);
+    } else {
+      get_component_size(format, i, get_bytesperline(queue, 0),
+                         context->nHeight, &dst_line, &lines);
+      dst = buffer->pUserPtr[0] + offset;
+      offset += dst_line * lines;
     }
+
+    for (S32 j = 0; j < lines; j++)
+      memcpy(dst + j * dst_line, src + j * src_line, width);
+    context->pVencPara->nInputCopiedBytes += (S64)width * lines;
   }
 
-  // queue output buffer
-  for (S32 i = 0; i < OUTPUT_BUF_NUM; i++) {
-    // remove vendor custom flags.
-    // context->stOutputBufArr[i].flags &= ~V4L2_BUF_FLAG_MVX_MASK;
+  if (V4L2_TYPE_IS_MULTIPLANAR(queue->eType)) {
+    for (S32 j = 0; j < queue->nPlanes; j++)
+      buffer->stPlanes[j].bytesused = get_sizeimage(queue, j);
+  } else {
+    buffer->stBuf.bytesused = get_sizeimage(queue, 0);
+  }
+
+  return MPP_OK;
+}
 
-    // mask buffer offset
-    if (!V4L2_TYPE_IS_MULTIPLANAR(context->stOutputBufArr[i].type) &&
-        V4L2_MEMORY_MMAP == context->stOutputBufArr[i].memory) {
-      context->stOutputBufArr[i].m.offset &= ~((1 << 12) - 1);
+/**
+ * @description: point the buffer at the dmabuf of the frame, components
+ * without an fd of their own are at their offset in the fd of component 0.
+ */
+static RETURN import_frame(ALV4l2EncContext *context, ALV4l2EncBuffer *buffer,
+                           MppFrame *frame) {
+  ALV4l2EncQueue *queue = &(context->stInput);
+  S32 fd = FRAME_GetFD(frame, 0);
+  S32 offset = 0;
+  S32 line, lines;
+
+  if (fd <= 0) {
+    error("frame has no dmabuf fd, please check!");
+    return MPP_CHECK_FAILED;
+  }
+
+  // length 0: the driver takes the size of the dmabuf
+  if (!V4L2_TYPE_IS_MULTIPLANAR(queue->eType)) {
+    buffer->stBuf.m.fd = fd;
+    buffer->stBuf.length = 0;
+    buffer->stBuf.bytesused = get_sizeimage(queue, 0);
+  } else {
+    for (S32 j = 0; j < queue->nPlanes; j++) {
+      S32 plane_fd = j ? FRAME_GetFD(frame, j) : fd;
+      S32 data_offset = plane_fd > 0 ? 0 : offset;
+
+      buffer->stPlanes[j].m.fd = plane_fd > 0 ? plane_fd : fd;
+      buffer->stPlanes[j].length = 0;
+      buffer->stPlanes[j].data_offset = data_offset;
+      buffer->stPlanes[j].bytesused = data_offset + get_sizeimage(queue, j);
+      get_component_size(context->ePixelFormat, j, get_bytesperline(queue, 0),
+                         context->nHeight, &line, &lines);
+      offset += line * lines;
     }
-    debug("queue all output buffer!");
-    ret =
-        mpp_v4l2_queue_buffer(context->nVideoFd, &(context->stOutputBufArr[i]));
-    if (ret) {
-      error("queue buffer failed, please check!");
-      return MPP_IOCTL_FAILED;
+  }
+  buffer->nImportedFd = fd;
+
+  return MPP_OK;
+}
+
+/**
+ * @description: the frame format, the driver has to take it as it is when
+ * frames are imported, their lines can not be padded.
+ */
+static RETURN set_input_format(ALV4l2EncContext *context, MppVencPara *para) {
+  ALV4l2EncQueue *queue = &(context->stInput);
+  BOOL mplane = V4L2_TYPE_IS_MULTIPLANAR(queue->eType);
+  U32 fourcc = get_frame_fourcc(context->ePixelFormat, mplane);
+  S32 stride = para->nStride > 0 ? para->nStride : para->nWidth;
+
+  if (!fourcc) {
+    error("%s can not be encoded by V4L2, please check!",
+          mpp_pixelformat2str(context->ePixelFormat));
+    return MPP_NOT_SUPPORTED_FORMAT;
+  }
+
+  if (mpp_v4l2_get_format(context->nVideoFd, &(queue->stFormat),
+                          queue->eType)) {
+    error("get frame format failed, please check!");
+    return MPP_IOCTL_FAILED;
+  }
+  if (mplane) {
+    struct v4l2_pix_format_mplane *pix = &(queue->stFormat.fmt.pix_mp);
+    pix->pixelformat = fourcc;
+    pix->width = para->nWidth;
+    pix->height = para->nHeight;
+    pix->field = V4L2_FIELD_NONE;
+    pix->num_planes = (fourcc == V4L2_PIX_FMT_NV12M ||
+                       fourcc == V4L2_PIX_FMT_NV21M)
+                          ? 2
+                          : 3;
+    for (S32 i = 0; i < pix->num_planes; i++) {
+      S32 line, lines;
+      get_component_size(context->ePixelFormat, i, stride, para->nHeight,
+                         &line, &lines);
+      pix->plane_fmt[i].bytesperline = line;
+      pix->plane_fmt[i].sizeimage = line * lines;
     }
+  } else {
+    struct v4l2_pix_format *pix = &(queue->stFormat.fmt.pix);
+    pix->pixelformat = fourcc;
+    pix->width = para->nWidth;
+    pix->height = para->nHeight;
+    pix->field = V4L2_FIELD_NONE;
+    pix->bytesperline = stride;
+    pix->sizeimage = stride * para->nHeight * 3 / 2;
+  }
+  if (mpp_v4l2_set_format(context->nVideoFd, &(queue->stFormat))) {
+    error("set frame format %dx%d %s failed, please check!", para->nWidth,
+          para->nHeight, mpp_pixelformat2str(context->ePixelFormat));
+    return MPP_IOCTL_FAILED;
+  }
+
+  if (mplane) {
+    context->nWidth = queue->stFormat.fmt.pix_mp.width;
+    context->nHeight = queue->stFormat.fmt.pix_mp.height;
+  } else {
+    context->nWidth = queue->stFormat.fmt.pix.width;
+    context->nHeight = queue->stFormat.fmt.pix.height;
+  }
+  if (context->nWidth != para->nWidth || context->nHeight != para->nHeight) {
+    error("the driver takes %dx%d, not %dx%d, please check!", context->nWidth,
+          context->nHeight, para->nWidth, para->nHeight);
+    return MPP_NOT_SUPPORTED_FORMAT;
+  }
+
+  if (V4L2_MEMORY_DMABUF == queue->eMemType &&
+      get_bytesperline(queue, 0) != stride) {
+    info("the driver pads lines to %d (frames have %d), copy the frames",
+         get_bytesperline(queue, 0), stride);
+    queue->eMemType = V4L2_MEMORY_MMAP;
+  }
+
+  return MPP_OK;
+}
+
+static RETURN set_output_format(ALV4l2EncContext *context, MppVencPara *para) {
+  ALV4l2EncQueue *queue = &(context->stOutput);
+  U32 fourcc = get_v4l2enc_codec_coding_type(para->eCodingType);
+  S32 size = para->nWidth * para->nHeight * 3 / 2;
+
+  if (!fourcc) {
+    error("%s can not be encoded by V4L2, please check!",
+          mpp_codingtype2str(para->eCodingType));
+    return MPP_NOT_SUPPORTED_FORMAT;
   }
+  if (size < V4L2_ENC_OUTPUT_BUF_SIZE) size = V4L2_ENC_OUTPUT_BUF_SIZE;
 
-  // stream on
-  debug("stream on!");
-  ret = mpp_v4l2_stream_on(context->nVideoFd, &context->eInputBufType);
-  if (ret) {
-    error("stream on input buffer failed, please check!");
+  if (mpp_v4l2_get_format(context->nVideoFd, &(queue->stFormat),
+                          queue->eType)) {
+    error("get stream format failed, please check!");
     return MPP_IOCTL_FAILED;
   }
-  ret = mpp_v4l2_stream_on(context->nVideoFd, &context->eOutputBufType);
-  if (ret) {
-    error("stream on output buffer failed, please check!");
+  if (V4L2_TYPE_IS_MULTIPLANAR(queue->eType)) {
+    struct v4l2_pix_format_mplane *pix = &(queue->stFormat.fmt.pix_mp);
+    pix->pixelformat = fourcc;
+    pix->width = para->nWidth;
+    pix->height = para->nHeight;
+    pix->num_planes = 1;
+    pix->plane_fmt[0].sizeimage = size;
+    pix->plane_fmt[0].bytesperline = 0;
+    pix->field = V4L2_FIELD_NONE;
+  } else {
+    struct v4l2_pix_format *pix = &(queue->stFormat.fmt.pix);
+    pix->pixelformat = fourcc;
+    pix->width = para->nWidth;
+    pix->height = para->nHeight;
+    pix->sizeimage = size;
+    pix->bytesperline = 0;
+    pix->field = V4L2_FIELD_NONE;
+  }
+  if (mpp_v4l2_set_format(context->nVideoFd, &(queue->stFormat))) {
+    error("set stream format failed, please check!");
     return MPP_IOCTL_FAILED;
   }
 
-  debug("init finish");
+  return MPP_OK;
+}
+
+ALBaseContext *al_enc_create() {
+  ALV4l2EncContext *context =
+      (ALV4l2EncContext *)malloc(sizeof(ALV4l2EncContext));
+  if (!context) {
+    error("can not malloc ALV4l2EncContext, please check! (%s)",
+          strerror(errno));
+    return NULL;
+  }
+  memset(context, 0, sizeof(ALV4l2EncContext));
+  context->nVideoFd = -1;
+
+  return &(context->stAlEncBaseContext.stAlBaseContext);
+}
+
+RETURN al_enc_init(ALBaseContext *ctx, MppVencPara *para) {
+  if (!ctx) {
+    error("input para ALBaseContext is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  if (!para) {
+    error("input para MppVencData is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  ALV4l2EncContext *context = (ALV4l2EncContext *)ctx;
+  ALV4l2EncQueue *input = &(context->stInput);
+  ALV4l2EncQueue *output = &(context->stOutput);
+  struct v4l2_capability vcap;
+  BOOL mplane = MPP_FALSE;
+  S32 ret = 0;
+
+  context->pVencPara = para;
+  context->ePixelFormat = PIXEL_FORMAT_UNKNOWN == para->PixelFormat
+                              ? PIXEL_FORMAT_I420
+                              : para->PixelFormat;
+  para->nInputCopiedBytes = 0;
+
+  context->nVideoFd = find_v4l2_encoder(
+      context->sDevicePath, get_v4l2enc_codec_coding_type(para->eCodingType));
+  if (-1 == context->nVideoFd) {
+    error("can not find the v4l2 codec device, please check!");
+    return MPP_OPEN_FAILED;
+  }
+  fcntl(context->nVideoFd, F_SETFL,
+        fcntl(context->nVideoFd, F_GETFL) | O_NONBLOCK);
+  // a stream done while nobody is in the plugin wakes the sys flow up
+  para->nOutputPollFd = context->nVideoFd;
+
+  memset(&vcap, 0, sizeof(vcap));
+  if (!v4l2_ioctl(context->nVideoFd, VIDIOC_QUERYCAP, &vcap)) {
+    U32 caps = (vcap.capabilities & V4L2_CAP_DEVICE_CAPS) ? vcap.device_caps
+                                                          : vcap.capabilities;
+    mplane = !!(caps & (V4L2_CAP_VIDEO_M2M_MPLANE |
+                        V4L2_CAP_VIDEO_OUTPUT_MPLANE));
+  }
+  debug("video fd = %d, device path = '%s', driver '%s', mplane %d",
+        context->nVideoFd, context->sDevicePath, vcap.driver, mplane);
+
+  input->eType =
+      mplane ? V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE : V4L2_BUF_TYPE_VIDEO_OUTPUT;
+  output->eType =
+      mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  input->eMemType =
+      (para->eFrameBufferType == MPP_FRAME_BUFFERTYPE_DMABUF_INTERNAL ||
+       para->eFrameBufferType == MPP_FRAME_BUFFERTYPE_DMABUF_EXTERNAL)
+          ? V4L2_MEMORY_DMABUF
+          : V4L2_MEMORY_MMAP;
+  output->eMemType = V4L2_MEMORY_MMAP;
+
+  // the stream format first, the frame formats can depend on it
+  ret = set_output_format(context, para);
+  if (ret) return ret;
+  ret = set_input_format(context, para);
+  if (ret) return ret;
+  set_controls(context, para);
+
+  if (!para->nInputBufferNum) para->nInputBufferNum = V4L2_ENC_INPUT_BUF_NUM;
+  if (!para->nOutputBufferNum)
+    para->nOutputBufferNum = V4L2_ENC_OUTPUT_BUF_NUM;
+
+  ret = setup_buffers(context, input, para->nInputBufferNum);
+  if (ret) return ret;
+  ret = setup_buffers(context, output, para->nOutputBufferNum);
+  if (ret) return ret;
+  para->nInputBufferNum = input->nBufferNum;
+  para->nOutputBufferNum = output->nBufferNum;
+
+  for (S32 i = 0; i < output->nBufferNum; i++) {
+    ret = queue_buffer(context, output, i);
+    if (ret) return ret;
+  }
+
+  ret = stream_on(context, input);
+  if (ret) return ret;
+  ret = stream_on(context, output);
+  if (ret) return ret;
+
+  para->eDataTransmissinMode = V4L2_MEMORY_DMABUF == input->eMemType
+                                   ? MPP_INPUT_ASYNC_OUTPUT_SYNC
+                                   : MPP_INPUT_SYNC_OUTPUT_SYNC;
+
+  info("init finish, %s %dx%d %s on '%s' (%s), %d frame buffers (%s), %d "
+       "stream buffers",
+       mpp_codingtype2str(para->eCodingType), context->nWidth,
+       context->nHeight, mpp_pixelformat2str(context->ePixelFormat),
+       context->sDevicePath, vcap.driver, input->nBufferNum,
+       V4L2_MEMORY_DMABUF == input->eMemType ? "dmabuf" : "mmap",
+       output->nBufferNum);
 
   return MPP_OK;
 }
 
-S32 al_enc_set_para(ALBaseContext *ctx, MppVencPara *para) { return 0; }
+S32 al_enc_set_para(ALBaseContext *ctx, MppVencPara *para) {
+  if (!ctx || !para) return MPP_NULL_POINTER;
 
-S32 al_enc_encode(ALBaseContext *ctx, MppData *sink_data) {
+  ALV4l2EncContext *context = (ALV4l2EncContext *)ctx;
+
+  // rate control and GOP can change while streaming
+  set_controls(context, para);
+
+  return MPP_OK;
+}
+
+static void send_stop(ALV4l2EncContext *context) {
+  struct v4l2_encoder_cmd cmd;
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.cmd = V4L2_ENC_CMD_STOP;
+  if (v4l2_ioctl(context->nVideoFd, VIDIOC_ENCODER_CMD, &cmd))
+    error("encoder stop failed, the last streams may not come (%s)",
+          strerror(errno));
+}
+
+/**
+ * @description: queue the frame, imported by its dmabuf or copied, the
+ * caller gets it back by al_enc_return_input_frame.
+ * @return {*}: MPP_OK, MPP_POLL_FAILED if all frame buffers are in the
+ * driver (get streams and return frames, then send it again)
+ */
+S32 al_enc_send_input_frame(ALBaseContext *ctx, MppData *sink_data) {
   if (!ctx) {
     error("input para ALBaseContext is NULL, please check!");
     return MPP_NULL_POINTER;
@@ -328,38 +879,129 @@ S32 al_enc_encode(ALBaseContext *ctx, MppData *sink_data) {
   }
 
   ALV4l2EncContext *context = (ALV4l2EncContext *)ctx;
-  S32 ret = 0;
-  static S32 i = 0;
-
-  if (i < INPUT_BUF_NUM) {
-    memcpy(context->pInputUserPtr[i][0],
-           PACKET_GetDataPointer(PACKET_GetPacket(sink_data)),
-           PACKET_GetLength(PACKET_GetPacket(sink_data)));
-    context->stInputBufArr[i].bytesused =
-        PACKET_GetLength(PACKET_GetPacket(sink_data));
-    context->stInputBufArr[i].flags |= V4L2_BUF_FLAG_LAST;
-    ret = mpp_v4l2_queue_buffer(context->nVideoFd, &context->stInputBufArr[i]);
-    i++;
-  } else {
-    struct v4l2_buffer buf_tmp;
+  ALV4l2EncQueue *input = &(context->stInput);
+  MppFrame *frame = FRAME_GetFrame(sink_data);
+  MppFrameEos eos = FRAME_GetEos(frame);
+  ALV4l2EncBuffer *buffer = NULL;
+  S64 pts = FRAME_GetPts(frame);
+  RETURN ret = MPP_OK;
+
+  if (context->bInputEos) {
+    debug("stream already ended, drop the frame");
+    return MPP_OK;
+  }
 
-    buf_tmp.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    buf_tmp.memory = V4L2_MEMORY_MMAP;
-    ret = mpp_v4l2_dequeue_buffer(context->nVideoFd, &buf_tmp);
-    memcpy(context->pInputUserPtr[buf_tmp.index][0],
-           PACKET_GetDataPointer(PACKET_GetPacket(sink_data)),
-           PACKET_GetLength(PACKET_GetPacket(sink_data)));
-    context->stInputBufArr[buf_tmp.index].bytesused =
-        PACKET_GetLength(PACKET_GetPacket(sink_data));
-    context->stInputBufArr[buf_tmp.index].flags |= V4L2_BUF_FLAG_LAST;
-    ret = mpp_v4l2_queue_buffer(context->nVideoFd,
-                                &context->stInputBufArr[buf_tmp.index]);
+  if (FRAME_EOS_WITHOUT_DATA == eos) {
+    debug("eos flag of input frame without data is set, EOS is coming");
+    context->bInputEos = MPP_TRUE;
+    send_stop(context);
+    mpp_notify_signal(context->pVencPara->nOutputEventFd);
+    return MPP_OK;
   }
 
-  return 0;
+  buffer = get_free_input(context, V4L2_MEMORY_DMABUF == input->eMemType
+                                       ? FRAME_GetFD(frame, 0)
+                                       : -1);
+  if (!buffer) return MPP_POLL_FAILED;
+
+  if (V4L2_MEMORY_DMABUF == input->eMemType)
+    ret = import_frame(context, buffer, frame);
+  else
+    ret = copy_frame(context, buffer, frame);
+  if (ret) return ret;
+
+  buffer->nFrameId = FRAME_GetID(frame);
+  buffer->stBuf.flags = 0;
+  buffer->stBuf.field = V4L2_FIELD_NONE;
+  buffer->stBuf.timestamp.tv_sec = pts / 1000000;
+  buffer->stBuf.timestamp.tv_usec = pts % 1000000;
+  ret = queue_buffer(context, input, buffer->stBuf.index);
+  if (ret) return ret;
+
+  if (FRAME_EOS_WITH_DATA == eos) {
+    debug("eos flag of input frame with data is set, EOS is coming");
+    context->bInputEos = MPP_TRUE;
+    send_stop(context);
+  }
+
+  // the driver encodes in the background, look for the stream (or EOS) now
+  mpp_notify_signal(context->pVencPara->nOutputEventFd);
+
+  return MPP_OK;
 }
 
-S32 al_enc_request_output_stream(ALBaseContext *ctx, MppData *src_data) {
+S32 al_enc_encode(ALBaseContext *ctx, MppData *sink_data) {
+  return al_enc_send_input_frame(ctx, sink_data);
+}
+
+/**
+ * @description: a frame the driver is done with
+ * @return {*}: the id of the frame, -1 if there is none now
+ */
+S32 al_enc_return_input_frame(ALBaseContext *ctx, MppData *sink_data) {
+  if (!ctx) {
+    error("input para ALBaseContext is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  ALV4l2EncContext *context = (ALV4l2EncContext *)ctx;
+  S32 id = -1;
+
+  reclaim_input(context);
+  if (!context->nDoneNum) return -1;
+
+  id = context->nDoneId[context->nDoneHead];
+  context->nDoneHead = (context->nDoneHead + 1) % V4L2_ENC_MAX_BUF_NUM;
+  context->nDoneNum--;
+  if (sink_data) FRAME_SetID(FRAME_GetFrame(sink_data), id);
+
+  return id;
+}
+
+/**
+ * @description: the next encoded stream buffer
+ * @return {*}: MPP_OK, MPP_CODER_NO_DATA, MPP_CODER_EOS with the last one
+ * (can be empty), out is NULL then if there is no buffer.
+ */
+static RETURN get_stream(ALV4l2EncContext *context, ALV4l2EncBuffer **out) {
+  ALV4l2EncBuffer *buffer = NULL;
+  RETURN ret = MPP_OK;
+
+  *out = NULL;
+  if (context->bOutputEos) return MPP_CODER_EOS;
+
+  ret = dequeue_buffer(context, &(context->stOutput), &buffer);
+  if (MPP_CODER_EOS == ret) {
+    context->bOutputEos = MPP_TRUE;
+    return MPP_CODER_EOS;
+  }
+  if (ret) return ret;
+
+  *out = buffer;
+  if (buffer->stBuf.flags & V4L2_BUF_FLAG_LAST) {
+    debug("last stream");
+    context->bOutputEos = MPP_TRUE;
+    return MPP_CODER_EOS;
+  }
+
+  return MPP_OK;
+}
+
+static U8 *get_stream_data(ALV4l2EncContext *context, ALV4l2EncBuffer *buffer,
+                           S32 *length) {
+  if (V4L2_TYPE_IS_MULTIPLANAR(context->stOutput.eType)) {
+    *length = buffer->stPlanes[0].bytesused - buffer->stPlanes[0].data_offset;
+    return buffer->pUserPtr[0] + buffer->stPlanes[0].data_offset;
+  }
+
+  *length = buffer->stBuf.bytesused;
+  return buffer->pUserPtr[0];
+}
+
+/**
+ * @description: copy the next stream into the packet of the caller
+ */
+S32 al_enc_get_output_stream(ALBaseContext *ctx, MppData *src_data) {
   if (!ctx) {
     error("input para ALBaseContext is NULL, please check!");
     return MPP_NULL_POINTER;
@@ -371,50 +1013,67 @@ S32 al_enc_request_output_stream(ALBaseContext *ctx, MppData *src_data) {
   }
 
   ALV4l2EncContext *context = (ALV4l2EncContext *)ctx;
-  S32 ret = 0;
-
-  debug("@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@request output");
+  MppPacket *packet = PACKET_GetPacket(src_data);
+  ALV4l2EncBuffer *buffer = NULL;
+  S32 length = 0;
+  U8 *data = NULL;
+  RETURN ret = get_stream(context, &buffer);
+
+  if (!buffer) {
+    if (MPP_CODER_EOS == ret) PACKET_SetLength(packet, 0);
+    return ret;
+  }
 
-  struct v4l2_buffer buf_tmp;
-  // struct v4l2_plane  planes[8];
-  // buf_tmp.m.planes = planes;
-  buf_tmp.type = context->eOutputBufType;
-  buf_tmp.memory = context->nMemType;
-  // buf_tmp.length   = 3;
+  data = get_stream_data(context, buffer, &length);
+  memcpy(PACKET_GetDataPointer(packet), data, length);
+  PACKET_SetLength(packet, length);
+  PACKET_SetPts(packet, (S64)buffer->stBuf.timestamp.tv_sec * 1000000 +
+                            buffer->stBuf.timestamp.tv_usec);
+  PACKET_SetKeyFrame(packet, !!(buffer->stBuf.flags & V4L2_BUF_FLAG_KEYFRAME));
 
-  ret = mpp_v4l2_dequeue_buffer(context->nVideoFd, &buf_tmp);
-  if (ret) {
-    error("dequeue output buffer failed, please check!");
+  if (MPP_OK != queue_buffer(context, &(context->stOutput),
+                             buffer->stBuf.index))
     return MPP_IOCTL_FAILED;
-  }
 
-  context->stOutputBufArr[buf_tmp.index] = buf_tmp;
-  if (V4L2_TYPE_IS_MULTIPLANAR(buf_tmp.type)) {
-    context->stOutputBufArr[buf_tmp.index].m.planes =
-        context->stOutputBufPlanes[buf_tmp.index];
-    for (size_t i = 0; i < context->stOutputBufArr[buf_tmp.index].length; ++i) {
-      context->stOutputBufArr[buf_tmp.index].m.planes[i] = buf_tmp.m.planes[i];
-    }
-  }
+  return ret;
+}
 
-  // handle output picture
-  struct v4l2_buffer *p_tmp = &context->stOutputBufArr[buf_tmp.index];
-  // U8 *user_ptr = context->pOutputUserPtr[buf_idx];
-  show_buffer_info(p_tmp);
-  for (S32 i = 0; i < p_tmp->length; ++i) {
-    // struct v4l2_plane *plane = &(p->m.planes);
+/**
+ * @description: lend the next stream buffer, the packet points into it until
+ * al_enc_return_output_stream.
+ */
+S32 al_enc_request_output_stream(ALBaseContext *ctx, MppData *src_data) {
+  if (!ctx) {
+    error("input para ALBaseContext is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
 
-    // U8 *pl     = user_ptr[i] + plane->data_offset;
-    // S32   len    = plane->bytesused - plane->data_offset;
-    // S32   wr_len = fwrite(pl, 1, len, out_pic);
+  if (!src_data) {
+    error("input para MppData is NULL, please check!");
+    return MPP_NULL_POINTER;
   }
 
-  FRAME_SetID(FRAME_GetFrame(src_data), buf_tmp.index);
+  ALV4l2EncContext *context = (ALV4l2EncContext *)ctx;
+  MppPacket *packet = PACKET_GetPacket(src_data);
+  ALV4l2EncBuffer *buffer = NULL;
+  S32 length = 0;
+  RETURN ret = get_stream(context, &buffer);
+
+  if (!buffer) {
+    if (MPP_CODER_EOS == ret) PACKET_SetLength(packet, 0);
+    return ret;
+  }
 
-  debug("@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@ request output idx = %d",
-        buf_tmp.index);
+  buffer->bLent = MPP_TRUE;
+  buffer->pOwnedPacketData = (U8 *)PACKET_GetDataPointer(packet);
+  buffer->pLentData = get_stream_data(context, buffer, &length);
+  PACKET_SetDataPointer(packet, buffer->pLentData);
+  PACKET_SetLength(packet, length);
+  PACKET_SetPts(packet, (S64)buffer->stBuf.timestamp.tv_sec * 1000000 +
+                            buffer->stBuf.timestamp.tv_usec);
+  PACKET_SetKeyFrame(packet, !!(buffer->stBuf.flags & V4L2_BUF_FLAG_KEYFRAME));
 
-  return 0;
+  return ret;
 }
 
 S32 al_enc_return_output_stream(ALBaseContext *ctx, MppData *src_data) {
@@ -429,20 +1088,65 @@ S32 al_enc_return_output_stream(ALBaseContext *ctx, MppData *src_data) {
   }
 
   ALV4l2EncContext *context = (ALV4l2EncContext *)ctx;
-  S32 ret = 0;
+  ALV4l2EncQueue *queue = &(context->stOutput);
+  MppPacket *packet = PACKET_GetPacket(src_data);
+  U8 *data = (U8 *)PACKET_GetDataPointer(packet);
+  S32 index;
+
+  // the id of the packet is the caller's, the data tells the buffer
+  for (index = 0; index < queue->nBufferNum; index++) {
+    if (queue->stBuffer[index].bLent &&
+        queue->stBuffer[index].pLentData == data)
+      break;
+  }
+  if (index == queue->nBufferNum) {
+    error("stream %p is not lent by the encoder, please check!", data);
+    return MPP_CHECK_FAILED;
+  }
 
-  S32 buf_idx = FRAME_GetID(FRAME_GetFrame(src_data));
-  debug("@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@release output idx = %d", buf_idx);
+  PACKET_SetDataPointer(packet, queue->stBuffer[index].pOwnedPacketData);
+  queue->stBuffer[index].pOwnedPacketData = NULL;
+  queue->stBuffer[index].pLentData = NULL;
+  queue->stBuffer[index].bLent = MPP_FALSE;
 
-  ret = mpp_v4l2_queue_buffer(context->nVideoFd,
-                              &context->stOutputBufArr[buf_idx]);
-  if (ret) {
-    error("queue output buffer failed, please check!");
-    return MPP_IOCTL_FAILED;
+  if (context->bOutputEos || !queue->bStreaming) return MPP_OK;
+
+  return queue_buffer(context, queue, index);
+}
+
+/**
+ * @description: drop the frames and streams in the driver, the frames are
+ * returned by al_enc_return_input_frame.
+ */
+S32 al_enc_flush(ALBaseContext *ctx) {
+  if (!ctx) return MPP_NULL_POINTER;
+
+  ALV4l2EncContext *context = (ALV4l2EncContext *)ctx;
+  ALV4l2EncQueue *queue = &(context->stOutput);
+  RETURN ret = MPP_OK;
+
+  debug("flush start");
+
+  stop_input(context);
+  ret = stream_on(context, &(context->stInput));
+  if (ret) return ret;
+  context->bInputEos = MPP_FALSE;
+
+  if (queue->bStreaming) {
+    mpp_v4l2_stream_off(context->nVideoFd, &(queue->eType));
+    queue->bStreaming = MPP_FALSE;
   }
-  debug("@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@release output ret = %d", ret);
+  for (S32 i = 0; i < queue->nBufferNum && !ret; i++) {
+    queue->stBuffer[i].bQueued = MPP_FALSE;
+    if (!queue->stBuffer[i].bLent) ret = queue_buffer(context, queue, i);
+  }
+  if (ret) return ret;
+  ret = stream_on(context, queue);
+  context->bOutputEos = MPP_FALSE;
 
-  return MPP_OK;
+  debug("flush finish, ret = %d", ret);
+
+  return ret;
 }
 
 void al_enc_destory(ALBaseContext *ctx) {
@@ -450,10 +1154,15 @@ void al_enc_destory(ALBaseContext *ctx) {
 
   ALV4l2EncContext *context = (ALV4l2EncContext *)ctx;
 
-  mpp_v4l2_stream_off(context->nVideoFd, &context->eInputBufType);
-  mpp_v4l2_stream_off(context->nVideoFd, &context->eOutputBufType);
+  if (context->nVideoFd >= 0) {
+    stop_input(context);
+    if (context->stOutput.bStreaming)
+      mpp_v4l2_stream_off(context->nVideoFd, &(context->stOutput.eType));
+    release_buffers(context, &(context->stInput));
+    release_buffers(context, &(context->stOutput));
+    close(context->nVideoFd);
+  }
 
-  close(context->nVideoFd);
   free(context);
   context = NULL;
 }
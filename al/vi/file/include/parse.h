@@ -18,6 +18,12 @@
 
 typedef struct _MppParseContext MppParseContext;
 
+/***
+ * parse: find the next frame in [stream_start_addr, + stream_size), set
+ * frame_size and pFrameStart of the context to it. The frame is copied to
+ * frame_start_addr unless it is NULL, so a caller holding the whole stream
+ * in memory can point its packet at pFrameStart without any copy.
+ */
 typedef struct _ParseOps {
   S32 (*init)(MppParseContext *base_context);
   S32(*parse)
@@ -27,6 +33,7 @@ typedef struct _ParseOps {
 
 struct _MppParseContext {
   ParseOps *ops;
+  U8 *pFrameStart;  // start of the frame found by the last parse
 };
 
 /**
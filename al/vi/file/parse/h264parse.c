@@ -15,6 +15,7 @@
 
 #include "log.h"
 #include "parse.h"
+#include "startcode.h"
 
 S32 PARSE_H264_Init(MppParseContext *ctx) {}
 
@@ -106,14 +107,12 @@ S32 PARSE_H264_Parse(MppParseContext *ctx, U8 *stream_start_addr,
   src_mem = stream_start_addr;
 
   while (1) {
-    tmp_mem = src_mem + i;
-
-    // debug("i = %d %x", i, *tmp_mem);
-    // NAL start with 00000001||000001
-    if (((0x00 == *(tmp_mem)) && (0x00 == *(tmp_mem + 1)) &&
-         (0x00 == *(tmp_mem + 2)) && (0x01 == *(tmp_mem + 3))) ||
-        ((0x00 == *(tmp_mem)) && (0x00 == *(tmp_mem + 1)) &&
-         (0x01 == *(tmp_mem + 2))))
+    // NAL start with 00000001||000001, report the 4 bytes one at its 1st 00
+    tmp_mem = (U8 *)mpp_find_start_code(src_mem + i,
+                                         src_mem + stream_size - 2);
+    if (tmp_mem >= src_mem + stream_size - 2) break;
+    if (tmp_mem > src_mem + i && 0x00 == *(tmp_mem - 1)) tmp_mem--;
+    i = tmp_mem - src_mem;
 
     {
       rbsp_base = stream_start_addr + i;
@@ -261,19 +260,19 @@ S32 PARSE_H264_Parse(MppParseContext *ctx, U8 *stream_start_addr,
       }
 
       i += 3;
-    } else {
-      i++;
     }
     if (i >= stream_size - 4) break;
   }
 
   if (2 == num_start_code) {
-    memcpy(frame_start_addr, start_pos, *frame_size);
+    ctx->pFrameStart = start_pos;
+    if (frame_start_addr) memcpy(frame_start_addr, start_pos, *frame_size);
     return 0;
   } else if (1 == num_start_code) {
     error("stream_size = %d", stream_size);
-    *frame_size = stream_size;
-    memcpy(frame_start_addr, start_pos, stream_size);
+    ctx->pFrameStart = start_pos;
+    *frame_size = stream_size - (start_pos - stream_start_addr);
+    if (frame_start_addr) memcpy(frame_start_addr, start_pos, *frame_size);
     return 0;
   } else {
     return -1;
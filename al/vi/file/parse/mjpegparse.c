@@ -15,6 +15,7 @@
 
 #include "log.h"
 #include "parse.h"
+#include "startcode.h"
 
 S32 PARSE_MJPEG_Init(MppParseContext *ctx) {}
 
@@ -35,7 +36,9 @@ S32 PARSE_MJPEG_Parse(MppParseContext *ctx, U8 *stream_start_addr,
   src_mem = stream_start_addr;
 
   while (1) {
-    tmp_mem = src_mem + i;
+    tmp_mem = (U8 *)mpp_find_jpeg_marker(src_mem + i, src_mem + stream_size);
+    if (tmp_mem >= src_mem + stream_size) break;
+    i = tmp_mem - src_mem;
 
     if ((0xff == *(tmp_mem)) && (0xd8 == *(tmp_mem + 1))) {
       debug("%p %x %x", tmp_mem, *(tmp_mem), *(tmp_mem + 1));
@@ -67,16 +70,14 @@ S32 PARSE_MJPEG_Parse(MppParseContext *ctx, U8 *stream_start_addr,
         break;
       }
       i++;
-
-    } else {
-      i++;
     }
 
     if (i >= stream_size - 1) break;
   }
 
   if (1 == num_finish_code) {
-    memcpy(frame_start_addr, start_pos, *frame_size);
+    ctx->pFrameStart = start_pos;
+    if (frame_start_addr) memcpy(frame_start_addr, start_pos, *frame_size);
     return 0;
   } else
     return 2;
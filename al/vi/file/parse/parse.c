@@ -32,6 +32,7 @@ MppParseContext* PARSE_Create(MppCodingType type) {
     free(parse_context);
     return NULL;
   }
+  parse_context->pFrameStart = NULL;
 
   if (CODING_H264 == type) {
     parse_context->ops->init = &PARSE_H264_Init;
@@ -5,16 +5,20 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2024-04-28 17:10:20
- * @LastEditTime: 2024-04-30 10:30:52
+ * @LastEditTime: 2024-05-22 15:02:41
  * @FilePath: \mpp\al\vi\file\vi_file.c
  * @Description:
  */
 
-#define ENABLE_DEBUG 1
+#define ENABLE_DEBUG 0
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "al_interface_vi.h"
 #include "log.h"
@@ -22,17 +26,11 @@
 
 #define MODULE_TAG "vi_file"
 
-#define MPP_PACKET_PARSE_REGION_SIZE (2 * 1024 * 1024)
-#define FRAME_FREAD(data, size, count, fp)        \
-  ({                                              \
-    S32 total = (size) * (count);                 \
-    S32 n = fread((data), (size), (count), (fp)); \
-    if (n != total && ferror(fp)) {               \
-      error("Failed to read frame from file");    \
-      exit(EXIT_FAILURE);                         \
-    }                                             \
-    n;                                            \
-  })
+/***
+ * the parsers peek a few bytes (and a slice header) behind the region they
+ * are given, keep one zero page mapped behind the end of the file.
+ */
+#define VI_FILE_MAP_PADDING 4096
 
 typedef struct _ALViFileContext ALViFileContext;
 
@@ -49,20 +47,84 @@ struct _ALViFileContext {
   MppPixelFormat eOutputPixelFormat;
   MppCodingType eCodingType;
   U8 *pInputFileName;
-  FILE *pInputFile;
+  S32 nInputFd;
   MppParseContext *pParseCtx;
-  S32 nFileOffset;
+  S64 nFileOffset;
   S64 nTimeStamp;
 
-  U8 *stream_data;
-  U8 *tmp_stream_data;
-  S32 stream_length;
-  S32 need_drain;
+  /***
+   * the whole input file is mapped once, packets point into the mapping
+   * (zero copy) while they are lent out, see al_vi_return_output_data.
+   */
+  U8 *pFileData;
+  S64 nFileSize;
+  S64 nMapSize;
+  U8 *pLentPacketData;
+  U8 *pOwnedPacketData;
+
   S32 length;
-  S32 fileSize;
   BOOL eos;
 };
 
+static RETURN map_input_file(ALViFileContext *context) {
+  struct stat st;
+  U8 *addr;
+
+  context->nInputFd = open(context->pInputFileName, O_RDONLY | O_CLOEXEC);
+  if (context->nInputFd < 0) {
+    error("can not open %s, please check! (%s)", context->pInputFileName,
+          strerror(errno));
+    return MPP_OPEN_FAILED;
+  }
+
+  if (fstat(context->nInputFd, &st) || st.st_size <= 0) {
+    error("can not get size of %s or it is empty, please check!",
+          context->pInputFileName);
+    return MPP_OPEN_FAILED;
+  }
+  context->nFileSize = st.st_size;
+  context->nMapSize = (context->nFileSize + VI_FILE_MAP_PADDING * 2 - 1) &
+                      ~(S64)(VI_FILE_MAP_PADDING - 1);
+
+  // reserve anonymous zero pages, then put the file on top of them
+  addr = (U8 *)mmap(NULL, context->nMapSize, PROT_READ,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (addr == MAP_FAILED) {
+    error("can not reserve %lld bytes, please check! (%s)",
+          (long long)context->nMapSize, strerror(errno));
+    return MPP_MMAP_FAILED;
+  }
+
+  context->pFileData =
+      (U8 *)mmap(addr, context->nFileSize, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+                 context->nInputFd, 0);
+  if (context->pFileData == MAP_FAILED) {
+    error("can not mmap %s, please check! (%s)", context->pInputFileName,
+          strerror(errno));
+    context->pFileData = NULL;
+    munmap(addr, context->nMapSize);
+    return MPP_MMAP_FAILED;
+  }
+
+  madvise(context->pFileData, context->nFileSize, MADV_SEQUENTIAL);
+  posix_fadvise(context->nInputFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  posix_fadvise(context->nInputFd, 0, 0, POSIX_FADV_WILLNEED);
+
+  return MPP_OK;
+}
+
+/***
+ * @description: give the caller's own buffer back to the packet
+ */
+static void restore_packet(ALViFileContext *context, MppPacket *packet) {
+  if (context->pLentPacketData &&
+      PACKET_GetDataPointer(packet) == context->pLentPacketData) {
+    PACKET_SetDataPointer(packet, context->pOwnedPacketData);
+  }
+  context->pLentPacketData = NULL;
+  context->pOwnedPacketData = NULL;
+}
+
 ALBaseContext *al_vi_create() {
   ALViFileContext *context = (ALViFileContext *)malloc(sizeof(ALViFileContext));
   if (!context) {
@@ -96,18 +158,11 @@ RETURN al_vi_init(ALBaseContext *ctx, MppViPara *para) {
   context->eOutputPixelFormat = para->ePixelFormat;
   context->pInputFileName = para->pInputFileName;
   context->eCodingType = para->eCodingType;
-  context->stream_data = NULL;
-  context->tmp_stream_data = NULL;
-  context->stream_length = 0;
-  context->need_drain = 0;
+  context->nInputFd = -1;
   context->length = 0;
   context->eos = MPP_FALSE;
 
-  context->pInputFile = fopen(context->pInputFileName, "r");
-  if (!context->pInputFile) {
-    error("can not open context->pInputFileName, please check !");
-    goto exit;
-  }
+  if (map_input_file(context)) goto exit;
 
   if (!context->bIsFrame) {
     // create parser
@@ -117,25 +172,21 @@ RETURN al_vi_init(ALBaseContext *ctx, MppViPara *para) {
       goto exit;
     }
     context->pParseCtx->ops->init(context->pParseCtx);
-
-    context->stream_data = (U8 *)malloc(MPP_PACKET_PARSE_REGION_SIZE);
-    context->tmp_stream_data = context->stream_data;
   }
 
   context->nFileOffset = 0;
-
-  fseek(context->pInputFile, 0, SEEK_END);
-  context->fileSize = ftell(context->pInputFile);
-  rewind(context->pInputFile);
-  debug("start do_parse: %d", context->fileSize);
+  debug("start do_parse: %lld", (long long)context->nFileSize);
 
   debug("init finish");
 
   return MPP_OK;
 
 exit:
-  error("k1 vi_sdl2 init fail");
-  free(context);
+  error("k1 vi_file init fail");
+  if (context->pFileData) munmap(context->pFileData, context->nMapSize);
+  if (context->nInputFd >= 0) close(context->nInputFd);
+  context->pFileData = NULL;
+  context->nInputFd = -1;
   return MPP_INIT_FAILED;
 }
 
@@ -220,21 +271,28 @@ S32 al_vi_request_output_data(ALBaseContext *ctx, MppData *src_data) {
     }
 
     for (i = 0; i < pnum; i++) {
-      read_byte += FRAME_FREAD(FRAME_GetDataPointer(sink_frame, i), 1, size[i],
-                               context->pInputFile);
+      S64 left = context->nFileSize - context->nFileOffset;
+      S32 n = size[i] < left ? size[i] : (S32)left;
+      if (n > 0) {
+        memcpy(FRAME_GetDataPointer(sink_frame, i),
+               context->pFileData + context->nFileOffset, n);
+        context->nFileOffset += n;
+      }
+      read_byte += n;
       if (read_byte == 0) context->eos = MPP_TRUE;
     }
   } else {
     MppPacket *sink_packet = PACKET_GetPacket(src_data);
+    S64 left = context->nFileSize - context->nFileOffset;
+    U8 *stream = context->pFileData + context->nFileOffset;
+
+    // the previous packet was not returned, take it back before lending
+    restore_packet(context, sink_packet);
 
-    context->stream_data = context->tmp_stream_data;
-    context->stream_length =
-        fread(context->stream_data, 1, MPP_PACKET_PARSE_REGION_SIZE,
-              context->pInputFile);
-    debug("stream_length = %d length = %d, offset = %d", context->stream_length,
-          context->length, context->nFileOffset);
+    debug("stream left = %lld, offset = %lld", (long long)left,
+          (long long)context->nFileOffset);
 
-    if (0 == context->stream_length) {
+    if (left <= 0) {
       error("There is no data, quit!");
       context->eos = MPP_TRUE;
       PACKET_SetEos(sink_packet, MPP_TRUE);
@@ -242,31 +300,37 @@ S32 al_vi_request_output_data(ALBaseContext *ctx, MppData *src_data) {
       return MPP_CODER_EOS;
     }
 
+    // find the packet in the mapping, no copy (frame_start_addr = NULL)
     ret = context->pParseCtx->ops->parse(
-        context->pParseCtx, (U8 *)(context->stream_data),
-        context->stream_length, (U8 *)PACKET_GetDataPointer(sink_packet),
-        &(context->length), 0);
+        context->pParseCtx, stream, left > 0x7fffffff ? 0x7fffffff : left,
+        NULL, &(context->length), 0);
+    if (1 == ret && context->pParseCtx->pFrameStart) {
+      // the last packet, runs to the end of the file
+      context->length = context->pFileData + context->nFileSize -
+                        context->pParseCtx->pFrameStart;
+      ret = 0;
+    }
+
     if (0 == ret) {
-      // context->stream_data += context->length;
-      // context->stream_length -= context->length;
-      context->nFileOffset += context->length;
+      context->pOwnedPacketData = PACKET_GetDataPointer(sink_packet);
+      context->pLentPacketData = context->pParseCtx->pFrameStart;
+      PACKET_SetDataPointer(sink_packet, context->pLentPacketData);
+      context->nFileOffset = context->pParseCtx->pFrameStart +
+                             context->length - context->pFileData;
 
       PACKET_SetEos(sink_packet, MPP_FALSE);
       PACKET_SetLength(sink_packet, context->length);
       PACKET_SetPts(sink_packet, context->nTimeStamp);
       context->nTimeStamp += 1000000;
 
-      debug("we get a packet, length = %d, ret = %d %p %x %x %x %x",
-            context->length, ret, PACKET_GetDataPointer(sink_packet),
-            *(S32 *)PACKET_GetDataPointer(sink_packet),
-            *(S32 *)(PACKET_GetDataPointer(sink_packet) + 4),
-            *(S32 *)(PACKET_GetDataPointer(sink_packet) + 8),
-            *(S32 *)(PACKET_GetDataPointer(sink_packet) + 12));
-
-      fseek(context->pInputFile, context->nFileOffset, SEEK_SET);
-      debug("fileoffset = %d", context->nFileOffset);
+      debug("we get a packet, length = %d, offset = %lld", context->length,
+            (long long)context->nFileOffset);
     } else {
-      error("something wrong?");
+      error("no more packet in the stream, quit!");
+      context->eos = MPP_TRUE;
+      PACKET_SetEos(sink_packet, MPP_TRUE);
+      PACKET_SetLength(sink_packet, 0);
+      return MPP_CODER_EOS;
     }
   }
 
@@ -275,16 +339,37 @@ S32 al_vi_request_output_data(ALBaseContext *ctx, MppData *src_data) {
   return MPP_OK;
 }
 
-S32 al_vi_return_output_data(ALBaseContext *ctx, MppData *src_data) {}
+S32 al_vi_return_output_data(ALBaseContext *ctx, MppData *src_data) {
+  if (!ctx) {
+    error("input para ALBaseContext is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  if (!src_data) {
+    error("input para MppData is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  ALViFileContext *context = (ALViFileContext *)ctx;
+
+  if (!context->bIsFrame)
+    restore_packet(context, PACKET_GetPacket(src_data));
+
+  return MPP_OK;
+}
 
 void al_vi_destory(ALBaseContext *ctx) {
   ALViFileContext *context = (ALViFileContext *)ctx;
   S32 ret = 0;
 
-  if (context->pInputFile) {
-    fflush(context->pInputFile);
-    fclose(context->pInputFile);
-    context->pInputFile = NULL;
+  if (context->pFileData) {
+    munmap(context->pFileData, context->nMapSize);
+    context->pFileData = NULL;
+  }
+
+  if (context->nInputFd >= 0) {
+    close(context->nInputFd);
+    context->nInputFd = -1;
   }
 
   if (context->pParseCtx) {
@@ -0,0 +1,661 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-28 11:02:37
+ * @LastEditTime: 2024-05-28 11:02:37
+ * @Description: G2D plugin on the CPU, NV12/NV21/I420/YV12/RGBA conversion and
+ *               scaling by the SIMD row kernels, rows split into bands over a
+ *               pool of threads.
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "al_interface_g2d.h"
+#include "g2d_cpu_kernels.h"
+#include "log.h"
+
+#define MODULE_TAG "g2d_cpu"
+
+/***
+ * bands per thread, smaller bands even out the threads
+ */
+#define G2D_CPU_BANDS_PER_THREAD 4
+#define G2D_CPU_MIN_BAND_HEIGHT 16
+
+typedef struct _ALG2dCpuContext ALG2dCpuContext;
+
+struct _ALG2dCpuContext {
+  ALG2dBaseContext stAlG2dBaseContext;
+  MppG2dPara stG2dPara;
+
+  /***
+   * threads of the pool, the caller of al_g2d_process works as one more
+   */
+  S32 nThreadNum;
+  pthread_t *pThreads;
+  pthread_mutex_t stMutex;
+  pthread_cond_t stStartCond;
+  pthread_cond_t stDoneCond;
+  BOOL bExit;
+
+  /***
+   * the job being run, guarded by stMutex
+   */
+  const G2dCpuJob *pJob;
+  S32 nBandHeight;
+  S32 nBandNum;
+  S32 nNextBand;
+  S32 nDoneBand;
+  RETURN eResult;
+
+  /***
+   * resized picture in the input format, before conversion
+   */
+  U8 *pScratch;
+  S32 nScratchSize;
+
+  // output of al_g2d_convert, handed out by al_g2d_request_output_frame
+  MppFrame *pOutputFrame;
+  BOOL bOutputReady;
+};
+
+/**
+ * @description: take bands of the current job until none is left, called
+ * with stMutex held.
+ */
+static void run_bands(ALG2dCpuContext *context) {
+  const G2dCpuJob *job = NULL;
+  S32 height, band, y_start, y_end;
+  S32 ret = 0;
+
+  while (context->pJob && context->nNextBand < context->nBandNum) {
+    job = context->pJob;
+    band = context->nNextBand++;
+    height = job->stDst.stPlane[0].nHeight;
+    y_start = band * context->nBandHeight;
+    y_end = y_start + context->nBandHeight;
+    if (y_end > height) y_end = height;
+
+    pthread_mutex_unlock(&context->stMutex);
+    ret = g2d_cpu_run(job, y_start, y_end, MPP_TRUE);
+    pthread_mutex_lock(&context->stMutex);
+
+    if (ret) context->eResult = ret;
+    if (++context->nDoneBand == context->nBandNum)
+      pthread_cond_signal(&context->stDoneCond);
+  }
+}
+
+static void *worker(void *private_data) {
+  ALG2dCpuContext *context = (ALG2dCpuContext *)private_data;
+
+  pthread_mutex_lock(&context->stMutex);
+  while (!context->bExit) {
+    run_bands(context);
+    if (!context->bExit)
+      pthread_cond_wait(&context->stStartCond, &context->stMutex);
+  }
+  pthread_mutex_unlock(&context->stMutex);
+
+  return NULL;
+}
+
+static RETURN run_job(ALG2dCpuContext *context, const G2dCpuJob *job) {
+  S32 height = job->stDst.stPlane[0].nHeight;
+  S32 band_height;
+  RETURN ret;
+
+  if (!context->nThreadNum) return g2d_cpu_run(job, 0, height, MPP_TRUE);
+
+  // even bands, so no chroma row of 420 is shared by two bands
+  band_height = (height + (context->nThreadNum + 1) * G2D_CPU_BANDS_PER_THREAD -
+                 1) /
+                ((context->nThreadNum + 1) * G2D_CPU_BANDS_PER_THREAD);
+  if (band_height < G2D_CPU_MIN_BAND_HEIGHT)
+    band_height = G2D_CPU_MIN_BAND_HEIGHT;
+  band_height = (band_height + 1) & ~1;
+
+  pthread_mutex_lock(&context->stMutex);
+  context->pJob = job;
+  context->nBandHeight = band_height;
+  context->nBandNum = (height + band_height - 1) / band_height;
+  context->nNextBand = 0;
+  context->nDoneBand = 0;
+  context->eResult = MPP_OK;
+  pthread_cond_broadcast(&context->stStartCond);
+
+  run_bands(context);
+  while (context->nDoneBand < context->nBandNum)
+    pthread_cond_wait(&context->stDoneCond, &context->stMutex);
+
+  context->pJob = NULL;
+  ret = context->eResult;
+  pthread_mutex_unlock(&context->stMutex);
+
+  return ret;
+}
+
+static BOOL is_yuv420(MppPixelFormat format) {
+  return format == PIXEL_FORMAT_I420 || format == PIXEL_FORMAT_YV12 ||
+         format == PIXEL_FORMAT_NV12 || format == PIXEL_FORMAT_NV21;
+}
+
+static BOOL is_semi_planar(MppPixelFormat format) {
+  return format == PIXEL_FORMAT_NV12 || format == PIXEL_FORMAT_NV21;
+}
+
+/**
+ * @description: planes of format without data, packed one after another.
+ * planar 420 is always Y, U, V here, whatever the order in memory.
+ */
+static RETURN get_layout(G2dCpuImage *image, MppPixelFormat format, S32 width,
+                         S32 height) {
+  S32 i;
+
+  memset(image, 0, sizeof(G2dCpuImage));
+  if (is_yuv420(format) && ((width | height) & 1)) {
+    error("%s needs even size, but %dx%d, please check!",
+          mpp_pixelformat2str(format), width, height);
+    return MPP_CHECK_FAILED;
+  }
+
+  switch (format) {
+    case PIXEL_FORMAT_I420:
+    case PIXEL_FORMAT_YV12:
+      image->nPlanes = 3;
+      image->stPlane[1].nBytes = 1;
+      image->stPlane[2].nBytes = 1;
+      break;
+    case PIXEL_FORMAT_NV12:
+    case PIXEL_FORMAT_NV21:
+      image->nPlanes = 2;
+      image->stPlane[1].nBytes = 2;
+      break;
+    case PIXEL_FORMAT_RGBA:
+    case PIXEL_FORMAT_BGRA:
+    case PIXEL_FORMAT_ARGB:
+    case PIXEL_FORMAT_ABGR:
+      image->nPlanes = 1;
+      image->stPlane[0].nBytes = 4;
+      break;
+    default:
+      error("g2d cpu does not support %s, please check!",
+            mpp_pixelformat2str(format));
+      return MPP_NOT_SUPPORTED_FORMAT;
+  }
+
+  if (is_yuv420(format)) image->stPlane[0].nBytes = 1;
+  for (i = 0; i < image->nPlanes; i++) {
+    image->stPlane[i].nWidth = i ? width / 2 : width;
+    image->stPlane[i].nHeight = i ? height / 2 : height;
+    image->stPlane[i].nStride =
+        image->stPlane[i].nWidth * image->stPlane[i].nBytes;
+  }
+
+  return MPP_OK;
+}
+
+static void place_planes(G2dCpuImage *image, U8 *data) {
+  S32 i;
+
+  for (i = 0; i < image->nPlanes; i++) {
+    image->stPlane[i].pData = data;
+    data += (S64)image->stPlane[i].nStride * image->stPlane[i].nHeight;
+  }
+}
+
+static S32 get_layout_size(const G2dCpuImage *image) {
+  S32 size = 0;
+  S32 i;
+
+  for (i = 0; i < image->nPlanes; i++)
+    size += image->stPlane[i].nStride * image->stPlane[i].nHeight;
+
+  return size;
+}
+
+/**
+ * @description: planes of a MppFrame, the line stride of the frame is the one
+ * of the first plane, planes the frame does not carry follow the previous one.
+ */
+static RETURN get_frame_image(G2dCpuImage *image, MppFrame *frame,
+                              MppPixelFormat format, S32 width, S32 height) {
+  S32 stride = FRAME_GetLineStride(frame);
+  S32 row_bytes;
+  G2dCpuPlane *plane = NULL;
+  U8 *data = NULL;
+  S32 i;
+  S32 ret = get_layout(image, format, width, height);
+  if (ret) return ret;
+
+  row_bytes = image->stPlane[0].nStride;
+  if (stride < row_bytes) stride = row_bytes;
+
+  for (i = 0; i < image->nPlanes; i++) {
+    plane = &(image->stPlane[i]);
+    plane->nStride = (S64)stride * plane->nStride / row_bytes;
+
+    data = i < FRAME_GetDataUsedNum(frame)
+               ? (U8 *)FRAME_GetDataPointer(frame, i)
+               : NULL;
+    if (!data && i > 0)
+      data = image->stPlane[i - 1].pData +
+             (S64)image->stPlane[i - 1].nStride * image->stPlane[i - 1].nHeight;
+    if (!data) {
+      error("frame %d has no data, please check!", FRAME_GetID(frame));
+      return MPP_NULL_POINTER;
+    }
+    plane->pData = data;
+  }
+
+  // YV12 keeps V before U
+  if (format == PIXEL_FORMAT_YV12) {
+    data = image->stPlane[1].pData;
+    image->stPlane[1].pData = image->stPlane[2].pData;
+    image->stPlane[2].pData = data;
+  }
+
+  return MPP_OK;
+}
+
+/**
+ * @description: a rect of the image, empty rect means the whole image.
+ */
+static RETURN crop_image(G2dCpuImage *image, MppPixelFormat format,
+                         const MppRect *rect) {
+  G2dCpuPlane *plane = NULL;
+  S32 shift;
+  S32 i;
+
+  if (!rect || rect->nXmax <= rect->nXmin || rect->nYmax <= rect->nYmin)
+    return MPP_OK;
+
+  if (rect->nXmax > (U32)image->stPlane[0].nWidth ||
+      rect->nYmax > (U32)image->stPlane[0].nHeight ||
+      (is_yuv420(format) &&
+       ((rect->nXmin | rect->nYmin | rect->nXmax | rect->nYmax) & 1))) {
+    error("rect (%u,%u)-(%u,%u) does not fit %dx%d %s, please check!",
+          rect->nXmin, rect->nYmin, rect->nXmax, rect->nYmax,
+          image->stPlane[0].nWidth, image->stPlane[0].nHeight,
+          mpp_pixelformat2str(format));
+    return MPP_CHECK_FAILED;
+  }
+
+  for (i = 0; i < image->nPlanes; i++) {
+    plane = &(image->stPlane[i]);
+    shift = i ? 1 : 0;
+    plane->pData += (S64)(rect->nYmin >> shift) * plane->nStride +
+                    (rect->nXmin >> shift) * plane->nBytes;
+    plane->nWidth = (rect->nXmax - rect->nXmin) >> shift;
+    plane->nHeight = (rect->nYmax - rect->nYmin) >> shift;
+  }
+
+  return MPP_OK;
+}
+
+static void swap_chroma(G2dCpuImage *image) {
+  U8 *data = image->stPlane[1].pData;
+
+  image->stPlane[1].pData = image->stPlane[2].pData;
+  image->stPlane[2].pData = data;
+}
+
+/**
+ * @description: the kernel converting in_format to out_format at one size
+ */
+static RETURN plan_convert(G2dCpuJob *job, MppPixelFormat in_format,
+                           MppPixelFormat out_format) {
+  BOOL in_sp = is_semi_planar(in_format);
+  BOOL out_sp = is_semi_planar(out_format);
+
+  if (in_format == out_format) {
+    job->eKernel = G2D_CPU_KERNEL_COPY;
+  } else if (in_sp && (out_format == PIXEL_FORMAT_I420 ||
+                       out_format == PIXEL_FORMAT_YV12)) {
+    job->eKernel = G2D_CPU_KERNEL_SP_TO_P;
+    if (in_format == PIXEL_FORMAT_NV21) swap_chroma(&(job->stDst));
+  } else if (out_sp && (in_format == PIXEL_FORMAT_I420 ||
+                        in_format == PIXEL_FORMAT_YV12)) {
+    job->eKernel = G2D_CPU_KERNEL_P_TO_SP;
+    if (out_format == PIXEL_FORMAT_NV21) swap_chroma(&(job->stSrc));
+  } else if (in_sp && (out_format == PIXEL_FORMAT_RGBA ||
+                       out_format == PIXEL_FORMAT_BGRA)) {
+    job->eKernel = G2D_CPU_KERNEL_SP_TO_RGBA;
+    job->bSwapUV = in_format == PIXEL_FORMAT_NV21;
+    job->bSwapRB = out_format == PIXEL_FORMAT_BGRA;
+  } else {
+    error("g2d cpu can not convert %s to %s, please check!",
+          mpp_pixelformat2str(in_format), mpp_pixelformat2str(out_format));
+    return MPP_NOT_SUPPORTED_FORMAT;
+  }
+
+  return MPP_OK;
+}
+
+static BOOL is_half(const G2dCpuImage *src, const G2dCpuImage *dst) {
+  S32 i;
+
+  for (i = 0; i < dst->nPlanes; i++) {
+    if (src->stPlane[i].nWidth != 2 * dst->stPlane[i].nWidth ||
+        src->stPlane[i].nHeight != 2 * dst->stPlane[i].nHeight)
+      return MPP_FALSE;
+  }
+
+  return MPP_TRUE;
+}
+
+static RETURN prepare_scratch(ALG2dCpuContext *context, S32 size) {
+  if (context->nScratchSize >= size) return MPP_OK;
+
+  free(context->pScratch);
+  context->pScratch = (U8 *)malloc(size);
+  if (!context->pScratch) {
+    context->nScratchSize = 0;
+    error("can not malloc %d bytes scratch, please check!", size);
+    return MPP_MALLOC_FAILED;
+  }
+  context->nScratchSize = size;
+
+  return MPP_OK;
+}
+
+/**
+ * @description: run the command of para from sink_frame to src_frame,
+ * resize first in the input format, then convert.
+ */
+static RETURN do_g2d(ALG2dCpuContext *context, MppFrame *sink_frame,
+                     MppFrame *src_frame) {
+  MppG2dPara *para = &(context->stG2dPara);
+  MppPixelFormat in_format = para->eInputPixelFormat;
+  MppPixelFormat out_format = para->eOutputPixelFormat;
+  const MppRect *src_rect = NULL;
+  const MppRect *dst_rect = NULL;
+  S32 out_width = para->nOutputWidth;
+  S32 out_height = para->nOutputHeight;
+  G2dCpuJob resize, convert;
+  S32 ret = 0;
+
+  switch (para->eG2dCmd) {
+    case MPP_G2D_CMD_SCALE:
+      src_rect = &(para->sScalePara.sSrcPosition);
+      dst_rect = &(para->sScalePara.sDstPosition);
+      break;
+    case MPP_G2D_CMD_COPY:
+      src_rect = &(para->sCopyPara.sSrcPosition);
+      dst_rect = &(para->sCopyPara.sDstPosition);
+      break;
+    case MPP_G2D_CMD_DRAW:
+      // zero (DRAW) is what a memset para holds, take it as plain convert
+      break;
+    default:
+      error("g2d cpu does not support g2d cmd %d, please check!",
+            para->eG2dCmd);
+      return MPP_CHECK_FAILED;
+  }
+
+  if (out_width <= 0 || out_height <= 0) {
+    out_width = para->nInputWidth;
+    out_height = para->nInputHeight;
+  }
+
+  if (!FRAME_GetDataPointer(src_frame, 0)) {
+    ret = FRAME_Alloc(src_frame, out_format, out_width, out_height);
+    if (ret) return ret;
+  }
+
+  memset(&convert, 0, sizeof(G2dCpuJob));
+  ret = get_frame_image(&(convert.stSrc), sink_frame, in_format,
+                        para->nInputWidth, para->nInputHeight);
+  if (!ret)
+    ret = get_frame_image(&(convert.stDst), src_frame, out_format, out_width,
+                          out_height);
+  if (!ret) ret = crop_image(&(convert.stSrc), in_format, src_rect);
+  if (!ret) ret = crop_image(&(convert.stDst), out_format, dst_rect);
+  if (ret) return ret;
+
+  if (convert.stSrc.stPlane[0].nWidth != convert.stDst.stPlane[0].nWidth ||
+      convert.stSrc.stPlane[0].nHeight != convert.stDst.stPlane[0].nHeight) {
+    if (para->eG2dCmd == MPP_G2D_CMD_COPY) {
+      error("copy can not scale, please check the rects!");
+      return MPP_CHECK_FAILED;
+    }
+
+    memset(&resize, 0, sizeof(G2dCpuJob));
+    resize.stSrc = convert.stSrc;
+    if (in_format == out_format) {
+      resize.stDst = convert.stDst;
+    } else {
+      // resize into the scratch, which is the input of the conversion
+      ret = get_layout(&(resize.stDst), in_format,
+                       convert.stDst.stPlane[0].nWidth,
+                       convert.stDst.stPlane[0].nHeight);
+      if (!ret)
+        ret = prepare_scratch(context, get_layout_size(&(resize.stDst)));
+      if (ret) return ret;
+      place_planes(&(resize.stDst), context->pScratch);
+      convert.stSrc = resize.stDst;
+    }
+
+    resize.eKernel = is_half(&(resize.stSrc), &(resize.stDst))
+                         ? G2D_CPU_KERNEL_DOWNSCALE_2X
+                         : G2D_CPU_KERNEL_BILINEAR;
+    ret = run_job(context, &resize);
+    if (ret || in_format == out_format) goto finish;
+  }
+
+  ret = plan_convert(&convert, in_format, out_format);
+  if (!ret) ret = run_job(context, &convert);
+
+finish:
+  if (ret) return ret;
+
+  FRAME_SetWidth(src_frame, out_width);
+  FRAME_SetHeight(src_frame, out_height);
+  FRAME_SetPixelFormat(src_frame, out_format);
+  FRAME_SetPts(src_frame, FRAME_GetPts(sink_frame));
+
+  return MPP_OK;
+}
+
+static void stop_threads(ALG2dCpuContext *context) {
+  S32 i;
+
+  if (!context->pThreads) return;
+
+  pthread_mutex_lock(&context->stMutex);
+  context->bExit = MPP_TRUE;
+  pthread_cond_broadcast(&context->stStartCond);
+  pthread_mutex_unlock(&context->stMutex);
+
+  for (i = 0; i < context->nThreadNum; i++)
+    pthread_join(context->pThreads[i], NULL);
+
+  free(context->pThreads);
+  context->pThreads = NULL;
+  context->nThreadNum = 0;
+  context->bExit = MPP_FALSE;
+}
+
+/**
+ * @description: nThreadCount threads in all, the caller is one of them
+ */
+static RETURN start_threads(ALG2dCpuContext *context, S32 thread_count) {
+  S32 i;
+
+  if (thread_count == MPP_THREAD_COUNT_AUTO)
+    thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+  if (thread_count <= 1) return MPP_OK;
+
+  context->pThreads = (pthread_t *)malloc(sizeof(pthread_t) * thread_count);
+  if (!context->pThreads) return MPP_MALLOC_FAILED;
+
+  for (i = 0; i < thread_count - 1; i++) {
+    if (pthread_create(&(context->pThreads[i]), NULL, worker, context)) {
+      error("can not create g2d cpu thread %d, please check!", i);
+      break;
+    }
+    context->nThreadNum++;
+  }
+
+  return MPP_OK;
+}
+
+ALBaseContext *al_g2d_create() {
+  ALG2dCpuContext *context = (ALG2dCpuContext *)malloc(sizeof(ALG2dCpuContext));
+  if (!context) return NULL;
+  memset(context, 0, sizeof(ALG2dCpuContext));
+
+  pthread_mutex_init(&context->stMutex, NULL);
+  pthread_cond_init(&context->stStartCond, NULL);
+  pthread_cond_init(&context->stDoneCond, NULL);
+
+  return &(context->stAlG2dBaseContext.stAlBaseContext);
+}
+
+RETURN al_g2d_init(ALBaseContext *ctx, MppG2dPara *para) {
+  if (!ctx) {
+    error("input para ALBaseContext is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  if (!para) {
+    error("input para MppG2dPara is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  ALG2dCpuContext *context = (ALG2dCpuContext *)ctx;
+  S32 ret = 0;
+
+  context->stG2dPara = *para;
+  para->eInputFrameBufferType = MPP_FRAME_BUFFERTYPE_NORMAL_EXTERNAL;
+  para->eOutputFrameBufferType = MPP_FRAME_BUFFERTYPE_NORMAL_EXTERNAL;
+
+  ret = start_threads(context, para->nThreadCount);
+  if (ret) return ret;
+
+  debug("init finish, %s kernels, %d threads, %s %dx%d -> %s %dx%d",
+        g2d_cpu_simd_name(), context->nThreadNum + 1,
+        mpp_pixelformat2str(para->eInputPixelFormat), para->nInputWidth,
+        para->nInputHeight, mpp_pixelformat2str(para->eOutputPixelFormat),
+        para->nOutputWidth, para->nOutputHeight);
+
+  return MPP_OK;
+}
+
+/**
+ * @description: the next frames use the new para, the threads are restarted
+ * when the count changes.
+ */
+S32 al_g2d_set_para(ALBaseContext *ctx, MppG2dPara *para) {
+  if (!ctx || !para) return MPP_NULL_POINTER;
+
+  ALG2dCpuContext *context = (ALG2dCpuContext *)ctx;
+  S32 ret = 0;
+
+  if (para->nThreadCount != context->stG2dPara.nThreadCount) {
+    stop_threads(context);
+    ret = start_threads(context, para->nThreadCount);
+  }
+  context->stG2dPara = *para;
+
+  return ret;
+}
+
+S32 al_g2d_process(ALBaseContext *ctx, MppData *sink_data, MppData *src_data) {
+  if (!ctx || !sink_data || !src_data) {
+    error("input para is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  ALG2dCpuContext *context = (ALG2dCpuContext *)ctx;
+
+  return do_g2d(context, FRAME_GetFrame(sink_data), FRAME_GetFrame(src_data));
+}
+
+S32 al_g2d_convert(ALBaseContext *ctx, MppData *sink_data) {
+  if (!ctx || !sink_data) return MPP_NULL_POINTER;
+
+  ALG2dCpuContext *context = (ALG2dCpuContext *)ctx;
+  S32 ret = 0;
+
+  if (context->bOutputReady) return MPP_DATAQUEUE_FULL;
+
+  if (!context->pOutputFrame) {
+    context->pOutputFrame = FRAME_Create();
+    if (!context->pOutputFrame) return MPP_MALLOC_FAILED;
+  }
+
+  ret = do_g2d(context, FRAME_GetFrame(sink_data), context->pOutputFrame);
+  if (ret) return ret;
+  context->bOutputReady = MPP_TRUE;
+
+  return MPP_OK;
+}
+
+/**
+ * @description: the input is converted at once, the caller can take it back
+ * right after al_g2d_send_input_frame.
+ */
+S32 al_g2d_send_input_frame(ALBaseContext *ctx, MppData *sink_data) {
+  return al_g2d_convert(ctx, sink_data);
+}
+
+S32 al_g2d_return_input_frame(ALBaseContext *ctx, MppData *sink_data) {
+  return MPP_OK;
+}
+
+S32 al_g2d_request_output_frame(ALBaseContext *ctx, MppData *src_data) {
+  if (!ctx || !src_data) return MPP_NULL_POINTER;
+
+  ALG2dCpuContext *context = (ALG2dCpuContext *)ctx;
+
+  if (!context->bOutputReady) return MPP_CODER_NO_DATA;
+
+  memcpy(src_data, FRAME_GetBaseData(context->pOutputFrame),
+         FRAME_GetStructSize());
+
+  return MPP_OK;
+}
+
+S32 al_g2d_get_output_frame(ALBaseContext *ctx, MppData *src_data) {
+  return al_g2d_request_output_frame(ctx, src_data);
+}
+
+S32 al_g2d_return_output_frame(ALBaseContext *ctx, MppData *src_data) {
+  if (!ctx) return MPP_NULL_POINTER;
+
+  ALG2dCpuContext *context = (ALG2dCpuContext *)ctx;
+
+  context->bOutputReady = MPP_FALSE;
+
+  return MPP_OK;
+}
+
+void al_g2d_destory(ALBaseContext *ctx) {
+  if (!ctx) return;
+
+  ALG2dCpuContext *context = (ALG2dCpuContext *)ctx;
+
+  stop_threads(context);
+  pthread_mutex_destroy(&context->stMutex);
+  pthread_cond_destroy(&context->stStartCond);
+  pthread_cond_destroy(&context->stDoneCond);
+
+  free(context->pScratch);
+
+  if (context->pOutputFrame) {
+    FRAME_Free(context->pOutputFrame);
+    FRAME_Destory(context->pOutputFrame);
+  }
+
+  free(context);
+}
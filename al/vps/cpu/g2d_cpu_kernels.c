@@ -0,0 +1,657 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-28 11:02:37
+ * @LastEditTime: 2024-05-30 09:48:26
+ * @Description: row kernels of the CPU G2D plugin
+ */
+
+#define ENABLE_DEBUG 0
+
+#include "g2d_cpu_kernels.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "para.h"
+
+#if defined(__riscv_vector)
+#include <riscv_vector.h>
+#define G2D_CPU_SIMD_RVV
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define G2D_CPU_SIMD_SSE2
+#endif
+
+#define MODULE_TAG "g2d_cpu"
+
+/***
+ * BT.601 limited range in 6 bit fixed point, every product fits in 16 bits
+ * so the SIMD versions work on 16 bit lanes:
+ * L = 74 * (Y - 16) + ((Y - 16) >> 1) + 32, 74.5 so 235 gives 255
+ * R = (L + 102 * V) >> 6
+ * G = (L - 25 * U - 52 * V) >> 6
+ * B = (L + 129 * U) >> 6, saturated at 32767 before shift
+ * with U and V minus 128.
+ */
+#define YUV2RGB_Y 74
+#define YUV2RGB_RV 102
+#define YUV2RGB_GU 25
+#define YUV2RGB_GV 52
+#define YUV2RGB_BU 129
+
+#define BILINEAR_ONE (1 << G2D_CPU_BILINEAR_BITS)
+
+typedef struct _G2dCpuRowOps {
+  void (*deinterleave)(const U8 *src, U8 *dst0, U8 *dst1, S32 n);
+  void (*interleave)(const U8 *src0, const U8 *src1, U8 *dst, S32 n);
+  void (*sp_to_rgba)(const U8 *y, const U8 *uv, U8 *dst, S32 width,
+                     BOOL swap_uv, BOOL swap_rb);
+  void (*downscale_2x)(const U8 *row0, const U8 *row1, U8 *dst, S32 n,
+                       S32 bytes);
+  void (*lerp)(const U8 *row0, const U8 *row1, U8 *dst, S32 n, S32 weight);
+} G2dCpuRowOps;
+
+static inline U8 clip_u8(S32 value) {
+  return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+/******************* scalar reference ******************/
+
+static void deinterleave_row_c(const U8 *src, U8 *dst0, U8 *dst1, S32 n) {
+  S32 i;
+
+  for (i = 0; i < n; i++) {
+    dst0[i] = src[2 * i];
+    dst1[i] = src[2 * i + 1];
+  }
+}
+
+static void interleave_row_c(const U8 *src0, const U8 *src1, U8 *dst, S32 n) {
+  S32 i;
+
+  for (i = 0; i < n; i++) {
+    dst[2 * i] = src0[i];
+    dst[2 * i + 1] = src1[i];
+  }
+}
+
+static void sp_to_rgba_row_c(const U8 *y, const U8 *uv, U8 *dst, S32 width,
+                             BOOL swap_uv, BOOL swap_rb) {
+  S32 luma, u, v, b;
+  S32 x;
+
+  for (x = 0; x < width; x++) {
+    u = uv[(x & ~1) + (swap_uv ? 1 : 0)] - 128;
+    v = uv[(x & ~1) + (swap_uv ? 0 : 1)] - 128;
+    luma = YUV2RGB_Y * (y[x] - 16) + ((y[x] - 16) >> 1) + 32;
+    b = luma + YUV2RGB_BU * u;
+    if (b > 32767) b = 32767;
+
+    dst[4 * x + (swap_rb ? 2 : 0)] = clip_u8((luma + YUV2RGB_RV * v) >> 6);
+    dst[4 * x + 1] =
+        clip_u8((luma - YUV2RGB_GU * u - YUV2RGB_GV * v) >> 6);
+    dst[4 * x + (swap_rb ? 0 : 2)] = clip_u8(b >> 6);
+    dst[4 * x + 3] = 255;
+  }
+}
+
+static void downscale_2x_row_c(const U8 *row0, const U8 *row1, U8 *dst, S32 n,
+                               S32 bytes) {
+  S32 i, c, s;
+
+  for (i = 0; i < n; i++) {
+    for (c = 0; c < bytes; c++) {
+      s = 2 * i * bytes + c;
+      dst[i * bytes + c] =
+          (row0[s] + row0[s + bytes] + row1[s] + row1[s + bytes] + 2) >> 2;
+    }
+  }
+}
+
+static void lerp_row_c(const U8 *row0, const U8 *row1, U8 *dst, S32 n,
+                       S32 weight) {
+  S32 i;
+
+  for (i = 0; i < n; i++) {
+    dst[i] = (row0[i] * (BILINEAR_ONE - weight) + row1[i] * weight +
+              BILINEAR_ONE / 2) >>
+             G2D_CPU_BILINEAR_BITS;
+  }
+}
+
+static const G2dCpuRowOps stScalarOps = {
+    deinterleave_row_c, interleave_row_c, sp_to_rgba_row_c,
+    downscale_2x_row_c, lerp_row_c,
+};
+
+/******************* SSE2 ******************/
+
+#if defined(G2D_CPU_SIMD_SSE2)
+
+static void deinterleave_row_sse2(const U8 *src, U8 *dst0, U8 *dst1, S32 n) {
+  const __m128i mask = _mm_set1_epi16(0x00ff);
+  __m128i a, b;
+  S32 i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    a = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+    b = _mm_loadu_si128((const __m128i *)(src + 2 * i + 16));
+    _mm_storeu_si128((__m128i *)(dst0 + i),
+                     _mm_packus_epi16(_mm_and_si128(a, mask),
+                                      _mm_and_si128(b, mask)));
+    _mm_storeu_si128((__m128i *)(dst1 + i),
+                     _mm_packus_epi16(_mm_srli_epi16(a, 8),
+                                      _mm_srli_epi16(b, 8)));
+  }
+
+  if (i < n) deinterleave_row_c(src + 2 * i, dst0 + i, dst1 + i, n - i);
+}
+
+static void interleave_row_sse2(const U8 *src0, const U8 *src1, U8 *dst,
+                                S32 n) {
+  __m128i a, b;
+  S32 i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    a = _mm_loadu_si128((const __m128i *)(src0 + i));
+    b = _mm_loadu_si128((const __m128i *)(src1 + i));
+    _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi8(a, b));
+    _mm_storeu_si128((__m128i *)(dst + 2 * i + 16), _mm_unpackhi_epi8(a, b));
+  }
+
+  if (i < n) interleave_row_c(src0 + i, src1 + i, dst + 2 * i, n - i);
+}
+
+static void sp_to_rgba_row_sse2(const U8 *y, const U8 *uv, U8 *dst,
+                                S32 width, BOOL swap_uv, BOOL swap_rb) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i mask = _mm_set1_epi16(0x00ff);
+  const __m128i alpha = _mm_set1_epi8((char)0xff);
+  const __m128i c16 = _mm_set1_epi16(16);
+  const __m128i c32 = _mm_set1_epi16(32);
+  const __m128i c128 = _mm_set1_epi16(128);
+  __m128i luma, chroma, u, v, tmp, rv, guv, bu, y_lo, y_hi;
+  __m128i r, g, b, rg, ba;
+  S32 x;
+
+  for (x = 0; x + 16 <= width; x += 16) {
+    luma = _mm_loadu_si128((const __m128i *)(y + x));
+    chroma = _mm_loadu_si128((const __m128i *)(uv + x));
+    u = _mm_sub_epi16(_mm_and_si128(chroma, mask), c128);
+    v = _mm_sub_epi16(_mm_srli_epi16(chroma, 8), c128);
+    if (swap_uv) {
+      tmp = u;
+      u = v;
+      v = tmp;
+    }
+
+    rv = _mm_mullo_epi16(v, _mm_set1_epi16(YUV2RGB_RV));
+    guv = _mm_add_epi16(_mm_mullo_epi16(u, _mm_set1_epi16(YUV2RGB_GU)),
+                        _mm_mullo_epi16(v, _mm_set1_epi16(YUV2RGB_GV)));
+    bu = _mm_mullo_epi16(u, _mm_set1_epi16(YUV2RGB_BU));
+
+    y_lo = _mm_sub_epi16(_mm_unpacklo_epi8(luma, zero), c16);
+    y_lo = _mm_add_epi16(_mm_mullo_epi16(y_lo, _mm_set1_epi16(YUV2RGB_Y)),
+                         _mm_add_epi16(_mm_srai_epi16(y_lo, 1), c32));
+    y_hi = _mm_sub_epi16(_mm_unpackhi_epi8(luma, zero), c16);
+    y_hi = _mm_add_epi16(_mm_mullo_epi16(y_hi, _mm_set1_epi16(YUV2RGB_Y)),
+                         _mm_add_epi16(_mm_srai_epi16(y_hi, 1), c32));
+
+    // every chroma sample is shared by two pixels
+    r = _mm_packus_epi16(
+        _mm_srai_epi16(_mm_add_epi16(y_lo, _mm_unpacklo_epi16(rv, rv)), 6),
+        _mm_srai_epi16(_mm_add_epi16(y_hi, _mm_unpackhi_epi16(rv, rv)), 6));
+    g = _mm_packus_epi16(
+        _mm_srai_epi16(_mm_sub_epi16(y_lo, _mm_unpacklo_epi16(guv, guv)), 6),
+        _mm_srai_epi16(_mm_sub_epi16(y_hi, _mm_unpackhi_epi16(guv, guv)), 6));
+    b = _mm_packus_epi16(
+        _mm_srai_epi16(_mm_adds_epi16(y_lo, _mm_unpacklo_epi16(bu, bu)), 6),
+        _mm_srai_epi16(_mm_adds_epi16(y_hi, _mm_unpackhi_epi16(bu, bu)), 6));
+    if (swap_rb) {
+      tmp = r;
+      r = b;
+      b = tmp;
+    }
+
+    rg = _mm_unpacklo_epi8(r, g);
+    ba = _mm_unpacklo_epi8(b, alpha);
+    _mm_storeu_si128((__m128i *)(dst + 4 * x), _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i *)(dst + 4 * x + 16),
+                     _mm_unpackhi_epi16(rg, ba));
+    rg = _mm_unpackhi_epi8(r, g);
+    ba = _mm_unpackhi_epi8(b, alpha);
+    _mm_storeu_si128((__m128i *)(dst + 4 * x + 32),
+                     _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i *)(dst + 4 * x + 48),
+                     _mm_unpackhi_epi16(rg, ba));
+  }
+
+  if (x < width)
+    sp_to_rgba_row_c(y + x, uv + x, dst + 4 * x, width - x, swap_uv, swap_rb);
+}
+
+/**
+ * @description: sums of horizontal neighbours of 16 bytes, in 8 words
+ */
+static inline __m128i pair_sum_1(__m128i a) {
+  return _mm_add_epi16(_mm_and_si128(a, _mm_set1_epi16(0x00ff)),
+                       _mm_srli_epi16(a, 8));
+}
+
+static inline __m128i pair_sum_2(__m128i a) {
+  __m128i lo = _mm_unpacklo_epi8(a, _mm_setzero_si128());
+  __m128i hi = _mm_unpackhi_epi8(a, _mm_setzero_si128());
+
+  lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 1, 2, 0));
+  hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 1, 2, 0));
+  lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+  hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+
+  return _mm_unpacklo_epi64(lo, hi);
+}
+
+static inline __m128i pair_sum_4(__m128i a) {
+  __m128i lo = _mm_unpacklo_epi8(a, _mm_setzero_si128());
+  __m128i hi = _mm_unpackhi_epi8(a, _mm_setzero_si128());
+
+  lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+  hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+
+  return _mm_unpacklo_epi64(lo, hi);
+}
+
+#define DOWNSCALE_2X_SSE2(PAIR_SUM)                                          \
+  do {                                                                       \
+    for (i = 0; i + 16 <= total; i += 16) {                                  \
+      lo = _mm_add_epi16(                                                    \
+          PAIR_SUM(_mm_loadu_si128((const __m128i *)(row0 + 2 * i))),        \
+          PAIR_SUM(_mm_loadu_si128((const __m128i *)(row1 + 2 * i))));      \
+      hi = _mm_add_epi16(                                                    \
+          PAIR_SUM(_mm_loadu_si128((const __m128i *)(row0 + 2 * i + 16))),   \
+          PAIR_SUM(_mm_loadu_si128((const __m128i *)(row1 + 2 * i + 16))));  \
+      lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);                        \
+      hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);                        \
+      _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));      \
+    }                                                                        \
+  } while (0)
+
+static void downscale_2x_row_sse2(const U8 *row0, const U8 *row1, U8 *dst,
+                                  S32 n, S32 bytes) {
+  const __m128i two = _mm_set1_epi16(2);
+  S32 total = n * bytes;
+  __m128i lo, hi;
+  S32 i = 0;
+
+  if (bytes == 1)
+    DOWNSCALE_2X_SSE2(pair_sum_1);
+  else if (bytes == 2)
+    DOWNSCALE_2X_SSE2(pair_sum_2);
+  else if (bytes == 4)
+    DOWNSCALE_2X_SSE2(pair_sum_4);
+
+  if (i < total)
+    downscale_2x_row_c(row0 + 2 * i, row1 + 2 * i, dst + i, n - i / bytes,
+                       bytes);
+}
+
+static void lerp_row_sse2(const U8 *row0, const U8 *row1, U8 *dst, S32 n,
+                          S32 weight) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i w0 = _mm_set1_epi16(BILINEAR_ONE - weight);
+  const __m128i w1 = _mm_set1_epi16(weight);
+  const __m128i half = _mm_set1_epi16(BILINEAR_ONE / 2);
+  __m128i a, b, lo, hi;
+  S32 i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    a = _mm_loadu_si128((const __m128i *)(row0 + i));
+    b = _mm_loadu_si128((const __m128i *)(row1 + i));
+    lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), w0),
+                       _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), w1));
+    hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), w0),
+                       _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), w1));
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, half), G2D_CPU_BILINEAR_BITS);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, half), G2D_CPU_BILINEAR_BITS);
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+  }
+
+  if (i < n) lerp_row_c(row0 + i, row1 + i, dst + i, n - i, weight);
+}
+
+static const G2dCpuRowOps stSimdOps = {
+    deinterleave_row_sse2, interleave_row_sse2, sp_to_rgba_row_sse2,
+    downscale_2x_row_sse2, lerp_row_sse2,
+};
+
+/******************* RVV ******************/
+
+#elif defined(G2D_CPU_SIMD_RVV)
+
+static void deinterleave_row_rvv(const U8 *src, U8 *dst0, U8 *dst1, S32 n) {
+  size_t vl;
+
+  for (; n > 0; n -= vl, src += 2 * vl, dst0 += vl, dst1 += vl) {
+    vl = __riscv_vsetvl_e8m4(n);
+    __riscv_vse8_v_u8m4(dst0, __riscv_vlse8_v_u8m4(src, 2, vl), vl);
+    __riscv_vse8_v_u8m4(dst1, __riscv_vlse8_v_u8m4(src + 1, 2, vl), vl);
+  }
+}
+
+static void interleave_row_rvv(const U8 *src0, const U8 *src1, U8 *dst,
+                               S32 n) {
+  size_t vl;
+
+  for (; n > 0; n -= vl, src0 += vl, src1 += vl, dst += 2 * vl) {
+    vl = __riscv_vsetvl_e8m4(n);
+    __riscv_vsse8_v_u8m4(dst, 2, __riscv_vle8_v_u8m4(src0, vl), vl);
+    __riscv_vsse8_v_u8m4(dst + 1, 2, __riscv_vle8_v_u8m4(src1, vl), vl);
+  }
+}
+
+static inline vint16m2_t widen_i16(vuint8m1_t value, size_t vl) {
+  return __riscv_vreinterpret_v_u16m2_i16m2(__riscv_vzext_vf2_u16m2(value, vl));
+}
+
+static inline vuint8m1_t narrow_clip_u8(vint16m2_t value, size_t vl) {
+  value = __riscv_vmin_vx_i16m2(__riscv_vmax_vx_i16m2(value, 0, vl), 255, vl);
+  return __riscv_vncvt_x_x_w_u8m1(
+      __riscv_vreinterpret_v_i16m2_u16m2(value), vl);
+}
+
+static void sp_to_rgba_row_rvv(const U8 *y, const U8 *uv, U8 *dst, S32 width,
+                               BOOL swap_uv, BOOL swap_rb) {
+  vint16m2_t luma, u, v, r, g, b;
+  vuint16m2_t index;
+  size_t vl;
+  S32 x;
+
+  // VLMAX of e8m1 is even, so x stays on a chroma pair
+  for (x = 0; x < width; x += vl) {
+    vl = __riscv_vsetvl_e8m1(width - x);
+    // byte offset of the chroma pair of every pixel
+    index = __riscv_vsll_vx_u16m2(
+        __riscv_vsrl_vx_u16m2(__riscv_vid_v_u16m2(vl), 1, vl), 1, vl);
+    u = widen_i16(
+        __riscv_vluxei16_v_u8m1(uv + x + (swap_uv ? 1 : 0), index, vl), vl);
+    v = widen_i16(
+        __riscv_vluxei16_v_u8m1(uv + x + (swap_uv ? 0 : 1), index, vl), vl);
+    u = __riscv_vsub_vx_i16m2(u, 128, vl);
+    v = __riscv_vsub_vx_i16m2(v, 128, vl);
+
+    luma = widen_i16(__riscv_vle8_v_u8m1(y + x, vl), vl);
+    luma = __riscv_vsub_vx_i16m2(luma, 16, vl);
+    luma = __riscv_vadd_vv_i16m2(__riscv_vmul_vx_i16m2(luma, YUV2RGB_Y, vl),
+                                 __riscv_vsra_vx_i16m2(luma, 1, vl), vl);
+    luma = __riscv_vadd_vx_i16m2(luma, 32, vl);
+
+    r = __riscv_vadd_vv_i16m2(luma, __riscv_vmul_vx_i16m2(v, YUV2RGB_RV, vl),
+                              vl);
+    g = __riscv_vsub_vv_i16m2(luma, __riscv_vmul_vx_i16m2(u, YUV2RGB_GU, vl),
+                              vl);
+    g = __riscv_vsub_vv_i16m2(g, __riscv_vmul_vx_i16m2(v, YUV2RGB_GV, vl), vl);
+    b = __riscv_vsadd_vv_i16m2(luma, __riscv_vmul_vx_i16m2(u, YUV2RGB_BU, vl),
+                               vl);
+
+    __riscv_vsse8_v_u8m1(dst + 4 * x + (swap_rb ? 2 : 0), 4,
+                         narrow_clip_u8(__riscv_vsra_vx_i16m2(r, 6, vl), vl),
+                         vl);
+    __riscv_vsse8_v_u8m1(dst + 4 * x + 1, 4,
+                         narrow_clip_u8(__riscv_vsra_vx_i16m2(g, 6, vl), vl),
+                         vl);
+    __riscv_vsse8_v_u8m1(dst + 4 * x + (swap_rb ? 0 : 2), 4,
+                         narrow_clip_u8(__riscv_vsra_vx_i16m2(b, 6, vl), vl),
+                         vl);
+    __riscv_vsse8_v_u8m1(dst + 4 * x + 3, 4, __riscv_vmv_v_x_u8m1(255, vl),
+                         vl);
+  }
+}
+
+static void downscale_2x_row_rvv(const U8 *row0, const U8 *row1, U8 *dst,
+                                 S32 n, S32 bytes) {
+  ptrdiff_t stride = 2 * bytes;
+  vuint16m2_t sum;
+  size_t vl;
+  S32 i, c;
+
+  for (i = 0; i < n; i += vl) {
+    vl = __riscv_vsetvl_e8m1(n - i);
+    for (c = 0; c < bytes; c++) {
+      const U8 *a = row0 + 2 * i * bytes + c;
+      const U8 *b = row1 + 2 * i * bytes + c;
+
+      sum = __riscv_vwaddu_vv_u16m2(__riscv_vlse8_v_u8m1(a, stride, vl),
+                                    __riscv_vlse8_v_u8m1(a + bytes, stride, vl),
+                                    vl);
+      sum = __riscv_vadd_vv_u16m2(
+          sum,
+          __riscv_vwaddu_vv_u16m2(__riscv_vlse8_v_u8m1(b, stride, vl),
+                                  __riscv_vlse8_v_u8m1(b + bytes, stride, vl),
+                                  vl),
+          vl);
+      sum = __riscv_vsrl_vx_u16m2(__riscv_vadd_vx_u16m2(sum, 2, vl), 2, vl);
+      __riscv_vsse8_v_u8m1(dst + i * bytes + c, bytes,
+                           __riscv_vncvt_x_x_w_u8m1(sum, vl), vl);
+    }
+  }
+}
+
+static void lerp_row_rvv(const U8 *row0, const U8 *row1, U8 *dst, S32 n,
+                         S32 weight) {
+  vuint16m8_t acc;
+  size_t vl;
+
+  for (; n > 0; n -= vl, row0 += vl, row1 += vl, dst += vl) {
+    vl = __riscv_vsetvl_e8m4(n);
+    acc = __riscv_vwmulu_vx_u16m8(__riscv_vle8_v_u8m4(row0, vl),
+                                  BILINEAR_ONE - weight, vl);
+    acc = __riscv_vwmaccu_vx_u16m8(acc, weight, __riscv_vle8_v_u8m4(row1, vl),
+                                   vl);
+    acc = __riscv_vsrl_vx_u16m8(
+        __riscv_vadd_vx_u16m8(acc, BILINEAR_ONE / 2, vl),
+        G2D_CPU_BILINEAR_BITS, vl);
+    __riscv_vse8_v_u8m4(dst, __riscv_vncvt_x_x_w_u8m4(acc, vl), vl);
+  }
+}
+
+static const G2dCpuRowOps stSimdOps = {
+    deinterleave_row_rvv, interleave_row_rvv, sp_to_rgba_row_rvv,
+    downscale_2x_row_rvv, lerp_row_rvv,
+};
+
+#else
+
+#define stSimdOps stScalarOps
+
+#endif
+
+/******************* bands ******************/
+
+static inline U8 *plane_row(const G2dCpuPlane *plane, S32 y) {
+  return plane->pData + (S64)y * plane->nStride;
+}
+
+/**
+ * @description: rows of plane i covered by rows [y_start, y_end) of plane 0
+ */
+static void plane_rows(const G2dCpuImage *image, S32 i, S32 y_start,
+                       S32 y_end, S32 *start, S32 *end) {
+  const G2dCpuPlane *plane = &(image->stPlane[i]);
+
+  if (plane->nHeight == image->stPlane[0].nHeight) {
+    *start = y_start;
+    *end = y_end;
+  } else {
+    *start = y_start / 2;
+    *end = (y_end + 1) / 2;
+  }
+  if (*end > plane->nHeight) *end = plane->nHeight;
+}
+
+/**
+ * @description: centre aligned source position of dst_pos, 16.16 fixed point
+ * down to G2D_CPU_BILINEAR_BITS of weight.
+ */
+static void bilinear_position(S32 dst_pos, S32 src_size, S32 dst_size,
+                              S32 *index0, S32 *index1, S32 *weight) {
+  S64 pos = (((S64)dst_pos * 2 + 1) * src_size << 16) / (2 * dst_size) -
+            (1 << 15);
+
+  if (pos < 0) pos = 0;
+  *index0 = pos >> 16;
+  *weight = (pos & 0xffff) >> (16 - G2D_CPU_BILINEAR_BITS);
+  if (*index0 >= src_size - 1) {
+    *index0 = src_size - 1;
+    *weight = 0;
+  }
+  *index1 = *weight ? *index0 + 1 : *index0;
+}
+
+static RETURN run_bilinear(const G2dCpuRowOps *ops, const G2dCpuPlane *src,
+                           const G2dCpuPlane *dst, S32 start, S32 end) {
+  S32 bytes = dst->nBytes;
+  BOOL same_width = src->nWidth == dst->nWidth;
+  S32 *x_index = NULL;
+  S32 *x_weight = NULL;
+  U8 *line = NULL;
+  U8 *out = NULL;
+  const U8 *in = NULL;
+  S32 y0, y1, wy, x0, x1, wx;
+  S32 x, y, c;
+
+  if (!same_width) {
+    x_index = (S32 *)malloc(sizeof(S32) * dst->nWidth * 2);
+    x_weight = x_index ? x_index + dst->nWidth : NULL;
+    line = (U8 *)malloc(src->nWidth * bytes);
+    if (!x_index || !line) {
+      free(x_index);
+      free(line);
+      return MPP_MALLOC_FAILED;
+    }
+    for (x = 0; x < dst->nWidth; x++) {
+      bilinear_position(x, src->nWidth, dst->nWidth, &x0, &x1, &wx);
+      x_index[x] = x0;
+      x_weight[x] = x1 > x0 ? wx : 0;
+    }
+  }
+
+  for (y = start; y < end; y++) {
+    bilinear_position(y, src->nHeight, dst->nHeight, &y0, &y1, &wy);
+    out = plane_row(dst, y);
+
+    // vertical pass into the line, horizontal pass from it
+    if (same_width) {
+      ops->lerp(plane_row(src, y0), plane_row(src, y1), out,
+                src->nWidth * bytes, wy);
+      continue;
+    }
+
+    ops->lerp(plane_row(src, y0), plane_row(src, y1), line,
+              src->nWidth * bytes, wy);
+    for (x = 0; x < dst->nWidth; x++) {
+      in = line + x_index[x] * bytes;
+      wx = x_weight[x];
+      for (c = 0; c < bytes; c++) {
+        out[x * bytes + c] =
+            (in[c] * (BILINEAR_ONE - wx) + in[c + (wx ? bytes : 0)] * wx +
+             BILINEAR_ONE / 2) >>
+            G2D_CPU_BILINEAR_BITS;
+      }
+    }
+  }
+
+  free(x_index);
+  free(line);
+
+  return MPP_OK;
+}
+
+const char *g2d_cpu_simd_name() {
+#if defined(G2D_CPU_SIMD_SSE2)
+  return "sse2";
+#elif defined(G2D_CPU_SIMD_RVV)
+  return "rvv";
+#else
+  return "scalar";
+#endif
+}
+
+RETURN g2d_cpu_run(const G2dCpuJob *job, S32 y_start, S32 y_end, BOOL simd) {
+  const G2dCpuRowOps *ops = simd ? &stSimdOps : &stScalarOps;
+  const G2dCpuImage *src = &(job->stSrc);
+  const G2dCpuImage *dst = &(job->stDst);
+  const G2dCpuPlane *sp, *dp;
+  S32 start, end, y, i;
+  S32 ret = 0;
+
+  switch (job->eKernel) {
+    case G2D_CPU_KERNEL_COPY:
+      for (i = 0; i < dst->nPlanes; i++) {
+        sp = &(src->stPlane[i]);
+        dp = &(dst->stPlane[i]);
+        plane_rows(dst, i, y_start, y_end, &start, &end);
+        for (y = start; y < end; y++)
+          memcpy(plane_row(dp, y), plane_row(sp, y), dp->nWidth * dp->nBytes);
+      }
+      break;
+    case G2D_CPU_KERNEL_SP_TO_P:
+      // the luma can be shared with the source, only the chroma is split
+      if (dst->stPlane[0].pData != src->stPlane[0].pData) {
+        for (y = y_start; y < y_end; y++)
+          memcpy(plane_row(&(dst->stPlane[0]), y),
+                 plane_row(&(src->stPlane[0]), y), dst->stPlane[0].nWidth);
+      }
+      plane_rows(dst, 1, y_start, y_end, &start, &end);
+      for (y = start; y < end; y++)
+        ops->deinterleave(plane_row(&(src->stPlane[1]), y),
+                          plane_row(&(dst->stPlane[1]), y),
+                          plane_row(&(dst->stPlane[2]), y),
+                          dst->stPlane[1].nWidth);
+      break;
+    case G2D_CPU_KERNEL_P_TO_SP:
+      for (y = y_start; y < y_end; y++)
+        memcpy(plane_row(&(dst->stPlane[0]), y),
+               plane_row(&(src->stPlane[0]), y), dst->stPlane[0].nWidth);
+      plane_rows(dst, 1, y_start, y_end, &start, &end);
+      for (y = start; y < end; y++)
+        ops->interleave(plane_row(&(src->stPlane[1]), y),
+                        plane_row(&(src->stPlane[2]), y),
+                        plane_row(&(dst->stPlane[1]), y),
+                        src->stPlane[1].nWidth);
+      break;
+    case G2D_CPU_KERNEL_SP_TO_RGBA:
+      for (y = y_start; y < y_end; y++)
+        ops->sp_to_rgba(plane_row(&(src->stPlane[0]), y),
+                        plane_row(&(src->stPlane[1]), y / 2),
+                        plane_row(&(dst->stPlane[0]), y),
+                        dst->stPlane[0].nWidth, job->bSwapUV, job->bSwapRB);
+      break;
+    case G2D_CPU_KERNEL_DOWNSCALE_2X:
+      for (i = 0; i < dst->nPlanes; i++) {
+        sp = &(src->stPlane[i]);
+        dp = &(dst->stPlane[i]);
+        plane_rows(dst, i, y_start, y_end, &start, &end);
+        for (y = start; y < end; y++)
+          ops->downscale_2x(plane_row(sp, 2 * y), plane_row(sp, 2 * y + 1),
+                            plane_row(dp, y), dp->nWidth, dp->nBytes);
+      }
+      break;
+    case G2D_CPU_KERNEL_BILINEAR:
+      for (i = 0; i < dst->nPlanes && !ret; i++) {
+        plane_rows(dst, i, y_start, y_end, &start, &end);
+        ret = run_bilinear(ops, &(src->stPlane[i]), &(dst->stPlane[i]), start,
+                           end);
+      }
+      break;
+    default:
+      error("unsupported g2d cpu kernel %d, please check!", job->eKernel);
+      return MPP_NOT_SUPPORTED_FORMAT;
+  }
+
+  return ret;
+}
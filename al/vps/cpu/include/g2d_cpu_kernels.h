@@ -0,0 +1,117 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-28 11:02:37
+ * @LastEditTime: 2024-05-30 09:48:26
+ * @Description: row kernels of the CPU G2D plugin, every kernel has a scalar
+ *               reference and a SIMD version (RVV on K1, SSE2 on x86) which
+ *               gives the same bytes.
+ */
+
+#ifndef _G2D_CPU_KERNELS_H_
+#define _G2D_CPU_KERNELS_H_
+
+#include "type.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define G2D_CPU_MAX_PLANES 3
+
+/***
+ * weights of bilinear resize are 7 bits, so the products stay in 16 bits
+ */
+#define G2D_CPU_BILINEAR_BITS 7
+
+typedef enum _G2dCpuKernelType {
+  /***
+   * same format, same size, plane by plane
+   */
+  G2D_CPU_KERNEL_COPY = 0,
+
+  /***
+   * semi-planar 420 (NV12/NV21) to planar 420 (I420/YV12), the even bytes
+   * of the chroma plane go to dst plane 1, the odd bytes to dst plane 2.
+   * dst plane 0 may be src plane 0 itself, the luma is not copied then.
+   */
+  G2D_CPU_KERNEL_SP_TO_P,
+
+  /***
+   * planar 420 to semi-planar 420, src plane 1 gives the even bytes.
+   */
+  G2D_CPU_KERNEL_P_TO_SP,
+
+  /***
+   * semi-planar 420 to 32 bit RGB, BT.601 limited range.
+   */
+  G2D_CPU_KERNEL_SP_TO_RGBA,
+
+  /***
+   * same format, half size, 2x2 box filter.
+   */
+  G2D_CPU_KERNEL_DOWNSCALE_2X,
+
+  /***
+   * same format, any size.
+   */
+  G2D_CPU_KERNEL_BILINEAR,
+
+  G2D_CPU_KERNEL_MAX,
+} G2dCpuKernelType;
+
+typedef struct _G2dCpuPlane {
+  U8 *pData;
+  S32 nStride;
+
+  /***
+   * in elements, nBytes bytes each (2 for the NV12 chroma, 4 for RGBA)
+   */
+  S32 nWidth;
+  S32 nHeight;
+  S32 nBytes;
+} G2dCpuPlane;
+
+typedef struct _G2dCpuImage {
+  S32 nPlanes;
+  G2dCpuPlane stPlane[G2D_CPU_MAX_PLANES];
+} G2dCpuImage;
+
+typedef struct _G2dCpuJob {
+  G2dCpuKernelType eKernel;
+  G2dCpuImage stSrc;
+  G2dCpuImage stDst;
+
+  /***
+   * G2D_CPU_KERNEL_SP_TO_RGBA: the chroma plane is VU (NV21)
+   */
+  BOOL bSwapUV;
+
+  /***
+   * G2D_CPU_KERNEL_SP_TO_RGBA: write B,G,R,A instead of R,G,B,A
+   */
+  BOOL bSwapRB;
+} G2dCpuJob;
+
+/**
+ * @description: name of the SIMD instruction set the kernels are built for,
+ * "scalar" if there is none.
+ */
+const char *g2d_cpu_simd_name();
+
+/**
+ * @description: run the kernel of job on dst rows [y_start, y_end) of the
+ * first plane, rows of subsampled planes follow. y_start has to be even.
+ * @param {BOOL} simd : MPP_FALSE runs the scalar reference
+ * @return {*}: MPP_OK, MPP_MALLOC_FAILED or MPP_NOT_SUPPORTED_FORMAT
+ */
+RETURN g2d_cpu_run(const G2dCpuJob *job, S32 y_start, S32 y_end, BOOL simd);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /*_G2D_CPU_KERNELS_H_*/
@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-11 17:20:27
- * @LastEditTime: 2023-02-02 15:04:49
+ * @LastEditTime: 2024-05-21 16:12:40
  * @Description: MppDataQueue is the managerment queue of MppData,
  *               which is used for data buffering
  */
@@ -23,17 +23,47 @@
 extern "C" {
 #endif
 
+#define DATAQUEUE_DEFAULT_CAPACITY 10
+
 typedef struct _MppDataQueueNode MppDataQueueNode;
 typedef struct _MppDataQueue MppDataQueue;
 
+/***
+ * The queue is a bounded ring of pointers, nothing is allocated on
+ * push/pop. A blocked caller is parked on a futex and only woken if it is
+ * really waiting.
+ */
+typedef enum _MppDataQueueMode {
+  /***
+   * one thread pushes and one thread pops, lock-free.
+   */
+  DATAQUEUE_MODE_SPSC = 0,
+
+  /***
+   * any thread pushes and pops, lock-free (bounded MPMC array queue).
+   */
+  DATAQUEUE_MODE_MPMC = 1,
+} MppDataQueueMode;
+
 /**
- * @description:
- * @param {BOOL} inblk
- * @param {BOOL} outblk
+ * @description: create a SPSC queue with DATAQUEUE_DEFAULT_CAPACITY
+ * @param {BOOL} inblk: push blocks when the queue is full
+ * @param {BOOL} outblk: pop blocks when the queue is empty
  * @return {*}
  */
 MppDataQueue *DATAQUEUE_Init(BOOL inblk, BOOL outblk);
 
+/**
+ * @description: create a queue
+ * @param {BOOL} inblk: push blocks when the queue is full
+ * @param {BOOL} outblk: pop blocks when the queue is empty
+ * @param {S32} capacity: max number of elements in the queue
+ * @param {MppDataQueueMode} mode: SPSC or MPMC
+ * @return {*}
+ */
+MppDataQueue *DATAQUEUE_InitWithCapacity(BOOL inblk, BOOL outblk,
+                                         S32 capacity, MppDataQueueMode mode);
+
 /**
  * @description:
  * @return {*}
@@ -61,6 +91,21 @@ RETURN DATAQUEUE_Push(MppDataQueue *queue, MppDataQueueNode *node);
  */
 MppDataQueueNode *DATAQUEUE_Pop(MppDataQueue *queue);
 
+/**
+ * @description: push a data pointer directly, no node is needed
+ * @param {MppDataQueue} *queue
+ * @param {MppData} *data
+ * @return {*}: MPP_OK or MPP_DATAQUEUE_FULL
+ */
+RETURN DATAQUEUE_PushData(MppDataQueue *queue, MppData *data);
+
+/**
+ * @description: pop a data pointer pushed by DATAQUEUE_PushData
+ * @param {MppDataQueue} *queue
+ * @return {*}: NULL if the queue is empty
+ */
+MppData *DATAQUEUE_PopData(MppDataQueue *queue);
+
 /**
  * @description:
  * @param {MppDataQueue} *queue
@@ -90,7 +135,8 @@ BOOL DATAQUEUE_IsFull(MppDataQueue *queue);
 S32 DATAQUEUE_GetCurrentSize(MppDataQueue *queue);
 
 /**
- * @description:
+ * @description: change the limit of the queue, it can not exceed the
+ * capacity given at init time.
  * @param {MppDataQueue} *queue
  * @param {S32} max_size
  * @return {*}
@@ -5,7 +5,7 @@
  * @
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-10-07 14:08:18
- * @LastEditTime: 2023-10-07 16:08:51
+ * @LastEditTime: 2024-06-02 09:12:40
  * @Description:
  */
 
@@ -99,9 +99,19 @@ typedef struct _DmaBuf {
 } DmaBuf;
 
 typedef struct _DmaBufWrapper {
+  /***
+   * process-wide heap fd, opened once and never closed by the wrapper.
+   */
   S32 nDmaHeapFd;
+  DMAHEAP eHeap;
   DmaBuf sDmaBuf;
 
+  /***
+   * allocDmaBuf takes buffers from the pool and freeDmaBuf gives them
+   * back (fd and mapping kept), see createPooledDmaBufWrapper.
+   */
+  BOOL bPooled;
+
   // environment variable
   BOOL bEnableUnfreeDmaBufDebug;
 } DmaBufWrapper;
@@ -114,7 +124,19 @@ typedef struct _DmaBufWrapper {
 DmaBufWrapper *createDmaBufWrapper(DMAHEAP heap);
 
 /***
- * @description: alloc a dmabuf with a specific size
+ * @description: create a dmabuf wrapper whose buffers are recycled by a
+ * process-wide pool of size classes. The caller must only release the
+ * buffer by freeDmaBuf (no munmap/close of its own). The pool keeps at most
+ * MPP_DMABUF_POOL_NUM (env, default 16) idle buffers.
+ * @param {DMAHEAP} heap: SYSTEM or CMA
+ * @return {*}
+ */
+DmaBufWrapper *createPooledDmaBufWrapper(DMAHEAP heap);
+
+/***
+ * @description: alloc a dmabuf with a specific size, new and recycled
+ * buffers are cleared before the fd is returned (MPP_DMABUF_NO_MEMSET=1
+ * skips it), mmapDmaBuf never touches the data.
  * @param {DmaBufWrapper} *context
  * @param {S32} size: size of buffer needed
  * @return {*}
@@ -122,7 +144,8 @@ DmaBufWrapper *createDmaBufWrapper(DMAHEAP heap);
 S32 allocDmaBuf(DmaBufWrapper *context, S32 size);
 
 /***
- * @description: mmap a dmabuf
+ * @description: mmap a dmabuf, return the existing mapping if it is mapped
+ * already, so it can be called lazily when the cpu needs the data.
  * @param {DmaBufWrapper} *context
  * @return {*}
  */
@@ -142,6 +165,20 @@ RETURN freeDmaBuf(DmaBufWrapper *context);
  */
 S32 getDmaHeapFd(DmaBufWrapper *context);
 
+/***
+ * @description: change the max number of idle buffers kept by the pool,
+ * 0 disables pooling, extra idle buffers are released at once.
+ * @param {S32} num
+ * @return {*}
+ */
+void setDmaBufPoolSize(S32 num);
+
+/***
+ * @description: release all idle buffers kept by the pool
+ * @return {*}
+ */
+void drainDmaBufPool();
+
 /***
  * @description: destory the dmabuf wrapper
  * @param {DmaBufWrapper} *context
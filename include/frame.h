@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-13 18:11:03
- * @LastEditTime: 2024-04-03 15:06:54
+ * @LastEditTime: 2024-06-02 11:12:05
  * @Description: MppFrame is the carrier the frame(data before encode or after
  * decode)
  */
@@ -97,6 +97,14 @@ extern "C" {
 
 typedef struct _MppFrame MppFrame;
 
+/**
+ * @description: called when the last reference of the frame is dropped
+ * @param {MppFrame} *frame: the frame FRAME_UnRef was called on
+ * @param {void} *opaque: set by FRAME_SetReleaseCallback
+ * @return {*}
+ */
+typedef void (*MppFrameReleaseCallback)(MppFrame *frame, void *opaque);
+
 /**
  * @description:
  * @return {*}
@@ -110,12 +118,15 @@ MppFrame *FRAME_Create();
 S32 FRAME_GetStructSize();
 
 /**
- * @description:
+ * @description: alloc the planes of a NORMAL_INTERNAL or DMABUF_INTERNAL
+ * frame, a NORMAL_INTERNAL frame also takes the format, the size and the
+ * (packed) line stride.
  * @param {MppFrame} *frame
  * @param {S32} pixelformat
  * @param {S32} width
  * @param {S32} height
- * @return {*}
+ * @return {*}: MPP_NOT_SUPPORTED_FORMAT if the planes of the format are
+ * unknown
  */
 RETURN FRAME_Alloc(MppFrame *frame, MppPixelFormat pixelformat, S32 width,
                    S32 height);
@@ -189,16 +200,17 @@ void *FRAME_GetMetaData(MppFrame *frame);
 RETURN FRAME_SetMetaData(MppFrame *frame, void *meta_data);
 
 /***
- * @description:
+ * @description: take a reference, thread safe
  * @param {MppFrame} *frame
- * @return {*}
+ * @return {*}: the new reference count
  */
 U32 FRAME_Ref(MppFrame *frame);
 
 /***
- * @description:
+ * @description: drop a reference, thread safe. The release callback is
+ * called (once) by the thread that drops the last reference.
  * @param {MppFrame} *frame
- * @return {*}
+ * @return {*}: the new reference count
  */
 U32 FRAME_UnRef(MppFrame *frame);
 
@@ -209,6 +221,27 @@ U32 FRAME_UnRef(MppFrame *frame);
  */
 U32 FRAME_GetRef(MppFrame *frame);
 
+/***
+ * @description: set the callback called when the reference count drops to
+ * 0. A backend lends its own buffer (AVFrame, V4L2 CAPTURE index, OMX
+ * buffer header, ...) through the frame and gets it back in the callback.
+ * The callback and the opaque are cleared before the callback is called.
+ * @param {MppFrame} *frame
+ * @param {MppFrameReleaseCallback} callback: NULL to clear
+ * @param {void} *opaque: passed to the callback
+ * @return {*}
+ */
+RETURN FRAME_SetReleaseCallback(MppFrame *frame,
+                                MppFrameReleaseCallback callback,
+                                void *opaque);
+
+/***
+ * @description: get the opaque pointer set by FRAME_SetReleaseCallback
+ * @param {MppFrame} *frame
+ * @return {*}
+ */
+void *FRAME_GetReleaseOpaque(MppFrame *frame);
+
 /**
  * @description:
  * @param {MppFrame} *frame
@@ -285,7 +318,8 @@ RETURN FRAME_SetHeight(MppFrame *frame, S32 height);
 S32 FRAME_GetHeight(MppFrame *frame);
 
 /***
- * @description:
+ * @description: bytes from one row of plane 0 to the next, the other planes
+ * follow it by the chroma subsampling of the format.
  * @param {MppFrame} *frame
  * @param {S32} line_stride
  * @return {*}
@@ -345,12 +379,73 @@ MppFrameBufferType FRAME_GetBufferType(MppFrame *frame);
 RETURN FRAME_SetBufferType(MppFrame *frame, MppFrameBufferType eBufferType);
 
 /**
- * @description:
+ * @description: destory the frame, a frame got from a MppFramePool is given
+ * back to its pool instead (same as FRAMEPOOL_PutFrame).
  * @param {MppFrame} *frame
  * @return {*}
  */
 void FRAME_Destory(MppFrame *frame);
 
+/*
+ * MppFramePool keeps frames that are created and allocated once with the
+ * same format and size, FRAMEPOOL_GetFrame hands one out with its buffer
+ * attached (not cleared), FRAMEPOOL_PutFrame or FRAME_Destory gives it back.
+ * FRAME_Free does nothing on a pooled frame, the buffer stays with the pool.
+ */
+typedef struct _MppFramePool MppFramePool;
+
+typedef struct _MppFramePoolStat {
+  S32 nTotalNum;      // frames owned by the pool
+  S32 nInUseNum;      // frames handed out now
+  S32 nHighWaterNum;  // max of nInUseNum since the pool was created
+  S64 nGetCount;      // successful FRAMEPOOL_GetFrame calls
+  S64 nMissCount;     // calls that found no idle frame (grow or fail)
+} MppFramePoolStat;
+
+/**
+ * @description: create a frame pool
+ * @param {MppFrameBufferType} eBufferType: NORMAL_INTERNAL or DMABUF_INTERNAL
+ * @param {MppPixelFormat} pixelformat
+ * @param {S32} width
+ * @param {S32} height
+ * @param {S32} init_num: frames allocated at once
+ * @param {S32} max_num: the pool grows on demand up to max_num frames
+ * @return {*}
+ */
+MppFramePool *FRAMEPOOL_Create(MppFrameBufferType eBufferType,
+                               MppPixelFormat pixelformat, S32 width,
+                               S32 height, S32 init_num, S32 max_num);
+
+/**
+ * @description: take an idle frame, the pts/eos/id/metadata are reset
+ * @param {MppFramePool} *pool
+ * @return {*}: NULL if all max_num frames are in use
+ */
+MppFrame *FRAMEPOOL_GetFrame(MppFramePool *pool);
+
+/**
+ * @description: give the frame back to its pool
+ * @param {MppFrame} *frame
+ * @return {*}
+ */
+RETURN FRAMEPOOL_PutFrame(MppFrame *frame);
+
+/**
+ * @description: get the occupancy statistics of the pool
+ * @param {MppFramePool} *pool
+ * @param {MppFramePoolStat} *stat
+ * @return {*}
+ */
+RETURN FRAMEPOOL_GetStat(MppFramePool *pool, MppFramePoolStat *stat);
+
+/**
+ * @description: destory the pool and all idle frames, frames still in use
+ * are freed when they are put back.
+ * @param {MppFramePool} *pool
+ * @return {*}
+ */
+void FRAMEPOOL_Destory(MppFramePool *pool);
+
 #ifdef __cplusplus
 };
 #endif
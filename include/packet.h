@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-13 18:11:03
- * @LastEditTime: 2023-02-03 10:56:18
+ * @LastEditTime: 2024-05-24 17:40:12
  * @Description: MppPacket is the carrier the stream(data before decode or after
  * encode)
  */
@@ -235,6 +235,22 @@ BOOL PACKET_GetEos(MppPacket *packet);
  */
 RETURN PACKET_SetEos(MppPacket *packet, BOOL eos);
 
+/**
+ * @description: whether the packet can be decoded without the packets before
+ * it (IDR/key frame), set by the encoders
+ * @param {MppPacket} *packet
+ * @return {*}
+ */
+BOOL PACKET_GetKeyFrame(MppPacket *packet);
+
+/**
+ * @description:
+ * @param {MppPacket} *packet
+ * @param {BOOL} key_frame : MPP_TRUE(1) or MPP_FALSE(0)
+ * @return {*}
+ */
+RETURN PACKET_SetKeyFrame(MppPacket *packet, BOOL key_frame);
+
 /***
  * @description:
  * @param {MppPacket} *packet
@@ -296,11 +312,68 @@ RETURN PACKET_SetPixelFormat(MppPacket *packet, S32 pixel_format);
 S32 PACKET_GetPixelFormat(MppPacket *packet);
 
 /**
- * @description:
+ * @description: destory the packet, a packet got from a MppPacketPool is
+ * given back to its pool instead (same as PACKETPOOL_PutPacket).
  * @return {*}
  */
 void PACKET_Destory(MppPacket *packet);
 
+/*
+ * MppPacketPool keeps packets whose buffer of the same size is allocated
+ * once, PACKETPOOL_GetPacket hands one out with its buffer attached,
+ * PACKETPOOL_PutPacket or PACKET_Destory gives it back. PACKET_Free does
+ * nothing on a pooled packet, the buffer stays with the pool.
+ */
+typedef struct _MppPacketPool MppPacketPool;
+
+typedef struct _MppPacketPoolStat {
+  S32 nTotalNum;      // packets owned by the pool
+  S32 nInUseNum;      // packets handed out now
+  S32 nHighWaterNum;  // max of nInUseNum since the pool was created
+  S64 nGetCount;      // successful PACKETPOOL_GetPacket calls
+  S64 nMissCount;     // calls that found no idle packet (grow or fail)
+} MppPacketPoolStat;
+
+/**
+ * @description: create a packet pool
+ * @param {S32} size: buffer size of each packet
+ * @param {S32} init_num: packets allocated at once
+ * @param {S32} max_num: the pool grows on demand up to max_num packets
+ * @return {*}
+ */
+MppPacketPool *PACKETPOOL_Create(S32 size, S32 init_num, S32 max_num);
+
+/**
+ * @description: take an idle packet, the length/pts/dts/eos/id/metadata are
+ * reset
+ * @param {MppPacketPool} *pool
+ * @return {*}: NULL if all max_num packets are in use
+ */
+MppPacket *PACKETPOOL_GetPacket(MppPacketPool *pool);
+
+/**
+ * @description: give the packet back to its pool
+ * @param {MppPacket} *packet
+ * @return {*}
+ */
+RETURN PACKETPOOL_PutPacket(MppPacket *packet);
+
+/**
+ * @description: get the occupancy statistics of the pool
+ * @param {MppPacketPool} *pool
+ * @param {MppPacketPoolStat} *stat
+ * @return {*}
+ */
+RETURN PACKETPOOL_GetStat(MppPacketPool *pool, MppPacketPoolStat *stat);
+
+/**
+ * @description: destory the pool and all idle packets, packets still in use
+ * are freed when they are put back.
+ * @param {MppPacketPool} *pool
+ * @return {*}
+ */
+void PACKETPOOL_Destory(MppPacketPool *pool);
+
 #ifdef __cplusplus
 };
 #endif
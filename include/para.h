@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-31 09:15:38
- * @LastEditTime: 2024-04-30 15:40:23
+ * @LastEditTime: 2024-06-02 10:05:33
  * @Description:
  */
 
@@ -55,6 +55,10 @@
 +-----------------------+---------+---------+-----------+
 | VPS_K1_V2D            | x       | x       | √         |
 +-----------------------+---------+---------+-----------+
+| VPS_FFMPEG_SWSCALE    | x       | x       | √         |
++-----------------------+---------+---------+-----------+
+| VPS_CPU               | x       | x       | √         |
++-----------------------+---------+---------+-----------+
 
 */
 
@@ -157,6 +161,16 @@ typedef enum _MppModuleType {
    */
   VPS_K1_V2D,
 
+  /***
+   * use ffmpeg swscale for graphic 2D convert on the CPU.
+   */
+  VPS_FFMPEG_SWSCALE,
+
+  /***
+   * use the SIMD kernels of the CPU for graphic 2D convert (RVV on K1).
+   */
+  VPS_CPU,
+
   VPS_MAX,
 } MppModuleType;
 
@@ -183,6 +197,8 @@ static inline const char* mpp_moduletype2str(int cmd) {
     MPP_MODULETYPE2STR(VI_K1_CAM);
     MPP_MODULETYPE2STR(VI_FILE);
     MPP_MODULETYPE2STR(VPS_K1_V2D);
+    MPP_MODULETYPE2STR(VPS_FFMPEG_SWSCALE);
+    MPP_MODULETYPE2STR(VPS_CPU);
     default:
       return "UNKNOWN";
   }
@@ -689,6 +705,91 @@ typedef enum _MppDataTransmissinMode {
   MPP_INPUT_ASYNC_OUTPUT_ASYNC = 4,
 } MppDataTransmissinMode;
 
+/***
+ * @description: how a software codec spreads its work over threads.
+ */
+typedef enum _MppCodecThreadType {
+  /***
+   * let the codec pick, frame threads if it supports them.
+   */
+  CODEC_THREAD_AUTO = 0,
+
+  /***
+   * decode several frames in parallel, higher throughput but every thread
+   * adds one frame of delay.
+   */
+  CODEC_THREAD_FRAME = 1,
+
+  /***
+   * split one frame by slices, no extra delay, only helps when the stream
+   * has several slices per frame.
+   */
+  CODEC_THREAD_SLICE = 2,
+} MppCodecThreadType;
+
+/***
+ * nThreadCount value asking for one thread per online CPU.
+ */
+#define MPP_THREAD_COUNT_AUTO (-1)
+
+/***
+ * @description: rate control of the encoders.
+ */
+typedef enum _MppRcMode {
+  /***
+   * average nBitrate, the bitrate of each frame may vary.
+   */
+  MPP_RC_MODE_VBR = 0,
+
+  /***
+   * nBitrate over a one second buffer, for streaming.
+   */
+  MPP_RC_MODE_CBR = 1,
+
+  /***
+   * fixed quantizer nQp for all frames, no bitrate target.
+   */
+  MPP_RC_MODE_CQP = 2,
+
+  /***
+   * constant quality, nQp is the quality level (crf), no bitrate target.
+   */
+  MPP_RC_MODE_CRF = 3,
+} MppRcMode;
+
+/***
+ * @description: speed against compression of the software encoders.
+ */
+typedef enum _MppVencPreset {
+  MPP_VENC_PRESET_DEFAULT = 0,
+  MPP_VENC_PRESET_FASTEST = 1,
+  MPP_VENC_PRESET_FAST = 2,
+  MPP_VENC_PRESET_MEDIUM = 3,
+  MPP_VENC_PRESET_SLOW = 4,
+} MppVencPreset;
+
+/***
+ * @description: how the software encoders cut a frame into slices, slice
+ * threads need at least one slice per thread.
+ */
+typedef enum _MppVencSliceMode {
+  /***
+   * one slice per encoder thread.
+   */
+  MPP_VENC_SLICE_AUTO = 0,
+  MPP_VENC_SLICE_SINGLE = 1,
+
+  /***
+   * nSliceNum slices per frame, 0 is one per thread.
+   */
+  MPP_VENC_SLICE_FIXED_NUM = 2,
+
+  /***
+   * new slice when one would be bigger than nSliceSize bytes.
+   */
+  MPP_VENC_SLICE_SIZE_LIMITED = 3,
+} MppVencSliceMode;
+
 typedef enum _MppFrameEos {
   FRAME_NO_EOS = 0,
   FRAME_EOS_WITH_DATA = 1,
@@ -924,6 +1025,22 @@ typedef struct _MppVdecPara {
   BOOL bInputBlockModeEnable;
   BOOL bOutputBlockModeEnable;
 
+  /***
+   * threads of the software decoders, 0 keeps the decoder single threaded,
+   * MPP_THREAD_COUNT_AUTO for one thread per CPU.
+   * set to MPP, and overwritten with the effective values after init
+   */
+  S32 nThreadCount;
+  MppCodecThreadType eThreadType;
+
+  /***
+   * software decoders (CODEC_OPENH264): lend the decoder's own picture
+   * instead of a copy. The frame has to be returned before the next packet
+   * is decoded, the decoder waits for it otherwise.
+   * set to MPP
+   */
+  BOOL bOutputByReference;
+
   /***
    * read from MPP
    */
@@ -944,6 +1061,19 @@ typedef struct _MppVdecPara {
    */
   BOOL bIsBufferInDecoder[64];
   S32 nOutputBufferFd[64];
+
+  /***
+   * set by MPP sys flow, AL layer signals it when an output frame is ready,
+   * <= 0 means nobody is waiting for the notification.
+   */
+  S32 nOutputEventFd;
+
+  /***
+   * set by AL layer at init, an fd that gets readable when the backend has
+   * a frame ready while the AL layer is not running (the video fd of a V4L2
+   * device), MPP sys flow waits on it next to nOutputEventFd, <= 0 if none.
+   */
+  S32 nOutputPollFd;
 } MppVdecPara;
 
 /***
@@ -971,6 +1101,68 @@ typedef struct _MppVencPara {
   S32 nStride;
   S32 nBitrate;
   S32 nFrameRate;
+
+  /***
+   * rate control, nBitrate is the target of VBR and CBR, nQp is the quantizer
+   * of CQP or the quality level of CRF, 0 means the codec default.
+   * set to MPP
+   */
+  MppRcMode eRcMode;
+  S32 nQp;
+
+  /***
+   * frames between two key frames and max consecutive B frames, 0 GOP means
+   * the codec default, 0 B frames gives the lowest latency.
+   * set to MPP
+   */
+  S32 nGop;
+  S32 nMaxBFrames;
+  MppVencPreset ePreset;
+
+  /***
+   * threads of the software encoders, same as MppVdecPara.
+   * set to MPP, and overwritten with the effective values after init
+   */
+  S32 nThreadCount;
+  MppCodecThreadType eThreadType;
+
+  /***
+   * slices of the software encoders (CODEC_OPENH264), nSliceNum is used by
+   * MPP_VENC_SLICE_FIXED_NUM and nSliceSize by MPP_VENC_SLICE_SIZE_LIMITED.
+   * set to MPP
+   */
+  MppVencSliceMode eSliceMode;
+  S32 nSliceNum;
+  S32 nSliceSize;
+
+  /***
+   * depth of the frame and stream queues of the V4L2 encoders, 0 means the
+   * codec default.
+   * set to MPP, and overwritten with the granted values after init
+   */
+  S32 nInputBufferNum;
+  S32 nOutputBufferNum;
+
+  /***
+   * bytes of raw frames copied into the encoder's own buffers, stays 0 when
+   * the frames are imported by their dmabuf fds.
+   * read from MPP
+   */
+  S64 nInputCopiedBytes;
+
+  /***
+   * set by MPP sys flow, AL layer signals it when an output stream is ready,
+   * <= 0 means nobody is waiting for the notification.
+   */
+  S32 nOutputEventFd;
+
+  /***
+   * set by AL layer at init, an fd that gets readable when the backend has
+   * a stream ready while the AL layer is not running (the video fd of a
+   * V4L2 device), MPP sys flow waits on it next to nOutputEventFd, <= 0 if
+   * none.
+   */
+  S32 nOutputPollFd;
 } MppVencPara;
 
 typedef enum _MppG2dCmd {
@@ -1071,6 +1263,12 @@ typedef struct _MppG2dPara {
   S32 nOutputHeight;
   S32 nInputBufSize;
   S32 nOutputBufSize;
+
+  /***
+   * threads of the software converters (VPS_FFMPEG_SWSCALE, VPS_CPU),
+   * 0 or 1 is single thread, MPP_THREAD_COUNT_AUTO is one per CPU.
+   */
+  S32 nThreadCount;
   union {
     MppG2dFillColorPara sFillColorPara;
     MppG2dCopyPara sCopyPara;
@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-11 14:35:20
- * @LastEditTime: 2023-02-03 11:06:10
+ * @LastEditTime: 2024-06-02 10:05:33
  * @Description: base class for pipeline flow
  */
 
@@ -37,6 +37,8 @@
  *                  |   eType                |
  *                  |   pAlBaseContext       |
  *                  |   MppOps               |
+ *                  |   nEventFd             |
+ *                  |   nPollFd              |
  *                  +-----------^------------+
  *                              |
  *                              |
@@ -55,28 +57,30 @@
  * @description: common ops for bind node
  *
  */
+typedef struct _MppProcessNode MppProcessNode;
+
 typedef struct _MppOps {
   /***
    * @description: send unhandled data to process node
-   * @param {ALBaseContext} *base_context
+   * @param {MppProcessNode} *node
    * @param {MppData} *sink_data
    * @return {*}
    */
-  S32 (*handle_data)(ALBaseContext *base_context, MppData *sink_data);
+  S32 (*handle_data)(MppProcessNode *node, MppData *sink_data);
   /***
    * @description: get handled result from process node
-   * @param {ALBaseContext} *base_context
+   * @param {MppProcessNode} *node
    * @param {MppData} *src_data
    * @return {*}
    */
-  S32 (*get_result)(ALBaseContext *base_context, MppData *src_data);
+  S32 (*get_result)(MppProcessNode *node, MppData *src_data);
   /***
    * @description: return the buffer to process node if needed
-   * @param {ALBaseContext} *base_context
+   * @param {MppProcessNode} *node
    * @param {MppData} *src_data
    * @return {*}
    */
-  S32 (*return_result)(ALBaseContext *base_context, MppData *src_data);
+  S32 (*return_result)(MppProcessNode *node, MppData *src_data);
 } MppOps;
 
 /***
@@ -124,12 +128,24 @@ typedef struct _MppProcessNodeBindCouple {
  *
  * manage every process node.
  */
-typedef struct _MppProcessNode {
+struct _MppProcessNode {
   S32 nNodeId;
   MppProcessNodeType eType;
   ALBaseContext *pAlBaseContext;
   MppOps *ops;
-} MppProcessNode;
+
+  /***
+   * eventfd signalled by AL layer when output is ready, the data
+   * transmission thread blocks on it instead of polling get_result.
+   */
+  S32 nEventFd;
+
+  /***
+   * nOutputPollFd of the AL layer, waited on edge triggered as the driver
+   * keeps it readable, <= 0 if none.
+   */
+  S32 nPollFd;
+};
 
 /***
  * @description: main process flow struct
@@ -151,6 +167,18 @@ typedef struct _MppProcessFlowCtx {
    * data transmission thread between nodes.
    */
   pthread_t pthread[MAX_NODE_NUM];
+
+  /***
+   * eventfd used to wake up and stop the data transmission threads.
+   */
+  S32 nExitEventFd;
+  BOOL bExit;
+
+  /***
+   * epoll instance SYS_Getresult waits on for the last node, -1 until the
+   * first result is asked for.
+   */
+  S32 nResultEpollFd;
 } MppProcessFlowCtx;
 
 #endif /*_MPP_BASE_H_*/
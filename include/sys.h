@@ -36,6 +36,17 @@ MppProcessFlowCtx *SYS_CreateFlow();
  */
 MppProcessNode *SYS_CreateNode(MppProcessNodeType type);
 
+/**
+ * @description: create a process node bound to a specific module, the
+ * parameters are applied before the node is initialized.
+ * @param {MppProcessNodeType} type: VDEC or VENC
+ * @param {MppModuleType} module_type: the codec used by the node
+ * @param {void} *para: MppVdecPara or MppVencPara, NULL to use default
+ * @return {*}
+ */
+MppProcessNode *SYS_CreateNodeByModule(MppProcessNodeType type,
+                                       MppModuleType module_type, void *para);
+
 /**
  * @description:
  * @param {MppProcessFlowCtx} *ctx
@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-11 17:24:41
- * @LastEditTime: 2024-03-15 14:53:30
+ * @LastEditTime: 2024-05-31 10:12:53
  * @Description: MPP VDEC API, use these API to do video decode
  *               from stream(H.264 etc.) to frame(YUV420)
  */
@@ -121,11 +121,38 @@ extern "C" {
  *            +--------------------------+
  */
 
+/***
+ * AL decoder interface resolved from the plugin by VDEC_Init, every channel
+ * holds its own table, so channels on different plugins can run in one
+ * process.
+ */
+typedef struct _MppVdecOps {
+  ALBaseContext *(*create)();
+  S32 (*init)(ALBaseContext *ctx, MppVdecPara *para);
+  S32 (*getparam)(ALBaseContext *ctx, MppVdecPara **para);
+  S32 (*request_input_stream)(ALBaseContext *ctx, MppData *sink_data);
+  S32 (*return_input_stream)(ALBaseContext *ctx, MppData *sink_data);
+  S32 (*decode)(ALBaseContext *ctx, MppData *sink_data);
+  S32 (*process)(ALBaseContext *ctx, MppData *sink_data, MppData *src_data);
+  S32 (*get_output_frame)(ALBaseContext *ctx, MppData *src_data);
+  S32 (*request_output_frame)(ALBaseContext *ctx, MppData *src_data);
+  S32 (*request_output_frame_2)(ALBaseContext *ctx, MppData **src_data);
+  S32 (*return_output_frame)(ALBaseContext *ctx, MppData *src_data);
+  S32 (*flush)(ALBaseContext *ctx);
+  S32 (*reset)(ALBaseContext *ctx);
+  void (*destory)(ALBaseContext *ctx);
+} MppVdecOps;
+
+/***
+ * pNode must be the first member, the bind system gets the channel
+ * context back from the node.
+ */
 typedef struct _MppVdecCtx {
   MppProcessNode pNode;
   MppModuleType eCodecType;
   MppModule *pModule;
   MppVdecPara stVdecPara;
+  MppVdecOps stVdecOps;
 } MppVdecCtx;
 
 /******************* standard API ******************/
@@ -168,6 +195,26 @@ S32 VDEC_GetParam(MppVdecCtx *ctx, MppVdecPara **stVdecPara);
  */
 S32 VDEC_GetDefaultParam(MppVdecCtx *ctx);
 
+/**
+ * @description: borrow a stream buffer of the decoder, APP writes the packet
+ * into it and sends it by VDEC_Decode without a copy, or gives it back by
+ * VDEC_ReturnInputStream, not supported by every decoder.
+ * @param {MppVdecCtx} *ctx: channel context
+ * @param {MppData} *sink_data: input stream data, points to the buffer then
+ * @return {*}: MPP_OK:successful, MPP_CODER_NO_DATA:no free buffer,
+ * MPP_NOT_SUPPORTED_FORMAT:not supported by the decoder
+ */
+S32 VDEC_RequestInputStream(MppVdecCtx *ctx, MppData *sink_data);
+
+/**
+ * @description: give back a stream buffer borrowed by VDEC_RequestInputStream
+ * and not sent, the packet points to its own memory again.
+ * @param {MppVdecCtx} *ctx: channel context
+ * @param {MppData} *sink_data: input stream data
+ * @return {*}: MPP_OK:successful, !MPP_OK:failed
+ */
+S32 VDEC_ReturnInputStream(MppVdecCtx *ctx, MppData *sink_data);
+
 /**
  * @description: send stream data to MPP, input sync mode, meaning that input
  * stream data can be released after calling this interface.
@@ -247,45 +294,45 @@ S32 VDEC_ResetChannel(MppVdecCtx *ctx);
 
 /**
  * @description:
- * @param {ALBaseContext} *base_context
+ * @param {MppProcessNode} *node
  * @param {MppData} *sink_data
  * @return {*}
  */
-S32 handle_vdec_data(ALBaseContext *base_context, MppData *sink_data);
+S32 handle_vdec_data(MppProcessNode *node, MppData *sink_data);
 
 /***
  * @description:
- * @param {ALBaseContext} *base_context
+ * @param {MppProcessNode} *node
  * @param {MppData} *sink_data
  * @param {MppData} *src_data
  * @return {*}
  */
-S32 process_vdec_data(ALBaseContext *base_context, MppData *sink_data,
+S32 process_vdec_data(MppProcessNode *node, MppData *sink_data,
                       MppData *src_data);
 
 /**
  * @description:
- * @param {ALBaseContext} *base_context
+ * @param {MppProcessNode} *node
  * @param {MppData *} src_data
  * @return {*}
  */
-S32 get_vdec_result(ALBaseContext *base_context, MppData *src_data);
+S32 get_vdec_result(MppProcessNode *node, MppData *src_data);
 
 /**
  * @description:
- * @param {ALBaseContext} *base_context
+ * @param {MppProcessNode} *node
  * @param {MppData **} src_data
  * @return {*}
  */
-S32 get_vdec_result_2(ALBaseContext *base_context, MppData **src_data);
+S32 get_vdec_result_2(MppProcessNode *node, MppData **src_data);
 
 /**
  * @description:
- * @param {ALBaseContext} *base_context
+ * @param {MppProcessNode} *node
  * @param {MppData *} src_data
  * @return {*}
  */
-S32 return_vdec_result(ALBaseContext *base_context, MppData *src_data);
+S32 return_vdec_result(MppProcessNode *node, MppData *src_data);
 
 #ifdef __cplusplus
 };
@@ -115,11 +115,36 @@
  *            +--------------------------+
  */
 
+/***
+ * AL encoder interface resolved from the plugin by VENC_Init, every channel
+ * holds its own table, so channels on different plugins can run in one
+ * process.
+ */
+typedef struct _MppVencOps {
+  ALBaseContext *(*create)();
+  S32 (*init)(ALBaseContext *ctx, MppVencPara *para);
+  S32 (*set_para)(ALBaseContext *ctx, MppVencPara *para);
+  S32 (*return_input_frame)(ALBaseContext *ctx, MppData *sink_data);
+  S32 (*send_input_frame)(ALBaseContext *ctx, MppData *sink_data);
+  S32 (*encode)(ALBaseContext *ctx, MppData *sink_data);
+  S32 (*process)(ALBaseContext *ctx, MppData *sink_data, MppData *src_data);
+  S32 (*get_output_stream)(ALBaseContext *ctx, MppData *src_data);
+  S32 (*request_output_stream)(ALBaseContext *ctx, MppData *src_data);
+  S32 (*return_output_stream)(ALBaseContext *ctx, MppData *src_data);
+  S32 (*flush)(ALBaseContext *ctx);
+  void (*destory)(ALBaseContext *ctx);
+} MppVencOps;
+
+/***
+ * pNode must be the first member, the bind system gets the channel
+ * context back from the node.
+ */
 typedef struct _MppVencCtx {
   MppProcessNode pNode;
   MppModuleType eCodecType;
   MppVencPara stVencPara;
   MppModule *pModule;
+  MppVencOps stVencOps;
 } MppVencCtx;
 
 /******************* standard API ******************/
@@ -236,44 +261,44 @@ S32 VENC_ResetChannel(MppVencCtx *ctx);
 
 /**
  * @description:
- * @param {ALBaseContext} *base_context
+ * @param {MppProcessNode} *node
  * @param {MppData} *sink_data
  * @return {*}
  */
-S32 handle_venc_data(ALBaseContext *base_context, MppData *sink_data);
+S32 handle_venc_data(MppProcessNode *node, MppData *sink_data);
 
 /***
  * @description:
- * @param {ALBaseContext} *base_context
+ * @param {MppProcessNode} *node
  * @param {MppData} *sink_data
  * @param {MppData} *src_data
  * @return {*}
  */
-S32 process_venc_data(ALBaseContext *base_context, MppData *sink_data,
+S32 process_venc_data(MppProcessNode *node, MppData *sink_data,
                       MppData *src_data);
 
 /***
  * @description:
- * @param {ALBaseContext} *base_context
+ * @param {MppProcessNode} *node
  * @param {MppData} *src_data
  * @return {*}
  */
-S32 get_venc_result_sync(ALBaseContext *base_context, MppData *src_data);
+S32 get_venc_result_sync(MppProcessNode *node, MppData *src_data);
 
 /**
  * @description:
- * @param {ALBaseContext} *base_context
+ * @param {MppProcessNode} *node
  * @param {MppData *} src_data
  * @return {*}
  */
-S32 get_venc_result(ALBaseContext *base_context, MppData *src_data);
+S32 get_venc_result(MppProcessNode *node, MppData *src_data);
 
 /**
  * @description:
- * @param {ALBaseContext} *base_context
+ * @param {MppProcessNode} *node
  * @param {MppData *} src_data
  * @return {*}
  */
-S32 return_venc_result(ALBaseContext *base_context, MppData *src_data);
+S32 return_venc_result(MppProcessNode *node, MppData *src_data);
 
 #endif /*_MPP_VENC_H*/
@@ -5,8 +5,10 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-13 18:11:03
- * @LastEditTime: 2024-03-15 14:54:33
- * @Description:
+ * @LastEditTime: 2024-06-02 09:40:15
+ * @Description: registry of the plugins, the directories in MPP_PLUGIN_PATH
+ *               (default /usr/lib:/usr/local/lib) are scanned once per
+ *               process and the libraries stay loaded.
  */
 
 #ifndef _MPP_MODULE_H_
@@ -14,6 +16,7 @@
 
 #include <dlfcn.h>
 
+#include "al_interface_base.h"
 #include "frame.h"
 #include "packet.h"
 
@@ -22,17 +25,36 @@
 typedef struct _MppModule MppModule;
 
 /**
- * @description:
+ * @description: open the plugin of a module type
  * @param {MppModuleType} codec_type
- * @return {*}
+ * @return {*}: NULL if it is not installed
  */
 MppModule* module_init(MppModuleType codec_type);
 
 /***
- * @description:
- * @return {*}
+ * @description: open the cheapest codec plugin whose capability descriptor
+ * covers the channel
+ * @param {MppCodingType} coding_type
+ * @param {BOOL} encoder
+ * @param {MppPixelFormat} pixel_format: PIXEL_FORMAT_UNKNOWN if any
+ * @param {S32} width: 0 if not known yet
+ * @param {S32} height: 0 if not known yet
+ * @return {*}: NULL if no plugin can
  */
-MppModule* module_auto_init();
+MppModule* module_auto_init(MppCodingType coding_type, BOOL encoder,
+                            MppPixelFormat pixel_format, S32 width,
+                            S32 height);
+
+/***
+ * @description: the next plugin module_auto_init would pick after the one
+ * of the module, for a channel that can not be opened on it, the module is
+ * not closed
+ * @param {MppModule} *module: the module picked before
+ * @return {*}: NULL if no other plugin can
+ */
+MppModule* module_auto_next(MppModule* module, MppCodingType coding_type,
+                            BOOL encoder, MppPixelFormat pixel_format,
+                            S32 width, S32 height);
 
 /**
  * @description:
@@ -48,4 +70,18 @@ void module_destory(MppModule* module);
  */
 void* module_get_so_path(MppModule* module);
 
-#endif /*_MPP_MODULE_H_*/
\ No newline at end of file
+/**
+ * @description: the module type of the plugin opened
+ * @param {MppModule} *module
+ * @return {*}
+ */
+MppModuleType module_get_type(MppModule* module);
+
+/**
+ * @description: the capability descriptor of the plugin opened
+ * @param {MppModule} *module
+ * @return {*}: NULL if the plugin does not export al_plugin_get_caps
+ */
+const ALPluginCaps* module_get_caps(MppModule* module);
+
+#endif /*_MPP_MODULE_H_*/
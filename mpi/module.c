@@ -5,8 +5,11 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-11 10:27:53
- * @LastEditTime: 2024-04-28 17:17:12
- * @Description: dlopen the video codec library dynamicly
+ * @LastEditTime: 2024-06-02 09:40:15
+ * @Description: dlopen the video codec library dynamicly, the plugins are
+ *               found once per process by a scan of MPP_PLUGIN_PATH and
+ *               their handles and capability descriptors are kept, so a
+ *               channel is created by a lookup in the registry.
  */
 
 #define ENABLE_DEBUG 1
@@ -15,242 +18,466 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <dirent.h>
+#include <pthread.h>
 
 #include "module.h"
-#include "v4l2_utils.h"
+#include "env.h"
 #include "log.h"
 
-#include <linux/videodev2.h>
+#define MODULE_TAG "mpp_module"
+
+/**
+ * directories scanned for the plugins, separated by ':', the first one
+ * that has a plugin wins
+ */
+#define PLUGIN_PATH_ENV "MPP_PLUGIN_PATH"
+#define PLUGIN_PATH_DEFAULT "/usr/lib:/usr/local/lib"
+
+typedef struct _MppPlugin {
+    MppModuleType eModuleType;
+
+    /**
+     * the library is lib<name>.so
+     */
+    const U8 *pPluginName;
+
+    /**
+     * the library the plugin is built on (lib<name>.so), NULL if it needs
+     * nothing but libc, and two more places it may be installed in
+     */
+    const U8 *pLibraryName;
+    const U8 *pLibraryPath[2];
+
+    U8 so_path[MAX_PATH_LENGTH];
+    BOOL bFound;
+
+    /**
+     * dlopen once, kept until the process exits, guarded by stRegistryMutex
+     */
+    void *load_so;
+    BOOL bLoadFailed;
+    const ALPluginCaps *pCaps;
+    BOOL (*probe)(MppCodingType, BOOL);
+    S32 nInstanceNum;
+} MppPlugin;
 
 struct _MppModule {
-    U8    so_path[MAX_PATH_LENGTH];
-    void    *load_so;
+    MppPlugin *pPlugin;
 };
 
-#define FIND_PLUGIN(TYPE, type, name) \
-S32 find_##type##_plugin(U8 *path) \
-{ \
-    if (0 == access("/usr/lib/lib"#name".so", F_OK)) \
-    { \
-        debug("yeah! we have "#name" plugin---------------"); \
-        U8 *tmp = "/usr/lib/lib"#name".so"; \
-        S32 len = strlen(tmp);  \
-        memcpy(path, tmp, len); \
-        path[len] = '\0';  \
-        return 1; \
-    } \
- \
-    if (0 == access("/usr/local/lib/lib"#name".so", F_OK)) \
-    { \
-        debug("yeah! have "#name" plugin---------------"); \
-        U8 *tmp = "/usr/local/lib/lib"#name".so"; \
-        S32 len = strlen(tmp);  \
-        memcpy(path, tmp, len); \
-        path[len] = '\0';  \
-        return 1; \
-    } \
- \
-    return 0; \
-} \
-
-FIND_PLUGIN(OPENH264, openh264, soft_openh264)
-FIND_PLUGIN(SFOMX, sfomx, sfomxil_plugin)
-FIND_PLUGIN(SFENC, sfenc, sfenc_plugin)
-FIND_PLUGIN(SFDEC, sfdec, sfdec_plugin)
-FIND_PLUGIN(FFMPEG, ffmpeg, ffmpegcodec)
-FIND_PLUGIN(V4L2, v4l2, v4l2_standard_codec)
-FIND_PLUGIN(FAKEDEC, fakedec, fake_dec_plugin)
-FIND_PLUGIN(V4L2_LINLONV5V7, v4l2_linlonv5v7, v4l2_linlonv5v7_codec)
-FIND_PLUGIN(K1_V2D, k1_v2d, v2d_plugin)
-FIND_PLUGIN(K1_JPU, k1_jpu, jpu_plugin)
-FIND_PLUGIN(VO_SDL2, vo_sdl2, vo_sdl2_plugin)
-FIND_PLUGIN(VO_FILE, vo_file, vo_file_plugin)
-FIND_PLUGIN(VI_V4L2, vi_v4l2, vi_v4l2_plugin)
-FIND_PLUGIN(VI_K1_CAM, vi_k1_cam, vi_k1_cam_plugin)
-FIND_PLUGIN(VI_FILE, vi_file, vi_file_plugin)
-
-#define CHECK_LIBRARY(TYPE, type, name, path1, path2) \
-S32 check_##type() \
-{ \
-    if ((0 == access("/usr/lib/lib"#name".so", F_OK)) || \
-            (0 == access("/usr/lib/lib"#name".so.0", F_OK)) || \
-            (0 == access("/usr/local/lib/lib"#name".so", F_OK)) || \
-            (0 == access("/usr/lib/riscv64-linux-gnu/lib"#name".so", F_OK)) || \
-            (0 == access("/usr/lib/riscv64-linux-gnu/lib"#name".so.7", F_OK)) || \
-            (0 == access("/usr/lib/riscv64-linux-gnu/lib"#name".so.0", F_OK)) || \
-            (0 == access(#path1"/lib"#name".so", F_OK)) || \
-            (0 == access(#path2"/lib"#name".so", F_OK))) \
-    { \
-        debug("yeah! have "#type"---------------"); \
-        return 1; \
-    } \
-\
-    return 0; \
-} \
-
-CHECK_LIBRARY(SFOMX, sfomx, sf-omx-il, /, /)
-CHECK_LIBRARY(SFENC, sfenc, sfenc, /, /)
-CHECK_LIBRARY(SFDEC, sfdec, sfdec, /, /)
-CHECK_LIBRARY(FFMPEG, ffmpeg, avcodec, /usr/lib/ffmpeg, /usr/local/lib/ffmpeg)
-CHECK_LIBRARY(OPENH264, openh264, openh264, /usr/lib/x86_64-linux-gnu, /usr/local/lib/x86_64-linux-gnu)
-CHECK_LIBRARY(FAKEDEC, fakedec, c, /, /)
-CHECK_LIBRARY(K1_V2D, k1_v2d, v2d, /, /)
-CHECK_LIBRARY(K1_JPU, k1_jpu, jpu, /, /)
-CHECK_LIBRARY(VO_SDL2, vo_sdl2, SDL2-2.0, /, /)
-CHECK_LIBRARY(VO_FILE, vo_file, c, /, /)
-CHECK_LIBRARY(VI_V4L2, vi_v4l2, c, /, /)
-CHECK_LIBRARY(VI_K1_CAM, vi_k1_cam, c, /, /)
-CHECK_LIBRARY(VI_FILE, vi_file, c, /, /)
-
-#define CHECKMODULE_BY_TYPE(TYPE, type) \
-{ \
-    if(check_##type()) \
-    { \
-        if(find_##type##_plugin(module->so_path)) \
-        { \
-            debug("++++++++++ "#TYPE" (%s)", module->so_path); \
-            module->load_so = dlopen(module->so_path, RTLD_LAZY | RTLD_LOCAL); \
-            debug("++++++++++ open (%s) success !", module->so_path); \
-        } \
-        else \
-        { \
-            error("can not find "#type" plugin, please check!"); \
-            free(module); \
-            return NULL; \
-        } \
-    } \
-    else \
-    { \
-        error("can not find "#type", please check!"); \
-        free(module); \
-        return NULL; \
-    } \
-} \
+/**
+ * the order breaks a tie of cost in module_auto_init, hardware first, the
+ * two v4l2 plugins do not tie, linlon is cheaper on its own device
+ */
+static MppPlugin stPlugins[] = {
+    {CODEC_V4L2_LINLONV5V7, "v4l2_linlonv5v7_codec", NULL},
+    {CODEC_V4L2, "v4l2_standard_codec", NULL},
+    {CODEC_SFOMX, "sfomxil_plugin", "sf-omx-il"},
+    {CODEC_SFDEC, "sfdec_plugin", "sfdec"},
+    {CODEC_SFENC, "sfenc_plugin", "sfenc"},
+    {CODEC_K1_JPU, "jpu_plugin", "jpu"},
+    {CODEC_FFMPEG, "ffmpegcodec", "avcodec",
+     {"/usr/lib/ffmpeg", "/usr/local/lib/ffmpeg"}},
+    {CODEC_OPENH264, "soft_openh264", "openh264",
+     {"/usr/lib/x86_64-linux-gnu", "/usr/local/lib/x86_64-linux-gnu"}},
+    {CODEC_FAKEDEC, "fake_dec_plugin", NULL},
+    {VO_SDL2, "vo_sdl2_plugin", "SDL2-2.0"},
+    {VO_FILE, "vo_file_plugin", NULL},
+    {VI_V4L2, "vi_v4l2_plugin", NULL},
+    {VI_K1_CAM, "vi_k1_cam_plugin", NULL},
+    {VI_FILE, "vi_file_plugin", NULL},
+    {VPS_K1_V2D, "v2d_plugin", "v2d"},
+    // al_g2d_* of swscale live in the ffmpeg codec plugin
+    {VPS_FFMPEG_SWSCALE, "ffmpegcodec", "avcodec",
+     {"/usr/lib/ffmpeg", "/usr/local/lib/ffmpeg"}},
+    {VPS_CPU, "cpu_g2d_plugin", NULL},
+};
+
+static pthread_once_t stRegistryOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t stRegistryMutex = PTHREAD_MUTEX_INITIALIZER;
 
 /**
- * @description: dlopen the video codec library by module_type
- * @param {MppModuleType} module_type : input, the codec need to be opened
- * @return {MppModule*} : the module context
+ * @description: check that the library a plugin is built on is installed
+ * @param {MppPlugin*} plugin : input, the plugin found
+ * @return {BOOL} : MPP_TRUE if it is
  */
-MppModule*  module_init(MppModuleType module_type)
+static BOOL check_library(MppPlugin *plugin)
 {
-    debug("+++++++++++++++ module init, module type = %d", module_type);
-    MppModule *module = (MppModule*)malloc(sizeof(MppModule));
+    static const U8 *dirs[] = {"/usr/lib", "/usr/local/lib",
+                               "/usr/lib/riscv64-linux-gnu"};
+    static const U8 *suffixes[] = {".so", ".so.0", ".so.7"};
+    U8 path[MAX_PATH_LENGTH];
+    S32 i, j;
 
-#if 0
-    //for test
-    U8 buffer[2000];
-    getcwd(buffer, 2000);
-    debug("the buffer is (%s)", buffer);
-#endif
+    if (!plugin->pLibraryName)
+        return MPP_TRUE;
 
-    if(CODEC_OPENH264 == module_type)
+    for (i = 0; i < NUM_OF(dirs) + NUM_OF(plugin->pLibraryPath); i++)
     {
-        CHECKMODULE_BY_TYPE(OPENH264, openh264);
-    }
-    else if(CODEC_FFMPEG == module_type)
-    {
-        CHECKMODULE_BY_TYPE(FFMPEG, ffmpeg);
-    }
-    else if(CODEC_SFDEC == module_type)
-    {
-        CHECKMODULE_BY_TYPE(SFDEC, sfdec);
-    }
-    else if(CODEC_SFENC == module_type)
-    {
-        CHECKMODULE_BY_TYPE(SFENC, sfenc);
+        const U8 *dir = i < NUM_OF(dirs)
+                            ? dirs[i]
+                            : plugin->pLibraryPath[i - NUM_OF(dirs)];
+        if (!dir)
+            continue;
+
+        for (j = 0; j < NUM_OF(suffixes); j++)
+        {
+            snprintf(path, sizeof(path), "%s/lib%s%s", dir,
+                     plugin->pLibraryName, suffixes[j]);
+            if (0 == access(path, F_OK))
+                return MPP_TRUE;
+        }
     }
-    else if(CODEC_SFOMX == module_type)
+
+    return MPP_FALSE;
+}
+
+/**
+ * @description: look for the plugins in one directory, a plugin found in
+ * an earlier directory is kept
+ * @param {U8*} dir : input, the directory
+ * @return {*}
+ */
+static void scan_directory(const U8 *dir)
+{
+    DIR *handle = opendir(dir);
+    struct dirent *entry = NULL;
+    U8 name[MAX_PATH_LENGTH];
+    S32 i;
+
+    if (!handle)
     {
-        CHECKMODULE_BY_TYPE(SFOMX, sfomx);
+        debug("can not open plugin directory (%s), skip it", dir);
+        return;
     }
-    else if(CODEC_V4L2 == module_type)
+
+    while ((entry = readdir(handle)))
     {
-        CHECKMODULE_BY_TYPE(V4L2, v4l2);
+        if (strncmp(entry->d_name, "lib", 3))
+            continue;
+
+        for (i = 0; i < NUM_OF(stPlugins); i++)
+        {
+            MppPlugin *plugin = &stPlugins[i];
+
+            snprintf(name, sizeof(name), "lib%s.so", plugin->pPluginName);
+            if (plugin->bFound || strcmp(entry->d_name, name))
+                continue;
+
+            snprintf(plugin->so_path, sizeof(plugin->so_path), "%s/%s", dir,
+                     name);
+            plugin->bFound = MPP_TRUE;
+        }
     }
-    else if(CODEC_FAKEDEC == module_type)
+
+    closedir(handle);
+}
+
+/**
+ * @description: find the installed plugins, run once per process
+ * @return {*}
+ */
+static void registry_scan()
+{
+    U8 *env = NULL;
+    char *save = NULL;
+    char *dir = NULL;
+    char paths[MAX_PATH_LENGTH];
+    S32 i;
+
+    mpp_env_get_str(PLUGIN_PATH_ENV, &env, PLUGIN_PATH_DEFAULT);
+    snprintf(paths, sizeof(paths), "%s", env);
+
+    for (dir = strtok_r(paths, ":", &save); dir;
+         dir = strtok_r(NULL, ":", &save))
     {
-        CHECKMODULE_BY_TYPE(FAKEDEC, fakedec);
+        scan_directory((U8*)dir);
     }
-    else if(CODEC_V4L2_LINLONV5V7 == module_type)
+
+    for (i = 0; i < NUM_OF(stPlugins); i++)
     {
-        CHECKMODULE_BY_TYPE(V4L2_LINLONV5V7, v4l2_linlonv5v7);
+        MppPlugin *plugin = &stPlugins[i];
+
+        if (plugin->bFound && !check_library(plugin))
+        {
+            debug("have %s but not lib%s, skip it", plugin->so_path,
+                  plugin->pLibraryName);
+            plugin->bFound = MPP_FALSE;
+        }
+
+        if (plugin->bFound)
+            debug("yeah! have %s (%s)",
+                  mpp_moduletype2str(plugin->eModuleType), plugin->so_path);
     }
-    else if(CODEC_K1_JPU == module_type)
+}
+
+/**
+ * @description: dlopen a plugin found and read its descriptor, once,
+ * called with stRegistryMutex held
+ * @param {MppPlugin*} plugin : input, the plugin
+ * @return {BOOL} : MPP_TRUE if the plugin is loaded
+ */
+static BOOL load_plugin(MppPlugin *plugin)
+{
+    const ALPluginCaps *(*get_caps)() = NULL;
+
+    if (plugin->load_so)
+        return MPP_TRUE;
+    if (!plugin->bFound || plugin->bLoadFailed)
+        return MPP_FALSE;
+
+    plugin->load_so = dlopen(plugin->so_path, RTLD_LAZY | RTLD_LOCAL);
+    if (!plugin->load_so)
     {
-        CHECKMODULE_BY_TYPE(K1_JPU, k1_v2d);
+        error("can not open (%s), please check! (%s)", plugin->so_path,
+              dlerror());
+        plugin->bLoadFailed = MPP_TRUE;
+        return MPP_FALSE;
     }
-    else if(VO_SDL2 == module_type)
+    debug("++++++++++ open (%s) success !", plugin->so_path);
+
+    get_caps = dlsym(plugin->load_so, "al_plugin_get_caps");
+    if (get_caps)
+        plugin->pCaps = get_caps();
+    if (plugin->pCaps && AL_PLUGIN_CAPS_VERSION != plugin->pCaps->nVersion)
     {
-        CHECKMODULE_BY_TYPE(VO_SDL2, vo_sdl2);
+        error("(%s) has caps version %u, not %u, ignore them", plugin->so_path,
+              plugin->pCaps->nVersion, AL_PLUGIN_CAPS_VERSION);
+        plugin->pCaps = NULL;
     }
-    else if(VO_FILE == module_type)
+    plugin->probe = dlsym(plugin->load_so, "al_plugin_probe");
+
+    return MPP_TRUE;
+}
+
+/**
+ * @description: take one instance of a loaded plugin
+ * @param {MppPlugin*} plugin : input, the plugin
+ * @return {MppModule*} : the module context
+ */
+static MppModule* create_module(MppPlugin *plugin)
+{
+    MppModule *module = (MppModule*)malloc(sizeof(MppModule));
+
+    if (!module)
     {
-        CHECKMODULE_BY_TYPE(VO_FILE, vo_file);
+        error("can not malloc MppModule, please check!");
+        return NULL;
     }
-    else if(VI_V4L2 == module_type)
+
+    module->pPlugin = plugin;
+    plugin->nInstanceNum++;
+
+    return module;
+}
+
+static BOOL has_coding_type(const MppCodingType *types, S32 num,
+                            MppCodingType coding_type)
+{
+    S32 i;
+
+    for (i = 0; i < num; i++)
     {
-        CHECKMODULE_BY_TYPE(VI_V4L2, vi_v4l2);
+        if (types[i] == coding_type)
+            return MPP_TRUE;
     }
-    else if(VI_K1_CAM == module_type)
+
+    return MPP_FALSE;
+}
+
+/**
+ * @description: check a plugin for a channel, called with stRegistryMutex held
+ * @return {BOOL} : MPP_TRUE if it can run one more channel like this
+ */
+static BOOL match_caps(MppPlugin *plugin, MppCodingType coding_type,
+                       BOOL encoder, MppPixelFormat pixel_format, S32 width,
+                       S32 height)
+{
+    const ALPluginCaps *caps = plugin->pCaps;
+    BOOL format = !caps->nPixelFormatNum ? MPP_TRUE : MPP_FALSE;
+    S32 i;
+
+    if (encoder && !has_coding_type(caps->pEncoderCodingTypes,
+                                    caps->nEncoderCodingTypeNum, coding_type))
+        return MPP_FALSE;
+    if (!encoder && !has_coding_type(caps->pDecoderCodingTypes,
+                                     caps->nDecoderCodingTypeNum, coding_type))
+        return MPP_FALSE;
+
+    for (i = 0; i < caps->nPixelFormatNum; i++)
     {
-        CHECKMODULE_BY_TYPE(VI_K1_CAM, vi_k1_cam);
+        if (PIXEL_FORMAT_UNKNOWN == pixel_format ||
+            caps->pPixelFormats[i] == pixel_format)
+            format = MPP_TRUE;
     }
-    else if(VI_FILE == module_type)
+    if (!format)
+        return MPP_FALSE;
+
+    if ((caps->nMaxWidth && width > caps->nMaxWidth) ||
+        (caps->nMaxHeight && height > caps->nMaxHeight))
+        return MPP_FALSE;
+
+    if (caps->nMaxInstances && plugin->nInstanceNum >= caps->nMaxInstances)
+        return MPP_FALSE;
+
+    return MPP_TRUE;
+}
+
+/**
+ * @description: dlopen the video codec library by module_type
+ * @param {MppModuleType} module_type : input, the codec need to be opened
+ * @return {MppModule*} : the module context
+ */
+MppModule*  module_init(MppModuleType module_type)
+{
+    MppModule *module = NULL;
+    S32 i;
+
+    debug("+++++++++++++++ module init, module type = %d", module_type);
+    pthread_once(&stRegistryOnce, registry_scan);
+
+    pthread_mutex_lock(&stRegistryMutex);
+    for (i = 0; i < NUM_OF(stPlugins); i++)
     {
-        CHECKMODULE_BY_TYPE(VI_FILE, vi_file);
+        if (stPlugins[i].eModuleType != module_type)
+            continue;
+
+        if (load_plugin(&stPlugins[i]))
+            module = create_module(&stPlugins[i]);
+        break;
     }
-    else if(VPS_K1_V2D == module_type)
+    pthread_mutex_unlock(&stRegistryMutex);
+
+    if (!module)
+        error("can not find %s, please check!",
+              mpp_moduletype2str(module_type));
+
+    return module;
+}
+
+/**
+ * @description: is a plugin picked before another one, by cost and then by
+ * the order of stPlugins
+ */
+static BOOL is_before(MppPlugin *plugin, MppPlugin *other)
+{
+    if (plugin->pCaps->nCost != other->pCaps->nCost)
+        return plugin->pCaps->nCost < other->pCaps->nCost;
+
+    return plugin < other;
+}
+
+/**
+ * @description: pick the cheapest codec plugin after a given one that
+ * describes itself able to run the channel and whose device is there
+ * @param {MppPlugin*} after : input, NULL to start from the cheapest
+ * @return {MppModule*} : the module context
+ */
+static MppModule* auto_init(MppPlugin *after, MppCodingType coding_type,
+                            BOOL encoder, MppPixelFormat pixel_format,
+                            S32 width, S32 height)
+{
+    MppPlugin *best = NULL;
+    MppModule *module = NULL;
+    S32 i;
+
+    pthread_once(&stRegistryOnce, registry_scan);
+
+    pthread_mutex_lock(&stRegistryMutex);
+    for (i = 0; i < NUM_OF(stPlugins); i++)
     {
-        CHECKMODULE_BY_TYPE(K1_V2D, k1_v2d);
+        MppPlugin *plugin = &stPlugins[i];
+
+        if (plugin->eModuleType <= CODEC_AUTO ||
+            plugin->eModuleType >= CODEC_MAX || !load_plugin(plugin) ||
+            !plugin->pCaps)
+            continue;
+
+        if ((after && !is_before(after, plugin)) ||
+            (best && !is_before(plugin, best)))
+            continue;
+
+        if (match_caps(plugin, coding_type, encoder, pixel_format, width,
+                       height) &&
+            (!plugin->probe || plugin->probe(coding_type, encoder)))
+            best = plugin;
     }
-    else
+
+    if (best)
+        module = create_module(best);
+    pthread_mutex_unlock(&stRegistryMutex);
+
+    if (!module)
     {
-        error("need auto detect load_so");
+        error("can not find %s %s for coding type %d, please check!",
+              after ? "another" : "suitable", encoder ? "encoder" : "decoder",
+              coding_type);
+        return NULL;
     }
 
+    debug("auto select %s (%s)", mpp_moduletype2str(best->eModuleType),
+          best->so_path);
     return module;
 }
 
-MppModule* module_auto_init() {
-    MppModule *module_tmp = NULL;
-    module_tmp = module_init(CODEC_V4L2);
-    if(module_tmp) {
-        debug("auto select V4L2 codec");
-        return module_tmp;
-    }
+/**
+ * @description: pick the cheapest codec plugin that describes itself able
+ * to run the channel
+ * @param {MppCodingType} coding_type : input, the codec
+ * @param {BOOL} encoder : input, MPP_TRUE for an encoder channel
+ * @param {MppPixelFormat} pixel_format : input, PIXEL_FORMAT_UNKNOWN if any
+ * @param {S32} width : input, 0 if not known yet
+ * @param {S32} height : input, 0 if not known yet
+ * @return {MppModule*} : the module context
+ */
+MppModule* module_auto_init(MppCodingType coding_type, BOOL encoder,
+                            MppPixelFormat pixel_format, S32 width,
+                            S32 height)
+{
+    return auto_init(NULL, coding_type, encoder, pixel_format, width, height);
+}
 
-    module_tmp = module_init(CODEC_SFOMX);
-        if(module_tmp) {
-        debug("auto select starfice openmax codec");
-        return module_tmp;
-    }
+/**
+ * @description: the channel can not be opened on the module picked, pick
+ * the next plugin, the module is kept
+ * @param {MppModule*} module : input, the module picked before
+ * @return {MppModule*} : the module context, NULL if there is no other
+ */
+MppModule* module_auto_next(MppModule *module, MppCodingType coding_type,
+                            BOOL encoder, MppPixelFormat pixel_format,
+                            S32 width, S32 height)
+{
+    if (!module)
+        return NULL;
 
-    error("can not find suitable codec, please check!");
-    return NULL;
+    return auto_init(module->pPlugin, coding_type, encoder, pixel_format,
+                     width, height);
 }
 
 /**
- * @description: close the module
+ * @description: close the module, the library stays loaded for the next
+ * channel
  * @param {MppModule*} module : input, the module need to be closed
  * @return {*}
  */
 void module_destory(MppModule *module)
 {
     debug("+++++++++++++++ module destory");
-    if (module->load_so)
-    {
-        dlclose(module->load_so);
-        module->load_so = NULL;
-    }
+    if (!module)
+        return;
+
+    pthread_mutex_lock(&stRegistryMutex);
+    module->pPlugin->nInstanceNum--;
+    pthread_mutex_unlock(&stRegistryMutex);
 
     free(module);
 }
 
 /**
- * @description: get the so path from the module
+ * @description: get the so handle from the module
  * @param {MppModule*} module : the module opened
- * @return {void*} : the path string pointer
+ * @return {void*} : the handle of dlopen
  */
 void* module_get_so_path(MppModule *module)
 {
@@ -260,5 +487,25 @@ void* module_get_so_path(MppModule *module)
         return NULL;
     }
 
-    return module->load_so;
+    return module->pPlugin->load_so;
+}
+
+/**
+ * @description: the type of the plugin the module runs on
+ * @param {MppModule*} module : the module opened
+ * @return {MppModuleType} :
+ */
+MppModuleType module_get_type(MppModule *module)
+{
+    return module ? module->pPlugin->eModuleType : CODEC_AUTO;
+}
+
+/**
+ * @description: the capability descriptor of the plugin
+ * @param {MppModule*} module : the module opened
+ * @return {ALPluginCaps*} : NULL if the plugin does not describe itself
+ */
+const ALPluginCaps* module_get_caps(MppModule *module)
+{
+    return module ? module->pPlugin->pCaps : NULL;
 }
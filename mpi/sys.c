@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-30 17:52:11
- * @LastEditTime: 2023-07-31 15:17:49
+ * @LastEditTime: 2024-06-02 10:05:33
  * @Description:
  */
 
@@ -13,15 +13,26 @@
 
 #include "sys.h"
 
+#include <errno.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
 #include <unistd.h>
 
 #include "log.h"
+#include "notify.h"
 
 #define MODULE_TAG "mpp_sys"
 
+/*
+ * max time to block on a node's eventfd and poll fd, plugins which neither
+ * signal nOutputEventFd nor give nOutputPollFd are still polled at this
+ * interval.
+ */
+#define SYS_WAIT_TIMEOUT_MS 10
+
 /*
  *    Data
  * +--+--+--+--+
@@ -82,38 +93,65 @@ S32 SYS_GetVersion() { return 0; }
 MppProcessFlowCtx *SYS_CreateFlow() {
   ctx = (MppProcessFlowCtx *)malloc(sizeof(MppProcessFlowCtx));
   if (!ctx) {
-    error("Can not create MppProcessFlowCtx, please check it !");
+    error("Can not create MppProcessFlowCtx, please check !");
+    return NULL;
+  }
+  memset(ctx, 0, sizeof(MppProcessFlowCtx));
+
+  ctx->nResultEpollFd = -1;
+  ctx->nExitEventFd = mpp_notify_create();
+  if (ctx->nExitEventFd < 0) {
+    error("Can not create exit eventfd, please check !");
+    free(ctx);
+    ctx = NULL;
     return NULL;
   }
 
   return ctx;
 }
 
-void SYS_Init(MppProcessFlowCtx *ctx) { ctx->nNodeNum = 0; }
-
-#define CREATE_NODE_BY_TYPE(TYPE, Type, type)                 \
-  {                                                           \
-    Mpp##Type##Ctx *ctx = TYPE##_CreateChannel();             \
-    if (!ctx) {                                               \
-      error("can not create Mpp##type##Ctx, please check !"); \
-      return NULL;                                            \
-    }                                                         \
-    ctx->pNode.eType = TYPE;                                  \
-    ctx->pNode.ops = (MppOps *)malloc(sizeof(MppOps));        \
-    ctx->pNode.ops->handle_data = &handle_##type##_data;      \
-    ctx->pNode.ops->get_result = &get_##type##_result;        \
-    ctx->pNode.ops->return_result = &return_##type##_result;  \
-    TYPE##_Init(ctx);                                         \
-    return &(ctx->pNode);                                     \
+void SYS_Init(MppProcessFlowCtx *ctx) {
+  ctx->nNodeNum = 0;
+  ctx->bExit = MPP_FALSE;
+}
+
+#define CREATE_NODE_BY_TYPE(TYPE, Type, type, module_type, para)     \
+  {                                                                 \
+    Mpp##Type##Ctx *ctx = TYPE##_CreateChannel();                   \
+    if (!ctx) {                                                     \
+      error("can not create Mpp##type##Ctx, please check !");       \
+      return NULL;                                                  \
+    }                                                               \
+    ctx->eCodecType = module_type;                                  \
+    if (para)                                                       \
+      memcpy(&(ctx->st##Type##Para), para, sizeof(Mpp##Type##Para)); \
+    ctx->pNode.eType = TYPE;                                        \
+    ctx->pNode.nEventFd = mpp_notify_create();                      \
+    ctx->st##Type##Para.nOutputEventFd = ctx->pNode.nEventFd;       \
+    ctx->st##Type##Para.nOutputPollFd = -1;                         \
+    ctx->pNode.ops = (MppOps *)malloc(sizeof(MppOps));              \
+    ctx->pNode.ops->handle_data = &handle_##type##_data;            \
+    ctx->pNode.ops->get_result = &get_##type##_result;              \
+    ctx->pNode.ops->return_result = &return_##type##_result;        \
+    if (TYPE##_Init(ctx)) {                                         \
+      error("can not init Mpp##type##Ctx, please check !");         \
+      mpp_notify_destory(ctx->pNode.nEventFd);                      \
+      free(ctx->pNode.ops);                                         \
+      TYPE##_DestoryChannel(ctx);                                   \
+      return NULL;                                                  \
+    }                                                               \
+    ctx->pNode.nPollFd = ctx->st##Type##Para.nOutputPollFd;         \
+    return &(ctx->pNode);                                           \
   }
 
-MppProcessNode *SYS_CreateNode(MppProcessNodeType type) {
+MppProcessNode *SYS_CreateNodeByModule(MppProcessNodeType type,
+                                       MppModuleType module_type, void *para) {
   switch (type) {
     case 1:
-      CREATE_NODE_BY_TYPE(VDEC, Vdec, vdec)
+      CREATE_NODE_BY_TYPE(VDEC, Vdec, vdec, module_type, para)
       break;
     case 2:
-      CREATE_NODE_BY_TYPE(VENC, Venc, venc)
+      CREATE_NODE_BY_TYPE(VENC, Venc, venc, module_type, para)
       break;
       //    case 3:
       //        CREATE_NODE_BY_TYPE(G2d)
@@ -125,6 +163,10 @@ MppProcessNode *SYS_CreateNode(MppProcessNodeType type) {
   return NULL;
 }
 
+MppProcessNode *SYS_CreateNode(MppProcessNodeType type) {
+  return SYS_CreateNodeByModule(type, CODEC_AUTO, NULL);
+}
+
 RETURN check_bind_couple(MppProcessNode *src_node, MppProcessNode *sink_node) {
   S32 i = 0;
   if (!src_node || !sink_node) {
@@ -141,58 +183,102 @@ RETURN check_bind_couple(MppProcessNode *src_node, MppProcessNode *sink_node) {
   return MPP_CHECK_FAILED;
 }
 
+/**
+ * @description: get one result from the node, block on the node's eventfd
+ * between attempts until a result is got or the flow exits.
+ * @param {S32} epoll_fd: epoll instance watching node eventfd and exit eventfd
+ * @param {MppProcessNode} *node: the node to get result from
+ * @param {MppData} *src_data: the result
+ * @return {*}: MPP_OK on success, else the flow is exiting
+ */
+static S32 wait_node_result(S32 epoll_fd, MppProcessNode *node,
+                            MppData *src_data) {
+  struct epoll_event events[2];
+  S32 ret = 0;
+
+  while (!ctx->bExit) {
+    ret = node->ops->get_result(node, src_data);
+    debug("get_result node = %d, ret = %d", node->nNodeId, ret);
+    if (!ret) return MPP_OK;
+
+    ret = epoll_wait(epoll_fd, events, NUM_OF(events), SYS_WAIT_TIMEOUT_MS);
+    if (ret < 0 && errno != EINTR) {
+      error("epoll_wait fail, please check! (%s)", strerror(errno));
+      return MPP_POLL_FAILED;
+    }
+    mpp_notify_clear(node->nEventFd);
+  }
+
+  return MPP_CODER_EOS;
+}
+
+/**
+ * @description: an epoll instance on the node's eventfd, its poll fd and the
+ * exit eventfd. The poll fd stays readable (a V4L2 queue after the last
+ * buffer, or in error) so it is edge triggered, a result is looked for at
+ * each change of it.
+ * @return {*}: the epoll fd, < 0 on failure
+ */
+static S32 create_node_epoll(MppProcessNode *node) {
+  struct epoll_event event;
+  S32 epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+  if (epoll_fd < 0) {
+    error("can not create epoll, please check! (%s)", strerror(errno));
+    return MPP_POLL_FAILED;
+  }
+
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = node->nEventFd;
+  if (node->nEventFd > 0)
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, node->nEventFd, &event);
+  event.data.fd = ctx->nExitEventFd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ctx->nExitEventFd, &event);
+
+  event.events = EPOLLIN | EPOLLPRI | EPOLLET;
+  event.data.fd = node->nPollFd;
+  if (node->nPollFd > 0 &&
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, node->nPollFd, &event) < 0)
+    error("can not wait on poll fd %d, please check! (%s)", node->nPollFd,
+          strerror(errno));
+
+  return epoll_fd;
+}
+
 void *data_transfer(void *private_data) {
   debug("------------------new thread-------------------");
   // MppProcessFlowCtx* ctx = (MppProcessFlowCtx*)private_data;
   S32 pthread_num = *(int *)private_data;
-  S32 ret = 0;
-  debug("pthread_num = %d", pthread_num);
-
+  MppProcessNode *src_node = ctx->pNode[pthread_num];
+  MppProcessNode *sink_node = ctx->pNode[pthread_num + 1];
+  S32 epoll_fd = -1;
+  MppData *tmp_data = NULL;
   MppFrame *tmp_frame = NULL;
   MppPacket *tmp_packet = NULL;
+  debug("pthread_num = %d", pthread_num);
 
-  if (VDEC == ctx->pNode[pthread_num]->eType) {
-    tmp_frame = FRAME_Create();
-
-    while (1) {
-      while (1) {
-        ret = ctx->pNode[pthread_num]->ops->get_result(
-            ctx->pNode[pthread_num]->pAlBaseContext,
-            FRAME_GetBaseData(tmp_frame));
-        debug("dec-enc get_result pthread_num = %d, ret = %d", pthread_num,
-              ret);
-        if (!ret)
-          break;
-        else
-          usleep(10 * 1000);
-      }
+  epoll_fd = create_node_epoll(src_node);
+  if (epoll_fd < 0) return NULL;
 
-      ctx->pNode[pthread_num + 1]->ops->handle_data(
-          ctx->pNode[pthread_num + 1]->pAlBaseContext,
-          FRAME_GetBaseData(tmp_frame));
-    }
-  } else if (VENC == ctx->pNode[pthread_num]->eType) {
+  if (VDEC == src_node->eType) {
+    tmp_frame = FRAME_Create();
+    tmp_data = FRAME_GetBaseData(tmp_frame);
+  } else if (VENC == src_node->eType) {
     tmp_packet = PACKET_Create();
+    tmp_data = PACKET_GetBaseData(tmp_packet);
+  }
 
-    while (1) {
-      while (1) {
-        ret = ctx->pNode[pthread_num]->ops->get_result(
-            ctx->pNode[pthread_num]->pAlBaseContext,
-            PACKET_GetBaseData(tmp_packet));
-        debug("enc-dec get_result pthread_num = %d, ret = %d", pthread_num,
-              ret);
-        if (!ret)
-          break;
-        else
-          usleep(10 * 1000);
-      }
-
-      ctx->pNode[pthread_num + 1]->ops->handle_data(
-          ctx->pNode[pthread_num + 1]->pAlBaseContext,
-          PACKET_GetBaseData(tmp_packet));
-    }
+  while (tmp_data && MPP_OK == wait_node_result(epoll_fd, src_node, tmp_data)) {
+    sink_node->ops->handle_data(sink_node, tmp_data);
+    // handle_data is input sync, the result can go back to src node now
+    src_node->ops->return_result(src_node, tmp_data);
   }
 
+  if (tmp_frame) FRAME_Destory(tmp_frame);
+  if (tmp_packet) PACKET_Destory(tmp_packet);
+  close(epoll_fd);
+
   return NULL;
 }
 
@@ -226,9 +312,19 @@ S32 SYS_Bind(MppProcessFlowCtx *ctx, MppProcessNode *src_node,
 void SYS_Unbind(MppProcessFlowCtx *ctx) {
   S32 i = 0;
   if (ctx) {
+    ctx->bExit = MPP_TRUE;
+    mpp_notify_signal(ctx->nExitEventFd);
+    for (i = 0; i < ctx->nNodeNum - 1; i++) {
+      pthread_join(ctx->pthread[i], NULL);
+    }
+
+    if (ctx->nResultEpollFd >= 0) close(ctx->nResultEpollFd);
+    ctx->nResultEpollFd = -1;
+
     ctx->nNodeNum = 0;
     for (i = 0; i < MAX_NODE_NUM; i++) {
       if (ctx->pNode[i]) {
+        mpp_notify_destory(ctx->pNode[i]->nEventFd);
         free(ctx->pNode[i]);
         ctx->pNode[i] = NULL;
       }
@@ -237,24 +333,21 @@ void SYS_Unbind(MppProcessFlowCtx *ctx) {
 }
 
 void SYS_Handledata(MppProcessFlowCtx *ctx, MppData *sink_data) {
-  ctx->pNode[0]->ops->handle_data(ctx->pNode[0]->pAlBaseContext, sink_data);
+  ctx->pNode[0]->ops->handle_data(ctx->pNode[0], sink_data);
 }
 
 void SYS_Getresult(MppProcessFlowCtx *ctx, MppData *src_data) {
-  S32 ret = 0;
-  while (1) {
-    ret = ctx->pNode[ctx->nNodeNum - 1]->ops->get_result(
-        ctx->pNode[ctx->nNodeNum - 1]->pAlBaseContext, src_data);
-    debug("get_result ctx->nNodeNum = %d, ret = %d", ctx->nNodeNum - 1, ret);
-    if (!ret)
-      break;
-    else
-      usleep(20 * 1000);
-  }
+  MppProcessNode *node = ctx->pNode[ctx->nNodeNum - 1];
+
+  if (ctx->nResultEpollFd < 0) ctx->nResultEpollFd = create_node_epoll(node);
+  if (ctx->nResultEpollFd < 0) return;
+
+  wait_node_result(ctx->nResultEpollFd, node, src_data);
 }
 
 void SYS_Destory(MppProcessFlowCtx *ctx) {
   if (ctx) {
+    mpp_notify_destory(ctx->nExitEventFd);
     free(ctx);
     // ctx = NULL;
   }
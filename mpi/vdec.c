@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-18 11:46:03
- * @LastEditTime: 2024-01-10 14:36:25
+ * @LastEditTime: 2024-06-02 09:40:15
  * @Description: MPP VDEC API, use these API to do video decode
  *               from stream(H.264 etc.) to frame(YUV420)
  */
@@ -25,20 +25,9 @@
 
 #define MODULE_TAG "mpp_vdec"
 
-ALBaseContext *(*dec_create)();
-S32 (*dec_init)(ALBaseContext *ctx, MppVdecPara *para);
-S32 (*dec_getparam)(ALBaseContext *ctx, MppVdecPara **para);
-S32 (*dec_request_input_stream)(ALBaseContext *ctx, MppData *sink_data);
-S32 (*dec_return_input_stream)(ALBaseContext *ctx, MppData *sink_data);
-S32 (*dec_decode)(ALBaseContext *ctx, MppData *sink_data);
-S32 (*dec_process)(ALBaseContext *ctx, MppData *sink_data, MppData *src_data);
-S32 (*dec_get_output_frame)(ALBaseContext *ctx, MppData *src_data);
-S32 (*dec_request_output_frame)(ALBaseContext *ctx, MppData *src_data);
-S32 (*dec_request_output_frame_2)(ALBaseContext *ctx, MppData **src_data);
-S32 (*dec_return_output_frame)(ALBaseContext *ctx, MppData *src_data);
-S32 (*dec_flush)(ALBaseContext *ctx);
-S32 (*dec_reset)(ALBaseContext *ctx);
-void (*dec_destory)(ALBaseContext *ctx);
+#define VDEC_LOAD_SYMBOL(ctx, op, symbol)                   \
+  ctx->stVdecOps.op = (__typeof__(ctx->stVdecOps.op))dlsym( \
+      module_get_so_path(ctx->pModule), symbol)
 
 MppVdecCtx *VDEC_CreateChannel() {
   MppVdecCtx *ctx = (MppVdecCtx *)malloc(sizeof(MppVdecCtx));
@@ -50,68 +39,85 @@ MppVdecCtx *VDEC_CreateChannel() {
   memset(ctx, 0, sizeof(MppVdecCtx));
   VDEC_GetDefaultParam(ctx);
 
-  dec_create = (ALBaseContext * (*)())NULL;
-  dec_init = (S32(*)(ALBaseContext * ctx, MppVdecPara * para))NULL;
-  dec_getparam = (S32(*)(ALBaseContext * ctx, MppVdecPara * *para))NULL;
-  dec_request_input_stream = (S32(*)(ALBaseContext * ctx, MppData * sink_data))NULL;
-  dec_return_input_stream = (S32(*)(ALBaseContext * ctx, MppData * sink_data))NULL;
-  dec_decode = (S32(*)(ALBaseContext * ctx, MppData * sink_data))NULL;
-  dec_process =
-      (S32(*)(ALBaseContext * ctx, MppData * sink_data, MppData * src_data))NULL;
-  dec_get_output_frame = (S32(*)(ALBaseContext * ctx, MppData * src_data))NULL;
-  dec_request_output_frame = (S32(*)(ALBaseContext * ctx, MppData * src_data))NULL;
-  dec_request_output_frame_2 =
-      (S32(*)(ALBaseContext * ctx, MppData * *src_data))NULL;
-  dec_return_output_frame = (S32(*)(ALBaseContext * ctx, MppData * src_data))NULL;
-  dec_destory = (void (*)(ALBaseContext * ctx))NULL;
-  dec_flush = (S32(*)(ALBaseContext * ctx))NULL;
-  dec_reset = (S32(*)(ALBaseContext * ctx))NULL;
-
   ctx->pModule = NULL;
   debug("create VDEC Channel success!");
   return ctx;
 }
 
+/**
+ * @description: open the decoder on the module of the channel
+ */
+static S32 open_decoder(MppVdecCtx *ctx) {
+  VDEC_LOAD_SYMBOL(ctx, create, "al_dec_create");
+  VDEC_LOAD_SYMBOL(ctx, init, "al_dec_init");
+  VDEC_LOAD_SYMBOL(ctx, getparam, "al_dec_getparam");
+  VDEC_LOAD_SYMBOL(ctx, request_input_stream, "al_dec_request_input_stream");
+  VDEC_LOAD_SYMBOL(ctx, return_input_stream, "al_dec_return_input_stream");
+  VDEC_LOAD_SYMBOL(ctx, decode, "al_dec_decode");
+  VDEC_LOAD_SYMBOL(ctx, process, "al_dec_process");
+  VDEC_LOAD_SYMBOL(ctx, get_output_frame, "al_dec_get_output_frame");
+  VDEC_LOAD_SYMBOL(ctx, request_output_frame, "al_dec_request_output_frame");
+  VDEC_LOAD_SYMBOL(ctx, request_output_frame_2,
+                   "al_dec_request_output_frame_2");
+  VDEC_LOAD_SYMBOL(ctx, return_output_frame, "al_dec_return_output_frame");
+  VDEC_LOAD_SYMBOL(ctx, destory, "al_dec_destory");
+  VDEC_LOAD_SYMBOL(ctx, flush, "al_dec_flush");
+  VDEC_LOAD_SYMBOL(ctx, reset, "al_dec_reset");
+
+  if (!ctx->stVdecOps.create || !ctx->stVdecOps.init) {
+    error("can not find al_dec_create/al_dec_init, please check!");
+    return MPP_INIT_FAILED;
+  }
+
+  ctx->pNode.pAlBaseContext = ctx->stVdecOps.create();
+  if (!ctx->pNode.pAlBaseContext) {
+    error("can not create AL decoder, please check!");
+    return MPP_INIT_FAILED;
+  }
+
+  return ctx->stVdecOps.init(ctx->pNode.pAlBaseContext, &(ctx->stVdecPara));
+}
+
 S32 VDEC_Init(MppVdecCtx *ctx) {
+  BOOL auto_select = CODEC_AUTO == ctx->eCodecType;
+  MppModule *next = NULL;
   S32 ret = 0;
 
-  ctx->pModule = module_init(ctx->eCodecType);
-
-  dec_create = (ALBaseContext * (*)())
-      dlsym(module_get_so_path(ctx->pModule), "al_dec_create");
-  dec_init = (S32(*)(ALBaseContext * ctx, MppVdecPara * para))
-      dlsym(module_get_so_path(ctx->pModule), "al_dec_init");
-  dec_getparam = (S32(*)(ALBaseContext * ctx, MppVdecPara * *para))
-      dlsym(module_get_so_path(ctx->pModule), "al_dec_getparam");
-  dec_request_input_stream = (S32(*)(ALBaseContext * ctx, MppData * sink_data))
-      dlsym(module_get_so_path(ctx->pModule), "al_dec_request_input_stream");
-  dec_return_input_stream = (S32(*)(ALBaseContext * ctx, MppData * sink_data))
-      dlsym(module_get_so_path(ctx->pModule), "al_dec_return_input_stream");
-  dec_decode = (S32(*)(ALBaseContext * ctx, MppData * sink_data))
-      dlsym(module_get_so_path(ctx->pModule), "al_dec_decode");
-  dec_process =
-      (S32(*)(ALBaseContext * ctx, MppData * sink_data, MppData * src_data))
-          dlsym(module_get_so_path(ctx->pModule), "al_dec_process");
-  dec_get_output_frame = (S32(*)(ALBaseContext * ctx, MppData * src_data))
-      dlsym(module_get_so_path(ctx->pModule), "al_dec_get_output_frame");
-  dec_request_output_frame = (S32(*)(ALBaseContext * ctx, MppData * src_data))
-      dlsym(module_get_so_path(ctx->pModule), "al_dec_request_output_frame");
-  dec_request_output_frame_2 =
-      (S32(*)(ALBaseContext * ctx, MppData * *src_data)) dlsym(
-          module_get_so_path(ctx->pModule), "al_dec_request_output_frame_2");
-  dec_return_output_frame = (S32(*)(ALBaseContext * ctx, MppData * src_data))
-      dlsym(module_get_so_path(ctx->pModule), "al_dec_return_output_frame");
-  dec_destory = (void (*)(ALBaseContext * ctx))
-      dlsym(module_get_so_path(ctx->pModule), "al_dec_destory");
-  dec_flush = (S32(*)(ALBaseContext * ctx))
-      dlsym(module_get_so_path(ctx->pModule), "al_dec_flush");
-  dec_reset = (S32(*)(ALBaseContext * ctx))
-      dlsym(module_get_so_path(ctx->pModule), "al_dec_reset");
-
-  ctx->pNode.pAlBaseContext = dec_create();
-
-  ret = dec_init(ctx->pNode.pAlBaseContext, &(ctx->stVdecPara));
-  debug("init VDEC Channel, ret = %d", ret);
+  if (auto_select) {
+    ctx->pModule = module_auto_init(
+        ctx->stVdecPara.eCodingType, MPP_FALSE,
+        ctx->stVdecPara.eOutputPixelFormat, ctx->stVdecPara.nWidth,
+        ctx->stVdecPara.nHeight);
+  } else {
+    ctx->pModule = module_init(ctx->eCodecType);
+  }
+  if (!ctx->pModule) {
+    error("can not init module, please check!");
+    return MPP_INIT_FAILED;
+  }
+
+  while (1) {
+    if (auto_select) ctx->eCodecType = module_get_type(ctx->pModule);
+    ret = open_decoder(ctx);
+    debug("init VDEC Channel on %s, ret = %d",
+          mpp_moduletype2str(ctx->eCodecType), ret);
+    if (MPP_OK == ret || !auto_select) break;
+
+    // the device of the plugin may be busy or gone, try the next one
+    next = module_auto_next(ctx->pModule, ctx->stVdecPara.eCodingType,
+                            MPP_FALSE, ctx->stVdecPara.eOutputPixelFormat,
+                            ctx->stVdecPara.nWidth, ctx->stVdecPara.nHeight);
+    if (!next) break;
+
+    error("can not init %s, try %s", mpp_moduletype2str(ctx->eCodecType),
+          mpp_moduletype2str(module_get_type(next)));
+    if (ctx->stVdecOps.destory && ctx->pNode.pAlBaseContext)
+      ctx->stVdecOps.destory(ctx->pNode.pAlBaseContext);
+    ctx->pNode.pAlBaseContext = NULL;
+    memset(&ctx->stVdecOps, 0, sizeof(ctx->stVdecOps));
+    module_destory(ctx->pModule);
+    ctx->pModule = next;
+  }
 
   return ret;
 }
@@ -123,7 +129,7 @@ S32 VDEC_SetParam(MppVdecCtx *ctx) {
 
 S32 VDEC_GetParam(MppVdecCtx *ctx, MppVdecPara **stVdecPara) {
   S32 ret = 0;
-  ret = dec_getparam(ctx->pNode.pAlBaseContext, stVdecPara);
+  ret = ctx->stVdecOps.getparam(ctx->pNode.pAlBaseContext, stVdecPara);
   debug("get VDEC parameters, ret = %d", ret);
 
   return ret;
@@ -147,92 +153,114 @@ S32 VDEC_GetDefaultParam(MppVdecCtx *ctx) {
   ctx->stVdecPara.bDispErrorFrame = MPP_TRUE;
   ctx->stVdecPara.bInputBlockModeEnable = MPP_FALSE;
   ctx->stVdecPara.bOutputBlockModeEnable = MPP_TRUE;
+  ctx->stVdecPara.nThreadCount = 0;
+  ctx->stVdecPara.eThreadType = CODEC_THREAD_AUTO;
 
   return MPP_OK;
 }
 
-S32 handle_vdec_data(ALBaseContext *base_context, MppData *sink_data) {
+S32 handle_vdec_data(MppProcessNode *node, MppData *sink_data) {
+  MppVdecCtx *ctx = (MppVdecCtx *)node;
   S32 ret = 0;
-  ret = dec_decode(base_context, sink_data);
+  ret = ctx->stVdecOps.decode(node->pAlBaseContext, sink_data);
 
   return ret;
 }
 
+S32 VDEC_RequestInputStream(MppVdecCtx *ctx, MppData *sink_data) {
+  if (!ctx->stVdecOps.request_input_stream) return MPP_NOT_SUPPORTED_FORMAT;
+
+  return ctx->stVdecOps.request_input_stream(ctx->pNode.pAlBaseContext,
+                                             sink_data);
+}
+
+S32 VDEC_ReturnInputStream(MppVdecCtx *ctx, MppData *sink_data) {
+  if (!ctx->stVdecOps.return_input_stream) return MPP_NOT_SUPPORTED_FORMAT;
+
+  return ctx->stVdecOps.return_input_stream(ctx->pNode.pAlBaseContext,
+                                            sink_data);
+}
+
 S32 VDEC_Decode(MppVdecCtx *ctx, MppData *sink_data) {
   S32 ret = 0;
-  ret = handle_vdec_data(ctx->pNode.pAlBaseContext, sink_data);
+  ret = handle_vdec_data(&(ctx->pNode), sink_data);
   debug("decode one packet, ret = %d", ret);
 
   return ret;
 }
 
-S32 process_vdec_data(ALBaseContext *base_context, MppData *sink_data,
+S32 process_vdec_data(MppProcessNode *node, MppData *sink_data,
                       MppData *src_data) {
+  MppVdecCtx *ctx = (MppVdecCtx *)node;
   S32 ret = 0;
-  ret = dec_process(base_context, sink_data, src_data);
+  ret = ctx->stVdecOps.process(node->pAlBaseContext, sink_data, src_data);
 
   return ret;
 }
 
 S32 VDEC_Process(MppVdecCtx *ctx, MppData *sink_data, MppData *src_data) {
   S32 ret = 0;
-  ret = process_vdec_data(ctx->pNode.pAlBaseContext, sink_data, src_data);
+  ret = process_vdec_data(&(ctx->pNode), sink_data, src_data);
 
   return ret;
 }
 
-S32 get_vdec_result_sync(ALBaseContext *base_context, MppData *src_data) {
+S32 get_vdec_result_sync(MppProcessNode *node, MppData *src_data) {
+  MppVdecCtx *ctx = (MppVdecCtx *)node;
   S32 ret = 0;
-  ret = dec_get_output_frame(base_context, src_data);
+  ret = ctx->stVdecOps.get_output_frame(node->pAlBaseContext, src_data);
 
   return ret;
 }
 
 S32 VDEC_GetOutputFrame(MppVdecCtx *ctx, MppData *src_data) {
   S32 ret = 0;
-  ret = get_vdec_result_sync(ctx->pNode.pAlBaseContext, src_data);
+  ret = get_vdec_result_sync(&(ctx->pNode), src_data);
 
   return ret;
 }
 
-S32 get_vdec_result(ALBaseContext *base_context, MppData *src_data) {
+S32 get_vdec_result(MppProcessNode *node, MppData *src_data) {
+  MppVdecCtx *ctx = (MppVdecCtx *)node;
   S32 ret = 0;
-  ret = dec_request_output_frame(base_context, src_data);
+  ret = ctx->stVdecOps.request_output_frame(node->pAlBaseContext, src_data);
 
   return ret;
 }
 
-S32 get_vdec_result_2(ALBaseContext *base_context, MppData **src_data) {
+S32 get_vdec_result_2(MppProcessNode *node, MppData **src_data) {
+  MppVdecCtx *ctx = (MppVdecCtx *)node;
   S32 ret = 0;
-  ret = dec_request_output_frame_2(base_context, src_data);
+  ret = ctx->stVdecOps.request_output_frame_2(node->pAlBaseContext, src_data);
 
   return ret;
 }
 
 S32 VDEC_RequestOutputFrame(MppVdecCtx *ctx, MppData *src_data) {
   S32 ret = 0;
-  ret = get_vdec_result(ctx->pNode.pAlBaseContext, src_data);
+  ret = get_vdec_result(&(ctx->pNode), src_data);
 
   return ret;
 }
 
 S32 VDEC_RequestOutputFrame_2(MppVdecCtx *ctx, MppData **src_data) {
   S32 ret = 0;
-  ret = get_vdec_result_2(ctx->pNode.pAlBaseContext, src_data);
+  ret = get_vdec_result_2(&(ctx->pNode), src_data);
 
   return ret;
 }
 
-S32 return_vdec_result(ALBaseContext *base_context, MppData *src_data) {
+S32 return_vdec_result(MppProcessNode *node, MppData *src_data) {
+  MppVdecCtx *ctx = (MppVdecCtx *)node;
   S32 ret = 0;
-  ret = dec_return_output_frame(base_context, src_data);
+  ret = ctx->stVdecOps.return_output_frame(node->pAlBaseContext, src_data);
 
   return ret;
 }
 
 S32 VDEC_ReturnOutputFrame(MppVdecCtx *ctx, MppData *src_data) {
   S32 ret = 0;
-  ret = return_vdec_result(ctx->pNode.pAlBaseContext, src_data);
+  ret = return_vdec_result(&(ctx->pNode), src_data);
 
   return ret;
 }
@@ -240,7 +268,7 @@ S32 VDEC_Flush(MppVdecCtx *ctx) {
   S32 ret = 0;
 
   debug("begin flush!");
-  ret = dec_flush(ctx->pNode.pAlBaseContext);
+  ret = ctx->stVdecOps.flush(ctx->pNode.pAlBaseContext);
   debug("finish flush ret = %d", ret);
 
   return ret;
@@ -252,7 +280,8 @@ S32 VDEC_DestoryChannel(MppVdecCtx *ctx) {
     return MPP_NULL_POINTER;
   }
 
-  if (dec_destory) dec_destory(ctx->pNode.pAlBaseContext);
+  if (ctx->stVdecOps.destory && ctx->pNode.pAlBaseContext)
+    ctx->stVdecOps.destory(ctx->pNode.pAlBaseContext);
   debug("finish destory decoder");
 
   if (ctx->pModule) module_destory(ctx->pModule);
@@ -266,7 +295,7 @@ S32 VDEC_DestoryChannel(MppVdecCtx *ctx) {
 
 S32 VDEC_ResetChannel(MppVdecCtx *ctx) {
   S32 ret = 0;
-  ret = dec_reset(ctx->pNode.pAlBaseContext);
+  ret = ctx->stVdecOps.reset(ctx->pNode.pAlBaseContext);
 
   return ret;
 }
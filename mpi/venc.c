@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-17 09:38:36
- * @LastEditTime: 2024-05-07 15:19:10
+ * @LastEditTime: 2024-06-02 09:40:15
  * @Description: MPP VENC API, use these API to do video encode
  *               from frame(YUV420) to stream(H.264 etc.)
  */
@@ -16,24 +16,16 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "al_interface_enc.h"
 #include "log.h"
 
 #define MODULE_TAG "mpp_venc"
 
-ALBaseContext *(*enc_create)();
-void (*enc_init)(ALBaseContext *ctx, MppVencPara *para);
-S32 (*enc_set_para)(ALBaseContext *ctx, MppVencPara *para);
-S32 (*enc_return_input_frame)(ALBaseContext *ctx, MppData *sink_Data);
-S32 (*enc_send_input_frame)(ALBaseContext *ctx, MppData *sink_Data);
-S32 (*enc_encode)(ALBaseContext *ctx, MppData *sink_data);
-S32 (*enc_process)(ALBaseContext *ctx, MppData *sink_data, MppData *src_data);
-S32 (*enc_get_output_stream)(ALBaseContext *ctx, MppData *src_Data);
-S32 (*enc_request_output_stream)(ALBaseContext *ctx, MppData *src_Data);
-S32 (*enc_return_output_stream)(ALBaseContext *ctx, MppData *src_Data);
-S32 (*enc_flush)(ALBaseContext *ctx);
-void (*enc_destory)(ALBaseContext *ctx);
+#define VENC_LOAD_SYMBOL(ctx, op, symbol)                   \
+  ctx->stVencOps.op = (__typeof__(ctx->stVencOps.op))dlsym( \
+      module_get_so_path(ctx->pModule), symbol)
 
 MppVencCtx *VENC_CreateChannel() {
   MppVencCtx *ctx = (MppVencCtx *)malloc(sizeof(MppVencCtx));
@@ -41,63 +33,87 @@ MppVencCtx *VENC_CreateChannel() {
     error("can not create MppVencCtx, please check !");
     return NULL;
   }
-
-  enc_create = (ALBaseContext * (*)())NULL;
-  enc_init = (void (*)(ALBaseContext * ctx, MppVencPara * para))NULL;
-  enc_set_para = (S32(*)(ALBaseContext * ctx, MppVencPara * para))NULL;
-  enc_return_input_frame = (S32(*)(ALBaseContext * ctx, MppData * sink_Data))NULL;
-  enc_send_input_frame = (S32(*)(ALBaseContext * ctx, MppData * sink_Data))NULL;
-  enc_encode = (S32(*)(ALBaseContext * ctx, MppData * sink_data))NULL;
-  enc_process =
-      (S32(*)(ALBaseContext * ctx, MppData * sink_data, MppData * src_data))NULL;
-  enc_get_output_stream = (S32(*)(ALBaseContext * ctx, MppData * src_Data))NULL;
-  enc_request_output_stream = (S32(*)(ALBaseContext * ctx, MppData * src_Data))NULL;
-  enc_return_output_stream = (S32(*)(ALBaseContext * ctx, MppData * src_Data))NULL;
-  enc_flush = (S32(*)(ALBaseContext * ctx))NULL;
-  enc_destory = (void (*)(ALBaseContext * ctx))NULL;
+  memset(ctx, 0, sizeof(MppVencCtx));
 
   ctx->pModule = NULL;
 
   return ctx;
 }
 
+/**
+ * @description: open the encoder on the module of the channel
+ */
+static S32 open_encoder(MppVencCtx *ctx) {
+  VENC_LOAD_SYMBOL(ctx, create, "al_enc_create");
+  VENC_LOAD_SYMBOL(ctx, init, "al_enc_init");
+  VENC_LOAD_SYMBOL(ctx, set_para, "al_enc_set_para");
+  VENC_LOAD_SYMBOL(ctx, return_input_frame, "al_enc_return_input_frame");
+  VENC_LOAD_SYMBOL(ctx, send_input_frame, "al_enc_send_input_frame");
+  VENC_LOAD_SYMBOL(ctx, encode, "al_enc_encode");
+  VENC_LOAD_SYMBOL(ctx, process, "al_enc_process");
+  VENC_LOAD_SYMBOL(ctx, get_output_stream, "al_enc_get_output_stream");
+  VENC_LOAD_SYMBOL(ctx, request_output_stream, "al_enc_request_output_stream");
+  VENC_LOAD_SYMBOL(ctx, return_output_stream, "al_enc_return_output_stream");
+  VENC_LOAD_SYMBOL(ctx, flush, "al_enc_flush");
+  VENC_LOAD_SYMBOL(ctx, destory, "al_enc_destory");
+
+  if (!ctx->stVencOps.create || !ctx->stVencOps.init) {
+    error("can not find al_enc_create/al_enc_init, please check!");
+    return MPP_INIT_FAILED;
+  }
+
+  ctx->pNode.pAlBaseContext = ctx->stVencOps.create();
+  if (!ctx->pNode.pAlBaseContext) {
+    error("can not create AL encoder, please check!");
+    return MPP_INIT_FAILED;
+  }
+
+  return ctx->stVencOps.init(ctx->pNode.pAlBaseContext, &(ctx->stVencPara));
+}
+
 S32 VENC_Init(MppVencCtx *ctx) {
-  ctx->pModule = module_init(ctx->eCodecType);
-
-  enc_create = (ALBaseContext * (*)())
-      dlsym(module_get_so_path(ctx->pModule), "al_enc_create");
-  enc_init = (void (*)(ALBaseContext * ctx, MppVencPara * para))
-      dlsym(module_get_so_path(ctx->pModule), "al_enc_init");
-  enc_set_para = (S32(*)(ALBaseContext * ctx, MppVencPara * para))
-      dlsym(module_get_so_path(ctx->pModule), "al_enc_set_para");
-  enc_return_input_frame = (S32(*)(ALBaseContext * ctx, MppData * sink_Data))
-      dlsym(module_get_so_path(ctx->pModule), "al_enc_return_input_frame");
-  enc_send_input_frame = (S32(*)(ALBaseContext * ctx, MppData * sink_Data))
-      dlsym(module_get_so_path(ctx->pModule), "al_enc_send_input_frame");
-  enc_encode = (S32(*)(ALBaseContext * ctx, MppData * sink_data))
-      dlsym(module_get_so_path(ctx->pModule), "al_enc_encode");
-  enc_process =
-      (S32(*)(ALBaseContext * ctx, MppData * sink_data, MppData * src_data))
-          dlsym(module_get_so_path(ctx->pModule), "al_enc_process");
-  enc_get_output_stream = (S32(*)(ALBaseContext * ctx, MppData * src_Data))
-      dlsym(module_get_so_path(ctx->pModule), "al_enc_get_output_stream");
-  enc_request_output_stream = (S32(*)(ALBaseContext * ctx, MppData * src_Data))
-      dlsym(module_get_so_path(ctx->pModule), "al_enc_request_output_stream");
-  enc_return_output_stream = (S32(*)(ALBaseContext * ctx, MppData * src_Data))
-      dlsym(module_get_so_path(ctx->pModule), "al_enc_return_output_stream");
-  enc_flush = (S32(*)(ALBaseContext * ctx))
-      dlsym(module_get_so_path(ctx->pModule), "al_enc_flush");
-  enc_destory = (void (*)(ALBaseContext * ctx))
-      dlsym(module_get_so_path(ctx->pModule), "al_enc_destory");
-
-  ctx->pNode.pAlBaseContext = enc_create();
-
-  enc_init(ctx->pNode.pAlBaseContext, &(ctx->stVencPara));
-  return 0;
+  BOOL auto_select = CODEC_AUTO == ctx->eCodecType;
+  MppModule *next = NULL;
+  S32 ret = 0;
+
+  if (auto_select) {
+    ctx->pModule = module_auto_init(
+        ctx->stVencPara.eCodingType, MPP_TRUE, ctx->stVencPara.PixelFormat,
+        ctx->stVencPara.nWidth, ctx->stVencPara.nHeight);
+  } else {
+    ctx->pModule = module_init(ctx->eCodecType);
+  }
+  if (!ctx->pModule) {
+    error("can not init module, please check!");
+    return MPP_INIT_FAILED;
+  }
+
+  while (1) {
+    if (auto_select) ctx->eCodecType = module_get_type(ctx->pModule);
+    ret = open_encoder(ctx);
+    if (MPP_OK == ret || !auto_select) break;
+
+    // the device of the plugin may be busy or gone, try the next one
+    next = module_auto_next(ctx->pModule, ctx->stVencPara.eCodingType,
+                            MPP_TRUE, ctx->stVencPara.PixelFormat,
+                            ctx->stVencPara.nWidth, ctx->stVencPara.nHeight);
+    if (!next) break;
+
+    error("can not init %s, try %s", mpp_moduletype2str(ctx->eCodecType),
+          mpp_moduletype2str(module_get_type(next)));
+    if (ctx->stVencOps.destory && ctx->pNode.pAlBaseContext)
+      ctx->stVencOps.destory(ctx->pNode.pAlBaseContext);
+    ctx->pNode.pAlBaseContext = NULL;
+    memset(&ctx->stVencOps, 0, sizeof(ctx->stVencOps));
+    module_destory(ctx->pModule);
+    ctx->pModule = next;
+  }
+
+  return ret;
 }
 
 S32 VENC_SetParam(MppVencCtx *ctx, MppVencPara *para) {
-  S32 ret = enc_set_para(ctx->pNode.pAlBaseContext, para);
+  S32 ret = ctx->stVencOps.set_para(ctx->pNode.pAlBaseContext, para);
 
   return ret;
 }
@@ -106,97 +122,103 @@ S32 VENC_GetParam(MppVencCtx *ctx, MppVencPara *para) { return 0; }
 
 S32 VENC_SendInputFrame(MppVencCtx *ctx, MppData *sink_data) {
   S32 ret = 0;
-  ret = enc_send_input_frame(ctx->pNode.pAlBaseContext, sink_data);
+  ret = ctx->stVencOps.send_input_frame(ctx->pNode.pAlBaseContext, sink_data);
 
   return ret;
 }
 
 S32 VENC_ReturnInputFrame(MppVencCtx *ctx, MppData *sink_data) {
   S32 ret = 0;
-  ret = enc_return_input_frame(ctx->pNode.pAlBaseContext, sink_data);
+  ret = ctx->stVencOps.return_input_frame(ctx->pNode.pAlBaseContext, sink_data);
 
   return ret;
 }
 
-S32 handle_venc_data(ALBaseContext *base_context, MppData *sink_data) {
+S32 handle_venc_data(MppProcessNode *node, MppData *sink_data) {
+  MppVencCtx *ctx = (MppVencCtx *)node;
   S32 ret = 0;
-  ret = enc_encode(base_context, sink_data);
+  ret = ctx->stVencOps.encode(node->pAlBaseContext, sink_data);
 
   return ret;
 }
 
 S32 VENC_Encode(MppVencCtx *ctx, MppData *sink_data) {
   S32 ret = 0;
-  ret = handle_venc_data(ctx->pNode.pAlBaseContext, sink_data);
+  ret = handle_venc_data(&(ctx->pNode), sink_data);
   return ret;
 }
 
-S32 process_venc_data(ALBaseContext *base_context, MppData *sink_data,
+S32 process_venc_data(MppProcessNode *node, MppData *sink_data,
                       MppData *src_data) {
+  MppVencCtx *ctx = (MppVencCtx *)node;
   S32 ret = 0;
-  ret = enc_process(base_context, sink_data, src_data);
+  ret = ctx->stVencOps.process(node->pAlBaseContext, sink_data, src_data);
 
   return ret;
 }
 
 S32 VENC_Process(MppVencCtx *ctx, MppData *sink_data, MppData *src_data) {
   S32 ret = 0;
-  ret = process_venc_data(ctx->pNode.pAlBaseContext, sink_data, src_data);
+  ret = process_venc_data(&(ctx->pNode), sink_data, src_data);
   return ret;
 }
 
-S32 get_venc_result_sync(ALBaseContext *base_context, MppData *src_data) {
+S32 get_venc_result_sync(MppProcessNode *node, MppData *src_data) {
+  MppVencCtx *ctx = (MppVencCtx *)node;
   S32 ret = 0;
-  ret = enc_get_output_stream(base_context, src_data);
+  ret = ctx->stVencOps.get_output_stream(node->pAlBaseContext, src_data);
 
   return ret;
 }
 
 S32 VENC_GetOutputStreamBuffer(MppVencCtx *ctx, MppData *src_data) {
   S32 ret = 0;
-  ret = get_venc_result_sync(ctx->pNode.pAlBaseContext, src_data);
+  ret = get_venc_result_sync(&(ctx->pNode), src_data);
 
   return ret;
 }
 
-S32 get_venc_result(ALBaseContext *base_context, MppData *src_data) {
+S32 get_venc_result(MppProcessNode *node, MppData *src_data) {
+  MppVencCtx *ctx = (MppVencCtx *)node;
   S32 ret = 0;
-  ret = enc_request_output_stream(base_context, src_data);
+  ret = ctx->stVencOps.request_output_stream(node->pAlBaseContext, src_data);
 
   return ret;
 }
 
 S32 VENC_RequestOutputStreamBuffer(MppVencCtx *ctx, MppData *src_data) {
   S32 ret = 0;
-  ret = get_venc_result(ctx->pNode.pAlBaseContext, src_data);
+  ret = get_venc_result(&(ctx->pNode), src_data);
 
   return ret;
 }
 
-S32 return_venc_result(ALBaseContext *base_context, MppData *src_data) {
+S32 return_venc_result(MppProcessNode *node, MppData *src_data) {
+  MppVencCtx *ctx = (MppVencCtx *)node;
   S32 ret = 0;
-  ret = enc_return_output_stream(base_context, src_data);
+  ret = ctx->stVencOps.return_output_stream(node->pAlBaseContext, src_data);
 
   return ret;
 }
 
 S32 VENC_ReturnOutputStreamBuffer(MppVencCtx *ctx, MppData *src_data) {
   S32 ret = 0;
-  ret = return_venc_result(ctx->pNode.pAlBaseContext, src_data);
+  ret = return_venc_result(&(ctx->pNode), src_data);
 
   return ret;
 }
 
 S32 VENC_Flush(MppVencCtx *ctx) {
   S32 ret = 0;
-  ret = enc_flush(ctx->pNode.pAlBaseContext);
+  ret = ctx->stVencOps.flush(ctx->pNode.pAlBaseContext);
 
   return ret;
 }
 
 S32 VENC_DestoryChannel(MppVencCtx *ctx) {
   if (ctx) {
-    if (enc_destory) enc_destory(ctx->pNode.pAlBaseContext);
+    if (ctx->stVencOps.destory && ctx->pNode.pAlBaseContext)
+      ctx->stVencOps.destory(ctx->pNode.pAlBaseContext);
     if (ctx->pModule) module_destory(ctx->pModule);
     free(ctx);
   }
@@ -0,0 +1,309 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-21 17:05:12
+ * @LastEditTime: 2024-05-21 17:05:12
+ * @Description: push/pop throughput and latency of MppDataQueue (SPSC and
+ *               MPMC) against the previous mutex + condvar linked list.
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "argument.h"
+#include "dataqueue.h"
+#include "type.h"
+
+#define BENCH_MAX_THREADS 8
+
+/***
+ * the previous implementation, kept here as the baseline: one malloc per
+ * push, push and pop serialised by one mutex.
+ */
+typedef struct _LegacyNode {
+  struct _LegacyNode *next;
+  void *data;
+} LegacyNode;
+
+typedef struct _LegacyQueue {
+  S32 nMaxNum;
+  atomic_int nCurrentNum;
+  LegacyNode *pQueueHead;
+  LegacyNode *pQueueTail;
+  pthread_mutex_t mutex;
+  pthread_cond_t inCond;
+  pthread_cond_t outCond;
+  BOOL bExit;
+} LegacyQueue;
+
+static void legacy_init(LegacyQueue *queue, S32 max_num) {
+  memset(queue, 0, sizeof(LegacyQueue));
+  queue->nMaxNum = max_num;
+  pthread_mutex_init(&queue->mutex, NULL);
+  pthread_cond_init(&queue->inCond, NULL);
+  pthread_cond_init(&queue->outCond, NULL);
+}
+
+static S32 legacy_push(LegacyQueue *queue, void *data) {
+  LegacyNode *node = (LegacyNode *)malloc(sizeof(LegacyNode));
+  memset(node, 0, sizeof(LegacyNode));
+  node->data = data;
+
+  pthread_mutex_lock(&queue->mutex);
+  if (atomic_load(&queue->nCurrentNum) == queue->nMaxNum) {
+    if (!queue->bExit) pthread_cond_wait(&queue->inCond, &queue->mutex);
+    if (atomic_load(&queue->nCurrentNum) == queue->nMaxNum) {
+      pthread_mutex_unlock(&queue->mutex);
+      free(node);
+      return MPP_DATAQUEUE_FULL;
+    }
+  }
+
+  if (atomic_load(&queue->nCurrentNum) == 0) {
+    queue->pQueueHead = node;
+    queue->pQueueTail = node;
+  } else {
+    queue->pQueueHead->next = node;
+    queue->pQueueHead = node;
+  }
+  atomic_fetch_add(&queue->nCurrentNum, 1);
+  pthread_mutex_unlock(&queue->mutex);
+  pthread_cond_signal(&queue->outCond);
+
+  return MPP_OK;
+}
+
+static void *legacy_pop(LegacyQueue *queue) {
+  LegacyNode *node = NULL;
+  void *data = NULL;
+
+  pthread_mutex_lock(&queue->mutex);
+  if (atomic_load(&queue->nCurrentNum) == 0 && !queue->bExit)
+    pthread_cond_wait(&queue->outCond, &queue->mutex);
+
+  if (atomic_load(&queue->nCurrentNum) == 0) {
+    pthread_mutex_unlock(&queue->mutex);
+    return NULL;
+  }
+
+  node = queue->pQueueTail;
+  queue->pQueueTail = queue->pQueueTail->next;
+  atomic_fetch_sub(&queue->nCurrentNum, 1);
+  pthread_mutex_unlock(&queue->mutex);
+  pthread_cond_signal(&queue->inCond);
+
+  data = node->data;
+  free(node);
+
+  return data;
+}
+
+static void legacy_exit(LegacyQueue *queue) {
+  pthread_mutex_lock(&queue->mutex);
+  queue->bExit = MPP_TRUE;
+  pthread_mutex_unlock(&queue->mutex);
+  pthread_cond_broadcast(&queue->inCond);
+  pthread_cond_broadcast(&queue->outCond);
+}
+
+static void legacy_deinit(LegacyQueue *queue) {
+  pthread_mutex_destroy(&queue->mutex);
+  pthread_cond_destroy(&queue->inCond);
+  pthread_cond_destroy(&queue->outCond);
+}
+
+/***
+ * benchmark
+ */
+typedef enum _BenchType {
+  BENCH_LEGACY = 0,
+  BENCH_SPSC,
+  BENCH_MPMC,
+} BenchType;
+
+typedef struct _BenchContext {
+  BenchType eType;
+  S32 nCount;
+  S32 nCapacity;
+  S32 nThreadNum;
+
+  LegacyQueue stLegacyQueue;
+  MppDataQueue *pQueue;
+
+  /***
+   * item i is &pStamp[i], the push time, pLatency[i] is filled on pop.
+   */
+  S64 *pStamp;
+  S64 *pLatency;
+  atomic_int nProduced;
+  atomic_int nConsumed;
+} BenchContext;
+
+static const MppArgument ArgumentMapping[] = {
+    {"-h", "--help", HELP, "Print this help"},
+    {"-n", "--count", DECODE_FRAME_NUM, "Number of elements, default 1000000"},
+    {"-c", "--capacity", WIDTH, "Capacity of the queue, default 10"},
+    {"-t", "--threads", HEIGHT,
+     "Producers and consumers of MPMC case, default 2"},
+};
+
+static S64 get_time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (S64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *producer(void *private_data) {
+  BenchContext *context = (BenchContext *)private_data;
+  S32 i;
+
+  while ((i = atomic_fetch_add(&context->nProduced, 1)) < context->nCount) {
+    context->pStamp[i] = get_time_ns();
+    if (context->eType == BENCH_LEGACY) {
+      while (legacy_push(&context->stLegacyQueue, &context->pStamp[i]))
+        ;
+    } else {
+      while (DATAQUEUE_PushData(context->pQueue,
+                                (MppData *)&context->pStamp[i]))
+        ;
+    }
+  }
+
+  return NULL;
+}
+
+static void *consumer(void *private_data) {
+  BenchContext *context = (BenchContext *)private_data;
+  S64 *stamp = NULL;
+
+  while (atomic_load(&context->nConsumed) < context->nCount) {
+    if (context->eType == BENCH_LEGACY)
+      stamp = (S64 *)legacy_pop(&context->stLegacyQueue);
+    else
+      stamp = (S64 *)DATAQUEUE_PopData(context->pQueue);
+    if (!stamp) continue;
+
+    context->pLatency[stamp - context->pStamp] = get_time_ns() - *stamp;
+    atomic_fetch_add(&context->nConsumed, 1);
+  }
+
+  return NULL;
+}
+
+static int compare_s64(const void *a, const void *b) {
+  S64 x = *(const S64 *)a, y = *(const S64 *)b;
+  return (x > y) - (x < y);
+}
+
+static void run_bench(BenchContext *context, BenchType type,
+                      const char *name) {
+  pthread_t producers[BENCH_MAX_THREADS], consumers[BENCH_MAX_THREADS];
+  S32 threads = type == BENCH_SPSC ? 1 : context->nThreadNum;
+  S64 start, cost;
+  S32 i;
+
+  context->eType = type;
+  atomic_store(&context->nProduced, 0);
+  atomic_store(&context->nConsumed, 0);
+  if (type == BENCH_LEGACY)
+    legacy_init(&context->stLegacyQueue, context->nCapacity);
+  else
+    context->pQueue = DATAQUEUE_InitWithCapacity(
+        MPP_TRUE, MPP_TRUE, context->nCapacity,
+        type == BENCH_SPSC ? DATAQUEUE_MODE_SPSC : DATAQUEUE_MODE_MPMC);
+
+  start = get_time_ns();
+  for (i = 0; i < threads; i++) {
+    pthread_create(&consumers[i], NULL, consumer, context);
+    pthread_create(&producers[i], NULL, producer, context);
+  }
+  for (i = 0; i < threads; i++) pthread_join(producers[i], NULL);
+  while (atomic_load(&context->nConsumed) < context->nCount) sched_yield();
+  cost = get_time_ns() - start;
+
+  // wake up the consumers still parked on the empty queue
+  if (type == BENCH_LEGACY) {
+    legacy_exit(&context->stLegacyQueue);
+  } else {
+    DATAQUEUE_SetWaitExit(context->pQueue, MPP_TRUE);
+    DATAQUEUE_Cond_BroadCast(context->pQueue);
+  }
+  for (i = 0; i < threads; i++) pthread_join(consumers[i], NULL);
+
+  if (type == BENCH_LEGACY)
+    legacy_deinit(&context->stLegacyQueue);
+  else
+    DATAQUEUE_Destory(context->pQueue);
+
+  qsort(context->pLatency, context->nCount, sizeof(S64), compare_s64);
+  printf("%-8s %dP/%dC %10.0f ops/s  p50 %7lld ns  p99 %8lld ns  "
+         "p99.9 %9lld ns  max %10lld ns\n",
+         name, threads, threads, (double)context->nCount * 1e9 / cost,
+         (long long)context->pLatency[context->nCount / 2],
+         (long long)context->pLatency[(S64)context->nCount * 99 / 100],
+         (long long)context->pLatency[(S64)context->nCount * 999 / 1000],
+         (long long)context->pLatency[context->nCount - 1]);
+}
+
+int main(int argc, char **argv) {
+  BenchContext context;
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  S32 threads = 0;
+  S32 i;
+
+  memset(&context, 0, sizeof(BenchContext));
+  context.nCount = 1000000;
+  context.nCapacity = DATAQUEUE_DEFAULT_CAPACITY;
+  context.nThreadNum = 2;
+
+  for (i = 1; i < argc; i += 2) {
+    ARGUMENT arg = get_argument(ArgumentMapping, argv[i], argument_num);
+    if (arg == HELP || arg == INVALID || i + 1 >= argc) {
+      print_demo_usage(ArgumentMapping, argument_num);
+      return -1;
+    }
+    if (arg == DECODE_FRAME_NUM) sscanf(argv[i + 1], "%d", &context.nCount);
+    if (arg == WIDTH) sscanf(argv[i + 1], "%d", &context.nCapacity);
+    if (arg == HEIGHT) sscanf(argv[i + 1], "%d", &context.nThreadNum);
+  }
+
+  if (context.nCount <= 0 || context.nCapacity <= 0 ||
+      context.nThreadNum <= 0 || context.nThreadNum > BENCH_MAX_THREADS) {
+    error("invalid arguments, please check!");
+    return -1;
+  }
+
+  context.pStamp = (S64 *)malloc(context.nCount * sizeof(S64));
+  context.pLatency = (S64 *)malloc(context.nCount * sizeof(S64));
+  if (!context.pStamp || !context.pLatency) {
+    error("can not malloc %d stamps, please check!", context.nCount);
+    return -1;
+  }
+
+  printf("%d elements, capacity %d\n", context.nCount, context.nCapacity);
+  threads = context.nThreadNum;
+  context.nThreadNum = 1;
+  run_bench(&context, BENCH_LEGACY, "legacy");
+  run_bench(&context, BENCH_SPSC, "spsc");
+  run_bench(&context, BENCH_MPMC, "mpmc");
+  if (threads > 1) {
+    context.nThreadNum = threads;
+    run_bench(&context, BENCH_LEGACY, "legacy");
+    run_bench(&context, BENCH_MPMC, "mpmc");
+  }
+
+  free(context.pStamp);
+  free(context.pLatency);
+
+  return 0;
+}
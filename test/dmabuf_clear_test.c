@@ -0,0 +1,156 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-06-02 09:12:40
+ * @LastEditTime: 2024-06-02 09:12:40
+ * @Description: a DMABUF_INTERNAL frame is cleared when it is allocated or
+ *               recycled, never on the first FRAME_GetDataPointer: data a
+ *               device wrote through the fd before (here a second mapping)
+ *               has to survive it. Needs /dev/dma_heap/linux,cma.
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "argument.h"
+#include "frame.h"
+#include "type.h"
+
+#define MODULE_TAG "dmabuf_clear_test"
+
+#define PATTERN 0x5a
+
+static const MppArgument ArgumentMapping[] = {
+    {"-h", "--help", HELP, "Print this help"},
+    {"-w", "--width", WIDTH, "Frame width, default 1920"},
+    {"-H", "--height", HEIGHT, "Frame height, default 1080"},
+};
+
+/**
+ * @description: write (or check) every byte of the buffer through a mapping
+ * of the fd of its own, as a device would see it.
+ * @return {*}: number of bytes that are not value when checking
+ */
+static S32 access_fd(S32 fd, S32 size, U8 value, BOOL write) {
+  U8 *data = (U8 *)mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  S32 wrong = 0;
+  S32 i;
+
+  if (data == MAP_FAILED) {
+    error("can not mmap fd %d, please check!", fd);
+    return size;
+  }
+
+  if (write) {
+    memset(data, value, size);
+  } else {
+    for (i = 0; i < size; i++) wrong += data[i] != value;
+  }
+  munmap(data, size);
+
+  return wrong;
+}
+
+static S32 count_wrong(const U8 *data, S32 size, U8 value) {
+  S32 wrong = 0;
+  S32 i;
+
+  if (!data) return size;
+  for (i = 0; i < size; i++) wrong += data[i] != value;
+
+  return wrong;
+}
+
+static MppFrame *alloc_frame(S32 width, S32 height) {
+  MppFrame *frame = FRAME_Create();
+
+  if (!frame) return NULL;
+  FRAME_SetBufferType(frame, MPP_FRAME_BUFFERTYPE_DMABUF_INTERNAL);
+  if (FRAME_Alloc(frame, PIXEL_FORMAT_NV12, width, height)) {
+    FRAME_Destory(frame);
+    return NULL;
+  }
+
+  return frame;
+}
+
+S32 main(S32 argc, char **argv) {
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  MppFrame *frame = NULL;
+  S32 width = 1920, height = 1080;
+  S32 size, wrong;
+  S32 ret = -1;
+  S32 i;
+
+  for (i = 1; i < argc; i += 2) {
+    ARGUMENT arg = get_argument(ArgumentMapping, argv[i], argument_num);
+    if (arg == HELP || arg == INVALID || i + 1 >= argc) {
+      print_demo_usage(ArgumentMapping, argument_num);
+      return -1;
+    }
+    if (arg == WIDTH) sscanf(argv[i + 1], "%d", &width);
+    if (arg == HEIGHT) sscanf(argv[i + 1], "%d", &height);
+  }
+
+  if (width <= 0 || height <= 0) {
+    print_demo_usage(ArgumentMapping, argument_num);
+    return -1;
+  }
+  size = width * height * 3 / 2;
+
+  if (access("/dev/dma_heap/linux,cma", R_OK)) {
+    printf("no dma heap, skipped\n");
+    return 0;
+  }
+
+  // a fresh buffer: the device writes it, then the CPU maps it
+  frame = alloc_frame(width, height);
+  if (!frame) {
+    error("can not alloc a dmabuf frame, please check!");
+    return -1;
+  }
+  if (access_fd(FRAME_GetFD(frame, 0), size, PATTERN, MPP_TRUE)) goto finish;
+  wrong = count_wrong((U8 *)FRAME_GetDataPointer(frame, 0), size, PATTERN);
+  printf("device data after the first map: %d bytes lost\n", wrong);
+  if (wrong) goto finish;
+
+  // the same buffer again from the pool, it is cleared before the fd is out
+  FRAME_Free(frame);
+  FRAME_Destory(frame);
+  frame = alloc_frame(width, height);
+  if (!frame) {
+    error("can not alloc a dmabuf frame, please check!");
+    return -1;
+  }
+  if (!getenv("MPP_DMABUF_NO_MEMSET")) {
+    wrong = access_fd(FRAME_GetFD(frame, 0), size, 0, MPP_FALSE);
+    printf("recycled buffer: %d bytes not cleared\n", wrong);
+    if (wrong) goto finish;
+  }
+
+  // and the device data survives the first map of the recycled buffer
+  if (access_fd(FRAME_GetFD(frame, 0), size, PATTERN, MPP_TRUE)) goto finish;
+  wrong = count_wrong((U8 *)FRAME_GetDataPointer(frame, 0), size, PATTERN);
+  printf("device data after the map of the recycled buffer: %d bytes lost\n",
+         wrong);
+  if (wrong) goto finish;
+
+  ret = 0;
+
+finish:
+  if (frame) {
+    FRAME_Free(frame);
+    FRAME_Destory(frame);
+  }
+  if (ret) error("the dmabuf data is not kept, please check!");
+
+  return ret;
+}
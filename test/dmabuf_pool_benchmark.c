@@ -0,0 +1,102 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-22 11:20:36
+ * @LastEditTime: 2024-05-22 11:20:36
+ * @Description: alloc + mmap + free cycles per second of DmaBufWrapper,
+ *               with the pool disabled and enabled.
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "argument.h"
+#include "dmabufwrapper.h"
+#include "type.h"
+
+static const MppArgument ArgumentMapping[] = {
+    {"-h", "--help", HELP, "Print this help"},
+    {"-n", "--count", DECODE_FRAME_NUM, "Number of cycles, default 1000"},
+    {"-w", "--width", WIDTH, "Frame width, default 1920"},
+    {"-H", "--height", HEIGHT, "Frame height, default 1080"},
+    {"-f", "--format", FORMAT, "Dma heap, 0: cma, 1: system, default 1"},
+};
+
+static S64 get_time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (S64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static S32 run_bench(DMAHEAP heap, S32 size, S32 count, S32 pool_size) {
+  DmaBufWrapper *wrapper = NULL;
+  S64 start, cost;
+  S32 i;
+
+  setDmaBufPoolSize(pool_size);
+  wrapper = createPooledDmaBufWrapper(heap);
+  if (!wrapper) {
+    error("can not create DmaBufWrapper, please check!");
+    return -1;
+  }
+
+  start = get_time_ns();
+  for (i = 0; i < count; i++) {
+    if (allocDmaBuf(wrapper, size) < 0 || !mmapDmaBuf(wrapper)) {
+      error("alloc or mmap dma buf failed at cycle %d, please check!", i);
+      destoryDmaBufWrapper(wrapper);
+      return -1;
+    }
+    // touch it like a frame producer would
+    ((U8 *)wrapper->sDmaBuf.pVaddr)[0] = (U8)i;
+    freeDmaBuf(wrapper);
+  }
+  cost = get_time_ns() - start;
+
+  destoryDmaBufWrapper(wrapper);
+  drainDmaBufPool();
+
+  printf("pool %-2d %10.0f cycles/s  %8.1f us/cycle\n", pool_size,
+         (double)count * 1e9 / cost, (double)cost / count / 1000);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  S32 count = 1000, width = 1920, height = 1080;
+  S32 heap = DMA_HEAP_SYSTEM;
+  S32 i;
+
+  for (i = 1; i < argc; i += 2) {
+    ARGUMENT arg = get_argument(ArgumentMapping, argv[i], argument_num);
+    if (arg == HELP || arg == INVALID || i + 1 >= argc) {
+      print_demo_usage(ArgumentMapping, argument_num);
+      return -1;
+    }
+    if (arg == DECODE_FRAME_NUM) sscanf(argv[i + 1], "%d", &count);
+    if (arg == WIDTH) sscanf(argv[i + 1], "%d", &width);
+    if (arg == HEIGHT) sscanf(argv[i + 1], "%d", &height);
+    if (arg == FORMAT) sscanf(argv[i + 1], "%d", &heap);
+  }
+
+  if (count <= 0 || width <= 0 || height <= 0 ||
+      (heap != DMA_HEAP_CMA && heap != DMA_HEAP_SYSTEM)) {
+    error("invalid arguments, please check!");
+    return -1;
+  }
+
+  printf("%d cycles of %dx%d nv12 on %s heap\n", count, width, height,
+         heap == DMA_HEAP_CMA ? "cma" : "system");
+  if (run_bench(heap, width * height * 3 / 2, count, 0)) return -1;
+  if (run_bench(heap, width * height * 3 / 2, count, 1)) return -1;
+
+  return 0;
+}
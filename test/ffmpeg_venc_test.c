@@ -0,0 +1,276 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-06-01 19:05:33
+ * @LastEditTime: 2024-06-01 19:05:33
+ * @Description: encode an I420/NV12 file (the streams in
+ *               test_script/streams/yuv420p) with CODEC_FFMPEG, the file is
+ *               read -l times. Checks that the encoder takes every frame,
+ *               gives every frame id back once and in order, and puts out
+ *               a non-empty stream up to EOS.
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "argument.h"
+#include "const.h"
+#include "type.h"
+#include "venc.h"
+
+typedef struct _TestContext {
+  U8 pInputFileName[DEMO_FILE_NAME_LEN];
+  U8 pOutputFileName[DEMO_FILE_NAME_LEN];
+  MppCodingType eCodingType;
+  MppPixelFormat ePixelFormat;
+  S32 nWidth;
+  S32 nHeight;
+  S32 nLoops;
+
+  U8 *pFrames;
+  S32 nFileFrameNum;
+  S32 nNextId;
+  S64 nStreamBytes;
+  S32 nStreamNum;
+  FILE *pOutputFile;
+} TestContext;
+
+static const MppArgument ArgumentMapping[] = {
+    {"-H", "--help", HELP, "Print help"},
+    {"-i", "--input", INPUT, "Input I420 or NV12 file path"},
+    {"-o", "--output", SAVE_FRAME_FILE, "Save the stream to the file"},
+    {"-c", "--codingtype", CODING_TYPE, "Coding type, default h264"},
+    {"-w", "--width", WIDTH, "Video width"},
+    {"-h", "--height", HEIGHT, "Video height"},
+    {"-f", "--format", FORMAT, "PixelFormat, I420 or NV12, default I420"},
+    {"-l", "--loops", DECODE_FRAME_NUM, "Times the file is encoded, default 30"},
+};
+
+static S32 load_frames(TestContext *context) {
+  S32 frame_size = context->nWidth * context->nHeight * 3 / 2;
+  FILE *file = fopen((char *)context->pInputFileName, "rb");
+  long size;
+
+  if (!file) {
+    error("can not open %s, please check!", context->pInputFileName);
+    return -1;
+  }
+
+  fseek(file, 0, SEEK_END);
+  size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  context->nFileFrameNum = size / frame_size;
+  if (!context->nFileFrameNum) {
+    error("%s has no whole frame of %dx%d, please check!",
+          context->pInputFileName, context->nWidth, context->nHeight);
+    fclose(file);
+    return -1;
+  }
+
+  context->pFrames = (U8 *)malloc((size_t)frame_size * context->nFileFrameNum);
+  if (!context->pFrames ||
+      fread(context->pFrames, frame_size, context->nFileFrameNum, file) !=
+          context->nFileFrameNum) {
+    error("can not read %s, please check!", context->pInputFileName);
+    fclose(file);
+    return -1;
+  }
+  fclose(file);
+
+  return 0;
+}
+
+/**
+ * @description: the frames come back in the order they were sent
+ */
+static S32 return_frames(TestContext *context, MppVencCtx *venc) {
+  S32 id;
+
+  while ((id = VENC_ReturnInputFrame(venc, NULL)) >= 0) {
+    if (id != context->nNextId) {
+      error("frame %d is returned, expect %d", id, context->nNextId);
+      return -1;
+    }
+    context->nNextId++;
+  }
+
+  return 0;
+}
+
+/**
+ * @description: take out all ready streams
+ * @return {*}: MPP_OK, MPP_CODER_EOS or the error code of the encoder
+ */
+static S32 drain(TestContext *context, MppVencCtx *venc, MppPacket *packet) {
+  S32 ret;
+
+  while (1) {
+    ret = VENC_RequestOutputStreamBuffer(venc, PACKET_GetBaseData(packet));
+    if (ret == MPP_CODER_NO_DATA) return MPP_OK;
+    if (ret) return ret;
+
+    context->nStreamBytes += PACKET_GetLength(packet);
+    if (PACKET_GetLength(packet)) context->nStreamNum++;
+    if (context->pOutputFile)
+      fwrite(PACKET_GetDataPointer(packet), 1, PACKET_GetLength(packet),
+             context->pOutputFile);
+    VENC_ReturnOutputStreamBuffer(venc, PACKET_GetBaseData(packet));
+  }
+}
+
+static S32 run_encode(TestContext *context) {
+  S32 frame_size = context->nWidth * context->nHeight * 3 / 2;
+  S32 planes = context->ePixelFormat == PIXEL_FORMAT_NV12 ? 2 : 3;
+  S32 frame_num = context->nFileFrameNum * context->nLoops;
+  MppVencCtx *venc = VENC_CreateChannel();
+  MppPacket *packet = PACKET_Create();
+  MppFrame *frame = FRAME_Create();
+  U8 *data = NULL;
+  S32 ret = -1;
+  S32 i;
+
+  if (!venc || !packet || !frame) {
+    error("can not create the channel, please check!");
+    goto finish;
+  }
+
+  venc->eCodecType = CODEC_FFMPEG;
+  venc->stVencPara.eCodingType = context->eCodingType;
+  venc->stVencPara.nWidth = context->nWidth;
+  venc->stVencPara.nHeight = context->nHeight;
+  venc->stVencPara.nStride = context->nWidth;
+  venc->stVencPara.PixelFormat = context->ePixelFormat;
+  venc->stVencPara.eFrameBufferType = MPP_FRAME_BUFFERTYPE_NORMAL_EXTERNAL;
+  venc->stVencPara.nBitrate = 1000000;
+  venc->stVencPara.nFrameRate = 30;
+  if (VENC_Init(venc)) {
+    error("can not init CODEC_FFMPEG, please check!");
+    goto finish;
+  }
+
+  FRAME_SetBufferType(frame, MPP_FRAME_BUFFERTYPE_NORMAL_EXTERNAL);
+  FRAME_SetDataUsedNum(frame, planes);
+  FRAME_SetWidth(frame, context->nWidth);
+  FRAME_SetHeight(frame, context->nHeight);
+  FRAME_SetLineStride(frame, context->nWidth);
+  FRAME_SetPixelFormat(frame, context->ePixelFormat);
+
+  for (i = 0; i < frame_num; i++) {
+    data = context->pFrames +
+           (size_t)frame_size * (i % context->nFileFrameNum);
+    FRAME_SetDataPointer(frame, 0, data);
+    FRAME_SetDataPointer(frame, 1, data + context->nWidth * context->nHeight);
+    if (planes > 2)
+      FRAME_SetDataPointer(frame, 2,
+                           data + context->nWidth * context->nHeight * 5 / 4);
+    FRAME_SetPts(frame, i);
+    FRAME_SetID(frame, i);
+    FRAME_SetEos(frame,
+                 i == frame_num - 1 ? FRAME_EOS_WITH_DATA : FRAME_NO_EOS);
+
+    while ((ret = VENC_Encode(venc, FRAME_GetBaseData(frame))) ==
+           MPP_DATAQUEUE_FULL) {
+      if ((ret = drain(context, venc, packet))) goto finish;
+    }
+    if (ret) {
+      error("encode frame %d failed, ret = %d", i, ret);
+      goto finish;
+    }
+
+    if (return_frames(context, venc)) goto finish;
+    ret = drain(context, venc, packet);
+    if (ret && ret != MPP_CODER_EOS) goto finish;
+  }
+
+  while (MPP_OK == (ret = drain(context, venc, packet))) {
+  }
+  if (ret != MPP_CODER_EOS) {
+    error("no EOS after the last frame, ret = %d", ret);
+    ret = -1;
+    goto finish;
+  }
+
+  ret = 0;
+  if (context->nNextId != frame_num) {
+    error("%d of %d frames are returned", context->nNextId, frame_num);
+    ret = -1;
+  }
+  if (!context->nStreamNum) {
+    error("no stream is put out");
+    ret = -1;
+  }
+
+finish:
+  if (frame) FRAME_Destory(frame);
+  if (packet) PACKET_Destory(packet);
+  if (venc) VENC_DestoryChannel(venc);
+
+  return ret;
+}
+
+S32 main(S32 argc, char **argv) {
+  TestContext context;
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  S32 ret = -1;
+  S32 i;
+
+  memset(&context, 0, sizeof(TestContext));
+  context.eCodingType = CODING_H264;
+  context.ePixelFormat = PIXEL_FORMAT_I420;
+  context.nLoops = 30;
+
+  for (i = 1; i < argc; i += 2) {
+    ARGUMENT arg = get_argument(ArgumentMapping, argv[i], argument_num);
+    if (arg == HELP || arg == INVALID || i + 1 >= argc) {
+      print_demo_usage(ArgumentMapping, argument_num);
+      return -1;
+    }
+    if (arg == INPUT) sscanf(argv[i + 1], "%2047s", context.pInputFileName);
+    if (arg == SAVE_FRAME_FILE)
+      sscanf(argv[i + 1], "%2047s", context.pOutputFileName);
+    if (arg == CODING_TYPE)
+      sscanf(argv[i + 1], "%d", (S32 *)&(context.eCodingType));
+    if (arg == WIDTH) sscanf(argv[i + 1], "%d", &(context.nWidth));
+    if (arg == HEIGHT) sscanf(argv[i + 1], "%d", &(context.nHeight));
+    if (arg == FORMAT)
+      sscanf(argv[i + 1], "%d", (S32 *)&(context.ePixelFormat));
+    if (arg == DECODE_FRAME_NUM) sscanf(argv[i + 1], "%d", &(context.nLoops));
+  }
+
+  if (!context.pInputFileName[0] || context.nWidth <= 0 ||
+      context.nHeight <= 0 || context.nLoops <= 0 ||
+      (context.ePixelFormat != PIXEL_FORMAT_I420 &&
+       context.ePixelFormat != PIXEL_FORMAT_NV12)) {
+    print_demo_usage(ArgumentMapping, argument_num);
+    return -1;
+  }
+
+  if (load_frames(&context)) goto finish;
+
+  if (context.pOutputFileName[0]) {
+    context.pOutputFile = fopen((char *)context.pOutputFileName, "wb");
+    if (!context.pOutputFile) {
+      error("can not open %s, please check!", context.pOutputFileName);
+      goto finish;
+    }
+  }
+
+  ret = run_encode(&context);
+  printf("%s: %dx%d %s, %d frames, %d streams, %lld bytes, %s\n",
+         context.pInputFileName, context.nWidth, context.nHeight,
+         mpp_pixelformat2str(context.ePixelFormat),
+         context.nFileFrameNum * context.nLoops, context.nStreamNum,
+         (long long)context.nStreamBytes, ret ? "FAILED" : "PASSED");
+
+finish:
+  if (context.pOutputFile) fclose(context.pOutputFile);
+  if (context.pFrames) free(context.pFrames);
+
+  return ret;
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-06-02 11:16:20
+ * @LastEditTime: 2024-06-02 11:16:20
+ * @Description: FRAME_Alloc of a NORMAL_INTERNAL frame gives the planes of
+ *               each format it knows (the decoders copy into them, P010 and
+ *               444 included) with the size and the line stride in bytes,
+ *               and refuses the formats it does not know.
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+#include "type.h"
+
+#define MODULE_TAG "frame_alloc_test"
+
+#define WIDTH 64
+#define HEIGHT 48
+
+typedef struct _TestFormat {
+  MppPixelFormat eFormat;
+  S32 nPlanes;
+  S32 nLineStride;
+  S32 nSize[3];
+} TestFormat;
+
+static const TestFormat TestFormats[] = {
+    {PIXEL_FORMAT_I420,
+     3,
+     WIDTH,
+     {WIDTH * HEIGHT, WIDTH * HEIGHT / 4, WIDTH * HEIGHT / 4}},
+    {PIXEL_FORMAT_YUV422P,
+     3,
+     WIDTH,
+     {WIDTH * HEIGHT, WIDTH * HEIGHT / 2, WIDTH * HEIGHT / 2}},
+    {PIXEL_FORMAT_YUV444P,
+     3,
+     WIDTH,
+     {WIDTH * HEIGHT, WIDTH * HEIGHT, WIDTH * HEIGHT}},
+    {PIXEL_FORMAT_NV12, 2, WIDTH, {WIDTH * HEIGHT, WIDTH * HEIGHT / 2, 0}},
+    {PIXEL_FORMAT_NV12_P010,
+     2,
+     WIDTH * 2,
+     {WIDTH * HEIGHT * 2, WIDTH * HEIGHT, 0}},
+    {PIXEL_FORMAT_RGBA, 1, WIDTH * 4, {WIDTH * HEIGHT * 4, 0, 0}},
+    {PIXEL_FORMAT_YUYV, 1, WIDTH * 2, {WIDTH * HEIGHT * 2, 0, 0}},
+};
+
+static S32 run_case(const TestFormat *format) {
+  MppFrame *frame = FRAME_Create();
+  S32 ret = -1;
+  U8 *data;
+  S32 i;
+
+  if (!frame) return -1;
+  FRAME_SetBufferType(frame, MPP_FRAME_BUFFERTYPE_NORMAL_INTERNAL);
+  if (FRAME_Alloc(frame, format->eFormat, WIDTH, HEIGHT)) {
+    error("can not alloc %s, please check!",
+          mpp_pixelformat2str(format->eFormat));
+    FRAME_Destory(frame);
+    return -1;
+  }
+
+  if (FRAME_GetDataUsedNum(frame) != format->nPlanes ||
+      FRAME_GetWidth(frame) != WIDTH || FRAME_GetHeight(frame) != HEIGHT ||
+      FRAME_GetLineStride(frame) != format->nLineStride ||
+      FRAME_GetPixelFormat(frame) != format->eFormat) {
+    error("%s: %d planes %dx%d stride %d, please check!",
+          mpp_pixelformat2str(format->eFormat), FRAME_GetDataUsedNum(frame),
+          FRAME_GetWidth(frame), FRAME_GetHeight(frame),
+          FRAME_GetLineStride(frame));
+    goto finish;
+  }
+
+  // allocated and cleared to the last byte of each plane
+  for (i = 0; i < format->nPlanes; i++) {
+    data = (U8 *)FRAME_GetDataPointer(frame, i);
+    if (!data || data[format->nSize[i] - 1]) goto finish;
+    memset(data, 0xff, format->nSize[i]);
+  }
+
+  ret = 0;
+
+finish:
+  FRAME_Free(frame);
+  FRAME_Destory(frame);
+
+  return ret;
+}
+
+S32 main(S32 argc, char **argv) {
+  MppFrame *frame = NULL;
+  S32 failed = 0;
+  S32 ret, i;
+
+  for (i = 0; i < NUM_OF(TestFormats); i++) {
+    ret = run_case(&TestFormats[i]);
+    printf("%-12s: %s\n", mpp_pixelformat2str(TestFormats[i].eFormat),
+           ret ? "FAILED" : "PASSED");
+    if (ret) failed++;
+  }
+
+  // a format of unknown planes is refused, not allocated too small
+  frame = FRAME_Create();
+  if (!frame) return -1;
+  FRAME_SetBufferType(frame, MPP_FRAME_BUFFERTYPE_NORMAL_INTERNAL);
+  ret = FRAME_Alloc(frame, PIXEL_FORMAT_RGB_888, WIDTH, HEIGHT);
+  printf("%-12s: %s\n", mpp_pixelformat2str(PIXEL_FORMAT_RGB_888),
+         MPP_NOT_SUPPORTED_FORMAT == ret ? "PASSED" : "FAILED");
+  if (MPP_NOT_SUPPORTED_FORMAT != ret) failed++;
+  FRAME_Free(frame);
+  FRAME_Destory(frame);
+
+  if (failed) error("%d cases failed, please check!", failed);
+  return failed ? -1 : 0;
+}
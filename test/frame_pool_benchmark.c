@@ -0,0 +1,202 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-23 16:12:05
+ * @LastEditTime: 2024-05-23 16:12:05
+ * @Description: create/alloc/free cycles of MppFrame and MppPacket, plain
+ *               calls against MppFramePool/MppPacketPool.
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "argument.h"
+#include "frame.h"
+#include "packet.h"
+#include "type.h"
+
+/***
+ * frames/packets held at the same time, like the queue of a pipeline
+ */
+#define BENCH_IN_FLIGHT 4
+
+static const MppArgument ArgumentMapping[] = {
+    {"-h", "--help", HELP, "Print this help"},
+    {"-n", "--count", DECODE_FRAME_NUM, "Number of cycles, default 1000"},
+    {"-w", "--width", WIDTH, "Frame width, default 3840"},
+    {"-H", "--height", HEIGHT, "Frame height, default 2160"},
+};
+
+static S64 get_time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (S64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void print_result(const char *name, S32 count, S64 cost, S64 size) {
+  printf("%-14s %10.0f cycles/s  %8.2f us/cycle  %9.1f MB/s handed out\n",
+         name, (double)count * 1e9 / cost, (double)cost / count / 1000,
+         (double)size * count * 1e9 / cost / (1024 * 1024));
+}
+
+static S32 bench_frame(S32 count, S32 width, S32 height) {
+  MppFrame *frames[BENCH_IN_FLIGHT];
+  MppFramePool *pool = NULL;
+  MppFramePoolStat stat;
+  S64 size = (S64)width * height * 3 / 2;
+  S64 start;
+  S32 i;
+
+  start = get_time_ns();
+  for (i = 0; i < count; i++) {
+    MppFrame *frame = FRAME_Create();
+    if (!frame || FRAME_Alloc(frame, PIXEL_FORMAT_NV12, width, height)) {
+      error("can not create frame, please check!");
+      return -1;
+    }
+    ((U8 *)FRAME_GetDataPointer(frame, 0))[0] = (U8)i;
+    frames[i % BENCH_IN_FLIGHT] = frame;
+    if (i >= BENCH_IN_FLIGHT - 1) {
+      frame = frames[(i + 1) % BENCH_IN_FLIGHT];
+      FRAME_Free(frame);
+      FRAME_Destory(frame);
+    }
+  }
+  for (i = count > BENCH_IN_FLIGHT - 1 ? count - BENCH_IN_FLIGHT + 1 : 0;
+       i < count; i++) {
+    FRAME_Free(frames[i % BENCH_IN_FLIGHT]);
+    FRAME_Destory(frames[i % BENCH_IN_FLIGHT]);
+  }
+  print_result("frame", count, get_time_ns() - start, size);
+
+  pool = FRAMEPOOL_Create(MPP_FRAME_BUFFERTYPE_NORMAL_INTERNAL,
+                          PIXEL_FORMAT_NV12, width, height, 2,
+                          BENCH_IN_FLIGHT + 1);
+  if (!pool) {
+    error("can not create frame pool, please check!");
+    return -1;
+  }
+
+  start = get_time_ns();
+  for (i = 0; i < count; i++) {
+    MppFrame *frame = FRAMEPOOL_GetFrame(pool);
+    if (!frame) {
+      error("frame pool is empty, please check!");
+      return -1;
+    }
+    ((U8 *)FRAME_GetDataPointer(frame, 0))[0] = (U8)i;
+    frames[i % BENCH_IN_FLIGHT] = frame;
+    if (i >= BENCH_IN_FLIGHT - 1)
+      FRAME_Destory(frames[(i + 1) % BENCH_IN_FLIGHT]);
+  }
+  for (i = count > BENCH_IN_FLIGHT - 1 ? count - BENCH_IN_FLIGHT + 1 : 0;
+       i < count; i++)
+    FRAME_Destory(frames[i % BENCH_IN_FLIGHT]);
+  print_result("frame pool", count, get_time_ns() - start, size);
+
+  FRAMEPOOL_GetStat(pool, &stat);
+  printf("  pool: total %d, in use %d, high water %d, get %lld, miss %lld\n",
+         stat.nTotalNum, stat.nInUseNum, stat.nHighWaterNum,
+         (long long)stat.nGetCount, (long long)stat.nMissCount);
+  FRAMEPOOL_Destory(pool);
+
+  return 0;
+}
+
+static S32 bench_packet(S32 count, S32 size) {
+  MppPacket *packets[BENCH_IN_FLIGHT];
+  MppPacketPool *pool = NULL;
+  MppPacketPoolStat stat;
+  S64 start;
+  S32 i;
+
+  start = get_time_ns();
+  for (i = 0; i < count; i++) {
+    MppPacket *packet = PACKET_Create();
+    if (!packet || PACKET_Alloc(packet, size)) {
+      error("can not create packet, please check!");
+      return -1;
+    }
+    ((U8 *)PACKET_GetDataPointer(packet))[0] = (U8)i;
+    packets[i % BENCH_IN_FLIGHT] = packet;
+    if (i >= BENCH_IN_FLIGHT - 1) {
+      packet = packets[(i + 1) % BENCH_IN_FLIGHT];
+      PACKET_Free(packet);
+      PACKET_Destory(packet);
+    }
+  }
+  for (i = count > BENCH_IN_FLIGHT - 1 ? count - BENCH_IN_FLIGHT + 1 : 0;
+       i < count; i++) {
+    PACKET_Free(packets[i % BENCH_IN_FLIGHT]);
+    PACKET_Destory(packets[i % BENCH_IN_FLIGHT]);
+  }
+  print_result("packet", count, get_time_ns() - start, size);
+
+  pool = PACKETPOOL_Create(size, 2, BENCH_IN_FLIGHT + 1);
+  if (!pool) {
+    error("can not create packet pool, please check!");
+    return -1;
+  }
+
+  start = get_time_ns();
+  for (i = 0; i < count; i++) {
+    MppPacket *packet = PACKETPOOL_GetPacket(pool);
+    if (!packet) {
+      error("packet pool is empty, please check!");
+      return -1;
+    }
+    ((U8 *)PACKET_GetDataPointer(packet))[0] = (U8)i;
+    packets[i % BENCH_IN_FLIGHT] = packet;
+    if (i >= BENCH_IN_FLIGHT - 1)
+      PACKET_Destory(packets[(i + 1) % BENCH_IN_FLIGHT]);
+  }
+  for (i = count > BENCH_IN_FLIGHT - 1 ? count - BENCH_IN_FLIGHT + 1 : 0;
+       i < count; i++)
+    PACKET_Destory(packets[i % BENCH_IN_FLIGHT]);
+  print_result("packet pool", count, get_time_ns() - start, size);
+
+  PACKETPOOL_GetStat(pool, &stat);
+  printf("  pool: total %d, in use %d, high water %d, get %lld, miss %lld\n",
+         stat.nTotalNum, stat.nInUseNum, stat.nHighWaterNum,
+         (long long)stat.nGetCount, (long long)stat.nMissCount);
+  PACKETPOOL_Destory(pool);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  S32 count = 1000, width = 3840, height = 2160;
+  S32 i;
+
+  for (i = 1; i < argc; i += 2) {
+    ARGUMENT arg = get_argument(ArgumentMapping, argv[i], argument_num);
+    if (arg == HELP || arg == INVALID || i + 1 >= argc) {
+      print_demo_usage(ArgumentMapping, argument_num);
+      return -1;
+    }
+    if (arg == DECODE_FRAME_NUM) sscanf(argv[i + 1], "%d", &count);
+    if (arg == WIDTH) sscanf(argv[i + 1], "%d", &width);
+    if (arg == HEIGHT) sscanf(argv[i + 1], "%d", &height);
+  }
+
+  if (count <= 0 || width <= 0 || height <= 0) {
+    error("invalid arguments, please check!");
+    return -1;
+  }
+
+  printf("%d cycles, %dx%d nv12 frames, %d in flight\n", count, width,
+         height, BENCH_IN_FLIGHT);
+  if (bench_frame(count, width, height)) return -1;
+  // the size of a compressed 4K frame is a fraction of the raw one
+  if (bench_packet(count, width * height / 2)) return -1;
+
+  return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-24 09:48:26
+ * @LastEditTime: 2024-06-01 18:35:40
+ * @Description: multi-threaded FRAME_Ref/FRAME_UnRef stress, the release
+ *               callback must be called exactly once per lend.
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame.h"
+#include "log.h"
+#include "type.h"
+
+#define TEST_THREADS 8
+#define TEST_LOOPS 100000
+#define TEST_ROUNDS 1000
+
+typedef struct _TestContext {
+  MppFrame *pFrame;
+  atomic_int nReleased;
+  S32 nLoops;
+  pthread_barrier_t barrier;
+} TestContext;
+
+static void on_release(MppFrame *frame, void *opaque) {
+  TestContext *context = (TestContext *)opaque;
+  atomic_fetch_add(&context->nReleased, 1);
+}
+
+// balanced ref/unref while the owner still holds its reference
+static void *ref_unref_thread(void *private_data) {
+  TestContext *context = (TestContext *)private_data;
+  S32 i;
+
+  for (i = 0; i < context->nLoops; i++) {
+    FRAME_Ref(context->pFrame);
+    FRAME_UnRef(context->pFrame);
+  }
+
+  return NULL;
+}
+
+// every consumer drops the one reference it was given, all at once
+static void *drop_thread(void *private_data) {
+  TestContext *context = (TestContext *)private_data;
+
+  pthread_barrier_wait(&context->barrier);
+  FRAME_UnRef(context->pFrame);
+
+  return NULL;
+}
+
+static S32 run_threads(TestContext *context, void *(*func)(void *)) {
+  pthread_t threads[TEST_THREADS];
+  S32 i;
+
+  for (i = 0; i < TEST_THREADS; i++) {
+    if (pthread_create(&threads[i], NULL, func, context)) {
+      error("can not create thread, please check!");
+      return -1;
+    }
+  }
+  for (i = 0; i < TEST_THREADS; i++) pthread_join(threads[i], NULL);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  TestContext context;
+  S32 failed = 0;
+  S32 i;
+
+  memset(&context, 0, sizeof(TestContext));
+  context.nLoops = TEST_LOOPS;
+  context.pFrame = FRAME_Create();
+  if (!context.pFrame) return -1;
+  pthread_barrier_init(&context.barrier, NULL, TEST_THREADS);
+
+  // 1. balanced ref/unref from many threads, no release while owned
+  FRAME_SetReleaseCallback(context.pFrame, on_release, &context);
+  if (run_threads(&context, ref_unref_thread)) return -1;
+  if (FRAME_GetRef(context.pFrame) != 1 ||
+      atomic_load(&context.nReleased) != 0) {
+    error("balanced: ref %u released %d, expect 1 and 0",
+          FRAME_GetRef(context.pFrame), atomic_load(&context.nReleased));
+    failed++;
+  }
+  FRAME_UnRef(context.pFrame);
+  if (atomic_load(&context.nReleased) != 1 ||
+      FRAME_GetReleaseOpaque(context.pFrame)) {
+    error("balanced: released %d opaque %p after the last unref, expect 1 "
+          "and NULL",
+          atomic_load(&context.nReleased),
+          FRAME_GetReleaseOpaque(context.pFrame));
+    failed++;
+  }
+
+  // 2. lend to TEST_THREADS consumers that drop at the same time, re-arm
+  atomic_store(&context.nReleased, 0);
+  for (i = 0; i < TEST_ROUNDS && !failed; i++) {
+    S32 j;
+    for (j = 0; j < TEST_THREADS; j++) FRAME_Ref(context.pFrame);
+    FRAME_SetReleaseCallback(context.pFrame, on_release, &context);
+    if (run_threads(&context, drop_thread)) return -1;
+    if (atomic_load(&context.nReleased) != i + 1 ||
+        FRAME_GetRef(context.pFrame) != 0) {
+      error("round %d: released %d ref %u, expect %d and 0", i,
+            atomic_load(&context.nReleased), FRAME_GetRef(context.pFrame),
+            i + 1);
+      failed++;
+    }
+  }
+
+  // 3. an extra unref is refused and does not wrap around
+  if (FRAME_UnRef(context.pFrame) != (U32)MPP_CHECK_FAILED ||
+      FRAME_GetRef(context.pFrame) != 0) {
+    error("extra unref changed the count to %u",
+          FRAME_GetRef(context.pFrame));
+    failed++;
+  }
+
+  pthread_barrier_destroy(&context.barrier);
+  FRAME_Destory(context.pFrame);
+
+  printf("frame ref test %s\n", failed ? "FAILED" : "PASSED");
+
+  return failed ? -1 : 0;
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-27 10:12:48
+ * @LastEditTime: 2024-05-27 10:12:48
+ * @Description: time of one G2D conversion on different VPS modules, for
+ *               comparing the V2D engine with the software converters.
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "argument.h"
+#include "g2d.h"
+#include "type.h"
+
+typedef struct _BenchContext {
+  MppModuleType eVpsType;
+  MppG2dCmd eG2dCmd;
+  S32 nInputWidth;
+  S32 nInputHeight;
+  S32 nOutputWidth;
+  S32 nOutputHeight;
+  S32 eInputPixelFormat;
+  S32 eOutputPixelFormat;
+  S32 nThreadCount;
+  S32 nFrameNum;
+  MppG2dCtx *pG2dCtx;
+  MppFrame *pSinkFrame;
+  MppFrame *pSrcFrame;
+} BenchContext;
+
+static const MppArgument ArgumentMapping[] = {
+    {"-H", "--help", HELP, "Print help"},
+    {"-m", "--moduletype", MODULE_TYPE, "VPS module type, default swscale"},
+    {"-c", "--codingtype", CODING_TYPE, "G2D cmd, default scale"},
+    {"-w", "--width", WIDTH, "in,out: width, default 1920,1280"},
+    {"-h", "--height", HEIGHT, "in,out: height, default 1080,720"},
+    {"-f", "--format", FORMAT, "in,out: PixelFormat, default NV12,NV12"},
+    {"-n", "--frame_num", DECODE_FRAME_NUM,
+     "Number of conversions, default 100"},
+    {"-t", "--threads", COST_DRAM_THREAD_NUM,
+     "Threads of software converters, -1 one per CPU"},
+};
+
+static S64 get_time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (S64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static MppFrame *prepare_frame(BenchContext *context, MppPixelFormat format,
+                               S32 width, S32 height) {
+  MppFrame *frame = FRAME_Create();
+  if (!frame) return NULL;
+
+  // V2D works on dmabuf fds only
+  if (context->eVpsType == VPS_K1_V2D)
+    FRAME_SetBufferType(frame, MPP_FRAME_BUFFERTYPE_DMABUF_INTERNAL);
+
+  if (FRAME_Alloc(frame, format, width, height)) {
+    FRAME_Destory(frame);
+    return NULL;
+  }
+  FRAME_SetWidth(frame, width);
+  FRAME_SetHeight(frame, height);
+  FRAME_SetPixelFormat(frame, format);
+
+  return frame;
+}
+
+static S32 prepare(BenchContext *context) {
+  MppG2dPara *para = NULL;
+
+  context->pG2dCtx = G2D_CreateChannel();
+  if (!context->pG2dCtx) {
+    error("Can not create MppG2dCtx, please check!");
+    return -1;
+  }
+
+  context->pG2dCtx->eVpsType = context->eVpsType;
+  para = &(context->pG2dCtx->stG2dPara);
+  para->eG2dCmd = context->eG2dCmd;
+  para->eInputPixelFormat = context->eInputPixelFormat;
+  para->eOutputPixelFormat = context->eOutputPixelFormat;
+  para->nInputWidth = context->nInputWidth;
+  para->nInputHeight = context->nInputHeight;
+  para->nOutputWidth = context->nOutputWidth;
+  para->nOutputHeight = context->nOutputHeight;
+  para->nInputBufSize = context->nInputWidth * context->nInputHeight * 3 / 2;
+  para->nOutputBufSize = context->nOutputWidth * context->nOutputHeight * 3 / 2;
+  para->nThreadCount = context->nThreadCount;
+  if (para->eG2dCmd == MPP_G2D_CMD_SCALE)
+    para->sScalePara.eScale = MPP_SCALE_CUSTOM;
+  if (para->eG2dCmd == MPP_G2D_CMD_ROTATE)
+    para->sRotatePara.eRotate = MPP_ROTATE_90;
+  G2D_Init(context->pG2dCtx);
+
+  context->pSinkFrame =
+      prepare_frame(context, context->eInputPixelFormat, context->nInputWidth,
+                    context->nInputHeight);
+  context->pSrcFrame =
+      prepare_frame(context, context->eOutputPixelFormat,
+                    context->nOutputWidth, context->nOutputHeight);
+  if (!context->pSinkFrame || !context->pSrcFrame) {
+    error("can not alloc frames, please check!");
+    return -1;
+  }
+
+  return 0;
+}
+
+S32 main(S32 argc, char **argv) {
+  BenchContext *context = NULL;
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  S64 start, cost;
+  S32 ret = -1;
+  S32 i;
+
+  context = (BenchContext *)malloc(sizeof(BenchContext));
+  if (!context) {
+    error("can not create BenchContext, please check!");
+    return -1;
+  }
+  memset(context, 0, sizeof(BenchContext));
+  context->eVpsType = VPS_FFMPEG_SWSCALE;
+  context->eG2dCmd = MPP_G2D_CMD_SCALE;
+  context->nInputWidth = 1920;
+  context->nInputHeight = 1080;
+  context->nOutputWidth = 1280;
+  context->nOutputHeight = 720;
+  context->eInputPixelFormat = PIXEL_FORMAT_NV12;
+  context->eOutputPixelFormat = PIXEL_FORMAT_NV12;
+  context->nFrameNum = 100;
+
+  for (i = 1; i < argc; i += 2) {
+    ARGUMENT arg = get_argument(ArgumentMapping, argv[i], argument_num);
+    if (arg == HELP || arg == INVALID || i + 1 >= argc) {
+      print_demo_usage(ArgumentMapping, argument_num);
+      print_para_enum();
+      goto finish;
+    }
+    if (arg == MODULE_TYPE)
+      sscanf(argv[i + 1], "%d", (S32 *)&(context->eVpsType));
+    if (arg == CODING_TYPE)
+      sscanf(argv[i + 1], "%d", (S32 *)&(context->eG2dCmd));
+    if (arg == WIDTH)
+      sscanf(argv[i + 1], "%d,%d", &(context->nInputWidth),
+             &(context->nOutputWidth));
+    if (arg == HEIGHT)
+      sscanf(argv[i + 1], "%d,%d", &(context->nInputHeight),
+             &(context->nOutputHeight));
+    if (arg == FORMAT)
+      sscanf(argv[i + 1], "%d,%d", &(context->eInputPixelFormat),
+             &(context->eOutputPixelFormat));
+    if (arg == DECODE_FRAME_NUM)
+      sscanf(argv[i + 1], "%d", &(context->nFrameNum));
+    if (arg == COST_DRAM_THREAD_NUM)
+      sscanf(argv[i + 1], "%d", &(context->nThreadCount));
+  }
+
+  if (context->nFrameNum <= 0) {
+    print_demo_usage(ArgumentMapping, argument_num);
+    goto finish;
+  }
+
+  if (prepare(context)) goto finish;
+
+  // the first conversion builds the converter, keep it out of the timing
+  ret = G2D_Process(context->pG2dCtx, FRAME_GetBaseData(context->pSinkFrame),
+                    FRAME_GetBaseData(context->pSrcFrame));
+  if (ret) {
+    error("g2d process failed (%d), please check!", ret);
+    goto finish;
+  }
+
+  start = get_time_ns();
+  for (i = 0; i < context->nFrameNum; i++) {
+    ret = G2D_Process(context->pG2dCtx, FRAME_GetBaseData(context->pSinkFrame),
+                      FRAME_GetBaseData(context->pSrcFrame));
+    if (ret) {
+      error("g2d process failed (%d), please check!", ret);
+      goto finish;
+    }
+  }
+  cost = get_time_ns() - start;
+
+  printf("%s: cmd %d, %s %dx%d -> %s %dx%d, %d threads, %8.3f ms, %8.1f fps\n",
+         mpp_moduletype2str(context->eVpsType), context->eG2dCmd,
+         mpp_pixelformat2str(context->eInputPixelFormat), context->nInputWidth,
+         context->nInputHeight,
+         mpp_pixelformat2str(context->eOutputPixelFormat),
+         context->nOutputWidth, context->nOutputHeight, context->nThreadCount,
+         cost / 1e6 / context->nFrameNum, context->nFrameNum * 1e9 / cost);
+  ret = 0;
+
+finish:
+  if (context->pSinkFrame) {
+    FRAME_Free(context->pSinkFrame);
+    FRAME_Destory(context->pSinkFrame);
+  }
+
+  if (context->pSrcFrame) {
+    FRAME_Free(context->pSrcFrame);
+    FRAME_Destory(context->pSrcFrame);
+  }
+
+  if (context->pG2dCtx) G2D_DestoryChannel(context->pG2dCtx);
+
+  free(context);
+
+  return ret;
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-28 11:02:37
+ * @LastEditTime: 2024-05-28 11:02:37
+ * @Description: Mpix/s of every kernel of the CPU G2D plugin, scalar reference
+ *               and SIMD, on one thread.
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "argument.h"
+#include "g2d_cpu_kernels.h"
+#include "para.h"
+
+typedef struct _BenchCase {
+  const char *pName;
+  G2dCpuKernelType eKernel;
+  S32 nSrcPlanes;
+  S32 nSrcBytes[G2D_CPU_MAX_PLANES];
+  S32 nDstPlanes;
+  S32 nDstBytes[G2D_CPU_MAX_PLANES];
+  // output size in 1/2 of the input
+  S32 nDstScale;
+} BenchCase;
+
+static const BenchCase stBenchCases[] = {
+    {"nv12 to i420", G2D_CPU_KERNEL_SP_TO_P, 2, {1, 2}, 3, {1, 1, 1}, 2},
+    {"i420 to nv21", G2D_CPU_KERNEL_P_TO_SP, 3, {1, 1, 1}, 2, {1, 2}, 2},
+    {"nv12 to rgba", G2D_CPU_KERNEL_SP_TO_RGBA, 2, {1, 2}, 1, {4}, 2},
+    {"nv12 2x down", G2D_CPU_KERNEL_DOWNSCALE_2X, 2, {1, 2}, 2, {1, 2}, 1},
+    {"nv12 bilinear", G2D_CPU_KERNEL_BILINEAR, 2, {1, 2}, 2, {1, 2}, 3},
+    {"rgba bilinear", G2D_CPU_KERNEL_BILINEAR, 1, {4}, 1, {4}, 3},
+};
+
+static const MppArgument ArgumentMapping[] = {
+    {"-H", "--help", HELP, "Print help"},
+    {"-w", "--width", WIDTH, "Input width, default 1920"},
+    {"-h", "--height", HEIGHT, "Input height, default 1080"},
+    {"-n", "--frame_num", DECODE_FRAME_NUM, "Runs of every kernel, default 50"},
+};
+
+static S64 get_time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (S64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static RETURN alloc_image(G2dCpuImage *image, S32 planes, const S32 *bytes,
+                          S32 width, S32 height) {
+  G2dCpuPlane *plane = NULL;
+  S32 i;
+
+  memset(image, 0, sizeof(G2dCpuImage));
+  image->nPlanes = planes;
+  for (i = 0; i < planes; i++) {
+    plane = &(image->stPlane[i]);
+    plane->nWidth = i ? width / 2 : width;
+    plane->nHeight = i ? height / 2 : height;
+    plane->nBytes = bytes[i];
+    plane->nStride = plane->nWidth * plane->nBytes;
+    plane->pData = (U8 *)malloc(plane->nStride * plane->nHeight);
+    if (!plane->pData) return MPP_MALLOC_FAILED;
+    memset(plane->pData, 0x80 + i, plane->nStride * plane->nHeight);
+  }
+
+  return MPP_OK;
+}
+
+static void free_image(G2dCpuImage *image) {
+  S32 i;
+
+  for (i = 0; i < image->nPlanes; i++) free(image->stPlane[i].pData);
+}
+
+/**
+ * @description: output Mpix/s of the kernel
+ */
+static double bench(G2dCpuJob *job, S32 runs, BOOL simd) {
+  S32 height = job->stDst.stPlane[0].nHeight;
+  S64 pixels = (S64)job->stDst.stPlane[0].nWidth * height;
+  S64 start;
+  S32 i;
+
+  g2d_cpu_run(job, 0, height, simd);
+  start = get_time_ns();
+  for (i = 0; i < runs; i++) g2d_cpu_run(job, 0, height, simd);
+
+  return pixels * runs * 1e3 / (get_time_ns() - start);
+}
+
+S32 main(S32 argc, char **argv) {
+  const BenchCase *test = NULL;
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  S32 width = 1920;
+  S32 height = 1080;
+  S32 runs = 50;
+  S32 dst_width, dst_height;
+  double scalar, simd;
+  G2dCpuJob job;
+  S32 i;
+
+  for (i = 1; i < argc; i += 2) {
+    ARGUMENT arg = get_argument(ArgumentMapping, argv[i], argument_num);
+    if (arg == HELP || arg == INVALID || i + 1 >= argc) {
+      print_demo_usage(ArgumentMapping, argument_num);
+      return -1;
+    }
+    if (arg == WIDTH) sscanf(argv[i + 1], "%d", &width);
+    if (arg == HEIGHT) sscanf(argv[i + 1], "%d", &height);
+    if (arg == DECODE_FRAME_NUM) sscanf(argv[i + 1], "%d", &runs);
+  }
+
+  if (width < 4 || height < 4 || runs <= 0) {
+    print_demo_usage(ArgumentMapping, argument_num);
+    return -1;
+  }
+  width &= ~3;
+  height &= ~3;
+
+  printf("%dx%d input, %s kernels, Mpix/s of output\n", width, height,
+         g2d_cpu_simd_name());
+  printf("%-16s %10s %10s %8s\n", "kernel", "scalar", "simd", "speedup");
+
+  for (i = 0; i < NUM_OF(stBenchCases); i++) {
+    test = &stBenchCases[i];
+    dst_width = (width * test->nDstScale / 2) & ~1;
+    dst_height = (height * test->nDstScale / 2) & ~1;
+
+    memset(&job, 0, sizeof(G2dCpuJob));
+    job.eKernel = test->eKernel;
+    if (alloc_image(&(job.stSrc), test->nSrcPlanes, test->nSrcBytes, width,
+                    height) ||
+        alloc_image(&(job.stDst), test->nDstPlanes, test->nDstBytes,
+                    dst_width, dst_height)) {
+      error("can not alloc images, please check!");
+      free_image(&(job.stSrc));
+      free_image(&(job.stDst));
+      return -1;
+    }
+
+    scalar = bench(&job, runs, MPP_FALSE);
+    simd = bench(&job, runs, MPP_TRUE);
+    printf("%-16s %10.1f %10.1f %7.2fx\n", test->pName, scalar, simd,
+           simd / scalar);
+
+    free_image(&(job.stSrc));
+    free_image(&(job.stDst));
+  }
+
+  return 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-28 11:02:37
+ * @LastEditTime: 2024-05-28 11:02:37
+ * @Description: the SIMD kernels of the CPU G2D plugin, run in bands, have to
+ *               give the same bytes as the scalar reference on whole pictures.
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "g2d_cpu_kernels.h"
+#include "log.h"
+#include "para.h"
+
+/***
+ * bytes after every row, the kernels must not touch them
+ */
+#define ROW_PADDING 24
+#define PADDING_BYTE 0x5a
+
+typedef struct _TestCase {
+  const char *pName;
+  G2dCpuKernelType eKernel;
+  S32 nSrcPlanes;
+  S32 nSrcBytes[G2D_CPU_MAX_PLANES];
+  S32 nDstPlanes;
+  S32 nDstBytes[G2D_CPU_MAX_PLANES];
+  BOOL bSwapUV;
+  BOOL bSwapRB;
+  // 0 same size as the source, 1 half, 2 any size
+  S32 nSize;
+} TestCase;
+
+static const TestCase stTestCases[] = {
+    {"copy nv12", G2D_CPU_KERNEL_COPY, 2, {1, 2}, 2, {1, 2}, 0, 0, 0},
+    {"nv12 to i420", G2D_CPU_KERNEL_SP_TO_P, 2, {1, 2}, 3, {1, 1, 1}, 0, 0, 0},
+    {"i420 to nv12", G2D_CPU_KERNEL_P_TO_SP, 3, {1, 1, 1}, 2, {1, 2}, 0, 0, 0},
+    {"nv12 to rgba", G2D_CPU_KERNEL_SP_TO_RGBA, 2, {1, 2}, 1, {4}, 0, 0, 0},
+    {"nv21 to bgra", G2D_CPU_KERNEL_SP_TO_RGBA, 2, {1, 2}, 1, {4}, 1, 1, 0},
+    {"nv12 2x down", G2D_CPU_KERNEL_DOWNSCALE_2X, 2, {1, 2}, 2, {1, 2}, 0, 0,
+     1},
+    {"i420 2x down", G2D_CPU_KERNEL_DOWNSCALE_2X, 3, {1, 1, 1}, 3, {1, 1, 1},
+     0, 0, 1},
+    {"rgba 2x down", G2D_CPU_KERNEL_DOWNSCALE_2X, 1, {4}, 1, {4}, 0, 0, 1},
+    {"nv12 bilinear", G2D_CPU_KERNEL_BILINEAR, 2, {1, 2}, 2, {1, 2}, 0, 0, 2},
+    {"rgba bilinear", G2D_CPU_KERNEL_BILINEAR, 1, {4}, 1, {4}, 0, 0, 2},
+};
+
+/***
+ * even sizes around the 16 and 32 byte blocks of the SIMD loops
+ */
+static const S32 nSizes[][2] = {
+    {2, 2}, {16, 4}, {30, 6}, {34, 10}, {64, 8}, {66, 18}, {128, 12},
+    {318, 22}, {640, 36},
+};
+
+static U32 nSeed = 1;
+
+static U8 random_byte() {
+  nSeed = nSeed * 1103515245 + 12345;
+  return (nSeed >> 16) & 0xff;
+}
+
+static RETURN alloc_image(G2dCpuImage *image, S32 planes, const S32 *bytes,
+                          S32 width, S32 height, BOOL fill) {
+  G2dCpuPlane *plane = NULL;
+  S32 size, i, j;
+
+  memset(image, 0, sizeof(G2dCpuImage));
+  image->nPlanes = planes;
+  for (i = 0; i < planes; i++) {
+    plane = &(image->stPlane[i]);
+    plane->nWidth = i ? width / 2 : width;
+    plane->nHeight = i ? height / 2 : height;
+    plane->nBytes = bytes[i];
+    plane->nStride = plane->nWidth * plane->nBytes + ROW_PADDING;
+    size = plane->nStride * plane->nHeight;
+    plane->pData = (U8 *)malloc(size);
+    if (!plane->pData) return MPP_MALLOC_FAILED;
+    for (j = 0; j < size; j++)
+      plane->pData[j] = fill ? random_byte() : PADDING_BYTE;
+  }
+
+  return MPP_OK;
+}
+
+static void free_image(G2dCpuImage *image) {
+  S32 i;
+
+  for (i = 0; i < image->nPlanes; i++) free(image->stPlane[i].pData);
+  memset(image, 0, sizeof(G2dCpuImage));
+}
+
+/**
+ * @description: compare the whole planes, the row padding included
+ */
+static S32 compare_image(const G2dCpuImage *a, const G2dCpuImage *b) {
+  const G2dCpuPlane *pa, *pb;
+  S32 i, j;
+
+  for (i = 0; i < a->nPlanes; i++) {
+    pa = &(a->stPlane[i]);
+    pb = &(b->stPlane[i]);
+    for (j = 0; j < pa->nStride * pa->nHeight; j++) {
+      if (pa->pData[j] != pb->pData[j]) {
+        printf("  plane %d row %d byte %d: %d != %d\n", i, j / pa->nStride,
+               j % pa->nStride, pa->pData[j], pb->pData[j]);
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+static S32 check_padding(const G2dCpuImage *image) {
+  const G2dCpuPlane *plane = NULL;
+  S32 i, y, x;
+
+  for (i = 0; i < image->nPlanes; i++) {
+    plane = &(image->stPlane[i]);
+    for (y = 0; y < plane->nHeight; y++) {
+      for (x = plane->nWidth * plane->nBytes; x < plane->nStride; x++) {
+        if (plane->pData[y * plane->nStride + x] != PADDING_BYTE) {
+          printf("  plane %d row %d: write after the row\n", i, y);
+          return -1;
+        }
+      }
+    }
+  }
+
+  return 0;
+}
+
+static S32 run_case(const TestCase *test, S32 width, S32 height,
+                    S32 dst_width, S32 dst_height) {
+  G2dCpuJob job, scalar;
+  G2dCpuImage reference;
+  S32 ret = -1;
+  S32 y;
+
+  memset(&job, 0, sizeof(G2dCpuJob));
+  memset(&reference, 0, sizeof(G2dCpuImage));
+  job.eKernel = test->eKernel;
+  job.bSwapUV = test->bSwapUV;
+  job.bSwapRB = test->bSwapRB;
+
+  if (alloc_image(&(job.stSrc), test->nSrcPlanes, test->nSrcBytes, width,
+                  height, MPP_TRUE) ||
+      alloc_image(&(job.stDst), test->nDstPlanes, test->nDstBytes, dst_width,
+                  dst_height, MPP_FALSE) ||
+      alloc_image(&reference, test->nDstPlanes, test->nDstBytes, dst_width,
+                  dst_height, MPP_FALSE))
+    goto finish;
+
+  // the pool of the plugin runs bands of even rows, take the smallest ones
+  for (y = 0; y < dst_height; y += 2) {
+    if (g2d_cpu_run(&job, y, y + 2 < dst_height ? y + 2 : dst_height,
+                    MPP_TRUE))
+      goto finish;
+  }
+
+  scalar = job;
+  scalar.stDst = reference;
+  ret = g2d_cpu_run(&scalar, 0, dst_height, MPP_FALSE);
+  if (!ret) ret = compare_image(&(job.stDst), &reference);
+  if (!ret) ret = check_padding(&reference);
+
+finish:
+  free_image(&(job.stSrc));
+  free_image(&(job.stDst));
+  free_image(&reference);
+
+  if (ret)
+    printf("%-16s %4dx%-4d -> %4dx%-4d FAIL\n", test->pName, width, height,
+           dst_width, dst_height);
+
+  return ret;
+}
+
+S32 main(S32 argc, char **argv) {
+  const TestCase *test = NULL;
+  S32 width, height, dst_width, dst_height;
+  S32 failed = 0;
+  S32 count = 0;
+  S32 i, j;
+
+  printf("g2d cpu kernels: %s\n", g2d_cpu_simd_name());
+
+  for (i = 0; i < NUM_OF(stTestCases); i++) {
+    test = &stTestCases[i];
+    for (j = 0; j < NUM_OF(nSizes); j++) {
+      width = nSizes[j][0];
+      height = nSizes[j][1];
+      dst_width = width;
+      dst_height = height;
+
+      if (test->nSize == 1) {
+        width *= 2;
+        height *= 2;
+      }
+
+      if (test->nSize == 2) {
+        // wider and shorter by the line pass, taller at the same width
+        failed += run_case(test, width, height, (width * 3 / 2) & ~1,
+                           height > 2 ? (height / 2 + 1) & ~1 : 2) != 0;
+        failed += run_case(test, width, height, width, height * 2) != 0;
+        count += 2;
+      }
+
+      failed += run_case(test, width, height, dst_width, dst_height) != 0;
+      count++;
+    }
+    printf("%-16s done\n", test->pName);
+  }
+
+  printf("%d of %d cases %s\n", count - failed, count,
+         failed ? "FAILED" : "passed");
+
+  return failed ? -1 : 0;
+}
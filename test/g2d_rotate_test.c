@@ -0,0 +1,288 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-06-01 20:10:12
+ * @LastEditTime: 2024-06-01 20:10:12
+ * @Description: MPP_G2D_CMD_ROTATE of VPS_FFMPEG_SWSCALE has to give the
+ *               same bytes as MPP_G2D_CMD_SCALE to the pre-rotation size
+ *               followed by a plain rotation of each plane.
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "argument.h"
+#include "g2d.h"
+#include "type.h"
+
+#define MAX_PLANES 3
+
+typedef struct _TestFormat {
+  MppPixelFormat eFormat;
+  S32 nPlanes;
+  // bytes of one element and chroma subsampling shift of each plane
+  S32 nBytes[MAX_PLANES];
+  S32 nShift[MAX_PLANES];
+} TestFormat;
+
+static const TestFormat TestFormats[] = {
+    {PIXEL_FORMAT_I420, 3, {1, 1, 1}, {0, 1, 1}},
+    {PIXEL_FORMAT_NV12, 2, {1, 2, 0}, {0, 1, 0}},
+    {PIXEL_FORMAT_RGBA, 1, {4, 0, 0}, {0, 0, 0}},
+    {PIXEL_FORMAT_RGB_888, 1, {3, 0, 0}, {0, 0, 0}},
+};
+
+static const MppRotate TestRotates[] = {
+    MPP_ROTATE_90, MPP_ROTATE_180, MPP_ROTATE_270, MPP_MIRROR, MPP_VFLIP,
+};
+
+static const MppArgument ArgumentMapping[] = {
+    {"-H", "--help", HELP, "Print help"},
+    {"-m", "--moduletype", MODULE_TYPE, "Module type, default swscale"},
+    {"-w", "--width", WIDTH, "Input and output width, default 64,40"},
+    {"-h", "--height", HEIGHT, "Input and output height, default 48,24"},
+};
+
+static S32 plane_width(const TestFormat *format, S32 plane, S32 width) {
+  return (width + (1 << format->nShift[plane]) - 1) >> format->nShift[plane];
+}
+
+static S32 frame_size(const TestFormat *format, S32 width, S32 height) {
+  S32 size = 0;
+  S32 i;
+
+  for (i = 0; i < format->nPlanes; i++)
+    size += plane_width(format, i, width) * format->nBytes[i] *
+            plane_width(format, i, height);
+
+  return size;
+}
+
+/**
+ * @description: a frame of the planes packed one after the other, as the
+ * plugin takes a frame with one data pointer.
+ */
+static MppFrame *create_frame(const TestFormat *format, S32 width,
+                              S32 height) {
+  MppFrame *frame = FRAME_Create();
+  U8 *data = NULL;
+
+  if (!frame) return NULL;
+  data = (U8 *)malloc(frame_size(format, width, height));
+  if (!data) {
+    FRAME_Destory(frame);
+    return NULL;
+  }
+
+  FRAME_SetBufferType(frame, MPP_FRAME_BUFFERTYPE_NORMAL_EXTERNAL);
+  FRAME_SetDataUsedNum(frame, 1);
+  FRAME_SetDataPointer(frame, 0, data);
+  FRAME_SetWidth(frame, width);
+  FRAME_SetHeight(frame, height);
+  FRAME_SetLineStride(frame, width * format->nBytes[0]);
+  FRAME_SetPixelFormat(frame, format->eFormat);
+
+  return frame;
+}
+
+static void destory_frame(MppFrame *frame) {
+  if (!frame) return;
+  free(FRAME_GetDataPointer(frame, 0));
+  FRAME_Destory(frame);
+}
+
+static S32 run_g2d(MppModuleType type, MppG2dPara *para, MppFrame *sink,
+                   MppFrame *src) {
+  MppG2dCtx *ctx = G2D_CreateChannel();
+  S32 ret;
+
+  if (!ctx) {
+    error("Can not create MppG2dCtx, please check!");
+    return -1;
+  }
+
+  ctx->eVpsType = type;
+  ctx->stG2dPara = *para;
+  ret = G2D_Init(ctx);
+  if (!ret)
+    ret = G2D_Process(ctx, FRAME_GetBaseData(sink), FRAME_GetBaseData(src));
+  G2D_DestoryChannel(ctx);
+
+  return ret;
+}
+
+/**
+ * @description: destination of element (x, y) of a width x height plane
+ */
+static void rotate_point(MppRotate rotate, S32 width, S32 height, S32 x,
+                         S32 y, S32 *dx, S32 *dy) {
+  switch (rotate) {
+    case MPP_ROTATE_90:
+      *dx = height - 1 - y;
+      *dy = x;
+      break;
+    case MPP_ROTATE_180:
+      *dx = width - 1 - x;
+      *dy = height - 1 - y;
+      break;
+    case MPP_ROTATE_270:
+      *dx = y;
+      *dy = width - 1 - x;
+      break;
+    case MPP_MIRROR:
+      *dx = width - 1 - x;
+      *dy = y;
+      break;
+    case MPP_VFLIP:
+    default:
+      *dx = x;
+      *dy = height - 1 - y;
+      break;
+  }
+}
+
+/**
+ * @description: compare each element of the rotated frame with the element
+ * of the scaled frame it comes from.
+ */
+static S32 compare(const TestFormat *format, MppRotate rotate,
+                   MppFrame *scaled, MppFrame *rotated) {
+  const U8 *src = (const U8 *)FRAME_GetDataPointer(scaled, 0);
+  const U8 *dst = (const U8 *)FRAME_GetDataPointer(rotated, 0);
+  S32 width = FRAME_GetWidth(scaled);
+  S32 height = FRAME_GetHeight(scaled);
+  S32 out_width = FRAME_GetWidth(rotated);
+  S32 out_height = FRAME_GetHeight(rotated);
+  S32 i, x, y, dx, dy, w, h, dw, bytes;
+
+  for (i = 0; i < format->nPlanes; i++) {
+    w = plane_width(format, i, width);
+    h = plane_width(format, i, height);
+    dw = plane_width(format, i, out_width);
+    bytes = format->nBytes[i];
+
+    for (y = 0; y < h; y++) {
+      for (x = 0; x < w; x++) {
+        rotate_point(rotate, w, h, x, y, &dx, &dy);
+        if (memcmp(src + ((S64)y * w + x) * bytes,
+                   dst + ((S64)dy * dw + dx) * bytes, bytes)) {
+          error("%s rotate %d: plane %d (%d,%d) -> (%d,%d) differs",
+                mpp_pixelformat2str(format->eFormat), rotate, i, x, y, dx,
+                dy);
+          return -1;
+        }
+      }
+    }
+
+    src += (S64)w * h * bytes;
+    dst += (S64)dw * plane_width(format, i, out_height) * bytes;
+  }
+
+  return 0;
+}
+
+static S32 run_case(MppModuleType type, const TestFormat *format,
+                    MppRotate rotate, S32 in_width, S32 in_height,
+                    S32 out_width, S32 out_height) {
+  BOOL transpose = rotate == MPP_ROTATE_90 || rotate == MPP_ROTATE_270;
+  S32 scaled_width = transpose ? out_height : out_width;
+  S32 scaled_height = transpose ? out_width : out_height;
+  MppFrame *input = create_frame(format, in_width, in_height);
+  MppFrame *scaled = create_frame(format, scaled_width, scaled_height);
+  MppFrame *rotated = create_frame(format, out_width, out_height);
+  MppG2dPara para;
+  U8 *data = NULL;
+  S32 ret = -1;
+  S32 i;
+
+  if (!input || !scaled || !rotated) {
+    error("can not alloc frames, please check!");
+    goto finish;
+  }
+
+  data = (U8 *)FRAME_GetDataPointer(input, 0);
+  for (i = 0; i < frame_size(format, in_width, in_height); i++)
+    data[i] = (U8)(i * 2654435761u >> 13);
+
+  memset(&para, 0, sizeof(MppG2dPara));
+  para.eInputPixelFormat = format->eFormat;
+  para.eOutputPixelFormat = format->eFormat;
+  para.nInputWidth = in_width;
+  para.nInputHeight = in_height;
+
+  para.eG2dCmd = MPP_G2D_CMD_SCALE;
+  para.sScalePara.eScale = MPP_SCALE_CUSTOM;
+  para.nOutputWidth = scaled_width;
+  para.nOutputHeight = scaled_height;
+  if (run_g2d(type, &para, input, scaled)) {
+    error("can not scale %s, please check!",
+          mpp_pixelformat2str(format->eFormat));
+    goto finish;
+  }
+
+  para.eG2dCmd = MPP_G2D_CMD_ROTATE;
+  para.sRotatePara.eRotate = rotate;
+  para.nOutputWidth = out_width;
+  para.nOutputHeight = out_height;
+  if (run_g2d(type, &para, input, rotated)) {
+    error("can not rotate %s, please check!",
+          mpp_pixelformat2str(format->eFormat));
+    goto finish;
+  }
+
+  ret = compare(format, rotate, scaled, rotated);
+
+finish:
+  destory_frame(input);
+  destory_frame(scaled);
+  destory_frame(rotated);
+
+  return ret;
+}
+
+S32 main(S32 argc, char **argv) {
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  MppModuleType type = VPS_FFMPEG_SWSCALE;
+  S32 in_width = 64, out_width = 40;
+  S32 in_height = 48, out_height = 24;
+  S32 failed = 0;
+  S32 i, j;
+
+  for (i = 1; i < argc; i += 2) {
+    ARGUMENT arg = get_argument(ArgumentMapping, argv[i], argument_num);
+    if (arg == HELP || arg == INVALID || i + 1 >= argc) {
+      print_demo_usage(ArgumentMapping, argument_num);
+      return -1;
+    }
+    if (arg == MODULE_TYPE) sscanf(argv[i + 1], "%d", (S32 *)&type);
+    if (arg == WIDTH) sscanf(argv[i + 1], "%d,%d", &in_width, &out_width);
+    if (arg == HEIGHT) sscanf(argv[i + 1], "%d,%d", &in_height, &out_height);
+  }
+
+  // 4:2:0 chroma of odd sizes does not transpose onto itself
+  if (in_width <= 0 || in_height <= 0 || out_width <= 0 || out_height <= 0 ||
+      (out_width & 1) || (out_height & 1)) {
+    print_demo_usage(ArgumentMapping, argument_num);
+    return -1;
+  }
+
+  for (i = 0; i < NUM_OF(TestFormats); i++) {
+    for (j = 0; j < NUM_OF(TestRotates); j++) {
+      S32 ret = run_case(type, &TestFormats[i], TestRotates[j], in_width,
+                         in_height, out_width, out_height);
+      printf("%-12s rotate %d: %s\n",
+             mpp_pixelformat2str(TestFormats[i].eFormat), TestRotates[j],
+             ret ? "FAILED" : "PASSED");
+      if (ret) failed++;
+    }
+  }
+
+  if (failed) error("%d cases failed, please check!", failed);
+  return failed ? -1 : 0;
+}
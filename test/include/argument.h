@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-13 18:11:03
- * @LastEditTime: 2024-04-28 15:52:42
+ * @LastEditTime: 2024-05-31 15:36:20
  * @Description:
  */
 
@@ -30,6 +30,15 @@ typedef enum {
   HEIGHT,
   FORMAT,
   VIDEO_DEVICE,
+  ZERO_COPY,
+  CODEC_THREAD_NUM,
+  SLICE_MODE,
+  REFERENCE_FILE,
+  BUFFER_NUM,
+  BUFFER_TYPE,
+  PSNR_THRESHOLD,
+  GOP_SIZE,
+  QP,
   INVALID
 } ARGUMENT;
 
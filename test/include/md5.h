@@ -0,0 +1,58 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-21 10:02:17
+ * @LastEditTime: 2024-05-21 10:02:17
+ * @Description: minimal md5 (RFC 1321) for checking decoded output in tests
+ */
+
+#ifndef _MPP_MD5_H_
+#define _MPP_MD5_H_
+
+#include "type.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MD5_DIGEST_LEN 16
+#define MD5_STRING_LEN (MD5_DIGEST_LEN * 2 + 1)
+
+typedef struct _MD5Context {
+  U32 nState[4];
+  U64 nLength;
+  U8 pBuffer[64];
+} MD5Context;
+
+/**
+ * @description: reset the md5 context
+ * @param {MD5Context} *context
+ * @return {*}
+ */
+void md5_init(MD5Context *context);
+
+/**
+ * @description: feed data to the md5 context
+ * @param {MD5Context} *context
+ * @param {U8} *data
+ * @param {U64} length
+ * @return {*}
+ */
+void md5_update(MD5Context *context, const U8 *data, U64 length);
+
+/**
+ * @description: finish and output the md5 as hex string
+ * @param {MD5Context} *context
+ * @param {char} *out: at least MD5_STRING_LEN bytes
+ * @return {*}
+ */
+void md5_final(MD5Context *context, char *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_MPP_MD5_H_*/
@@ -0,0 +1,333 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-06-02 11:28:40
+ * @LastEditTime: 2024-06-02 11:28:40
+ * @Description: encode generated NV12 frames to H264 by
+ *               CODEC_V4L2_LINLONV5V7 and drain every stream with
+ *               VENC_RequestOutputStreamBuffer/VENC_ReturnOutputStreamBuffer:
+ *               the id of the packet stays the caller's, its own data
+ *               pointer is back after the return, a packet that is not lent
+ *               can not be returned, and every frame gives a stream up to
+ *               the EOS. Skipped without a mvx encoder (or without the
+ *               linlon plugin).
+ */
+
+#define ENABLE_DEBUG 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "argument.h"
+#include "const.h"
+#include "type.h"
+#include "v4l2_utils.h"
+#include "venc.h"
+
+#define MODULE_TAG "linlon_venc_lend_test"
+
+#define FRAME_POOL_NUM (8)
+#define PACKET_ID (0x5a5a)
+
+typedef struct _TestContext {
+  U8 pOutputFileName[DEMO_FILE_NAME_LEN];
+  FILE *pOutputFile;
+  S32 nWidth;
+  S32 nHeight;
+  S32 nFrames;
+  MppVencCtx *pVencCtx;
+  MppPacket *pPacket;
+  MppFrame *pFrame[FRAME_POOL_NUM];
+  BOOL bFrameFree[FRAME_POOL_NUM];
+  S32 nFrameNum;
+  S32 nStreamNum;
+  S64 nStreamBytes;
+  BOOL bEos;
+} TestContext;
+
+static const MppArgument ArgumentMapping[] = {
+    {"-H", "--help", HELP, "Print help"},
+    {"-o", "--output", SAVE_FRAME_FILE, "Output stream file path"},
+    {"-w", "--width", WIDTH, "Video width, default 640"},
+    {"-h", "--height", HEIGHT, "Video height, default 480"},
+    {"-n", "--frames", DECODE_FRAME_NUM, "Frames to encode, default 30"},
+};
+
+static S32 parse_argument(TestContext *context, char *argument, char *value,
+                          S32 num) {
+  ARGUMENT arg = get_argument(ArgumentMapping, argument, num);
+
+  if (!value && arg != HELP) {
+    error("argument need a value, please check!");
+    return -1;
+  }
+
+  switch (arg) {
+    case HELP:
+      print_demo_usage(ArgumentMapping, num);
+      print_para_enum();
+      return -1;
+    case SAVE_FRAME_FILE:
+      sscanf(value, "%2047s", context->pOutputFileName);
+      break;
+    case WIDTH:
+      sscanf(value, "%d", &(context->nWidth));
+      break;
+    case HEIGHT:
+      sscanf(value, "%d", &(context->nHeight));
+      break;
+    case DECODE_FRAME_NUM:
+      sscanf(value, "%d", &(context->nFrames));
+      break;
+    case INVALID:
+    default:
+      error("Unknowed argument : %s, please check!", argument);
+      return -1;
+  }
+
+  return 0;
+}
+
+static S32 VencPrepare(TestContext *context) {
+  MppVencPara *para = NULL;
+
+  context->pVencCtx = VENC_CreateChannel();
+  if (!context->pVencCtx) {
+    error("Can not create MppVencCtx, please check!");
+    return -1;
+  }
+
+  para = &(context->pVencCtx->stVencPara);
+  context->pVencCtx->eCodecType = CODEC_V4L2_LINLONV5V7;
+  para->eCodingType = CODING_H264;
+  para->PixelFormat = PIXEL_FORMAT_NV12;
+  para->nWidth = context->nWidth;
+  para->nHeight = context->nHeight;
+  para->nStride = context->nWidth;
+  para->eFrameBufferType = MPP_FRAME_BUFFERTYPE_NORMAL_INTERNAL;
+
+  return VENC_Init(context->pVencCtx);
+}
+
+static S32 FramePrepare(TestContext *context) {
+  for (S32 i = 0; i < FRAME_POOL_NUM; i++) {
+    MppFrame *frame = FRAME_Create();
+    if (!frame) return -1;
+    context->pFrame[i] = frame;
+
+    FRAME_SetBufferType(frame, MPP_FRAME_BUFFERTYPE_NORMAL_INTERNAL);
+    if (FRAME_Alloc(frame, PIXEL_FORMAT_NV12, context->nWidth,
+                    context->nHeight)) {
+      error("can not alloc frame %d, please check!", i);
+      return -1;
+    }
+    FRAME_SetID(frame, i);
+    context->bFrameFree[i] = MPP_TRUE;
+  }
+
+  return 0;
+}
+
+/**
+ * @description: a gradient moving with the frame number, so that the
+ * encoder has something to do between the frames.
+ */
+static void fill_frame(TestContext *context, MppFrame *frame) {
+  U8 *luma = (U8 *)FRAME_GetDataPointer(frame, 0);
+  U8 *chroma = (U8 *)FRAME_GetDataPointer(frame, 1);
+  S32 x, y;
+
+  for (y = 0; y < context->nHeight; y++) {
+    for (x = 0; x < context->nWidth; x++)
+      luma[y * context->nWidth + x] = (U8)(x + y + context->nFrameNum * 4);
+  }
+  memset(chroma, 128, context->nWidth * context->nHeight / 2);
+}
+
+/**
+ * @description: take every ready stream lent, check the packet around the
+ * lend, and take back the frames the encoder is done with.
+ * @return {*}: MPP_OK, or the error code of the encoder, -1 if the packet
+ * is wrong
+ */
+static S32 drain(TestContext *context) {
+  MppPacket *packet = context->pPacket;
+  U8 *owned = (U8 *)PACKET_GetDataPointer(packet);
+  BOOL lent;
+  S32 ret = 0;
+  S32 id = 0;
+
+  while (!context->bEos) {
+    PACKET_SetID(packet, PACKET_ID);
+    PACKET_SetLength(packet, 0);
+    ret = VENC_RequestOutputStreamBuffer(context->pVencCtx,
+                                         PACKET_GetBaseData(packet));
+    if (ret != MPP_OK && ret != MPP_CODER_EOS) break;
+
+    if (PACKET_GetID(packet) != PACKET_ID) {
+      error("the id of the packet is %d, not the caller's %d, please check!",
+            PACKET_GetID(packet), PACKET_ID);
+      return -1;
+    }
+
+    lent = PACKET_GetDataPointer(packet) != owned;
+    if (PACKET_GetLength(packet)) {
+      if (!lent) {
+        error("a stream of %d bytes is not lent, please check!",
+              PACKET_GetLength(packet));
+        return -1;
+      }
+      context->nStreamNum++;
+      context->nStreamBytes += PACKET_GetLength(packet);
+      if (context->pOutputFile)
+        fwrite(PACKET_GetDataPointer(packet), 1, PACKET_GetLength(packet),
+               context->pOutputFile);
+    }
+
+    if (lent) {
+      S32 err = VENC_ReturnOutputStreamBuffer(context->pVencCtx,
+                                              PACKET_GetBaseData(packet));
+      if (err) return err;
+      if (PACKET_GetDataPointer(packet) != owned) {
+        error("the packet does not get its own data back, please check!");
+        return -1;
+      }
+      // given back already, the encoder does not take it twice
+      if (MPP_CHECK_FAILED !=
+          VENC_ReturnOutputStreamBuffer(context->pVencCtx,
+                                        PACKET_GetBaseData(packet))) {
+        error("a packet that is not lent is returned, please check!");
+        return -1;
+      }
+    }
+    if (ret == MPP_CODER_EOS) context->bEos = MPP_TRUE;
+  }
+  if (ret != MPP_OK && ret != MPP_CODER_EOS && ret != MPP_CODER_NO_DATA)
+    return ret;
+
+  while ((id = VENC_ReturnInputFrame(context->pVencCtx, NULL)) >= 0) {
+    if (id < FRAME_POOL_NUM) context->bFrameFree[id] = MPP_TRUE;
+  }
+
+  return MPP_OK;
+}
+
+static MppFrame *get_free_frame(TestContext *context) {
+  for (S32 n = 0; n < 5000; n++) {
+    for (S32 i = 0; i < FRAME_POOL_NUM; i++) {
+      if (context->bFrameFree[i]) return context->pFrame[i];
+    }
+    if (drain(context)) return NULL;
+    usleep(1000);
+  }
+
+  error("no frame comes back from the encoder, please check!");
+  return NULL;
+}
+
+S32 main(S32 argc, char **argv) {
+  TestContext *context = NULL;
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  MppFrame *frame = NULL;
+  S32 ret = -1;
+  S32 i;
+
+  context = (TestContext *)malloc(sizeof(TestContext));
+  if (!context) {
+    error("can not create TestContext, please check!");
+    return -1;
+  }
+  memset(context, 0, sizeof(TestContext));
+  context->nWidth = 640;
+  context->nHeight = 480;
+  context->nFrames = 30;
+
+  for (i = 1; i < argc; i += 2) {
+    if (parse_argument(context, argv[i], i + 1 < argc ? argv[i + 1] : NULL,
+                       argument_num))
+      goto finish;
+  }
+
+  if (!has_v4l2_encoder("mvx", V4L2_PIX_FMT_H264)) {
+    printf("no mvx encoder, skipped\n");
+    ret = 0;
+    goto finish;
+  }
+
+  if (context->pOutputFileName[0]) {
+    context->pOutputFile = fopen((char *)context->pOutputFileName, "wb");
+    if (!context->pOutputFile) {
+      error("can not open %s, please check!", context->pOutputFileName);
+      goto finish;
+    }
+  }
+
+  if (FramePrepare(context)) goto finish;
+  if (VencPrepare(context)) {
+    printf("the linlon encoder can not be opened, skipped\n");
+    ret = 0;
+    goto finish;
+  }
+
+  context->pPacket = PACKET_Create();
+  if (!context->pPacket) goto finish;
+  PACKET_Alloc(context->pPacket, MPP_PACKET_MALLOC_SIZE);
+
+  while (context->nFrameNum < context->nFrames) {
+    frame = get_free_frame(context);
+    if (!frame) goto finish;
+    fill_frame(context, frame);
+
+    FRAME_SetEos(frame, FRAME_NO_EOS);
+    FRAME_SetPts(frame, context->nFrameNum);
+    context->bFrameFree[FRAME_GetID(frame)] = MPP_FALSE;
+
+    // all frame buffers of the encoder are busy, take streams and retry
+    while ((ret = VENC_SendInputFrame(context->pVencCtx,
+                                      FRAME_GetBaseData(frame)))) {
+      if (ret != MPP_POLL_FAILED || drain(context)) goto finish;
+      usleep(1000);
+    }
+    context->nFrameNum++;
+    if (drain(context)) goto finish;
+  }
+
+  ret = -1;
+  FRAME_SetEos(frame, FRAME_EOS_WITHOUT_DATA);
+  VENC_SendInputFrame(context->pVencCtx, FRAME_GetBaseData(frame));
+  for (i = 0; i < 5000 && !context->bEos; i++) {
+    if (drain(context)) goto finish;
+    usleep(1000);
+  }
+
+  printf("%d frames, %d lent streams of %lld bytes, %s\n", context->nFrameNum,
+         context->nStreamNum, (long long)context->nStreamBytes,
+         context->bEos ? "eos" : "no eos");
+  ret = (context->bEos && context->nStreamNum >= context->nFrameNum) ? 0 : -1;
+  printf("linlon lent stream encode %s\n", ret ? "FAIL" : "PASS");
+
+finish:
+  if (context->pPacket) {
+    PACKET_Free(context->pPacket);
+    PACKET_Destory(context->pPacket);
+  }
+
+  if (context->pVencCtx) VENC_DestoryChannel(context->pVencCtx);
+
+  for (i = 0; i < FRAME_POOL_NUM; i++) {
+    if (context->pFrame[i]) {
+      FRAME_Free(context->pFrame[i]);
+      FRAME_Destory(context->pFrame[i]);
+    }
+  }
+
+  if (context->pOutputFile) fclose(context->pOutputFile);
+  free(context);
+
+  return ret;
+}
@@ -0,0 +1,225 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-06-01 17:20:36
+ * @LastEditTime: 2024-06-02 11:52:18
+ * @Description: cost of one debug() line for the caller: the previous
+ *               synchronous printf (an fprintf into the same file, line
+ *               buffered as stdout on a console), the log thread with the
+ *               debug level enabled, and with it disabled. The lines are
+ *               logged in bursts of BURST_NUM (a few per frame), the flush
+ *               after each burst is not counted in the first number. Checks
+ *               that no line is lost, that a lone line is written without a
+ *               flush (the log thread has no timed wakeup), and that an
+ *               error() line is on the file when it returns, after the debug
+ *               lines logged before it (in a child that exits without a
+ *               flush).
+ */
+
+#define ENABLE_DEBUG 1
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "argument.h"
+#include "log.h"
+#include "type.h"
+
+#define MODULE_TAG "log_benchmark"
+
+#define BURST_NUM 64
+#define WAKEUP_NUM 100
+#define WAKEUP_TIMEOUT_NS 1000000000LL
+
+static const MppArgument ArgumentMapping[] = {
+    {"-h", "--help", HELP, "Print this help"},
+    {"-n", "--count", DECODE_FRAME_NUM, "Number of lines, default 1000000"},
+    {"-o", "--output", SAVE_FRAME_FILE,
+     "File the lines are written to, default /tmp/log_benchmark.log"},
+};
+
+static S64 get_time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (S64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static S32 count_lines(const char *path) {
+  FILE *file = fopen(path, "r");
+  S32 num = 0;
+  int c;
+
+  if (!file) return -1;
+  while (EOF != (c = fgetc(file))) {
+    if ('\n' == c) num++;
+  }
+  fclose(file);
+
+  return num;
+}
+
+static void print_result(const char *name, S32 count, S64 call, S64 all) {
+  printf("%-16s %8.1f ns/line, %8.1f ns/line with the flush\n", name,
+         (double)call / count, (double)all / count);
+}
+
+/**
+ * @description: the macro before the log thread, one gettid and one write
+ * per line
+ */
+static S32 run_legacy(const char *path, S32 count) {
+  FILE *file = fopen(path, "w");
+  S64 start, call = 0, all = 0;
+  S32 i, j;
+
+  if (!file) return -1;
+  setvbuf(file, NULL, _IOLBF, 0);
+
+  for (i = 0; i < count; i += BURST_NUM) {
+    start = get_time_ns();
+    for (j = i; j < i + BURST_NUM && j < count; j++)
+      fprintf(file, "[MPP-DEBUG] %ld:%s:%d decode frame %d\n", gettid(),
+              __FUNCTION__, __LINE__, j);
+    call += get_time_ns() - start;
+    fflush(file);
+    all += get_time_ns() - start;
+  }
+  fclose(file);
+
+  print_result("printf", count, call, all);
+  return count_lines(path) == count ? 0 : -1;
+}
+
+static S32 run_async(const char *path, S32 count, S32 level) {
+  S64 start, call = 0, all = 0;
+  S32 i, j;
+
+  if (mpp_set_log_sink(MPP_LOG_SINK_FILE, path)) return -1;
+  mpp_set_log_level(level);
+
+  for (i = 0; i < count; i += BURST_NUM) {
+    start = get_time_ns();
+    for (j = i; j < i + BURST_NUM && j < count; j++)
+      debug("decode frame %d", j);
+    call += get_time_ns() - start;
+    mpp_log_flush();
+    all += get_time_ns() - start;
+  }
+
+  print_result(level >= MPP_LOG_DEBUG ? "async, debug on" : "async, debug off",
+               count, call, all);
+  return count_lines(path) == (level >= MPP_LOG_DEBUG ? count : 0) ? 0 : -1;
+}
+
+/**
+ * @description: one debug line at a time, nobody flushes: the line logged
+ * has to wake the log thread, or it is never written.
+ */
+static S32 run_wakeup(const char *path) {
+  S64 start, latency, max_latency = 0;
+  S32 i;
+
+  if (mpp_set_log_sink(MPP_LOG_SINK_FILE, path)) return -1;
+  mpp_set_log_level(MPP_LOG_DEBUG);
+
+  for (i = 0; i < WAKEUP_NUM; i++) {
+    // the log thread is asleep again before the next line
+    usleep(1000);
+    start = get_time_ns();
+    debug("decode frame %d", i);
+    while (count_lines(path) != i + 1) {
+      if (get_time_ns() - start > WAKEUP_TIMEOUT_NS) {
+        printf("%-16s FAILED, line %d is not written\n", "wakeup", i);
+        return -1;
+      }
+      sched_yield();
+    }
+    latency = get_time_ns() - start;
+    if (latency > max_latency) max_latency = latency;
+  }
+
+  printf("%-16s ok, %.1f us at most\n", "wakeup", max_latency / 1000.0);
+  return 0;
+}
+
+/**
+ * @description: a child logs debug lines and an error, then exits at once
+ * (no atexit flush): the error line has to drain the rings itself.
+ */
+static S32 run_error_order(const char *path) {
+  char line[512];
+  FILE *file = NULL;
+  S32 num = 0;
+  pid_t pid;
+  S32 i;
+
+  if (mpp_set_log_sink(MPP_LOG_SINK_FILE, path)) return -1;
+  mpp_set_log_level(MPP_LOG_DEBUG);
+
+  pid = fork();
+  if (pid < 0) return -1;
+  if (!pid) {
+    for (i = 0; i < BURST_NUM; i++) debug("decode frame %d", i);
+    error("decode frame %d failed", i);
+    _exit(0);
+  }
+  waitpid(pid, NULL, 0);
+
+  file = fopen(path, "r");
+  if (!file) return -1;
+  while (fgets(line, sizeof(line), file)) {
+    // debug lines 0..BURST_NUM-1 first, then the error
+    if (num < BURST_NUM ? !strstr(line, "[MPP-DEBUG]")
+                        : !strstr(line, "[MPP-ERROR]")) {
+      num = -1;
+      break;
+    }
+    num++;
+  }
+  fclose(file);
+
+  printf("%-16s %s\n", "error order", num == BURST_NUM + 1 ? "ok" : "FAILED");
+  return num == BURST_NUM + 1 ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  const char *path = "/tmp/log_benchmark.log";
+  S32 count = 1000000;
+  S32 ret = 0;
+  S32 i;
+
+  for (i = 1; i < argc; i += 2) {
+    ARGUMENT arg = get_argument(ArgumentMapping, argv[i], argument_num);
+    if (arg == HELP || arg == INVALID || i + 1 >= argc) {
+      print_demo_usage(ArgumentMapping, argument_num);
+      return -1;
+    }
+    if (arg == DECODE_FRAME_NUM) sscanf(argv[i + 1], "%d", &count);
+    if (arg == SAVE_FRAME_FILE) path = argv[i + 1];
+  }
+
+  if (count <= 0) {
+    error("invalid arguments, please check!");
+    return -1;
+  }
+
+  printf("%d debug lines into %s\n", count, path);
+  if (run_legacy(path, count)) ret = -1;
+  if (run_async(path, count, MPP_LOG_DEBUG)) ret = -1;
+  if (run_async(path, count, MPP_LOG_INFO)) ret = -1;
+  if (run_wakeup(path)) ret = -1;
+  if (run_error_order(path)) ret = -1;
+  mpp_set_log_sink(MPP_LOG_SINK_STDOUT, NULL);
+
+  if (ret) error("lines are lost, please check!");
+  return ret;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-21 10:02:17
+ * @LastEditTime: 2024-05-21 10:02:17
+ * @Description: minimal md5 (RFC 1321) for checking decoded output in tests
+ */
+
+#include "md5.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define ROTATE_LEFT(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static const U32 md5_k[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+    0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+    0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+    0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+    0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+    0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+
+static const U8 md5_r[64] = {7,  12, 17, 22, 7,  12, 17, 22, 7,  12, 17, 22, 7,
+                             12, 17, 22, 5,  9,  14, 20, 5,  9,  14, 20, 5,  9,
+                             14, 20, 5,  9,  14, 20, 4,  11, 16, 23, 4,  11, 16,
+                             23, 4,  11, 16, 23, 4,  11, 16, 23, 6,  10, 15, 21,
+                             6,  10, 15, 21, 6,  10, 15, 21, 6,  10, 15, 21};
+
+static void md5_transform(U32 state[4], const U8 block[64]) {
+  U32 a = state[0], b = state[1], c = state[2], d = state[3];
+  U32 m[16];
+  U32 f, g, tmp;
+  S32 i;
+
+  for (i = 0; i < 16; i++) {
+    m[i] = (U32)block[i * 4] | ((U32)block[i * 4 + 1] << 8) |
+           ((U32)block[i * 4 + 2] << 16) | ((U32)block[i * 4 + 3] << 24);
+  }
+
+  for (i = 0; i < 64; i++) {
+    if (i < 16) {
+      f = (b & c) | (~b & d);
+      g = i;
+    } else if (i < 32) {
+      f = (d & b) | (~d & c);
+      g = (5 * i + 1) % 16;
+    } else if (i < 48) {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) % 16;
+    } else {
+      f = c ^ (b | ~d);
+      g = (7 * i) % 16;
+    }
+
+    tmp = d;
+    d = c;
+    c = b;
+    b = b + ROTATE_LEFT(a + f + md5_k[i] + m[g], md5_r[i]);
+    a = tmp;
+  }
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+}
+
+void md5_init(MD5Context *context) {
+  context->nState[0] = 0x67452301;
+  context->nState[1] = 0xefcdab89;
+  context->nState[2] = 0x98badcfe;
+  context->nState[3] = 0x10325476;
+  context->nLength = 0;
+}
+
+void md5_update(MD5Context *context, const U8 *data, U64 length) {
+  U32 used = context->nLength % 64;
+  U32 fill = 64 - used;
+
+  context->nLength += length;
+
+  if (used && length >= fill) {
+    memcpy(context->pBuffer + used, data, fill);
+    md5_transform(context->nState, context->pBuffer);
+    data += fill;
+    length -= fill;
+    used = 0;
+  }
+
+  while (length >= 64) {
+    md5_transform(context->nState, data);
+    data += 64;
+    length -= 64;
+  }
+
+  if (length) memcpy(context->pBuffer + used, data, length);
+}
+
+void md5_final(MD5Context *context, char *out) {
+  static const U8 padding[64] = {0x80};
+  U64 bits = context->nLength * 8;
+  U32 used = context->nLength % 64;
+  U8 length[8];
+  S32 i, j;
+
+  for (i = 0; i < 8; i++) length[i] = (U8)(bits >> (i * 8));
+
+  md5_update(context, padding, used < 56 ? 56 - used : 120 - used);
+  md5_update(context, length, 8);
+
+  for (i = 0; i < 4; i++) {
+    for (j = 0; j < 4; j++) {
+      sprintf(out + i * 8 + j * 2, "%02x",
+              (context->nState[i] >> (j * 8)) & 0xff);
+    }
+  }
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-06-01 16:10:12
+ * @LastEditTime: 2024-06-02 09:40:15
+ * @Description: check the plugin registry on the plugins of the build tree
+ *               (fake_dec_plugin and v4l2_standard_codec, no device is
+ *               opened): lookup by type, the pick by capability descriptor
+ *               and device probe, the next pick after a plugin that can not
+ *               open the channel, and that the directories are scanned
+ *               once. Usage:
+ *               module_registry_test [plugin directories separated by ':']
+ */
+
+#define ENABLE_DEBUG 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "env.h"
+#include "log.h"
+#include "module.h"
+#include "v4l2_utils.h"
+#include "vdec.h"
+
+#define MODULE_TAG "module_registry_test"
+
+#define LOOKUP_NUM (10000)
+
+#define CHECK(cond)                     \
+  do {                                  \
+    if (!(cond)) {                      \
+      error("check failed: %s", #cond); \
+      return -1;                        \
+    }                                   \
+  } while (0)
+
+static S64 get_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (S64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @description: the type auto selected for a channel, CODEC_AUTO if none
+ */
+static MppModuleType pick(MppCodingType coding_type, BOOL encoder,
+                          MppPixelFormat pixel_format, S32 width, S32 height) {
+  MppModule *module = module_auto_init(coding_type, encoder, pixel_format,
+                                       width, height);
+  MppModuleType type = module_get_type(module);
+
+  if (module) module_destory(module);
+  return type;
+}
+
+/**
+ * @description: the type picked where the hardware can not run the channel,
+ * or the v4l2 plugin of the device that can, linlon (driver "mvx") is only
+ * there if it is built
+ */
+static MppModuleType hardware_or(U32 fourcc, BOOL encoder,
+                                 MppModuleType type) {
+  MppModule *linlon = NULL;
+  BOOL has_linlon, has_any;
+
+  has_linlon = encoder ? has_v4l2_encoder("mvx", fourcc)
+                       : has_v4l2_decoder("mvx", fourcc);
+  has_any = encoder ? has_v4l2_encoder(NULL, fourcc)
+                    : has_v4l2_decoder(NULL, fourcc);
+
+  if (has_linlon) {
+    linlon = module_init(CODEC_V4L2_LINLONV5V7);
+    if (linlon) {
+      module_destory(linlon);
+      return CODEC_V4L2_LINLONV5V7;
+    }
+  }
+
+  return has_any ? CODEC_V4L2 : type;
+}
+
+static S32 test_lookup() {
+  MppModule *module = module_init(CODEC_FAKEDEC);
+  const ALPluginCaps *caps = module_get_caps(module);
+
+  CHECK(module && CODEC_FAKEDEC == module_get_type(module));
+  CHECK(dlsym(module_get_so_path(module), "al_dec_create"));
+  CHECK(caps && AL_PLUGIN_CAPS_VERSION == caps->nVersion);
+  CHECK(CODEC_FAKEDEC == caps->eModuleType && 1000 == caps->nCost);
+  module_destory(module);
+
+  // not in the directories
+  CHECK(!module_init(CODEC_FFMPEG));
+  CHECK(!module_init(CODEC_OPENH264));
+
+  return 0;
+}
+
+static S32 test_auto() {
+  // the hardware one is cheaper, if its device is there
+  CHECK(hardware_or(V4L2_PIX_FMT_H264, MPP_FALSE, CODEC_FAKEDEC) ==
+        pick(CODING_H264, MPP_FALSE, PIXEL_FORMAT_I420, 1920, 1080));
+  CHECK(hardware_or(V4L2_PIX_FMT_FWHT, MPP_TRUE, CODEC_AUTO) ==
+        pick(CODING_FWHT, MPP_TRUE, PIXEL_FORMAT_UNKNOWN, 0, 0));
+
+  // the fake one takes any format, v4l2 does not map RGBA
+  CHECK(CODEC_FAKEDEC == pick(CODING_H264, MPP_FALSE, PIXEL_FORMAT_RGBA, 1920,
+                              1080));
+  CHECK(CODEC_FAKEDEC == pick(CODING_H265, MPP_TRUE, PIXEL_FORMAT_RGBA, 0, 0));
+
+  // nobody
+  CHECK(CODEC_AUTO == pick(CODING_H264, MPP_FALSE, PIXEL_FORMAT_RGBA, 16384,
+                           16384));
+  CHECK(CODEC_AUTO == pick(CODING_AV1, MPP_TRUE, PIXEL_FORMAT_UNKNOWN, 0, 0));
+  CHECK(CODEC_AUTO == pick(CODING_VC1, MPP_FALSE, PIXEL_FORMAT_RGBA, 0, 0));
+
+  return 0;
+}
+
+/**
+ * @description: the picks after a plugin go up in cost and end
+ */
+static S32 test_next() {
+  MppModule *module = module_auto_init(CODING_H264, MPP_FALSE,
+                                       PIXEL_FORMAT_UNKNOWN, 0, 0);
+  MppModule *next = NULL;
+  S32 num = 0;
+
+  CHECK(module);
+  while (module && num < 8) {
+    next = module_auto_next(module, CODING_H264, MPP_FALSE,
+                            PIXEL_FORMAT_UNKNOWN, 0, 0);
+    CHECK(!next || module_get_type(next) != module_get_type(module));
+    CHECK(!next ||
+          module_get_caps(next)->nCost >= module_get_caps(module)->nCost);
+    module_destory(module);
+    module = next;
+    num++;
+  }
+  CHECK(!module);
+
+  // the fake one is the last
+  module = module_auto_init(CODING_H264, MPP_FALSE, PIXEL_FORMAT_RGBA, 0, 0);
+  CHECK(CODEC_FAKEDEC == module_get_type(module));
+  CHECK(!module_auto_next(module, CODING_H264, MPP_FALSE, PIXEL_FORMAT_RGBA,
+                          0, 0));
+  module_destory(module);
+
+  return 0;
+}
+
+/**
+ * @description: a CODEC_AUTO channel gets the type picked
+ */
+static S32 test_vdec() {
+  MppVdecCtx *ctx = VDEC_CreateChannel();
+
+  CHECK(ctx);
+  ctx->eCodecType = CODEC_AUTO;
+  ctx->stVdecPara.eCodingType = CODING_H264;
+  ctx->stVdecPara.eOutputPixelFormat = PIXEL_FORMAT_RGBA;
+  ctx->stVdecPara.nWidth = 64;
+  ctx->stVdecPara.nHeight = 32;
+  CHECK(MPP_OK == VDEC_Init(ctx));
+  CHECK(CODEC_FAKEDEC == ctx->eCodecType);
+  VDEC_DestoryChannel(ctx);
+
+  return 0;
+}
+
+/**
+ * @description: the directories are not scanned again, a lookup is cheap
+ */
+static S32 test_once() {
+  S64 start;
+  S32 i;
+
+  mpp_env_set_str("MPP_PLUGIN_PATH", "/nonexistent");
+  start = get_time_us();
+  for (i = 0; i < LOOKUP_NUM; i++) {
+    MppModule *module = module_init(CODEC_FAKEDEC);
+    CHECK(module);
+    module_destory(module);
+  }
+  printf("module_init + module_destory: %.3f us\n",
+         (double)(get_time_us() - start) / LOOKUP_NUM);
+
+  return 0;
+}
+
+S32 main(S32 argc, char **argv) {
+  S32 ret = 0;
+
+  mpp_env_set_str("MPP_PLUGIN_PATH",
+                  argc > 1 ? (U8 *)argv[1] : (U8 *)MPP_TEST_PLUGIN_PATH);
+
+  if (test_lookup() || test_auto() || test_next() || test_vdec() ||
+      test_once())
+    ret = -1;
+
+  printf("module registry test %s\n", ret ? "FAIL" : "PASS");
+  return ret;
+}
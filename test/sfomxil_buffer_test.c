@@ -0,0 +1,251 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-06-01 15:20:36
+ * @LastEditTime: 2024-06-01 15:20:36
+ * @Description: check who holds the sfomxil port buffers on the mock OMX IL
+ *               core (sfomxil_mock_core): the buffers registered by
+ *               OMX_UseBuffer, lent, sent and given back by the component,
+ *               then an encoder channel fed by al_enc_send_input_frame, every
+ *               frame must come back once and in order. Usage:
+ *               sfomxil_buffer_test [path of libsfomxil_mock_core.so]
+ */
+
+#define ENABLE_DEBUG 1
+
+#include <OMX_Component.h>
+#include <OMX_Core.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "al_interface_enc.h"
+#include "env.h"
+#include "log.h"
+#include "sfomxil_buffer.h"
+
+#define MODULE_TAG "sfomxil_buffer_test"
+
+#define BUFFER_NUM (4)
+#define BUFFER_SIZE (1024)
+#define FRAME_NUM (16)
+#define WIDTH (64)
+#define HEIGHT (32)
+#define WAIT_MS (5000)
+
+#define CHECK(cond)                     \
+  do {                                  \
+    if (!(cond)) {                      \
+      error("check failed: %s", #cond); \
+      return -1;                        \
+    }                                   \
+  } while (0)
+
+static SfOmxilBufferSet stInput;
+static S32 nEmptyDoneNum;
+
+static OMX_ERRORTYPE event_handler(OMX_HANDLETYPE hComponent, OMX_PTR pAppData,
+                                   OMX_EVENTTYPE eEvent, OMX_U32 nData1,
+                                   OMX_U32 nData2, OMX_PTR pEventData) {
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE fill_buffer_done(OMX_HANDLETYPE hComponent,
+                                      OMX_PTR pAppData,
+                                      OMX_BUFFERHEADERTYPE *pBuffer) {
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE empty_buffer_done(OMX_HANDLETYPE hComponent,
+                                       OMX_PTR pAppData,
+                                       OMX_BUFFERHEADERTYPE *pBuffer) {
+  if (!sfomxil_buffer_move(&stInput,
+                           sfomxil_buffer_find_header(&stInput, pBuffer),
+                           SFOMXIL_BUFFER_OWNED_BY_COMPONENT,
+                           SFOMXIL_BUFFER_OWNED_BY_PLUGIN))
+    nEmptyDoneNum++;
+  return OMX_ErrorNone;
+}
+
+/**
+ * @description: alloc, lend, send and free the buffers of a mock component
+ */
+static S32 test_owner(U8 *core) {
+  OMX_CALLBACKTYPE callbacks = {event_handler, empty_buffer_done,
+                                fill_buffer_done};
+  OMX_ERRORTYPE (*get_handle)(OMX_HANDLETYPE *, OMX_STRING, OMX_PTR,
+                              OMX_CALLBACKTYPE *);
+  OMX_ERRORTYPE (*free_handle)(OMX_HANDLETYPE);
+  OMX_HANDLETYPE component = NULL;
+  OMX_BUFFERHEADERTYPE *output = NULL;
+  SfOmxilBuffer *buffer[BUFFER_NUM];
+  void *so = dlopen(core, RTLD_LAZY | RTLD_LOCAL);
+  S32 i;
+
+  CHECK(so);
+  get_handle = dlsym(so, "OMX_GetHandle");
+  free_handle = dlsym(so, "OMX_FreeHandle");
+  CHECK(get_handle && free_handle);
+  CHECK(OMX_ErrorNone ==
+        get_handle(&component, "OMX.sf.video_encoder.hevc", NULL, &callbacks));
+
+  // registered by OMX_UseBuffer, the component writes into our memory
+  CHECK(MPP_OK == sfomxil_buffer_alloc(&stInput, component, 0, BUFFER_NUM,
+                                       BUFFER_SIZE));
+  CHECK(BUFFER_NUM == stInput.nBufferNum);
+  for (i = 0; i < BUFFER_NUM; i++) {
+    SfOmxilBuffer *b = &(stInput.stBuffer[i]);
+    CHECK(b->pHeader && b->pData && b->pHeader->pBuffer == b->pData);
+    CHECK(BUFFER_SIZE == b->pHeader->nAllocLen);
+    CHECK(b == sfomxil_buffer_find_header(&stInput, b->pHeader));
+    CHECK(b == sfomxil_buffer_find_data(&stInput, b->pData));
+  }
+  CHECK(BUFFER_NUM ==
+        sfomxil_buffer_count(&stInput, SFOMXIL_BUFFER_OWNED_BY_PLUGIN));
+  CHECK(!sfomxil_buffer_find_data(&stInput, stInput.stBuffer[0].pData + 1));
+
+  // lend one, the others are sent, none is left
+  buffer[0] = sfomxil_buffer_take(&stInput, SFOMXIL_BUFFER_OWNED_BY_APP);
+  CHECK(buffer[0] && SFOMXIL_BUFFER_OWNED_BY_APP == buffer[0]->eOwner);
+  for (i = 1; i < BUFFER_NUM; i++) {
+    buffer[i] =
+        sfomxil_buffer_take(&stInput, SFOMXIL_BUFFER_OWNED_BY_COMPONENT);
+    CHECK(buffer[i] && buffer[i] != buffer[i - 1]);
+  }
+  CHECK(!sfomxil_buffer_take(&stInput, SFOMXIL_BUFFER_OWNED_BY_APP));
+  CHECK(1 == sfomxil_buffer_count(&stInput, SFOMXIL_BUFFER_OWNED_BY_APP));
+
+  // a wrong owner changes nothing
+  CHECK(MPP_CHECK_FAILED ==
+        sfomxil_buffer_move(&stInput, buffer[1], SFOMXIL_BUFFER_OWNED_BY_APP,
+                            SFOMXIL_BUFFER_OWNED_BY_PLUGIN));
+  CHECK(SFOMXIL_BUFFER_OWNED_BY_COMPONENT == buffer[1]->eOwner);
+
+  // the lent one is written in place and sent as it is
+  memset(buffer[0]->pData, 0x5a, 16);
+  CHECK(MPP_OK == sfomxil_buffer_move(&stInput, buffer[0],
+                                      SFOMXIL_BUFFER_OWNED_BY_APP,
+                                      SFOMXIL_BUFFER_OWNED_BY_COMPONENT));
+
+  // all of them come back by EmptyBufferDone once the component runs
+  CHECK(OMX_ErrorNone == OMX_SendCommand(component, OMX_CommandStateSet,
+                                         OMX_StateExecuting, NULL));
+  for (i = 0; i < BUFFER_NUM; i++) {
+    buffer[i]->pHeader->nFilledLen = 16;
+    buffer[i]->pHeader->nFlags = OMX_BUFFERFLAG_ENDOFFRAME;
+    CHECK(OMX_ErrorNone == OMX_EmptyThisBuffer(component, buffer[i]->pHeader));
+  }
+  CHECK(OMX_ErrorNone == OMX_AllocateBuffer(component, &output, 1, NULL, 4096));
+  for (i = 0; i < BUFFER_NUM; i++) {
+    CHECK(OMX_ErrorNone == OMX_FillThisBuffer(component, output));
+    if (!i) CHECK(0x5a == output->pBuffer[8]);
+  }
+  CHECK(BUFFER_NUM == nEmptyDoneNum);
+  CHECK(BUFFER_NUM ==
+        sfomxil_buffer_count(&stInput, SFOMXIL_BUFFER_OWNED_BY_PLUGIN));
+
+  OMX_FreeBuffer(component, 1, output);
+  sfomxil_buffer_free(&stInput, component);
+  CHECK(0 == stInput.nBufferNum);
+  free_handle(component);
+  dlclose(so);
+
+  return 0;
+}
+
+/**
+ * @description: send frames by al_enc_send_input_frame, check the streams
+ * and the frames given back
+ */
+static S32 test_encoder() {
+  MppVencPara para;
+  ALBaseContext *ctx = al_enc_create();
+  MppPacket *packet = PACKET_Create();
+  MppFrame *frame = FRAME_Create();
+  MppData *data = PACKET_GetBaseData(packet);
+  S32 stream_num = 0, returned_num = 0;
+  BOOL eos = MPP_FALSE;
+  S32 n, id, ret;
+
+  memset(&para, 0, sizeof(para));
+  para.nWidth = WIDTH;
+  para.nHeight = HEIGHT;
+  para.PixelFormat = PIXEL_FORMAT_I420;
+  CHECK(ctx && packet && frame);
+  CHECK(MPP_OK == al_enc_init(ctx, &para));
+  CHECK(MPP_OK == FRAME_Alloc(frame, PIXEL_FORMAT_I420, WIDTH, HEIGHT));
+
+  for (n = 0; n <= FRAME_NUM + WAIT_MS && !eos; n++) {
+    if (n < FRAME_NUM) {
+      // one frame is reused, it can be changed once sent (copied)
+      memset(FRAME_GetDataPointer(frame, 0), n + 1, WIDTH * HEIGHT);
+      FRAME_SetID(frame, n);
+      while (MPP_POLL_FAILED ==
+             (ret = al_enc_send_input_frame(ctx, FRAME_GetBaseData(frame)))) {
+        usleep(1000);
+      }
+      CHECK(MPP_OK == ret);
+    } else if (n == FRAME_NUM) {
+      MppFrame *end = FRAME_Create();
+      FRAME_SetEos(end, FRAME_EOS_WITHOUT_DATA);
+      while (MPP_POLL_FAILED ==
+             al_enc_send_input_frame(ctx, FRAME_GetBaseData(end))) {
+        usleep(1000);
+      }
+      FRAME_Destory(end);
+    } else {
+      usleep(1000);
+    }
+
+    while ((id = al_enc_return_input_frame(ctx, NULL)) >= 0) {
+      CHECK(id == returned_num);
+      returned_num++;
+    }
+
+    while (MPP_OK == (ret = al_enc_request_output_stream(ctx, data))) {
+      U8 *stream = PACKET_GetDataPointer(packet);
+      if (PACKET_GetLength(packet)) {
+        CHECK(9 == PACKET_GetLength(packet) && !memcmp(stream, "MOCK", 4));
+        CHECK(stream[8] == stream_num + 1);
+        stream_num++;
+      }
+      al_enc_return_output_stream(ctx, data);
+    }
+    if (MPP_CODER_EOS == ret) eos = MPP_TRUE;
+  }
+
+  printf("encoder: %d streams, %d frames back, %s\n", stream_num,
+         returned_num, eos ? "eos" : "no eos");
+  CHECK(eos && FRAME_NUM == stream_num && FRAME_NUM == returned_num);
+
+  al_enc_destory(ctx);
+  FRAME_Free(frame);
+  FRAME_Destory(frame);
+  PACKET_Destory(packet);
+
+  return 0;
+}
+
+S32 main(S32 argc, char **argv) {
+  U8 *core = NULL;
+  S32 ret = 0;
+
+  if (argc > 1) {
+    mpp_env_set_str("MPP_SFOMX_LIBRARY", (U8 *)argv[1]);
+  } else {
+    mpp_env_get_str("MPP_SFOMX_LIBRARY", &core, NULL);
+    if (!core) mpp_env_set_str("MPP_SFOMX_LIBRARY", SFOMXIL_MOCK_CORE_PATH);
+  }
+  mpp_env_get_str("MPP_SFOMX_LIBRARY", &core, NULL);
+
+  if (test_owner(core)) ret = -1;
+  if (!ret && test_encoder()) ret = -1;
+
+  printf("sfomxil buffer test %s\n", ret ? "FAIL" : "PASS");
+  return ret;
+}
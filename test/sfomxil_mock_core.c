@@ -0,0 +1,282 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-06-01 14:05:12
+ * @LastEditTime: 2024-06-01 14:05:12
+ * @Description: a mock OMX IL core for the sfomxil plugin tests, loaded by
+ *               MPP_SFOMX_LIBRARY. Each component is an independent fake
+ *               encoder: an output buffer gets "MOCK", the frame number of
+ *               the component and the first byte of the input buffer, so a
+ *               test can tell whether the streams of two channels got mixed.
+ */
+
+#include <OMX_Component.h>
+#include <OMX_Core.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MOCK_BUFFER_NUM (64)
+#define MOCK_INPUT_BUFFER_NUM (5)
+#define MOCK_OUTPUT_BUFFER_NUM (3)
+#define MOCK_OUTPUT_BUFFER_SIZE (4096)
+
+typedef struct _MockComponent {
+  OMX_COMPONENTTYPE stComponent;
+  OMX_CALLBACKTYPE stCallbacks;
+  OMX_PTR pAppData;
+  OMX_STATETYPE eState;
+  OMX_PARAM_PORTDEFINITIONTYPE stPort[2];
+  OMX_BOOL bSettingsChanged;
+
+  /***
+   * input buffers waiting for an output buffer and output buffers waiting
+   * for an input buffer, the lock is held while they are processed so that
+   * the streams come out in order.
+   */
+  pthread_mutex_t stMutex;
+  OMX_BUFFERHEADERTYPE *pInput[MOCK_BUFFER_NUM];
+  OMX_BUFFERHEADERTYPE *pOutput[MOCK_BUFFER_NUM];
+  OMX_U32 nInputNum;
+  OMX_U32 nOutputNum;
+  OMX_U32 nFrameNum;
+} MockComponent;
+
+static MockComponent *get_mock(OMX_HANDLETYPE hComponent) {
+  return (MockComponent *)((OMX_COMPONENTTYPE *)hComponent)->pComponentPrivate;
+}
+
+static void pop(OMX_BUFFERHEADERTYPE **fifo, OMX_U32 *num) {
+  memmove(fifo, fifo + 1, (*num - 1) * sizeof(fifo[0]));
+  (*num)--;
+}
+
+/**
+ * @description: encode the pending input buffers, called with the lock held
+ */
+static void process(MockComponent *mock) {
+  while (mock->eState == OMX_StateExecuting && mock->nInputNum &&
+         mock->nOutputNum) {
+    OMX_BUFFERHEADERTYPE *in = mock->pInput[0];
+    OMX_BUFFERHEADERTYPE *out = mock->pOutput[0];
+    pop(mock->pInput, &mock->nInputNum);
+    pop(mock->pOutput, &mock->nOutputNum);
+
+    out->nOffset = 0;
+    out->nTimeStamp = in->nTimeStamp;
+    if (in->nFlags & OMX_BUFFERFLAG_EOS) {
+      out->nFlags = OMX_BUFFERFLAG_EOS;
+      out->nFilledLen = 0;
+    } else {
+      memcpy(out->pBuffer, "MOCK", 4);
+      memcpy(out->pBuffer + 4, &mock->nFrameNum, sizeof(mock->nFrameNum));
+      out->pBuffer[8] = in->nFilledLen ? in->pBuffer[0] : 0;
+      out->nFilledLen = 9;
+      out->nFlags = OMX_BUFFERFLAG_ENDOFFRAME;
+      mock->nFrameNum++;
+    }
+
+    mock->stCallbacks.FillBufferDone(&mock->stComponent, mock->pAppData, out);
+    mock->stCallbacks.EmptyBufferDone(&mock->stComponent, mock->pAppData, in);
+  }
+}
+
+static OMX_ERRORTYPE mock_send_command(OMX_HANDLETYPE hComponent,
+                                       OMX_COMMANDTYPE Cmd, OMX_U32 nParam,
+                                       OMX_PTR pCmdData) {
+  MockComponent *mock = get_mock(hComponent);
+  OMX_BOOL settings_changed = OMX_FALSE;
+
+  if (OMX_CommandStateSet == Cmd) {
+    pthread_mutex_lock(&mock->stMutex);
+    mock->eState = (OMX_STATETYPE)nParam;
+    if (OMX_StateExecuting == nParam && !mock->bSettingsChanged) {
+      mock->bSettingsChanged = OMX_TRUE;
+      settings_changed = OMX_TRUE;
+    }
+    pthread_mutex_unlock(&mock->stMutex);
+  }
+
+  mock->stCallbacks.EventHandler(hComponent, mock->pAppData,
+                                 OMX_EventCmdComplete, Cmd, nParam, NULL);
+
+  // the output buffers are allocated by the client on this event
+  if (settings_changed)
+    mock->stCallbacks.EventHandler(hComponent, mock->pAppData,
+                                   OMX_EventPortSettingsChanged, 1, 0, NULL);
+
+  pthread_mutex_lock(&mock->stMutex);
+  process(mock);
+  pthread_mutex_unlock(&mock->stMutex);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE mock_get_parameter(OMX_HANDLETYPE hComponent,
+                                        OMX_INDEXTYPE nParamIndex,
+                                        OMX_PTR pComponentParameterStructure) {
+  MockComponent *mock = get_mock(hComponent);
+  OMX_PARAM_PORTDEFINITIONTYPE *def = pComponentParameterStructure;
+
+  if (OMX_IndexParamPortDefinition != nParamIndex) return OMX_ErrorNone;
+  if (def->nPortIndex > 1) return OMX_ErrorBadPortIndex;
+
+  *def = mock->stPort[def->nPortIndex];
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE mock_set_parameter(OMX_HANDLETYPE hComponent,
+                                        OMX_INDEXTYPE nIndex,
+                                        OMX_PTR pComponentParameterStructure) {
+  MockComponent *mock = get_mock(hComponent);
+  OMX_PARAM_PORTDEFINITIONTYPE *def = pComponentParameterStructure;
+
+  if (OMX_IndexParamPortDefinition != nIndex) return OMX_ErrorNone;
+  if (def->nPortIndex > 1) return OMX_ErrorBadPortIndex;
+
+  mock->stPort[def->nPortIndex] = *def;
+  if (0 == def->nPortIndex)
+    mock->stPort[0].nBufferSize = def->format.video.nFrameWidth *
+                                  def->format.video.nFrameHeight * 3 / 2;
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE mock_get_state(OMX_HANDLETYPE hComponent,
+                                    OMX_STATETYPE *pState) {
+  *pState = get_mock(hComponent)->eState;
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE mock_use_buffer(OMX_HANDLETYPE hComponent,
+                                     OMX_BUFFERHEADERTYPE **ppBufferHdr,
+                                     OMX_U32 nPortIndex, OMX_PTR pAppPrivate,
+                                     OMX_U32 nSizeBytes, OMX_U8 *pBuffer) {
+  OMX_BUFFERHEADERTYPE *header = calloc(1, sizeof(OMX_BUFFERHEADERTYPE));
+  if (!header) return OMX_ErrorInsufficientResources;
+
+  header->nSize = sizeof(OMX_BUFFERHEADERTYPE);
+  header->pBuffer = pBuffer;
+  header->nAllocLen = nSizeBytes;
+  header->pAppPrivate = pAppPrivate;
+  header->nInputPortIndex = 0;
+  header->nOutputPortIndex = 1;
+  *ppBufferHdr = header;
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE mock_allocate_buffer(OMX_HANDLETYPE hComponent,
+                                          OMX_BUFFERHEADERTYPE **ppBuffer,
+                                          OMX_U32 nPortIndex,
+                                          OMX_PTR pAppPrivate,
+                                          OMX_U32 nSizeBytes) {
+  OMX_U8 *data = malloc(nSizeBytes);
+  if (!data) return OMX_ErrorInsufficientResources;
+
+  if (OMX_ErrorNone != mock_use_buffer(hComponent, ppBuffer, nPortIndex,
+                                       pAppPrivate, nSizeBytes, data)) {
+    free(data);
+    return OMX_ErrorInsufficientResources;
+  }
+  // owned by the component, freed by FreeBuffer
+  (*ppBuffer)->pPlatformPrivate = data;
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE mock_free_buffer(OMX_HANDLETYPE hComponent,
+                                      OMX_U32 nPortIndex,
+                                      OMX_BUFFERHEADERTYPE *pBuffer) {
+  if (!pBuffer) return OMX_ErrorBadParameter;
+  free(pBuffer->pPlatformPrivate);
+  free(pBuffer);
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE mock_empty_this_buffer(OMX_HANDLETYPE hComponent,
+                                            OMX_BUFFERHEADERTYPE *pBuffer) {
+  MockComponent *mock = get_mock(hComponent);
+
+  pthread_mutex_lock(&mock->stMutex);
+  if (mock->nInputNum == MOCK_BUFFER_NUM) {
+    pthread_mutex_unlock(&mock->stMutex);
+    return OMX_ErrorInsufficientResources;
+  }
+  mock->pInput[mock->nInputNum++] = pBuffer;
+  process(mock);
+  pthread_mutex_unlock(&mock->stMutex);
+
+  return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE mock_fill_this_buffer(OMX_HANDLETYPE hComponent,
+                                           OMX_BUFFERHEADERTYPE *pBuffer) {
+  MockComponent *mock = get_mock(hComponent);
+
+  pthread_mutex_lock(&mock->stMutex);
+  if (mock->nOutputNum == MOCK_BUFFER_NUM) {
+    pthread_mutex_unlock(&mock->stMutex);
+    return OMX_ErrorInsufficientResources;
+  }
+  mock->pOutput[mock->nOutputNum++] = pBuffer;
+  process(mock);
+  pthread_mutex_unlock(&mock->stMutex);
+
+  return OMX_ErrorNone;
+}
+
+static void init_port(OMX_PARAM_PORTDEFINITIONTYPE *def, OMX_U32 index,
+                      OMX_U32 count, OMX_U32 size) {
+  memset(def, 0, sizeof(*def));
+  def->nSize = sizeof(*def);
+  def->nPortIndex = index;
+  def->eDir = index ? OMX_DirOutput : OMX_DirInput;
+  def->nBufferCountActual = count;
+  def->nBufferCountMin = count;
+  def->nBufferSize = size;
+  def->bEnabled = OMX_TRUE;
+  def->eDomain = OMX_PortDomainVideo;
+}
+
+OMX_ERRORTYPE OMX_Init(void) { return OMX_ErrorNone; }
+
+OMX_ERRORTYPE OMX_Deinit(void) { return OMX_ErrorNone; }
+
+OMX_ERRORTYPE OMX_GetHandle(OMX_HANDLETYPE *pHandle, OMX_STRING cComponentName,
+                            OMX_PTR pAppData, OMX_CALLBACKTYPE *pCallBacks) {
+  MockComponent *mock = calloc(1, sizeof(MockComponent));
+  if (!mock) return OMX_ErrorInsufficientResources;
+
+  mock->stCallbacks = *pCallBacks;
+  mock->pAppData = pAppData;
+  mock->eState = OMX_StateLoaded;
+  pthread_mutex_init(&mock->stMutex, NULL);
+  init_port(&mock->stPort[0], 0, MOCK_INPUT_BUFFER_NUM, 0);
+  init_port(&mock->stPort[1], 1, MOCK_OUTPUT_BUFFER_NUM,
+            MOCK_OUTPUT_BUFFER_SIZE);
+
+  mock->stComponent.nSize = sizeof(OMX_COMPONENTTYPE);
+  mock->stComponent.pComponentPrivate = mock;
+  mock->stComponent.pApplicationPrivate = pAppData;
+  mock->stComponent.SendCommand = mock_send_command;
+  mock->stComponent.GetParameter = mock_get_parameter;
+  mock->stComponent.SetParameter = mock_set_parameter;
+  mock->stComponent.GetState = mock_get_state;
+  mock->stComponent.UseBuffer = mock_use_buffer;
+  mock->stComponent.AllocateBuffer = mock_allocate_buffer;
+  mock->stComponent.FreeBuffer = mock_free_buffer;
+  mock->stComponent.EmptyThisBuffer = mock_empty_this_buffer;
+  mock->stComponent.FillThisBuffer = mock_fill_this_buffer;
+
+  *pHandle = &mock->stComponent;
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE OMX_FreeHandle(OMX_HANDLETYPE hComponent) {
+  MockComponent *mock = get_mock(hComponent);
+
+  pthread_mutex_destroy(&mock->stMutex);
+  free(mock);
+  return OMX_ErrorNone;
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-06-01 14:05:12
+ * @LastEditTime: 2024-06-01 14:05:12
+ * @Description: run two sfomxil encoder channels in one process on the mock
+ *               OMX IL core (sfomxil_mock_core), feed them interleaved, and
+ *               check that every channel gets all of its own streams in
+ *               order and its own EOS. Usage:
+ *               sfomxil_multi_channel_test [path of libsfomxil_mock_core.so]
+ */
+
+#define ENABLE_DEBUG 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "al_interface_enc.h"
+#include "env.h"
+#include "log.h"
+
+#define MODULE_TAG "sfomxil_multi_channel_test"
+
+#define CHANNEL_NUM (2)
+#define FRAME_NUM (16)
+#define WIDTH (64)
+#define HEIGHT (32)
+#define WAIT_MS (5000)
+
+typedef struct _TestChannel {
+  ALBaseContext *pCtx;
+  MppVencPara stPara;
+  MppPacket *pPacket;
+  S32 nStreamNum;
+  BOOL bEos;
+  BOOL bError;
+} TestChannel;
+
+/**
+ * @description: the first luma byte of frame n of channel ch, the mock core
+ * copies it into the stream
+ */
+static U8 frame_value(S32 ch, S32 n) { return (U8)(ch * 100 + n + 1); }
+
+static S32 send_frame(TestChannel *channel, S32 ch, S32 n, BOOL eos) {
+  MppFrame *frame = FRAME_Create();
+  S32 ret;
+
+  if (!frame) return MPP_MALLOC_FAILED;
+
+  if (eos) {
+    FRAME_SetEos(frame, FRAME_EOS_WITHOUT_DATA);
+  } else {
+    FRAME_Alloc(frame, PIXEL_FORMAT_I420, WIDTH, HEIGHT);
+    memset(FRAME_GetDataPointer(frame, 0), frame_value(ch, n), WIDTH * HEIGHT);
+    memset(FRAME_GetDataPointer(frame, 1), 128, WIDTH * HEIGHT / 4);
+    memset(FRAME_GetDataPointer(frame, 2), 128, WIDTH * HEIGHT / 4);
+  }
+
+  ret = al_enc_encode(channel->pCtx, FRAME_GetBaseData(frame));
+
+  if (!eos) FRAME_Free(frame);
+  FRAME_Destory(frame);
+  return ret;
+}
+
+/**
+ * @description: take the ready streams of a channel and check them
+ */
+static void drain(TestChannel *channel, S32 ch) {
+  MppData *data = PACKET_GetBaseData(channel->pPacket);
+  S32 ret;
+
+  while (!channel->bEos) {
+    ret = al_enc_request_output_stream(channel->pCtx, data);
+    if (MPP_CODER_EOS == ret) {
+      channel->bEos = MPP_TRUE;
+      break;
+    }
+    if (MPP_OK != ret) break;
+
+    U8 *stream = PACKET_GetDataPointer(channel->pPacket);
+    S32 length = PACKET_GetLength(channel->pPacket);
+    if (length) {
+      U32 num = 0;
+      memcpy(&num, stream + 4, sizeof(num));
+      if (length != 9 || memcmp(stream, "MOCK", 4) ||
+          num != channel->nStreamNum ||
+          stream[8] != frame_value(ch, channel->nStreamNum)) {
+        error("channel %d stream %d is wrong (length %d num %u value %d)", ch,
+              channel->nStreamNum, length, num, stream[8]);
+        channel->bError = MPP_TRUE;
+      }
+      channel->nStreamNum++;
+    }
+
+    al_enc_return_output_stream(channel->pCtx, data);
+  }
+}
+
+S32 main(S32 argc, char **argv) {
+  TestChannel channel[CHANNEL_NUM];
+  U8 *core = NULL;
+  S32 ret = -1;
+  S32 ch, n;
+
+  memset(channel, 0, sizeof(channel));
+
+  if (argc > 1) {
+    mpp_env_set_str("MPP_SFOMX_LIBRARY", (U8 *)argv[1]);
+  } else {
+    mpp_env_get_str("MPP_SFOMX_LIBRARY", &core, NULL);
+    if (!core) mpp_env_set_str("MPP_SFOMX_LIBRARY", SFOMXIL_MOCK_CORE_PATH);
+  }
+
+  for (ch = 0; ch < CHANNEL_NUM; ch++) {
+    channel[ch].stPara.nWidth = WIDTH;
+    channel[ch].stPara.nHeight = HEIGHT;
+    channel[ch].stPara.PixelFormat = PIXEL_FORMAT_I420;
+    channel[ch].pPacket = PACKET_Create();
+    channel[ch].pCtx = al_enc_create();
+    if (!channel[ch].pPacket || !channel[ch].pCtx ||
+        MPP_OK != al_enc_init(channel[ch].pCtx, &(channel[ch].stPara))) {
+      error("can not init channel %d, please check!", ch);
+      goto finish;
+    }
+  }
+
+  // interleave the channels, a state shared by them breaks at least one
+  for (n = 0; n < FRAME_NUM; n++) {
+    for (ch = 0; ch < CHANNEL_NUM; ch++) {
+      if (send_frame(&channel[ch], ch, n, MPP_FALSE)) goto finish;
+      drain(&channel[ch], ch);
+    }
+  }
+
+  for (ch = 0; ch < CHANNEL_NUM; ch++) {
+    if (send_frame(&channel[ch], ch, n, MPP_TRUE)) goto finish;
+  }
+
+  for (n = 0; n < WAIT_MS; n++) {
+    BOOL done = MPP_TRUE;
+    for (ch = 0; ch < CHANNEL_NUM; ch++) {
+      drain(&channel[ch], ch);
+      done = done && channel[ch].bEos;
+    }
+    if (done) break;
+    usleep(1000);
+  }
+
+  ret = 0;
+  for (ch = 0; ch < CHANNEL_NUM; ch++) {
+    printf("channel %d: %d streams, %s%s\n", ch, channel[ch].nStreamNum,
+           channel[ch].bEos ? "eos" : "no eos",
+           channel[ch].bError ? ", wrong stream" : "");
+    if (!channel[ch].bEos || channel[ch].bError ||
+        channel[ch].nStreamNum != FRAME_NUM)
+      ret = -1;
+  }
+
+finish:
+  // a channel without EOS has a work thread blocked in the core, do not
+  // destory it under the thread
+  for (ch = 0; ch < CHANNEL_NUM; ch++) {
+    if (channel[ch].pCtx && channel[ch].bEos)
+      al_enc_destory(channel[ch].pCtx);
+    if (channel[ch].pPacket) PACKET_Destory(channel[ch].pPacket);
+  }
+
+  printf("sfomxil multi channel test %s\n", ret ? "FAIL" : "PASS");
+  return ret;
+}
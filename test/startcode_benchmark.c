@@ -0,0 +1,109 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-23 10:36:18
+ * @LastEditTime: 2024-05-23 10:36:18
+ * @Description: bytes per second of the start code search, the plain C
+ *               version against the one selected for this cpu.
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "startcode.h"
+#include "type.h"
+
+typedef const U8 *(*FindFunc)(const U8 *data, const U8 *end);
+
+static S64 get_time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (S64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static S64 count_start_codes(FindFunc find, const U8 *data, S64 size) {
+  const U8 *end = data + size;
+  const U8 *p = data;
+  S64 num = 0;
+
+  while ((p = find(p, end)) < end) {
+    num++;
+    p += 3;
+  }
+
+  return num;
+}
+
+static void run_bench(const char *name, FindFunc find, const U8 *data,
+                      S64 size, S32 loops, S64 *num) {
+  S64 start, cost;
+  S32 i;
+
+  start = get_time_ns();
+  for (i = 0; i < loops; i++) *num = count_start_codes(find, data, size);
+  cost = get_time_ns() - start;
+
+  printf("  %-6s %8lld start codes  %9.1f MB/s\n", name, (long long)*num,
+         (double)size * loops * 1e9 / cost / (1024 * 1024));
+}
+
+S32 main(S32 argc, char **argv) {
+  S32 loops = 20;
+  S32 ret = 0;
+  S32 i;
+
+  if (argc < 2) {
+    printf("usage: %s [-n loops] stream_file...\n", argv[0]);
+    return -1;
+  }
+
+  for (i = 1; i < argc; i++) {
+    FILE *fp = NULL;
+    U8 *data = NULL;
+    S64 size, num_c = 0, num = 0;
+
+    if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      sscanf(argv[++i], "%d", &loops);
+      continue;
+    }
+
+    fp = fopen(argv[i], "rb");
+    if (!fp) {
+      error("can not open %s, please check!", argv[i]);
+      return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    data = (U8 *)malloc(size > 0 ? size : 1);
+    if (!data || fread(data, 1, size, fp) != (size_t)size) {
+      error("can not read %s, please check!", argv[i]);
+      fclose(fp);
+      free(data);
+      return -1;
+    }
+    fclose(fp);
+
+    printf("%s (%lld bytes)\n", argv[i], (long long)size);
+    run_bench("c", mpp_find_start_code_c, data, size, loops, &num_c);
+    run_bench(mpp_find_start_code_impl(), mpp_find_start_code, data, size,
+              loops, &num);
+    if (num != num_c) {
+      error("start codes mismatch: %lld vs %lld", (long long)num_c,
+            (long long)num);
+      ret = -1;
+    }
+
+    free(data);
+  }
+
+  return ret;
+}
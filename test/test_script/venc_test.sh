@@ -0,0 +1,56 @@
+#!/bin/bash
+
+###
+ # Copyright 2022-2023 SPACEMIT. All rights reserved.
+ # Use of this source code is governed by a BSD-style license
+ # that can be found in the LICENSE file.
+ #
+ # @Author: David(qiang.fu@spacemit.com)
+ # @Date: 2024-06-01 19:05:33
+ # @LastEditTime: 2024-06-01 19:05:33
+ # @Description: CODEC_FFMPEG encoder test on the yuv streams in
+ #               streams/yuv420p, every file is encoded 30 times in a row
+ #               (more frames than the encoder keeps ids of).
+###
+
+rm -rf test_result
+mkdir test_result
+
+CURRENT_PATH=`pwd`
+LOG_PATH=$CURRENT_PATH/test_result/venc.log
+CMD_PATH=$CURRENT_PATH/out/test/ffmpeg_venc_test
+STREAM_PATH=$CURRENT_PATH/test/test_script/streams/yuv420p
+RESULT_PATH=$CURRENT_PATH/test_result
+
+echo "============ venc test start ==============" >> $LOG_PATH
+
+test_num=0
+pass_num=0
+fail_num=0
+
+# name : width : height : format (2 I420, 4 NV12)
+for line in foreman_128x64_3frames.yuv:128:64:2 \
+            tractorHDcrop_x0y220_960x128_3f_2plane.yuv:960:128:4; do
+  name=$(echo ${line} | cut -d : -f 1)
+  width=$(echo ${line} | cut -d : -f 2)
+  height=$(echo ${line} | cut -d : -f 3)
+  format=$(echo ${line} | cut -d : -f 4)
+
+  test_num=$((test_num+1))
+  echo ">>>>> $name test start" >> $LOG_PATH
+
+  $CMD_PATH -i $STREAM_PATH/$name -o $RESULT_PATH/$name.264 \
+    -w $width -h $height -f $format -l 30 >> $LOG_PATH 2>&1
+
+  if [ $? -eq 0 ]; then
+    echo ">>>>> $name test pass" >> $LOG_PATH
+    pass_num=$((pass_num+1))
+  else
+    echo ">>>>> $name test fail" >> $LOG_PATH
+    fail_num=$((fail_num+1))
+  fi
+done
+
+echo "============ venc test finish ==============" >> $LOG_PATH
+
+echo "Total:$test_num    Pass:$pass_num    Fail:$fail_num" | tee -a $LOG_PATH
@@ -0,0 +1,134 @@
+#!/bin/bash
+
+###
+ # Copyright 2022-2023 SPACEMIT. All rights reserved.
+ # Use of this source code is governed by a BSD-style license
+ # that can be found in the LICENSE file.
+ #
+ # @Author: David(qiang.fu@spacemit.com)
+ # @Date: 2024-05-31 10:12:53
+ # @LastEditTime: 2024-06-02 11:44:03
+ # @Description: CODEC_V4L2 decoder and encoder test on vicodec (virtual
+ #               FWHT codec), the decoder stream is made by v4l2-ctl and has
+ #               a size change in the middle, the encoder streams are checked
+ #               by decoding them again, with MMAP and DMABUF buffers, and
+ #               with copied and lent streams. The decoder also has to skip
+ #               empty packets and end on the EOS flag only.
+###
+
+rm -rf test_result
+mkdir test_result
+
+CURRENT_PATH=`pwd`
+LOG_PATH=$CURRENT_PATH/test_result/vicodec.log
+CMD_PATH=$CURRENT_PATH/out/test/v4l2_vicodec_vdec_test
+ENC_CMD_PATH=$CURRENT_PATH/out/test/v4l2_vicodec_venc_test
+EOS_CMD_PATH=$CURRENT_PATH/out/test/v4l2_vicodec_vdec_eos_test
+RESULT_PATH=$CURRENT_PATH/test_result
+
+modprobe vicodec || exit 1
+sleep 1
+
+ENC_DEV=""
+for dev in /dev/video*; do
+  card=$(v4l2-ctl -d $dev --info 2>/dev/null | grep "Card type")
+  if echo "$card" | grep -q "vicodec-stateful-encoder"; then
+    ENC_DEV=$dev
+  fi
+done
+if [ -z "$ENC_DEV" ]; then
+  echo "no vicodec encoder found" | tee -a $LOG_PATH
+  exit 1
+fi
+
+# I420 frames of a moving gradient, $1x$2, $3 frames
+make_yuv() {
+  python3 - $1 $2 $3 <<EOF
+import sys
+w, h, n = int(sys.argv[1]), int(sys.argv[2]), int(sys.argv[3])
+out = sys.stdout.buffer
+for f in range(n):
+    out.write(bytes((x + y + 4 * f) & 0xff for y in range(h) for x in range(w)))
+    out.write(bytes([128]) * (w * h // 2))
+EOF
+}
+
+# $1 raw, $2 width, $3 height, $4 stream
+encode() {
+  v4l2-ctl -d $ENC_DEV \
+    --set-fmt-video-out=width=$2,height=$3,pixelformat=YU12 \
+    --stream-out-mmap --stream-mmap \
+    --stream-from=$1 --stream-to=$4 >> $LOG_PATH 2>&1
+}
+
+make_yuv 128 64 30 > $RESULT_PATH/a.yuv
+make_yuv 64 32 30 > $RESULT_PATH/b.yuv
+encode $RESULT_PATH/a.yuv 128 64 $RESULT_PATH/a.fwht || exit 1
+encode $RESULT_PATH/b.yuv 64 32 $RESULT_PATH/b.fwht || exit 1
+cat $RESULT_PATH/a.yuv $RESULT_PATH/b.yuv > $RESULT_PATH/ref.yuv
+cat $RESULT_PATH/a.fwht $RESULT_PATH/b.fwht > $RESULT_PATH/stream.fwht
+
+echo "============ vicodec test start ==============" >> $LOG_PATH
+
+test_num=0
+pass_num=0
+fail_num=0
+
+# buffer type (0 MMAP, 1 DMABUF) : zero copy input
+for mode in 0:0 1:0 1:1; do
+  buffertype=$(echo ${mode} | cut -d : -f 1)
+  zerocopy=$(echo ${mode} | cut -d : -f 2)
+
+  test_num=$((test_num+1))
+  echo ">>>>> buffertype $buffertype zerocopy $zerocopy test start" >> $LOG_PATH
+
+  $CMD_PATH -i $RESULT_PATH/stream.fwht -r $RESULT_PATH/ref.yuv \
+    -w 128 -h 64 -b $buffertype -z $zerocopy >> $LOG_PATH 2>&1
+
+  if [ $? -eq 0 ]; then
+    echo ">>>>> buffertype $buffertype zerocopy $zerocopy test pass" >> $LOG_PATH
+    pass_num=$((pass_num+1))
+  else
+    echo ">>>>> buffertype $buffertype zerocopy $zerocopy test fail" >> $LOG_PATH
+    fail_num=$((fail_num+1))
+  fi
+done
+
+# frame buffer type (0 malloc, copied; 1 dmabuf, imported) : stream output
+# (0 copied, 1 lent) of the encoder
+for mode in 0:0 1:0 1:1; do
+  buffertype=$(echo ${mode} | cut -d : -f 1)
+  zerocopy=$(echo ${mode} | cut -d : -f 2)
+
+  test_num=$((test_num+1))
+  echo ">>>>> encoder buffertype $buffertype zerocopy $zerocopy test start" >> $LOG_PATH
+
+  stream=$RESULT_PATH/enc-$buffertype-$zerocopy.fwht
+  $ENC_CMD_PATH -i $RESULT_PATH/a.yuv -o $stream -w 128 -h 64 \
+    -b $buffertype -z $zerocopy >> $LOG_PATH 2>&1 &&
+  $CMD_PATH -i $stream -r $RESULT_PATH/a.yuv -w 128 -h 64 >> $LOG_PATH 2>&1
+
+  if [ $? -eq 0 ]; then
+    echo ">>>>> encoder buffertype $buffertype zerocopy $zerocopy test pass" >> $LOG_PATH
+    pass_num=$((pass_num+1))
+  else
+    echo ">>>>> encoder buffertype $buffertype zerocopy $zerocopy test fail" >> $LOG_PATH
+    fail_num=$((fail_num+1))
+  fi
+done
+
+# empty packets between the frames, the EOS flag on an empty packet
+test_num=$((test_num+1))
+echo ">>>>> empty packets and eos test start" >> $LOG_PATH
+$EOS_CMD_PATH -w 128 -h 64 -n 30 >> $LOG_PATH 2>&1
+if [ $? -eq 0 ]; then
+  echo ">>>>> empty packets and eos test pass" >> $LOG_PATH
+  pass_num=$((pass_num+1))
+else
+  echo ">>>>> empty packets and eos test fail" >> $LOG_PATH
+  fail_num=$((fail_num+1))
+fi
+
+echo "============ vicodec test finish ==============" >> $LOG_PATH
+
+echo "Total:$test_num    Pass:$pass_num    Fail:$fail_num" | tee -a $LOG_PATH
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-20 15:03:44
+ * @LastEditTime: 2024-06-02 10:05:33
+ * @Description: measure the latency of the sys flow (fake vdec -> fake venc),
+ *               one packet is in flight at a time. The fake decoder does a
+ *               frame MPP_FAKEDEC_DELAY_US (default 1000) after its packet,
+ *               from a thread of its own that only makes its poll fd
+ *               readable, as a V4L2 device does. Fails if the average is not
+ *               well under delay + the poll interval of the sys flow, that
+ *               is a flow which does not wake up on nOutputPollFd.
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "argument.h"
+#include "env.h"
+#include "sys.h"
+#include "type.h"
+
+/***
+ * the sys flow polls every 10 ms (SYS_WAIT_TIMEOUT_MS) when nobody signals,
+ * a woken flow has to be far below delay + that on average.
+ */
+#define SYS_LATENCY_AVG_BOUND_US (2000)
+#define SYS_LATENCY_DEFAULT_DELAY_US (1000)
+
+typedef struct _TestSysLatencyContext {
+  S32 nFrameNum;
+  S32 nWidth;
+  S32 nHeight;
+} TestSysLatencyContext;
+
+static const MppArgument ArgumentMapping[] = {
+    {"-h", "--help", HELP, "Print this help"},
+    {"-n", "--frame_num", DECODE_FRAME_NUM, "Send n packets and stop"},
+    {"-w", "--width", WIDTH, "Frame width of the fake decoder"},
+    {"-H", "--height", HEIGHT, "Frame height of the fake decoder"},
+};
+
+static void ParseArgument(TestSysLatencyContext *context, char *argument,
+                          char *value, int num) {
+  ARGUMENT arg = get_argument(ArgumentMapping, argument, num);
+  switch (arg) {
+    case HELP:
+      print_demo_usage(ArgumentMapping, num);
+      exit(-1);
+    case DECODE_FRAME_NUM:
+      sscanf(value, "%d", &context->nFrameNum);
+      break;
+    case WIDTH:
+      sscanf(value, "%d", &context->nWidth);
+      break;
+    case HEIGHT:
+      sscanf(value, "%d", &context->nHeight);
+      break;
+    case INVALID:
+    default:
+      error("Unknowed argument :  %s", argument);
+      break;
+  }
+}
+
+static S64 get_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (S64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int main(int argc, char **argv) {
+  TestSysLatencyContext context;
+  MppVdecPara vdec_para;
+  MppVencPara venc_para;
+  MppPacket *sink_packet = NULL;
+  MppPacket *src_packet = NULL;
+  S64 start = 0, cost = 0, total = 0, max = 0;
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  U8 *plugin_path = NULL;
+  U32 delay = 0;
+  S32 i = 0;
+
+  context.nFrameNum = 100;
+  context.nWidth = 1280;
+  context.nHeight = 720;
+  for (i = 1; i + 1 < argc; i += 2) {
+    ParseArgument(&context, argv[i], argv[i + 1], argument_num);
+  }
+
+  // the plugins of this build, not an older installed one
+  mpp_env_get_str("MPP_PLUGIN_PATH", &plugin_path, NULL);
+  if (!plugin_path)
+    mpp_env_set_str("MPP_PLUGIN_PATH", (U8 *)MPP_TEST_PLUGIN_PATH);
+
+  // the frames are done asynchronously, as on a device
+  mpp_env_get_u32("MPP_FAKEDEC_DELAY_US", &delay,
+                  SYS_LATENCY_DEFAULT_DELAY_US);
+  mpp_env_set_u32("MPP_FAKEDEC_DELAY_US", delay);
+
+  memset(&vdec_para, 0, sizeof(MppVdecPara));
+  vdec_para.eCodingType = CODING_H264;
+  vdec_para.eOutputPixelFormat = PIXEL_FORMAT_I420;
+  vdec_para.nWidth = context.nWidth;
+  vdec_para.nHeight = context.nHeight;
+  vdec_para.nStride = context.nWidth;
+
+  memset(&venc_para, 0, sizeof(MppVencPara));
+  venc_para.eCodingType = CODING_H264;
+  venc_para.PixelFormat = PIXEL_FORMAT_I420;
+  venc_para.nWidth = context.nWidth;
+  venc_para.nHeight = context.nHeight;
+  venc_para.nStride = context.nWidth;
+
+  MppProcessFlowCtx *ctx = SYS_CreateFlow();
+  if (!ctx) return -1;
+  SYS_Init(ctx);
+
+  MppProcessNode *vdec_node =
+      SYS_CreateNodeByModule(VDEC, CODEC_FAKEDEC, &vdec_para);
+  MppProcessNode *venc_node =
+      SYS_CreateNodeByModule(VENC, CODEC_FAKEDEC, &venc_para);
+  if (!vdec_node || !venc_node) {
+    error("can not create fake nodes, please check!");
+    return -1;
+  }
+
+  if (SYS_Bind(ctx, vdec_node, venc_node)) {
+    error("can not bind vdec and venc, please check!");
+    return -1;
+  }
+
+  sink_packet = PACKET_Create();
+  PACKET_Alloc(sink_packet, 1024);
+  PACKET_SetLength(sink_packet, 1024);
+  src_packet = PACKET_Create();
+
+  for (i = 0; i < context.nFrameNum; i++) {
+    start = get_time_us();
+    SYS_Handledata(ctx, PACKET_GetBaseData(sink_packet));
+    SYS_Getresult(ctx, PACKET_GetBaseData(src_packet));
+    cost = get_time_us() - start;
+
+    total += cost;
+    if (cost > max) max = cost;
+  }
+
+  if (context.nFrameNum > 0) total /= context.nFrameNum;
+  printf("sys flow latency: %d packets, delay %u us, avg %lld us, "
+         "max %lld us\n",
+         context.nFrameNum, delay, (long long)total, (long long)max);
+
+  SYS_Unbind(ctx);
+  SYS_Destory(ctx);
+
+  PACKET_Free(sink_packet);
+  PACKET_Destory(sink_packet);
+  PACKET_Destory(src_packet);
+
+  if (total > delay + SYS_LATENCY_AVG_BOUND_US) {
+    error("avg latency %lld us is over %u us, please check!",
+          (long long)total, delay + SYS_LATENCY_AVG_BOUND_US);
+    return -1;
+  }
+
+  return 0;
+}
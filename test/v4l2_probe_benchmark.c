@@ -0,0 +1,139 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-06-01 16:45:20
+ * @LastEditTime: 2024-06-01 16:45:20
+ * @Description: latency of find_v4l2_decoder/find_v4l2_encoder, probing all
+ *               /dev/video* nodes at each call (as before the device table)
+ *               against the cached device table. Needs a V4L2 codec, such as
+ *               vicodec (the default fourcc is FWHT).
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "argument.h"
+#include "type.h"
+#include "v4l2_utils.h"
+
+#define MODULE_TAG "v4l2_probe_benchmark"
+
+static const MppArgument ArgumentMapping[] = {
+    {"-h", "--help", HELP, "Print this help"},
+    {"-n", "--count", DECODE_FRAME_NUM, "Number of lookups, default 1000"},
+    {"-f", "--fourcc", FORMAT,
+     "Fourcc of the stream to find a codec for, default FWHT"},
+};
+
+static S64 get_time_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (S64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void print_fourcc(U32 fourcc) {
+  printf("%c%c%c%c", fourcc & 0xff, (fourcc >> 8) & 0xff,
+         (fourcc >> 16) & 0xff, (fourcc >> 24) & 0xff);
+}
+
+static void print_devices() {
+  V4l2DeviceInfo info;
+  S32 num = mpp_v4l2_get_device_num();
+  S32 i, j;
+
+  printf("%d V4L2 devices\n", num);
+  for (i = 0; i < num; i++) {
+    if (mpp_v4l2_get_device_info(i, &info)) continue;
+
+    printf("%s: %s (%s), caps %08x\n  output: ", info.sDevicePath,
+           info.sDriver, info.sCard, info.nDeviceCaps);
+    for (j = 0; j < info.nOutputFormatNum; j++) {
+      print_fourcc(info.stOutputFormat[j].nFourcc);
+      printf(" ");
+    }
+    printf("\n  capture: ");
+    for (j = 0; j < info.nCaptureFormatNum; j++) {
+      print_fourcc(info.stCaptureFormat[j].nFourcc);
+      printf(" ");
+    }
+    printf("\n");
+  }
+}
+
+/**
+ * @description: average cost of one lookup, -1 if nothing is found
+ */
+static double run_bench(S32 (*find)(U8 *, S32), U32 fourcc, S32 count,
+                        BOOL cold) {
+  U8 device_path[32];
+  S64 start, cost = 0;
+  S32 i, fd;
+
+  for (i = 0; i < count; i++) {
+    if (cold) mpp_v4l2_invalidate_devices();
+
+    start = get_time_us();
+    fd = find(device_path, fourcc);
+    cost += get_time_us() - start;
+
+    if (fd < 0) return -1;
+    close(fd);
+  }
+
+  return (double)cost / count;
+}
+
+static void print_bench(const char *name, S32 (*find)(U8 *, S32), U32 fourcc,
+                        S32 count) {
+  double cold = run_bench(find, fourcc, count, MPP_TRUE);
+  double cached = run_bench(find, fourcc, count, MPP_FALSE);
+
+  if (cold < 0 || cached < 0) {
+    printf("%-8s no device\n", name);
+    return;
+  }
+
+  printf("%-8s probe all: %10.3f us  cached: %10.3f us\n", name, cold, cached);
+}
+
+int main(int argc, char **argv) {
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  const char *name = "FWHT";
+  S32 count = 1000;
+  U32 fourcc;
+  S32 i;
+
+  for (i = 1; i < argc; i += 2) {
+    ARGUMENT arg = get_argument(ArgumentMapping, argv[i], argument_num);
+    if (arg == HELP || arg == INVALID || i + 1 >= argc) {
+      print_demo_usage(ArgumentMapping, argument_num);
+      return -1;
+    }
+    if (arg == DECODE_FRAME_NUM) sscanf(argv[i + 1], "%d", &count);
+    if (arg == FORMAT) name = argv[i + 1];
+  }
+
+  if (count <= 0 || 4 != strlen(name)) {
+    error("invalid arguments, please check!");
+    return -1;
+  }
+
+  fourcc = v4l2_fourcc(name[0], name[1], name[2], name[3]);
+  print_devices();
+
+  printf("%d lookups of ", count);
+  print_fourcc(fourcc);
+  printf("\n");
+  print_bench("decoder", find_v4l2_decoder, fourcc, count);
+  print_bench("encoder", find_v4l2_encoder, fourcc, count);
+
+  return 0;
+}
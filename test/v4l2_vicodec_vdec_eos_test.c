@@ -0,0 +1,407 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-06-02 11:44:03
+ * @LastEditTime: 2024-06-02 11:44:03
+ * @Description: the CODEC_V4L2 decoder ends the stream on the EOS flag of
+ *               the packets and nowhere else: a FWHT stream of generated
+ *               frames (made by the vicodec encoder) is decoded with an
+ *               empty packet before every frame, the decoder must not end
+ *               before the EOS packet (itself empty) comes, and must give
+ *               exactly one frame per encoded frame. Skipped without a
+ *               vicodec encoder and decoder.
+ */
+
+#define ENABLE_DEBUG 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "argument.h"
+#include "const.h"
+#include "type.h"
+#include "v4l2_utils.h"
+#include "vdec.h"
+#include "venc.h"
+
+#define MODULE_TAG "v4l2_vicodec_vdec_eos_test"
+
+#define FRAME_POOL_NUM (4)
+#define MAX_STREAM_NUM (256)
+
+typedef struct _TestContext {
+  S32 nWidth;
+  S32 nHeight;
+  S32 nFrames;
+
+  MppVencCtx *pVencCtx;
+  MppFrame *pFrame[FRAME_POOL_NUM];
+  BOOL bFrameFree[FRAME_POOL_NUM];
+  U8 *pStream[MAX_STREAM_NUM];
+  S32 nStreamLength[MAX_STREAM_NUM];
+  S32 nStreamNum;
+
+  MppVdecCtx *pVdecCtx;
+  MppFrame *pOutputFrame;
+  S32 nFrameNum;
+  BOOL bEos;
+} TestContext;
+
+static const MppArgument ArgumentMapping[] = {
+    {"-H", "--help", HELP, "Print help"},
+    {"-w", "--width", WIDTH, "Video width, default 128"},
+    {"-h", "--height", HEIGHT, "Video height, default 64"},
+    {"-n", "--frames", DECODE_FRAME_NUM, "Frames of the stream, default 30"},
+};
+
+static S32 parse_argument(TestContext *context, char *argument, char *value,
+                          S32 num) {
+  ARGUMENT arg = get_argument(ArgumentMapping, argument, num);
+
+  if (!value && arg != HELP) {
+    error("argument need a value, please check!");
+    return -1;
+  }
+
+  switch (arg) {
+    case HELP:
+      print_demo_usage(ArgumentMapping, num);
+      return -1;
+    case WIDTH:
+      sscanf(value, "%d", &(context->nWidth));
+      break;
+    case HEIGHT:
+      sscanf(value, "%d", &(context->nHeight));
+      break;
+    case DECODE_FRAME_NUM:
+      sscanf(value, "%d", &(context->nFrames));
+      break;
+    case INVALID:
+    default:
+      error("Unknowed argument : %s, please check!", argument);
+      return -1;
+  }
+
+  return 0;
+}
+
+static S32 VencPrepare(TestContext *context) {
+  MppVencPara *para = NULL;
+
+  context->pVencCtx = VENC_CreateChannel();
+  if (!context->pVencCtx) {
+    error("Can not create MppVencCtx, please check!");
+    return -1;
+  }
+
+  para = &(context->pVencCtx->stVencPara);
+  context->pVencCtx->eCodecType = CODEC_V4L2;
+  para->eCodingType = CODING_FWHT;
+  para->PixelFormat = PIXEL_FORMAT_I420;
+  para->nWidth = context->nWidth;
+  para->nHeight = context->nHeight;
+  para->nStride = context->nWidth;
+  para->eFrameBufferType = MPP_FRAME_BUFFERTYPE_NORMAL_INTERNAL;
+
+  for (S32 i = 0; i < FRAME_POOL_NUM; i++) {
+    MppFrame *frame = FRAME_Create();
+    if (!frame) return -1;
+    context->pFrame[i] = frame;
+
+    FRAME_SetBufferType(frame, MPP_FRAME_BUFFERTYPE_NORMAL_INTERNAL);
+    if (FRAME_Alloc(frame, PIXEL_FORMAT_I420, context->nWidth,
+                    context->nHeight))
+      return -1;
+    FRAME_SetID(frame, i);
+    context->bFrameFree[i] = MPP_TRUE;
+  }
+
+  return VENC_Init(context->pVencCtx);
+}
+
+static S32 VdecPrepare(TestContext *context) {
+  MppVdecPara *para = NULL;
+
+  context->pVdecCtx = VDEC_CreateChannel();
+  if (!context->pVdecCtx) {
+    error("Can not create MppVdecCtx, please check!");
+    return -1;
+  }
+
+  para = &(context->pVdecCtx->stVdecPara);
+  context->pVdecCtx->eCodecType = CODEC_V4L2;
+  para->eCodingType = CODING_FWHT;
+  para->nWidth = context->nWidth;
+  para->nHeight = context->nHeight;
+  para->nScale = 1;
+  para->eOutputPixelFormat = PIXEL_FORMAT_I420;
+  para->eFrameBufferType = MPP_FRAME_BUFFERTYPE_NORMAL_INTERNAL;
+
+  return VDEC_Init(context->pVdecCtx);
+}
+
+/**
+ * @description: a gradient moving with the frame number, as vicodec_test.sh
+ * makes them.
+ */
+static void fill_frame(TestContext *context, MppFrame *frame, S32 num) {
+  S32 size = context->nWidth * context->nHeight;
+  U8 *luma = (U8 *)FRAME_GetDataPointer(frame, 0);
+  S32 x, y;
+
+  for (y = 0; y < context->nHeight; y++) {
+    for (x = 0; x < context->nWidth; x++)
+      luma[y * context->nWidth + x] = (U8)(x + y + num * 4);
+  }
+  memset(FRAME_GetDataPointer(frame, 1), 128, size / 4);
+  memset(FRAME_GetDataPointer(frame, 2), 128, size / 4);
+}
+
+/**
+ * @description: keep the ready streams of the encoder, one per frame, and
+ * take back the frames it is done with.
+ */
+static S32 drain_encoder(TestContext *context, MppPacket *packet,
+                         BOOL *eos) {
+  S32 length, id, ret;
+
+  while (!*eos) {
+    ret = VENC_GetOutputStreamBuffer(context->pVencCtx,
+                                     PACKET_GetBaseData(packet));
+    if (ret == MPP_CODER_NO_DATA) break;
+    if (ret != MPP_OK && ret != MPP_CODER_EOS) return ret;
+
+    length = PACKET_GetLength(packet);
+    if (length) {
+      if (context->nStreamNum == MAX_STREAM_NUM) return -1;
+      context->pStream[context->nStreamNum] = (U8 *)malloc(length);
+      if (!context->pStream[context->nStreamNum]) return -1;
+      memcpy(context->pStream[context->nStreamNum],
+             PACKET_GetDataPointer(packet), length);
+      context->nStreamLength[context->nStreamNum++] = length;
+    }
+    if (ret == MPP_CODER_EOS) *eos = MPP_TRUE;
+  }
+
+  while ((id = VENC_ReturnInputFrame(context->pVencCtx, NULL)) >= 0) {
+    if (id < FRAME_POOL_NUM) context->bFrameFree[id] = MPP_TRUE;
+  }
+
+  return MPP_OK;
+}
+
+static S32 encode_stream(TestContext *context) {
+  MppPacket *packet = PACKET_Create();
+  MppFrame *frame = NULL;
+  BOOL eos = MPP_FALSE;
+  S32 ret = -1;
+  S32 err, i, n;
+
+  if (!packet) return -1;
+  PACKET_Alloc(packet, MPP_PACKET_MALLOC_SIZE);
+
+  for (i = 0; i < context->nFrames; i++) {
+    for (frame = NULL, n = 0; !frame && n < 5000; n++) {
+      for (S32 j = 0; j < FRAME_POOL_NUM && !frame; j++) {
+        if (context->bFrameFree[j]) frame = context->pFrame[j];
+      }
+      if (!frame) {
+        if (drain_encoder(context, packet, &eos)) goto finish;
+        usleep(1000);
+      }
+    }
+    if (!frame) goto finish;
+
+    fill_frame(context, frame, i);
+    FRAME_SetEos(frame, FRAME_NO_EOS);
+    FRAME_SetPts(frame, i);
+    context->bFrameFree[FRAME_GetID(frame)] = MPP_FALSE;
+    while ((err = VENC_SendInputFrame(context->pVencCtx,
+                                      FRAME_GetBaseData(frame)))) {
+      if (err != MPP_POLL_FAILED || drain_encoder(context, packet, &eos))
+        goto finish;
+      usleep(1000);
+    }
+    if (drain_encoder(context, packet, &eos)) goto finish;
+  }
+
+  FRAME_SetEos(frame, FRAME_EOS_WITHOUT_DATA);
+  VENC_SendInputFrame(context->pVencCtx, FRAME_GetBaseData(frame));
+  for (n = 0; n < 5000 && !eos; n++) {
+    if (drain_encoder(context, packet, &eos)) goto finish;
+    usleep(1000);
+  }
+  ret = eos ? 0 : -1;
+
+finish:
+  PACKET_Free(packet);
+  PACKET_Destory(packet);
+
+  return ret;
+}
+
+/**
+ * @description: count the ready frames of the decoder
+ * @return {*}: MPP_OK or the error code of the decoder
+ */
+static S32 drain_decoder(TestContext *context) {
+  S32 ret = 0;
+
+  while (!context->bEos) {
+    ret = VDEC_RequestOutputFrame(context->pVdecCtx,
+                                  FRAME_GetBaseData(context->pOutputFrame));
+    if (ret == MPP_OK) {
+      context->nFrameNum++;
+      VDEC_ReturnOutputFrame(context->pVdecCtx,
+                             FRAME_GetBaseData(context->pOutputFrame));
+    } else if (ret == MPP_CODER_EOS) {
+      context->bEos = MPP_TRUE;
+    } else if (ret == MPP_RESOLUTION_CHANGED) {
+      debug("the frame queue is set up, the frames follow");
+    } else if (ret == MPP_CODER_NO_DATA || ret == MPP_ERROR_FRAME) {
+      return MPP_OK;
+    } else {
+      return ret;
+    }
+  }
+
+  return MPP_OK;
+}
+
+static S32 send_packet(TestContext *context, MppPacket *packet, U8 *data,
+                       S32 length, BOOL eos) {
+  S32 ret;
+
+  if (length) memcpy(PACKET_GetDataPointer(packet), data, length);
+  PACKET_SetLength(packet, length);
+  PACKET_SetEos(packet, eos);
+
+  // input queue is full, take frames out and retry
+  while ((ret = VDEC_Decode(context->pVdecCtx, PACKET_GetBaseData(packet)))) {
+    if (ret != MPP_POLL_FAILED || drain_decoder(context)) return -1;
+    usleep(1000);
+  }
+
+  return drain_decoder(context);
+}
+
+static S32 decode_stream(TestContext *context) {
+  MppPacket *packet = PACKET_Create();
+  S32 max_length = 0;
+  S32 ret = -1;
+  S32 i;
+
+  if (!packet) return -1;
+  for (i = 0; i < context->nStreamNum; i++) {
+    if (context->nStreamLength[i] > max_length)
+      max_length = context->nStreamLength[i];
+  }
+  PACKET_Alloc(packet, max_length);
+
+  for (i = 0; i < context->nStreamNum; i++) {
+    // an empty packet in the middle of the stream is skipped
+    if (send_packet(context, packet, NULL, 0, MPP_FALSE)) goto finish;
+    if (send_packet(context, packet, context->pStream[i],
+                    context->nStreamLength[i], MPP_FALSE))
+      goto finish;
+  }
+
+  // every frame had the time to come out, the stream is not over yet
+  for (i = 0; i < 200 && !context->bEos; i++) {
+    if (drain_decoder(context)) goto finish;
+    usleep(1000);
+  }
+  if (context->bEos) {
+    error("EOS after %d frames, before the EOS flag, please check!",
+          context->nFrameNum);
+    goto finish;
+  }
+
+  if (send_packet(context, packet, NULL, 0, MPP_TRUE)) goto finish;
+  for (i = 0; i < 5000 && !context->bEos; i++) {
+    if (drain_decoder(context)) goto finish;
+    usleep(1000);
+  }
+  ret = 0;
+
+finish:
+  PACKET_Free(packet);
+  PACKET_Destory(packet);
+
+  return ret;
+}
+
+S32 main(S32 argc, char **argv) {
+  TestContext *context = NULL;
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  S32 ret = -1;
+  S32 i;
+
+  context = (TestContext *)malloc(sizeof(TestContext));
+  if (!context) {
+    error("can not create TestContext, please check!");
+    return -1;
+  }
+  memset(context, 0, sizeof(TestContext));
+  context->nWidth = 128;
+  context->nHeight = 64;
+  context->nFrames = 30;
+
+  for (i = 1; i < argc; i += 2) {
+    if (parse_argument(context, argv[i], i + 1 < argc ? argv[i + 1] : NULL,
+                       argument_num))
+      goto finish;
+  }
+  if (context->nFrames <= 0 || context->nFrames > MAX_STREAM_NUM) {
+    print_demo_usage(ArgumentMapping, argument_num);
+    goto finish;
+  }
+
+  if (!has_v4l2_encoder(NULL, V4L2_PIX_FMT_FWHT) ||
+      !has_v4l2_decoder(NULL, V4L2_PIX_FMT_FWHT)) {
+    printf("no vicodec encoder and decoder, skipped\n");
+    ret = 0;
+    goto finish;
+  }
+
+  if (VencPrepare(context) || encode_stream(context)) {
+    error("can not make the FWHT stream, please check!");
+    goto finish;
+  }
+  if (context->nStreamNum != context->nFrames) {
+    error("%d streams of %d frames, please check!", context->nStreamNum,
+          context->nFrames);
+    goto finish;
+  }
+
+  context->pOutputFrame = FRAME_Create();
+  if (!context->pOutputFrame || VdecPrepare(context)) goto finish;
+  if (decode_stream(context)) goto finish;
+
+  printf("%d streams with empty packets, %d frames, %s\n",
+         context->nStreamNum, context->nFrameNum,
+         context->bEos ? "eos" : "no eos");
+  ret = (context->bEos && context->nFrameNum == context->nStreamNum) ? 0 : -1;
+  printf("vicodec eos decode %s\n", ret ? "FAIL" : "PASS");
+
+finish:
+  if (context->pOutputFrame) FRAME_Destory(context->pOutputFrame);
+  if (context->pVdecCtx) VDEC_DestoryChannel(context->pVdecCtx);
+  if (context->pVencCtx) VENC_DestoryChannel(context->pVencCtx);
+
+  for (i = 0; i < FRAME_POOL_NUM; i++) {
+    if (context->pFrame[i]) {
+      FRAME_Free(context->pFrame[i]);
+      FRAME_Destory(context->pFrame[i]);
+    }
+  }
+  for (i = 0; i < context->nStreamNum; i++) free(context->pStream[i]);
+  free(context);
+
+  return ret;
+}
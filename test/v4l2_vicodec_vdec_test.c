@@ -0,0 +1,362 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-31 10:12:53
+ * @LastEditTime: 2024-05-31 10:12:53
+ * @Description: decode a FWHT stream by CODEC_V4L2 on vicodec, the stream is
+ *               sent in small chunks as vicodec finds the frames itself, and
+ *               the luma of every frame is compared (PSNR) to the I420 file
+ *               the stream was encoded from, the size can change in the
+ *               stream, the reference has the frames of every size.
+ */
+
+#define ENABLE_DEBUG 1
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "argument.h"
+#include "const.h"
+#include "type.h"
+#include "vdec.h"
+
+/***
+ * vicodec finds the frame headers in the byte stream, any chunk size works,
+ * small ones are smaller than the stream buffer of every frame size.
+ */
+#define STREAM_CHUNK_SIZE (4096)
+
+typedef struct _TestContext {
+  U8 pInputFileName[DEMO_FILE_NAME_LEN];
+  U8 pReferenceFileName[DEMO_FILE_NAME_LEN];
+  FILE *pInputFile;
+  FILE *pReferenceFile;
+  MppCodingType eCodingType;
+  S32 ePixelFormat;
+  S32 nWidth;
+  S32 nHeight;
+  S32 nInputBufferNum;
+  S32 nOutputBufferNum;
+  S32 eFrameBufferType;
+  BOOL bZeroCopy;
+  double fThreshold;
+  MppVdecCtx *pVdecCtx;
+  MppPacket *pPacket;
+  MppFrame *pFrame;
+  U8 *pReference;
+  S32 nReferenceSize;
+  S32 nFrameNum;
+  S32 nBadFrameNum;
+  S32 nResolutionChangeNum;
+  double fMinPsnr;
+  BOOL bEos;
+} TestContext;
+
+static const MppArgument ArgumentMapping[] = {
+    {"-H", "--help", HELP, "Print help"},
+    {"-i", "--input", INPUT, "Input FWHT stream path"},
+    {"-r", "--reference", REFERENCE_FILE,
+     "I420 file the stream was encoded from, no PSNR check if not set"},
+    {"-c", "--codingtype", CODING_TYPE, "Coding type, FWHT by default"},
+    {"-w", "--width", WIDTH, "Video width (hint)"},
+    {"-h", "--height", HEIGHT, "Video height (hint)"},
+    {"-f", "--format", FORMAT, "Output PixelFormat"},
+    {"-n", "--buffernum", BUFFER_NUM, "Buffer num: input,output"},
+    {"-b", "--buffertype", BUFFER_TYPE,
+     "Frame buffer type: 0 internal(MMAP), 1 dmabuf internal"},
+    {"-z", "--zerocopy", ZERO_COPY,
+     "Write the stream into the buffers of the decoder: 0 or 1"},
+    {"-p", "--psnr", PSNR_THRESHOLD, "Min luma PSNR in dB, 25 by default"},
+};
+
+static S32 parse_argument(TestContext *context, char *argument, char *value,
+                          S32 num) {
+  ARGUMENT arg = get_argument(ArgumentMapping, argument, num);
+  S32 zero_copy = 0;
+
+  if (!value && arg != HELP) {
+    error("argument need a value, please check!");
+    return -1;
+  }
+
+  switch (arg) {
+    case HELP:
+      print_demo_usage(ArgumentMapping, num);
+      print_para_enum();
+      return -1;
+    case INPUT:
+      sscanf(value, "%2047s", context->pInputFileName);
+      break;
+    case REFERENCE_FILE:
+      sscanf(value, "%2047s", context->pReferenceFileName);
+      break;
+    case CODING_TYPE:
+      sscanf(value, "%d", (S32 *)&(context->eCodingType));
+      break;
+    case WIDTH:
+      sscanf(value, "%d", &(context->nWidth));
+      break;
+    case HEIGHT:
+      sscanf(value, "%d", &(context->nHeight));
+      break;
+    case FORMAT:
+      sscanf(value, "%d", &(context->ePixelFormat));
+      break;
+    case BUFFER_NUM:
+      sscanf(value, "%d,%d", &(context->nInputBufferNum),
+             &(context->nOutputBufferNum));
+      break;
+    case BUFFER_TYPE:
+      sscanf(value, "%d", &(context->eFrameBufferType));
+      break;
+    case ZERO_COPY:
+      sscanf(value, "%d", &zero_copy);
+      context->bZeroCopy = zero_copy ? MPP_TRUE : MPP_FALSE;
+      break;
+    case PSNR_THRESHOLD:
+      sscanf(value, "%lf", &(context->fThreshold));
+      break;
+    case INVALID:
+    default:
+      error("Unknowed argument : %s, please check!", argument);
+      return -1;
+  }
+
+  return 0;
+}
+
+static S32 VdecPrepare(TestContext *context) {
+  MppVdecPara *para = NULL;
+
+  context->pVdecCtx = VDEC_CreateChannel();
+  if (!context->pVdecCtx) {
+    error("Can not create MppVdecCtx, please check!");
+    return -1;
+  }
+
+  para = &(context->pVdecCtx->stVdecPara);
+  context->pVdecCtx->eCodecType = CODEC_V4L2;
+  para->eCodingType = context->eCodingType;
+  para->nWidth = context->nWidth;
+  para->nHeight = context->nHeight;
+  para->nScale = 1;
+  para->eOutputPixelFormat = context->ePixelFormat;
+  para->eFrameBufferType = context->eFrameBufferType;
+  para->nInputBufferNum = context->nInputBufferNum;
+  para->nOutputBufferNum = context->nOutputBufferNum;
+
+  return VDEC_Init(context->pVdecCtx);
+}
+
+/**
+ * @description: luma PSNR of the frame against the next frame of the
+ * reference file, the reference frame has the size of the decoded one.
+ * @return {*}: PSNR in dB, 100 if equal, -1 if the reference ends
+ */
+static double get_luma_psnr(TestContext *context, MppFrame *frame) {
+  S32 width = FRAME_GetWidth(frame);
+  S32 height = FRAME_GetHeight(frame);
+  S32 stride = FRAME_GetLineStride(frame);
+  S32 size = width * height * 3 / 2;
+  U8 *data = FRAME_GetDataPointer(frame, 0);
+  double sse = 0;
+  S32 i, j;
+
+  if (size > context->nReferenceSize) {
+    free(context->pReference);
+    context->pReference = (U8 *)malloc(size);
+    if (!context->pReference) return -1;
+    context->nReferenceSize = size;
+  }
+  if (fread(context->pReference, 1, size, context->pReferenceFile) !=
+      (size_t)size)
+    return -1;
+
+  if (stride < width) stride = width;
+  for (i = 0; i < height; i++) {
+    for (j = 0; j < width; j++) {
+      S32 diff = data[(S64)i * stride + j] - context->pReference[i * width + j];
+      sse += diff * diff;
+    }
+  }
+  if (sse == 0) return 100;
+
+  return 10 * log10(255.0 * 255.0 * width * height / sse);
+}
+
+static S32 check_frame(TestContext *context, MppFrame *frame) {
+  double psnr = 0;
+
+  context->nFrameNum++;
+  if (!context->pReferenceFile) return MPP_OK;
+
+  psnr = get_luma_psnr(context, frame);
+  debug("frame %d: %dx%d stride %d, psnr %.2f dB", context->nFrameNum,
+        FRAME_GetWidth(frame), FRAME_GetHeight(frame),
+        FRAME_GetLineStride(frame), psnr);
+  if (psnr < context->fMinPsnr) context->fMinPsnr = psnr;
+  if (psnr < context->fThreshold) {
+    error("frame %d: psnr %.2f dB < %.2f dB", context->nFrameNum, psnr,
+          context->fThreshold);
+    context->nBadFrameNum++;
+  }
+
+  return MPP_OK;
+}
+
+/**
+ * @description: get all ready frames
+ * @return {*}: MPP_OK or the error code of the decoder
+ */
+static S32 drain(TestContext *context) {
+  MppVdecPara *para = NULL;
+  S32 ret = 0;
+
+  while (!context->bEos) {
+    ret = VDEC_RequestOutputFrame(context->pVdecCtx,
+                                  FRAME_GetBaseData(context->pFrame));
+    if (ret == MPP_OK) {
+      check_frame(context, context->pFrame);
+      VDEC_ReturnOutputFrame(context->pVdecCtx,
+                             FRAME_GetBaseData(context->pFrame));
+    } else if (ret == MPP_CODER_EOS) {
+      context->bEos = MPP_TRUE;
+    } else if (ret == MPP_RESOLUTION_CHANGED) {
+      VDEC_GetParam(context->pVdecCtx, &para);
+      info("resolution changed to %dx%d, stride %d, %d frame buffers",
+           para->nWidth, para->nHeight, para->nStride, para->nOutputBufferNum);
+      context->nResolutionChangeNum++;
+    } else if (ret == MPP_CODER_NO_DATA || ret == MPP_ERROR_FRAME) {
+      return MPP_OK;
+    } else {
+      return ret;
+    }
+  }
+
+  return MPP_OK;
+}
+
+/**
+ * @description: the packet to write the next chunk into, a stream buffer of
+ * the decoder when zero copy.
+ */
+static S32 get_packet(TestContext *context) {
+  S32 ret = 0;
+
+  if (!context->bZeroCopy) return MPP_OK;
+
+  while ((ret = VDEC_RequestInputStream(
+              context->pVdecCtx, PACKET_GetBaseData(context->pPacket))) ==
+         MPP_CODER_NO_DATA) {
+    if (drain(context)) return -1;
+    usleep(1000);
+  }
+
+  return ret;
+}
+
+S32 main(S32 argc, char **argv) {
+  TestContext *context = NULL;
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  S64 pts = 0;
+  S32 length = 0;
+  S32 ret = -1;
+  S32 i;
+
+  context = (TestContext *)malloc(sizeof(TestContext));
+  if (!context) {
+    error("can not create TestContext, please check!");
+    return -1;
+  }
+  memset(context, 0, sizeof(TestContext));
+  context->eCodingType = CODING_FWHT;
+  context->ePixelFormat = PIXEL_FORMAT_I420;
+  context->eFrameBufferType = MPP_FRAME_BUFFERTYPE_DMABUF_INTERNAL;
+  context->fThreshold = 25;
+  context->fMinPsnr = 100;
+
+  if (argc < 2) {
+    print_demo_usage(ArgumentMapping, argument_num);
+    goto finish;
+  }
+
+  for (i = 1; i < argc; i += 2) {
+    if (parse_argument(context, argv[i], i + 1 < argc ? argv[i + 1] : NULL,
+                       argument_num))
+      goto finish;
+  }
+
+  context->pInputFile = fopen((char *)context->pInputFileName, "rb");
+  if (!context->pInputFile) {
+    error("can not open %s, please check!", context->pInputFileName);
+    goto finish;
+  }
+  if (context->pReferenceFileName[0]) {
+    context->pReferenceFile = fopen((char *)context->pReferenceFileName, "rb");
+    if (!context->pReferenceFile) {
+      error("can not open %s, please check!", context->pReferenceFileName);
+      goto finish;
+    }
+  }
+
+  if (VdecPrepare(context)) goto finish;
+
+  context->pPacket = PACKET_Create();
+  context->pFrame = FRAME_Create();
+  if (!context->pPacket || !context->pFrame) goto finish;
+  PACKET_Alloc(context->pPacket, STREAM_CHUNK_SIZE);
+
+  do {
+    if (get_packet(context)) goto finish;
+    length = fread(PACKET_GetDataPointer(context->pPacket), 1,
+                   STREAM_CHUNK_SIZE, context->pInputFile);
+    PACKET_SetLength(context->pPacket, length);
+    PACKET_SetPts(context->pPacket, pts++);
+    PACKET_SetEos(context->pPacket, length < STREAM_CHUNK_SIZE);
+
+    // input queue is full, take frames out and retry
+    while ((ret = VDEC_Decode(context->pVdecCtx,
+                              PACKET_GetBaseData(context->pPacket)))) {
+      if (ret != MPP_POLL_FAILED || drain(context)) goto finish;
+      usleep(1000);
+    }
+    if (drain(context)) goto finish;
+  } while (length == STREAM_CHUNK_SIZE);
+
+  for (i = 0; i < 5000 && !context->bEos; i++) {
+    if (drain(context)) goto finish;
+    usleep(1000);
+  }
+
+  printf("%d frames, %d resolution changes, %d below %.2f dB, min psnr "
+         "%.2f dB, %s\n",
+         context->nFrameNum, context->nResolutionChangeNum,
+         context->nBadFrameNum, context->fThreshold, context->fMinPsnr,
+         context->bEos ? "eos" : "no eos");
+  ret = (context->bEos && context->nFrameNum && !context->nBadFrameNum) ? 0
+                                                                         : -1;
+  printf("vicodec decode %s\n", ret ? "FAIL" : "PASS");
+
+finish:
+  if (context->pFrame) FRAME_Destory(context->pFrame);
+
+  if (context->pPacket) {
+    PACKET_Free(context->pPacket);
+    PACKET_Destory(context->pPacket);
+  }
+
+  if (context->pVdecCtx) VDEC_DestoryChannel(context->pVdecCtx);
+
+  if (context->pInputFile) fclose(context->pInputFile);
+  if (context->pReferenceFile) fclose(context->pReferenceFile);
+  free(context->pReference);
+  free(context);
+
+  return ret;
+}
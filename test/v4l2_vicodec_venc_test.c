@@ -0,0 +1,380 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-31 15:36:20
+ * @LastEditTime: 2024-06-02 11:36:12
+ * @Description: encode an I420/NV12 file by CODEC_V4L2 on vicodec, frames
+ *               come from a pool of dmabuf frames (or malloc ones), and the
+ *               bytes the encoder copies are counted, 0 when the frames are
+ *               imported. The stream can be checked by v4l2_vicodec_vdec_test.
+ *               With -z the streams are lent by the encoder instead of copied.
+ */
+
+#define ENABLE_DEBUG 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "argument.h"
+#include "const.h"
+#include "type.h"
+#include "venc.h"
+
+#define FRAME_POOL_NUM (8)
+
+typedef struct _TestContext {
+  U8 pInputFileName[DEMO_FILE_NAME_LEN];
+  U8 pOutputFileName[DEMO_FILE_NAME_LEN];
+  FILE *pInputFile;
+  FILE *pOutputFile;
+  MppCodingType eCodingType;
+  S32 ePixelFormat;
+  S32 nWidth;
+  S32 nHeight;
+  S32 nInputBufferNum;
+  S32 nOutputBufferNum;
+  S32 eFrameBufferType;
+  S32 nGop;
+  S32 nQp;
+  BOOL bZeroCopy;
+  MppVencCtx *pVencCtx;
+  MppPacket *pPacket;
+  MppFrame *pFrame[FRAME_POOL_NUM];
+  BOOL bFrameFree[FRAME_POOL_NUM];
+  S32 nFrameNum;
+  S32 nStreamNum;
+  S64 nStreamBytes;
+  BOOL bEos;
+} TestContext;
+
+static const MppArgument ArgumentMapping[] = {
+    {"-H", "--help", HELP, "Print help"},
+    {"-i", "--input", INPUT, "Input raw file path"},
+    {"-o", "--output", SAVE_FRAME_FILE, "Output stream file path"},
+    {"-c", "--codingtype", CODING_TYPE, "Coding type, FWHT by default"},
+    {"-w", "--width", WIDTH, "Video width"},
+    {"-h", "--height", HEIGHT, "Video height"},
+    {"-f", "--format", FORMAT, "Input PixelFormat, I420 or NV12"},
+    {"-n", "--buffernum", BUFFER_NUM, "Buffer num: input,output"},
+    {"-b", "--buffertype", BUFFER_TYPE,
+     "Frame buffer type: 0 malloc (copied), 1 dmabuf (imported)"},
+    {"-g", "--gop", GOP_SIZE, "GOP size"},
+    {"-q", "--qp", QP, "QP"},
+    {"-z", "--zerocopy", ZERO_COPY,
+     "Stream output: 0 copied (default), 1 lent by the encoder"},
+};
+
+static S32 parse_argument(TestContext *context, char *argument, char *value,
+                          S32 num) {
+  ARGUMENT arg = get_argument(ArgumentMapping, argument, num);
+
+  if (!value && arg != HELP) {
+    error("argument need a value, please check!");
+    return -1;
+  }
+
+  switch (arg) {
+    case HELP:
+      print_demo_usage(ArgumentMapping, num);
+      print_para_enum();
+      return -1;
+    case INPUT:
+      sscanf(value, "%2047s", context->pInputFileName);
+      break;
+    case SAVE_FRAME_FILE:
+      sscanf(value, "%2047s", context->pOutputFileName);
+      break;
+    case CODING_TYPE:
+      sscanf(value, "%d", (S32 *)&(context->eCodingType));
+      break;
+    case WIDTH:
+      sscanf(value, "%d", &(context->nWidth));
+      break;
+    case HEIGHT:
+      sscanf(value, "%d", &(context->nHeight));
+      break;
+    case FORMAT:
+      sscanf(value, "%d", &(context->ePixelFormat));
+      break;
+    case BUFFER_NUM:
+      sscanf(value, "%d,%d", &(context->nInputBufferNum),
+             &(context->nOutputBufferNum));
+      break;
+    case BUFFER_TYPE:
+      sscanf(value, "%d", &(context->eFrameBufferType));
+      break;
+    case GOP_SIZE:
+      sscanf(value, "%d", &(context->nGop));
+      break;
+    case QP:
+      sscanf(value, "%d", &(context->nQp));
+      break;
+    case ZERO_COPY:
+      context->bZeroCopy = atoi(value);
+      break;
+    case INVALID:
+    default:
+      error("Unknowed argument : %s, please check!", argument);
+      return -1;
+  }
+
+  return 0;
+}
+
+static S32 VencPrepare(TestContext *context) {
+  MppVencPara *para = NULL;
+
+  context->pVencCtx = VENC_CreateChannel();
+  if (!context->pVencCtx) {
+    error("Can not create MppVencCtx, please check!");
+    return -1;
+  }
+
+  para = &(context->pVencCtx->stVencPara);
+  context->pVencCtx->eCodecType = CODEC_V4L2;
+  para->eCodingType = context->eCodingType;
+  para->PixelFormat = context->ePixelFormat;
+  para->nWidth = context->nWidth;
+  para->nHeight = context->nHeight;
+  para->nStride = context->nWidth;
+  para->nGop = context->nGop;
+  para->nQp = context->nQp;
+  para->eRcMode = context->nQp ? MPP_RC_MODE_CQP : MPP_RC_MODE_VBR;
+  para->nInputBufferNum = context->nInputBufferNum;
+  para->nOutputBufferNum = context->nOutputBufferNum;
+  para->eFrameBufferType = context->eFrameBufferType;
+
+  return VENC_Init(context->pVencCtx);
+}
+
+static S32 FramePrepare(TestContext *context) {
+  for (S32 i = 0; i < FRAME_POOL_NUM; i++) {
+    MppFrame *frame = FRAME_Create();
+    if (!frame) return -1;
+    context->pFrame[i] = frame;
+
+    FRAME_SetBufferType(frame, context->eFrameBufferType);
+    if (FRAME_Alloc(frame, context->ePixelFormat, context->nWidth,
+                    context->nHeight)) {
+      error("can not alloc frame %d (buffer type %d), please check!", i,
+            context->eFrameBufferType);
+      return -1;
+    }
+    FRAME_SetWidth(frame, context->nWidth);
+    FRAME_SetHeight(frame, context->nHeight);
+    FRAME_SetLineStride(frame, context->nWidth);
+    FRAME_SetPixelFormat(frame, context->ePixelFormat);
+    FRAME_SetID(frame, i);
+    context->bFrameFree[i] = MPP_TRUE;
+  }
+
+  return 0;
+}
+
+/**
+ * @description: read the next frame, dmabuf frames have all components in
+ * one buffer, malloc ones one buffer per component.
+ */
+static BOOL read_frame(TestContext *context, MppFrame *frame) {
+  S32 size[3] = {context->nWidth * context->nHeight,
+                 context->nWidth * context->nHeight / 4,
+                 context->nWidth * context->nHeight / 4};
+  S32 num = 3;
+  U8 *data = NULL;
+
+  if (context->ePixelFormat == PIXEL_FORMAT_NV12 ||
+      context->ePixelFormat == PIXEL_FORMAT_NV21) {
+    size[1] = context->nWidth * context->nHeight / 2;
+    num = 2;
+  }
+
+  for (S32 i = 0; i < num; i++) {
+    if (FRAME_GetDataUsedNum(frame) > i)
+      data = FRAME_GetDataPointer(frame, i);
+    else
+      data += size[i - 1];
+    if (!data || fread(data, 1, size[i], context->pInputFile) != size[i])
+      return MPP_FALSE;
+  }
+
+  return MPP_TRUE;
+}
+
+/**
+ * @description: write the ready streams, and take back the frames the
+ * encoder is done with.
+ * @return {*}: MPP_OK or the error code of the encoder
+ */
+static S32 drain(TestContext *context) {
+  U8 *owned = (U8 *)PACKET_GetDataPointer(context->pPacket);
+  S32 ret = 0;
+  S32 id = 0;
+
+  while (!context->bEos) {
+    if (context->bZeroCopy) {
+      // a lent stream points into the encoder, the ID stays the caller's
+      PACKET_SetID(context->pPacket, context->nStreamNum);
+      ret = VENC_RequestOutputStreamBuffer(
+          context->pVencCtx, PACKET_GetBaseData(context->pPacket));
+    } else {
+      ret = VENC_GetOutputStreamBuffer(context->pVencCtx,
+                                       PACKET_GetBaseData(context->pPacket));
+    }
+    if (ret != MPP_OK && ret != MPP_CODER_EOS) break;
+    if (context->bZeroCopy &&
+        PACKET_GetID(context->pPacket) != context->nStreamNum) {
+      error("the encoder changed the ID of the packet, please check!");
+      return -1;
+    }
+
+    if (PACKET_GetLength(context->pPacket)) {
+      context->nStreamNum++;
+      context->nStreamBytes += PACKET_GetLength(context->pPacket);
+      if (context->pOutputFile)
+        fwrite(PACKET_GetDataPointer(context->pPacket), 1,
+               PACKET_GetLength(context->pPacket), context->pOutputFile);
+    }
+    if (context->bZeroCopy &&
+        PACKET_GetDataPointer(context->pPacket) != owned) {
+      S32 err = VENC_ReturnOutputStreamBuffer(
+          context->pVencCtx, PACKET_GetBaseData(context->pPacket));
+      if (err) return err;
+    }
+    if (ret == MPP_CODER_EOS) context->bEos = MPP_TRUE;
+  }
+  if (ret != MPP_OK && ret != MPP_CODER_EOS && ret != MPP_CODER_NO_DATA)
+    return ret;
+
+  while ((id = VENC_ReturnInputFrame(context->pVencCtx, NULL)) >= 0) {
+    if (id < FRAME_POOL_NUM) context->bFrameFree[id] = MPP_TRUE;
+  }
+
+  return MPP_OK;
+}
+
+static MppFrame *get_free_frame(TestContext *context) {
+  for (S32 n = 0; n < 5000; n++) {
+    for (S32 i = 0; i < FRAME_POOL_NUM; i++) {
+      if (context->bFrameFree[i]) return context->pFrame[i];
+    }
+    if (drain(context)) return NULL;
+    usleep(1000);
+  }
+
+  error("no frame comes back from the encoder, please check!");
+  return NULL;
+}
+
+S32 main(S32 argc, char **argv) {
+  TestContext *context = NULL;
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  MppFrame *frame = NULL;
+  S64 copied = 0;
+  S32 ret = -1;
+  S32 i;
+
+  context = (TestContext *)malloc(sizeof(TestContext));
+  if (!context) {
+    error("can not create TestContext, please check!");
+    return -1;
+  }
+  memset(context, 0, sizeof(TestContext));
+  context->eCodingType = CODING_FWHT;
+  context->ePixelFormat = PIXEL_FORMAT_I420;
+  context->eFrameBufferType = MPP_FRAME_BUFFERTYPE_DMABUF_INTERNAL;
+
+  if (argc < 2) {
+    print_demo_usage(ArgumentMapping, argument_num);
+    goto finish;
+  }
+
+  for (i = 1; i < argc; i += 2) {
+    if (parse_argument(context, argv[i], i + 1 < argc ? argv[i + 1] : NULL,
+                       argument_num))
+      goto finish;
+  }
+
+  context->pInputFile = fopen((char *)context->pInputFileName, "rb");
+  if (!context->pInputFile) {
+    error("can not open %s, please check!", context->pInputFileName);
+    goto finish;
+  }
+  if (context->pOutputFileName[0]) {
+    context->pOutputFile = fopen((char *)context->pOutputFileName, "wb");
+    if (!context->pOutputFile) {
+      error("can not open %s, please check!", context->pOutputFileName);
+      goto finish;
+    }
+  }
+
+  if (FramePrepare(context)) goto finish;
+  if (VencPrepare(context)) goto finish;
+
+  context->pPacket = PACKET_Create();
+  if (!context->pPacket) goto finish;
+  PACKET_Alloc(context->pPacket, MPP_PACKET_MALLOC_SIZE);
+
+  while (1) {
+    frame = get_free_frame(context);
+    if (!frame) goto finish;
+    if (!read_frame(context, frame)) break;
+
+    FRAME_SetEos(frame, FRAME_NO_EOS);
+    FRAME_SetPts(frame, context->nFrameNum);
+    context->bFrameFree[FRAME_GetID(frame)] = MPP_FALSE;
+
+    // all frame buffers of the encoder are busy, take streams and retry
+    while ((ret = VENC_SendInputFrame(context->pVencCtx,
+                                      FRAME_GetBaseData(frame)))) {
+      if (ret != MPP_POLL_FAILED || drain(context)) goto finish;
+      usleep(1000);
+    }
+    context->nFrameNum++;
+    if (drain(context)) goto finish;
+  }
+
+  FRAME_SetEos(frame, FRAME_EOS_WITHOUT_DATA);
+  VENC_SendInputFrame(context->pVencCtx, FRAME_GetBaseData(frame));
+  for (i = 0; i < 5000 && !context->bEos; i++) {
+    if (drain(context)) goto finish;
+    usleep(1000);
+  }
+
+  copied = context->pVencCtx->stVencPara.nInputCopiedBytes;
+  printf("%d frames, %d streams of %lld bytes, %lld frame bytes copied, %s\n",
+         context->nFrameNum, context->nStreamNum,
+         (long long)context->nStreamBytes, (long long)copied,
+         context->bEos ? "eos" : "no eos");
+  ret = (context->bEos && context->nStreamNum >= context->nFrameNum &&
+         (context->eFrameBufferType != MPP_FRAME_BUFFERTYPE_DMABUF_INTERNAL ||
+          !copied))
+            ? 0
+            : -1;
+  printf("vicodec encode %s\n", ret ? "FAIL" : "PASS");
+
+finish:
+  if (context->pPacket) {
+    PACKET_Free(context->pPacket);
+    PACKET_Destory(context->pPacket);
+  }
+
+  if (context->pVencCtx) VENC_DestoryChannel(context->pVencCtx);
+
+  for (i = 0; i < FRAME_POOL_NUM; i++) {
+    if (context->pFrame[i]) {
+      FRAME_Free(context->pFrame[i]);
+      FRAME_Destory(context->pFrame[i]);
+    }
+  }
+
+  if (context->pInputFile) fclose(context->pInputFile);
+  if (context->pOutputFile) fclose(context->pOutputFile);
+  free(context);
+
+  return ret;
+}
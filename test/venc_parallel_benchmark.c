@@ -0,0 +1,338 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-29 15:36:08
+ * @LastEditTime: 2024-05-30 09:48:26
+ * @Description: aggregate frames per second of N VENC channels encoding the
+ *               same I420/NV12 file at once, one thread per channel, with
+ *               the threads and slices of every encoder set by -e and -s.
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "argument.h"
+#include "const.h"
+#include "type.h"
+#include "venc.h"
+
+#define MAX_CHANNEL_NUM 64
+
+typedef struct _BenchContext BenchContext;
+
+typedef struct _BenchChannel {
+  BenchContext *pContext;
+  pthread_t stThread;
+  S32 nIndex;
+  S64 nFrameNum;
+  S64 nStreamBytes;
+  S64 nCost;
+  S32 nRet;
+  S32 nThreadCount;
+} BenchChannel;
+
+struct _BenchContext {
+  U8 pInputFileName[DEMO_FILE_NAME_LEN];
+  MppCodingType eCodingType;
+  MppModuleType eCodecType;
+  S32 nWidth;
+  S32 nHeight;
+  S32 nFrameNum;
+  S32 nChannelNum;
+  MppPixelFormat ePixelFormat;
+
+  /***
+   * of every encoder, nThreadCount is what the first channel got
+   */
+  S32 nThreadCount;
+  MppCodecThreadType eThreadType;
+  MppVencSliceMode eSliceMode;
+  S32 nSliceNum;
+
+  /***
+   * the input frames, read once and shared by all channels
+   */
+  U8 *pFrames;
+  S32 nFileFrameNum;
+  BenchChannel stChannel[MAX_CHANNEL_NUM];
+};
+
+static const MppArgument ArgumentMapping[] = {
+    {"-H", "--help", HELP, "Print help"},
+    {"-i", "--input", INPUT, "Input I420 or NV12 file path"},
+    {"-c", "--codingtype", CODING_TYPE, "Coding type, default h264"},
+    {"-m", "--moduletype", MODULE_TYPE, "Codec module type, default openh264"},
+    {"-w", "--width", WIDTH, "Video width, default 1280"},
+    {"-h", "--height", HEIGHT, "Video height, default 720"},
+    {"-f", "--format", FORMAT, "PixelFormat, I420 or NV12, default I420"},
+    {"-n", "--frame_num", DECODE_FRAME_NUM,
+     "Frames encoded by every channel, default 100"},
+    {"-t", "--channels", COST_DRAM_THREAD_NUM,
+     "Channels encoding at once, default 1"},
+    {"-e", "--encthreads", CODEC_THREAD_NUM,
+     "count,type of every encoder: count -1 one per CPU, type 2 slice"},
+    {"-s", "--slices", SLICE_MODE,
+     "mode,num: mode 0 one per thread 1 single 2 num slices, default 0"},
+};
+
+static S64 get_time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (S64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @description: read up to nFrameNum frames of the file into memory
+ */
+static S32 load_frames(BenchContext *context) {
+  S32 frame_size = context->nWidth * context->nHeight * 3 / 2;
+  FILE *file = fopen((char *)context->pInputFileName, "rb");
+  S32 i;
+
+  if (!file) {
+    error("can not open %s, please check!", context->pInputFileName);
+    return -1;
+  }
+
+  context->pFrames = (U8 *)malloc((size_t)frame_size * context->nFrameNum);
+  if (!context->pFrames) {
+    error("can not malloc the input frames, please check!");
+    fclose(file);
+    return -1;
+  }
+
+  for (i = 0; i < context->nFrameNum; i++) {
+    if (fread(context->pFrames + (size_t)frame_size * i, 1, frame_size,
+              file) != frame_size)
+      break;
+  }
+  fclose(file);
+
+  context->nFileFrameNum = i;
+  if (!i) {
+    error("%s has no whole frame of %dx%d, please check!",
+          context->pInputFileName, context->nWidth, context->nHeight);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * @description: take out all ready streams
+ * @return {*}: MPP_OK, MPP_CODER_EOS or the error code of the encoder
+ */
+static S32 drain(MppVencCtx *venc, MppPacket *packet, BenchChannel *channel) {
+  S32 ret;
+
+  while (1) {
+    ret = VENC_RequestOutputStreamBuffer(venc, PACKET_GetBaseData(packet));
+    if (ret == MPP_CODER_NO_DATA) return MPP_OK;
+    if (ret) return ret;
+
+    channel->nStreamBytes += PACKET_GetLength(packet);
+    VENC_ReturnOutputStreamBuffer(venc, PACKET_GetBaseData(packet));
+  }
+}
+
+static void *encode_thread(void *arg) {
+  BenchChannel *channel = (BenchChannel *)arg;
+  BenchContext *context = channel->pContext;
+  S32 frame_size = context->nWidth * context->nHeight * 3 / 2;
+  MppVencCtx *venc = NULL;
+  MppPacket *packet = NULL;
+  MppFrame *frame = NULL;
+  U8 *data = NULL;
+  S32 planes = context->ePixelFormat == PIXEL_FORMAT_NV12 ? 2 : 3;
+  S64 start;
+  S32 ret = -1;
+  S32 i;
+
+  venc = VENC_CreateChannel();
+  packet = PACKET_Create();
+  frame = FRAME_Create();
+  if (!venc || !packet || !frame) {
+    error("can not create channel %d, please check!", channel->nIndex);
+    goto finish;
+  }
+
+  venc->eCodecType = context->eCodecType;
+  venc->stVencPara.eCodingType = context->eCodingType;
+  venc->stVencPara.nWidth = context->nWidth;
+  venc->stVencPara.nHeight = context->nHeight;
+  venc->stVencPara.nStride = context->nWidth;
+  venc->stVencPara.PixelFormat = context->ePixelFormat;
+  venc->stVencPara.eFrameBufferType = MPP_FRAME_BUFFERTYPE_NORMAL_EXTERNAL;
+  venc->stVencPara.nBitrate = 5000000;
+  venc->stVencPara.nFrameRate = 30;
+  venc->stVencPara.nThreadCount = context->nThreadCount;
+  venc->stVencPara.eThreadType = context->eThreadType;
+  venc->stVencPara.eSliceMode = context->eSliceMode;
+  venc->stVencPara.nSliceNum = context->nSliceNum;
+  if (VENC_Init(venc) || VENC_SetParam(venc, &(venc->stVencPara))) {
+    error("can not init %s for channel %d, please check!",
+          mpp_moduletype2str(context->eCodecType), channel->nIndex);
+    goto finish;
+  }
+  channel->nThreadCount = venc->stVencPara.nThreadCount;
+
+  // the planes point at the shared input, nothing is copied
+  FRAME_SetBufferType(frame, MPP_FRAME_BUFFERTYPE_NORMAL_EXTERNAL);
+  FRAME_SetDataUsedNum(frame, planes);
+  FRAME_SetWidth(frame, context->nWidth);
+  FRAME_SetHeight(frame, context->nHeight);
+  FRAME_SetLineStride(frame, context->nWidth);
+  FRAME_SetPixelFormat(frame, context->ePixelFormat);
+
+  start = get_time_ns();
+  for (i = 0; i < context->nFrameNum; i++) {
+    data = context->pFrames +
+           (size_t)frame_size * (i % context->nFileFrameNum);
+    FRAME_SetDataPointer(frame, 0, data);
+    FRAME_SetDataPointer(frame, 1, data + context->nWidth * context->nHeight);
+    if (planes > 2)
+      FRAME_SetDataPointer(frame, 2,
+                           data + context->nWidth * context->nHeight * 5 / 4);
+    FRAME_SetPts(frame, i);
+    FRAME_SetID(frame, i);
+    FRAME_SetEos(frame, i == context->nFrameNum - 1 ? FRAME_EOS_WITH_DATA
+                                                    : FRAME_NO_EOS);
+
+    // the encoder refuses the frame while all its output slots are taken
+    while ((ret = VENC_Encode(venc, FRAME_GetBaseData(frame))) ==
+           MPP_DATAQUEUE_FULL) {
+      if ((ret = drain(venc, packet, channel))) goto finish;
+    }
+    if (ret) {
+      error("channel %d: encode frame %d failed, ret = %d", channel->nIndex,
+            i, ret);
+      goto finish;
+    }
+    channel->nFrameNum++;
+
+    ret = drain(venc, packet, channel);
+    if (ret && ret != MPP_CODER_EOS) goto finish;
+  }
+  ret = drain(venc, packet, channel);
+  if (ret == MPP_CODER_EOS) ret = MPP_OK;
+  channel->nCost = get_time_ns() - start;
+
+finish:
+  channel->nRet = ret;
+  if (frame) FRAME_Destory(frame);
+  if (packet) PACKET_Destory(packet);
+  if (venc) VENC_DestoryChannel(venc);
+
+  return NULL;
+}
+
+S32 main(S32 argc, char **argv) {
+  BenchContext *context = NULL;
+  BenchChannel *channel = NULL;
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  S64 frames = 0;
+  S64 start, cost;
+  S32 ret = -1;
+  S32 i;
+
+  context = (BenchContext *)malloc(sizeof(BenchContext));
+  if (!context) {
+    error("can not create BenchContext, please check!");
+    return -1;
+  }
+  memset(context, 0, sizeof(BenchContext));
+  context->eCodingType = CODING_H264;
+  context->eCodecType = CODEC_OPENH264;
+  context->nWidth = 1280;
+  context->nHeight = 720;
+  context->nFrameNum = 100;
+  context->nChannelNum = 1;
+  context->ePixelFormat = PIXEL_FORMAT_I420;
+  context->nThreadCount = 1;
+
+  for (i = 1; i < argc; i += 2) {
+    ARGUMENT arg = get_argument(ArgumentMapping, argv[i], argument_num);
+    if (arg == HELP || arg == INVALID || i + 1 >= argc) {
+      print_demo_usage(ArgumentMapping, argument_num);
+      goto finish;
+    }
+    if (arg == INPUT) sscanf(argv[i + 1], "%2047s", context->pInputFileName);
+    if (arg == CODING_TYPE)
+      sscanf(argv[i + 1], "%d", (S32 *)&(context->eCodingType));
+    if (arg == MODULE_TYPE)
+      sscanf(argv[i + 1], "%d", (S32 *)&(context->eCodecType));
+    if (arg == WIDTH) sscanf(argv[i + 1], "%d", &(context->nWidth));
+    if (arg == HEIGHT) sscanf(argv[i + 1], "%d", &(context->nHeight));
+    if (arg == DECODE_FRAME_NUM)
+      sscanf(argv[i + 1], "%d", &(context->nFrameNum));
+    if (arg == FORMAT)
+      sscanf(argv[i + 1], "%d", (S32 *)&(context->ePixelFormat));
+    if (arg == COST_DRAM_THREAD_NUM)
+      sscanf(argv[i + 1], "%d", &(context->nChannelNum));
+    if (arg == CODEC_THREAD_NUM)
+      sscanf(argv[i + 1], "%d,%d", &(context->nThreadCount),
+             (S32 *)&(context->eThreadType));
+    if (arg == SLICE_MODE)
+      sscanf(argv[i + 1], "%d,%d", (S32 *)&(context->eSliceMode),
+             &(context->nSliceNum));
+  }
+
+  if (!context->pInputFileName[0] || context->nFrameNum <= 0 ||
+      context->nChannelNum <= 0 || context->nChannelNum > MAX_CHANNEL_NUM ||
+      (context->ePixelFormat != PIXEL_FORMAT_I420 &&
+       context->ePixelFormat != PIXEL_FORMAT_NV12)) {
+    print_demo_usage(ArgumentMapping, argument_num);
+    goto finish;
+  }
+
+  if (load_frames(context)) goto finish;
+
+  start = get_time_ns();
+  for (i = 0; i < context->nChannelNum; i++) {
+    channel = &(context->stChannel[i]);
+    channel->pContext = context;
+    channel->nIndex = i;
+    channel->nRet = -1;
+    if (pthread_create(&(channel->stThread), NULL, encode_thread, channel)) {
+      error("can not create thread %d, please check!", i);
+      context->nChannelNum = i;
+      break;
+    }
+  }
+  for (i = 0; i < context->nChannelNum; i++)
+    pthread_join(context->stChannel[i].stThread, NULL);
+  cost = get_time_ns() - start;
+
+  ret = 0;
+  for (i = 0; i < context->nChannelNum; i++) {
+    channel = &(context->stChannel[i]);
+    printf("channel %2d: %lld frames, %lld bytes, %8.1f fps%s\n", i,
+           (long long)channel->nFrameNum, (long long)channel->nStreamBytes,
+           channel->nCost ? channel->nFrameNum * 1e9 / channel->nCost : 0.0,
+           channel->nRet ? " FAILED" : "");
+    frames += channel->nFrameNum;
+    if (channel->nRet) ret = -1;
+  }
+  printf(
+      "%s: %s, %dx%d %s, %d channels x %d threads, %lld frames, %8.1f fps in "
+      "total\n",
+      context->pInputFileName, mpp_moduletype2str(context->eCodecType),
+      context->nWidth, context->nHeight,
+      mpp_pixelformat2str(context->ePixelFormat), context->nChannelNum,
+      context->stChannel[0].nThreadCount, (long long)frames,
+      frames * 1e9 / cost);
+
+finish:
+  if (context->pFrames) free(context->pFrames);
+  free(context);
+
+  return ret;
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-22 15:02:41
+ * @LastEditTime: 2024-05-22 15:02:41
+ * @Description: packets per second that the vi_file plugin demuxes from
+ *               a stream file, no decoder attached.
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "argument.h"
+#include "const.h"
+#include "type.h"
+#include "vi.h"
+
+static const MppArgument ArgumentMapping[] = {
+    {"-H", "--help", HELP, "Print help"},
+    {"-i", "--input", INPUT, "Input file path"},
+    {"-c", "--codingtype", CODING_TYPE, "Coding type, default h264"},
+    {"-n", "--count", DECODE_FRAME_NUM, "Passes over the file, default 10"},
+};
+
+static S64 get_time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (S64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @description: demux the whole file once
+ * @return {*}: number of packets, or < 0 on error
+ */
+static S64 demux_once(U8 *file_name, MppCodingType coding_type,
+                      MppPacket *packet, S64 *bytes) {
+  MppViCtx *vi_ctx = VI_CreateChannel();
+  S64 packets = 0;
+  S32 ret = 0;
+
+  if (!vi_ctx) {
+    error("Can not create MppViCtx, please check!");
+    return -1;
+  }
+
+  vi_ctx->eViType = VI_FILE;
+  vi_ctx->stViPara.eCodingType = coding_type;
+  vi_ctx->stViPara.pInputFileName = file_name;
+  vi_ctx->stViPara.bIsFrame = MPP_FALSE;
+  if (VI_Init(vi_ctx)) {
+    error("Can not init vi_file, please check!");
+    VI_DestoryChannel(vi_ctx);
+    return -1;
+  }
+
+  while (1) {
+    ret = VI_RequestOutputData(vi_ctx, PACKET_GetBaseData(packet));
+    if (ret == MPP_CODER_EOS) break;
+    packets++;
+    *bytes += PACKET_GetLength(packet);
+    VI_ReturnOutputData(vi_ctx, PACKET_GetBaseData(packet));
+  }
+  VI_ReturnOutputData(vi_ctx, PACKET_GetBaseData(packet));
+
+  VI_DestoryChannel(vi_ctx);
+
+  return packets;
+}
+
+S32 main(S32 argc, char **argv) {
+  U8 file_name[DEMO_FILE_NAME_LEN] = {0};
+  MppCodingType coding_type = CODING_H264;
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  MppPacket *packet = NULL;
+  S64 packets = 0, bytes = 0, start, cost, ret;
+  S32 count = 10;
+  S32 i;
+
+  for (i = 1; i < argc; i += 2) {
+    ARGUMENT arg = get_argument(ArgumentMapping, argv[i], argument_num);
+    if (arg == HELP || arg == INVALID || i + 1 >= argc) {
+      print_demo_usage(ArgumentMapping, argument_num);
+      return -1;
+    }
+    if (arg == INPUT) sscanf(argv[i + 1], "%2047s", file_name);
+    if (arg == CODING_TYPE) sscanf(argv[i + 1], "%d", (S32 *)&coding_type);
+    if (arg == DECODE_FRAME_NUM) sscanf(argv[i + 1], "%d", &count);
+  }
+
+  if (!file_name[0] || count <= 0) {
+    print_demo_usage(ArgumentMapping, argument_num);
+    return -1;
+  }
+
+  packet = PACKET_Create();
+  if (!packet || PACKET_Alloc(packet, MPP_PACKET_MALLOC_SIZE)) {
+    error("can not create packet, please check!");
+    return -1;
+  }
+
+  start = get_time_ns();
+  for (i = 0; i < count; i++) {
+    ret = demux_once(file_name, coding_type, packet, &bytes);
+    if (ret < 0) break;
+    packets += ret;
+  }
+  cost = get_time_ns() - start;
+
+  if (ret >= 0) {
+    printf("%s: %lld packets (%lld bytes) in %d passes, %10.0f packets/s  "
+           "%8.1f MB/s\n",
+           file_name, (long long)packets, (long long)bytes, count,
+           packets * 1e9 / cost, bytes * 1e9 / cost / (1024 * 1024));
+  }
+
+  PACKET_Free(packet);
+  PACKET_Destory(packet);
+
+  return ret < 0 ? -1 : 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-24 16:05:31
+ * @LastEditTime: 2024-05-29 10:21:45
+ * @Description: frames per second of one VDEC channel decoding a stream file,
+ *               for comparing the threading and output settings of software
+ *               decoders.
+ */
+
+#define ENABLE_DEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "argument.h"
+#include "const.h"
+#include "type.h"
+#include "vdec.h"
+#include "vi.h"
+
+typedef struct _BenchContext {
+  U8 pInputFileName[DEMO_FILE_NAME_LEN];
+  MppCodingType eCodingType;
+  MppModuleType eCodecType;
+  S32 nWidth;
+  S32 nHeight;
+  S32 nThreadCount;
+  MppCodecThreadType eThreadType;
+  BOOL bOutputByReference;
+  MppViCtx *pViCtx;
+  MppVdecCtx *pVdecCtx;
+  MppPacket *pPacket;
+  MppFrame *pFrame;
+  S64 nFrameNum;
+  BOOL bEos;
+} BenchContext;
+
+static const MppArgument ArgumentMapping[] = {
+    {"-H", "--help", HELP, "Print help"},
+    {"-i", "--input", INPUT, "Input file path"},
+    {"-c", "--codingtype", CODING_TYPE, "Coding type, default h264"},
+    {"-m", "--moduletype", MODULE_TYPE, "Codec module type, default ffmpeg"},
+    {"-w", "--width", WIDTH, "Video width, default 1920"},
+    {"-h", "--height", HEIGHT, "Video height, default 1080"},
+    {"-t", "--threads", COST_DRAM_THREAD_NUM,
+     "count,type: count -1 one per CPU, type 0 auto 1 frame 2 slice"},
+    {"-z", "--zerocopy", ZERO_COPY,
+     "1 lends the decoder's pictures instead of copies, default 0"},
+};
+
+static S64 get_time_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (S64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @description: take out all ready frames
+ * @return {*}: MPP_OK or the error code of the decoder
+ */
+static S32 drain(BenchContext *context) {
+  S32 ret = 0;
+
+  while (!context->bEos) {
+    ret = VDEC_RequestOutputFrame(context->pVdecCtx,
+                                  FRAME_GetBaseData(context->pFrame));
+    if (ret == MPP_OK) {
+      context->nFrameNum++;
+      VDEC_ReturnOutputFrame(context->pVdecCtx,
+                             FRAME_GetBaseData(context->pFrame));
+    } else if (ret == MPP_CODER_EOS) {
+      context->bEos = MPP_TRUE;
+    } else if (ret == MPP_CODER_NULL_DATA) {
+      VDEC_ReturnOutputFrame(context->pVdecCtx,
+                             FRAME_GetBaseData(context->pFrame));
+    } else if (ret == MPP_CODER_NO_DATA || ret == MPP_RESOLUTION_CHANGED ||
+               ret == MPP_ERROR_FRAME) {
+      return MPP_OK;
+    } else {
+      return ret;
+    }
+  }
+
+  return MPP_OK;
+}
+
+static S32 prepare(BenchContext *context) {
+  context->pViCtx = VI_CreateChannel();
+  context->pVdecCtx = VDEC_CreateChannel();
+  if (!context->pViCtx || !context->pVdecCtx) {
+    error("Can not create channels, please check!");
+    return -1;
+  }
+
+  context->pViCtx->eViType = VI_FILE;
+  context->pViCtx->stViPara.eCodingType = context->eCodingType;
+  context->pViCtx->stViPara.pInputFileName = context->pInputFileName;
+  context->pViCtx->stViPara.bIsFrame = MPP_FALSE;
+  if (VI_Init(context->pViCtx)) {
+    error("Can not init vi_file, please check!");
+    return -1;
+  }
+
+  context->pVdecCtx->eCodecType = context->eCodecType;
+  context->pVdecCtx->stVdecPara.eCodingType = context->eCodingType;
+  context->pVdecCtx->stVdecPara.nWidth = context->nWidth;
+  context->pVdecCtx->stVdecPara.nHeight = context->nHeight;
+  context->pVdecCtx->stVdecPara.nScale = 1;
+  context->pVdecCtx->stVdecPara.nThreadCount = context->nThreadCount;
+  context->pVdecCtx->stVdecPara.eThreadType = context->eThreadType;
+  context->pVdecCtx->stVdecPara.bOutputByReference =
+      context->bOutputByReference;
+  if (VDEC_Init(context->pVdecCtx)) {
+    error("Can not init %s, please check!",
+          mpp_moduletype2str(context->eCodecType));
+    return -1;
+  }
+
+  context->pPacket = PACKET_Create();
+  context->pFrame = FRAME_Create();
+  if (!context->pPacket || !context->pFrame ||
+      PACKET_Alloc(context->pPacket, MPP_PACKET_MALLOC_SIZE)) {
+    error("can not create packet or frame, please check!");
+    return -1;
+  }
+
+  return 0;
+}
+
+S32 main(S32 argc, char **argv) {
+  BenchContext *context = NULL;
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  BOOL eos = MPP_FALSE;
+  S64 start, cost;
+  S32 ret = -1;
+  S32 i;
+
+  context = (BenchContext *)malloc(sizeof(BenchContext));
+  if (!context) {
+    error("can not create BenchContext, please check!");
+    return -1;
+  }
+  memset(context, 0, sizeof(BenchContext));
+  context->eCodingType = CODING_H264;
+  context->eCodecType = CODEC_FFMPEG;
+  context->nWidth = 1920;
+  context->nHeight = 1080;
+
+  for (i = 1; i < argc; i += 2) {
+    ARGUMENT arg = get_argument(ArgumentMapping, argv[i], argument_num);
+    if (arg == HELP || arg == INVALID || i + 1 >= argc) {
+      print_demo_usage(ArgumentMapping, argument_num);
+      goto finish;
+    }
+    if (arg == INPUT) sscanf(argv[i + 1], "%2047s", context->pInputFileName);
+    if (arg == CODING_TYPE)
+      sscanf(argv[i + 1], "%d", (S32 *)&(context->eCodingType));
+    if (arg == MODULE_TYPE)
+      sscanf(argv[i + 1], "%d", (S32 *)&(context->eCodecType));
+    if (arg == WIDTH) sscanf(argv[i + 1], "%d", &(context->nWidth));
+    if (arg == HEIGHT) sscanf(argv[i + 1], "%d", &(context->nHeight));
+    if (arg == COST_DRAM_THREAD_NUM)
+      sscanf(argv[i + 1], "%d,%d", &(context->nThreadCount),
+             (S32 *)&(context->eThreadType));
+    if (arg == ZERO_COPY)
+      sscanf(argv[i + 1], "%d", (S32 *)&(context->bOutputByReference));
+  }
+
+  if (!context->pInputFileName[0]) {
+    print_demo_usage(ArgumentMapping, argument_num);
+    goto finish;
+  }
+
+  if (prepare(context)) goto finish;
+
+  start = get_time_ns();
+  while (!eos) {
+    ret = VI_RequestOutputData(context->pViCtx,
+                               PACKET_GetBaseData(context->pPacket));
+    if (ret == MPP_CODER_EOS) eos = MPP_TRUE;
+
+    // the decoder does not take more input until frames are taken out
+    while (VDEC_Decode(context->pVdecCtx,
+                       PACKET_GetBaseData(context->pPacket))) {
+      if ((ret = drain(context))) goto finish;
+      usleep(100);
+    }
+    if ((ret = drain(context))) goto finish;
+
+    VI_ReturnOutputData(context->pViCtx, PACKET_GetBaseData(context->pPacket));
+  }
+
+  while (!context->bEos) {
+    if ((ret = drain(context))) goto finish;
+    usleep(100);
+  }
+  cost = get_time_ns() - start;
+
+  printf(
+      "%s: %s, %d threads, thread type %d, by reference %d, %lld frames, "
+      "%8.1f fps\n",
+      context->pInputFileName, mpp_moduletype2str(context->eCodecType),
+      context->pVdecCtx->stVdecPara.nThreadCount,
+      context->pVdecCtx->stVdecPara.eThreadType, context->bOutputByReference,
+      (long long)context->nFrameNum, context->nFrameNum * 1e9 / cost);
+  ret = 0;
+
+finish:
+  if (context->pFrame) FRAME_Destory(context->pFrame);
+
+  if (context->pPacket) {
+    PACKET_Free(context->pPacket);
+    PACKET_Destory(context->pPacket);
+  }
+
+  if (context->pVdecCtx) VDEC_DestoryChannel(context->pVdecCtx);
+  if (context->pViCtx) VI_DestoryChannel(context->pViCtx);
+
+  free(context);
+
+  return ret;
+}
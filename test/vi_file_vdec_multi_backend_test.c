@@ -0,0 +1,307 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-21 11:20:45
+ * @LastEditTime: 2024-05-24 14:27:10
+ * @Description: decode one stream by two VDEC channels on different plugins
+ *               in one process, and compare the md5 of the two outputs.
+ */
+
+#define ENABLE_DEBUG 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "argument.h"
+#include "const.h"
+#include "md5.h"
+#include "type.h"
+#include "vdec.h"
+#include "vi.h"
+
+#define NUM_OF_CHANNELS 2
+
+typedef struct _TestChannel {
+  MppModuleType eCodecType;
+  MppVdecCtx *pVdecCtx;
+  MD5Context stMd5;
+  S32 nFrameNum;
+  BOOL bEos;
+} TestChannel;
+
+typedef struct _TestContext {
+  U8 pInputFileName[DEMO_FILE_NAME_LEN];
+  MppCodingType eCodingType;
+  S32 ePixelFormat;
+  S32 nWidth;
+  S32 nHeight;
+  MppModuleType eViType;
+  MppViCtx *pViCtx;
+  TestChannel stChannel[NUM_OF_CHANNELS];
+  MppPacket *pPacket;
+  MppFrame *pFrame;
+} TestContext;
+
+static const MppArgument ArgumentMapping[] = {
+    {"-H", "--help", HELP, "Print help"},
+    {"-i", "--input", INPUT, "Input file path"},
+    {"-c", "--codingtype", CODING_TYPE, "Coding type"},
+    {"-m", "--moduletype", MODULE_TYPE, "Module type: vi,codec_a,codec_b"},
+    {"-w", "--width", WIDTH, "Video width"},
+    {"-h", "--height", HEIGHT, "Video height"},
+    {"-f", "--format", FORMAT, "Video PixelFormat"},
+};
+
+static S32 parse_argument(TestContext *context, char *argument, char *value,
+                          S32 num) {
+  ARGUMENT arg = get_argument(ArgumentMapping, argument, num);
+
+  if (!value && arg != HELP) {
+    error("argument need a value, please check!");
+    return -1;
+  }
+
+  switch (arg) {
+    case HELP:
+      print_demo_usage(ArgumentMapping, num);
+      print_para_enum();
+      return -1;
+    case INPUT:
+      sscanf(value, "%2047s", context->pInputFileName);
+      break;
+    case CODING_TYPE:
+      sscanf(value, "%d", (S32 *)&(context->eCodingType));
+      break;
+    case MODULE_TYPE:
+      sscanf(value, "%d,%d,%d", (S32 *)&(context->eViType),
+             (S32 *)&(context->stChannel[0].eCodecType),
+             (S32 *)&(context->stChannel[1].eCodecType));
+      break;
+    case WIDTH:
+      sscanf(value, "%d", &(context->nWidth));
+      break;
+    case HEIGHT:
+      sscanf(value, "%d", &(context->nHeight));
+      break;
+    case FORMAT:
+      sscanf(value, "%d", &(context->ePixelFormat));
+      break;
+    case INVALID:
+    default:
+      error("Unknowed argument : %s, please check!", argument);
+      return -1;
+  }
+
+  return 0;
+}
+
+static S32 ViPrepare(TestContext *context) {
+  context->pViCtx = VI_CreateChannel();
+  if (!context->pViCtx) {
+    error("Can not create MppViCtx, please check!");
+    return -1;
+  }
+
+  context->pViCtx->eViType = context->eViType;
+  context->pViCtx->stViPara.nWidth = context->nWidth;
+  context->pViCtx->stViPara.nHeight = context->nHeight;
+  context->pViCtx->stViPara.ePixelFormat = context->ePixelFormat;
+  context->pViCtx->stViPara.eCodingType = context->eCodingType;
+  context->pViCtx->stViPara.pInputFileName = context->pInputFileName;
+  context->pViCtx->stViPara.bIsFrame = MPP_FALSE;
+
+  return VI_Init(context->pViCtx);
+}
+
+static S32 VdecPrepare(TestContext *context, TestChannel *channel) {
+  channel->pVdecCtx = VDEC_CreateChannel();
+  if (!channel->pVdecCtx) {
+    error("Can not create MppVdecCtx, please check!");
+    return -1;
+  }
+
+  channel->pVdecCtx->eCodecType = channel->eCodecType;
+  channel->pVdecCtx->stVdecPara.eCodingType = context->eCodingType;
+  channel->pVdecCtx->stVdecPara.nWidth = context->nWidth;
+  channel->pVdecCtx->stVdecPara.nHeight = context->nHeight;
+  channel->pVdecCtx->stVdecPara.nScale = 1;
+  channel->pVdecCtx->stVdecPara.eOutputPixelFormat = context->ePixelFormat;
+  md5_init(&(channel->stMd5));
+
+  return VDEC_Init(channel->pVdecCtx);
+}
+
+/**
+ * @description: hash the visible picture only, row by row, so frames lent by
+ * the decoder with a padded line stride give the same md5 as packed ones
+ */
+static void update_md5(TestContext *context, TestChannel *channel,
+                       MppFrame *frame) {
+  S32 width[3] = {context->nWidth, context->nWidth / 2, context->nWidth / 2};
+  S32 height[3] = {context->nHeight, context->nHeight / 2,
+                   context->nHeight / 2};
+  S32 stride[3];
+  S32 i, j;
+  U8 *data = NULL;
+
+  stride[0] = FRAME_GetLineStride(frame) > context->nWidth
+                  ? FRAME_GetLineStride(frame)
+                  : context->nWidth;
+  stride[1] = stride[0] / 2;
+  stride[2] = stride[0] / 2;
+
+  if (context->ePixelFormat == PIXEL_FORMAT_NV12 ||
+      context->ePixelFormat == PIXEL_FORMAT_NV21) {
+    width[1] = context->nWidth;
+    stride[1] = stride[0];
+  }
+
+  for (i = 0; i < FRAME_GetDataUsedNum(frame) && i < 3; i++) {
+    data = FRAME_GetDataPointer(frame, i);
+    for (j = 0; j < height[i]; j++)
+      md5_update(&(channel->stMd5), data + (S64)j * stride[i], width[i]);
+  }
+}
+
+/**
+ * @description: get all ready frames of the channel
+ * @return {*}: MPP_OK or the error code of the decoder
+ */
+static S32 drain_channel(TestContext *context, TestChannel *channel) {
+  S32 ret = 0;
+
+  while (!channel->bEos) {
+    ret = VDEC_RequestOutputFrame(channel->pVdecCtx,
+                                  FRAME_GetBaseData(context->pFrame));
+    if (ret == MPP_OK) {
+      update_md5(context, channel, context->pFrame);
+      channel->nFrameNum++;
+      VDEC_ReturnOutputFrame(channel->pVdecCtx,
+                             FRAME_GetBaseData(context->pFrame));
+    } else if (ret == MPP_CODER_EOS) {
+      channel->bEos = MPP_TRUE;
+    } else if (ret == MPP_CODER_NULL_DATA) {
+      VDEC_ReturnOutputFrame(channel->pVdecCtx,
+                             FRAME_GetBaseData(context->pFrame));
+    } else if (ret == MPP_CODER_NO_DATA || ret == MPP_RESOLUTION_CHANGED ||
+               ret == MPP_ERROR_FRAME) {
+      return MPP_OK;
+    } else {
+      return ret;
+    }
+  }
+
+  return MPP_OK;
+}
+
+S32 main(S32 argc, char **argv) {
+  TestContext *context = NULL;
+  TestChannel *channel = NULL;
+  char md5[NUM_OF_CHANNELS][MD5_STRING_LEN];
+  S32 argument_num = NUM_OF(ArgumentMapping);
+  BOOL eos = MPP_FALSE;
+  S32 ret = -1;
+  S32 i;
+
+  context = (TestContext *)malloc(sizeof(TestContext));
+  if (!context) {
+    error("can not create TestContext, please check!");
+    return -1;
+  }
+  memset(context, 0, sizeof(TestContext));
+  context->eCodingType = CODING_H264;
+  context->ePixelFormat = PIXEL_FORMAT_I420;
+  context->eViType = VI_FILE;
+  context->stChannel[0].eCodecType = CODEC_FFMPEG;
+  context->stChannel[1].eCodecType = CODEC_OPENH264;
+
+  if (argc < 2) {
+    print_demo_usage(ArgumentMapping, argument_num);
+    goto finish;
+  }
+
+  for (i = 1; i < argc; i += 2) {
+    if (parse_argument(context, argv[i], i + 1 < argc ? argv[i + 1] : NULL,
+                       argument_num))
+      goto finish;
+  }
+
+  if (ViPrepare(context)) goto finish;
+
+  for (i = 0; i < NUM_OF_CHANNELS; i++) {
+    if (VdecPrepare(context, &(context->stChannel[i]))) {
+      error("can not init channel %d (%s), please check!", i,
+            mpp_moduletype2str(context->stChannel[i].eCodecType));
+      goto finish;
+    }
+  }
+
+  context->pPacket = PACKET_Create();
+  context->pFrame = FRAME_Create();
+  if (!context->pPacket || !context->pFrame) goto finish;
+  PACKET_Alloc(context->pPacket, MPP_PACKET_MALLOC_SIZE);
+
+  while (!eos) {
+    ret = VI_RequestOutputData(context->pViCtx,
+                               PACKET_GetBaseData(context->pPacket));
+    if (ret == MPP_CODER_EOS) eos = MPP_TRUE;
+
+    for (i = 0; i < NUM_OF_CHANNELS; i++) {
+      channel = &(context->stChannel[i]);
+      // input queue of the channel is full, take frames out and retry
+      while (VDEC_Decode(channel->pVdecCtx,
+                         PACKET_GetBaseData(context->pPacket))) {
+        if (drain_channel(context, channel)) goto finish;
+        usleep(1000);
+      }
+      if (drain_channel(context, channel)) goto finish;
+    }
+
+    VI_ReturnOutputData(context->pViCtx, PACKET_GetBaseData(context->pPacket));
+  }
+
+  while (!context->stChannel[0].bEos || !context->stChannel[1].bEos) {
+    for (i = 0; i < NUM_OF_CHANNELS; i++) {
+      if (drain_channel(context, &(context->stChannel[i]))) goto finish;
+    }
+    usleep(1000);
+  }
+
+  for (i = 0; i < NUM_OF_CHANNELS; i++) {
+    channel = &(context->stChannel[i]);
+    md5_final(&(channel->stMd5), md5[i]);
+    printf("channel %d (%s): %d frames, md5 %s\n", i,
+           mpp_moduletype2str(channel->eCodecType), channel->nFrameNum,
+           md5[i]);
+  }
+
+  ret = (context->stChannel[0].nFrameNum == context->stChannel[1].nFrameNum &&
+         !strcmp(md5[0], md5[1]))
+            ? 0
+            : -1;
+  printf("md5 %s\n", ret ? "MISMATCH" : "MATCH");
+
+finish:
+  if (context->pFrame) FRAME_Destory(context->pFrame);
+
+  if (context->pPacket) {
+    PACKET_Free(context->pPacket);
+    PACKET_Destory(context->pPacket);
+  }
+
+  for (i = 0; i < NUM_OF_CHANNELS; i++) {
+    if (context->stChannel[i].pVdecCtx)
+      VDEC_DestoryChannel(context->stChannel[i].pVdecCtx);
+  }
+
+  if (context->pViCtx) VI_DestoryChannel(context->pViCtx);
+
+  free(context);
+
+  return ret;
+}
@@ -5,8 +5,10 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-13 18:10:10
- * @LastEditTime: 2023-12-05 11:30:01
- * @Description:
+ * @LastEditTime: 2024-05-21 16:12:40
+ * @Description: bounded ring of pointers, SPSC by default, MPMC (Vyukov's
+ *               bounded array queue) on demand. The hot path takes no lock
+ *               and allocates nothing, blocking callers park on a futex.
  */
 
 #define ENABLE_DEBUG 0
@@ -14,10 +16,15 @@
 #include "dataqueue.h"
 
 #include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sched.h>
 #include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "log.h"
 
@@ -28,52 +35,324 @@ S32 num_of_unfree_queue = 0;
 S32 num_of_unfree_node = 0;
 #endif
 
+#define DATAQUEUE_CACHELINE 64
+
 struct _MppDataQueueNode {
   struct _MppDataQueueNode *next;
   MppData *data;
 };
 
+typedef struct _MppDataQueueCell {
+  atomic_uint nSeq;
+  void *pData;
+} MppDataQueueCell;
+
 struct _MppDataQueue {
+  MppDataQueueMode eMode;
   S32 nMaxNum;
-  atomic_int nCurrentNum;
-  MppDataQueueNode *pQueueHead;
-  MppDataQueueNode *pQueueTail;
-
+  U32 nCapacity;
+  U32 nMask;
   BOOL bInputBlock;
   BOOL bOutputBlock;
-
-  pthread_mutex_t mutex;
-  pthread_cond_t inCond;
-  pthread_cond_t outCond;
-  BOOL bExit;
+  atomic_int bExit;
+
+  /***
+   * SPSC uses pSlots, MPMC uses pCells.
+   */
+  void **pSlots;
+  MppDataQueueCell *pCells;
+
+  /***
+   * producer side and consumer side live in their own cache lines.
+   */
+  atomic_uint nHead __attribute__((aligned(DATAQUEUE_CACHELINE)));
+  atomic_uint nInFutex;
+
+  atomic_uint nTail __attribute__((aligned(DATAQUEUE_CACHELINE)));
+  atomic_uint nOutFutex;
+
+  /***
+   * only maintained in MPMC mode, counts reserved slots.
+   */
+  atomic_int nCurrentNum __attribute__((aligned(DATAQUEUE_CACHELINE)));
 };
 
-MppDataQueue *DATAQUEUE_Init(BOOL inblk, BOOL outblk) {
-  MppDataQueue *queue = (MppDataQueue *)malloc(sizeof(MppDataQueue));
-  if (!queue) {
-    error("can not malloc MppDataQueue, please check! (%s)", strerror(errno));
+static void futex_wait(atomic_uint *addr, U32 val) {
+  syscall(SYS_futex, (U32 *)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_uint *addr) {
+  syscall(SYS_futex, (U32 *)addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/***
+ * futex word: bit 0 is set by a parked waiter, the other bits are a
+ * sequence bumped on every wakeup.
+ */
+#define FUTEX_WAITER_BIT 1U
+#define FUTEX_SEQ_STEP 2U
+
+/**
+ * @description: wake the parked side, the syscall is skipped when nobody
+ * waits, which is the common case, and only the first wakeup after a
+ * waiter parks pays for it.
+ */
+static inline void wake_waiters(atomic_uint *futex, BOOL force) {
+  U32 value = atomic_load(futex);
+
+  while ((value & FUTEX_WAITER_BIT) || force) {
+    if (atomic_compare_exchange_weak(
+            futex, &value, (value + FUTEX_SEQ_STEP) & ~FUTEX_WAITER_BIT)) {
+      if (value & FUTEX_WAITER_BIT) futex_wake(futex);
+      return;
+    }
+  }
+}
+
+/**
+ * @description: park until ready() is true, the queue exits or the
+ * sequence moves on, each caller waits for at most one wakeup.
+ */
+static void wait_for(MppDataQueue *queue, atomic_uint *futex,
+                     BOOL (*ready)(MppDataQueue *queue)) {
+  U32 seq = atomic_load(futex) & ~FUTEX_WAITER_BIT;
+  U32 value;
+
+  for (;;) {
+    value = atomic_fetch_or(futex, FUTEX_WAITER_BIT) | FUTEX_WAITER_BIT;
+    if ((value & ~FUTEX_WAITER_BIT) != seq || ready(queue) ||
+        atomic_load(&queue->bExit))
+      return;
+    futex_wait(futex, value);
+  }
+}
+
+static U32 round_up_power_of_2(U32 value) {
+  U32 ret = 1;
+
+  while (ret < value) ret <<= 1;
+
+  return ret;
+}
+
+static inline S32 current_num(MppDataQueue *queue) {
+  if (queue->eMode == DATAQUEUE_MODE_MPMC)
+    return atomic_load(&queue->nCurrentNum);
+
+  return (S32)(atomic_load(&queue->nHead) - atomic_load(&queue->nTail));
+}
+
+/**
+ * @description: whether there is an element ready to pop, in MPMC mode a
+ * reserved slot does not count until its data is published.
+ */
+static BOOL is_readable(MppDataQueue *queue) {
+  U32 tail = atomic_load(&queue->nTail);
+
+  if (queue->eMode == DATAQUEUE_MODE_MPMC)
+    return atomic_load(&queue->pCells[tail & queue->nMask].nSeq) == tail + 1;
+
+  return atomic_load(&queue->nHead) != tail;
+}
+
+static BOOL is_writable(MppDataQueue *queue) {
+  return current_num(queue) < queue->nMaxNum;
+}
+
+static BOOL spsc_push(MppDataQueue *queue, void *data) {
+  U32 head = atomic_load_explicit(&queue->nHead, memory_order_relaxed);
+  U32 tail = atomic_load_explicit(&queue->nTail, memory_order_acquire);
+
+  if ((S32)(head - tail) >= queue->nMaxNum) return MPP_FALSE;
+
+  queue->pSlots[head & queue->nMask] = data;
+  atomic_store(&queue->nHead, head + 1);
+
+  return MPP_TRUE;
+}
+
+static void *spsc_pop(MppDataQueue *queue, BOOL peek) {
+  U32 tail = atomic_load_explicit(&queue->nTail, memory_order_relaxed);
+  U32 head = atomic_load_explicit(&queue->nHead, memory_order_acquire);
+  void *data = NULL;
+
+  if (head == tail) return NULL;
+
+  data = queue->pSlots[tail & queue->nMask];
+  if (!peek) atomic_store(&queue->nTail, tail + 1);
+
+  return data;
+}
+
+static BOOL mpmc_push(MppDataQueue *queue, void *data) {
+  MppDataQueueCell *cell = NULL;
+  U32 pos, seq;
+
+  // reserve a slot first, so nMaxNum is honoured even if it is smaller
+  // than the ring
+  if (atomic_fetch_add(&queue->nCurrentNum, 1) >= queue->nMaxNum) {
+    atomic_fetch_sub(&queue->nCurrentNum, 1);
+    return MPP_FALSE;
+  }
+
+  pos = atomic_load_explicit(&queue->nHead, memory_order_relaxed);
+  for (;;) {
+    cell = &queue->pCells[pos & queue->nMask];
+    seq = atomic_load_explicit(&cell->nSeq, memory_order_acquire);
+    if (seq == pos) {
+      if (atomic_compare_exchange_weak_explicit(&queue->nHead, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if ((S32)(seq - pos) < 0) {
+      // the slot is reserved for us, a consumer is still releasing the cell
+      sched_yield();
+      pos = atomic_load_explicit(&queue->nHead, memory_order_relaxed);
+    } else {
+      pos = atomic_load_explicit(&queue->nHead, memory_order_relaxed);
+    }
+  }
+
+  cell->pData = data;
+  atomic_store(&cell->nSeq, pos + 1);
+
+  return MPP_TRUE;
+}
+
+static void *mpmc_pop(MppDataQueue *queue, BOOL peek) {
+  MppDataQueueCell *cell = NULL;
+  U32 pos, seq;
+  void *data = NULL;
+
+  pos = atomic_load_explicit(&queue->nTail, memory_order_relaxed);
+  for (;;) {
+    cell = &queue->pCells[pos & queue->nMask];
+    seq = atomic_load(&cell->nSeq);
+    if (seq == pos + 1) {
+      if (peek) return cell->pData;
+      if (atomic_compare_exchange_weak_explicit(&queue->nTail, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed))
+        break;
+    } else if ((S32)(seq - (pos + 1)) < 0) {
+      return NULL;
+    } else {
+      pos = atomic_load_explicit(&queue->nTail, memory_order_relaxed);
+    }
+  }
+
+  data = cell->pData;
+  atomic_store_explicit(&cell->nSeq, pos + queue->nMask + 1,
+                        memory_order_release);
+  atomic_fetch_sub(&queue->nCurrentNum, 1);
+
+  return data;
+}
+
+static inline BOOL try_push(MppDataQueue *queue, void *data) {
+  BOOL ret = queue->eMode == DATAQUEUE_MODE_MPMC ? mpmc_push(queue, data)
+                                                 : spsc_push(queue, data);
+  if (ret) wake_waiters(&queue->nOutFutex, MPP_FALSE);
+
+  return ret;
+}
+
+static inline void *try_pop(MppDataQueue *queue, BOOL peek) {
+  void *data = queue->eMode == DATAQUEUE_MODE_MPMC ? mpmc_pop(queue, peek)
+                                                   : spsc_pop(queue, peek);
+  if (data && !peek) wake_waiters(&queue->nInFutex, MPP_FALSE);
+
+  return data;
+}
+
+static RETURN queue_push(MppDataQueue *queue, void *data) {
+  if (try_push(queue, data)) return MPP_OK;
+
+  if (!queue->bInputBlock || atomic_load(&queue->bExit)) {
+    debug("dataqueue is full or exit, no push wait!");
+    return MPP_DATAQUEUE_FULL;
+  }
+
+  // park until one element is popped, or Cond_BroadCast is called
+  wait_for(queue, &queue->nInFutex, is_writable);
+
+  return try_push(queue, data) ? MPP_OK : MPP_DATAQUEUE_FULL;
+}
+
+static void *queue_pop(MppDataQueue *queue, BOOL peek) {
+  void *data = try_pop(queue, peek);
+
+  if (data) return data;
+
+  if (!queue->bOutputBlock || atomic_load(&queue->bExit)) {
+    debug("dataqueue is empty or exit, no pop wait!");
     return NULL;
   }
 
-#ifdef DEBUG_MEMORY
-  num_of_unfree_queue++;
-#endif
+  // park until one element is pushed, or Cond_BroadCast is called, the
+  // caller gets NULL when woken up by the latter
+  wait_for(queue, &queue->nOutFutex, is_readable);
+
+  data = try_pop(queue, peek);
+  if (!data) debug("wait up, but dataqueue is empty!");
+
+  return data;
+}
+
+MppDataQueue *DATAQUEUE_InitWithCapacity(BOOL inblk, BOOL outblk,
+                                         S32 capacity, MppDataQueueMode mode) {
+  MppDataQueue *queue = NULL;
+  U32 i;
 
-  queue->nMaxNum = 10;
-  queue->nCurrentNum = ATOMIC_VAR_INIT(0);
-  queue->pQueueHead = NULL;
-  queue->pQueueTail = NULL;
+  if (capacity <= 0) {
+    error("capacity is not a valid value(%d), please check!", capacity);
+    return NULL;
+  }
+
+  if (posix_memalign((void **)&queue, DATAQUEUE_CACHELINE,
+                     sizeof(MppDataQueue))) {
+    error("can not malloc MppDataQueue, please check! (%s)", strerror(errno));
+    return NULL;
+  }
+  memset(queue, 0, sizeof(MppDataQueue));
+
+  queue->eMode = mode;
+  queue->nMaxNum = capacity;
+  queue->nCapacity = round_up_power_of_2(capacity);
+  queue->nMask = queue->nCapacity - 1;
   queue->bInputBlock = inblk;
   queue->bOutputBlock = outblk;
-  queue->bExit = MPP_FALSE;
 
-  pthread_mutex_init(&queue->mutex, NULL);
-  pthread_cond_init(&queue->inCond, NULL);
-  pthread_cond_init(&queue->outCond, NULL);
+  if (mode == DATAQUEUE_MODE_MPMC) {
+    queue->pCells =
+        (MppDataQueueCell *)malloc(queue->nCapacity * sizeof(MppDataQueueCell));
+    if (queue->pCells) {
+      for (i = 0; i < queue->nCapacity; i++)
+        atomic_init(&queue->pCells[i].nSeq, i);
+    }
+  } else {
+    queue->pSlots = (void **)malloc(queue->nCapacity * sizeof(void *));
+  }
+
+  if (!queue->pCells && !queue->pSlots) {
+    error("can not malloc ring of MppDataQueue, please check! (%s)",
+          strerror(errno));
+    free(queue);
+    return NULL;
+  }
+
+#ifdef DEBUG_MEMORY
+  num_of_unfree_queue++;
+#endif
 
   return queue;
 }
 
+MppDataQueue *DATAQUEUE_Init(BOOL inblk, BOOL outblk) {
+  return DATAQUEUE_InitWithCapacity(inblk, outblk, DATAQUEUE_DEFAULT_CAPACITY,
+                                    DATAQUEUE_MODE_SPSC);
+}
+
 S32 DATAQUEUE_GetQueueStructSize() { return sizeof(MppDataQueue); }
 
 S32 DATAQUEUE_GetNodeStructSize() { return sizeof(MppDataQueueNode); }
@@ -89,35 +368,7 @@ RETURN DATAQUEUE_Push(MppDataQueue *queue, MppDataQueueNode *node) {
     return MPP_NULL_POINTER;
   }
 
-  pthread_mutex_lock(&queue->mutex);
-
-  if (atomic_load(&queue->nCurrentNum) == queue->nMaxNum) {
-    if (queue->bInputBlock && queue->bExit == MPP_FALSE) {
-      pthread_cond_wait(&queue->inCond, &queue->mutex);
-    } else if (queue->bInputBlock && queue->bExit == MPP_TRUE) {
-      debug("get exit singal, no push wait and exit!");
-      goto exit;
-    } else {
-      goto exit;
-    }
-  }
-
-  if (atomic_load(&queue->nCurrentNum) == 0) {
-    queue->pQueueHead = node;
-    queue->pQueueTail = node;
-  } else {
-    queue->pQueueHead->next = node;
-    queue->pQueueHead = node;
-  }
-  atomic_fetch_add(&queue->nCurrentNum, 1);
-  pthread_mutex_unlock(&queue->mutex);
-  pthread_cond_signal(&queue->outCond);
-
-  return MPP_OK;
-
-exit:
-  pthread_mutex_unlock(&queue->mutex);
-  return MPP_DATAQUEUE_FULL;
+  return queue_push(queue, node);
 }
 
 MppDataQueueNode *DATAQUEUE_Pop(MppDataQueue *queue) {
@@ -126,71 +377,39 @@ MppDataQueueNode *DATAQUEUE_Pop(MppDataQueue *queue) {
     return NULL;
   }
 
-  pthread_mutex_lock(&queue->mutex);
+  return (MppDataQueueNode *)queue_pop(queue, MPP_FALSE);
+}
 
-  if (atomic_load(&queue->nCurrentNum) == 0) {
-    if (queue->bOutputBlock && queue->bExit == MPP_FALSE) {
-      pthread_cond_wait(&queue->outCond, &queue->mutex);
-    } else if (queue->bOutputBlock && queue->bExit == MPP_TRUE) {
-      debug("get exit singal, no pop wait and exit!");
-      goto exit;
-    } else {
-      goto exit;
-    }
+RETURN DATAQUEUE_PushData(MppDataQueue *queue, MppData *data) {
+  if (!queue) {
+    error("input para MppDataQueue is NULL, please check!");
+    return MPP_NULL_POINTER;
   }
 
-  // this is used for exit, after get signal, here quit
-  if (atomic_load(&queue->nCurrentNum) == 0) {
-    debug("wait up, but dataqueue is empty!");
-    goto exit;
+  if (!data) {
+    error("input para MppData is NULL, please check!");
+    return MPP_NULL_POINTER;
   }
 
-  MppDataQueueNode *tmp = queue->pQueueTail;
-  queue->pQueueTail = queue->pQueueTail->next;
-  atomic_fetch_sub(&queue->nCurrentNum, 1);
-  pthread_mutex_unlock(&queue->mutex);
-  pthread_cond_signal(&queue->inCond);
-
-  return tmp;
-
-exit:
-  pthread_mutex_unlock(&queue->mutex);
-  return NULL;
+  return queue_push(queue, data);
 }
 
-MppDataQueueNode *DATAQUEUE_First(MppDataQueue *queue) {
+MppData *DATAQUEUE_PopData(MppDataQueue *queue) {
   if (!queue) {
     error("input para MppDataQueue is NULL, please check!");
     return NULL;
   }
 
-  pthread_mutex_lock(&queue->mutex);
-
-  if (atomic_load(&queue->nCurrentNum) == 0) {
-    if (queue->bOutputBlock && queue->bExit == MPP_FALSE) {
-      pthread_cond_wait(&queue->outCond, &queue->mutex);
-    } else if (queue->bOutputBlock && queue->bExit == MPP_TRUE) {
-      debug("get singal, no pop wait and exit!");
-      goto exit;
-    } else {
-      goto exit;
-    }
-  }
+  return (MppData *)queue_pop(queue, MPP_FALSE);
+}
 
-  // this is used for exit, after get signal, here quit
-  if (atomic_load(&queue->nCurrentNum) == 0) {
-    debug("wait up, but dataqueue is empty!");
-    goto exit;
+MppDataQueueNode *DATAQUEUE_First(MppDataQueue *queue) {
+  if (!queue) {
+    error("input para MppDataQueue is NULL, please check!");
+    return NULL;
   }
 
-  MppDataQueueNode *tmp = queue->pQueueTail;
-  pthread_mutex_unlock(&queue->mutex);
-
-  return tmp;
-
-exit:
-  pthread_mutex_unlock(&queue->mutex);
-  return NULL;
+  return (MppDataQueueNode *)queue_pop(queue, MPP_TRUE);
 }
 
 RETURN DATAQUEUE_SetMaxSize(MppDataQueue *queue, S32 max_size) {
@@ -199,12 +418,14 @@ RETURN DATAQUEUE_SetMaxSize(MppDataQueue *queue, S32 max_size) {
     return MPP_NULL_POINTER;
   }
 
-  if (max_size <= 0) {
-    error("max_size is not a valid value, please check!");
+  if (max_size <= 0 || max_size > (S32)queue->nCapacity) {
+    error("max_size is not a valid value(%d, capacity %d), please check!",
+          max_size, queue->nCapacity);
     return MPP_CHECK_FAILED;
   }
 
   queue->nMaxNum = max_size;
+  wake_waiters(&queue->nInFutex, MPP_FALSE);
 
   return MPP_OK;
 }
@@ -224,7 +445,7 @@ BOOL DATAQUEUE_IsEmpty(MppDataQueue *queue) {
     return MPP_CHECK_FAILED;
   }
 
-  if (atomic_load(&queue->nCurrentNum) == 0) {
+  if (current_num(queue) == 0) {
     return MPP_TRUE;
   }
 
@@ -237,7 +458,7 @@ BOOL DATAQUEUE_IsFull(MppDataQueue *queue) {
     return MPP_CHECK_FAILED;
   }
 
-  if (queue->nMaxNum - atomic_load(&queue->nCurrentNum) == 0) {
+  if (current_num(queue) >= queue->nMaxNum) {
     return MPP_TRUE;
   }
 
@@ -250,7 +471,7 @@ S32 DATAQUEUE_GetCurrentSize(MppDataQueue *queue) {
     return MPP_NULL_POINTER;
   }
 
-  return atomic_load(&queue->nCurrentNum);
+  return current_num(queue);
 }
 
 MppData *DATAQUEUE_GetData(MppDataQueueNode *node) {
@@ -284,7 +505,11 @@ RETURN DATAQUEUE_SetWaitExit(MppDataQueue *queue, BOOL val) {
     return MPP_NULL_POINTER;
   }
 
-  queue->bExit = val;
+  atomic_store(&queue->bExit, val);
+  if (val) {
+    wake_waiters(&queue->nInFutex, MPP_TRUE);
+    wake_waiters(&queue->nOutFutex, MPP_TRUE);
+  }
 
   return MPP_OK;
 }
@@ -295,8 +520,8 @@ RETURN DATAQUEUE_Cond_BroadCast(MppDataQueue *queue) {
     return MPP_NULL_POINTER;
   }
 
-  pthread_cond_broadcast(&queue->inCond);
-  pthread_cond_broadcast(&queue->outCond);
+  wake_waiters(&queue->nInFutex, MPP_TRUE);
+  wake_waiters(&queue->nOutFutex, MPP_TRUE);
 
   return MPP_OK;
 }
@@ -307,9 +532,8 @@ void DATAQUEUE_Destory(MppDataQueue *queue) {
     return;
   }
 
-  pthread_mutex_destroy(&queue->mutex);
-  pthread_cond_destroy(&queue->inCond);
-  pthread_cond_destroy(&queue->outCond);
+  if (queue->pSlots) free(queue->pSlots);
+  if (queue->pCells) free(queue->pCells);
 
   free(queue);
   // queue = NULL;
@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-10-07 14:08:38
- * @LastEditTime: 2024-04-24 16:44:07
+ * @LastEditTime: 2024-06-02 09:12:40
  * @Description:
  */
 
@@ -13,10 +13,100 @@
 
 #include "dmabufwrapper.h"
 
+#include <pthread.h>
+
+/***
+ * buffers are recycled by size class, a class is a multiple of 64KB, so
+ * frames of the same resolution always land in the same class.
+ */
+#define DMABUF_POOL_ALIGN (64 * 1024)
+#define DMABUF_POOL_MAX_NUM 64
+#define DMABUF_POOL_DEFAULT_NUM 16
+#define DMABUF_ALIGN_SIZE(size) \
+  (((size) + DMABUF_POOL_ALIGN - 1) & ~(DMABUF_POOL_ALIGN - 1))
+
 static S32 num_of_unfree_dmabuf = 0;
 static S32 num_of_unfree_dmabufwrapper = 0;
 
-DmaBufWrapper *createDmaBufWrapper(DMAHEAP heap) {
+static const U8 *dma_heap_path[] = {"/dev/dma_heap/linux,cma",
+                                    //"/dev/dma_heap/linux,cma@70000000",
+                                    "/dev/dma_heap/system"};
+
+typedef struct _DmaBufPool {
+  pthread_mutex_t mutex;
+  BOOL bInited;
+  BOOL bNoMemset;
+
+  // opened on first use, kept for the lifetime of the process
+  S32 nDmaHeapFd[NUM_OF(dma_heap_path)];
+
+  S32 nMaxNum;
+  S32 nIdleNum;
+  struct {
+    DMAHEAP eHeap;
+    DmaBuf sDmaBuf;
+  } stIdle[DMABUF_POOL_MAX_NUM];
+} DmaBufPool;
+
+static DmaBufPool pool = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void release_dmabuf(DmaBuf *buf) {
+  if (buf->pVaddr && munmap(buf->pVaddr, buf->nSize))
+    error("munmap dma buf fail, please check!! (%s)", strerror(errno));
+  if (buf->nFd > 0 && close(buf->nFd))
+    error("close dma buf fd fail, please check!!(%s)", strerror(errno));
+  memset(buf, 0, sizeof(DmaBuf));
+}
+
+// must be called with pool.mutex held
+static void pool_init_locked() {
+  U32 num = DMABUF_POOL_DEFAULT_NUM;
+  U32 no_memset = 0;
+  S32 i;
+
+  if (pool.bInited) return;
+
+  for (i = 0; i < NUM_OF(dma_heap_path); i++) pool.nDmaHeapFd[i] = -1;
+  mpp_env_get_u32("MPP_DMABUF_POOL_NUM", &num, DMABUF_POOL_DEFAULT_NUM);
+  mpp_env_get_u32("MPP_DMABUF_NO_MEMSET", &no_memset, 0);
+  pool.nMaxNum = num > DMABUF_POOL_MAX_NUM ? DMABUF_POOL_MAX_NUM : num;
+  pool.bNoMemset = no_memset ? MPP_TRUE : MPP_FALSE;
+  pool.bInited = MPP_TRUE;
+}
+
+// must be called with pool.mutex held
+static void pool_trim_locked(S32 max_num) {
+  while (pool.nIdleNum > max_num) {
+    pool.nIdleNum--;
+    release_dmabuf(&pool.stIdle[pool.nIdleNum].sDmaBuf);
+  }
+}
+
+static S32 get_heap_fd(DMAHEAP heap) {
+  S32 fd;
+
+  pthread_mutex_lock(&pool.mutex);
+  pool_init_locked();
+  if (pool.nDmaHeapFd[heap] < 0) {
+    pool.nDmaHeapFd[heap] = open(dma_heap_path[heap], O_RDONLY | O_CLOEXEC);
+    if (pool.nDmaHeapFd[heap] < 0)
+      error("can not open (%s), fd < 0!!! (%s)", dma_heap_path[heap],
+            strerror(errno));
+  }
+  fd = pool.nDmaHeapFd[heap];
+  pthread_mutex_unlock(&pool.mutex);
+
+  return fd;
+}
+
+static DmaBufWrapper *create_wrapper(DMAHEAP heap, BOOL pooled) {
+  if (heap < 0 || heap >= NUM_OF(dma_heap_path)) {
+    error("invalid dma heap %d, please check!", heap);
+    return NULL;
+  }
+
   DmaBufWrapper *wrapper_tmp = (DmaBufWrapper *)malloc(sizeof(DmaBufWrapper));
   if (!wrapper_tmp) {
     error("can not malloc DmaBufWrapper, please check! (%s)", strerror(errno));
@@ -24,17 +114,13 @@ DmaBufWrapper *createDmaBufWrapper(DMAHEAP heap) {
   }
   memset(wrapper_tmp, 0, sizeof(DmaBufWrapper));
 
-  U8 *dma_heap_path[64] = {"/dev/dma_heap/linux,cma",
-                           //"/dev/dma_heap/linux,cma@70000000",
-                           "/dev/dma_heap/system"};
-
-  wrapper_tmp->nDmaHeapFd = open(dma_heap_path[heap], O_RDONLY | O_CLOEXEC);
+  wrapper_tmp->nDmaHeapFd = get_heap_fd(heap);
   if (wrapper_tmp->nDmaHeapFd < 0) {
-    error("can not open (%s), fd < 0!!! (%s)", dma_heap_path[heap],
-          strerror(errno));
     free(wrapper_tmp);
     return NULL;
   }
+  wrapper_tmp->eHeap = heap;
+  wrapper_tmp->bPooled = pooled;
 
   mpp_env_get_u32("MPP_PRINT_UNFREE_DMABUF",
                   &(wrapper_tmp->bEnableUnfreeDmaBufDebug), 0);
@@ -48,6 +134,86 @@ DmaBufWrapper *createDmaBufWrapper(DMAHEAP heap) {
   return wrapper_tmp;
 }
 
+DmaBufWrapper *createDmaBufWrapper(DMAHEAP heap) {
+  return create_wrapper(heap, MPP_FALSE);
+}
+
+DmaBufWrapper *createPooledDmaBufWrapper(DMAHEAP heap) {
+  return create_wrapper(heap, MPP_TRUE);
+}
+
+/***
+ * @description: take an idle buffer of the same heap and size class
+ * @return {*}: MPP_TRUE if found, the buffer is moved into context
+ */
+static BOOL pool_take(DmaBufWrapper *context, S32 size) {
+  BOOL found = MPP_FALSE;
+  S32 i;
+
+  pthread_mutex_lock(&pool.mutex);
+  for (i = pool.nIdleNum - 1; i >= 0; i--) {
+    if (pool.stIdle[i].eHeap == context->eHeap &&
+        pool.stIdle[i].sDmaBuf.nSize == size) {
+      context->sDmaBuf = pool.stIdle[i].sDmaBuf;
+      pool.stIdle[i] = pool.stIdle[--pool.nIdleNum];
+      found = MPP_TRUE;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&pool.mutex);
+
+  return found;
+}
+
+/***
+ * @description: give the buffer of context back to the pool
+ * @return {*}: MPP_TRUE if the pool keeps it
+ */
+static BOOL pool_give(DmaBufWrapper *context) {
+  BOOL kept = MPP_FALSE;
+
+  pthread_mutex_lock(&pool.mutex);
+  if (pool.nIdleNum < pool.nMaxNum) {
+    pool.stIdle[pool.nIdleNum].eHeap = context->eHeap;
+    pool.stIdle[pool.nIdleNum].sDmaBuf = context->sDmaBuf;
+    pool.nIdleNum++;
+    kept = MPP_TRUE;
+  }
+  pthread_mutex_unlock(&pool.mutex);
+
+  return kept;
+}
+
+/***
+ * @description: clear the buffer before its fd is given out, a device may
+ * write it before the CPU maps it. The pooled wrapper keeps the mapping, the
+ * plain one leaves mapping to its caller.
+ */
+static RETURN clear_dmabuf(DmaBufWrapper *context) {
+  void *vaddr = context->sDmaBuf.pVaddr;
+
+  // the memset costs a full write of the buffer, skip it if not needed
+  if (pool.bNoMemset) return MPP_OK;
+
+  if (!vaddr) {
+    vaddr = mmap(0, context->sDmaBuf.nSize, PROT_READ | PROT_WRITE,
+                 MAP_SHARED, context->sDmaBuf.nFd, 0);
+    if (vaddr == MAP_FAILED) {
+      error("can not mmap dma buf, please check! (%s)", strerror(errno));
+      return MPP_MMAP_FAILED;
+    }
+  }
+
+  memset(vaddr, 0, context->sDmaBuf.nSize);
+
+  if (context->bPooled)
+    context->sDmaBuf.pVaddr = vaddr;
+  else if (vaddr != context->sDmaBuf.pVaddr)
+    munmap(vaddr, context->sDmaBuf.nSize);
+
+  return MPP_OK;
+}
+
 S32 allocDmaBuf(DmaBufWrapper *context, S32 size) {
   if (!context) {
     error("input para context is NULL, please check!");
@@ -64,6 +230,14 @@ S32 allocDmaBuf(DmaBufWrapper *context, S32 size) {
     return MPP_CHECK_FAILED;
   }
 
+  if (context->bPooled) {
+    size = DMABUF_ALIGN_SIZE(size);
+    if (pool_take(context, size)) {
+      debug("reuse dma buf from pool! fd = %d", context->sDmaBuf.nFd);
+      goto finish;
+    }
+  }
+
   struct dma_heap_allocation_data heap_data;
   memset(&heap_data, 0, sizeof(struct dma_heap_allocation_data));
   heap_data.len = size;
@@ -78,16 +252,23 @@ S32 allocDmaBuf(DmaBufWrapper *context, S32 size) {
 
   debug("alloc dma buf success! fd = %d", heap_data.fd);
 
+  context->sDmaBuf.nFd = heap_data.fd;
+  context->sDmaBuf.nSize = size;
+  context->sDmaBuf.pVaddr = NULL;
+
+finish:
+  if (clear_dmabuf(context)) {
+    release_dmabuf(&(context->sDmaBuf));
+    return MPP_MMAP_FAILED;
+  }
+
   if (context->bEnableUnfreeDmaBufDebug) {
     num_of_unfree_dmabuf++;
     info("++++++++++ debug dmabufwrapper memory: num of unfree dmabuf: %d",
          num_of_unfree_dmabuf);
   }
 
-  context->sDmaBuf.nFd = heap_data.fd;
-  context->sDmaBuf.nSize = size;
-
-  return heap_data.fd;
+  return context->sDmaBuf.nFd;
 }
 
 void *mmapDmaBuf(DmaBufWrapper *context) {
@@ -101,16 +282,17 @@ void *mmapDmaBuf(DmaBufWrapper *context) {
     return NULL;
   }
 
-  context->sDmaBuf.pVaddr =
-      (void *)mmap(0, context->sDmaBuf.nSize, PROT_READ | PROT_WRITE,
-                   MAP_SHARED, context->sDmaBuf.nFd, 0);
-  if (context->sDmaBuf.pVaddr == MAP_FAILED) {
-    error("can not mmap dma buf, please check! (%s)", strerror(errno));
-    return NULL;
+  if (!context->sDmaBuf.pVaddr) {
+    void *vaddr = (void *)mmap(0, context->sDmaBuf.nSize,
+                               PROT_READ | PROT_WRITE, MAP_SHARED,
+                               context->sDmaBuf.nFd, 0);
+    if (vaddr == MAP_FAILED) {
+      error("can not mmap dma buf, please check! (%s)", strerror(errno));
+      return NULL;
+    }
+    context->sDmaBuf.pVaddr = vaddr;
   }
 
-  memset(context->sDmaBuf.pVaddr, 0, context->sDmaBuf.nSize);
-
   return context->sDmaBuf.pVaddr;
 }
 
@@ -120,17 +302,21 @@ RETURN freeDmaBuf(DmaBufWrapper *context) {
     return MPP_NULL_POINTER;
   }
 
-  if (context->sDmaBuf.pVaddr) {
-    if (munmap(context->sDmaBuf.pVaddr, context->sDmaBuf.nSize)) {
-      error("munmap dma buf fail, please check!! (%s)", strerror(errno));
-      return MPP_MUNMAP_FAILED;
+  if (context->bPooled && context->sDmaBuf.nFd > 0 && pool_give(context)) {
+    debug("give dma buf back to pool! fd = %d", context->sDmaBuf.nFd);
+  } else {
+    if (context->sDmaBuf.pVaddr) {
+      if (munmap(context->sDmaBuf.pVaddr, context->sDmaBuf.nSize)) {
+        error("munmap dma buf fail, please check!! (%s)", strerror(errno));
+        return MPP_MUNMAP_FAILED;
+      }
     }
-  }
 
-  if (context->sDmaBuf.nFd > 0) {
-    if (close(context->sDmaBuf.nFd)) {
-      error("close dma buf fd fail, please check!!(%s)", strerror(errno));
-      return MPP_CLOSE_FAILED;
+    if (context->sDmaBuf.nFd > 0) {
+      if (close(context->sDmaBuf.nFd)) {
+        error("close dma buf fd fail, please check!!(%s)", strerror(errno));
+        return MPP_CLOSE_FAILED;
+      }
     }
   }
 
@@ -140,18 +326,31 @@ RETURN freeDmaBuf(DmaBufWrapper *context) {
          num_of_unfree_dmabuf);
   }
 
-  context->sDmaBuf.nFd = 0;
-  context->sDmaBuf.nSize = 0;
-  context->sDmaBuf.pVaddr = NULL;
+  memset(&(context->sDmaBuf), 0, sizeof(DmaBuf));
 
   return MPP_OK;
 }
 
+void setDmaBufPoolSize(S32 num) {
+  pthread_mutex_lock(&pool.mutex);
+  pool_init_locked();
+  if (num < 0) num = 0;
+  pool.nMaxNum = num > DMABUF_POOL_MAX_NUM ? DMABUF_POOL_MAX_NUM : num;
+  pool_trim_locked(pool.nMaxNum);
+  pthread_mutex_unlock(&pool.mutex);
+}
+
+void drainDmaBufPool() {
+  pthread_mutex_lock(&pool.mutex);
+  pool_trim_locked(0);
+  pthread_mutex_unlock(&pool.mutex);
+}
+
 S32 getDmaHeapFd(DmaBufWrapper *context) { return context->nDmaHeapFd; }
 
 void destoryDmaBufWrapper(DmaBufWrapper *context) {
   if (context) {
-    close(context->nDmaHeapFd);
+    // the heap fd is shared by all wrappers, do not close it here
     if (context->bEnableUnfreeDmaBufDebug) {
       num_of_unfree_dmabufwrapper--;
       info("---------- debug dmabufwrapper memory: num of unfree wrapper: %d",
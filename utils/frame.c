@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-13 18:10:10
- * @LastEditTime: 2024-04-24 17:16:59
+ * @LastEditTime: 2024-06-02 11:12:05
  * @Description:
  */
 
@@ -17,6 +17,8 @@
 #include <fcntl.h>
 #include <linux/dma-buf.h>
 #include <linux/dma-heap.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -62,13 +64,56 @@ struct _MppFrame {
   U8 *pData3;
   void *pMetaData;
   S32 nFd[MPP_MAX_PLANES];
-  U32 refCount;
+  atomic_uint refCount;
   DmaBufWrapper *pDmaBufWrapper;
 
+  /**
+   * called once when FRAME_UnRef drops the last reference, so a producer
+   * can lend its own buffer and get it back without copying.
+   */
+  MppFrameReleaseCallback pReleaseCallback;
+  void *pReleaseOpaque;
+
+  /**
+   * set on frames owned by a MppFramePool, pPoolSelf tells the original
+   * frame from a struct copy of it (plugins memcpy frames to the caller).
+   */
+  MppFramePool *pPool;
+  MppFrame *pPoolSelf;
+
   // environment variable
   BOOL bEnableUnfreeFrameDebug;
 };
 
+struct _MppFramePool {
+  pthread_mutex_t mutex;
+  MppFrameBufferType eBufferType;
+  MppPixelFormat ePixelFormat;
+  S32 nWidth;
+  S32 nHeight;
+  S32 nMaxNum;
+
+  // idle frames, a stack so the most recently used (cache hot) goes first
+  MppFrame **pIdle;
+  S32 nIdleNum;
+  MppFramePoolStat stStat;
+  BOOL bDestoryed;
+};
+
+/**
+ * read the environment once per process, not on every FRAME_Create
+ */
+static pthread_once_t frame_env_once = PTHREAD_ONCE_INIT;
+static U32 enable_unfree_frame_debug = 0;
+
+static void frame_env_init() {
+  mpp_env_get_u32("MPP_PRINT_UNFREE_FRAME", &enable_unfree_frame_debug, 0);
+}
+
+static BOOL is_pooled(MppFrame *frame) {
+  return frame->pPool && frame->pPoolSelf == frame;
+}
+
 MppFrame *FRAME_Create() {
   MppFrame *frame = (MppFrame *)malloc(sizeof(MppFrame));
 
@@ -78,8 +123,8 @@ MppFrame *FRAME_Create() {
   }
   memset(frame, 0, sizeof(MppFrame));
 
-  mpp_env_get_u32("MPP_PRINT_UNFREE_FRAME", &(frame->bEnableUnfreeFrameDebug),
-                  0);
+  pthread_once(&frame_env_once, frame_env_init);
+  frame->bEnableUnfreeFrameDebug = enable_unfree_frame_debug;
 
   if (frame->bEnableUnfreeFrameDebug) {
     num_of_unfree_frame++;
@@ -89,7 +134,7 @@ MppFrame *FRAME_Create() {
 
   frame->nDataUsedNum = 1;
   frame->eBufferType = MPP_FRAME_BUFFERTYPE_NORMAL_INTERNAL;
-  frame->refCount = 1;
+  atomic_init(&frame->refCount, 1);
 
   return frame;
 }
@@ -99,6 +144,7 @@ S32 FRAME_GetStructSize() { return sizeof(MppFrame); }
 RETURN FRAME_Alloc(MppFrame *frame, MppPixelFormat pixelformat, S32 width,
                    S32 height) {
   S32 size[3];
+  S32 bytes = 1;
   S32 i;
   S32 ret = 0;
   S32 fd = 0;
@@ -133,21 +179,36 @@ RETURN FRAME_Alloc(MppFrame *frame, MppPixelFormat pixelformat, S32 width,
         size[2] = (width / 2) * height;
         frame->nDataUsedNum = 3;
         break;
+      case PIXEL_FORMAT_YUV444P:
+        size[0] = width * height;
+        size[1] = width * height;
+        size[2] = width * height;
+        frame->nDataUsedNum = 3;
+        break;
       case PIXEL_FORMAT_NV12:
       case PIXEL_FORMAT_NV21:
         size[0] = width * height;
         size[1] = (width / 2) * height;
         frame->nDataUsedNum = 2;
         break;
+      case PIXEL_FORMAT_NV12_P010:
+        // 2 bytes a sample, height / 2 rows of interleaved uv
+        bytes = 2;
+        size[0] = width * height * 2;
+        size[1] = width * height;
+        frame->nDataUsedNum = 2;
+        break;
       case PIXEL_FORMAT_RGBA:
       case PIXEL_FORMAT_ARGB:
       case PIXEL_FORMAT_BGRA:
       case PIXEL_FORMAT_ABGR:
+        bytes = 4;
         size[0] = width * height * 4;
         frame->nDataUsedNum = 1;
         break;
       case PIXEL_FORMAT_YUYV:
       case PIXEL_FORMAT_UYVY:
+        bytes = 2;
         size[0] = width * height * 2;
         frame->nDataUsedNum = 1;
         break;
@@ -157,6 +218,9 @@ RETURN FRAME_Alloc(MppFrame *frame, MppPixelFormat pixelformat, S32 width,
     }
 
     frame->ePixelFormat = pixelformat;
+    frame->nWidth = width;
+    frame->nHeight = height;
+    frame->nLineStride = width * bytes;
 
     for (i = 0; i < frame->nDataUsedNum; i++) {
       if (i == 0) {
@@ -191,7 +255,7 @@ RETURN FRAME_Alloc(MppFrame *frame, MppPixelFormat pixelformat, S32 width,
   } else if (MPP_FRAME_BUFFERTYPE_DMABUF_INTERNAL == frame->eBufferType) {
     frame->nDataUsedNum = 1;
 
-    frame->pDmaBufWrapper = createDmaBufWrapper(DMA_HEAP_CMA);
+    frame->pDmaBufWrapper = createPooledDmaBufWrapper(DMA_HEAP_CMA);
     if (!frame->pDmaBufWrapper) {
       return MPP_NULL_POINTER;
     }
@@ -202,8 +266,8 @@ RETURN FRAME_Alloc(MppFrame *frame, MppPixelFormat pixelformat, S32 width,
     }
     debug("alloc dma buf success! fd = %d", frame->nFd[0]);
 
-    frame->pData0 = (U8 *)mmapDmaBuf(frame->pDmaBufWrapper);
-    debug("dma buf mmap success! pData0 = %p", frame->pData0);
+    // mmap lazily in FRAME_GetDataPointer, zero-copy users only need the fd
+    frame->pData0 = NULL;
 
     if (frame->bEnableUnfreeFrameDebug) num_of_unfree_data++;
 
@@ -223,6 +287,9 @@ RETURN FRAME_Free(MppFrame *frame) {
     return MPP_NULL_POINTER;
   }
 
+  // the buffer belongs to the pool, it is released with the pool
+  if (is_pooled(frame)) return MPP_OK;
+
   if (MPP_FRAME_BUFFERTYPE_NORMAL_INTERNAL == frame->eBufferType) {
     if (frame->pData0) {
       free(frame->pData0);
@@ -247,12 +314,18 @@ RETURN FRAME_Free(MppFrame *frame) {
     }
 
     destoryDmaBufWrapper(frame->pDmaBufWrapper);
+    frame->pDmaBufWrapper = NULL;
+    frame->pData0 = NULL;
+    frame->nFd[0] = 0;
 
     if (frame->bEnableUnfreeFrameDebug) {
       num_of_unfree_data--;
       info("debug frame memory: num of unfree frame data: %d",
            num_of_unfree_data);
     }
+  } else if (MPP_FRAME_BUFFERTYPE_NORMAL_EXTERNAL == frame->eBufferType ||
+             MPP_FRAME_BUFFERTYPE_DMABUF_EXTERNAL == frame->eBufferType) {
+    // the buffer is owned by someone else, nothing to free
   } else {
     error("unsupported buffertype, please check!!");
     return MPP_NOT_SUPPORTED_FORMAT;
@@ -320,6 +393,12 @@ void *FRAME_GetDataPointer(MppFrame *frame, S32 data_num) {
 
   switch (data_num) {
     case 0:
+      if (!frame->pData0 &&
+          MPP_FRAME_BUFFERTYPE_DMABUF_INTERNAL == frame->eBufferType &&
+          frame->pDmaBufWrapper) {
+        frame->pData0 = (U8 *)mmapDmaBuf(frame->pDmaBufWrapper);
+        debug("dma buf mmap success! pData0 = %p", frame->pData0);
+      }
       return (void *)(frame->pData0);
       break;
     case 1:
@@ -344,11 +423,7 @@ RETURN FRAME_SetDataPointer(MppFrame *frame, S32 data_num, U8 *data) {
     return MPP_NULL_POINTER;
   }
 
-  if (!data) {
-    error("input para data is NULL, please check!");
-    return MPP_NULL_POINTER;
-  }
-
+  // data may be NULL, it clears the plane (e.g. when a lent buffer returns)
   if (data_num < 0 || data_num >= frame->nDataUsedNum) {
     error("input para data_num is not valid %d %d, please check!", data_num,
           frame->nDataUsedNum);
@@ -406,36 +481,75 @@ U32 FRAME_Ref(MppFrame *frame) {
     return MPP_NULL_POINTER;
   }
 
-  frame->refCount++;
-
-  return frame->refCount;
+  return atomic_fetch_add_explicit(&frame->refCount, 1,
+                                   memory_order_relaxed) +
+         1;
 }
+
 U32 FRAME_UnRef(MppFrame *frame) {
+  MppFrameReleaseCallback callback = NULL;
+  void *opaque = NULL;
+  U32 count;
+
   if (!frame) {
     error("input para MppFrame is NULL, please check!");
     return MPP_NULL_POINTER;
   }
 
-  if (frame->refCount == 0) {
-    error("frame unref error, please check!");
-    return MPP_CHECK_FAILED;
-  }
+  // never go below 0, a wrong extra unref must not wrap the count
+  count = atomic_load_explicit(&frame->refCount, memory_order_relaxed);
+  do {
+    if (count == 0) {
+      error("frame unref error, please check!");
+      return MPP_CHECK_FAILED;
+    }
+  } while (!atomic_compare_exchange_weak_explicit(
+      &frame->refCount, &count, count - 1, memory_order_acq_rel,
+      memory_order_relaxed));
 
-  if (frame->refCount == 1) {
+  if (count == 1) {
     debug("frame unref to 0, need to be free.");
+    // one shot, the owner sets it again when it lends the buffer again
+    callback = frame->pReleaseCallback;
+    opaque = frame->pReleaseOpaque;
+    frame->pReleaseCallback = NULL;
+    frame->pReleaseOpaque = NULL;
+    if (callback) callback(frame, opaque);
   }
 
-  frame->refCount--;
-
-  return frame->refCount;
+  return count - 1;
 }
+
 U32 FRAME_GetRef(MppFrame *frame) {
   if (!frame) {
     error("input para MppFrame is NULL, please check!");
     return MPP_NULL_POINTER;
   }
 
-  return frame->refCount;
+  return atomic_load_explicit(&frame->refCount, memory_order_acquire);
+}
+
+RETURN FRAME_SetReleaseCallback(MppFrame *frame,
+                                MppFrameReleaseCallback callback,
+                                void *opaque) {
+  if (!frame) {
+    error("input para MppFrame is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  frame->pReleaseCallback = callback;
+  frame->pReleaseOpaque = opaque;
+
+  return MPP_OK;
+}
+
+void *FRAME_GetReleaseOpaque(MppFrame *frame) {
+  if (!frame) {
+    error("input para MppFrame is NULL, please check!");
+    return NULL;
+  }
+
+  return frame->pReleaseOpaque;
 }
 
 S32 FRAME_GetID(MppFrame *frame) {
@@ -667,6 +781,11 @@ void FRAME_Destory(MppFrame *frame) {
     return;
   }
 
+  if (is_pooled(frame)) {
+    FRAMEPOOL_PutFrame(frame);
+    return;
+  }
+
   if (frame->bEnableUnfreeFrameDebug) {
     num_of_unfree_frame--;
     info("---------- debug frame memory: num of unfree frame: %d",
@@ -675,3 +794,208 @@ void FRAME_Destory(MppFrame *frame) {
 
   free(frame);
 }
+
+/**
+ * @description: create and alloc one frame owned by the pool
+ */
+static MppFrame *pool_new_frame(MppFramePool *pool) {
+  MppFrame *frame = FRAME_Create();
+  if (!frame) return NULL;
+
+  frame->eBufferType = pool->eBufferType;
+  if (FRAME_Alloc(frame, pool->ePixelFormat, pool->nWidth, pool->nHeight)) {
+    error("can not alloc frame of the pool, please check!");
+    FRAME_Destory(frame);
+    return NULL;
+  }
+
+  frame->pPool = pool;
+  frame->pPoolSelf = frame;
+
+  return frame;
+}
+
+/**
+ * @description: free a frame owned by the pool, detach it first so that
+ * FRAME_Free/FRAME_Destory really release it.
+ */
+static void pool_delete_frame(MppFrame *frame) {
+  frame->pPool = NULL;
+  frame->pPoolSelf = NULL;
+  FRAME_Free(frame);
+  FRAME_Destory(frame);
+}
+
+static void pool_release(MppFramePool *pool) {
+  pthread_mutex_destroy(&pool->mutex);
+  free(pool->pIdle);
+  free(pool);
+}
+
+MppFramePool *FRAMEPOOL_Create(MppFrameBufferType eBufferType,
+                               MppPixelFormat pixelformat, S32 width,
+                               S32 height, S32 init_num, S32 max_num) {
+  MppFramePool *pool = NULL;
+  MppFrame *frame = NULL;
+  S32 i;
+
+  if (init_num < 0 || max_num <= 0 || init_num > max_num) {
+    error("invalid init_num %d or max_num %d, please check!", init_num,
+          max_num);
+    return NULL;
+  }
+
+  pool = (MppFramePool *)malloc(sizeof(MppFramePool));
+  if (!pool) {
+    error("can not malloc MppFramePool, please check! (%s)", strerror(errno));
+    return NULL;
+  }
+  memset(pool, 0, sizeof(MppFramePool));
+
+  pool->pIdle = (MppFrame **)malloc(max_num * sizeof(MppFrame *));
+  if (!pool->pIdle) {
+    error("can not malloc idle list of MppFramePool, please check!");
+    free(pool);
+    return NULL;
+  }
+
+  pthread_mutex_init(&pool->mutex, NULL);
+  pool->eBufferType = eBufferType;
+  pool->ePixelFormat = pixelformat;
+  pool->nWidth = width;
+  pool->nHeight = height;
+  pool->nMaxNum = max_num;
+
+  for (i = 0; i < init_num; i++) {
+    frame = pool_new_frame(pool);
+    if (!frame) {
+      FRAMEPOOL_Destory(pool);
+      return NULL;
+    }
+    pool->pIdle[pool->nIdleNum++] = frame;
+    pool->stStat.nTotalNum++;
+  }
+
+  debug("create frame pool %p: %dx%d format %d, %d/%d frames", pool, width,
+        height, pixelformat, init_num, max_num);
+
+  return pool;
+}
+
+MppFrame *FRAMEPOOL_GetFrame(MppFramePool *pool) {
+  MppFrame *frame = NULL;
+  BOOL grow = MPP_FALSE;
+
+  if (!pool) {
+    error("input para MppFramePool is NULL, please check!");
+    return NULL;
+  }
+
+  pthread_mutex_lock(&pool->mutex);
+  if (pool->nIdleNum) {
+    frame = pool->pIdle[--pool->nIdleNum];
+  } else {
+    pool->stStat.nMissCount++;
+    if (pool->stStat.nTotalNum < pool->nMaxNum) {
+      // reserve the slot, alloc outside of the lock
+      pool->stStat.nTotalNum++;
+      grow = MPP_TRUE;
+    }
+  }
+  if (frame || grow) {
+    pool->stStat.nGetCount++;
+    pool->stStat.nInUseNum++;
+    if (pool->stStat.nInUseNum > pool->stStat.nHighWaterNum)
+      pool->stStat.nHighWaterNum = pool->stStat.nInUseNum;
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  if (grow) {
+    frame = pool_new_frame(pool);
+    if (!frame) {
+      pthread_mutex_lock(&pool->mutex);
+      pool->stStat.nTotalNum--;
+      pool->stStat.nInUseNum--;
+      pool->stStat.nGetCount--;
+      pthread_mutex_unlock(&pool->mutex);
+    }
+  }
+
+  if (!frame) return NULL;
+
+  frame->nPts = 0;
+  frame->bEos = FRAME_NO_EOS;
+  frame->nID = 0;
+  frame->pMetaData = NULL;
+  frame->pReleaseCallback = NULL;
+  frame->pReleaseOpaque = NULL;
+  atomic_store(&frame->refCount, 1);
+
+  return frame;
+}
+
+RETURN FRAMEPOOL_PutFrame(MppFrame *frame) {
+  MppFramePool *pool = NULL;
+  BOOL release_pool = MPP_FALSE;
+
+  if (!frame) {
+    error("input para MppFrame is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  if (!is_pooled(frame)) {
+    error("the frame %p is not got from a pool, please check!", frame);
+    return MPP_CHECK_FAILED;
+  }
+
+  pool = frame->pPool;
+  pthread_mutex_lock(&pool->mutex);
+  pool->stStat.nInUseNum--;
+  if (pool->bDestoryed) {
+    pool->stStat.nTotalNum--;
+    release_pool = pool->stStat.nInUseNum == 0;
+  } else {
+    pool->pIdle[pool->nIdleNum++] = frame;
+    frame = NULL;
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  // the pool is destoryed, free the frame and the pool after the last one
+  if (frame) pool_delete_frame(frame);
+  if (release_pool) pool_release(pool);
+
+  return MPP_OK;
+}
+
+RETURN FRAMEPOOL_GetStat(MppFramePool *pool, MppFramePoolStat *stat) {
+  if (!pool || !stat) {
+    error("input para MppFramePool or stat is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  pthread_mutex_lock(&pool->mutex);
+  *stat = pool->stStat;
+  pthread_mutex_unlock(&pool->mutex);
+
+  return MPP_OK;
+}
+
+void FRAMEPOOL_Destory(MppFramePool *pool) {
+  BOOL release_pool = MPP_FALSE;
+
+  if (!pool) {
+    error("input para MppFramePool is NULL, please check!");
+    return;
+  }
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->bDestoryed = MPP_TRUE;
+  while (pool->nIdleNum) {
+    pool_delete_frame(pool->pIdle[--pool->nIdleNum]);
+    pool->stStat.nTotalNum--;
+  }
+  release_pool = pool->stStat.nInUseNum == 0;
+  pthread_mutex_unlock(&pool->mutex);
+
+  if (release_pool) pool_release(pool);
+}
@@ -5,8 +5,9 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-13 18:11:03
- * @LastEditTime: 2023-02-02 14:48:41
- * @Description:
+ * @LastEditTime: 2024-06-02 11:52:18
+ * @Description: the log macros (error/info/debug), gated by a runtime level
+ *               and written asynchronously by a log thread, see log.c
  */
 
 #ifndef __MPP_LOG_H__
@@ -19,34 +20,37 @@
 
 #define gettid() syscall(SYS_gettid)
 
-#define USE_PRINTF 1
-
-#if USE_PRINTF
-#define error(fmt, ...)                                                       \
-  printf("[MPP-ERROR] %ld:%s:%d " fmt "\n", gettid(), __FUNCTION__, __LINE__, \
-         ##__VA_ARGS__)
-// fprintf(stderr, "%ld:%s:%d " fmt "\n", gettid(), __FUNCTION__, __LINE__,
-// ##__VA_ARGS__)
-#define info(fmt, ...)                                                       \
-  printf("[MPP-INFO] %ld:%s:%d " fmt "\n", gettid(), __FUNCTION__, __LINE__, \
-         ##__VA_ARGS__)
-// fprintf(stderr, "%ld:%s:%d " fmt "\n", gettid(), __FUNCTION__, __LINE__,
-// ##__VA_ARGS__)
+#define USE_ASYNC_LOG 1
+
+/***
+ * the level is checked by the caller with one relaxed load, a line which is
+ * not printed costs no call. The printed lines are formatted by the caller
+ * into a ring of its thread and written to the sink by the log thread.
+ */
+#define mpp_log_on(level) \
+  ((level) <= __atomic_load_n(&mpp_log_level, __ATOMIC_RELAXED))
+#define mpp_log_print(level, prefix, fmt, ...)                    \
+  (mpp_log_on(level) ? mpp_log_write(level, prefix, fmt, ##__VA_ARGS__) \
+                     : (void)0)
+
+#if USE_ASYNC_LOG
+#define error(fmt, ...)                                                \
+  mpp_log_print(MPP_LOG_ERROR, MPP_TRUE, "%s:%d " fmt "\n", __FUNCTION__, \
+                __LINE__, ##__VA_ARGS__)
+#define info(fmt, ...)                                                \
+  mpp_log_print(MPP_LOG_INFO, MPP_TRUE, "%s:%d " fmt "\n", __FUNCTION__, \
+                __LINE__, ##__VA_ARGS__)
 #if ENABLE_DEBUG
-#define debug(fmt, ...)                                                       \
-  printf("[MPP-DEBUG] %ld:%s:%d " fmt "\n", gettid(), __FUNCTION__, __LINE__, \
-         ##__VA_ARGS__)
-// fprintf(stderr, "%ld:%s:%d " fmt "\n", gettid(), __FUNCTION__, __LINE__,
-// ##__VA_ARGS__)
-#define debug_pre(fmt, ...)                                                  \
-  printf("[MPP-DEBUG] %ld:%s:%d " fmt " ", gettid(), __FUNCTION__, __LINE__, \
-         ##__VA_ARGS__)
-// fprintf(stderr, "%ld:%s:%d " fmt " ", gettid(), __FUNCTION__, __LINE__,
-// ##__VA_ARGS__)
-#define debug_mid(fmt, ...) printf(" " fmt " ", ##__VA_ARGS__)
-// fprintf(stderr, " " fmt " ", ##__VA_ARGS__)
-#define debug_after(fmt, ...) printf(" " fmt "\n", ##__VA_ARGS__)
-// fprintf(stderr, " " fmt "\n", ##__VA_ARGS__)
+#define debug(fmt, ...)                                                \
+  mpp_log_print(MPP_LOG_DEBUG, MPP_TRUE, "%s:%d " fmt "\n", __FUNCTION__, \
+                __LINE__, ##__VA_ARGS__)
+#define debug_pre(fmt, ...)                                           \
+  mpp_log_print(MPP_LOG_DEBUG, MPP_TRUE, "%s:%d " fmt " ", __FUNCTION__, \
+                __LINE__, ##__VA_ARGS__)
+#define debug_mid(fmt, ...) \
+  mpp_log_print(MPP_LOG_DEBUG, MPP_FALSE, " " fmt " ", ##__VA_ARGS__)
+#define debug_after(fmt, ...) \
+  mpp_log_print(MPP_LOG_DEBUG, MPP_FALSE, " " fmt "\n", ##__VA_ARGS__)
 #else
 #define debug(fmt, ...) \
   do {                  \
@@ -73,6 +77,11 @@
 #define MPP_LOG_VERBOSE 6  // Verbose log
 #define MPP_LOG_SILENT 7   // internal use only
 
+#define MPP_LOG_SINK_STDOUT 0  // default
+#define MPP_LOG_SINK_FILE 1    // a file, truncated when opened
+#define MPP_LOG_SINK_SYSLOG 2  // syslog, the lines get no prefix of ours
+#define MPP_LOG_SINK_STDERR 3
+
 #define mpp_logf(fmt, ...) \
   _mpp_log_l(MPP_LOG_FATAL, MODULE_TAG, fmt, NULL, ##__VA_ARGS__)
 #define mpp_loge(fmt, ...) \
@@ -97,6 +106,41 @@
 extern "C" {
 #endif
 
+/***
+ * the runtime level, MPP_LOG_LEVEL of the environment (MPP_LOG_INFO if not
+ * set), read it by mpp_log_on, change it by mpp_set_log_level
+ */
+extern int mpp_log_level;
+
+/**
+ * @description: format one record into the ring of the calling thread, the
+ * log thread writes "[MPP-LEVEL] seconds.ms tid:" (if prefix) and the text.
+ * Waits if the ring is full, no line is dropped.
+ * @param {int} level
+ * @param {int} prefix
+ * @param {char} *fmt
+ * @return {*}
+ */
+void mpp_log_write(int level, int prefix, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/**
+ * @description: wait until the log thread has written all the records
+ * logged so far, and flush the sink
+ * @return {*}
+ */
+void mpp_log_flush(void);
+
+/**
+ * @description: the sink of the log thread, MPP_LOG_FILE of the environment
+ * at start (a path, "stderr" or "syslog"), stdout if not set
+ * @param {int} sink : MPP_LOG_SINK_STDOUT, MPP_LOG_SINK_STDERR,
+ * MPP_LOG_SINK_FILE or MPP_LOG_SINK_SYSLOG
+ * @param {char} *path : the file of MPP_LOG_SINK_FILE
+ * @return {*}: MPP_OK, MPP_OPEN_FAILED (the sink is not changed then)
+ */
+RETURN mpp_set_log_sink(int sink, const char *path);
+
 /**
  * @description:
  * @param {int} level
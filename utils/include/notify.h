@@ -0,0 +1,55 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-20 10:12:31
+ * @LastEditTime: 2024-05-20 16:40:02
+ * @Description: eventfd based notification between AL layer and mpi layer,
+ *               the producer signals, the consumer blocks in poll/epoll.
+ */
+
+#ifndef __MPP_NOTIFY_H__
+#define __MPP_NOTIFY_H__
+
+#include "type.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @description: create a non-blocking eventfd used as notifier
+ * @return {*}: fd > 0 on success, < 0 on failure
+ */
+S32 mpp_notify_create();
+
+/**
+ * @description: wake up the waiter of the notifier, fd <= 0 is ignored, so the
+ * AL layer can call it unconditionally even if nobody listens.
+ * @param {S32} fd: the notifier fd
+ * @return {*}
+ */
+void mpp_notify_signal(S32 fd);
+
+/**
+ * @description: consume all pending notifications, call it after the waiter
+ * wakes up and before it polls the data source again.
+ * @param {S32} fd: the notifier fd
+ * @return {*}
+ */
+void mpp_notify_clear(S32 fd);
+
+/**
+ * @description: close the notifier
+ * @param {S32} fd: the notifier fd
+ * @return {*}
+ */
+void mpp_notify_destory(S32 fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__MPP_NOTIFY_H__*/
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-23 10:36:18
+ * @LastEditTime: 2024-05-23 10:36:18
+ * @Description: start code and marker search for the stream parsers, the
+ *               best implementation for the cpu is picked at first use.
+ */
+
+#ifndef __MPP_STARTCODE_H__
+#define __MPP_STARTCODE_H__
+
+#include "type.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @description: find the first Annex-B start code (00 00 01) in [data, end).
+ * A 4 bytes start code (00 00 00 01) is reported at its last 3 bytes, check
+ * the byte before the result if the caller needs it.
+ * @param {U8} *data
+ * @param {U8} *end
+ * @return {*}: pointer to the first 00 of the start code, or end if none
+ */
+const U8 *mpp_find_start_code(const U8 *data, const U8 *end);
+
+/**
+ * @description: the plain C version of mpp_find_start_code, for tests and
+ * benchmarks that compare against it.
+ * @param {U8} *data
+ * @param {U8} *end
+ * @return {*}
+ */
+const U8 *mpp_find_start_code_c(const U8 *data, const U8 *end);
+
+/**
+ * @description: find the first jpeg SOI (ff d8) or EOI (ff d9) marker in
+ * [data, end).
+ * @param {U8} *data
+ * @param {U8} *end
+ * @return {*}: pointer to the ff of the marker, or end if none
+ */
+const U8 *mpp_find_jpeg_marker(const U8 *data, const U8 *end);
+
+/**
+ * @description: name of the implementation in use, e.g. "avx2"
+ * @return {*}
+ */
+const char *mpp_find_start_code_impl();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__MPP_STARTCODE_H__*/
@@ -5,8 +5,10 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-10 15:52:19
- * @LastEditTime: 2023-02-02 14:53:49
- * @Description:
+ * @LastEditTime: 2024-06-02 09:40:15
+ * @Description: some V4L2 utils, the /dev/video* devices are probed once
+ *               into a table shared by all channels of the process, it is
+ *               probed again when a video node is added or removed.
  */
 
 #ifndef _MPP_V4L2_UTILS_H_
@@ -27,6 +29,57 @@ typedef struct _DeviceInfo {
   DeviceType type;
 } DeviceInfo;
 
+#define MPP_V4L2_MAX_DEVICE_NUM 32
+#define MPP_V4L2_MAX_FORMAT_NUM 32
+
+typedef struct _V4l2FormatInfo {
+  U32 nFourcc;
+
+  /***
+   * from VIDIOC_ENUM_FRAMESIZES, all 0 if the driver does not tell
+   */
+  U32 nMinWidth;
+  U32 nMaxWidth;
+  U32 nMinHeight;
+  U32 nMaxHeight;
+} V4l2FormatInfo;
+
+/***
+ * what VIDIOC_QUERYCAP and VIDIOC_ENUM_FMT say about one device, single and
+ * multi planar formats of a queue are in one list
+ */
+typedef struct _V4l2DeviceInfo {
+  U8 sDevicePath[20];
+  U8 sDriver[16];
+  U8 sCard[32];
+  U32 nDeviceCaps;
+  S32 nOutputFormatNum;
+  V4l2FormatInfo stOutputFormat[MPP_V4L2_MAX_FORMAT_NUM];
+  S32 nCaptureFormatNum;
+  V4l2FormatInfo stCaptureFormat[MPP_V4L2_MAX_FORMAT_NUM];
+} V4l2DeviceInfo;
+
+/**
+ * @description: number of devices in the table
+ * @return {*}
+ */
+S32 mpp_v4l2_get_device_num();
+
+/**
+ * @description: copy one device of the table
+ * @param {S32} index
+ * @param {V4l2DeviceInfo} *info
+ * @return {*}: MPP_OK, MPP_CHECK_FAILED if there is no such device
+ */
+S32 mpp_v4l2_get_device_info(S32 index, V4l2DeviceInfo *info);
+
+/**
+ * @description: probe the devices again at the next lookup, for the changes
+ * inotify can not see, or to measure the cold lookup
+ * @return {*}
+ */
+void mpp_v4l2_invalidate_devices();
+
 /**
  * @description:
  * @return {*}
@@ -39,6 +92,24 @@ BOOL check_v4l2();
  */
 BOOL check_v4l2_linlonv5v7();
 
+/**
+ * @description: is there a device in the table that can decode the stream
+ * format, no device is opened
+ * @param {U8} *driver: the driver the device must be of, NULL if any
+ * @param {S32} coding_type: the stream format (fourcc)
+ * @return {*}
+ */
+BOOL has_v4l2_decoder(const U8 *driver, S32 coding_type);
+
+/**
+ * @description: is there a device in the table that can encode the stream
+ * format, no device is opened
+ * @param {U8} *driver: the driver the device must be of, NULL if any
+ * @param {S32} coding_type: the stream format (fourcc)
+ * @return {*}
+ */
+BOOL has_v4l2_encoder(const U8 *driver, S32 coding_type);
+
 /**
  * @description:
  * @param {U8} *device_path
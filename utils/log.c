@@ -5,21 +5,34 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-17 09:33:01
- * @LastEditTime: 2023-11-09 14:50:49
- * @Description:
+ * @LastEditTime: 2024-06-02 11:52:18
+ * @Description: the log backend: one ring of records per logging thread,
+ *               drained by a log thread into stdout, stderr, a file or
+ *               syslog. Errors are written by their threads, after the
+ *               rings.
  */
 
 #define MODULE_TAG "mpp_log"
 
 #include "log.h"
 
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <syslog.h>
+#include <time.h>
 
+#include "env.h"
 #include "os_log.h"
+#include "para.h"
 
 #define MPP_LOG_MAX_LEN 256
+#define MPP_LOG_RING_SIZE 256  // records of one thread, power of 2
 
 #ifdef __cplusplus
 extern "C" {
@@ -27,10 +40,66 @@ extern "C" {
 
 U32 mpp_debug = 0;
 
-// TODO: add log timing information and switch flag
 static const char *msg_log_warning = "log message is long\n";
 static const char *msg_log_nothing = "\n";
-static int mpp_log_level = MPP_LOG_INFO;
+
+/***
+ * MPP_LOG_VERBOSE until the environment is read, so the first line of each
+ * level comes to mpp_log_write, which reads it
+ */
+int mpp_log_level = MPP_LOG_VERBOSE;
+
+typedef struct _MppLogRecord {
+  S64 nTime;  // ms of CLOCK_MONOTONIC_COARSE
+  LONG nTid;
+  S32 nLevel;
+  S32 nPrefix;
+  S32 nLength;
+  char sText[MPP_LOG_MAX_LEN];
+} MppLogRecord;
+
+/***
+ * written by its thread, read by the log thread. The rings are never freed,
+ * the ring of an exited thread is taken by the next new one.
+ */
+typedef struct _MppLogRing {
+  struct _MppLogRing *pNext;
+  atomic_int bUsed;
+  atomic_uint nWrite;
+  atomic_uint nRead;
+  MppLogRecord stRecord[MPP_LOG_RING_SIZE];
+} MppLogRing;
+
+typedef enum _MppLogWriterState {
+  LOG_WRITER_IDLE = 0,
+  LOG_WRITER_RUNNING,
+  LOG_WRITER_STOPPED,
+} MppLogWriterState;
+
+static const char *level_name[] = {
+    "", "FATAL", "ERROR", "WARN", "INFO", "DEBUG", "VERBOSE",
+};
+static const int level_priority[] = {
+    LOG_INFO, LOG_CRIT, LOG_ERR, LOG_WARNING, LOG_INFO, LOG_DEBUG, LOG_NOTICE,
+};
+
+static pthread_once_t log_env_once = PTHREAD_ONCE_INIT;
+static pthread_key_t log_ring_key;
+static __thread MppLogRing *log_ring = NULL;
+static __thread LONG log_tid = 0;
+static _Atomic(MppLogRing *) log_rings = NULL;
+
+/***
+ * the sink and the state of the log thread are changed under log_mutex, the
+ * log thread holds it while it writes
+ */
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t log_writer;
+static atomic_int log_writer_state = LOG_WRITER_IDLE;
+static atomic_int log_writer_sleeping = 0;
+static sem_t log_wakeup;
+static S32 log_sink = MPP_LOG_SINK_STDOUT;
+static FILE *log_file = NULL;
 
 static void __mpp_log(os_log_callback func, const char *tag, const char *fmt,
                       const char *fname, va_list args) {
@@ -67,6 +136,314 @@ static void __mpp_log(os_log_callback func, const char *tag, const char *fmt,
   func(tag, buf, args);
 }
 
+static void write_record(MppLogRecord *record) {
+  if (MPP_LOG_SINK_SYSLOG == log_sink) {
+    syslog(level_priority[record->nLevel], "%.*s", record->nLength,
+           record->sText);
+  } else if (record->nPrefix) {
+    fprintf(log_file, "[MPP-%s] %lld.%03lld %ld:%.*s",
+            level_name[record->nLevel], (long long)(record->nTime / 1000),
+            (long long)(record->nTime % 1000), record->nTid, record->nLength,
+            record->sText);
+  } else {
+    fwrite(record->sText, 1, record->nLength, log_file);
+  }
+}
+
+/**
+ * @description: write the records of all rings with log_mutex held, return
+ * how many
+ */
+static S32 drain_rings_locked() {
+  S32 num = 0;
+
+  for (MppLogRing *ring = atomic_load(&log_rings); ring; ring = ring->pNext) {
+    U32 read = atomic_load_explicit(&ring->nRead, memory_order_relaxed);
+    U32 write = atomic_load_explicit(&ring->nWrite, memory_order_acquire);
+
+    for (; read != write; read++, num++)
+      write_record(&ring->stRecord[read & (MPP_LOG_RING_SIZE - 1)]);
+    atomic_store_explicit(&ring->nRead, read, memory_order_release);
+  }
+
+  return num;
+}
+
+/**
+ * @description: write the records of all rings, return how many
+ */
+static S32 drain_rings() {
+  S32 num;
+
+  pthread_mutex_lock(&log_mutex);
+  num = drain_rings_locked();
+  if (num && log_file) fflush(log_file);
+  pthread_mutex_unlock(&log_mutex);
+
+  return num;
+}
+
+static BOOL rings_empty() {
+  for (MppLogRing *ring = atomic_load(&log_rings); ring; ring = ring->pNext) {
+    if (atomic_load(&ring->nRead) != atomic_load(&ring->nWrite))
+      return MPP_FALSE;
+  }
+
+  return MPP_TRUE;
+}
+
+/**
+ * @description: sleeps on log_wakeup until a writer or stop_writer posts it,
+ * there is no timed wakeup.
+ */
+static void *log_writer_thread(void *private_data) {
+  while (LOG_WRITER_RUNNING == atomic_load(&log_writer_state)) {
+    if (drain_rings()) continue;
+
+    // a writer checks the flag after its record is visible, see wake_writer
+    atomic_store(&log_writer_sleeping, 1);
+    if (rings_empty() &&
+        LOG_WRITER_RUNNING == atomic_load(&log_writer_state)) {
+      sem_wait(&log_wakeup);
+      // woken by the first line of a burst, let the writer log the rest so
+      // that one round takes them all
+      sched_yield();
+    }
+    atomic_store(&log_writer_sleeping, 0);
+  }
+
+  drain_rings();
+  return NULL;
+}
+
+/**
+ * @description: one post per sleep of the log thread, a plain load while it
+ * is awake
+ */
+static void wake_writer() {
+  if (atomic_load(&log_writer_sleeping) &&
+      atomic_exchange(&log_writer_sleeping, 0))
+    sem_post(&log_wakeup);
+}
+
+static void stop_writer() {
+  pthread_mutex_lock(&log_mutex);
+  if (LOG_WRITER_RUNNING != atomic_load(&log_writer_state)) {
+    atomic_store(&log_writer_state, LOG_WRITER_STOPPED);
+    pthread_mutex_unlock(&log_mutex);
+    return;
+  }
+  atomic_store(&log_writer_state, LOG_WRITER_STOPPED);
+  pthread_mutex_unlock(&log_mutex);
+
+  sem_post(&log_wakeup);
+  pthread_join(log_writer, NULL);
+  drain_rings();
+
+  // the lines logged after this are written by their threads
+  pthread_mutex_lock(&log_mutex);
+  fflush(log_file);
+  pthread_mutex_unlock(&log_mutex);
+}
+
+static void start_writer() {
+  pthread_mutex_lock(&log_mutex);
+  if (LOG_WRITER_IDLE == atomic_load(&log_writer_state)) {
+    atomic_store(&log_writer_state, LOG_WRITER_RUNNING);
+    if (pthread_create(&log_writer, NULL, log_writer_thread, NULL))
+      atomic_store(&log_writer_state, LOG_WRITER_STOPPED);
+  }
+  pthread_mutex_unlock(&log_mutex);
+}
+
+static void release_ring(void *ring) {
+  atomic_store(&((MppLogRing *)ring)->bUsed, 0);
+}
+
+/**
+ * @description: the child has no log thread, the records of the parent are
+ * left to the parent
+ */
+static void log_after_fork() {
+  pthread_mutex_init(&log_mutex, NULL);
+  sem_init(&log_wakeup, 0, 0);
+  atomic_store(&log_writer_sleeping, 0);
+  for (MppLogRing *ring = atomic_load(&log_rings); ring; ring = ring->pNext)
+    atomic_store(&ring->nRead, atomic_load(&ring->nWrite));
+  if (LOG_WRITER_RUNNING == atomic_load(&log_writer_state))
+    atomic_store(&log_writer_state, LOG_WRITER_IDLE);
+  log_tid = 0;
+}
+
+static void log_env_init() {
+  U32 level = MPP_LOG_INFO;
+  U8 *path = NULL;
+
+  mpp_env_get_u32("MPP_LOG_LEVEL", &level, MPP_LOG_INFO);
+  if (level <= MPP_LOG_UNKNOWN || level > MPP_LOG_SILENT) level = MPP_LOG_INFO;
+  __atomic_store_n(&mpp_log_level, level, __ATOMIC_RELAXED);
+
+  log_file = stdout;
+  mpp_env_get_str("MPP_LOG_FILE", &path, NULL);
+  if (path && !strcmp((char *)path, "syslog")) {
+    log_sink = MPP_LOG_SINK_SYSLOG;
+  } else if (path && !strcmp((char *)path, "stderr")) {
+    log_sink = MPP_LOG_SINK_STDERR;
+    log_file = stderr;
+  } else if (path && path[0] && strcmp((char *)path, "stdout")) {
+    FILE *file = fopen((char *)path, "w");
+    if (file) {
+      log_sink = MPP_LOG_SINK_FILE;
+      log_file = file;
+    } else {
+      fprintf(stderr, "[MPP-ERROR] can not open log file %s, use stdout\n",
+              path);
+    }
+  }
+
+  sem_init(&log_wakeup, 0, 0);
+  pthread_key_create(&log_ring_key, release_ring);
+  pthread_atfork(NULL, NULL, log_after_fork);
+  atexit(stop_writer);
+}
+
+static MppLogRing *get_ring() {
+  MppLogRing *ring;
+  int unused = 0;
+
+  if (log_ring) return log_ring;
+
+  for (ring = atomic_load(&log_rings); ring; ring = ring->pNext) {
+    if (atomic_compare_exchange_strong(&ring->bUsed, &unused, 1)) break;
+    unused = 0;
+  }
+
+  if (!ring) {
+    ring = (MppLogRing *)calloc(1, sizeof(MppLogRing));
+    if (!ring) return NULL;
+    atomic_store(&ring->bUsed, 1);
+    ring->pNext = atomic_load(&log_rings);
+    while (!atomic_compare_exchange_weak(&log_rings, &ring->pNext, ring))
+      ;
+  }
+
+  pthread_setspecific(log_ring_key, ring);
+  log_ring = ring;
+  return ring;
+}
+
+void mpp_log_write(int level, int prefix, const char *fmt, ...) {
+  MppLogRecord *record, sync_record;
+  MppLogRing *ring;
+  struct timespec ts;
+  va_list args;
+  U32 write;
+  S32 length;
+
+  pthread_once(&log_env_once, log_env_init);
+  if (!mpp_log_on(level) || level <= MPP_LOG_UNKNOWN ||
+      level >= MPP_LOG_SILENT)
+    return;
+
+  if (LOG_WRITER_IDLE == atomic_load_explicit(&log_writer_state,
+                                              memory_order_relaxed))
+    start_writer();
+
+  // an error is on the file when the call returns, a crash right after it
+  // must not lose it
+  ring = level <= MPP_LOG_ERROR ? NULL : get_ring();
+  record = &sync_record;
+  if (ring && LOG_WRITER_RUNNING == atomic_load_explicit(
+                                        &log_writer_state,
+                                        memory_order_relaxed)) {
+    write = atomic_load_explicit(&ring->nWrite, memory_order_relaxed);
+    record = &ring->stRecord[write & (MPP_LOG_RING_SIZE - 1)];
+
+    // full, wait for the log thread unless it is stopped meanwhile
+    while (write - atomic_load_explicit(&ring->nRead, memory_order_acquire) >=
+           MPP_LOG_RING_SIZE) {
+      if (LOG_WRITER_RUNNING != atomic_load(&log_writer_state)) {
+        record = &sync_record;
+        break;
+      }
+      wake_writer();
+      sched_yield();
+    }
+  }
+
+  if (!log_tid) log_tid = gettid();
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  record->nTime = (S64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+  record->nTid = log_tid;
+  record->nLevel = level;
+  record->nPrefix = prefix;
+
+  va_start(args, fmt);
+  length = vsnprintf(record->sText, MPP_LOG_MAX_LEN, fmt, args);
+  va_end(args);
+  if (length < 0) length = 0;
+  if (length >= MPP_LOG_MAX_LEN) {
+    length = MPP_LOG_MAX_LEN - 1;
+    record->sText[length - 1] = '\n';
+  }
+  record->nLength = length;
+
+  if (record == &sync_record) {
+    // an error, or no log thread (at exit, or it can not be created): write
+    // it here, after the lines still in the rings
+    pthread_mutex_lock(&log_mutex);
+    drain_rings_locked();
+    write_record(record);
+    if (log_file) fflush(log_file);
+    pthread_mutex_unlock(&log_mutex);
+    return;
+  }
+
+  // only the first line after the log thread went to sleep posts it, the
+  // next ones find it awake
+  atomic_store_explicit(&ring->nWrite, write + 1, memory_order_seq_cst);
+  wake_writer();
+}
+
+void mpp_log_flush(void) {
+  pthread_once(&log_env_once, log_env_init);
+
+  while (LOG_WRITER_RUNNING == atomic_load(&log_writer_state) &&
+         !rings_empty()) {
+    wake_writer();
+    sched_yield();
+  }
+
+  pthread_mutex_lock(&log_mutex);
+  if (log_file) fflush(log_file);
+  pthread_mutex_unlock(&log_mutex);
+}
+
+RETURN mpp_set_log_sink(int sink, const char *path) {
+  FILE *file = stdout;
+
+  pthread_once(&log_env_once, log_env_init);
+
+  if (MPP_LOG_SINK_FILE == sink) {
+    if (!path || !(file = fopen(path, "w"))) return MPP_OPEN_FAILED;
+  } else if (MPP_LOG_SINK_STDERR == sink) {
+    file = stderr;
+  } else if (MPP_LOG_SINK_STDOUT != sink && MPP_LOG_SINK_SYSLOG != sink) {
+    return MPP_OPEN_FAILED;
+  }
+
+  // the lines logged before go to the old sink
+  mpp_log_flush();
+
+  pthread_mutex_lock(&log_mutex);
+  if (log_file && log_file != stdout && log_file != stderr) fclose(log_file);
+  log_file = file;
+  log_sink = sink;
+  pthread_mutex_unlock(&log_mutex);
+
+  return MPP_OK;
+}
+
 void _mpp_log(const char *tag, const char *fmt, const char *fname, ...) {
   va_list args;
 
@@ -95,7 +472,7 @@ void _mpp_log_l(int level, const char *tag, const char *fmt, const char *fname,
 
   if (level <= MPP_LOG_UNKNOWN || level >= MPP_LOG_SILENT) return;
 
-  log_level = mpp_log_level;
+  log_level = mpp_get_log_level();
   if (log_level >= MPP_LOG_SILENT) return;
 
   if (level > log_level) return;
@@ -106,21 +483,21 @@ void _mpp_log_l(int level, const char *tag, const char *fmt, const char *fname,
 }
 
 void mpp_set_log_level(int level) {
+  pthread_once(&log_env_once, log_env_init);
+
   if (level <= MPP_LOG_UNKNOWN || level > MPP_LOG_SILENT) {
     mpp_logw("log level should in range [%d : %d] invalid intput %d\n",
              MPP_LOG_FATAL, MPP_LOG_SILENT, level);
     level = MPP_LOG_INFO;
   }
 
-  mpp_log_level = level;
+  __atomic_store_n(&mpp_log_level, level, __ATOMIC_RELAXED);
 }
 
 int mpp_get_log_level(void) {
-  int level;
-
-  mpp_log_level = level;
+  pthread_once(&log_env_once, log_env_init);
 
-  return level;
+  return __atomic_load_n(&mpp_log_level, __ATOMIC_RELAXED);
 }
 
 #ifdef __cplusplus
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-20 10:12:31
+ * @LastEditTime: 2024-05-20 16:40:02
+ * @Description: eventfd based notification between AL layer and mpi layer
+ */
+
+#define ENABLE_DEBUG 0
+
+#include "notify.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "para.h"
+
+#define MODULE_TAG "mpp_notify"
+
+S32 mpp_notify_create() {
+  S32 fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd < 0) {
+    error("can not create eventfd, please check! (%s)", strerror(errno));
+    return MPP_OPEN_FAILED;
+  }
+
+  debug("create notifier fd = %d", fd);
+  return fd;
+}
+
+void mpp_notify_signal(S32 fd) {
+  uint64_t value = 1;
+
+  if (fd <= 0) return;
+
+  // EAGAIN means the counter is saturated, the waiter will wake up anyway
+  if (write(fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+    error("can not signal notifier fd = %d (%s)", fd, strerror(errno));
+}
+
+void mpp_notify_clear(S32 fd) {
+  uint64_t value = 0;
+
+  if (fd <= 0) return;
+
+  // the fd is non-blocking, one read resets the counter to 0
+  if (read(fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+    error("can not clear notifier fd = %d (%s)", fd, strerror(errno));
+}
+
+void mpp_notify_destory(S32 fd) {
+  if (fd > 0) close(fd);
+}
@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-13 18:10:10
- * @LastEditTime: 2024-04-24 16:43:56
+ * @LastEditTime: 2024-05-24 17:40:12
  * @Description:
  */
 
@@ -14,6 +14,7 @@
 #include "packet.h"
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -50,6 +51,16 @@ struct _MppPacket {
   S64 nPts;
   S64 nDts;
   BOOL bEos;
+  BOOL bKeyFrame;
+
+  /**
+   * set on packets owned by a MppPacketPool, pPoolSelf tells the original
+   * packet from a struct copy of it. pPoolData is the pool's buffer, the
+   * data pointer may be lent to someone else's (e.g. vi_file) meanwhile.
+   */
+  MppPacketPool *pPool;
+  MppPacket *pPoolSelf;
+  U8 *pPoolData;
 
   // environment variable
   BOOL bEnableUnfreePacketDebug;
@@ -58,6 +69,32 @@ struct _MppPacket {
   // S32    bIsLastPart;
 };
 
+struct _MppPacketPool {
+  pthread_mutex_t mutex;
+  S32 nSize;
+  S32 nMaxNum;
+
+  // idle packets, a stack so the most recently used (cache hot) goes first
+  MppPacket **pIdle;
+  S32 nIdleNum;
+  MppPacketPoolStat stStat;
+  BOOL bDestoryed;
+};
+
+/**
+ * read the environment once per process, not on every PACKET_Create
+ */
+static pthread_once_t packet_env_once = PTHREAD_ONCE_INIT;
+static U32 enable_unfree_packet_debug = 0;
+
+static void packet_env_init() {
+  mpp_env_get_u32("MPP_PRINT_UNFREE_PACKET", &enable_unfree_packet_debug, 0);
+}
+
+static BOOL is_pooled(MppPacket *packet) {
+  return packet->pPool && packet->pPoolSelf == packet;
+}
+
 MppPacket *PACKET_Create() {
   MppPacket *packet = (MppPacket *)malloc(sizeof(MppPacket));
   if (!packet) {
@@ -67,8 +104,8 @@ MppPacket *PACKET_Create() {
 
   memset(packet, 0, sizeof(MppPacket));
 
-  mpp_env_get_u32("MPP_PRINT_UNFREE_PACKET",
-                  &(packet->bEnableUnfreePacketDebug), 0);
+  pthread_once(&packet_env_once, packet_env_init);
+  packet->bEnableUnfreePacketDebug = enable_unfree_packet_debug;
 
   if (packet->bEnableUnfreePacketDebug) {
     num_of_unfree_packet++;
@@ -101,6 +138,9 @@ MppPacket *PACKET_Copy(MppPacket *src_packet) {
 
   memset(dst_packet, 0, sizeof(MppPacket));
   memcpy(dst_packet, src_packet, sizeof(MppPacket));
+  dst_packet->pPool = NULL;
+  dst_packet->pPoolSelf = NULL;
+  dst_packet->pPoolData = NULL;
 
   if (src_packet->nTotalSize) {
     ret = PACKET_Alloc(dst_packet, src_packet->nTotalSize);
@@ -164,6 +204,9 @@ RETURN PACKET_Free(MppPacket *packet) {
     return MPP_NULL_POINTER;
   }
 
+  // the buffer belongs to the pool, it is released with the pool
+  if (is_pooled(packet)) return MPP_OK;
+
   if (packet->pData) {
     free(packet->pData);
     packet->pData = NULL;
@@ -369,6 +412,26 @@ RETURN PACKET_SetEos(MppPacket *packet, BOOL eos) {
   return MPP_OK;
 }
 
+BOOL PACKET_GetKeyFrame(MppPacket *packet) {
+  if (!packet) {
+    error("input para MppPacket is NULL, please check!");
+    return MPP_FALSE;
+  }
+
+  return packet->bKeyFrame;
+}
+
+RETURN PACKET_SetKeyFrame(MppPacket *packet, BOOL key_frame) {
+  if (!packet) {
+    error("input para MppPacket is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  packet->bKeyFrame = key_frame;
+
+  return MPP_OK;
+}
+
 RETURN PACKET_SetWidth(MppPacket *packet, S32 width) {
   if (!packet) {
     error("input para packet is NULL, please check!");
@@ -475,6 +538,11 @@ void PACKET_Destory(MppPacket *packet) {
     return;
   }
 
+  if (is_pooled(packet)) {
+    PACKETPOOL_PutPacket(packet);
+    return;
+  }
+
   if (packet->bEnableUnfreePacketDebug) {
     num_of_unfree_packet--;
     info("---------- debug packet memory: num of unfree packet: %d",
@@ -484,3 +552,207 @@ void PACKET_Destory(MppPacket *packet) {
   free(packet);
   // packet = NULL;
 }
+
+/**
+ * @description: create and alloc one packet owned by the pool
+ */
+static MppPacket *pool_new_packet(MppPacketPool *pool) {
+  MppPacket *packet = PACKET_Create();
+  if (!packet) return NULL;
+
+  if (PACKET_Alloc(packet, pool->nSize)) {
+    error("can not alloc packet of the pool, please check!");
+    PACKET_Destory(packet);
+    return NULL;
+  }
+
+  packet->pPool = pool;
+  packet->pPoolSelf = packet;
+  packet->pPoolData = packet->pData;
+
+  return packet;
+}
+
+/**
+ * @description: free a packet owned by the pool, detach it first so that
+ * PACKET_Free/PACKET_Destory really release it.
+ */
+static void pool_delete_packet(MppPacket *packet) {
+  packet->pData = packet->pPoolData;
+  packet->pPool = NULL;
+  packet->pPoolSelf = NULL;
+  packet->pPoolData = NULL;
+  PACKET_Free(packet);
+  PACKET_Destory(packet);
+}
+
+static void pool_release(MppPacketPool *pool) {
+  pthread_mutex_destroy(&pool->mutex);
+  free(pool->pIdle);
+  free(pool);
+}
+
+MppPacketPool *PACKETPOOL_Create(S32 size, S32 init_num, S32 max_num) {
+  MppPacketPool *pool = NULL;
+  MppPacket *packet = NULL;
+  S32 i;
+
+  if (size <= 0 || init_num < 0 || max_num <= 0 || init_num > max_num) {
+    error("invalid size %d, init_num %d or max_num %d, please check!", size,
+          init_num, max_num);
+    return NULL;
+  }
+
+  pool = (MppPacketPool *)malloc(sizeof(MppPacketPool));
+  if (!pool) {
+    error("can not malloc MppPacketPool, please check! (%s)",
+          strerror(errno));
+    return NULL;
+  }
+  memset(pool, 0, sizeof(MppPacketPool));
+
+  pool->pIdle = (MppPacket **)malloc(max_num * sizeof(MppPacket *));
+  if (!pool->pIdle) {
+    error("can not malloc idle list of MppPacketPool, please check!");
+    free(pool);
+    return NULL;
+  }
+
+  pthread_mutex_init(&pool->mutex, NULL);
+  pool->nSize = size;
+  pool->nMaxNum = max_num;
+
+  for (i = 0; i < init_num; i++) {
+    packet = pool_new_packet(pool);
+    if (!packet) {
+      PACKETPOOL_Destory(pool);
+      return NULL;
+    }
+    pool->pIdle[pool->nIdleNum++] = packet;
+    pool->stStat.nTotalNum++;
+  }
+
+  debug("create packet pool %p: size %d, %d/%d packets", pool, size, init_num,
+        max_num);
+
+  return pool;
+}
+
+MppPacket *PACKETPOOL_GetPacket(MppPacketPool *pool) {
+  MppPacket *packet = NULL;
+  BOOL grow = MPP_FALSE;
+
+  if (!pool) {
+    error("input para MppPacketPool is NULL, please check!");
+    return NULL;
+  }
+
+  pthread_mutex_lock(&pool->mutex);
+  if (pool->nIdleNum) {
+    packet = pool->pIdle[--pool->nIdleNum];
+  } else {
+    pool->stStat.nMissCount++;
+    if (pool->stStat.nTotalNum < pool->nMaxNum) {
+      // reserve the slot, alloc outside of the lock
+      pool->stStat.nTotalNum++;
+      grow = MPP_TRUE;
+    }
+  }
+  if (packet || grow) {
+    pool->stStat.nGetCount++;
+    pool->stStat.nInUseNum++;
+    if (pool->stStat.nInUseNum > pool->stStat.nHighWaterNum)
+      pool->stStat.nHighWaterNum = pool->stStat.nInUseNum;
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  if (grow) {
+    packet = pool_new_packet(pool);
+    if (!packet) {
+      pthread_mutex_lock(&pool->mutex);
+      pool->stStat.nTotalNum--;
+      pool->stStat.nInUseNum--;
+      pool->stStat.nGetCount--;
+      pthread_mutex_unlock(&pool->mutex);
+    }
+  }
+
+  if (!packet) return NULL;
+
+  packet->pData = packet->pPoolData;
+  packet->nLength = 0;
+  packet->pMetaData = NULL;
+  packet->nID = 0;
+  packet->nPts = 0;
+  packet->nDts = 0;
+  packet->bEos = MPP_FALSE;
+  packet->bKeyFrame = MPP_FALSE;
+
+  return packet;
+}
+
+RETURN PACKETPOOL_PutPacket(MppPacket *packet) {
+  MppPacketPool *pool = NULL;
+  BOOL release_pool = MPP_FALSE;
+
+  if (!packet) {
+    error("input para MppPacket is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  if (!is_pooled(packet)) {
+    error("the packet %p is not got from a pool, please check!", packet);
+    return MPP_CHECK_FAILED;
+  }
+
+  pool = packet->pPool;
+  pthread_mutex_lock(&pool->mutex);
+  pool->stStat.nInUseNum--;
+  if (pool->bDestoryed) {
+    pool->stStat.nTotalNum--;
+    release_pool = pool->stStat.nInUseNum == 0;
+  } else {
+    pool->pIdle[pool->nIdleNum++] = packet;
+    packet = NULL;
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  // the pool is destoryed, free the packet and the pool after the last one
+  if (packet) pool_delete_packet(packet);
+  if (release_pool) pool_release(pool);
+
+  return MPP_OK;
+}
+
+RETURN PACKETPOOL_GetStat(MppPacketPool *pool, MppPacketPoolStat *stat) {
+  if (!pool || !stat) {
+    error("input para MppPacketPool or stat is NULL, please check!");
+    return MPP_NULL_POINTER;
+  }
+
+  pthread_mutex_lock(&pool->mutex);
+  *stat = pool->stStat;
+  pthread_mutex_unlock(&pool->mutex);
+
+  return MPP_OK;
+}
+
+void PACKETPOOL_Destory(MppPacketPool *pool) {
+  BOOL release_pool = MPP_FALSE;
+
+  if (!pool) {
+    error("input para MppPacketPool is NULL, please check!");
+    return;
+  }
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->bDestoryed = MPP_TRUE;
+  while (pool->nIdleNum) {
+    pool_delete_packet(pool->pIdle[--pool->nIdleNum]);
+    pool->stStat.nTotalNum--;
+  }
+  release_pool = pool->stStat.nInUseNum == 0;
+  pthread_mutex_unlock(&pool->mutex);
+
+  if (release_pool) pool_release(pool);
+}
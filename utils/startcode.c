@@ -0,0 +1,201 @@
+/*
+ * Copyright 2022-2023 SPACEMIT. All rights reserved.
+ * Use of this source code is governed by a BSD-style license
+ * that can be found in the LICENSE file.
+ *
+ * @Author: David(qiang.fu@spacemit.com)
+ * @Date: 2024-05-23 10:36:18
+ * @LastEditTime: 2024-05-23 10:36:18
+ * @Description: start code and marker search for the stream parsers
+ */
+
+#define ENABLE_DEBUG 0
+
+#include "startcode.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "log.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STARTCODE_X86 1
+#endif
+
+#if defined(__riscv_vector)
+#include <riscv_vector.h>
+#define STARTCODE_RVV 1
+#endif
+
+typedef const U8 *(*FindStartCodeFunc)(const U8 *data, const U8 *end);
+
+/***
+ * 00 00 01 can only start at p if p[2] == 1 and p[1] == 0 and p[0] == 0,
+ * so look at p[2] first: > 1 rules out p, p + 1 and p + 2 at once. Aligned
+ * words without any zero byte are skipped as a whole.
+ */
+const U8 *mpp_find_start_code_c(const U8 *data, const U8 *end) {
+  const U8 *p = data;
+
+  if (end - data < 3) return end;
+
+  while (p < end - 2 && ((uintptr_t)p & (sizeof(size_t) - 1))) {
+    if (!p[0] && !p[1] && p[2] == 1) return p;
+    p++;
+  }
+
+  // no zero byte in the word, no start code can begin in it
+  while (p + sizeof(size_t) + 2 <= end) {
+    size_t x;
+    memcpy(&x, p, sizeof(size_t));
+    if ((x - (size_t)0x0101010101010101ULL) & ~x &
+        (size_t)0x8080808080808080ULL)
+      break;
+    p += sizeof(size_t);
+  }
+
+  while (p < end - 2) {
+    if (p[2] > 1) {
+      p += 3;
+    } else if (!p[1]) {
+      if (!p[0] && p[2] == 1) return p;
+      p++;
+    } else {
+      p += 2;
+    }
+  }
+
+  return end;
+}
+
+#ifdef STARTCODE_X86
+/***
+ * compare p, p + 1 and p + 2 against 0, 0, 1 for a whole vector at once,
+ * the first set bit of the mask is the first start code in the block.
+ */
+__attribute__((target("sse2"))) static const U8 *find_start_code_sse2(
+    const U8 *data, const U8 *end) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one = _mm_set1_epi8(1);
+  const U8 *p = data;
+
+  while (p + 16 + 2 <= end) {
+    __m128i b0 = _mm_loadu_si128((const __m128i *)p);
+    __m128i b1 = _mm_loadu_si128((const __m128i *)(p + 1));
+    __m128i b2 = _mm_loadu_si128((const __m128i *)(p + 2));
+    __m128i m = _mm_and_si128(
+        _mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)),
+        _mm_cmpeq_epi8(b2, one));
+    S32 mask = _mm_movemask_epi8(m);
+    if (mask) return p + __builtin_ctz(mask);
+    p += 16;
+  }
+
+  return mpp_find_start_code_c(p, end);
+}
+
+__attribute__((target("avx2"))) static const U8 *find_start_code_avx2(
+    const U8 *data, const U8 *end) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi8(1);
+  const U8 *p = data;
+
+  while (p + 32 + 2 <= end) {
+    __m256i b0 = _mm256_loadu_si256((const __m256i *)p);
+    __m256i b1 = _mm256_loadu_si256((const __m256i *)(p + 1));
+    __m256i b2 = _mm256_loadu_si256((const __m256i *)(p + 2));
+    __m256i m = _mm256_and_si256(
+        _mm256_and_si256(_mm256_cmpeq_epi8(b0, zero),
+                         _mm256_cmpeq_epi8(b1, zero)),
+        _mm256_cmpeq_epi8(b2, one));
+    U32 mask = (U32)_mm256_movemask_epi8(m);
+    if (mask) return p + __builtin_ctz(mask);
+    p += 32;
+  }
+
+  return find_start_code_sse2(p, end);
+}
+#endif
+
+#ifdef STARTCODE_RVV
+static const U8 *find_start_code_rvv(const U8 *data, const U8 *end) {
+  const U8 *p = data;
+
+  while (end - p >= 3) {
+    size_t vl = __riscv_vsetvl_e8m8(end - p - 2);
+    vuint8m8_t b0 = __riscv_vle8_v_u8m8(p, vl);
+    vuint8m8_t b1 = __riscv_vle8_v_u8m8(p + 1, vl);
+    vuint8m8_t b2 = __riscv_vle8_v_u8m8(p + 2, vl);
+    vbool1_t m = __riscv_vmand_mm_b1(
+        __riscv_vmand_mm_b1(__riscv_vmseq_vx_u8m8_b1(b0, 0, vl),
+                            __riscv_vmseq_vx_u8m8_b1(b1, 0, vl), vl),
+        __riscv_vmseq_vx_u8m8_b1(b2, 1, vl), vl);
+    long first = __riscv_vfirst_m_b1(m, vl);
+    if (first >= 0) return p + first;
+    p += vl;
+  }
+
+  return end;
+}
+#endif
+
+static FindStartCodeFunc find_start_code_func = NULL;
+static const char *find_start_code_name = "c";
+
+static void select_impl() {
+  FindStartCodeFunc func = mpp_find_start_code_c;
+  const char *name = "c";
+
+#if defined(STARTCODE_RVV)
+  func = find_start_code_rvv;
+  name = "rvv";
+#elif defined(STARTCODE_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    func = find_start_code_avx2;
+    name = "avx2";
+  } else if (__builtin_cpu_supports("sse2")) {
+    func = find_start_code_sse2;
+    name = "sse2";
+  }
+#endif
+
+  // benign race, every thread selects the same function
+  find_start_code_name = name;
+  __atomic_store_n(&find_start_code_func, func, __ATOMIC_RELEASE);
+  debug("find start code by %s", name);
+}
+
+const U8 *mpp_find_start_code(const U8 *data, const U8 *end) {
+  FindStartCodeFunc func = __atomic_load_n(&find_start_code_func,
+                                           __ATOMIC_ACQUIRE);
+
+  if (!func) {
+    select_impl();
+    func = find_start_code_func;
+  }
+
+  return func(data, end);
+}
+
+const U8 *mpp_find_jpeg_marker(const U8 *data, const U8 *end) {
+  const U8 *p = data;
+
+  // memchr is vectorised by the libc, the entropy data rarely contains ff
+  while (end - p >= 2) {
+    p = (const U8 *)memchr(p, 0xff, end - p - 1);
+    if (!p) return end;
+    if (p[1] == 0xd8 || p[1] == 0xd9) return p;
+    p++;
+  }
+
+  return end;
+}
+
+const char *mpp_find_start_code_impl() {
+  if (!__atomic_load_n(&find_start_code_func, __ATOMIC_ACQUIRE))
+    select_impl();
+
+  return find_start_code_name;
+}
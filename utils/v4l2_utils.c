@@ -5,7 +5,7 @@
  *
  * @Author: David(qiang.fu@spacemit.com)
  * @Date: 2023-01-11 15:35:41
- * @LastEditTime: 2023-11-28 11:26:18
+ * @LastEditTime: 2024-06-02 09:40:15
  * @Description: some V4L2 utils
  */
 
@@ -16,8 +16,10 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -46,441 +48,334 @@
     return MPP_FALSE;                              \
   }
 
+#define V4L2_DEVICE_PATH_BASE "/dev/video"
+
 /**
- * @description: check whether the V4L2 output is stream(H264 etc.)
- * @param {S32} video_fd : the opened device fd
- * @return {*}
+ * the device table, probed once and kept until a /dev/video* node is
+ * created, removed or changes its mode (inotify on /dev), guarded by
+ * stDeviceMutex. Without inotify it is probed on every lookup, as before.
  */
-BOOL check_output_is_stream(S32 video_fd) {
-  BOOL check_result = MPP_FALSE;
-  struct v4l2_fmtdesc format;
-
-  for (S32 i = 0;; i++) {
-    memset(&format, 0, sizeof(format));
-    format.index = i;
-    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-
-    if (ioctl(video_fd, VIDIOC_ENUM_FMT, &format) < 0) {
-      break; /* end of enumeration */
-    }
-
-    debug("index:       %u", format.index);
-    debug("type:        %d", format.type);
-    debug("flags:       %08x", format.flags);
-    debug("description: %s", format.description);
-    debug("pixelformat: %d", format.pixelformat);
-
-    switch (format.pixelformat) {
-      case V4L2_PIX_FMT_MJPEG:
-      case V4L2_PIX_FMT_JPEG:
-      case V4L2_PIX_FMT_MPEG:
-      case V4L2_PIX_FMT_H264:
-      case V4L2_PIX_FMT_H264_NO_SC:
-      case V4L2_PIX_FMT_H264_MVC:
-      case V4L2_PIX_FMT_MPEG1:
-      case V4L2_PIX_FMT_MPEG2:
-      case V4L2_PIX_FMT_MPEG2_SLICE:
-      case V4L2_PIX_FMT_MPEG4:
-      case V4L2_PIX_FMT_VP8:
-      case V4L2_PIX_FMT_VP9:
-      case V4L2_PIX_FMT_HEVC:
-      case V4L2_PIX_FMT_FWHT:
-      case V4L2_PIX_FMT_FWHT_STATELESS:
-        check_result = MPP_TRUE;
-        break;
-      default:
-        break;
-    }
+static pthread_mutex_t stDeviceMutex = PTHREAD_MUTEX_INITIALIZER;
+static V4l2DeviceInfo stDevices[MPP_V4L2_MAX_DEVICE_NUM];
+static S32 nDeviceNum = 0;
+static BOOL bDevicesValid = MPP_FALSE;
+static S32 nInotifyFd = -1;
+static BOOL bInotifyTried = MPP_FALSE;
+
+static BOOL is_stream_fourcc(U32 fourcc) {
+  switch (fourcc) {
+    case V4L2_PIX_FMT_MJPEG:
+    case V4L2_PIX_FMT_JPEG:
+    case V4L2_PIX_FMT_MPEG:
+    case V4L2_PIX_FMT_H264:
+    case V4L2_PIX_FMT_H264_NO_SC:
+    case V4L2_PIX_FMT_H264_MVC:
+    case V4L2_PIX_FMT_MPEG1:
+    case V4L2_PIX_FMT_MPEG2:
+    case V4L2_PIX_FMT_MPEG2_SLICE:
+    case V4L2_PIX_FMT_MPEG4:
+    case V4L2_PIX_FMT_VP8:
+    case V4L2_PIX_FMT_VP9:
+    case V4L2_PIX_FMT_HEVC:
+    case V4L2_PIX_FMT_FWHT:
+    case V4L2_PIX_FMT_FWHT_STATELESS:
+      return MPP_TRUE;
+    default:
+      return MPP_FALSE;
   }
+}
 
-  for (S32 i = 0;; i++) {
-    memset(&format, 0, sizeof(format));
-    format.index = i;
-    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-
-    if (ioctl(video_fd, VIDIOC_ENUM_FMT, &format) < 0) {
-      break; /* end of enumeration */
-    }
-
-    debug("index:       %u", format.index);
-    debug("type:        %d", format.type);
-    debug("flags:       %08x", format.flags);
-    debug("description: %s", format.description);
-    debug("pixelformat: %d", format.pixelformat);
-
-    switch (format.pixelformat) {
-      case V4L2_PIX_FMT_MJPEG:
-      case V4L2_PIX_FMT_JPEG:
-      case V4L2_PIX_FMT_MPEG:
-      case V4L2_PIX_FMT_H264:
-      case V4L2_PIX_FMT_H264_NO_SC:
-      case V4L2_PIX_FMT_H264_MVC:
-      case V4L2_PIX_FMT_MPEG1:
-      case V4L2_PIX_FMT_MPEG2:
-      case V4L2_PIX_FMT_MPEG2_SLICE:
-      case V4L2_PIX_FMT_MPEG4:
-      case V4L2_PIX_FMT_VP8:
-      case V4L2_PIX_FMT_VP9:
-      case V4L2_PIX_FMT_HEVC:
-      case V4L2_PIX_FMT_FWHT:
-      case V4L2_PIX_FMT_FWHT_STATELESS:
-        check_result = MPP_TRUE;
-        break;
-      default:
-        break;
-    }
+static BOOL is_frame_fourcc(U32 fourcc) {
+  switch (fourcc) {
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV21:
+    case V4L2_PIX_FMT_YUV420:
+    case V4L2_PIX_FMT_YVU420:
+      return MPP_TRUE;
+    default:
+      return MPP_FALSE;
   }
-
-  debug("================= check output is stream finish! result = %d",
-        check_result);
-  return check_result;
 }
 
 /**
- * @description: check whether the V4L2 output is frame(YUV)
- * @param {S32} video_fd : the opened device fd
+ * @description: check the formats of one queue of a device
+ * @param {V4l2FormatInfo} *formats : input, the formats probed
+ * @param {S32} num : input, number of formats
+ * @param {BOOL} (*check) : input, is_stream_fourcc or is_frame_fourcc, NULL
+ * to look for fourcc only
+ * @param {U32} fourcc : input, the format we need, 0 if any
  * @return {*}
  */
-BOOL check_output_is_frame(S32 video_fd) {
-  BOOL check_result = MPP_FALSE;
-  struct v4l2_fmtdesc format;
+static BOOL has_format(const V4l2FormatInfo *formats, S32 num,
+                       BOOL (*check)(U32), U32 fourcc) {
+  for (S32 i = 0; i < num; i++) {
+    if (check && !check(formats[i].nFourcc)) continue;
+    if (fourcc && fourcc != formats[i].nFourcc) continue;
+    return MPP_TRUE;
+  }
 
-  debug("check_output_is_frame");
+  return MPP_FALSE;
+}
 
-  for (S32 i = 0;; i++) {
-    memset(&format, 0, sizeof(format));
-    format.index = i;
-    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+static BOOL is_decoder(const V4l2DeviceInfo *info, U32 fourcc) {
+  return V4L2_IS_M2M(info->nDeviceCaps) &&
+         has_format(info->stOutputFormat, info->nOutputFormatNum,
+                    is_stream_fourcc, fourcc) &&
+         has_format(info->stCaptureFormat, info->nCaptureFormatNum,
+                    is_frame_fourcc, 0);
+}
 
-    if (ioctl(video_fd, VIDIOC_ENUM_FMT, &format) < 0) {
-      break; /* end of enumeration */
-    }
+static BOOL is_encoder(const V4l2DeviceInfo *info, U32 fourcc) {
+  return V4L2_IS_M2M(info->nDeviceCaps) &&
+         has_format(info->stOutputFormat, info->nOutputFormatNum,
+                    is_frame_fourcc, 0) &&
+         has_format(info->stCaptureFormat, info->nCaptureFormatNum,
+                    is_stream_fourcc, fourcc);
+}
 
-    debug("=======================================");
-    debug("index:       %u", format.index);
-    debug("type:        %d", format.type);
-    debug("flags:       %08x", format.flags);
-    debug("description: %s", format.description);
-    debug("pixelformat: %d", format.pixelformat);
-
-    switch (format.pixelformat) {
-      case V4L2_PIX_FMT_NV12:
-      case V4L2_PIX_FMT_NV21:
-      case V4L2_PIX_FMT_YUV420:
-      case V4L2_PIX_FMT_YVU420:
-        check_result = MPP_TRUE;
-        break;
-      default:
-        debug("pixelformat(%u) is not supported", format.pixelformat);
-        break;
-    }
-  }
+/**
+ * @description: the smallest and the largest frame size of a format, all 0
+ * if the driver does not enumerate them
+ */
+static void probe_frame_size(S32 video_fd, V4l2FormatInfo *format) {
+  struct v4l2_frmsizeenum size;
 
   for (S32 i = 0;; i++) {
-    memset(&format, 0, sizeof(format));
-    format.index = i;
-    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-
-    if (ioctl(video_fd, VIDIOC_ENUM_FMT, &format) < 0) {
-      break; /* end of enumeration */
-    }
-
-    debug("=======================================");
-    debug("index:       %u", format.index);
-    debug("type:        %d", format.type);
-    debug("flags:       %08x", format.flags);
-    debug("description: %s", format.description);
-    debug("pixelformat: %d", format.pixelformat);
-
-    switch (format.pixelformat) {
-      case V4L2_PIX_FMT_NV12:
-      case V4L2_PIX_FMT_NV21:
-      case V4L2_PIX_FMT_YUV420:
-      case V4L2_PIX_FMT_YVU420:
-        check_result = MPP_TRUE;
-        break;
-      default:
-        debug("pixelformat(%u) is not supported", format.pixelformat);
-        break;
+    memset(&size, 0, sizeof(size));
+    size.index = i;
+    size.pixel_format = format->nFourcc;
+    if (ioctl(video_fd, VIDIOC_ENUM_FRAMESIZES, &size) < 0) break;
+
+    if (V4L2_FRMSIZE_TYPE_DISCRETE == size.type) {
+      if (!format->nMinWidth || size.discrete.width < format->nMinWidth)
+        format->nMinWidth = size.discrete.width;
+      if (!format->nMinHeight || size.discrete.height < format->nMinHeight)
+        format->nMinHeight = size.discrete.height;
+      if (size.discrete.width > format->nMaxWidth)
+        format->nMaxWidth = size.discrete.width;
+      if (size.discrete.height > format->nMaxHeight)
+        format->nMaxHeight = size.discrete.height;
+    } else {
+      // stepwise and continuous have one entry
+      format->nMinWidth = size.stepwise.min_width;
+      format->nMaxWidth = size.stepwise.max_width;
+      format->nMinHeight = size.stepwise.min_height;
+      format->nMaxHeight = size.stepwise.max_height;
+      break;
     }
   }
-
-  debug("================= check output is frame finish! result = %d",
-        check_result);
-  return check_result;
 }
 
 /**
- * @description: check if V4L2 support the output format wo need
- * @param {S32} video_fd : input, the opened device fd
- * @param {U32} fmt : input, the format we need
- * @return {*}
+ * @description: the formats of one queue, single and multi planar
+ * @return {S32} : number of formats
  */
-BOOL check_output_format(S32 video_fd, U32 fmt) {
-  BOOL check_result = MPP_FALSE;
+static S32 probe_formats(S32 video_fd, enum v4l2_buf_type type,
+                         enum v4l2_buf_type type_mplane,
+                         V4l2FormatInfo *formats) {
+  enum v4l2_buf_type types[2] = {type, type_mplane};
   struct v4l2_fmtdesc format;
+  S32 num = 0;
+
+  for (S32 t = 0; t < NUM_OF(types); t++) {
+    for (S32 i = 0; num < MPP_V4L2_MAX_FORMAT_NUM; i++) {
+      memset(&format, 0, sizeof(format));
+      format.index = i;
+      format.type = types[t];
+      if (ioctl(video_fd, VIDIOC_ENUM_FMT, &format) < 0) break;
+
+      if (has_format(formats, num, NULL, format.pixelformat)) continue;
+      memset(&formats[num], 0, sizeof(V4l2FormatInfo));
+      formats[num].nFourcc = format.pixelformat;
+      probe_frame_size(video_fd, &formats[num]);
+      debug("%s format %d: %.4s (%ux%u - %ux%u)",
+            V4L2_TYPE_IS_OUTPUT(types[t]) ? "OUTPUT" : "CAPTURE", num,
+            (char *)&format.pixelformat, formats[num].nMinWidth,
+            formats[num].nMinHeight, formats[num].nMaxWidth,
+            formats[num].nMaxHeight);
+      num++;
+    }
+  }
 
-  debug("================= check output format! fmt = %d", fmt);
+  return num;
+}
 
-  for (S32 i = 0;; i++) {
-    memset(&format, 0, sizeof(format));
-    format.index = i;
-    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+/**
+ * @description: query one device
+ * @return {BOOL} : MPP_FALSE if there is no such device or it can not be
+ * queried
+ */
+static BOOL probe_device(S32 index, V4l2DeviceInfo *info) {
+  struct v4l2_capability vcap;
+  S32 video_fd = -1;
 
-    if (ioctl(video_fd, VIDIOC_ENUM_FMT, &format) < 0) {
-      break; /* end of enumeration */
-    }
+  memset(info, 0, sizeof(V4l2DeviceInfo));
+  snprintf(info->sDevicePath, sizeof(info->sDevicePath), "%s%d",
+           V4L2_DEVICE_PATH_BASE, index);
 
-    debug("index:       %u", format.index);
-    debug("type:        %d", format.type);
-    // debug("flags:       %08x", format.flags);
-    debug("description: %s", format.description);
-    debug("pixelformat: %d", format.pixelformat);
+  video_fd = open(info->sDevicePath, O_RDWR | O_CLOEXEC);
+  if (video_fd < 0) {
+    if (ENOENT != errno)
+      error("can not open '%s', please check it! (%s)", info->sDevicePath,
+            strerror(errno));
+    return MPP_FALSE;
+  }
 
-    if (fmt == format.pixelformat) check_result = MPP_TRUE;
+  memset(&vcap, 0, sizeof(vcap));
+  if (ioctl(video_fd, VIDIOC_QUERYCAP, &vcap) < 0) {
+    error("can not get capabilities of '%s', please check it! (%s)",
+          info->sDevicePath, strerror(errno));
+    close(video_fd);
+    return MPP_FALSE;
   }
 
-  for (S32 i = 0;; i++) {
-    memset(&format, 0, sizeof(format));
-    format.index = i;
-    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+  snprintf(info->sDriver, sizeof(info->sDriver), "%s", vcap.driver);
+  snprintf(info->sCard, sizeof(info->sCard), "%s", vcap.card);
+  info->nDeviceCaps = (vcap.capabilities & V4L2_CAP_DEVICE_CAPS)
+                          ? vcap.device_caps
+                          : vcap.capabilities;
+  debug("probing '%s' located at '%s', caps %08x", info->sDriver,
+        info->sDevicePath, info->nDeviceCaps);
+
+  info->nOutputFormatNum =
+      probe_formats(video_fd, V4L2_BUF_TYPE_VIDEO_OUTPUT,
+                    V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE, info->stOutputFormat);
+  info->nCaptureFormatNum =
+      probe_formats(video_fd, V4L2_BUF_TYPE_VIDEO_CAPTURE,
+                    V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, info->stCaptureFormat);
 
-    if (ioctl(video_fd, VIDIOC_ENUM_FMT, &format) < 0) {
-      break; /* end of enumeration */
-    }
+  close(video_fd);
+  return MPP_TRUE;
+}
 
-    debug("index:       %u", format.index);
-    debug("type:        %d", format.type);
-    // debug("flags:       %08x", format.flags);
-    debug("description: %s", format.description);
-    debug("pixelformat: %d", format.pixelformat);
+/**
+ * @description: watch /dev, once, the table is probed every time if it
+ * fails
+ */
+static void watch_devices() {
+  if (bInotifyTried) return;
+  bInotifyTried = MPP_TRUE;
 
-    if (fmt == format.pixelformat) check_result = MPP_TRUE;
+  nInotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (nInotifyFd < 0) {
+    error("can not init inotify, probe V4L2 devices every time (%s)",
+          strerror(errno));
+    return;
   }
 
-  debug("================= check output formatfinish! result = %d",
-        check_result);
-  return check_result;
+  if (inotify_add_watch(nInotifyFd, "/dev",
+                        IN_CREATE | IN_DELETE | IN_ATTRIB) < 0) {
+    error("can not watch /dev, probe V4L2 devices every time (%s)",
+          strerror(errno));
+    close(nInotifyFd);
+    nInotifyFd = -1;
+  }
 }
 
 /**
- * @description: check whether the V4L2 input is stream(H264 etc.)
- * @param {S32} video_fd : the opened device fd
- * @return {*}
+ * @description: drop the table if a video node changed since the last
+ * lookup, called with stDeviceMutex held
  */
-BOOL check_input_is_stream(S32 video_fd) {
-  BOOL check_result = MPP_FALSE;
-  struct v4l2_fmtdesc format;
-
-  debug("check_input_is_stream");
-
-  for (S32 i = 0;; i++) {
-    memset(&format, 0, sizeof(format));
-    format.index = i;
-    format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-
-    if (ioctl(video_fd, VIDIOC_ENUM_FMT, &format) < 0) {
-      break; /* end of enumeration */
-    }
+static void check_devices_changed() {
+  U8 buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t length;
 
-    debug("=======================================");
-    debug("index:       %u", format.index);
-    debug("type:        %d", format.type);
-    debug("flags:       %08x", format.flags);
-    debug("description: %s", format.description);
-    debug("pixelformat: %d", format.pixelformat);
-
-    switch (format.pixelformat) {
-      case V4L2_PIX_FMT_MJPEG:
-      case V4L2_PIX_FMT_JPEG:
-      case V4L2_PIX_FMT_MPEG:
-      case V4L2_PIX_FMT_H264:
-      case V4L2_PIX_FMT_H264_NO_SC:
-      case V4L2_PIX_FMT_H264_MVC:
-      case V4L2_PIX_FMT_MPEG1:
-      case V4L2_PIX_FMT_MPEG2:
-      case V4L2_PIX_FMT_MPEG2_SLICE:
-      case V4L2_PIX_FMT_MPEG4:
-      case V4L2_PIX_FMT_VP8:
-      case V4L2_PIX_FMT_VP9:
-      case V4L2_PIX_FMT_HEVC:
-      case V4L2_PIX_FMT_FWHT:
-      case V4L2_PIX_FMT_FWHT_STATELESS:
-        check_result = MPP_TRUE;
-        break;
-      default:
-        debug("pixelformat(%u) is not supported", format.pixelformat);
-        break;
-    }
+  if (nInotifyFd < 0) {
+    bDevicesValid = MPP_FALSE;
+    return;
   }
 
-  for (S32 i = 0;; i++) {
-    memset(&format, 0, sizeof(format));
-    format.index = i;
-    format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-
-    if (ioctl(video_fd, VIDIOC_ENUM_FMT, &format) < 0) {
-      break; /* end of enumeration */
-    }
-
-    debug("=======================================");
-    debug("index:       %u", format.index);
-    debug("type:        %d", format.type);
-    debug("flags:       %08x", format.flags);
-    debug("description: %s", format.description);
-    debug("pixelformat: %d", format.pixelformat);
-
-    switch (format.pixelformat) {
-      case V4L2_PIX_FMT_MJPEG:
-      case V4L2_PIX_FMT_JPEG:
-      case V4L2_PIX_FMT_MPEG:
-      case V4L2_PIX_FMT_H264:
-      case V4L2_PIX_FMT_H264_NO_SC:
-      case V4L2_PIX_FMT_H264_MVC:
-      case V4L2_PIX_FMT_MPEG1:
-      case V4L2_PIX_FMT_MPEG2:
-      case V4L2_PIX_FMT_MPEG2_SLICE:
-      case V4L2_PIX_FMT_MPEG4:
-      case V4L2_PIX_FMT_VP8:
-      case V4L2_PIX_FMT_VP9:
-      case V4L2_PIX_FMT_HEVC:
-      case V4L2_PIX_FMT_FWHT:
-      case V4L2_PIX_FMT_FWHT_STATELESS:
-        check_result = MPP_TRUE;
-        break;
-      default:
-        debug("pixelformat(%u) is not supported", format.pixelformat);
-        break;
+  while ((length = read(nInotifyFd, buffer, sizeof(buffer))) > 0) {
+    for (U8 *p = buffer; p < buffer + length;) {
+      struct inotify_event *event = (struct inotify_event *)p;
+      if (event->len && !strncmp(event->name, "video", 5)) {
+        debug("'/dev/%s' changed, probe V4L2 devices again", event->name);
+        bDevicesValid = MPP_FALSE;
+      }
+      p += sizeof(struct inotify_event) + event->len;
     }
   }
-
-  debug("================= check input is stream finish! result = %d",
-        check_result);
-  return check_result;
 }
 
 /**
- * @description: check whether the V4L2 input is frame(YUV)
- * @param {S32} video_fd : the opened device fd
- * @return {*}
+ * @description: make the table valid, called with stDeviceMutex held
  */
-BOOL check_input_is_frame(S32 video_fd) {
-  BOOL check_result = MPP_FALSE;
-  struct v4l2_fmtdesc format;
+static void update_devices() {
+  watch_devices();
+  check_devices_changed();
+  if (bDevicesValid) return;
 
-  debug("check_input_is_frame");
+  nDeviceNum = 0;
+  for (S32 i = 0; i < MAX_VIDEO_NODE_NUM; i++) {
+    if (nDeviceNum < MPP_V4L2_MAX_DEVICE_NUM &&
+        probe_device(i, &stDevices[nDeviceNum]))
+      nDeviceNum++;
+  }
+  bDevicesValid = MPP_TRUE;
+  debug("probe V4L2 devices finish, %d found", nDeviceNum);
+}
 
-  for (S32 i = 0;; i++) {
-    memset(&format, 0, sizeof(format));
-    format.index = i;
-    format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+S32 mpp_v4l2_get_device_num() {
+  S32 num;
 
-    if (ioctl(video_fd, VIDIOC_ENUM_FMT, &format) < 0) {
-      break; /* end of enumeration */
-    }
+  pthread_mutex_lock(&stDeviceMutex);
+  update_devices();
+  num = nDeviceNum;
+  pthread_mutex_unlock(&stDeviceMutex);
 
-    debug("index:       %u", format.index);
-    debug("type:        %d", format.type);
-    debug("flags:       %08x", format.flags);
-    debug("description: %s", format.description);
-    debug("pixelformat: %d", format.pixelformat);
-
-    switch (format.pixelformat) {
-      case V4L2_PIX_FMT_NV12:
-      case V4L2_PIX_FMT_NV21:
-      case V4L2_PIX_FMT_YUV420:
-      case V4L2_PIX_FMT_YVU420:
-        check_result = MPP_TRUE;
-        break;
-      default:
-        break;
-    }
-  }
+  return num;
+}
 
-  for (S32 i = 0;; i++) {
-    memset(&format, 0, sizeof(format));
-    format.index = i;
-    format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+S32 mpp_v4l2_get_device_info(S32 index, V4l2DeviceInfo *info) {
+  S32 ret = MPP_OK;
 
-    if (ioctl(video_fd, VIDIOC_ENUM_FMT, &format) < 0) {
-      break; /* end of enumeration */
-    }
+  if (!info) return MPP_NULL_POINTER;
 
-    debug("index:       %u", format.index);
-    debug("type:        %d", format.type);
-    debug("flags:       %08x", format.flags);
-    debug("description: %s", format.description);
-    debug("pixelformat: %d", format.pixelformat);
-
-    switch (format.pixelformat) {
-      case V4L2_PIX_FMT_NV12:
-      case V4L2_PIX_FMT_NV21:
-      case V4L2_PIX_FMT_YUV420:
-      case V4L2_PIX_FMT_YVU420:
-        check_result = MPP_TRUE;
-        break;
-      default:
-        break;
-    }
-  }
+  pthread_mutex_lock(&stDeviceMutex);
+  update_devices();
+  if (index >= 0 && index < nDeviceNum)
+    memcpy(info, &stDevices[index], sizeof(V4l2DeviceInfo));
+  else
+    ret = MPP_CHECK_FAILED;
+  pthread_mutex_unlock(&stDeviceMutex);
 
-  debug("================= check input is frame finish! result = %d",
-        check_result);
-  return check_result;
+  return ret;
+}
+
+void mpp_v4l2_invalidate_devices() {
+  pthread_mutex_lock(&stDeviceMutex);
+  bDevicesValid = MPP_FALSE;
+  pthread_mutex_unlock(&stDeviceMutex);
 }
 
 /**
- * @description: check if V4L2 support the input format wo need
- * @param {S32} video_fd : input, the opened device fd
- * @param {U32} fmt : input, the format we need
- * @return {*}
+ * @description: is there a device for the check in the table
+ * @param {BOOL} (*check) : input, is_decoder or is_encoder
+ * @param {U32} fourcc : input, the stream format, 0 if any
+ * @param {S32} start : input, the first index of the table to look at
+ * @param {U8*} device_path : output, the path of the device found
+ * @return {S32} : the index of the device, -1 if none
  */
-BOOL check_input_format(S32 video_fd, U32 fmt) {
-  BOOL check_result = MPP_FALSE;
-  struct v4l2_fmtdesc format;
-
-  debug("check input format! fmt = %d", fmt);
-
-  for (S32 i = 0;; i++) {
-    memset(&format, 0, sizeof(format));
-    format.index = i;
-    format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-
-    if (ioctl(video_fd, VIDIOC_ENUM_FMT, &format) < 0) {
-      break; /* end of enumeration */
+static S32 lookup_device(BOOL (*check)(const V4l2DeviceInfo *, U32),
+                         U32 fourcc, S32 start, U8 *device_path) {
+  S32 index = -1;
+
+  pthread_mutex_lock(&stDeviceMutex);
+  update_devices();
+  for (S32 i = start; i < nDeviceNum; i++) {
+    if (check(&stDevices[i], fourcc)) {
+      if (device_path) strcpy(device_path, stDevices[i].sDevicePath);
+      index = i;
+      break;
     }
-
-    debug("=================================");
-    debug("index:       %u", format.index);
-    debug("type:        %d", format.type);
-    debug("flags:       %08x", format.flags);
-    debug("description: %s", format.description);
-    debug("pixelformat: %d", format.pixelformat);
-
-    if (fmt == format.pixelformat) check_result = MPP_TRUE;
   }
+  pthread_mutex_unlock(&stDeviceMutex);
 
-  for (S32 i = 0;; i++) {
-    memset(&format, 0, sizeof(format));
-    format.index = i;
-    format.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-
-    if (ioctl(video_fd, VIDIOC_ENUM_FMT, &format) < 0) {
-      break; /* end of enumeration */
-    }
-
-    debug("=================================");
-    debug("index:       %u", format.index);
-    debug("type:        %d", format.type);
-    debug("flags:       %08x", format.flags);
-    debug("description: %s", format.description);
-    debug("pixelformat: %d", format.pixelformat);
-
-    if (fmt == format.pixelformat) check_result = MPP_TRUE;
-  }
+  return index;
+}
 
-  debug("check input format finish! result = %d", check_result);
-  return check_result;
+static BOOL is_codec(const V4l2DeviceInfo *info, U32 fourcc) {
+  return is_decoder(info, fourcc) || is_encoder(info, fourcc);
 }
 
 /**
@@ -489,65 +384,7 @@ BOOL check_input_format(S32 video_fd, U32 fmt) {
  * @return {*}
  */
 BOOL check_v4l2() {
-  S32 video_fd = -1;
-  struct v4l2_capability vcap;
-  struct v4l2_fmtdesc format;
-  U32 device_caps;
-
-  debug("Start probing devices");
-
-  for (S32 i = 0; i < MAX_VIDEO_NODE_NUM; i++) {
-    if (video_fd >= 0) {
-      close(video_fd);
-      video_fd = -1;
-    }
-
-    U8 path_base[12] = "/dev/video";
-    U8 device_path[20];
-    sprintf(device_path, "%s%d", path_base, i);
-    debug("Now open '%s' and check it!", device_path);
-
-    video_fd = open(device_path, O_RDWR | O_CLOEXEC);
-
-    if (video_fd == -1) {
-      error("Can not open '%s', please check it! (%s)", device_path,
-            strerror(errno));
-      continue;
-    }
-
-    memset(&vcap, 0, sizeof(vcap));
-
-    if (ioctl(video_fd, VIDIOC_QUERYCAP, &vcap) < 0) {
-      error("Can not get device capabilities, please check it ! (%s)",
-            strerror(errno));
-      continue;
-    }
-
-    if (vcap.capabilities & V4L2_CAP_DEVICE_CAPS) {
-      device_caps = vcap.device_caps;
-    } else {
-      device_caps = vcap.capabilities;
-    }
-
-    if (!V4L2_IS_M2M(device_caps)) {
-      continue;
-    }
-
-    debug("Probing '%s' located at '%s'", (const U8 *)vcap.driver, device_path);
-
-    if ((check_input_is_stream(video_fd) && check_output_is_frame(video_fd)) ||
-        (check_input_is_frame(video_fd) && check_output_is_stream(video_fd))) {
-      close(video_fd);
-      video_fd = -1;
-      return MPP_TRUE;
-    }
-  }
-
-  if (video_fd >= 0) {
-    close(video_fd);
-    video_fd = -1;
-  }
-  return MPP_FALSE;
+  return lookup_device(is_codec, 0, 0, NULL) >= 0 ? MPP_TRUE : MPP_FALSE;
 }
 
 /**
@@ -555,69 +392,53 @@ BOOL check_v4l2() {
  * V5V7, module.c use it, if there is V4L2 codec, dlopen the V4L2 codec library.
  * @return {*}
  */
-BOOL check_v4l2_linlonv5v7() {
-  S32 video_fd = -1;
-  struct v4l2_capability vcap;
-  struct v4l2_fmtdesc format;
-  U32 device_caps;
-
-  debug("check_v4l2_linlonv5v7");
-
-  for (S32 i = 0; i < MAX_VIDEO_NODE_NUM; i++) {
-    if (video_fd >= 0) {
-      close(video_fd);
-      video_fd = -1;
-    }
+BOOL check_v4l2_linlonv5v7() { return check_v4l2(); }
 
-    U8 path_base[12] = "/dev/video";
-    U8 device_path[20];
-    sprintf(device_path, "%s%d", path_base, i);
-    debug("Now open '%s' and check it!", device_path);
-
-    video_fd = open(device_path, O_RDWR | O_CLOEXEC);
-
-    if (video_fd == -1) {
-      error("Can not open '%s', please check it! (%s)", device_path,
-            strerror(errno));
-      continue;
-    }
-
-    memset(&vcap, 0, sizeof(vcap));
+/**
+ * @description: is there a device of the driver in the table that passes
+ * check
+ */
+static BOOL has_device(BOOL (*check)(const V4l2DeviceInfo *, U32), U32 fourcc,
+                       const U8 *driver) {
+  V4l2DeviceInfo info;
+
+  for (S32 i = lookup_device(check, fourcc, 0, NULL); i >= 0;
+       i = lookup_device(check, fourcc, i + 1, NULL)) {
+    if (!driver) return MPP_TRUE;
+    if (MPP_OK == mpp_v4l2_get_device_info(i, &info) &&
+        !strcmp(info.sDriver, driver))
+      return MPP_TRUE;
+  }
 
-    if (ioctl(video_fd, VIDIOC_QUERYCAP, &vcap) < 0) {
-      error("Can not get device capabilities, please check it ! (%s)",
-            strerror(errno));
-      continue;
-    }
+  return MPP_FALSE;
+}
 
-    debug("driver = (%s)", vcap.driver);
+BOOL has_v4l2_decoder(const U8 *driver, S32 coding_type) {
+  return has_device(is_decoder, coding_type, driver);
+}
 
-    if (vcap.capabilities & V4L2_CAP_DEVICE_CAPS) {
-      device_caps = vcap.device_caps;
-    } else {
-      device_caps = vcap.capabilities;
-    }
+BOOL has_v4l2_encoder(const U8 *driver, S32 coding_type) {
+  return has_device(is_encoder, coding_type, driver);
+}
 
-    if (!V4L2_IS_M2M(device_caps)) {
-      error("device is not a M2M device!");
-      continue;
-    }
+/**
+ * @description: open the first device of the table that passes check, a
+ * device that can not be opened any more is skipped
+ */
+static S32 open_device(BOOL (*check)(const V4l2DeviceInfo *, U32), U32 fourcc,
+                       U8 *device_path) {
+  S32 video_fd = -1;
 
-    debug("Probing '%s' located at '%s'", (const U8 *)vcap.driver, device_path);
+  for (S32 i = lookup_device(check, fourcc, 0, device_path); i >= 0;
+       i = lookup_device(check, fourcc, i + 1, device_path)) {
+    video_fd = open(device_path, O_RDWR | O_CLOEXEC);
+    if (video_fd >= 0) return video_fd;
 
-    if ((check_input_is_stream(video_fd) && check_output_is_frame(video_fd)) ||
-        (check_input_is_frame(video_fd) && check_output_is_stream(video_fd))) {
-      close(video_fd);
-      video_fd = -1;
-      return MPP_TRUE;
-    }
+    error("can not open '%s', please check it! (%s)", device_path,
+          strerror(errno));
   }
 
-  if (video_fd >= 0) {
-    close(video_fd);
-    video_fd = -1;
-  }
-  return MPP_FALSE;
+  return -1;
 }
 
 /**
@@ -627,61 +448,8 @@ BOOL check_v4l2_linlonv5v7() {
  * @return {S32} : video device fd
  */
 S32 find_v4l2_decoder(U8 *device_path, S32 coding_type) {
-  S32 video_fd = -1;
-  struct v4l2_capability vcap;
-  struct v4l2_fmtdesc format;
-  U32 device_caps;
-  U8 path_base[12] = "/dev/video";
-
   debug("find V4L2 Decoder");
-
-  for (S32 i = 0; i < MAX_VIDEO_NODE_NUM; i++) {
-    if (video_fd >= 0) {
-      close(video_fd);
-      video_fd = -1;
-    }
-
-    sprintf(device_path, "%s%d", path_base, i);
-    debug("now open '%s' and check it!", device_path);
-    video_fd = open(device_path, O_RDWR | O_CLOEXEC);
-
-    if (video_fd == -1) {
-      error("can not open '%s', please check it! (%s)", device_path,
-            strerror(errno));
-      continue;
-    }
-
-    memset(&vcap, 0, sizeof(vcap));
-
-    if (ioctl(video_fd, VIDIOC_QUERYCAP, &vcap) < 0) {
-      error("can not get device capabilities, please check it ! (%s)",
-            strerror(errno));
-      continue;
-    }
-
-    debug("v4l2_capability.capabilities = %u, v4l2_capability.device_caps = %u",
-          vcap.capabilities, vcap.device_caps);
-
-    if (vcap.capabilities & V4L2_CAP_DEVICE_CAPS) {
-      device_caps = vcap.device_caps;
-    } else {
-      device_caps = vcap.capabilities;
-    }
-
-    if (!V4L2_IS_M2M(device_caps)) {
-      error("device is not a M2M device!");
-      continue;
-    }
-
-    debug("Probing '%s' located at '%s'", (const U8 *)vcap.driver, device_path);
-
-    if (check_input_is_stream(video_fd) && check_output_is_frame(video_fd) &&
-        check_input_format(video_fd, coding_type)) {
-      return video_fd;
-    }
-  }
-
-  return -1;
+  return open_device(is_decoder, coding_type, device_path);
 }
 
 /**
@@ -691,57 +459,8 @@ S32 find_v4l2_decoder(U8 *device_path, S32 coding_type) {
  * @return {S32} : video device fd
  */
 S32 find_v4l2_encoder(U8 *device_path, S32 coding_type) {
-  S32 video_fd = -1;
-  struct v4l2_capability vcap;
-  struct v4l2_fmtdesc format;
-  U32 device_caps;
-  U8 path_base[12] = "/dev/video";
-
-  debug("find V4L2 Decoder");
-
-  for (S32 i = 0; i < MAX_VIDEO_NODE_NUM; i++) {
-    if (video_fd >= 0) {
-      close(video_fd);
-      video_fd = -1;
-    }
-
-    sprintf(device_path, "%s%d", path_base, i);
-    debug("now open '%s' and check it!", device_path);
-    video_fd = open(device_path, O_RDWR | O_CLOEXEC);
-
-    if (video_fd == -1) {
-      error("can not open '%s', please check it! (%s)", device_path,
-            strerror(errno));
-      continue;
-    }
-
-    memset(&vcap, 0, sizeof(vcap));
-
-    if (ioctl(video_fd, VIDIOC_QUERYCAP, &vcap) < 0) {
-      error("can not get device capabilities, please check it ! (%s)",
-            strerror(errno));
-      continue;
-    }
-
-    if (vcap.capabilities & V4L2_CAP_DEVICE_CAPS) {
-      device_caps = vcap.device_caps;
-    } else {
-      device_caps = vcap.capabilities;
-    }
-
-    if (!V4L2_IS_M2M(device_caps)) {
-      continue;
-    }
-
-    debug("Probing '%s' located at '%s'", (const U8 *)vcap.driver, device_path);
-
-    if (check_input_is_frame(video_fd) && check_output_is_stream(video_fd) &&
-        check_output_format(video_fd, coding_type)) {
-      return video_fd;
-    }
-  }
-
-  return -1;
+  debug("find V4L2 Encoder");
+  return open_device(is_encoder, coding_type, device_path);
 }
 
 /**